@@ -736,6 +736,7 @@ fi
 case "$TARGET_OS" in
     linux-*)
         echo "#define CONFIG_SIGNALFD       1" >> $config_h
+        echo "#define CONFIG_LINUX_AIO      1" >> $config_h
         ;;
 esac
 
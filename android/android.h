@@ -28,6 +28,10 @@ extern double   qemu_net_download_speed;
 extern int      qemu_net_min_latency;
 extern int      qemu_net_max_latency;
 
+/* emulated network jitter, expressed in ms, and packet loss in percent */
+extern int      qemu_net_jitter;
+extern double   qemu_net_loss;
+
 /* global flag, when true, network is disabled */
 extern int      qemu_net_disable;
 
@@ -10,7 +10,8 @@
 ** GNU General Public License for more details.
 */
 #include "sysemu/char.h"
-#include "android/cbuffer.h"
+#include "android/charpipe.h"
+#include "android/utils/char_queue.h"
 #include "android/qemu-debug.h"
 
 #define  xxDEBUG
@@ -26,230 +27,194 @@
  * between two QEMU character drivers that merge well into the
  * QEMU event loop.
  *
- * each half of the channel has its own object and buffer, and
- * we implement communication through charpipe_poll() which
- * must be called by the main event loop after its call to select()
- *
+ * each half of the channel has its own object and CharQueue: what is
+ * written to a half goes straight to the read handler of its peer when
+ * the latter can accept it, and is buffered otherwise. buffering puts
+ * the half on a pending list and schedules a bottom half to flush it.
+ * charpipe_poll(), called by the main event loop after its call to
+ * select(), only retries the pending halves, so idle pipes cost nothing.
  */
 
-#define  BIP_BUFFER_SIZE  512
-
-typedef struct BipBuffer {
-    struct BipBuffer*  next;
-    CBuffer            cb[1];
-    char               buff[ BIP_BUFFER_SIZE ];
-} BipBuffer;
+static CharQueueSet  _charpipe_set[1];    /* pending charpipe halves */
+static CharQueueSet  _charbuffer_set[1];  /* pending charbuffers */
+static int           _charpipe_sets_inited;
+static QEMUBH*       _charpipe_bh;
 
-static BipBuffer*  _free_bip_buffers;
+static void
+charpipe_bh( void*  opaque )
+{
+    charpipe_poll();
+}
 
-static BipBuffer*
-bip_buffer_alloc( void )
+/* called when a charpipe half or charbuffer starts buffering data */
+static void
+charpipe_notify( void*  opaque )
 {
-    BipBuffer*  bip = _free_bip_buffers;
-    if (bip != NULL) {
-        _free_bip_buffers = bip->next;
-    } else {
-        bip = malloc( sizeof(*bip) );
-        if (bip == NULL) {
-            derror( "%s: not enough memory", __FUNCTION__ );
-            exit(1);
-        }
-    }
-    bip->next = NULL;
-    cbuffer_reset( bip->cb, bip->buff, sizeof(bip->buff) );
-    return bip;
+    if (_charpipe_bh == NULL)
+        _charpipe_bh = qemu_bh_new( charpipe_bh, NULL );
+
+    qemu_bh_schedule( _charpipe_bh );
 }
 
 static void
-bip_buffer_free( BipBuffer*  bip )
+charpipe_init_sets( void )
 {
-    bip->next         = _free_bip_buffers;
-    _free_bip_buffers = bip;
+    if (_charpipe_sets_inited)
+        return;
+
+    charQueueSet_init( _charpipe_set, charpipe_notify, NULL );
+    charQueueSet_init( _charbuffer_set, charpipe_notify, NULL );
+    _charpipe_sets_inited = 1;
 }
 
 /* this models each half of the charpipe */
 typedef struct CharPipeHalf {
-    CharDriverState       cs[1];
-    BipBuffer*            bip_first;
-    BipBuffer*            bip_last;
+    CharDriverState       cs[1];        /* first, freed by qemu_chr_close() */
+    CharQueue             queue[1];     /* data written to this half */
     struct CharPipeHalf*  peer;         /* NULL if closed */
+    struct CharPipeHalf*  next;         /* in _s_charpipes */
+    int                   id;
+    char                  side;         /* 'a' or 'b' */
 } CharPipeHalf;
 
+static CharPipeHalf*   _s_charpipes;
+static CharPipeHalf**  _s_charpipes_tail = &_s_charpipes;
+static int             _s_charpipes_count;
 
 
 static void
 charpipehalf_close( CharDriverState*  cs )
 {
-    CharPipeHalf*  ph = cs->opaque;
+    CharPipeHalf*   ph   = cs->opaque;
+    CharPipeHalf*   peer = ph->peer;
+    CharPipeHalf**  pnode;
+
+    charQueue_done(ph->queue);
 
-    while (ph->bip_first) {
-        BipBuffer*  bip = ph->bip_first;
-        ph->bip_first = bip->next;
-        bip_buffer_free(bip);
+    /* nobody is left to read what the peer buffered */
+    if (peer != NULL) {
+        charQueue_done(peer->queue);
+        peer->peer = NULL;
+    }
+    ph->peer = NULL;
+
+    for (pnode = &_s_charpipes; *pnode != NULL; pnode = &(*pnode)->next) {
+        if (*pnode == ph) {
+            *pnode = ph->next;
+            if (_s_charpipes_tail == &ph->next)
+                _s_charpipes_tail = pnode;
+            break;
+        }
     }
-    ph->bip_last    = NULL;
-    ph->peer        = NULL;
 }
 
 
+/* CharQueue callback, pass data written to ph to the peer's read handler */
 static int
-charpipehalf_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
+charpipehalf_send( void*  opaque, const uint8_t*  buf, int  len )
 {
-    CharPipeHalf*  ph   = cs->opaque;
+    CharPipeHalf*  ph   = opaque;
     CharPipeHalf*  peer = ph->peer;
-    BipBuffer*     bip  = ph->bip_last;
-    int            ret  = 0;
 
-    D("%s: writing %d bytes to %p: '%s'", __FUNCTION__,
-      len, ph, quote_bytes( buf, len ));
-
-    if (bip == NULL && peer != NULL && peer->cs->chr_read != NULL) {
-        /* no buffered data, try to write directly to the peer */
-        while (len > 0) {
-            int  size;
-
-            if (peer->cs->chr_can_read) {
-                size = qemu_chr_can_read( peer->cs );
-                if (size == 0)
-                    break;
-
-                if (size > len)
-                    size = len;
-            } else
-                size = len;
-
-            qemu_chr_read( peer->cs, (uint8_t*)buf, size );
-            buf += size;
-            len -= size;
-            ret += size;
-        }
-    }
+    if (peer == NULL || peer->cs->chr_read == NULL)
+        return 0;
 
-    if (len == 0)
-        return ret;
+    if (peer->cs->chr_can_read) {
+        int  size = qemu_chr_can_read( peer->cs );
+        if (size <= 0)
+            return 0;
 
-    /* buffer the remaining data */
-    if (bip == NULL) {
-        bip = bip_buffer_alloc();
-        ph->bip_first = ph->bip_last = bip;
+        if (len > size)
+            len = size;
     }
 
-    while (len > 0) {
-        int  len2 = cbuffer_write( bip->cb, buf, len );
+    D("%s: sending %d bytes from %p: '%s'", __FUNCTION__,
+      len, ph, quote_bytes( (const char*)buf, len ));
 
-        buf += len2;
-        ret += len2;
-        len -= len2;
-        if (len == 0)
-            break;
-
-        /* ok, we need another buffer */
-        ph->bip_last = bip_buffer_alloc();
-        bip->next = ph->bip_last;
-        bip       = ph->bip_last;
-    }
-    return  ret;
+    qemu_chr_read( peer->cs, (uint8_t*)buf, len );
+    return len;
 }
 
 
-static void
-charpipehalf_poll( CharPipeHalf*  ph )
+static int
+charpipehalf_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
 {
-    CharPipeHalf*   peer = ph->peer;
-    int             size;
+    CharPipeHalf*  ph = cs->opaque;
 
-    if (peer == NULL || peer->cs->chr_read == NULL)
-        return;
+    D("%s: writing %d bytes to %p: '%s'", __FUNCTION__,
+      len, ph, quote_bytes( (const char*)buf, len ));
 
-    while (1) {
-        BipBuffer*  bip = ph->bip_first;
-        uint8_t*    base;
-        int         avail;
+    /* the peer was closed, nobody will ever read this */
+    if (ph->peer == NULL)
+        return len;
 
-        if (bip == NULL)
-            break;
+    return charQueue_write( ph->queue, buf, len );
+}
 
-        size = cbuffer_read_avail(bip->cb);
-        if (size == 0) {
-            ph->bip_first = bip->next;
-            if (ph->bip_first == NULL)
-                ph->bip_last = NULL;
-            bip_buffer_free(bip);
-            continue;
-        }
 
-        if (ph->cs->chr_can_read) {
-            int  size2 = qemu_chr_can_read(peer->cs);
+/* return 1 iff flushing ph would send data to the peer */
+static int
+charpipehalf_can_poll( CharPipeHalf*  ph )
+{
+    CharPipeHalf*  peer = ph->peer;
 
-            if (size2 == 0)
-                break;
+    if (peer == NULL || peer->cs->chr_read == NULL)
+        return 0;
 
-            if (size > size2)
-                size = size2;
-        }
+    if (peer->cs->chr_can_read && qemu_chr_can_read(peer->cs) == 0)
+        return 0;
 
-        avail = cbuffer_read_peek( bip->cb, &base );
-        if (avail > size)
-            avail = size;
-        D("%s: sending %d bytes from %p: '%s'", __FUNCTION__,
-            avail, ph, quote_bytes( base, avail ));
+    return 1;
+}
 
-        qemu_chr_read( peer->cs, base, avail );
-        cbuffer_read_step( bip->cb, avail );
-    }
+
+/* called by the user of ph when it can read again */
+static void
+charpipehalf_accept_input( CharDriverState*  cs )
+{
+    CharPipeHalf*  ph = cs->opaque;
+
+    if (ph->peer != NULL && charQueue_count(ph->peer->queue) > 0)
+        charpipe_notify(NULL);
 }
 
 
 static void
-charpipehalf_init( CharPipeHalf*  ph, CharPipeHalf*  peer )
+charpipehalf_init( CharPipeHalf*  ph, CharPipeHalf*  peer, int  id, char  side )
 {
     CharDriverState*  cs = ph->cs;
 
-    ph->bip_first   = NULL;
-    ph->bip_last    = NULL;
+    charQueue_init( ph->queue, _charpipe_set, charpipehalf_send, ph );
     ph->peer        = peer;
+    ph->next        = NULL;
+    ph->id          = id;
+    ph->side        = side;
+
+    *_s_charpipes_tail = ph;
+    _s_charpipes_tail  = &ph->next;
 
     cs->chr_write            = charpipehalf_write;
     cs->chr_ioctl            = NULL;
     cs->chr_send_event       = NULL;
     cs->chr_close            = charpipehalf_close;
+    cs->chr_accept_input     = charpipehalf_accept_input;
     cs->opaque               = ph;
 }
 
 
-typedef struct CharPipeState {
-    CharPipeHalf  a[1];
-    CharPipeHalf  b[1];
-} CharPipeState;
-
-
-
-#define   MAX_CHAR_PIPES   8
-
-static CharPipeState  _s_charpipes[ MAX_CHAR_PIPES ];
-
 int
 qemu_chr_open_charpipe( CharDriverState*  *pfirst, CharDriverState*  *psecond )
 {
-    CharPipeState*  cp     = _s_charpipes;
-    CharPipeState*  cp_end = cp + MAX_CHAR_PIPES;
+    CharPipeHalf*  a = g_malloc0( sizeof(*a) );
+    CharPipeHalf*  b = g_malloc0( sizeof(*b) );
+    int            id = _s_charpipes_count++;
 
-    for ( ; cp < cp_end; cp++ ) {
-        if ( cp->a->peer == NULL && cp->b->peer == NULL )
-            break;
-    }
+    charpipe_init_sets();
+    charpipehalf_init( a, b, id, 'a' );
+    charpipehalf_init( b, a, id, 'b' );
 
-    if (cp == cp_end) {  /* can't allocate one */
-        *pfirst  = NULL;
-        *psecond = NULL;
-        return -1;
-    }
-
-    charpipehalf_init( cp->a, cp->b );
-    charpipehalf_init( cp->b, cp->a );
-
-    *pfirst  = cp->a->cs;
-    *psecond = cp->b->cs;
+    *pfirst  = a->cs;
+    *psecond = b->cs;
     return 0;
 }
 
@@ -263,123 +228,63 @@ qemu_chr_open_charpipe( CharDriverState*  *pfirst, CharDriverState*  *psecond )
  **/
 
 typedef struct CharBuffer {
-    CharDriverState  cs[1];
-    BipBuffer*       bip_first;
-    BipBuffer*       bip_last;
-    CharDriverState* endpoint;  /* NULL if closed */
-    char             closing;
+    CharDriverState     cs[1];      /* first, freed by qemu_chr_close() */
+    CharQueue           queue[1];
+    CharDriverState*    endpoint;   /* NULL if closed */
+    struct CharBuffer*  next;       /* in _s_charbuffers */
+    int                 id;
 } CharBuffer;
 
+static CharBuffer*   _s_charbuffers;
+static CharBuffer**  _s_charbuffers_tail = &_s_charbuffers;
+static int           _s_charbuffers_count;
+
 
 static void
 charbuffer_close( CharDriverState*  cs )
 {
-    CharBuffer*  cbuf = cs->opaque;
+    CharBuffer*   cbuf = cs->opaque;
+    CharBuffer**  pnode;
 
-    while (cbuf->bip_first) {
-        BipBuffer*  bip = cbuf->bip_first;
-        cbuf->bip_first = bip->next;
-        bip_buffer_free(bip);
-    }
-    cbuf->bip_last = NULL;
+    charQueue_done(cbuf->queue);
     cbuf->endpoint = NULL;
 
     if (cbuf->endpoint != NULL) {
         qemu_chr_close(cbuf->endpoint);
         cbuf->endpoint = NULL;
     }
-}
-
-static int
-charbuffer_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
-{
-    CharBuffer*       cbuf = cs->opaque;
-    CharDriverState*  peer = cbuf->endpoint;
-    BipBuffer*        bip  = cbuf->bip_last;
-    int               ret  = 0;
-
-    D("%s: writing %d bytes to %p: '%s'", __FUNCTION__,
-      len, cbuf, quote_bytes( buf, len ));
-
-    if (bip == NULL && peer != NULL) {
-        /* no buffered data, try to write directly to the peer */
-        int  size = qemu_chr_write(peer, buf, len);
-
-        if (size < 0)  /* just to be safe */
-            size = 0;
-        else if (size > len)
-            size = len;
-
-        buf += size;
-        ret += size;
-        len -= size;
-    }
-
-    if (len == 0)
-        return ret;
-
-    /* buffer the remaining data */
-    if (bip == NULL) {
-        bip = bip_buffer_alloc();
-        cbuf->bip_first = cbuf->bip_last = bip;
-    }
-
-    while (len > 0) {
-        int  len2 = cbuffer_write( bip->cb, buf, len );
 
-        buf += len2;
-        ret += len2;
-        len -= len2;
-        if (len == 0)
+    for (pnode = &_s_charbuffers; *pnode != NULL; pnode = &(*pnode)->next) {
+        if (*pnode == cbuf) {
+            *pnode = cbuf->next;
+            if (_s_charbuffers_tail == &cbuf->next)
+                _s_charbuffers_tail = pnode;
             break;
-
-        /* ok, we need another buffer */
-        cbuf->bip_last = bip_buffer_alloc();
-        bip->next = cbuf->bip_last;
-        bip       = cbuf->bip_last;
+        }
     }
-    return  ret;
 }
 
-
-static void
-charbuffer_poll( CharBuffer*  cbuf )
+/* CharQueue callback, pass data to the endpoint */
+static int
+charbuffer_send( void*  opaque, const uint8_t*  buf, int  len )
 {
-    CharDriverState*  peer = cbuf->endpoint;
+    CharBuffer*  cbuf = opaque;
 
-    if (peer == NULL)
-        return;
+    if (cbuf->endpoint == NULL)
+        return 0;
 
-    while (1) {
-        BipBuffer*  bip = cbuf->bip_first;
-        uint8_t*    base;
-        int         avail;
-        int         size;
-
-        if (bip == NULL)
-            break;
-
-        avail = cbuffer_read_peek( bip->cb, &base );
-        if (avail == 0) {
-            cbuf->bip_first = bip->next;
-            if (cbuf->bip_first == NULL)
-                cbuf->bip_last = NULL;
-            bip_buffer_free(bip);
-            continue;
-        }
-
-        size = qemu_chr_write( peer, base, avail );
+    return qemu_chr_write( cbuf->endpoint, buf, len );
+}
 
-        if (size < 0)  /* just to be safe */
-            size = 0;
-        else if (size > avail)
-            size = avail;
+static int
+charbuffer_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
+{
+    CharBuffer*  cbuf = cs->opaque;
 
-        cbuffer_read_step( bip->cb, size );
+    D("%s: writing %d bytes to %p: '%s'", __FUNCTION__,
+      len, cbuf, quote_bytes( (const char*)buf, len ));
 
-        if (size < avail)
-            break;
-    }
+    return charQueue_write( cbuf->queue, buf, len );
 }
 
 
@@ -401,9 +306,13 @@ charbuffer_init( CharBuffer*  cbuf, CharDriverState*  endpoint )
 {
     CharDriverState*  cs = cbuf->cs;
 
-    cbuf->bip_first   = NULL;
-    cbuf->bip_last    = NULL;
+    charQueue_init( cbuf->queue, _charbuffer_set, charbuffer_send, cbuf );
     cbuf->endpoint    = endpoint;
+    cbuf->next        = NULL;
+    cbuf->id          = _s_charbuffers_count++;
+
+    *_s_charbuffers_tail = cbuf;
+    _s_charbuffers_tail  = &cbuf->next;
 
     cs->chr_write               = charbuffer_write;
     cs->chr_ioctl               = NULL;
@@ -413,27 +322,16 @@ charbuffer_init( CharBuffer*  cbuf, CharDriverState*  endpoint )
     cs->opaque                  = cbuf;
 }
 
-#define MAX_CHAR_BUFFERS  8
-
-static CharBuffer  _s_charbuffers[ MAX_CHAR_BUFFERS ];
-
 CharDriverState*
 qemu_chr_open_buffer( CharDriverState*  endpoint )
 {
-    CharBuffer*  cbuf     = _s_charbuffers;
-    CharBuffer*  cbuf_end = cbuf + MAX_CHAR_BUFFERS;
+    CharBuffer*  cbuf;
 
     if (endpoint == NULL)
         return NULL;
 
-    for ( ; cbuf < cbuf_end; cbuf++ ) {
-        if (cbuf->endpoint == NULL)
-            break;
-    }
-
-    if (cbuf == cbuf_end)
-        return NULL;
-
+    charpipe_init_sets();
+    cbuf = g_malloc0( sizeof(*cbuf) );
     charbuffer_init(cbuf, endpoint);
     return cbuf->cs;
 }
@@ -442,28 +340,61 @@ qemu_chr_open_buffer( CharDriverState*  endpoint )
 void
 charpipe_poll( void )
 {
-    CharPipeState*  cp     = _s_charpipes;
-    CharPipeState*  cp_end = cp + MAX_CHAR_PIPES;
+    /* poll the charpipes */
+    if (_charpipe_set->num_pending > 0)
+        charQueueSet_poll(_charpipe_set);
 
-    CharBuffer*     cb     = _s_charbuffers;
-    CharBuffer*     cb_end = cb + MAX_CHAR_BUFFERS;
+    /* poll the charbuffers */
+    if (_charbuffer_set->num_pending > 0)
+        charQueueSet_poll(_charbuffer_set);
+}
 
-    /* poll the charpipes */
-    for ( ; cp < cp_end; cp++ ) {
-        CharPipeHalf*  half;
+/* how long to wait before trying again to send buffered data to an
+ * endpoint that could not accept all of it, in milliseconds */
+#define  CHARBUFFER_RETRY_MS  10
 
-        half = cp->a;
-        if (half->peer != NULL)
-            charpipehalf_poll(half);
+void
+charpipe_update_timeout( int*  timeout )
+{
+    CharQueue*  queue;
 
-        half = cp->b;
-        if (half->peer != NULL)
-            charpipehalf_poll(half);
+    /* buffered charpipe data can be sent as soon as the peer accepts it */
+    for (queue = _charpipe_set->pending; queue != NULL; queue = queue->next) {
+        if (charpipehalf_can_poll(queue->opaque)) {
+            *timeout = 0;
+            return;
+        }
     }
 
-    /* poll the charbuffers */
-    for ( ; cb < cb_end; cb++ ) {
-        if (cb->endpoint != NULL)
-            charbuffer_poll(cb);
+    /* charbuffers only buffer data after a short write to their endpoint,
+     * there is no way to know when it will accept more */
+    if (_charbuffer_set->num_pending > 0) {
+        if (*timeout > CHARBUFFER_RETRY_MS)
+            *timeout = CHARBUFFER_RETRY_MS;
+    }
+}
+
+int
+charpipe_get_stats( int  index, CharPipeStats*  stats )
+{
+    CharPipeHalf*  ph;
+    CharBuffer*    cbuf;
+
+    for (ph = _s_charpipes; ph != NULL; ph = ph->next) {
+        if (index-- == 0) {
+            snprintf( stats->name, sizeof(stats->name), "pipe%d.%c",
+                      ph->id, ph->side );
+            charQueue_getStats( ph->queue, &stats->queue );
+            return 0;
+        }
+    }
+    for (cbuf = _s_charbuffers; cbuf != NULL; cbuf = cbuf->next) {
+        if (index-- == 0) {
+            snprintf( stats->name, sizeof(stats->name), "buffer%d",
+                      cbuf->id );
+            charQueue_getStats( cbuf->queue, &stats->queue );
+            return 0;
+        }
     }
+    return -1;
 }
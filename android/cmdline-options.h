@@ -82,6 +82,7 @@ OPT_PARAM( snapshot,       "<name>", "name of snapshot within storage file for a
 OPT_FLAG ( no_snapshot,    "perform a full boot and do not do not auto-save, but qemu vmload and vmsave operate on snapstorage" )
 OPT_FLAG ( no_snapshot_save, "do not auto-save to snapshot on exit: abandon changed state" )
 OPT_FLAG ( no_snapshot_load, "do not auto-start from snapshot: perform a full boot" )
+OPT_FLAG ( snapshot_save_background, "auto-save to snapshot from a background process on exit" )
 OPT_FLAG ( snapshot_list,  "show a list of available snapshots" )
 OPT_FLAG ( no_snapshot_update_time, "do not do try to correct snapshot time on restore" )
 OPT_FLAG ( wipe_data, "reset the user data image (copy it from initdata)" )
@@ -136,7 +137,11 @@ OPT_PARAM( report_console, "<socket>", "report console port to remote socket" )
 OPT_PARAM( gps, "<device>", "redirect NMEA GPS to character device" )
 OPT_PARAM( keyset, "<name>", "specify keyset file name" )
 OPT_PARAM( shell_serial, "<device>", "specific character device for root shell" )
-OPT_PARAM( tcpdump, "<file>", "capture network packets to file" )
+OPT_PARAM( tcpdump, "<file>[,options]", "capture network packets to file" )
+OPT_PARAM( guest_profile, "<file>", "profile guest processes, write collapsed stacks to file" )
+OPT_PARAM( timer_slack, "<ms>", "delay timers by up to <ms> milliseconds while the guest is idle" )
+OPT_PARAM( ram_base, "<file>", "share unmodified guest RAM with other instances through a base file" )
+OPT_PARAM( trace_startup, "<file>", "write a timeline of emulator startup phases to file" )
 
 OPT_PARAM( bootchart, "<timeout>", "enable bootcharting")
 
@@ -15,5 +15,6 @@
 #define CONFIG_LINUX   1
 #define CONFIG_POSIX 1
 #define CONFIG_SIGNALFD 1
+#define CONFIG_LINUX_AIO 1
 #define CONFIG_ANDROID       1
 #define CONFIG_MADVISE 1
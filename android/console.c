@@ -26,6 +26,7 @@
 #include "sysemu/sysemu.h"
 #include "android/android.h"
 #include "cpu.h"
+#include "exec/hax.h"
 #include "hw/android/goldfish/device.h"
 #include "hw/power_supply.h"
 #include "android/shaper.h"
@@ -35,11 +36,15 @@
 #include "android/utils/bufprint.h"
 #include "android/utils/debug.h"
 #include "android/utils/eintr_wrapper.h"
+#include "android/utils/hot_profiler.h"
+#include "android/utils/shared_ram.h"
 #include "android/utils/stralloc.h"
+#include "android/utils/trace_ring.h"
 #include "android/config/config.h"
 #include "android/tcpdump.h"
 #include "net/net.h"
 #include "monitor/monitor.h"
+#include "qemu/log.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -52,6 +57,7 @@
 #include "android/hw-sensors.h"
 #include "android/keycode-array.h"
 #include "android/charmap.h"
+#include "android/charpipe.h"
 #include "android/display-core.h"
 
 #if defined(CONFIG_SLIRP)
@@ -97,6 +103,21 @@ typedef struct ControlClientRec_
     char                       buff[ 4096 ];
     int                        buff_len;
 
+    /* replies are accumulated in 'out' while a batch of input is being
+     * processed, and sent with a single write by control_client_flush() */
+    stralloc_t                 out[1];
+    char                       reading;
+
+    /* tag of the current pipelined request, including its trailing space,
+     * each reply line is prefixed with it. empty for untagged requests */
+    char                       tag[ 32 ];
+    char                       line_start;
+
+    /* commands collected between 'batch begin' and 'batch end' */
+    char                       in_batch;
+    char                       running_batch;
+    stralloc_t                 batch[1];
+
 } ControlClientRec;
 
 
@@ -209,6 +230,7 @@ control_client_detach( ControlClient  client )
 }
 
 static void  control_client_read( void*  _client );  /* forward */
+static void  control_client_flush( ControlClient  client );  /* forward */
 
 static void
 control_client_destroy( ControlClient  client )
@@ -241,6 +263,7 @@ control_client_destroy( ControlClient  client )
     }
 #endif  // CONFIG_STANDALONE_CORE
 
+    control_client_flush( client );
     sock = control_client_detach( client );
     if (sock >= 0)
         socket_close(sock);
@@ -257,17 +280,22 @@ control_client_destroy( ControlClient  client )
         pnode = &node->next;
     }
 
+    stralloc_reset( client->out );
+    stralloc_reset( client->batch );
     free( client );
 }
 
 
-
-static void  control_control_write( ControlClient  client, const char*  buff, int  len )
+/* send all pending replies to the client */
+static void  control_client_flush( ControlClient  client )
 {
-    int ret;
+    const char*  buff = client->out->s;
+    int          len  = client->out->n;
+    int          ret;
 
-    if (len < 0)
-        len = strlen(buff);
+    client->out->n = 0;
+    if (client->sock < 0)
+        return;
 
     while (len > 0) {
         ret = HANDLE_EINTR(socket_send( client->sock, buff, len));
@@ -281,6 +309,32 @@ static void  control_control_write( ControlClient  client, const char*  buff, in
     }
 }
 
+static void  control_control_write( ControlClient  client, const char*  buff, int  len )
+{
+    if (len < 0)
+        len = strlen(buff);
+
+    if (client->tag[0] == 0) {
+        stralloc_add_bytes( client->out, buff, len );
+    } else {
+        /* prefix each reply line with the request's tag */
+        while (len > 0) {
+            const char*  eol = memchr( buff, '\n', len );
+            int          n   = eol ? eol + 1 - buff : len;
+
+            if (client->line_start)
+                stralloc_add_str( client->out, client->tag );
+            stralloc_add_bytes( client->out, buff, n );
+            client->line_start = (eol != NULL);
+            buff += n;
+            len  -= n;
+        }
+    }
+
+    if (!client->reading)
+        control_client_flush( client );
+}
+
 static int  control_vwrite( ControlClient  client, const char*  format, va_list args )
 {
     static char  temp[1024];
@@ -337,19 +391,38 @@ typedef struct CommandDefRec_ {
 
 static const CommandDefRec   main_commands[];  /* forward */
 
-static CommandDef
-find_command( char*  input, CommandDef  commands, char*  *pend, char*  *pargs )
+/* command names are looked up through a hash table keyed by the
+ * (command table, name) pair. It is built on first use from
+ * main_commands and all the sub-command tables it references.
+ */
+typedef struct {
+    CommandDef   table;
+    const char*  name;
+    int          len;
+    CommandDef   cmd;
+} CommandHashEntry;
+
+static CommandHashEntry*  command_hash;
+static unsigned           command_hash_mask;
+
+static unsigned
+command_hash_index( CommandDef  table, const char*  name, int  len )
 {
-    int    nn;
-    char*  args = strchr(input, ' ');
+    unsigned  h = (unsigned)(uintptr_t)table * 2654435761U;
+    int       nn;
 
-    if (args != NULL) {
-        while (*args == ' ')
-            args++;
+    for (nn = 0; nn < len; nn++)
+        h = h*31 + (unsigned char)name[nn];
 
-        if (args[0] == 0)
-            args = NULL;
-    }
+    return (h ^ (h >> 16)) & command_hash_mask;
+}
+
+/* call 'func' for each name and alias of each command in 'commands' */
+static int
+command_hash_walk( CommandDef  commands,
+                   void      (*func)( CommandDef, const char*, int, CommandDef ) )
+{
+    int  nn, count = 0;
 
     for (nn = 0; commands[nn].names != NULL; nn++)
     {
@@ -357,7 +430,7 @@ find_command( char*  input, CommandDef  commands, char*  *pend, char*  *pargs )
         const char*  sep;
 
         do {
-            int  len, c;
+            int  len;
 
             sep = strchr( name, '|' );
             if (sep)
@@ -365,20 +438,93 @@ find_command( char*  input, CommandDef  commands, char*  *pend, char*  *pargs )
             else
                 len = strlen(name);
 
-            c = input[len];
-            if ( !memcmp( name, input, len ) && (c == ' ' || c == 0) ) {
-                *pend  = input + len;
-                *pargs = args;
-                return &commands[nn];
-            }
+            if (func)
+                func( commands, name, len, &commands[nn] );
+            count++;
 
             if (sep)
                 name = sep + 1;
 
         } while (sep != NULL && *name);
+
+        if (commands[nn].subcommands)
+            count += command_hash_walk( commands[nn].subcommands, func );
     }
-    /* NOTE: don't touch *pend and *pargs if no command is found */
-    return NULL;
+    return count;
+}
+
+static CommandHashEntry*
+command_hash_lookup( CommandDef  table, const char*  name, int  len )
+{
+    unsigned  index = command_hash_index( table, name, len );
+
+    for (;;) {
+        CommandHashEntry*  e = &command_hash[index];
+
+        if (e->table == NULL ||
+            (e->table == table && e->len == len && !memcmp(e->name, name, len)))
+            return e;
+
+        index = (index + 1) & command_hash_mask;
+    }
+}
+
+static void
+command_hash_add( CommandDef  table, const char*  name, int  len, CommandDef  cmd )
+{
+    CommandHashEntry*  e = command_hash_lookup( table, name, len );
+
+    /* keep the first match in table order, like a linear search would */
+    if (e->table == NULL) {
+        e->table = table;
+        e->name  = name;
+        e->len   = len;
+        e->cmd   = cmd;
+    }
+}
+
+static void
+command_hash_init( void )
+{
+    unsigned  size  = 64;
+    int       count = command_hash_walk( main_commands, NULL );
+
+    /* keep the load factor under 1/2 */
+    while (size < 2*(unsigned)count)
+        size <<= 1;
+
+    command_hash      = calloc( size, sizeof(command_hash[0]) );
+    command_hash_mask = size - 1;
+    command_hash_walk( main_commands, command_hash_add );
+}
+
+static CommandDef
+find_command( char*  input, CommandDef  commands, char*  *pend, char*  *pargs )
+{
+    char*              args = strchr(input, ' ');
+    int                len  = args ? args - input : (int)strlen(input);
+    CommandHashEntry*  e;
+
+    if (args != NULL) {
+        while (*args == ' ')
+            args++;
+
+        if (args[0] == 0)
+            args = NULL;
+    }
+
+    if (command_hash == NULL)
+        command_hash_init();
+
+    e = command_hash_lookup( commands, input, len );
+    if (e->table == NULL) {
+        /* NOTE: don't touch *pend and *pargs if no command is found */
+        return NULL;
+    }
+
+    *pend  = input + len;
+    *pargs = args;
+    return e->cmd;
 }
 
 static void
@@ -404,12 +550,12 @@ dump_help( ControlClient  client,
 }
 
 static void
-control_client_do_command( ControlClient  client )
+control_client_do_command( ControlClient  client, char*  input )
 {
-    char*       line     = client->buff;
+    char*       line     = input;
     char*       args     = NULL;
     CommandDef  commands = main_commands;
-    char*       cmdend   = client->buff;
+    char*       cmdend   = input;
     CommandDef  cmd      = find_command( line, commands, &cmdend, &args );
 
     if (cmd == NULL) {
@@ -430,7 +576,7 @@ control_client_do_command( ControlClient  client )
         /* no handler means we should have sub-commands */
         if (cmd->subcommands == NULL) {
             control_write( client, "KO: internal error: buggy command table for '%.*s'\r\n",
-                           cmdend - client->buff, client->buff );
+                           cmdend - input, input );
             break;
         }
 
@@ -497,6 +643,65 @@ do_help( ControlClient  client, char*  args )
 }
 
 
+static int  do_batch_end( ControlClient  client, char*  args );    /* forward */
+static int  do_batch_abort( ControlClient  client, char*  args );  /* forward */
+
+/* returns true if 'line' ends the batch being collected, i.e. if
+ * control_client_do_command() would run 'batch end' or 'batch abort' */
+static int
+control_client_is_batch_end( char*  line )
+{
+    char*       end;
+    char*       args = NULL;
+    CommandDef  cmd  = find_command( line, main_commands, &end, &args );
+
+    if (cmd == NULL || cmd->handler || cmd->subcommands == NULL || args == NULL)
+        return 0;
+
+    cmd = find_command( args, cmd->subcommands, &end, &args );
+    return cmd != NULL &&
+           (cmd->handler == do_batch_end || cmd->handler == do_batch_abort);
+}
+
+/* handle one line of input. A line that starts with '@<tag> ' is a
+ * pipelined request: every line of its reply is prefixed with the
+ * same '@<tag> ', so that clients can send many requests without
+ * waiting and still match the replies to them.
+ */
+static void
+control_client_do_line( ControlClient  client, char*  input )
+{
+    char*  line = input;
+
+    client->tag[0] = 0;
+    client->line_start = 1;
+
+    if (line[0] == '@') {
+        char*  p   = strchr( line, ' ' );
+        int    len = p ? p - line : (int)strlen(line);
+
+        if (len + 2 > (int)sizeof(client->tag)) {
+            control_write( client, "KO: request tag too long\r\n" );
+            return;
+        }
+        memcpy( client->tag, line, len );
+        client->tag[len]   = ' ';
+        client->tag[len+1] = 0;
+
+        line += len;
+        while (*line == ' ')
+            line++;
+    }
+
+    if (client->in_batch && !control_client_is_batch_end( line )) {
+        stralloc_add_str( client->batch, input );
+        stralloc_add_c( client->batch, '\n' );
+    } else {
+        control_client_do_command( client, line );
+    }
+    client->tag[0] = 0;
+}
+
 static void
 control_client_read_byte( ControlClient  client, unsigned char  ch )
 {
@@ -507,7 +712,7 @@ control_client_read_byte( ControlClient  client, unsigned char  ch )
     else if (ch == '\n')
     {
         client->buff[ client->buff_len ] = 0;
-        control_client_do_command( client );
+        control_client_do_line( client, client->buff );
         if (client->finished)
             return;
 
@@ -564,6 +769,9 @@ control_client_read( void*  _client )
 #else
         D(( "received %.*s\n", size, buf ));
 #endif
+        /* all replies to the commands found in this chunk of input are
+         * sent together once it has been processed */
+        client->reading = 1;
         for (nn = 0; nn < size; nn++) {
             control_client_read_byte( client, buf[nn] );
             if (client->finished) {
@@ -571,6 +779,8 @@ control_client_read( void*  _client )
                 return;
             }
         }
+        client->reading = 0;
+        control_client_flush( client );
     }
 }
 
@@ -648,6 +858,85 @@ control_global_init( ControlGlobal  global,
 
 
 
+static int
+do_batch_begin( ControlClient  client, char*  args )
+{
+    if (client->in_batch || client->running_batch) {
+        control_write( client, "KO: batch already in progress\r\n" );
+        return -1;
+    }
+    client->in_batch = 1;
+    client->batch->n = 0;
+    return 0;
+}
+
+static int
+do_batch_end( ControlClient  client, char*  args )
+{
+    STRALLOC_DEFINE(script);
+    char   tag[ sizeof(client->tag) ];
+    char*  line;
+    char*  next;
+
+    if (!client->in_batch) {
+        control_write( client, "KO: no batch in progress\r\n" );
+        return -1;
+    }
+    client->in_batch = 0;
+
+    /* take the script, commands can't touch it while it runs */
+    *script = *client->batch;
+    memset( client->batch, 0, sizeof(client->batch) );
+    memcpy( tag, client->tag, sizeof(tag) );
+
+    /* run everything before returning to the main loop */
+    client->running_batch = 1;
+    for (line = stralloc_cstr(script); *line; line = next) {
+        next  = strchr( line, '\n' );
+        *next++ = 0;
+        control_client_do_line( client, line );
+        if (client->finished)
+            break;
+    }
+    client->running_batch = 0;
+    stralloc_reset( script );
+
+    memcpy( client->tag, tag, sizeof(tag) );
+    client->line_start = 1;
+    return 0;
+}
+
+static int
+do_batch_abort( ControlClient  client, char*  args )
+{
+    if (!client->in_batch) {
+        control_write( client, "KO: no batch in progress\r\n" );
+        return -1;
+    }
+    client->in_batch = 0;
+    stralloc_reset( client->batch );
+    return 0;
+}
+
+static const CommandDefRec  batch_commands[] =
+{
+    { "begin", "start collecting a batch of commands",
+      "'batch begin' starts collecting commands instead of running them. nothing is\r\n"
+      "sent back for the collected commands until 'batch end'.\r\n",
+      NULL, do_batch_begin, NULL },
+
+    { "end", "run the collected commands",
+      "'batch end' runs all commands collected since 'batch begin' in a row, without\r\n"
+      "letting the emulator run in between, then replies with their results.\r\n",
+      NULL, do_batch_end, NULL },
+
+    { "abort", "discard the collected commands",
+      "'batch abort' discards all commands collected since 'batch begin'.\r\n",
+      NULL, do_batch_abort, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
 static int
 do_quit( ControlClient  client, char*  args )
 {
@@ -676,6 +965,29 @@ do_network_status( ControlClient  client, char*  args )
 
     control_write( client, "  minimum latency:  %ld ms\r\n", qemu_net_min_latency );
     control_write( client, "  maximum latency:  %ld ms\r\n", qemu_net_max_latency );
+    control_write( client, "  jitter:           %d ms\r\n", qemu_net_jitter );
+    control_write( client, "  packet loss:      %.2f %%\r\n", qemu_net_loss );
+
+    if (slirp_shaper_in && slirp_shaper_out && slirp_delay_in) {
+        NetShaperStats  up, down;
+        NetDelayStats   delay;
+
+        netshaper_get_stats( slirp_shaper_in,  &up );
+        netshaper_get_stats( slirp_shaper_out, &down );
+        netdelay_get_stats( slirp_delay_in, &delay );
+
+        control_write( client, "  upload:   %llu packets, %llu bytes, %llu delayed, %llu dropped, %u queued\r\n",
+                       (unsigned long long)up.packets, (unsigned long long)up.bytes,
+                       (unsigned long long)up.delayed, (unsigned long long)up.dropped,
+                       up.queued );
+        control_write( client, "  download: %llu packets, %llu bytes, %llu delayed, %llu dropped, %u queued\r\n",
+                       (unsigned long long)down.packets, (unsigned long long)down.bytes,
+                       (unsigned long long)down.delayed, (unsigned long long)down.dropped,
+                       down.queued );
+        control_write( client, "  sessions: %u tracked, %u connecting, %llu delayed, %llu expired\r\n",
+                       delay.sessions, delay.pending,
+                       (unsigned long long)delay.delayed, (unsigned long long)delay.expired );
+    }
     return 0;
 }
 
@@ -747,6 +1059,78 @@ describe_network_delay( ControlClient  client )
     /* XXX: TODO */
 }
 
+static int
+do_network_jitter( ControlClient  client, char*  args )
+{
+    char*  end;
+    long   jitter;
+
+    if ( !args ) {
+        control_write( client, "KO: missing <jitter> argument, see 'help network jitter'\r\n" );
+        return -1;
+    }
+    jitter = strtol( args, &end, 10 );
+    if ( end == args || *end != 0 || jitter < 0 || jitter > 60000 ) {
+        control_write( client, "KO: invalid <jitter> argument, see 'help network jitter' for valid values\r\n" );
+        return -1;
+    }
+    qemu_net_jitter = (int)jitter;
+    netshaper_set_jitter( slirp_shaper_in,  qemu_net_jitter );
+    netshaper_set_jitter( slirp_shaper_out, qemu_net_jitter );
+    return 0;
+}
+
+static int
+do_network_loss( ControlClient  client, char*  args )
+{
+    char*   end;
+    double  loss;
+
+    if ( !args ) {
+        control_write( client, "KO: missing <percent> argument, see 'help network loss'\r\n" );
+        return -1;
+    }
+    loss = strtod( args, &end );
+    if ( end == args || *end != 0 || loss < 0. || loss > 100. ) {
+        control_write( client, "KO: invalid <percent> argument, see 'help network loss' for valid values\r\n" );
+        return -1;
+    }
+    qemu_net_loss = loss;
+    netshaper_set_loss( slirp_shaper_in,  qemu_net_loss );
+    netshaper_set_loss( slirp_shaper_out, qemu_net_loss );
+    return 0;
+}
+
+static int
+do_network_queues( ControlClient  client, char*  args )
+{
+    VLANClientStats  stats;
+    PacketPoolStats  pool;
+    int              vlan_id;
+    int              n;
+
+    for (n = 0; qemu_get_vlan_pool_stats(n, &vlan_id, &pool) == 0; n++) {
+        control_write( client,
+                       "vlan %d: %llu packets queued, %llu allocations, "
+                       "%u in use (max %u), %llu bytes\r\n",
+                       vlan_id,
+                       (unsigned long long)pool.allocs,
+                       (unsigned long long)pool.mallocs,
+                       pool.in_use, pool.high_water,
+                       (unsigned long long)pool.bytes );
+    }
+    for (n = 0; qemu_get_vlan_client_stats(n, &stats) == 0; n++) {
+        control_write( client,
+                       "  vlan %d %s: %u queued (max %u), "
+                       "%llu queued in total, %llu dropped\r\n",
+                       stats.vlan_id, stats.name,
+                       stats.queue_len, stats.queue_max,
+                       (unsigned long long)stats.queued,
+                       (unsigned long long)stats.dropped );
+    }
+    return 0;
+}
+
 static int
 do_network_capture_start( ControlClient  client, char*  args )
 {
@@ -769,6 +1153,23 @@ do_network_capture_stop( ControlClient  client, char*  args )
     return 0;
 }
 
+static int
+do_network_capture_status( ControlClient  client, char*  args )
+{
+    QemuTcpdumpStatus  status;
+
+    qemu_tcpdump_get_status(&status);
+    control_write( client, "capture %s: %llu packets (%llu bytes), %llu dropped\r\n",
+                   status.active ? "running" : "stopped",
+                   (unsigned long long)status.packets,
+                   (unsigned long long)status.bytes,
+                   (unsigned long long)status.dropped );
+    if (status.error) {
+        control_write( client, "write error: %s\r\n", strerror(status.error) );
+    }
+    return 0;
+}
+
 static const CommandDefRec  network_capture_commands[] =
 {
     { "start", "start network capture",
@@ -776,6 +1177,10 @@ static const CommandDefRec  network_capture_commands[] =
       "into a specific <file>. This will stop any capture already in progress.\r\n"
       "the capture file can later be analyzed by tools like WireShark. It uses\r\n"
       "the libpcap file format.\r\n\r\n"
+      "<file> can be followed by comma-separated options: size=<MB> or time=<secs>\r\n"
+      "to start a new file periodically, files=<n> to keep at most <n> files,\r\n"
+      "ring=<MB> to keep only the last <MB> megabytes, and snaplen=<n> to keep\r\n"
+      "only the first <n> bytes of each packet, e.g. 'net.pcap,ring=64'\r\n\r\n"
       "you can stop the capture anytime with 'network capture stop'\r\n", NULL,
       do_network_capture_start, NULL },
 
@@ -784,6 +1189,11 @@ static const CommandDefRec  network_capture_commands[] =
       "you can start one with 'network capture start <file>'\r\n", NULL,
       do_network_capture_stop, NULL },
 
+    { "status", "report network capture status",
+      "'network capture status' reports how many packets were captured, and how\r\n"
+      "many were dropped because the disk could not keep up\r\n", NULL,
+      do_network_capture_status, NULL },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
@@ -798,6 +1208,22 @@ static const CommandDefRec  network_commands[] =
     { "delay", "change network latency", NULL, describe_network_delay,
        do_network_delay, NULL },
 
+    { "jitter", "change network jitter",
+      "'network jitter <ms>' holds each packet for a random time between 0 and <ms>\r\n"
+      "milliseconds, in both directions, without reordering them. 0 disables it.\r\n", NULL,
+      do_network_jitter, NULL },
+
+    { "loss", "change network packet loss",
+      "'network loss <percent>' drops the given percentage of packets at random,\r\n"
+      "in both directions, e.g. 'network loss 0.5'. 0 disables it.\r\n", NULL,
+      do_network_loss, NULL },
+
+    { "queues", "dump network send queue statistics",
+      "'network queues' reports, for each VLAN, how many packets were queued and\r\n"
+      "how many allocations their buffers took, then the current and maximum\r\n"
+      "send queue depth of each network client, and the packets it dropped\r\n", NULL,
+      do_network_queues, NULL },
+
     { "capture", "dump network packets to file",
       "allows to start/stop capture of network packets to a file for later analysis\r\n", NULL,
       NULL, network_capture_commands },
@@ -1496,6 +1922,207 @@ static const CommandDefRec  cdma_commands[] =
       do_cdma_prl_version, NULL },
 };
 
+static int
+do_gsm_inject_line( ControlClient  client, char*  line )
+{
+    char*  p;
+    char*  arg;
+
+    /* strip the trailing spaces and line feed */
+    p = line + strlen(line);
+    while (p > line && (p[-1] == '\n' || p[-1] == '\r' || p[-1] == ' '))
+        *--p = 0;
+
+    while (*line == ' ' || *line == '\t')
+        line++;
+
+    if (line[0] == 0 || line[0] == '#')
+        return 0;
+
+    arg = strchr( line, ' ' );
+    if (arg == NULL) {
+        control_write( client, "KO: missing argument" );
+        return -1;
+    }
+    *arg++ = 0;
+
+    if (!strcmp( line, "call" ) || !strcmp( line, "cancel" )) {
+        if (gsm_check_number(arg)) {
+            control_write( client, "KO: bad phone number format, use digits, # and + only" );
+            return -1;
+        }
+        if (!strcmp( line, "call" ))
+            amodem_inject_call( android_modem, arg );
+        else
+            amodem_inject_cancel( android_modem, arg );
+        return 0;
+    }
+
+    if (!strcmp( line, "pdu" )) {
+        SmsPDU  pdu = smspdu_create_from_hex( arg, strlen(arg) );
+
+        if (pdu == NULL) {
+            control_write( client, "KO: badly formatted <hexstring>" );
+            return -1;
+        }
+        amodem_inject_sms( android_modem, pdu );
+        return 0;
+    }
+
+    if (!strcmp( line, "sms" )) {
+        SmsAddressRec  sender;
+        SmsPDU*        pdus;
+        int            textlen;
+        int            nn;
+
+        p = strchr( arg, ' ' );
+        if (p == NULL) {
+            control_write( client, "KO: missing message text" );
+            return -1;
+        }
+        if ( sms_address_from_str( &sender, arg, p - arg ) < 0 ) {
+            control_write( client, "KO: bad phone number format, must be [+](0-9)*" );
+            return -1;
+        }
+        p      += 1;
+        textlen = strlen(p);
+        textlen = sms_utf8_from_message_str( p, textlen, (unsigned char*)p, textlen );
+        if (textlen < 0) {
+            control_write( client, "KO: badly formatted text" );
+            return -1;
+        }
+        pdus = smspdu_create_deliver_utf8( (cbytes_t)p, textlen, &sender, NULL );
+        if (pdus == NULL) {
+            control_write( client, "KO: internal error when creating SMS-DELIVER PDUs" );
+            return -1;
+        }
+        /* the queue now owns the PDUs, only free the list */
+        for (nn = 0; pdus[nn] != NULL; nn++)
+            amodem_inject_sms( android_modem, pdus[nn] );
+        free( pdus );
+        return 0;
+    }
+
+    control_write( client, "KO: unknown event '%s'", line );
+    return -1;
+}
+
+static int
+do_gsm_inject_file( ControlClient  client, char*  args )
+{
+    FILE*  file;
+    char   line[2048];
+    int    lineno = 0;
+    int    queued;
+
+    if (!args) {
+        control_write( client, "KO: missing argument, try 'gsm inject file <file>'\r\n" );
+        return -1;
+    }
+    if (!android_modem) {
+        control_write( client, "KO: modem emulation not running\r\n" );
+        return -1;
+    }
+    file = fopen( args, "r" );
+    if (file == NULL) {
+        control_write( client, "KO: could not open '%s': %s\r\n", args, strerror(errno) );
+        return -1;
+    }
+
+    queued = amodem_get_inject_pending( android_modem );
+    while (fgets( line, sizeof(line), file ) != NULL) {
+        lineno += 1;
+        if (do_gsm_inject_line( client, line ) < 0) {
+            control_write( client, " at %s:%d\r\n", args, lineno );
+            fclose( file );
+            return -1;
+        }
+    }
+    fclose( file );
+
+    queued = amodem_get_inject_pending( android_modem ) - queued;
+    control_write( client, "queued %d events\r\n", queued );
+    return 0;
+}
+
+static int
+do_gsm_inject_rate( ControlClient  client, char*  args )
+{
+    char*  end;
+    long   rate;
+
+    if (!android_modem) {
+        control_write( client, "KO: modem emulation not running\r\n" );
+        return -1;
+    }
+    if (!args) {
+        control_write( client, "%d events per second%s\r\n",
+                       amodem_get_inject_rate( android_modem ),
+                       amodem_get_inject_rate( android_modem ) ? "" : " (no limit)" );
+        return 0;
+    }
+    rate = strtol( args, &end, 10 );
+    if (*end != 0 || end == args || rate < 0 || rate > 1000000) {
+        control_write( client, "KO: rate must be a number of events per second, 0 for no limit\r\n" );
+        return -1;
+    }
+    amodem_set_inject_rate( android_modem, (int)rate );
+    return 0;
+}
+
+static int
+do_gsm_inject_status( ControlClient  client, char*  args )
+{
+    if (!android_modem) {
+        control_write( client, "KO: modem emulation not running\r\n" );
+        return -1;
+    }
+    control_write( client, "pending:    %d\r\n", amodem_get_inject_pending( android_modem ) );
+    control_write( client, "delivered:  %u\r\n", amodem_get_inject_delivered( android_modem ) );
+    control_write( client, "rate:       %d/s\r\n", amodem_get_inject_rate( android_modem ) );
+    return 0;
+}
+
+static int
+do_gsm_inject_clear( ControlClient  client, char*  args )
+{
+    if (!android_modem) {
+        control_write( client, "KO: modem emulation not running\r\n" );
+        return -1;
+    }
+    amodem_clear_inject( android_modem );
+    return 0;
+}
+
+static const CommandDefRec  gsm_inject_commands[] =
+{
+    { "file", "queue the SMS messages and calls of a file",
+    "'gsm inject file <file>' queues the events of <file>, one per line:\r\n"
+    "    sms <phonenumber> <message>    an inbound SMS text message\r\n"
+    "    pdu <hexstring>                an inbound SMS PDU\r\n"
+    "    call <phonenumber>             an inbound phone call\r\n"
+    "    cancel <phonenumber>           the end of a phone call\r\n"
+    "lines starting with '#' are ignored. the events are delivered in order, at up\r\n"
+    "to the 'gsm inject rate'. each SMS waits until the previous one is acknowledged\r\n"
+    "and each call until a call slot is free. on error, the previous lines remain queued.\r\n", NULL,
+    do_gsm_inject_file, NULL },
+
+    { "rate", "set the most events delivered per second",
+    "'gsm inject rate <count>' sets the most queued events delivered per second,\r\n"
+    "0 for no limit (the default). 'gsm inject rate' shows the current rate.\r\n", NULL,
+    do_gsm_inject_rate, NULL },
+
+    { "status", "display the injection queue",
+    "'gsm inject status' displays the number of queued and delivered events\r\n", NULL,
+    do_gsm_inject_status, NULL },
+
+    { "clear", "drop the queued events",
+    "'gsm inject clear' drops the events that were not delivered yet\r\n", NULL,
+    do_gsm_inject_clear, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
 static const CommandDefRec  gsm_commands[] =
 {
     { "list", "list current phone calls",
@@ -1541,6 +2168,10 @@ static const CommandDefRec  gsm_commands[] =
     "ber range is 0..7 percent and 99 for unknown\r\n",
     NULL, do_gsm_signal, NULL },
 
+    { "inject", "queue many inbound SMS messages and calls",
+    "allows you to deliver many inbound SMS messages and calls at a steady rate\r\n",
+    NULL, NULL, gsm_inject_commands },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
@@ -2088,6 +2719,43 @@ do_snapshot_save( ControlClient  client, char*  args )
     return ret > 0; // no output on error channel indicates success
 }
 
+static int
+do_snapshot_save_background( ControlClient  client, char*  args )
+{
+    int64_t ret;
+
+    if (args == NULL) {
+        control_write(client, "KO: argument missing, try 'avd snapshot save-background <name>'\r\n");
+        return -1;
+    }
+
+    Monitor *err = monitor_fake_new(client, control_write_err_cb);
+#ifdef _WIN32
+    do_savevm(err, args);
+#else
+    /* The child process can't share the hypervisor's vCPU state. */
+    if (hax_enabled()) {
+        do_savevm(err, args);
+    } else {
+        do_savevm_background(err, args, false);
+    }
+#endif
+    ret = monitor_fake_get_bytes(err);
+    monitor_fake_free(err);
+
+    return ret > 0;
+}
+
+static int
+do_snapshot_status( ControlClient  client, char*  args )
+{
+    Monitor *out = monitor_fake_new(client, control_write_out_cb);
+    do_info_savevm_background(out);
+    monitor_fake_free(out);
+
+    return 0;
+}
+
 static int
 do_snapshot_load( ControlClient  client, char*  args )
 {
@@ -2134,6 +2802,15 @@ static const CommandDefRec  snapshot_commands[] =
     "'avd snapshot save <name>' will save the current (run-time) state to a snapshot with the given name\r\n",
     NULL, do_snapshot_save, NULL },
 
+    { "save-background", "save state snapshot without pausing the virtual device",
+    "'avd snapshot save-background <name>' will save the current state to a snapshot with the given name\r\n"
+    "from a child process, while the virtual device keeps running. Use 'avd snapshot status' to follow it.\r\n",
+    NULL, do_snapshot_save_background, NULL },
+
+    { "status", "show the status of the background snapshot",
+    "'avd snapshot status' will show the progress of the current background snapshot, or the result of the last one\r\n",
+    NULL, do_snapshot_status, NULL },
+
     { "load", "load state snapshot",
     "'avd snapshot load <name>' will load the state snapshot of the given name\r\n",
     NULL, do_snapshot_load, NULL },
@@ -2191,6 +2868,72 @@ do_avd_name( ControlClient  client, char*  args )
     return 0;
 }
 
+static int
+do_avd_ram( ControlClient  client, char*  args )
+{
+    SharedRamStats  stats;
+
+    if (qemu_ram_get_sharing_stats(&stats) < 0) {
+        control_write( client, "KO: cannot count guest RAM pages on this host\r\n" );
+        return -1;
+    }
+    control_write( client, "ram base file: %s\r\n",
+                   qemu_ram_base_used() ? ram_base_path : "(none)" );
+    control_write( client, "shared pages:  %llu\r\n",
+                   (unsigned long long)stats.shared_pages );
+    control_write( client, "private pages: %llu\r\n",
+                   (unsigned long long)stats.private_pages );
+    control_write( client, "absent pages:  %llu\r\n",
+                   (unsigned long long)stats.absent_pages );
+    return 0;
+}
+
+static int
+do_avd_tty( ControlClient  client, char*  args )
+{
+    GoldfishTtyStats  stats;
+    int64_t           now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    int               n;
+
+    for (n = 0; goldfish_tty_get_stats(n, &stats) == 0; n++) {
+        double  secs = (now - stats.start_ms) / 1000.;
+        if (secs <= 0)
+            secs = 1;
+        control_write( client,
+                       "tty%d: out %llu bytes in %llu writes (%.1f KB/s), "
+                       "in %llu bytes in %llu reads (%.1f KB/s), "
+                       "max %u bytes pending\r\n",
+                       stats.id,
+                       (unsigned long long)stats.tx_bytes,
+                       (unsigned long long)stats.tx_calls,
+                       stats.tx_bytes / 1024. / secs,
+                       (unsigned long long)stats.rx_bytes,
+                       (unsigned long long)stats.rx_reads,
+                       stats.rx_bytes / 1024. / secs,
+                       stats.rx_high_water );
+    }
+    return 0;
+}
+
+static int
+do_avd_charpipe( ControlClient  client, char*  args )
+{
+    CharPipeStats  stats;
+    int            n;
+
+    for (n = 0; charpipe_get_stats(n, &stats) == 0; n++) {
+        control_write( client,
+                       "%s: %llu bytes, %llu stalls, "
+                       "max %u bytes buffered, %u pending\r\n",
+                       stats.name,
+                       (unsigned long long)stats.queue.bytes,
+                       (unsigned long long)stats.queue.stalls,
+                       stats.queue.high_water,
+                       stats.queue.pending );
+    }
+    return 0;
+}
+
 static const CommandDefRec  vm_commands[] =
 {
     { "stop", "stop the virtual device",
@@ -2209,6 +2952,24 @@ static const CommandDefRec  vm_commands[] =
     "'avd name' will return the name of this virtual device\r\n",
     NULL, do_avd_name, NULL },
 
+    { "ram", "query guest RAM sharing",
+    "'avd ram' reports how many host pages of guest RAM are shared with other\r\n"
+    "instances through the -ram-base file, are private to this one, or were\r\n"
+    "never touched\r\n",
+    NULL, do_avd_ram, NULL },
+
+    { "tty", "query guest serial port traffic",
+    "'avd tty' reports the bytes written and read by the guest on each of its\r\n"
+    "serial ports, and the average throughput since they were created\r\n",
+    NULL, do_avd_tty, NULL },
+
+    { "charpipe", "query internal character pipe traffic",
+    "'avd charpipe' reports, for each direction of the internal pipes that connect\r\n"
+    "serial ports to the modem, GPS and qemud, the bytes passed to the reader, how\r\n"
+    "many times the reader was full and data had to be buffered, and the largest\r\n"
+    "and current amount of buffered data\r\n",
+    NULL, do_avd_charpipe, NULL },
+
     { "snapshot", "state snapshot commands",
     "allows you to save and restore the virtual device state in snapshots\r\n",
     NULL, NULL, snapshot_commands },
@@ -2562,6 +3323,45 @@ do_sensors_status( ControlClient client, char* args )
     return 0;
 }
 
+/* replay a recorded sensor trace file, or stop/query the current replay */
+static int
+do_sensors_replay( ControlClient client, char* args )
+{
+    char  buffer[SENSORS_INFO_SIZE] = { 0 };
+    int   status, errline, done, total;
+
+    if (! args) {
+        if (android_sensors_replay_progress( &done, &total ))
+            snprintf( buffer, sizeof(buffer), "replaying: %d/%d records\r\n", done, total );
+        else
+            snprintf( buffer, sizeof(buffer), "no replay in progress\r\n" );
+        control_write( client, buffer );
+        return 0;
+    }
+
+    if (!strcmp( args, "stop" )) {
+        android_sensors_replay_stop();
+        return 0;
+    }
+
+    status = android_sensors_replay_start( args, &errline );
+    switch (status) {
+    case SENSOR_STATUS_OK:
+        return 0;
+    case SENSOR_STATUS_NO_SERVICE:
+        snprintf( buffer, sizeof(buffer), "KO: No sensor service found!\r\n" );
+        break;
+    default:
+        if (errline > 0)
+            snprintf( buffer, sizeof(buffer), "KO: %s:%d: invalid sensor trace record\r\n", args, errline );
+        else
+            snprintf( buffer, sizeof(buffer), "KO: can't load sensor trace %s: %s\r\n", args, strerror(errno) );
+        break;
+    }
+    control_write( client, buffer );
+    return -1;
+}
+
 /* Sensor commands for get/set sensor values and get available sensor names. */
 static const CommandDefRec sensor_commands[] =
 {
@@ -2577,6 +3377,215 @@ static const CommandDefRec sensor_commands[] =
       "'set <sensorname> <value-a>[:<value-b>[:<value-c>]]' set the values of a given sensor.\r\n",
       NULL, do_sensors_set, NULL },
 
+    { "replay", "replay a recorded sensor trace",
+      "'replay <file>' replays a sensor trace into the guest at its original timing.\r\n"
+      "each line of <file> is '<time_us> <sensorname> <value-a>[:<value-b>[:<value-c>]]'.\r\n"
+      "'replay stop' stops the current replay, 'replay' alone reports its progress.\r\n",
+      NULL, do_sensors_replay, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+/********************************************************************************************/
+/********************************************************************************************/
+/*****                                                                                 ******/
+/*****                        P R O F I L E R   C O M M A N D S                        ******/
+/*****                                                                                 ******/
+/********************************************************************************************/
+/********************************************************************************************/
+
+static int
+do_profile_start( ControlClient  client, char*  args )
+{
+    hotProfiler_start();
+    return 0;
+}
+
+static int
+do_profile_stop( ControlClient  client, char*  args )
+{
+    hotProfiler_stop();
+    return 0;
+}
+
+static int
+do_profile_reset( ControlClient  client, char*  args )
+{
+    hotProfiler_reset();
+    return 0;
+}
+
+static int
+do_profile_show( ControlClient  client, char*  args )
+{
+    STRALLOC_DEFINE(report);
+    const char*  line;
+    const char*  eol;
+
+    hotProfiler_report(report);
+    for (line = stralloc_cstr(report); *line; line = eol + 1) {
+        eol = strchr(line, '\n');
+        if (!eol)
+            break;
+        control_control_write( client, line, eol - line );
+        control_write( client, "\r\n" );
+    }
+    stralloc_reset(report);
+    return 0;
+}
+
+static int
+do_profile_dump( ControlClient  client, char*  args )
+{
+    if (!args) {
+        control_write( client, "KO: missing file name, try 'profile dump <file>'\r\n" );
+        return -1;
+    }
+    if (hotProfiler_dump(args) < 0) {
+        control_write( client, "KO: can't write %s: %s\r\n", args, strerror(errno) );
+        return -1;
+    }
+    return 0;
+}
+
+static const CommandDefRec  profile_commands[] =
+{
+    { "start", "start profiling",
+    "'profile start' starts recording where the emulator spends its time. statistics\r\n"
+    "accumulate until 'profile reset'\r\n",
+    NULL, do_profile_start, NULL },
+
+    { "stop", "stop profiling",
+    "'profile stop' stops recording, the statistics are kept\r\n",
+    NULL, do_profile_stop, NULL },
+
+    { "reset", "clear the statistics",
+    "'profile reset' clears all statistics\r\n",
+    NULL, do_profile_reset, NULL },
+
+    { "show", "show the statistics",
+    "'profile show' prints the time spent running guest code, translating, in the main loop,\r\n"
+    "timers and bottom-halves, with histograms, then event counts and rates, including the\r\n"
+    "main loop wakeups per source while the guest is idle, and MMIO accesses per device\r\n",
+    NULL, do_profile_show, NULL },
+
+    { "dump", "write the statistics to a file",
+    "'profile dump <file>' writes the output of 'profile show' to <file>\r\n",
+    NULL, do_profile_dump, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+/********************************************************************************************/
+/********************************************************************************************/
+/*****                                                                                 ******/
+/*****                           T R A C E   C O M M A N D S                           ******/
+/*****                                                                                 ******/
+/********************************************************************************************/
+/********************************************************************************************/
+
+/* return the mask of the log items enabled, except 'ring' */
+static int
+trace_get_items( void )
+{
+    const QEMULogItem*  item;
+    int                 mask = 0;
+
+    for (item = qemu_log_items; item->mask != 0; item++) {
+        if (item->mask != LOG_TRACE_RING && qemu_loglevel_mask(item->mask))
+            mask |= item->mask;
+    }
+    return mask;
+}
+
+static int
+do_trace_start( ControlClient  client, char*  args )
+{
+    int  mask;
+
+    if (args) {
+        mask = qemu_str_to_log_mask(args);
+        if (!mask) {
+            control_write( client, "KO: bad log items '%s', see 'emulator -qemu -d help'\r\n", args );
+            return -1;
+        }
+    } else {
+        mask = trace_get_items();
+        if (!mask) {
+            control_write( client, "KO: no log items enabled, try 'trace start <items>'\r\n" );
+            return -1;
+        }
+    }
+    qemu_set_log(mask | LOG_TRACE_RING);
+    return 0;
+}
+
+static int
+do_trace_stop( ControlClient  client, char*  args )
+{
+    qemu_set_log(0);
+    return 0;
+}
+
+static int
+do_trace_status( ControlClient  client, char*  args )
+{
+    const QEMULogItem*  item;
+    TraceRingStats      stats;
+    int                 items = trace_get_items();
+
+    control_write( client, "recording: %s\r\n",
+                   qemu_loglevel_mask(LOG_TRACE_RING) ? "yes" : "no" );
+    control_write( client, "items:" );
+    for (item = qemu_log_items; item->mask != 0; item++) {
+        if (items & item->mask)
+            control_write( client, " %s", item->name );
+    }
+    control_write( client, "%s\r\n", items ? "" : " none" );
+
+    traceRing_getStats(&stats);
+    control_write( client, "threads: %u\r\n", stats.threads );
+    control_write( client, "events: %llu, overwritten: %llu\r\n",
+                   (unsigned long long)stats.events, (unsigned long long)stats.lost );
+    if (qemu_log_ring_path())
+        control_write( client, "dumped at exit to: %s\r\n", qemu_log_ring_path() );
+    return 0;
+}
+
+static int
+do_trace_dump( ControlClient  client, char*  args )
+{
+    if (!args) {
+        control_write( client, "KO: missing file name, try 'trace dump <file>'\r\n" );
+        return -1;
+    }
+    if (traceRing_dump(args) < 0) {
+        control_write( client, "KO: can't write %s: %s\r\n", args, strerror(errno) );
+        return -1;
+    }
+    return 0;
+}
+
+static const CommandDefRec  trace_commands[] =
+{
+    { "start", "record log messages into the trace rings",
+    "'trace start [<items>]' records the messages of the comma-separated QEMU log items\r\n"
+    "(see 'emulator -qemu -d help') into per-thread in-memory rings, instead of formatting\r\n"
+    "them into the log file. without <items>, the ones already enabled are recorded\r\n",
+    NULL, do_trace_start, NULL },
+
+    { "stop", "stop logging",
+    "'trace stop' disables all the log items, the rings are kept\r\n",
+    NULL, do_trace_stop, NULL },
+
+    { "status", "show what is recorded",
+    "'trace status' lists the log items enabled, and the number of events recorded\r\n",
+    NULL, do_trace_status, NULL },
+
+    { "dump", "write the trace rings to a file",
+    "'trace dump <file>' writes the rings to <file>, which emulator_trace_decode formats\r\n",
+    NULL, do_trace_dump, NULL },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
@@ -2656,6 +3665,8 @@ do_attach_ui( ControlClient client, char* args )
         return -1;
     }
 
+    // The socket is handed over below, send pending replies first.
+    control_client_flush(client);
     if (!attachUiProxy_create(client->sock)) {
         char reply_buf[4096];
         attached_ui_client = client;
@@ -2707,6 +3718,7 @@ do_create_framebuffer_service( ControlClient client, char* args )
         }
     }
 
+    control_client_flush(client);
     core_fb = proxyFb_create(client->sock, protocol);
     if (core_fb == NULL) {
         control_write( client, "KO\r\n" );
@@ -2731,6 +3743,7 @@ do_create_user_events_service( ControlClient client, char* args )
         return -1;
     }
 
+    control_client_flush(client);
     if (!userEventsImpl_create(client->sock)) {
         char reply_buf[4096];
         user_events_client = client;
@@ -2763,6 +3776,7 @@ do_create_ui_core_ctl_service( ControlClient client, char* args )
         return -1;
     }
 
+    control_client_flush(client);
     if (!coreCmdImpl_create(client->sock)) {
         char reply_buf[4096];
         ui_core_ctl_client = client;
@@ -2803,6 +3817,7 @@ do_create_core_ui_ctl_service( ControlClient client, char* args )
         return -1;
     }
 
+    control_client_flush(client);
     if (!uiCmdProxy_create(client->sock)) {
         char reply_buf[4096];
         core_ui_ctl_client = client;
@@ -2943,6 +3958,22 @@ static const CommandDefRec   main_commands[] =
       "allows you to request the emulator sensors\r\n", NULL,
       NULL, sensor_commands },
 
+    { "profile", "profile the emulator",
+      "allows you to find where the emulator spends its time: running and translating guest\r\n"
+      "code, device I/O, timers or the main loop\r\n", NULL,
+      NULL, profile_commands },
+
+    { "trace", "record QEMU log messages",
+      "allows you to record the QEMU log messages (see 'emulator -qemu -d help') into fast\r\n"
+      "binary rings, and to write them to a file\r\n", NULL,
+      NULL, trace_commands },
+
+    { "batch", "run a script of commands at once",
+      "allows you to send many commands and run them together, without letting the\r\n"
+      "emulator run in between. replies to a command sent as '@<tag> <command>' have\r\n"
+      "each of their lines prefixed with '@<tag> ', in batches or not.\r\n", NULL,
+      NULL, batch_commands },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
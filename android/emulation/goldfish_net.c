@@ -0,0 +1,389 @@
+// Copyright (C) 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/emulation/goldfish_net.h"
+
+#include <string.h>
+
+typedef struct {
+    uint64_t  addr;
+    uint32_t  len;
+    uint32_t  flags;
+} GoldfishNetDesc;
+
+static uint32_t getLe32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void putLe32(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static void setLow32(uint64_t* value, uint32_t low) {
+    *value = (*value & ~(uint64_t)0xffffffffU) | low;
+}
+
+static void setHigh32(uint64_t* value, uint32_t high) {
+    *value = (*value & 0xffffffffU) | ((uint64_t)high << 32);
+}
+
+// Guest address of descriptor |index| of |ring|.
+static uint64_t goldfishNet_descAddr(const GoldfishNet* net,
+                                     const GoldfishNetRing* ring,
+                                     uint32_t index) {
+    return ring->base +
+           (uint64_t)(index & (net->ring_size - 1)) * GOLDFISH_NET_DESC_SIZE;
+}
+
+static int goldfishNet_ringEnabled(const GoldfishNet* net,
+                                   const GoldfishNetRing* ring) {
+    return net->ring_size != 0 && ring->base != 0;
+}
+
+// Read descriptor |index| of |ring|. Return true iff the device owns it.
+static int goldfishNet_readDesc(GoldfishNet* net, const GoldfishNetRing* ring,
+                                uint32_t index, GoldfishNetDesc* desc) {
+    uint8_t data[GOLDFISH_NET_DESC_SIZE];
+
+    net->ops->read_mem(net->opaque, goldfishNet_descAddr(net, ring, index),
+                       data, sizeof(data));
+    desc->addr = getLe32(data) | ((uint64_t)getLe32(data + 4) << 32);
+    desc->len = getLe32(data + 8);
+    desc->flags = getLe32(data + 12);
+    return (desc->flags & GOLDFISH_NET_DESC_OWNED) != 0;
+}
+
+// Give descriptor |index| of |ring| back to the guest with |len| and
+// |flags|.
+static void goldfishNet_completeDesc(GoldfishNet* net,
+                                     const GoldfishNetRing* ring,
+                                     uint32_t index, uint32_t len,
+                                     uint32_t flags) {
+    uint8_t data[8];
+
+    putLe32(data, len);
+    putLe32(data + 4, flags & ~GOLDFISH_NET_DESC_OWNED);
+    net->ops->write_mem(net->opaque,
+                        goldfishNet_descAddr(net, ring, index) + 8,
+                        data, sizeof(data));
+}
+
+void goldfishNet_updateIrq(GoldfishNet* net) {
+    int level = (net->int_status & net->int_enable) != 0;
+
+    if (level != net->irq_level) {
+        net->irq_level = level;
+        if (level) {
+            net->stats.interrupts++;
+        }
+        net->ops->set_irq(net->opaque, level);
+    }
+}
+
+// Report the pending completions to the guest.
+static void goldfishNet_signal(GoldfishNet* net) {
+    if (net->timer_armed) {
+        net->ops->set_timer(net->opaque, 0);
+        net->timer_armed = 0;
+    }
+    net->int_status |= net->pending_causes;
+    net->pending_causes = 0;
+    net->pending_count = 0;
+    goldfishNet_updateIrq(net);
+}
+
+// Record a completion of |cause|, signal it if enough of them are pending.
+static void goldfishNet_complete(GoldfishNet* net, uint32_t cause) {
+    net->pending_causes |= cause;
+    net->pending_count++;
+    if (net->pending_count >= net->coalesce_frames) {
+        goldfishNet_signal(net);
+    }
+}
+
+// Called at the end of a batch of completions: start the coalescing delay
+// for those that were not signalled.
+static void goldfishNet_endBatch(GoldfishNet* net) {
+    if (net->pending_count == 0) {
+        return;
+    }
+    if (net->coalesce_usecs == 0) {
+        goldfishNet_signal(net);
+    } else if (!net->timer_armed) {
+        net->timer_armed = 1;
+        net->ops->set_timer(net->opaque, net->coalesce_usecs);
+    }
+}
+
+void goldfishNet_init(GoldfishNet* net, const GoldfishNetOps* ops,
+                      void* opaque, const uint8_t mac[6]) {
+    memset(net, 0, sizeof(*net));
+    net->ops = ops;
+    net->opaque = opaque;
+    memcpy(net->mac, mac, sizeof(net->mac));
+    goldfishNet_reset(net);
+}
+
+void goldfishNet_reset(GoldfishNet* net) {
+    if (net->timer_armed) {
+        net->ops->set_timer(net->opaque, 0);
+    }
+    net->int_status = 0;
+    net->int_enable = 0;
+    net->ring_size = 0;
+    memset(&net->tx, 0, sizeof(net->tx));
+    memset(&net->rx, 0, sizeof(net->rx));
+    net->coalesce_frames = 1;
+    net->coalesce_usecs = 0;
+    net->pending_causes = 0;
+    net->pending_count = 0;
+    net->timer_armed = 0;
+    net->tx_blocked = 0;
+    goldfishNet_updateIrq(net);
+}
+
+// Send the frame that starts at the TX head, made of |count| descriptors
+// of |total| bytes. Return the send callback's result, or -1 if the frame
+// was dropped.
+static int goldfishNet_sendFrame(GoldfishNet* net,
+                                 const GoldfishNetDesc* descs, int count,
+                                 uint64_t total) {
+    GoldfishNetIov iov[GOLDFISH_NET_MAX_FRAGMENTS];
+    int mapped = 0;
+    int ret;
+    int n;
+
+    if (total > GOLDFISH_NET_MAX_FRAME) {
+        return -1;
+    }
+    if (net->ops->map_mem) {
+        for (; mapped < count; mapped++) {
+            iov[mapped].len = descs[mapped].len;
+            iov[mapped].base = net->ops->map_mem(net->opaque,
+                                                 descs[mapped].addr,
+                                                 descs[mapped].len, 0);
+            if (!iov[mapped].base) {
+                break;
+            }
+        }
+    }
+    if (mapped == count) {
+        ret = net->ops->send(net->opaque, iov, count);
+    } else {
+        // Not all RAM, copy it to one buffer.
+        uint32_t offset = 0;
+        for (n = 0; n < count; n++) {
+            net->ops->read_mem(net->opaque, descs[n].addr,
+                               net->bounce + offset, descs[n].len);
+            offset += descs[n].len;
+        }
+        iov[mapped].base = net->bounce;
+        iov[mapped].len = (uint32_t)total;
+        ret = net->ops->send(net->opaque, &iov[mapped], 1);
+    }
+    for (n = 0; n < mapped; n++) {
+        net->ops->unmap_mem(net->opaque, iov[n].base, iov[n].len, 0);
+    }
+    return ret;
+}
+
+// Send the frames that the guest queued, until the ring is empty or the
+// network is busy.
+static void goldfishNet_processTx(GoldfishNet* net) {
+    if (!goldfishNet_ringEnabled(net, &net->tx)) {
+        return;
+    }
+    while (!net->tx_blocked) {
+        GoldfishNetDesc descs[GOLDFISH_NET_MAX_FRAGMENTS];
+        GoldfishNetDesc desc;
+        // The lengths come from the guest, this can't wrap.
+        uint64_t total = 0;
+        int count = 0;
+        int ret = -1;
+        int n;
+
+        // Collect the descriptors of the next frame.
+        for (;;) {
+            if (count == (int)net->ring_size ||
+                !goldfishNet_readDesc(net, &net->tx, net->tx.head + count,
+                                      &desc)) {
+                // Not completely handed over yet.
+                goto done;
+            }
+            if (count < GOLDFISH_NET_MAX_FRAGMENTS) {
+                descs[count] = desc;
+            }
+            total += desc.len;
+            count++;
+            if (!(desc.flags & GOLDFISH_NET_DESC_MORE)) {
+                break;
+            }
+        }
+
+        if (count <= GOLDFISH_NET_MAX_FRAGMENTS) {
+            ret = goldfishNet_sendFrame(net, descs, count, total);
+        }
+        for (n = 0; n < count; n++) {
+            uint32_t flags = (n + 1 < count) ? GOLDFISH_NET_DESC_MORE : 0;
+            if (ret < 0) {
+                flags |= GOLDFISH_NET_DESC_ERROR;
+            }
+            goldfishNet_completeDesc(net, &net->tx, net->tx.head + n,
+                                     n < GOLDFISH_NET_MAX_FRAGMENTS ?
+                                         descs[n].len : 0,
+                                     flags);
+        }
+        net->tx.head += count;
+        if (ret < 0) {
+            net->stats.tx_errors++;
+        } else {
+            net->stats.tx_frames++;
+            net->stats.tx_bytes += total;
+        }
+        goldfishNet_complete(net, GOLDFISH_NET_INT_TX);
+        if (ret == 0) {
+            // Queued by the network, which will call goldfishNet_txResume().
+            net->tx_blocked = 1;
+        }
+    }
+done:
+    goldfishNet_endBatch(net);
+}
+
+void goldfishNet_txResume(GoldfishNet* net) {
+    net->tx_blocked = 0;
+    goldfishNet_processTx(net);
+}
+
+void goldfishNet_timerExpired(GoldfishNet* net) {
+    net->timer_armed = 0;
+    if (net->pending_count > 0) {
+        goldfishNet_signal(net);
+    }
+}
+
+int goldfishNet_canReceive(GoldfishNet* net) {
+    GoldfishNetDesc desc;
+
+    if (!goldfishNet_ringEnabled(net, &net->rx)) {
+        return 0;
+    }
+    return goldfishNet_readDesc(net, &net->rx, net->rx.head, &desc);
+}
+
+int goldfishNet_receive(GoldfishNet* net, const uint8_t* buf, size_t len) {
+    GoldfishNetDesc desc;
+    uint32_t flags = 0;
+
+    if (!goldfishNet_ringEnabled(net, &net->rx) ||
+        !goldfishNet_readDesc(net, &net->rx, net->rx.head, &desc)) {
+        net->stats.rx_no_buffer++;
+        return 0;
+    }
+    if (len > desc.len) {
+        flags = GOLDFISH_NET_DESC_ERROR;
+        net->stats.rx_errors++;
+        desc.len = 0;
+    } else {
+        net->ops->write_mem(net->opaque, desc.addr, buf, len);
+        desc.len = len;
+        net->stats.rx_frames++;
+        net->stats.rx_bytes += len;
+    }
+    goldfishNet_completeDesc(net, &net->rx, net->rx.head, desc.len, flags);
+    net->rx.head++;
+    goldfishNet_complete(net, GOLDFISH_NET_INT_RX);
+    goldfishNet_endBatch(net);
+    return len;
+}
+
+uint32_t goldfishNet_read(GoldfishNet* net, uint32_t offset) {
+    net->stats.mmio_accesses++;
+
+    switch (offset) {
+    case GOLDFISH_NET_INT_STATUS:
+        return net->int_status;
+    case GOLDFISH_NET_INT_ENABLE:
+        return net->int_enable;
+    case GOLDFISH_NET_RING_SIZE:
+        return net->ring_size;
+    case GOLDFISH_NET_MAC_LOW:
+        return getLe32(net->mac);
+    case GOLDFISH_NET_MAC_HIGH:
+        return net->mac[4] | (net->mac[5] << 8);
+    case GOLDFISH_NET_COALESCE_FRAMES:
+        return net->coalesce_frames;
+    case GOLDFISH_NET_COALESCE_USECS:
+        return net->coalesce_usecs;
+    case GOLDFISH_NET_TX_HEAD:
+        return net->tx.head & (net->ring_size - 1);
+    case GOLDFISH_NET_RX_HEAD:
+        return net->rx.head & (net->ring_size - 1);
+    default:
+        return 0;
+    }
+}
+
+void goldfishNet_write(GoldfishNet* net, uint32_t offset, uint32_t value) {
+    net->stats.mmio_accesses++;
+
+    switch (offset) {
+    case GOLDFISH_NET_INT_STATUS:
+        net->int_status &= ~value;
+        goldfishNet_updateIrq(net);
+        break;
+    case GOLDFISH_NET_INT_ENABLE:
+        net->int_enable = value;
+        goldfishNet_updateIrq(net);
+        break;
+    case GOLDFISH_NET_DOORBELL:
+        net->stats.doorbells++;
+        if (value & GOLDFISH_NET_KICK_TX) {
+            goldfishNet_processTx(net);
+        }
+        if ((value & GOLDFISH_NET_KICK_RX) && net->ops->rx_ready) {
+            net->ops->rx_ready(net->opaque);
+        }
+        break;
+    case GOLDFISH_NET_TX_RING:
+        setLow32(&net->tx.base, value);
+        break;
+    case GOLDFISH_NET_TX_RING_HIGH:
+        setHigh32(&net->tx.base, value);
+        break;
+    case GOLDFISH_NET_RX_RING:
+        setLow32(&net->rx.base, value);
+        break;
+    case GOLDFISH_NET_RX_RING_HIGH:
+        setHigh32(&net->rx.base, value);
+        break;
+    case GOLDFISH_NET_RING_SIZE:
+        // Restart both rings. Anything but a power of 2 disables them.
+        if (value > GOLDFISH_NET_MAX_RING_SIZE || (value & (value - 1))) {
+            value = 0;
+        }
+        net->ring_size = value;
+        net->tx.head = 0;
+        net->rx.head = 0;
+        break;
+    case GOLDFISH_NET_COALESCE_FRAMES:
+        net->coalesce_frames = value ? value : 1;
+        break;
+    case GOLDFISH_NET_COALESCE_USECS:
+        net->coalesce_usecs = value;
+        break;
+    default:
+        break;
+    }
+}
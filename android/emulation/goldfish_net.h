@@ -0,0 +1,177 @@
+// Copyright (C) 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_EMULATION_GOLDFISH_NET_H
+#define ANDROID_EMULATION_GOLDFISH_NET_H
+
+#include "android/utils/compiler.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+// Model of the goldfish paravirtual network device.
+//
+// Unlike the smc91c111, which moves frames through a data register one
+// MMIO access at a time, the device exchanges frames with the guest
+// through two rings of descriptors in guest memory, one for transmission
+// and one for reception. The guest fills descriptors, hands them over by
+// setting GOLDFISH_NET_DESC_OWNED, and writes the doorbell register once
+// per batch. The device clears the flag of each descriptor it is done
+// with, and raises its interrupt after |coalesce_frames| completions, or
+// |coalesce_usecs| after the first unsignalled one.
+//
+// This file only has the register and ring logic. Guest memory, the
+// network, the IRQ line and the coalescing timer are reached through a
+// GoldfishNetOps, see hw/android/goldfish/net.c.
+
+// Registers, all 32-bit.
+enum {
+    GOLDFISH_NET_INT_STATUS       = 0x00,  // R: pending causes, W: ack.
+    GOLDFISH_NET_INT_ENABLE       = 0x04,  // RW: causes that raise the IRQ.
+    GOLDFISH_NET_DOORBELL         = 0x08,  // W: GOLDFISH_NET_KICK_XXX.
+    GOLDFISH_NET_TX_RING          = 0x0c,  // W: TX ring guest address.
+    GOLDFISH_NET_TX_RING_HIGH     = 0x10,
+    GOLDFISH_NET_RX_RING          = 0x14,  // W: RX ring guest address.
+    GOLDFISH_NET_RX_RING_HIGH     = 0x18,
+    GOLDFISH_NET_RING_SIZE        = 0x1c,  // RW: descriptors per ring.
+    GOLDFISH_NET_MAC_LOW          = 0x20,  // R: MAC address bytes 0-3.
+    GOLDFISH_NET_MAC_HIGH         = 0x24,  // R: MAC address bytes 4-5.
+    GOLDFISH_NET_COALESCE_FRAMES  = 0x28,  // RW
+    GOLDFISH_NET_COALESCE_USECS   = 0x2c,  // RW
+    GOLDFISH_NET_TX_HEAD          = 0x30,  // R: next TX descriptor index.
+    GOLDFISH_NET_RX_HEAD          = 0x34,  // R: next RX descriptor index.
+};
+
+// Interrupt causes.
+#define GOLDFISH_NET_INT_TX      (1U << 0)  // TX descriptors completed.
+#define GOLDFISH_NET_INT_RX      (1U << 1)  // RX descriptors completed.
+
+// Doorbell bits.
+#define GOLDFISH_NET_KICK_TX     (1U << 0)  // New TX descriptors.
+#define GOLDFISH_NET_KICK_RX     (1U << 1)  // New RX buffers.
+
+// A descriptor is 16 bytes of guest memory, in little-endian order:
+//   0: buffer guest physical address, 64-bit.
+//   8: length. For TX, the bytes to send. For RX, the buffer size, which
+//      the device replaces with the size of the frame received.
+//  12: flags.
+#define GOLDFISH_NET_DESC_SIZE   16
+
+#define GOLDFISH_NET_DESC_OWNED  (1U << 0)  // Set by the guest for the
+                                            // device, cleared when done.
+#define GOLDFISH_NET_DESC_MORE   (1U << 1)  // TX: frame continues in the
+                                            // next descriptor.
+#define GOLDFISH_NET_DESC_ERROR  (1U << 2)  // Set by the device if the
+                                            // frame was dropped.
+
+// Largest ring, and largest frame, without FCS.
+#define GOLDFISH_NET_MAX_RING_SIZE   4096
+#define GOLDFISH_NET_MAX_FRAME       1514
+#define GOLDFISH_NET_MAX_FRAGMENTS   16
+
+typedef struct {
+    void*   base;
+    size_t  len;
+} GoldfishNetIov;
+
+typedef struct {
+    // Copy between guest physical memory at |addr| and |buf|.
+    void  (*read_mem)(void* opaque, uint64_t addr, void* buf, uint32_t len);
+    void  (*write_mem)(void* opaque, uint64_t addr, const void* buf,
+                       uint32_t len);
+    // Return a host pointer to the |len| bytes of guest RAM at |addr|, or
+    // NULL if they are not all RAM. Can be NULL to always copy.
+    void* (*map_mem)(void* opaque, uint64_t addr, uint32_t len,
+                     int is_write);
+    void  (*unmap_mem)(void* opaque, void* host, uint32_t len,
+                       int is_write);
+    // Send a frame made of |count| fragments. Return 0 if it was queued
+    // because the network is busy: no other frame is sent until
+    // goldfishNet_txResume() is called.
+    int   (*send)(void* opaque, const GoldfishNetIov* iov, int count);
+    void  (*set_irq)(void* opaque, int level);
+    // Call goldfishNet_timerExpired() in |usecs| microseconds, or never if
+    // |usecs| is 0.
+    void  (*set_timer)(void* opaque, uint32_t usecs);
+    // New RX buffers are available, retry the frames that were refused.
+    void  (*rx_ready)(void* opaque);
+} GoldfishNetOps;
+
+typedef struct {
+    uint64_t  base;     // Guest address of the descriptors, 0 if unset.
+    uint32_t  head;     // Free-running index of the next descriptor.
+} GoldfishNetRing;
+
+typedef struct {
+    uint64_t  tx_frames;
+    uint64_t  tx_bytes;
+    uint64_t  tx_errors;
+    uint64_t  rx_frames;
+    uint64_t  rx_bytes;
+    uint64_t  rx_errors;      // Frames larger than the RX buffer.
+    uint64_t  rx_no_buffer;   // Frames refused for lack of RX buffers.
+    uint64_t  interrupts;     // IRQ raises.
+    uint64_t  mmio_accesses;  // Register reads and writes.
+    uint64_t  doorbells;
+} GoldfishNetStats;
+
+typedef struct {
+    const GoldfishNetOps*  ops;
+    void*                  opaque;
+    uint8_t                mac[6];
+    uint32_t               int_status;
+    uint32_t               int_enable;
+    uint32_t               ring_size;
+    GoldfishNetRing        tx;
+    GoldfishNetRing        rx;
+    uint32_t               coalesce_frames;
+    uint32_t               coalesce_usecs;
+    uint32_t               pending_causes;   // Not signalled yet.
+    uint32_t               pending_count;
+    int                    timer_armed;
+    int                    tx_blocked;
+    int                    irq_level;
+    GoldfishNetStats       stats;
+    uint8_t                bounce[GOLDFISH_NET_MAX_FRAME];
+} GoldfishNet;
+
+// Initialize |net| with |ops| and its |opaque| argument.
+void goldfishNet_init(GoldfishNet* net, const GoldfishNetOps* ops,
+                      void* opaque, const uint8_t mac[6]);
+
+// Put |net| back in its power-on state. The statistics are kept.
+void goldfishNet_reset(GoldfishNet* net);
+
+// Register accesses by the guest.
+uint32_t goldfishNet_read(GoldfishNet* net, uint32_t offset);
+void goldfishNet_write(GoldfishNet* net, uint32_t offset, uint32_t value);
+
+// Return true iff a frame can be received right now.
+int goldfishNet_canReceive(GoldfishNet* net);
+
+// Pass a frame from the network to the guest. Return |len| if it was
+// consumed, even if dropped, or 0 if there is no RX buffer for it.
+int goldfishNet_receive(GoldfishNet* net, const uint8_t* buf, size_t len);
+
+// The network took the frame that the send callback queued.
+void goldfishNet_txResume(GoldfishNet* net);
+
+// The coalescing timer expired.
+void goldfishNet_timerExpired(GoldfishNet* net);
+
+// Recompute the IRQ level, e.g. after restoring the state of |net|.
+void goldfishNet_updateIrq(GoldfishNet* net);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_EMULATION_GOLDFISH_NET_H
@@ -0,0 +1,134 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// Measures the goldfish network device model driven by a minimal guest
+// driver over a fake guest memory region: packets per second, and MMIO
+// accesses (i.e. VM exits) and interrupts per packet, for several batch
+// sizes and coalescing settings. For reference, moving a 1514-byte frame
+// through the smc91c111 data register takes about 380 MMIO accesses.
+// Run with emulator_benchmarks.
+
+#include "android/emulation/goldfish_net.h"
+#include "android/emulation/goldfish_net_testing.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using android::FakeGoldfishNetGuest;
+
+const uint32_t kRingSize = 256;
+const int kFrameSize = GOLDFISH_NET_MAX_FRAME;
+const int kFrames = 2000000;
+
+double elapsedSecs(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// The guest interrupt handler: read and acknowledge the causes.
+void handleIrq(FakeGoldfishNetGuest* guest) {
+    if (guest->irqLevel) {
+        guest->ack();
+    }
+}
+
+// Coalescing timer expiry, when the guest has nothing else to do.
+void expireTimer(FakeGoldfishNetGuest* guest) {
+    if (guest->net.timer_armed) {
+        goldfishNet_timerExpired(&guest->net);
+        handleIrq(guest);
+    }
+}
+
+void printResult(const char* dir, int batch, uint32_t frames, uint32_t usecs,
+                 const GoldfishNetStats& stats, uint64_t packets,
+                 double secs) {
+    printf("%s batch %3d, coalesce %2u frames %3u us: %5.2f Mpackets/s, "
+           "%.3f MMIO/packet, %.3f IRQ/packet\n",
+           dir, batch, frames, usecs, packets / secs / 1e6,
+           (double)stats.mmio_accesses / packets,
+           (double)stats.interrupts / packets);
+}
+
+// The guest queues |batch| frames and rings the doorbell once.
+void measureTx(int batch, uint32_t frames, uint32_t usecs) {
+    FakeGoldfishNetGuest guest(kRingSize);
+    static uint8_t frame[kFrameSize];
+
+    guest.keepFrames = false;
+    guest.probe(frames, usecs);
+    memset(&guest.net.stats, 0, sizeof(guest.net.stats));
+
+    clock_t start = clock();
+    for (int sent = 0; sent < kFrames; sent += batch) {
+        for (int n = 0; n < batch; ++n) {
+            ASSERT_TRUE(guest.queueTx(frame, sizeof(frame), 1));
+        }
+        guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_TX);
+        handleIrq(&guest);
+        expireTimer(&guest);
+        ASSERT_EQ(batch, guest.reapTx());
+    }
+    double secs = elapsedSecs(start);
+
+    ASSERT_EQ((uint64_t)guest.sentFrames, guest.net.stats.tx_frames);
+    printResult("TX", batch, frames, usecs, guest.net.stats,
+                guest.net.stats.tx_frames, secs);
+}
+
+// The network delivers |batch| frames in a row, the guest then reaps them
+// and gives the buffers back with one doorbell.
+void measureRx(int batch, uint32_t frames, uint32_t usecs) {
+    FakeGoldfishNetGuest guest(kRingSize);
+    static uint8_t frame[kFrameSize];
+
+    guest.probe(frames, usecs);
+    guest.fillRx(kRingSize);
+    memset(&guest.net.stats, 0, sizeof(guest.net.stats));
+
+    clock_t start = clock();
+    for (int received = 0; received < kFrames; received += batch) {
+        for (int n = 0; n < batch; ++n) {
+            ASSERT_EQ(kFrameSize,
+                      goldfishNet_receive(&guest.net, frame, sizeof(frame)));
+            handleIrq(&guest);
+        }
+        expireTimer(&guest);
+        ASSERT_EQ(batch, guest.reapRx(NULL));
+        guest.fillRx(batch);
+        guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_RX);
+    }
+    double secs = elapsedSecs(start);
+
+    ASSERT_EQ(0U, guest.net.stats.rx_no_buffer);
+    printResult("RX", batch, frames, usecs, guest.net.stats,
+                guest.net.stats.rx_frames, secs);
+}
+
+}  // namespace
+
+TEST(GoldfishNetBenchmark, Transmit) {
+    measureTx(1, 1, 0);
+    measureTx(32, 1, 0);
+    measureTx(32, 16, 0);
+    measureTx(32, 64, 100);
+}
+
+TEST(GoldfishNetBenchmark, Receive) {
+    measureRx(1, 1, 0);
+    measureRx(32, 1, 0);
+    measureRx(32, 16, 0);
+    measureRx(32, 64, 100);
+}
@@ -0,0 +1,258 @@
+// Copyright (C) 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_EMULATION_GOLDFISH_NET_TESTING_H
+#define ANDROID_EMULATION_GOLDFISH_NET_TESTING_H
+
+#include "android/emulation/goldfish_net.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace android {
+
+// A GoldfishNet device in a fake guest: a flat memory region holds both
+// rings and one 2 KB buffer per descriptor, and a minimal driver fills
+// and reaps the rings. The frames sent by the device are collected in
+// |sent|, the IRQ line and the coalescing timer are recorded.
+class FakeGoldfishNetGuest {
+public:
+    static const uint64_t kMemBase = 0x40000000;
+    static const uint32_t kBufferSize = 2048;
+
+    FakeGoldfishNetGuest(uint32_t ringSize)
+            : canMap(true), sendBusy(false), keepFrames(true),
+              sentFrames(0), irqLevel(0), timerUsecs(0), rxReadyCalls(0),
+              mRingSize(ringSize),
+              mMem(2 * ringSize * (GOLDFISH_NET_DESC_SIZE + kBufferSize)),
+              mTxTail(0), mTxClean(0), mRxTail(0), mRxClean(0) {
+        static const GoldfishNetOps ops = {
+            readMem, writeMem, mapMem, unmapMem,
+            send, setIrq, setTimer, rxReady,
+        };
+        static const uint8_t mac[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+        goldfishNet_init(&net, &ops, this, mac);
+    }
+
+    // Program the rings, the interrupt mask and coalescing, like a driver
+    // probe would.
+    void probe(uint32_t coalesceFrames, uint32_t coalesceUsecs) {
+        uint64_t tx = txRing();
+        uint64_t rx = rxRing();
+        write(GOLDFISH_NET_TX_RING, (uint32_t)tx);
+        write(GOLDFISH_NET_TX_RING_HIGH, (uint32_t)(tx >> 32));
+        write(GOLDFISH_NET_RX_RING, (uint32_t)rx);
+        write(GOLDFISH_NET_RX_RING_HIGH, (uint32_t)(rx >> 32));
+        write(GOLDFISH_NET_RING_SIZE, mRingSize);
+        write(GOLDFISH_NET_COALESCE_FRAMES, coalesceFrames);
+        write(GOLDFISH_NET_COALESCE_USECS, coalesceUsecs);
+        write(GOLDFISH_NET_INT_ENABLE,
+              GOLDFISH_NET_INT_TX | GOLDFISH_NET_INT_RX);
+    }
+
+    uint32_t read(uint32_t offset) {
+        return goldfishNet_read(&net, offset);
+    }
+
+    void write(uint32_t offset, uint32_t value) {
+        goldfishNet_write(&net, offset, value);
+    }
+
+    // Queue a frame split in |fragments| descriptors. No register access.
+    // Return false if the ring is full.
+    bool queueTx(const uint8_t* data, uint32_t len, int fragments) {
+        if (mTxTail + fragments - mTxClean > mRingSize) {
+            return false;
+        }
+        uint32_t offset = 0;
+        for (int n = 0; n < fragments; ++n) {
+            uint32_t l = (n + 1 < fragments) ? len / fragments
+                                             : len - offset;
+            uint32_t index = mTxTail++ & (mRingSize - 1);
+            uint64_t buffer = txBuffer(index);
+            memcpy(host(buffer), data + offset, l);
+            offset += l;
+            putDesc(txRing() + index * GOLDFISH_NET_DESC_SIZE, buffer, l,
+                    GOLDFISH_NET_DESC_OWNED |
+                    ((n + 1 < fragments) ? GOLDFISH_NET_DESC_MORE : 0));
+        }
+        return true;
+    }
+
+    // Overwrite the length of the TX descriptor at |index|, like a
+    // malicious guest could.
+    void setTxLength(uint32_t index, uint32_t len) {
+        putLe32(host(txRing() + index * GOLDFISH_NET_DESC_SIZE) + 8, len);
+    }
+
+    // Count the TX descriptors that the device gave back.
+    int reapTx() {
+        int count = 0;
+        while (mTxClean != mTxTail &&
+               !(descFlags(txRing(), mTxClean) & GOLDFISH_NET_DESC_OWNED)) {
+            mTxClean++;
+            count++;
+        }
+        return count;
+    }
+
+    // Hand |count| RX buffers to the device. No register access.
+    void fillRx(uint32_t count) {
+        while (count-- > 0 && mRxTail - mRxClean < mRingSize) {
+            uint32_t index = mRxTail++ & (mRingSize - 1);
+            putDesc(rxRing() + index * GOLDFISH_NET_DESC_SIZE,
+                    rxBuffer(index), kBufferSize, GOLDFISH_NET_DESC_OWNED);
+        }
+    }
+
+    // Collect the frames that the device received, dropped ones as empty
+    // strings. Return their number.
+    int reapRx(std::vector<std::string>* frames) {
+        int count = 0;
+        while (mRxClean != mRxTail) {
+            uint32_t index = mRxClean & (mRingSize - 1);
+            const uint8_t* desc =
+                    host(rxRing() + index * GOLDFISH_NET_DESC_SIZE);
+            uint32_t flags = getLe32(desc + 12);
+            if (flags & GOLDFISH_NET_DESC_OWNED) {
+                break;
+            }
+            if (frames) {
+                frames->push_back(std::string(
+                        reinterpret_cast<const char*>(host(rxBuffer(index))),
+                        (flags & GOLDFISH_NET_DESC_ERROR) ?
+                                0 : getLe32(desc + 8)));
+            }
+            mRxClean++;
+            count++;
+        }
+        return count;
+    }
+
+    // Read and acknowledge the interrupt causes.
+    uint32_t ack() {
+        uint32_t status = read(GOLDFISH_NET_INT_STATUS);
+        write(GOLDFISH_NET_INT_STATUS, status);
+        return status;
+    }
+
+    uint32_t descFlags(uint64_t ring, uint32_t index) {
+        return getLe32(host(ring + (index & (mRingSize - 1)) *
+                                   GOLDFISH_NET_DESC_SIZE) + 12);
+    }
+
+    uint64_t txRing() const { return kMemBase; }
+    uint64_t rxRing() const {
+        return kMemBase + mRingSize * GOLDFISH_NET_DESC_SIZE;
+    }
+
+    GoldfishNet net;
+    bool canMap;
+    bool sendBusy;
+    bool keepFrames;
+    std::vector<std::string> sent;
+    int sentFrames;
+    int irqLevel;
+    uint32_t timerUsecs;
+    int rxReadyCalls;
+
+private:
+    uint64_t txBuffer(uint32_t index) const {
+        return kMemBase + 2 * mRingSize * GOLDFISH_NET_DESC_SIZE +
+               index * kBufferSize;
+    }
+
+    uint64_t rxBuffer(uint32_t index) const {
+        return txBuffer(mRingSize + index);
+    }
+
+    uint8_t* host(uint64_t addr) { return &mMem[addr - kMemBase]; }
+
+    static uint32_t getLe32(const uint8_t* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    static void putLe32(uint8_t* p, uint32_t value) {
+        for (int n = 0; n < 4; ++n) {
+            p[n] = (uint8_t)(value >> (8 * n));
+        }
+    }
+
+    void putDesc(uint64_t addr, uint64_t buffer, uint32_t len,
+                 uint32_t flags) {
+        uint8_t* p = host(addr);
+        putLe32(p, (uint32_t)buffer);
+        putLe32(p + 4, (uint32_t)(buffer >> 32));
+        putLe32(p + 8, len);
+        putLe32(p + 12, flags);
+    }
+
+    static FakeGoldfishNetGuest* self(void* opaque) {
+        return static_cast<FakeGoldfishNetGuest*>(opaque);
+    }
+
+    static void readMem(void* opaque, uint64_t addr, void* buf,
+                        uint32_t len) {
+        memcpy(buf, self(opaque)->host(addr), len);
+    }
+
+    static void writeMem(void* opaque, uint64_t addr, const void* buf,
+                         uint32_t len) {
+        memcpy(self(opaque)->host(addr), buf, len);
+    }
+
+    static void* mapMem(void* opaque, uint64_t addr, uint32_t len,
+                        int isWrite) {
+        return self(opaque)->canMap ? self(opaque)->host(addr) : NULL;
+    }
+
+    static void unmapMem(void* opaque, void* host, uint32_t len,
+                         int isWrite) {}
+
+    static int send(void* opaque, const GoldfishNetIov* iov, int count) {
+        FakeGoldfishNetGuest* guest = self(opaque);
+        guest->sentFrames++;
+        if (guest->keepFrames) {
+            std::string frame;
+            for (int n = 0; n < count; ++n) {
+                frame.append(static_cast<const char*>(iov[n].base),
+                             iov[n].len);
+            }
+            guest->sent.push_back(frame);
+        }
+        return guest->sendBusy ? 0 : 1;
+    }
+
+    static void setIrq(void* opaque, int level) {
+        self(opaque)->irqLevel = level;
+    }
+
+    static void setTimer(void* opaque, uint32_t usecs) {
+        self(opaque)->timerUsecs = usecs;
+    }
+
+    static void rxReady(void* opaque) {
+        self(opaque)->rxReadyCalls++;
+    }
+
+    uint32_t mRingSize;
+    std::vector<uint8_t> mMem;
+    uint32_t mTxTail;
+    uint32_t mTxClean;
+    uint32_t mRxTail;
+    uint32_t mRxClean;
+};
+
+}  // namespace android
+
+#endif  // ANDROID_EMULATION_GOLDFISH_NET_TESTING_H
@@ -0,0 +1,259 @@
+// Copyright (C) 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/emulation/goldfish_net.h"
+#include "android/emulation/goldfish_net_testing.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+namespace {
+
+std::string makeFrame(size_t len, char seed) {
+    std::string frame(len, 0);
+    for (size_t n = 0; n < len; ++n) {
+        frame[n] = (char)(seed + n);
+    }
+    return frame;
+}
+
+bool queueFrame(FakeGoldfishNetGuest* guest, const std::string& frame,
+                int fragments) {
+    return guest->queueTx(reinterpret_cast<const uint8_t*>(frame.data()),
+                          frame.size(), fragments);
+}
+
+int receiveFrame(FakeGoldfishNetGuest* guest, const std::string& frame) {
+    return goldfishNet_receive(&guest->net,
+                               reinterpret_cast<const uint8_t*>(frame.data()),
+                               frame.size());
+}
+
+}  // namespace
+
+TEST(GoldfishNet, Registers) {
+    FakeGoldfishNetGuest guest(8);
+
+    EXPECT_EQ(0x12005452U, guest.read(GOLDFISH_NET_MAC_LOW));
+    EXPECT_EQ(0x5634U, guest.read(GOLDFISH_NET_MAC_HIGH));
+    EXPECT_EQ(1U, guest.read(GOLDFISH_NET_COALESCE_FRAMES));
+
+    guest.write(GOLDFISH_NET_RING_SIZE, 12);
+    EXPECT_EQ(0U, guest.read(GOLDFISH_NET_RING_SIZE));
+    guest.write(GOLDFISH_NET_RING_SIZE, GOLDFISH_NET_MAX_RING_SIZE * 2);
+    EXPECT_EQ(0U, guest.read(GOLDFISH_NET_RING_SIZE));
+
+    guest.probe(1, 0);
+    EXPECT_EQ(8U, guest.read(GOLDFISH_NET_RING_SIZE));
+    EXPECT_EQ(guest.txRing(), guest.net.tx.base);
+    EXPECT_EQ(guest.rxRing(), guest.net.rx.base);
+    EXPECT_EQ(0U, guest.read(GOLDFISH_NET_TX_HEAD));
+    EXPECT_EQ(17U, guest.net.stats.mmio_accesses);
+}
+
+TEST(GoldfishNet, Transmit) {
+    FakeGoldfishNetGuest guest(8);
+    guest.probe(1, 0);
+
+    std::string small = makeFrame(60, 'a');
+    std::string large = makeFrame(GOLDFISH_NET_MAX_FRAME, 'b');
+    ASSERT_TRUE(queueFrame(&guest, small, 1));
+    ASSERT_TRUE(queueFrame(&guest, large, 3));
+    // Nothing happens before the doorbell.
+    EXPECT_EQ(0, guest.sentFrames);
+
+    guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_TX);
+    ASSERT_EQ(2U, guest.sent.size());
+    EXPECT_EQ(small, guest.sent[0]);
+    EXPECT_EQ(large, guest.sent[1]);
+    EXPECT_EQ(4U, guest.read(GOLDFISH_NET_TX_HEAD));
+
+    // The MORE flags are kept, the OWNED ones cleared.
+    EXPECT_EQ(0U, guest.descFlags(guest.txRing(), 0));
+    EXPECT_EQ(GOLDFISH_NET_DESC_MORE, guest.descFlags(guest.txRing(), 1));
+    EXPECT_EQ(0U, guest.descFlags(guest.txRing(), 3));
+    EXPECT_EQ(4, guest.reapTx());
+
+    EXPECT_EQ(1, guest.irqLevel);
+    EXPECT_EQ(GOLDFISH_NET_INT_TX, guest.ack());
+    EXPECT_EQ(0, guest.irqLevel);
+    EXPECT_EQ(2U, guest.net.stats.tx_frames);
+    EXPECT_EQ(small.size() + large.size(), guest.net.stats.tx_bytes);
+
+    // Wrap around the ring.
+    for (int n = 0; n < 3; ++n) {
+        ASSERT_TRUE(queueFrame(&guest, makeFrame(100, 'c' + n), 2));
+    }
+    guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_TX);
+    ASSERT_EQ(5U, guest.sent.size());
+    EXPECT_EQ(makeFrame(100, 'e'), guest.sent[4]);
+    EXPECT_EQ(6, guest.reapTx());
+}
+
+TEST(GoldfishNet, TransmitWithoutMapping) {
+    FakeGoldfishNetGuest guest(8);
+    guest.probe(1, 0);
+    guest.canMap = false;
+
+    std::string frame = makeFrame(1000, 'x');
+    ASSERT_TRUE(queueFrame(&guest, frame, 4));
+    guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_TX);
+    ASSERT_EQ(1U, guest.sent.size());
+    EXPECT_EQ(frame, guest.sent[0]);
+}
+
+TEST(GoldfishNet, TransmitErrors) {
+    FakeGoldfishNetGuest guest(8);
+    guest.probe(1, 0);
+
+    // Too large: dropped, with the error flag.
+    ASSERT_TRUE(queueFrame(&guest, makeFrame(GOLDFISH_NET_MAX_FRAME + 1, 'x'),
+                           2));
+    // The next frame still goes through.
+    ASSERT_TRUE(queueFrame(&guest, makeFrame(100, 'y'), 1));
+    guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_TX);
+    EXPECT_EQ(1U, guest.sent.size());
+    EXPECT_EQ(1U, guest.net.stats.tx_errors);
+    EXPECT_EQ(GOLDFISH_NET_DESC_MORE | GOLDFISH_NET_DESC_ERROR,
+              guest.descFlags(guest.txRing(), 0));
+    EXPECT_EQ(GOLDFISH_NET_DESC_ERROR, guest.descFlags(guest.txRing(), 1));
+    EXPECT_EQ(0U, guest.descFlags(guest.txRing(), 2));
+    EXPECT_EQ(1U, guest.net.stats.tx_frames);
+}
+
+TEST(GoldfishNet, TransmitWrappingLengths) {
+    FakeGoldfishNetGuest guest(8);
+    guest.probe(1, 0);
+    guest.canMap = false;
+
+    // The lengths add up to 0x100 in 32 bits: the frame must be dropped
+    // instead of copied to the bounce buffer.
+    ASSERT_TRUE(queueFrame(&guest, makeFrame(0x100, 'x'), 2));
+    guest.setTxLength(0, 0xffffff00);
+    guest.setTxLength(1, 0x200);
+    ASSERT_TRUE(queueFrame(&guest, makeFrame(100, 'y'), 1));
+    guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_TX);
+    ASSERT_EQ(1U, guest.sent.size());
+    EXPECT_EQ(makeFrame(100, 'y'), guest.sent[0]);
+    EXPECT_EQ(1U, guest.net.stats.tx_errors);
+    EXPECT_EQ(GOLDFISH_NET_DESC_MORE | GOLDFISH_NET_DESC_ERROR,
+              guest.descFlags(guest.txRing(), 0));
+    EXPECT_EQ(GOLDFISH_NET_DESC_ERROR, guest.descFlags(guest.txRing(), 1));
+}
+
+TEST(GoldfishNet, TransmitBusy) {
+    FakeGoldfishNetGuest guest(8);
+    guest.probe(1, 0);
+
+    guest.sendBusy = true;
+    ASSERT_TRUE(queueFrame(&guest, makeFrame(100, 'a'), 1));
+    ASSERT_TRUE(queueFrame(&guest, makeFrame(100, 'b'), 1));
+    guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_TX);
+    // The first frame was queued by the network, the second one waits.
+    EXPECT_EQ(1, guest.sentFrames);
+    EXPECT_EQ(1, guest.reapTx());
+    guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_TX);
+    EXPECT_EQ(1, guest.sentFrames);
+
+    guest.sendBusy = false;
+    goldfishNet_txResume(&guest.net);
+    EXPECT_EQ(2, guest.sentFrames);
+    EXPECT_EQ(1, guest.reapTx());
+}
+
+TEST(GoldfishNet, Receive) {
+    FakeGoldfishNetGuest guest(4);
+    guest.probe(1, 0);
+
+    std::string frame = makeFrame(200, 'r');
+    EXPECT_FALSE(goldfishNet_canReceive(&guest.net));
+    EXPECT_EQ(0, receiveFrame(&guest, frame));
+    EXPECT_EQ(1U, guest.net.stats.rx_no_buffer);
+
+    guest.fillRx(4);
+    guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_RX);
+    EXPECT_EQ(1, guest.rxReadyCalls);
+    EXPECT_TRUE(goldfishNet_canReceive(&guest.net));
+
+    EXPECT_EQ(200, receiveFrame(&guest, frame));
+    std::string huge = makeFrame(FakeGoldfishNetGuest::kBufferSize + 1, 'h');
+    EXPECT_EQ((int)huge.size(), receiveFrame(&guest, huge));
+    EXPECT_EQ(1, guest.irqLevel);
+    EXPECT_EQ(GOLDFISH_NET_INT_RX, guest.ack());
+
+    std::vector<std::string> frames;
+    EXPECT_EQ(2, guest.reapRx(&frames));
+    EXPECT_EQ(frame, frames[0]);
+    EXPECT_EQ("", frames[1]);
+    EXPECT_EQ(1U, guest.net.stats.rx_frames);
+    EXPECT_EQ(1U, guest.net.stats.rx_errors);
+
+    EXPECT_EQ(200, receiveFrame(&guest, frame));
+    EXPECT_EQ(200, receiveFrame(&guest, frame));
+    EXPECT_FALSE(goldfishNet_canReceive(&guest.net));
+}
+
+TEST(GoldfishNet, Coalescing) {
+    FakeGoldfishNetGuest guest(16);
+    guest.probe(4, 100);
+
+    // Three frames: below the threshold, the timer is started.
+    for (int n = 0; n < 3; ++n) {
+        ASSERT_TRUE(queueFrame(&guest, makeFrame(64, n), 1));
+    }
+    guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_TX);
+    EXPECT_EQ(0, guest.irqLevel);
+    EXPECT_EQ(100U, guest.timerUsecs);
+
+    goldfishNet_timerExpired(&guest.net);
+    EXPECT_EQ(1, guest.irqLevel);
+    guest.ack();
+    EXPECT_EQ(1U, guest.net.stats.interrupts);
+
+    // Nine frames: two signals in the batch, then the timer for the last.
+    for (int n = 0; n < 9; ++n) {
+        ASSERT_TRUE(queueFrame(&guest, makeFrame(64, n), 1));
+    }
+    guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_TX);
+    EXPECT_EQ(1, guest.irqLevel);
+    EXPECT_EQ(2U, guest.net.stats.interrupts);
+    EXPECT_EQ(1U, guest.net.pending_count);
+    EXPECT_EQ(100U, guest.timerUsecs);
+
+    // Acknowledged before the timer: no new interrupt until it expires.
+    guest.ack();
+    EXPECT_EQ(0, guest.irqLevel);
+    goldfishNet_timerExpired(&guest.net);
+    EXPECT_EQ(1, guest.irqLevel);
+    EXPECT_EQ(3U, guest.net.stats.interrupts);
+
+    // Masked causes don't raise the line.
+    guest.write(GOLDFISH_NET_INT_ENABLE, GOLDFISH_NET_INT_RX);
+    EXPECT_EQ(0, guest.irqLevel);
+    EXPECT_EQ(GOLDFISH_NET_INT_TX, guest.ack());
+}
+
+TEST(GoldfishNet, Reset) {
+    FakeGoldfishNetGuest guest(8);
+    guest.probe(4, 100);
+    ASSERT_TRUE(queueFrame(&guest, makeFrame(64, 'a'), 1));
+    guest.write(GOLDFISH_NET_DOORBELL, GOLDFISH_NET_KICK_TX);
+    EXPECT_TRUE(guest.net.timer_armed);
+
+    goldfishNet_reset(&guest.net);
+    EXPECT_FALSE(guest.net.timer_armed);
+    EXPECT_EQ(0U, guest.timerUsecs);
+    EXPECT_EQ(0U, guest.read(GOLDFISH_NET_RING_SIZE));
+    EXPECT_EQ(1U, guest.net.stats.tx_frames);
+}
+
+}  // namespace android
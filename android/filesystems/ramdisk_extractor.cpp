@@ -12,14 +12,16 @@
 #include "android/filesystems/ramdisk_extractor.h"
 
 #include "android/base/Compiler.h"
-#include "android/base/Log.h"
+#include "android/base/containers/PodVector.h"
 #include "android/base/String.h"
+#include "android/utils/file_data.h"
+#include "android/utils/uncompress.h"
 
-#include <inttypes.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <zlib.h>
+#include <sys/stat.h>
 
 #define DEBUG 0
 
@@ -30,137 +32,54 @@
 #endif
 
 // Ramdisk images are gzipped cpio archives using the new ASCII
-// format as described at [1]. Hence this source file first implements
-// a gzip-based input stream class, then 
+// format as described at [1]. Extracting a file used to require
+// decompressing and parsing the archive up to that file, and startup
+// does this several times for the same image. Instead, this source file
+// builds an index of the archive (file name -> offset and size of its
+// data in the decompressed stream) the first time the image is read,
+// and caches it next to the image, in <ramdisk>.idx. The index is keyed
+// by the image's size and modification time, and lets later lookups
+// only decompress the archive up to the last requested file, or skip
+// decompression entirely when a file isn't in the image.
 //
 // [1] http://people.freebsd.org/~kientzle/libarchive/man/cpio.5.txt
 
-namespace {
-
-// Helper class used to implement a gzip-based input stream.
-// Usage is as follows:
-//
-//     GZipInputStream input(filePath);
-//     if (input.error()) {
-//        fprintf(stderr, "Could not open file: %s\n",
-//                filePath, strerror(input.error()));
-//     } else {
-//        uint8_t header[32];
-//        if (!doRead(&input, header, sizeof header)) {
-//           ... error, could not read header.
-//        }
-//     }
-//      .. stream is closed automatically on scope exit.
-class GZipInputStream {
-public:
-    // Open a new input stream to read from file |filePath|.
-    // The constructor can never fail, so call error() after
-    // this to see if an error occured.
-    explicit GZipInputStream(const char* filePath) {
-        mFile = gzopen(filePath, "rb");
-        if (mFile == Z_NULL) {
-            mFile = NULL;
-            mError = errno;
-        } else {
-            mError = 0;
-        }
-    }
-
-    // Return the last error that occured on this stream,
-    // or 0 if everything's well. Note that as soon as an
-    // error occurs, the stream cannot be used anymore.
-    int error() const { return mError; }
-
-    // Close the stream, note that this is called automatically
-    // from the destructor, but clients might want to do this
-    // before.
-    void close() {
-        if (mFile) {
-            gzclose(mFile);
-            mFile = NULL;
-        }
-    }
+using android::base::PodVector;
+using android::base::String;
 
-    ~GZipInputStream() {
-        close();
-    }
-
-    // Try to read up to |len| bytes of data from the input
-    // stream into |buffer|. On success, return true and sets
-    // |*readBytes| to the number of bytes that were read.
-    // On failure, return false and set error().
-    bool tryRead(void* buffer, size_t len, size_t* readBytes) {
-        *readBytes = 0;
-
-        if (mError) {
-            return false;
-        }
-
-        if (len == 0) {
-            return true;
-        }
+namespace {
 
-        // Warning, gzread() takes an unsigned int parameter for
-        // the length, but will return an error if its value
-        // exceeds INT_MAX anyway.
-        char* buff = reinterpret_cast<char*>(buffer);
+// Type of cpio new ASCII header.
+struct cpio_newc_header {
+    char c_magic[6];
+    char c_ino[8];
+    char c_mode[8];
+    char c_uid[8];
+    char c_gid[8];
+    char c_nlink[8];
+    char c_mtime[8];
+    char c_filesize[8];
+    char c_devmajor[8];
+    char c_devminor[8];
+    char c_rdevmajor[8];
+    char c_rdevminor[8];
+    char c_namesize[8];
+    char c_check[8];
+};
 
-        while (len > 0) {
-            size_t avail = len;
-            if (avail > INT_MAX)
-                avail = INT_MAX;
+// Last record is named 'TRAILER!!!' and indicates end of archive.
+const char kTrailer[] = "TRAILER!!!";
 
-            int ret = gzread(mFile, buff, static_cast<unsigned int>(avail));
-            if (ret < 0) {
-                gzerror(mFile, &mError);
-                break;
-            }
-            if (ret == 0) {
-                if (gzeof(mFile)) {
-                    break;
-                }
-                gzerror(mFile, &mError);
-                break;
-            }
-            len -= ret;
-            buff += ret;
-            *readBytes += ret;
-        }
+// Suffix appended to the ramdisk image path to get its index file path.
+const char kIndexSuffix[] = ".idx";
 
-        return (!mError && *readBytes > 0);
-    }
+// First token of an index file, followed by the format version.
+const char kIndexMagic[] = "ramdisk-index";
+const int kIndexVersion = 1;
 
-    // Read exactly |len| bytes of data into |buffer|. On success,
-    // return true, on failure, return false and set error().
-    bool doRead(void* buffer, size_t len) {
-        size_t readCount = 0;
-        if (!tryRead(buffer, len, &readCount)) {
-            return false;
-        }
-        if (readCount < len) {
-            mError = EIO;
-            return false;
-        }
-        return true;
-    }
-
-    bool doSkip(size_t len) {
-        if (mError) {
-            return false;
-        }
-        if (gzseek(mFile, len, SEEK_CUR) < 0) {
-            gzerror(mFile, &mError);
-            return false;
-        }
-        return true;
-    }
-
-private:
-    DISALLOW_COPY_AND_ASSIGN(GZipInputStream);
-
-    gzFile mFile;
-    int mError;
-};
+// Maximum length of a line in an index file, entries with longer names
+// are never written to it.
+const size_t kIndexMaxLine = 1024;
 
 // Parse an hexadecimal string of 8 characters. On success,
 // return true and sets |*value| to its value. On failure,
@@ -186,129 +105,350 @@ bool parse_hex8(const char* input, uint32_t* value) {
     return true;
 }
 
-}  // namespace
-
-bool android_extractRamdiskFile(const char* ramdiskPath,
-                                const char* fileName,
-                                char** out,
-                                size_t* outSize) {
-    *out = NULL;
-    *outSize = 0;
+// Size and modification time of a ramdisk image, used to check that
+// an index file still matches its image.
+struct ImageStamp {
+    uint64_t size;
+    uint64_t mtime;
+};
 
-    GZipInputStream input(ramdiskPath);
-    if (input.error()) {
-        errno = input.error();
+bool getImageStamp(const char* path, ImageStamp* stamp) {
+    struct stat st;
+    if (stat(path, &st) < 0) {
         return false;
     }
+    stamp->size = static_cast<uint64_t>(st.st_size);
+    stamp->mtime = static_cast<uint64_t>(st.st_mtime);
+    return true;
+}
 
-    // Type of cpio new ASCII header.
-    struct cpio_newc_header {
-        char c_magic[6];
-        char c_ino[8];
-        char c_mode[8];
-        char c_uid[8];
-        char c_gid[8];
-        char c_nlink[8];
-        char c_mtime[8];
-        char c_filesize[8];
-        char c_devmajor[8];
-        char c_devminor[8];
-        char c_rdevmajor[8];
-        char c_rdevminor[8];
-        char c_namesize[8];
-        char c_check[8];
+// Helper class used to map the files of a ramdisk archive to the
+// location of their data in the decompressed cpio stream.
+// Usage is:
+//
+//    RamdiskIndex index;
+//    if (!index.load(indexPath, stamp)) {
+//        ... decompress the archive
+//        index.build(archive, archiveSize);
+//        index.save(indexPath, stamp);
+//    }
+//    const RamdiskIndex::Entry* entry = index.find("fstab.goldfish");
+//
+class RamdiskIndex {
+public:
+    struct Entry {
+        uint32_t nameOffset;  // offset of name in mNames.
+        uint32_t dataOffset;  // offset of data in the decompressed archive.
+        uint32_t dataSize;    // size of data in bytes.
     };
 
-    size_t fileNameLen = strlen(fileName);
+    RamdiskIndex() : mEntries(), mNames(), mSavable(true) {}
 
-    for (;;) {
-        // Read the header then check it.
-        cpio_newc_header header;
-        if (!input.doRead(&header, sizeof header)) {
-            // Assume end of input here.
-            D("Could not find %s in ramdisk image at %s\n",
-              fileName, ramdiskPath);
-            return false;
+    size_t size() const { return mEntries.size(); }
+
+    // Return the entry of the file named |name|, or NULL if there is none.
+    // Ramdisks only contain a few dozen files, so a linear scan is enough.
+    const Entry* find(const char* name) const {
+        for (size_t n = 0; n < mEntries.size(); ++n) {
+            if (!strcmp(nameOf(mEntries[n]), name)) {
+                return &mEntries[n];
+            }
         }
+        return NULL;
+    }
 
-        D("HEADER %.6s\n", header.c_magic);
-        if (memcmp(header.c_magic, "070701", 6) != 0) {
-            D("Not a valid ramdisk image file: %s\n", ramdiskPath);
-            errno = EINVAL;
-            return false;
+    // Parse the cpio archive at |data| and record all its non-empty
+    // files. Return true if the whole archive could be parsed, or false
+    // if it is truncated or corrupted, in which case the index only
+    // contains the files found before the error.
+    bool build(const uint8_t* data, size_t size) {
+        size_t pos = 0;
+        for (;;) {
+            // Read the header then check it.
+            cpio_newc_header header;
+            if (size - pos < sizeof header) {
+                D("Truncated ramdisk archive\n");
+                return false;
+            }
+            memcpy(&header, data + pos, sizeof header);
+
+            D("HEADER %.6s\n", header.c_magic);
+            if (memcmp(header.c_magic, "070701", 6) != 0) {
+                D("Not a valid ramdisk archive\n");
+                return false;
+            }
+
+            uint32_t nameSize;
+            uint32_t entrySize;
+            if (!parse_hex8(header.c_namesize, &nameSize) ||
+                !parse_hex8(header.c_filesize, &entrySize)) {
+                D("Could not parse ramdisk file entry header!\n");
+                return false;
+            }
+
+            // The header is followed by the name, followed by 4-byte
+            // padding with NUL bytes. The file data is 4-byte padded
+            // with NUL bytes too.
+            size_t nameStart = pos + sizeof header;
+            size_t dataStart = (nameStart + nameSize + 3) & ~3;
+            size_t dataEnd = dataStart + entrySize;
+            if (nameSize == 0 || dataEnd > size || dataEnd < dataStart) {
+                D("Truncated ramdisk file entry!\n");
+                return false;
+            }
+
+            const char* name = reinterpret_cast<const char*>(data + nameStart);
+            size_t nameLen = nameSize - 1U;
+            if (nameLen == sizeof(kTrailer) - 1U &&
+                !memcmp(name, kTrailer, nameLen)) {
+                return true;
+            }
+
+            // Files with a size of 0 are directories or hard links
+            // and are ignored.
+            if (entrySize > 0) {
+                D("---- Name=[%.*s] offset=%u size=%u\n",
+                  static_cast<int>(nameLen), name,
+                  static_cast<unsigned>(dataStart), entrySize);
+                add(name, nameLen, static_cast<uint32_t>(dataStart),
+                    entrySize);
+            }
+
+            pos = (dataEnd + 3) & ~3;
+            if (pos > size) {
+                pos = size;
+            }
         }
+    }
 
-        // Compare file names, note that files with a size of 0 are
-        // hard links and should be ignored.
-        uint32_t nameSize;
-        uint32_t entrySize;
-        if (!parse_hex8(header.c_namesize, &nameSize) ||
-            !parse_hex8(header.c_filesize, &entrySize)) {
-            D("Could not parse ramdisk file entry header!");
-            break;
+    // Load an index from the file at |path|. Return true on success, or
+    // false if the file is missing, corrupted, or doesn't match |stamp|.
+    bool load(const char* path, const ImageStamp& stamp) {
+        FILE* file = fopen(path, "rb");
+        if (!file) {
+            return false;
         }
 
-        D("---- %d nameSize=%d entrySize=%d\n", __LINE__, nameSize, entrySize);
-
-        // The header is followed by the name, followed by 4-byte padding
-        // with NUL bytes. Compute the number of bytes to skip over the
-        // name.
-        size_t skipName =
-                ((sizeof header + nameSize + 3) & ~3) - sizeof header;
-
-        // The file data is 4-byte padded with NUL bytes too.
-        size_t skipFile = (entrySize + 3) & ~3;
-        size_t skipCount = skipName + skipFile;
-
-        // Last record is named 'TRAILER!!!' and indicates end of archive.
-        static const char kTrailer[] = "TRAILER!!!";
-        static const size_t kTrailerSize = sizeof(kTrailer) - 1U;
-
-        if ((entrySize == 0 || nameSize != fileNameLen + 1U) &&
-            nameSize != kTrailerSize + 1U) {
-            D("---- %d Skipping\n", __LINE__);
-        } else {
-            // Read the name and compare it.
-            nameSize -= 1U;
-            android::base::String entryName;
-            entryName.resize(nameSize);
-            if (!input.doRead(&entryName[0], nameSize)) {
-                D("Could not read ramdisk file entry name!");
+        char line[kIndexMaxLine];
+        bool result = false;
+        do {
+            char magic[sizeof(kIndexMagic)];
+            int version;
+            unsigned long long size, mtime;
+            unsigned count;
+            if (!fgets(line, sizeof line, file) ||
+                sscanf(line, "%13s %d %llu %llu %u",
+                       magic, &version, &size, &mtime, &count) != 5 ||
+                strcmp(magic, kIndexMagic) != 0 ||
+                version != kIndexVersion ||
+                size != stamp.size || mtime != stamp.mtime) {
                 break;
             }
-            D("---- %d Name=[%s]\n", __LINE__, entryName.c_str());
-            skipCount -= nameSize;
-
-            // Check for last entry.
-            if (nameSize == kTrailerSize &&
-                !strcmp(entryName.c_str(), kTrailer)) {
-                D("End of archive reached. Could not find %s in ramdisk image at %s",
-                  fileName, ramdiskPath);
-                return false;
-            }
 
-            // Check for the search file name.
-            if (nameSize == entryName.size() &&
-                !strcmp(entryName.c_str(), fileName)) {
-                // Found it !! Skip over padding.
-                if (!input.doSkip(skipName - nameSize)) {
-                    D("Could not skip ramdisk name entry!");
+            unsigned n;
+            for (n = 0; n < count; ++n) {
+                if (!fgets(line, sizeof line, file)) {
+                    break;
+                }
+                size_t lineLen = strlen(line);
+                if (lineLen == 0 || line[lineLen - 1] != '\n') {
                     break;
                 }
+                line[--lineLen] = '\0';
+
+                unsigned offset, dataSize;
+                int nameStart = -1;
+                if (sscanf(line, "%u %u %n", &offset, &dataSize,
+                           &nameStart) != 2 || nameStart < 0 ||
+                    line[nameStart] == '\0') {
+                    break;
+                }
+                add(line + nameStart, lineLen - nameStart, offset, dataSize);
+            }
+            result = (n == count);
+        } while (0);
+
+        fclose(file);
+        if (!result) {
+            D("Ignoring stale or invalid ramdisk index: %s\n", path);
+            mEntries.resize(0);
+            mNames.resize(0);
+        }
+        return result;
+    }
+
+    // Save the index to the file at |path|. Failure is not an error, the
+    // directory containing the image may well be read-only.
+    void save(const char* path, const ImageStamp& stamp) const {
+        if (!mSavable) {
+            return;
+        }
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+            D("Could not create ramdisk index %s: %s\n",
+              path, strerror(errno));
+            return;
+        }
+        fprintf(file, "%s %d %llu %llu %u\n",
+                kIndexMagic, kIndexVersion,
+                static_cast<unsigned long long>(stamp.size),
+                static_cast<unsigned long long>(stamp.mtime),
+                static_cast<unsigned>(mEntries.size()));
+        for (size_t n = 0; n < mEntries.size(); ++n) {
+            const Entry& entry = mEntries[n];
+            fprintf(file, "%u %u %s\n", entry.dataOffset, entry.dataSize,
+                    nameOf(entry));
+        }
+        if (fclose(file) != 0) {
+            remove(path);
+        }
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(RamdiskIndex);
+
+    const char* nameOf(const Entry& entry) const {
+        return &mNames[entry.nameOffset];
+    }
 
-                // Then read data into head-allocated buffer.
-                *out = reinterpret_cast<char*>(malloc(entrySize));
-                *outSize = entrySize;
+    void add(const char* name, size_t nameLen, uint32_t offset,
+             uint32_t size) {
+        // Names that don't fit on a single index line can only be
+        // found by parsing the archive.
+        if (nameLen + 24 >= kIndexMaxLine || memchr(name, '\n', nameLen)) {
+            mSavable = false;
+        }
+        Entry entry;
+        entry.nameOffset = static_cast<uint32_t>(mNames.size());
+        entry.dataOffset = offset;
+        entry.dataSize = size;
+        mEntries.push_back(entry);
+
+        mNames.resize(entry.nameOffset + nameLen + 1U);
+        memcpy(&mNames[entry.nameOffset], name, nameLen);
+        mNames[entry.nameOffset + nameLen] = '\0';
+    }
 
-                return input.doRead(*out, entrySize);
+    PodVector<Entry> mEntries;
+    PodVector<char> mNames;
+    bool mSavable;
+};
+
+}  // namespace
+
+int android_extractRamdiskFiles(const char* ramdiskPath,
+                                const char* const* fileNames,
+                                int count,
+                                char** outs,
+                                size_t* outSizes) {
+    for (int n = 0; n < count; ++n) {
+        outs[n] = NULL;
+        outSizes[n] = 0;
+    }
+
+    ImageStamp stamp;
+    if (!getImageStamp(ramdiskPath, &stamp)) {
+        return -1;
+    }
+
+    String indexPath(ramdiskPath);
+    indexPath += kIndexSuffix;
+
+    RamdiskIndex index;
+    bool indexed = index.load(indexPath.c_str(), stamp);
+
+    // With a valid index, only decompress the archive up to the end of
+    // the last requested file, and not at all if none of them is there.
+    size_t needed = 0;
+    if (indexed) {
+        for (int n = 0; n < count; ++n) {
+            const RamdiskIndex::Entry* entry = index.find(fileNames[n]);
+            if (entry) {
+                size_t end = static_cast<size_t>(entry->dataOffset) +
+                             entry->dataSize;
+                if (end > needed) {
+                    needed = end;
+                }
             }
         }
-        if (!input.doSkip(skipCount)) {
-            D("Could not skip ramdisk entry!");
-            break;
+        if (!needed) {
+            D("None of the requested files are in ramdisk image at %s\n",
+              ramdiskPath);
+            return 0;
+        }
+    }
+
+    FileData image;
+    if (fileData_initFromFile(&image, ramdiskPath) < 0) {
+        return -1;
+    }
+
+    // Images are normally gzipped, but accept plain cpio archives too.
+    uint8_t* archive = NULL;
+    size_t archiveSize = 0;
+    bool archiveOk = true;
+    static const uint8_t kGZipMagic[2] = { 0x1f, 0x8b };
+    if (image.size >= sizeof(kGZipMagic) &&
+        !memcmp(image.data, kGZipMagic, sizeof(kGZipMagic))) {
+        archiveOk = uncompress_gzipStreamAlloc(image.data, image.size,
+                                               needed, &archive,
+                                               &archiveSize);
+        fileData_done(&image);
+    } else {
+        archive = reinterpret_cast<uint8_t*>(malloc(image.size + 1U));
+        if (image.size) {
+            memcpy(archive, image.data, image.size);
         }
+        archiveSize = image.size;
+        fileData_done(&image);
     }
 
-    errno = input.error();
-    return false;
+    if (indexed) {
+        if (archiveSize < needed) {
+            D("Ramdisk image decompression failed: %s\n", ramdiskPath);
+            free(archive);
+            errno = EIO;
+            return -1;
+        }
+    } else {
+        // A partially readable archive is still searched, but its
+        // index is never cached.
+        bool complete = index.build(archive, archiveSize);
+        if (complete && archiveOk) {
+            index.save(indexPath.c_str(), stamp);
+        } else if (!index.size()) {
+            D("Not a valid ramdisk image file: %s\n", ramdiskPath);
+            free(archive);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    int found = 0;
+    for (int n = 0; n < count; ++n) {
+        const RamdiskIndex::Entry* entry = index.find(fileNames[n]);
+        if (!entry) {
+            D("Could not find %s in ramdisk image at %s\n",
+              fileNames[n], ramdiskPath);
+            continue;
+        }
+        outs[n] = reinterpret_cast<char*>(malloc(entry->dataSize));
+        if (!outs[n]) {
+            continue;
+        }
+        memcpy(outs[n], archive + entry->dataOffset, entry->dataSize);
+        outSizes[n] = entry->dataSize;
+        found++;
+    }
+
+    free(archive);
+    return found;
+}
+
+bool android_extractRamdiskFile(const char* ramdiskPath,
+                                const char* fileName,
+                                char** out,
+                                size_t* outSize) {
+    return android_extractRamdiskFiles(ramdiskPath, &fileName, 1,
+                                       out, outSize) == 1;
 }
@@ -30,6 +30,22 @@ bool android_extractRamdiskFile(const char* ramdisk_path,
                                 char** out,
                                 size_t* out_size);
 
+// Extract several files from a ramdisk image in a single pass.
+// |file_paths| is an array of |count| paths within the ramdisk.
+// On return, |outs[n]| is either NULL if the corresponding file could not
+// be found, or points to a heap allocated block of |out_sizes[n]| bytes.
+// Returns the number of files that were found, or -1 on error, with
+// errno set.
+//
+// Note that this caches an index of the ramdisk content next to the image,
+// in <ramdisk_path>.idx, so that later calls don't need to decompress the
+// archive past the requested files.
+int android_extractRamdiskFiles(const char* ramdisk_path,
+                                const char* const* file_paths,
+                                int count,
+                                char** outs,
+                                size_t* out_sizes);
+
 ANDROID_END_HEADER
 
 #endif  // ANDROID_FILESYSTEMS_RAMDISK_EXTRACTOR_H
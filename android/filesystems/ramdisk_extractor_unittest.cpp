@@ -17,6 +17,8 @@
 #include <gtest/gtest.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 namespace {
 
@@ -25,7 +27,8 @@ namespace {
 class RamdiskExtractorTest : public ::testing::Test {
 public:
     RamdiskExtractorTest() :
-        mTempFilePath(android::testing::CreateTempFilePath()) {}
+        mTempFilePath(android::testing::CreateTempFilePath()),
+        mIndexFilePath(mTempFilePath + ".idx") {}
 
     bool fillData(const void* data, size_t dataSize) {
         FILE* file = ::fopen(mTempFilePath.c_str(), "wb");
@@ -41,13 +44,17 @@ public:
     ~RamdiskExtractorTest() {
         if (!mTempFilePath.empty()) {
             HANDLE_EINTR(unlink(mTempFilePath.c_str()));
+            HANDLE_EINTR(unlink(mIndexFilePath.c_str()));
         }
     }
 
     const char* path() const { return mTempFilePath.c_str(); }
 
+    const char* indexPath() const { return mIndexFilePath.c_str(); }
+
 private:
     std::string mTempFilePath;
+    std::string mIndexFilePath;
 };
 
 }  // namespace
@@ -100,3 +107,65 @@ TEST_F(RamdiskExtractorTest, MissingFile) {
     EXPECT_TRUE(fillData(kTestRamdiskImage, kTestRamdiskImageSize));
     EXPECT_FALSE(android_extractRamdiskFile(path(), "zoolander", &out, &outSize));
 }
+
+TEST_F(RamdiskExtractorTest, FindMultipleFiles) {
+    static const char* const kNames[] = { "zoo", "zoolander", "foo" };
+    char* outs[3];
+    size_t outSizes[3];
+
+    EXPECT_TRUE(fillData(kTestRamdiskImage, kTestRamdiskImageSize));
+    EXPECT_EQ(2, android_extractRamdiskFiles(path(), kNames, 3,
+                                             outs, outSizes));
+    EXPECT_EQ(7U, outSizes[0]);
+    EXPECT_TRUE(outs[0] && !memcmp(outs[0], "Meow!!\n", 7));
+    EXPECT_FALSE(outs[1]);
+    EXPECT_EQ(0U, outSizes[1]);
+    EXPECT_EQ(13U, outSizes[2]);
+    EXPECT_TRUE(outs[2] && !memcmp(outs[2], "Hello World!\n", 13));
+    free(outs[0]);
+    free(outs[2]);
+}
+
+TEST_F(RamdiskExtractorTest, IndexIsCachedAndReused) {
+    char* out = NULL;
+    size_t outSize = 0;
+
+    EXPECT_TRUE(fillData(kTestRamdiskImage, kTestRamdiskImageSize));
+    EXPECT_TRUE(android_extractRamdiskFile(path(), "bar2", &out, &outSize));
+    free(out);
+
+    // The first lookup must have written the index.
+    FILE* file = ::fopen(indexPath(), "rb");
+    EXPECT_TRUE(file);
+    if (file) {
+        fclose(file);
+    }
+
+    out = NULL;
+    EXPECT_TRUE(android_extractRamdiskFile(path(), "zoo", &out, &outSize));
+    EXPECT_EQ(7U, outSize);
+    EXPECT_TRUE(out && !memcmp(out, "Meow!!\n", 7));
+    free(out);
+
+    EXPECT_FALSE(android_extractRamdiskFile(path(), "zoolander",
+                                            &out, &outSize));
+}
+
+TEST_F(RamdiskExtractorTest, StaleIndexIsIgnored) {
+    // An index for another image, with an entry pointing nowhere.
+    static const char kStaleIndex[] =
+            "ramdisk-index 1 1 1 1\n"
+            "100000 5 zoo\n";
+    FILE* file = ::fopen(indexPath(), "wb");
+    ASSERT_TRUE(file);
+    fputs(kStaleIndex, file);
+    fclose(file);
+
+    char* out = NULL;
+    size_t outSize = 0;
+    EXPECT_TRUE(fillData(kTestRamdiskImage, kTestRamdiskImageSize));
+    EXPECT_TRUE(android_extractRamdiskFile(path(), "zoo", &out, &outSize));
+    EXPECT_EQ(7U, outSize);
+    EXPECT_TRUE(out && !memcmp(out, "Meow!!\n", 7));
+    free(out);
+}
@@ -711,6 +711,19 @@ help_no_snapshot_save(stralloc_t*  out)
     );
 }
 
+static void
+help_snapshot_save_background(stralloc_t*  out)
+{
+    PRINTF(
+    "  Saves the AVD's state to the snapshot storage on exit from a child\n"
+    "  process, so that the emulator window closes right away. The child\n"
+    "  keeps the AVD locked until the snapshot is written.\n\n"
+
+    "  Not supported on Windows or with HAXM, where the snapshot is saved\n"
+    "  before the emulator exits.\n\n"
+    );
+}
+
 static void
 help_no_snapshot_update_time(stralloc_t*  out)
 {
@@ -1372,12 +1385,90 @@ help_tcpdump(stralloc_t  *out)
     "  note that this captures all Ethernet packets, and is not limited to TCP\n"
     "  connections.\n\n"
 
+    "  packets are written to disk by a background thread. If the disk can't keep\n"
+    "  up, packets are dropped from the capture, never delayed. The file name can be\n"
+    "  followed by comma-separated options:\n\n"
+
+    "    size=<MB>      start a new file every <MB> megabytes\n"
+    "    time=<secs>    start a new file every <secs> seconds\n"
+    "    files=<n>      keep at most <n> files, overwriting the oldest\n"
+    "    ring=<MB>      keep only the last <MB> megabytes of traffic\n"
+    "    snaplen=<n>    keep only the first <n> bytes of each packet\n\n"
+
+    "  additional files are named <file>.1, <file>.2, etc. For example:\n\n"
+
+    "    -tcpdump /tmp/net.pcap,ring=64,snaplen=128\n\n"
+
     "  you can also start/stop the packet capture dynamically through the console;\n"
     "  see the 'network capture start' and 'network capture stop' commands for\n"
     "  details.\n\n"
     );
 }
 
+static void
+help_guest_profile(stralloc_t  *out)
+{
+    PRINTF(
+    "  use the -guest-profile <file> option to find which guest processes,\n"
+    "  threads and libraries the emulator spends its time in. The guest\n"
+    "  program counter is sampled every few milliseconds, and the host time\n"
+    "  is attributed to the process, thread and library + file offset that\n"
+    "  the guest kernel reports through its 'qemu_trace' device.\n\n"
+
+    "  the profile is written at exit in the collapsed stack format, which\n"
+    "  can be turned into a flame graph with flamegraph.pl. Kernel samples\n"
+    "  use absolute addresses, that can be looked up in System.map.\n\n"
+    );
+}
+
+static void
+help_timer_slack(stralloc_t  *out)
+{
+    PRINTF(
+    "  when the guest system is idle, the emulator stops its periodic host\n"
+    "  alarm and only wakes up when a timer expires. use '-timer-slack <ms>'\n"
+    "  to let it delay these timers by up to <ms> milliseconds, so that\n"
+    "  nearby deadlines, including those of other emulator instances on the\n"
+    "  same host, expire together. this reduces the host CPU usage of idle\n"
+    "  emulators, at the cost of a less precise timing in the guest.\n\n"
+
+    "  <ms> must be between 0 (the default, no slack) and 1000. the 'profile'\n"
+    "  console command reports the remaining idle wakeups per second.\n\n"
+    );
+}
+
+static void
+help_ram_base(stralloc_t  *out)
+{
+    PRINTF(
+    "  use '-ram-base <file>' when running many instances of the same virtual\n"
+    "  device, all booted from the same snapshot. the first instance writes\n"
+    "  the guest RAM to <file> right after loading the snapshot. the next\n"
+    "  ones map their guest RAM from <file>, copy-on-write, so that the pages\n"
+    "  the guest does not modify are shared by all of them through the host\n"
+    "  page cache instead of being duplicated.\n\n"
+
+    "  the option has no effect when no snapshot is loaded at startup. to\n"
+    "  refresh <file>, e.g. after saving a new snapshot, simply delete it.\n"
+    "  the 'avd ram' console command reports how many guest RAM pages are\n"
+    "  still shared. this option is not supported on Windows, or with HAXM.\n\n"
+    );
+}
+
+static void
+help_trace_startup(stralloc_t  *out)
+{
+    PRINTF(
+    "  use the -trace-startup <file> option to record how long each phase of\n"
+    "  the emulator startup takes (virtual device setup, hardware configuration,\n"
+    "  kernel probing, disk image setup, snapshot loading), up to the display\n"
+    "  of the first frame.\n\n"
+
+    "  the timeline is written in the Chrome trace event format, which can be\n"
+    "  viewed by loading the file from the chrome://tracing page.\n\n"
+    );
+}
+
 static void
 help_charmap(stralloc_t  *out)
 {
@@ -14,6 +14,7 @@
 #include "android/hw-sensors.h"
 #include "android/utils/debug.h"
 #include "android/utils/misc.h"
+#include "android/utils/path.h"
 #include "android/utils/system.h"
 #include "android/hw-qemud.h"
 #include "android/globals.h"
@@ -162,17 +163,57 @@ typedef struct {
  *   was "taken" by this code. This is adjusted by the HAL module to
  *   emulated system time (using the first sync: to compute an adjustment
  *   offset).
+ *
+ * - the HAL module can send "set-format:binary" to receive each tick's
+ *   reports as a single packed message instead of the text lines above,
+ *   and "set-format:text" to go back to the default. A binary report is:
+ *
+ *      "bin:"              4-byte tag
+ *      <mask>              32-bit bitmap of the sensors that follow
+ *      <time_us>           64-bit VM time in micro-seconds (as in sync:)
+ *      <a> <b> <c>         three 32-bit IEEE floats per sensor in <mask>,
+ *                          in increasing sensor id order
+ *
+ *   All integers and floats are little-endian. Sensors with fewer than
+ *   three values (temperature, proximity) pad with zeroes.
  */
 #define  HEADER_SIZE  4
 #define  BUFFER_SIZE  512
 
+#define  BINARY_REPORT_TAG     "bin:"
+#define  BINARY_REPORT_HEADER  (4 + 4 + 8)
+#define  BINARY_REPORT_MAX     (BINARY_REPORT_HEADER + MAX_SENSORS*3*4)
+
+/* The binary format flag is saved in the top bit of the enabled mask
+ * so that older snapshots keep loading as text clients.
+ */
+#define  CLIENT_SAVE_BINARY_FLAG  0x80000000U
+
 typedef struct HwSensorClient   HwSensorClient;
 
+/* A single record of a sensor trace being replayed, see
+ * android_sensors_replay_start() for the file format.
+ */
+typedef struct {
+    int64_t  time_us;
+    int      sensor_id;
+    float    a, b, c;
+} SensorReplayRecord;
+
+typedef struct {
+    SensorReplayRecord*  records;
+    int                  count;
+    int                  next;
+    int64_t              start_ns;
+    QEMUTimer*           timer;
+} SensorReplay;
+
 typedef struct {
     QemudService*       service;
     Sensor              sensors[MAX_SENSORS];
     HwSensorClient*     clients;
     AndroidSensorsPort* sensors_port;
+    SensorReplay        replay;
 } HwSensors;
 
 struct HwSensorClient {
@@ -182,6 +223,7 @@ struct HwSensorClient {
     QEMUTimer*       timer;
     uint32_t         enabledMask;
     int32_t          delay_ms;
+    char             binary;
 };
 
 static void
@@ -281,6 +323,58 @@ _hwSensorClient_enabled( HwSensorClient*  cl, int  sensorId )
     return (cl->enabledMask & (1 << sensorId)) != 0;
 }
 
+static uint8_t*
+_put_le32( uint8_t*  p, uint32_t  v )
+{
+    p[0] = (uint8_t)(v);
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+    return p + 4;
+}
+
+static uint8_t*
+_put_le_float( uint8_t*  p, float  f )
+{
+    union { float f; uint32_t u; } v;
+    v.f = f;
+    return _put_le32(p, v.u);
+}
+
+/* send all enabled sensor values and the timestamp as one packed message */
+static void
+_hwSensorClient_sendBinaryReport( HwSensorClient*  cl, int64_t  now_ns )
+{
+    HwSensors*  hw = cl->sensors;
+    uint8_t     buffer[BINARY_REPORT_MAX];
+    uint8_t*    p = buffer;
+    uint64_t    now_us = (uint64_t)(now_ns / 1000);
+    uint32_t    mask = 0;
+    int         nn;
+
+    for (nn = 0; nn < MAX_SENSORS; nn++) {
+        if (_hwSensorClient_enabled(cl, nn))
+            mask |= (1U << nn);
+    }
+
+    memcpy(p, BINARY_REPORT_TAG, 4);
+    p = _put_le32(p + 4, mask);
+    p = _put_le32(p, (uint32_t)now_us);
+    p = _put_le32(p, (uint32_t)(now_us >> 32));
+
+    for (nn = 0; nn < MAX_SENSORS; nn++) {
+        const SensorValues*  v = &hw->sensors[nn].u.value;
+        if (!(mask & (1U << nn)))
+            continue;
+        p = _put_le_float(p, v->a);
+        p = _put_le_float(p, v->b);
+        p = _put_le_float(p, v->c);
+    }
+
+    T("%s: %d bytes, mask=0x%x", __FUNCTION__, (int)(p - buffer), mask);
+    qemud_client_send(cl->client, buffer, p - buffer);
+}
+
 /* this function is called periodically to send sensor reports
  * to the HAL module, and re-arm the timer if necessary
  */
@@ -295,6 +389,12 @@ _hwSensorClient_tick( void*  opaque )
     Sensor*          sensor;
     char             buffer[128];
 
+    if (cl->binary) {
+        now_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        _hwSensorClient_sendBinaryReport(cl, now_ns);
+        goto REARM;
+    }
+
     if (_hwSensorClient_enabled(cl, ANDROID_SENSOR_ACCELERATION)) {
         sensor = &hw->sensors[ANDROID_SENSOR_ACCELERATION];
         snprintf(buffer, sizeof buffer, "acceleration:%g:%g:%g",
@@ -342,6 +442,7 @@ _hwSensorClient_tick( void*  opaque )
     snprintf(buffer, sizeof buffer, "sync:%" PRId64, now_ns/1000);
     _hwSensorClient_send(cl, (uint8_t*)buffer, strlen(buffer));
 
+REARM:
     /* rearm timer, use a minimum delay of 20 ms, just to
      * be safe.
      */
@@ -401,6 +502,21 @@ _hwSensorClient_receive( HwSensorClient*  cl, uint8_t*  msg, int  msglen )
         return;
     }
 
+    /* "set-format:<format>" selects how reports are sent, <format>
+     * must be "text" (the default) or "binary"
+     */
+    if (msglen > 11 && !memcmp(msg, "set-format:", 11)) {
+        if (msglen == 17 && !memcmp(msg + 11, "binary", 6)) {
+            cl->binary = 1;
+        } else if (msglen == 15 && !memcmp(msg + 11, "text", 4)) {
+            cl->binary = 0;
+        } else {
+            D("%s: ignore unknown format '%.*s'", __FUNCTION__,
+              msglen - 11, msg + 11);
+        }
+        return;
+    }
+
     /* "set:<name>:<state>" is used to enable/disable a given
      * sensor. <state> must be 0 or 1
      */
@@ -460,7 +576,8 @@ _hwSensorClient_save( QEMUFile*  f, QemudClient*  client, void*  opaque  )
     HwSensorClient* sc = opaque;
 
     qemu_put_be32(f, sc->delay_ms);
-    qemu_put_be32(f, sc->enabledMask);
+    qemu_put_be32(f, sc->enabledMask |
+                     (sc->binary ? CLIENT_SAVE_BINARY_FLAG : 0));
     timer_put(f, sc->timer);
 }
 
@@ -472,6 +589,8 @@ _hwSensorClient_load( QEMUFile*  f, QemudClient*  client, void*  opaque  )
 
     sc->delay_ms = qemu_get_be32(f);
     sc->enabledMask = qemu_get_be32(f);
+    sc->binary = (sc->enabledMask & CLIENT_SAVE_BINARY_FLAG) != 0;
+    sc->enabledMask &= ~CLIENT_SAVE_BINARY_FLAG;
     timer_get(f, sc->timer);
 
     return 0;
@@ -657,6 +776,178 @@ _hwSensors_setCoarseOrientation( HwSensors*  h, AndroidCoarseOrientation  orient
 }
 
 
+/* push the current sensor values to all clients that have at least
+ * one enabled sensor, without waiting for their next tick.
+ */
+static void
+_hwSensors_flushClients( HwSensors*  h )
+{
+    HwSensorClient*  cl = h->clients;
+
+    while (cl != NULL) {
+        /* _hwSensorClient_tick() can't free the client */
+        HwSensorClient*  next = cl->next;
+        if (cl->enabledMask != 0)
+            _hwSensorClient_tick(cl);
+        cl = next;
+    }
+}
+
+static void
+_sensorReplay_reset( SensorReplay*  r )
+{
+    if (r->timer) {
+        timer_del(r->timer);
+    }
+    AFREE(r->records);
+    r->records  = NULL;
+    r->count    = 0;
+    r->next     = 0;
+    r->start_ns = 0;
+}
+
+/* apply all records that are due, then re-arm for the next one */
+static void
+_hwSensors_replayTick( void*  opaque )
+{
+    HwSensors*     h = opaque;
+    SensorReplay*  r = &h->replay;
+    int64_t        elapsed_us;
+    int            applied = 0;
+
+    elapsed_us = (qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - r->start_ns) / 1000;
+
+    while (r->next < r->count && r->records[r->next].time_us <= elapsed_us) {
+        const SensorReplayRecord*  rec = &r->records[r->next++];
+        _hwSensors_setSensorValue(h, rec->sensor_id, rec->a, rec->b, rec->c);
+        applied++;
+    }
+
+    if (applied > 0)
+        _hwSensors_flushClients(h);
+
+    if (r->next >= r->count) {
+        D("%s: sensor replay complete (%d records)", __FUNCTION__, r->count);
+        _sensorReplay_reset(r);
+        return;
+    }
+
+    timer_mod(r->timer, r->start_ns + r->records[r->next].time_us * 1000);
+}
+
+/* parse one trace line into |rec|. Returns 1 on success, 0 for blank or
+ * comment lines, and -1 on error.
+ */
+static int
+_sensorReplay_parseLine( HwSensors*  h, char*  line, SensorReplayRecord*  rec )
+{
+    char*   p = line;
+    char*   end;
+    char*   name;
+    float   values[3] = { 0, 0, 0 };
+    int     nn;
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (*p == 0 || *p == '#')
+        return 0;
+
+    rec->time_us = strtoll(p, &end, 10);
+    if (end == p || rec->time_us < 0)
+        return -1;
+
+    p = end;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    name = p;
+    while (*p && *p != ' ' && *p != '\t')
+        p++;
+    if (*p == 0)
+        return -1;
+    *p++ = 0;
+
+    rec->sensor_id = _sensorIdFromName(name);
+    if (rec->sensor_id < 0 || !h->sensors[rec->sensor_id].enabled)
+        return -1;
+
+    for (nn = 0; nn < 3; nn++) {
+        values[nn] = strtof(p, &end);
+        if (end == p)
+            return -1;
+        p = end;
+        if (*p != ':')
+            break;
+        p++;
+    }
+    rec->a = values[0];
+    rec->b = values[1];
+    rec->c = values[2];
+    return 1;
+}
+
+static int
+_hwSensors_replayStart( HwSensors*  h, const char*  path, int*  errline )
+{
+    SensorReplay*        r = &h->replay;
+    SensorReplayRecord*  records = NULL;
+    int                  count = 0, capacity = 0, lineno = 0;
+    char*                data;
+    char*                line;
+    char*                next;
+
+    *errline = 0;
+    data = path_load_file(path, NULL);
+    if (data == NULL)
+        return -1;
+
+    for (line = data; line != NULL; line = next) {
+        SensorReplayRecord  rec;
+        int                 ret;
+
+        next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = 0;
+        lineno++;
+
+        ret = _sensorReplay_parseLine(h, line, &rec);
+        if (ret == 0)
+            continue;
+        if (ret < 0 || (count > 0 && rec.time_us < records[count-1].time_us)) {
+            *errline = lineno;
+            free(data);
+            AFREE(records);
+            errno = EINVAL;
+            return -1;
+        }
+        if (count == capacity) {
+            capacity += capacity/2 + 64;
+            AARRAY_RENEW(records, capacity);
+        }
+        records[count++] = rec;
+    }
+    free(data);
+
+    if (count == 0) {
+        AFREE(records);
+        errno = EINVAL;
+        return -1;
+    }
+
+    _sensorReplay_reset(r);
+    if (r->timer == NULL)
+        r->timer = timer_new(QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                             _hwSensors_replayTick, h);
+
+    /* timestamps are relative to the first record */
+    r->records  = records;
+    r->count    = count;
+    r->start_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) -
+                  records[0].time_us * 1000;
+    D("%s: replaying %d records from %s", __FUNCTION__, count, path);
+    _hwSensors_replayTick(h);
+    return 0;
+}
+
 /* initialize the sensors state */
 static void
 _hwSensors_init( HwSensors*  h )
@@ -800,6 +1091,40 @@ android_sensors_set( int sensor_id, float a, float b, float c )
     return SENSOR_STATUS_OK;
 }
 
+/* Start replaying a sensor trace file */
+extern int
+android_sensors_replay_start( const char* path, int* errline )
+{
+    HwSensors* hw = _sensorsState;
+
+    *errline = 0;
+    if (hw->service == NULL)
+        return SENSOR_STATUS_NO_SERVICE;
+
+    if (_hwSensors_replayStart(hw, path, errline) < 0)
+        return SENSOR_STATUS_UNKNOWN;
+
+    return SENSOR_STATUS_OK;
+}
+
+/* Stop the current sensor trace replay, if any */
+extern void
+android_sensors_replay_stop( void )
+{
+    _sensorReplay_reset(&_sensorsState->replay);
+}
+
+/* Get the progress of the current sensor trace replay */
+extern int
+android_sensors_replay_progress( int* done, int* total )
+{
+    SensorReplay* r = &_sensorsState->replay;
+
+    *done  = r->next;
+    *total = r->count;
+    return r->count > 0;
+}
+
 /* Get Sensor from sensor id */
 extern uint8_t
 android_sensors_get_sensor_status( int sensor_id )
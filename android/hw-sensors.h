@@ -78,4 +78,27 @@ extern const char* android_sensors_get_name_from_id( int sensor_id );
 /* Get sensor from sensor id */
 extern uint8_t android_sensors_get_sensor_status( int sensor_id );
 
+/* Start replaying a recorded sensor trace into the guest at its original
+ * timing. Each non-empty line of the file that doesn't start with '#' is:
+ *
+ *     <time_us> <sensorname> <value-a>[:<value-b>[:<value-c>]]
+ *
+ * where <time_us> is a non-decreasing timestamp in micro-seconds; only the
+ * difference with the first record's timestamp matters. Starting a new
+ * replay cancels the current one.
+ *
+ * Returns SENSOR_STATUS_OK on success. On parse errors, returns
+ * SENSOR_STATUS_UNKNOWN and sets |*errline| to the faulty line number,
+ * or to 0 if the file could not be read (errno is set then).
+ */
+extern int android_sensors_replay_start( const char* path, int* errline );
+
+/* Stop the current sensor trace replay, if any */
+extern void android_sensors_replay_stop( void );
+
+/* Return 1 and the number of applied/total records if a replay is
+ * in progress, 0 otherwise.
+ */
+extern int android_sensors_replay_progress( int* done, int* total );
+
 #endif /* _android_gps_h */
@@ -9,7 +9,6 @@
 // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
 // GNU General Public License for more details.
 
-#include "android/base/containers/PodVector.h"
 #include "android/base/Limits.h"
 #include "android/base/Log.h"
 #include "android/kernel/kernel_utils.h"
@@ -32,8 +31,6 @@
 #define KERNEL_ERROR   LOG_IF(ERROR, DEBUG_KERNEL)
 #define KERNEL_PERROR  PLOG_IF(ERROR, DEBUG_KERNEL)
 
-using android::base::PodVector;
-
 namespace {
 
 const char kLinuxVersionStringPrefix[] = "Linux version ";
@@ -113,7 +110,7 @@ bool android_imageProbeKernelVersionString(const uint8_t* kernelFileData,
                                            size_t kernelFileSize,
                                            char* dst/*[dstLen]*/,
                                            size_t dstLen) {
-    PodVector<uint8_t> uncompressed;
+    uint8_t* uncompressed = NULL;
 
     const uint8_t* uncompressedKernel = NULL;
     size_t uncompressedKernelLen = 0;
@@ -157,17 +154,14 @@ bool android_imageProbeKernelVersionString(const uint8_t* kernelFileData,
             size_t compressedKernelLen = kernelFileSize -
                 (compressedKernel - kernelFileData);
 
-            // inflate ratios for all prebuilt kernels on 2014-07-14 is 1.9:1 ~
-            // 3.43:1 not sure how big the uncompressed size is, so make an
-            // absurdly large buffer
-            uncompressedKernelLen = compressedKernelLen * 10;
-            uncompressed.resize(uncompressedKernelLen);
-            uncompressedKernel = uncompressed.begin();
-
-            bool zOk = uncompress_gzipStream(uncompressed.begin(),
-                                            &uncompressedKernelLen,
-                                            compressedKernel,
-                                            compressedKernelLen);
+            // The uncompressed size isn't known in advance, so let the
+            // decompressor grow its output buffer as needed.
+            bool zOk = uncompress_gzipStreamAlloc(compressedKernel,
+                                                  compressedKernelLen,
+                                                  0,
+                                                  &uncompressed,
+                                                  &uncompressedKernelLen);
+            uncompressedKernel = uncompressed;
             if (!zOk) {
                 KERNEL_ERROR << "Kernel decompression error";
                 // it may have been partially decompressed, so we're going to
@@ -185,12 +179,14 @@ bool android_imageProbeKernelVersionString(const uint8_t* kernelFileData,
 
         if (!versionStringStart) {
             KERNEL_ERROR << "Could not find 'Linux version ' in kernel!";
+            free(uncompressed);
             return false;
         }
     }
 
     strlcpy(dst, versionStringStart, dstLen);
 
+    free(uncompressed);
     return true;
 }
 
@@ -282,6 +282,11 @@ void sdl_display_init(DisplayState *ds, int full_screen, int  no_frame)
 
     snprintf(buf, sizeof buf, "width=%d,height=%d", width, height);
     android_display_init(ds, qframebuffer_fifo_get());
+
+    /* Without a window, the display is not polled for user input, and
+     * its refresh can be suspended while the guest is idle. */
+    if (emulator->opts->no_window)
+        ds->listeners->idle = 1;
 }
 
 typedef struct part_properties part_properties;
@@ -15,6 +15,7 @@
 #include "android/utils/eintr_wrapper.h"
 #include "android/utils/path.h"
 #include "android/utils/dirscanner.h"
+#include "android/utils/startup_trace.h"
 #include "android/main-common.h"
 #include "android/globals.h"
 #include "android/resource.h"
@@ -379,6 +380,7 @@ AvdInfo* createAVD(AndroidOptions* opts, int* inAndroidBuild)
     /* setup the virtual device differently depending on whether
      * we are in the Android build system or not
      */
+    startupTrace_begin("avdInfo_new");
     if (opts->avd != NULL)
     {
         ret = avdInfo_new( opts->avd, android_avdParams );
@@ -403,6 +405,7 @@ AvdInfo* createAVD(AndroidOptions* opts, int* inAndroidBuild)
             exit(1);
         }
     }
+    startupTrace_end("avdInfo_new");
 
     if (android_build_out) {
         *inAndroidBuild = 1;
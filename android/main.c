@@ -45,6 +45,7 @@
 #include "android/utils/lineinput.h"
 #include "android/utils/path.h"
 #include "android/utils/property_file.h"
+#include "android/utils/startup_trace.h"
 #include "android/utils/tempfile.h"
 
 #include "android/main-common.h"
@@ -190,6 +191,8 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+    startupTrace_init(opts->trace_startup);
+
 #ifdef _WIN32
     socket_init();
 #endif
@@ -331,10 +334,12 @@ int main(int argc, char **argv)
 
     /* Read hardware configuration */
     hw = android_hw;
+    startupTrace_begin("hw-config");
     if (avdInfo_initHwConfig(avd, hw) < 0) {
         derror("could not read hardware configuration ?");
         exit(1);
     }
+    startupTrace_end("hw-config");
 
     if (opts->keyset) {
         parse_keyset(opts->keyset, opts);
@@ -456,6 +461,7 @@ int main(int argc, char **argv)
     }
 
     char versionString[256];
+    startupTrace_begin("kernel-probe");
     if (!android_pathProbeKernelVersionString(hw->kernel_path,
                                               versionString,
                                               sizeof(versionString))) {
@@ -463,6 +469,7 @@ int main(int argc, char **argv)
                hw->kernel_path);
         exit(2);
     }
+    startupTrace_end("kernel-probe");
 
     KernelVersion kernelVersion = 0;
     if (!android_parseLinuxVersionString(versionString, &kernelVersion)) {
@@ -506,6 +513,21 @@ int main(int argc, char **argv)
         args[n++] = opts->tcpdump;
     }
 
+    if (opts->guest_profile) {
+        args[n++] = "-guest-profile";
+        args[n++] = opts->guest_profile;
+    }
+
+    if (opts->timer_slack) {
+        args[n++] = "-timer-slack";
+        args[n++] = opts->timer_slack;
+    }
+
+    if (opts->ram_base) {
+        args[n++] = "-ram-base";
+        args[n++] = opts->ram_base;
+    }
+
 #ifdef CONFIG_NAND_LIMITS
     if (opts->nand_limits) {
         args[n++] = "-nand-limits";
@@ -907,6 +929,9 @@ int main(int argc, char **argv)
         if (!opts->no_snapshot_save) {
             args[n++] = "-savevm-on-exit";
             args[n++] = ASTRDUP(opts->snapshot);
+            if (opts->snapshot_save_background) {
+                args[n++] = "-savevm-on-exit-background";
+            }
         }
 
         if (opts->no_snapshot_update_time) {
@@ -10,84 +10,124 @@
 ** GNU General Public License for more details.
 */
 #include "android/tcpdump.h"
+#include "android/utils/pcap_writer.h"
+#include "qemu/thread.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 
 int  qemu_tcpdump_active;
 
-static FILE*     capture_file;
+/* Packets are queued by the emulation thread, and written to disk by a
+ * capture thread. There are two queues: the capture thread takes the one
+ * being filled, and writes it while the other one fills in turn. A packet
+ * that doesn't fit is dropped and counted, so that the emulation thread
+ * never waits for the disk.
+ */
+#define  CAPTURE_QUEUE_SIZE  (4 << 20)
+
+/* The capture thread writes the queued packets at least that often. */
+#define  CAPTURE_FLUSH_MS    200
+
+static QemuMutex     capture_lock;
+static QemuSemaphore capture_sem;
+static QemuThread    capture_thread;
+static PcapQueue     capture_queues[2];
+static PcapQueue*    capture_fill;       /* filled by the emulation thread */
+static int           capture_stopping;
+static int           capture_woken;
+static PcapWriter    capture_writer;     /* used by the capture thread */
+static int           capture_error;      /* errno of the first failure */
+static int           capture_init;
+
 static uint64_t  capture_count;
 static uint64_t  capture_size;
-static int       capture_init;
+static uint64_t  capture_dropped;
 
 static void
 capture_atexit(void)
 {
-    if (qemu_tcpdump_active) {
-        fclose(capture_file);
-        qemu_tcpdump_active = 0;
-    }
+    qemu_tcpdump_stop();
 }
 
-/* See http://wiki.wireshark.org/Development/LibpcapFileFormat for
- * the complete description of the packet capture file format
- */
-
-#define  PCAP_MAGIC     0xa1b2c3d4
-#define  PCAP_MAJOR     2
-#define  PCAP_MINOR     4
-#define  PCAP_SNAPLEN   65535
-#define  PCAP_ETHERNET  1
-
-static int
-pcap_write_header( FILE*  out )
+static void*
+capture_thread_main( void*  opaque )
 {
-    typedef struct {
-        uint32_t   magic;
-        uint16_t   version_major;
-        uint16_t   version_minor;
-        int32_t    this_zone;
-        uint32_t   sigfigs;
-        uint32_t   snaplen;
-        uint32_t   network;
-    } PcapHeader;
-
-    PcapHeader  h;
-
-    h.magic         = PCAP_MAGIC;
-    h.version_major = PCAP_MAJOR;
-    h.version_minor = PCAP_MINOR;
-    h.this_zone     = 0;
-    h.sigfigs       = 0;  /* all tools set it to 0 in practice */
-    h.snaplen       = PCAP_SNAPLEN;
-    h.network       = PCAP_ETHERNET;
-
-    if (fwrite(&h, sizeof(h), 1, out) != 1) {
-        return -1;
+    qemu_mutex_lock(&capture_lock);
+    for (;;) {
+        PcapQueue*  queue = capture_fill;
+        int         ret;
+
+        if (pcapQueue_count(queue) == 0) {
+            if (capture_stopping)
+                break;
+            qemu_mutex_unlock(&capture_lock);
+            qemu_sem_timedwait(&capture_sem, CAPTURE_FLUSH_MS);
+            qemu_mutex_lock(&capture_lock);
+            continue;
+        }
+
+        capture_fill  = (queue == &capture_queues[0]) ? &capture_queues[1]
+                                                      : &capture_queues[0];
+        capture_woken = 0;
+        qemu_mutex_unlock(&capture_lock);
+
+        ret = pcapQueue_drain(queue, &capture_writer);
+        if (ret >= 0)
+            pcapWriter_flush(&capture_writer);
+
+        qemu_mutex_lock(&capture_lock);
+        if (ret < 0 && !capture_error)
+            capture_error = errno ? errno : EIO;
     }
-    return 0;
+    qemu_mutex_unlock(&capture_lock);
+    return NULL;
 }
 
 int
-qemu_tcpdump_start( const char*  filepath )
+qemu_tcpdump_start( const char*  spec )
 {
+    PcapWriterConfig  config;
+    char*             path;
+
     if (!capture_init) {
         capture_init = 1;
+        qemu_mutex_init(&capture_lock);
+        qemu_sem_init(&capture_sem, 0);
         atexit(capture_atexit);
     }
 
     qemu_tcpdump_stop();
 
-    if (filepath == NULL)
+    if (spec == NULL)
         return -1;
 
-    capture_file = fopen(filepath, "wb");
-    if (capture_file == NULL)
+    if (pcapWriter_parseSpec(spec, &path, &config) < 0) {
+        errno = EINVAL;
         return -1;
-
-    if (pcap_write_header(capture_file) < 0)
+    }
+    if (pcapWriter_open(&capture_writer, path, &config) < 0) {
+        int  err = errno;
+        free(path);
+        errno = err;
         return -1;
+    }
+    free(path);
+
+    pcapQueue_init(&capture_queues[0], CAPTURE_QUEUE_SIZE, config.snaplen);
+    pcapQueue_init(&capture_queues[1], CAPTURE_QUEUE_SIZE, config.snaplen);
+    capture_fill     = &capture_queues[0];
+    capture_stopping = 0;
+    capture_woken    = 0;
+    capture_error    = 0;
+    capture_count    = 0;
+    capture_size     = 0;
+    capture_dropped  = 0;
+
+    qemu_thread_create(&capture_thread, capture_thread_main, NULL,
+                       QEMU_THREAD_JOINABLE);
 
     qemu_tcpdump_active = 1;
     return 0;
@@ -101,41 +141,45 @@ qemu_tcpdump_stop( void )
 
     qemu_tcpdump_active = 0;
 
-    capture_count = 0;
-    capture_size  = 0;
-
-    fclose(capture_file);
-    capture_file = NULL;
+    /* let the capture thread write what is queued, then exit */
+    qemu_mutex_lock(&capture_lock);
+    capture_stopping = 1;
+    qemu_mutex_unlock(&capture_lock);
+    qemu_sem_post(&capture_sem);
+    qemu_thread_join(&capture_thread);
+
+    pcapWriter_close(&capture_writer);
+    pcapQueue_done(&capture_queues[0]);
+    pcapQueue_done(&capture_queues[1]);
+    capture_fill = NULL;
 }
 
 void
 qemu_tcpdump_packet( const void*  base, int  len )
 {
-    typedef struct {
-        uint32_t  ts_sec;
-        uint32_t  ts_usec;
-        uint32_t  incl_len;
-        uint32_t  orig_len;
-    } PacketHeader;
-
-    PacketHeader    h;
     struct timeval  now;
-    int             len2 = len;
-
-    if (len2 > PCAP_SNAPLEN)
-        len2 = PCAP_SNAPLEN;
+    int             wake = 0;
 
     gettimeofday(&now, NULL);
-    h.ts_sec   = (uint32_t) now.tv_sec;
-    h.ts_usec  = (uint32_t) now.tv_usec;
-    h.incl_len = (uint32_t) len2;
-    h.orig_len = (uint32_t) len;
 
-    fwrite( &h, sizeof(h), 1, capture_file );
-    fwrite( base, 1, len2, capture_file );
+    qemu_mutex_lock(&capture_lock);
+    if (pcapQueue_put(capture_fill, (uint32_t) now.tv_sec,
+                      (uint32_t) now.tv_usec, base, (uint32_t) len) < 0) {
+        capture_dropped += 1;
+    } else {
+        capture_count += 1;
+        capture_size  += len;
+        /* wake the capture thread early when half full */
+        if (!capture_woken &&
+            pcapQueue_count(capture_fill) > CAPTURE_QUEUE_SIZE / 2) {
+            capture_woken = 1;
+            wake = 1;
+        }
+    }
+    qemu_mutex_unlock(&capture_lock);
 
-    capture_count += 1;
-    capture_size  += len2;
+    if (wake)
+        qemu_sem_post(&capture_sem);
 }
 
 void
@@ -145,3 +189,18 @@ qemu_tcpdump_stats( uint64_t  *pcount, uint64_t*  psize )
     *psize  = capture_size;
 }
 
+void
+qemu_tcpdump_get_status( QemuTcpdumpStatus*  status )
+{
+    if (!capture_init) {
+        memset(status, 0, sizeof(*status));
+        return;
+    }
+    qemu_mutex_lock(&capture_lock);
+    status->active  = qemu_tcpdump_active;
+    status->packets = capture_count;
+    status->bytes   = capture_size;
+    status->dropped = capture_dropped;
+    status->error   = capture_error;
+    qemu_mutex_unlock(&capture_lock);
+}
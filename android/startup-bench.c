@@ -0,0 +1,278 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* This is the source code of the "emulator_startup_bench" program, which
+ * repeatedly boots an emulator without a window up to a given startup
+ * milestone, and reports the median duration of each startup phase.
+ *
+ * Each run is started with '-no-window -trace-startup <file>', and the
+ * STARTUP_TRACE_EXIT_ENV environment variable set to the milestone, so
+ * that the emulator writes its startup trace and exits as soon as the
+ * milestone is reached. See android/utils/startup_trace.h.
+ */
+
+#include "android/utils/startup_trace.h"
+#include "android/utils/stralloc.h"
+#include "android/utils/system.h"
+#include "android/utils/tempfile.h"
+#ifdef _WIN32
+#include "android/utils/win32_cmdline_quote.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Required by android/utils/debug.h */
+int android_verbose;
+
+#define DEFAULT_RUNS       5
+#define MAX_RUNS           101
+#define MAX_PHASES         64
+#define MAX_PHASE_NAME     64
+
+/* Name of the pseudo-phase reporting the time to the milestone. */
+#define TOTAL_PHASE        "(total)"
+
+typedef struct {
+    char     name[MAX_PHASE_NAME];
+    int      count;                 /* number of runs that recorded it */
+    double   values_ms[MAX_RUNS];
+} Phase;
+
+static Phase  _phases[MAX_PHASES];
+static int    _num_phases;
+
+static Phase*
+phase_get(const char* name)
+{
+    int n;
+    for (n = 0; n < _num_phases; n++) {
+        if (!strcmp(_phases[n].name, name))
+            return &_phases[n];
+    }
+    if (_num_phases == MAX_PHASES)
+        return NULL;
+
+    Phase* phase = &_phases[_num_phases++];
+    snprintf(phase->name, sizeof phase->name, "%s", name);
+    phase->count = 0;
+    return phase;
+}
+
+static void
+usage(void)
+{
+    printf(
+        "Usage: emulator_startup_bench [<options>] <emulator> [<emulator-options>]\n\n"
+        "Boots <emulator> several times without a window and reports the median\n"
+        "duration of each startup phase, in milliseconds.\n\n"
+        "Options:\n"
+        "  -runs <count>      number of runs (default %d, max %d)\n"
+        "  -milestone <name>  stop each run at this phase or milestone\n"
+        "                     (default '%s')\n\n"
+        "Example:\n"
+        "  emulator_startup_bench -runs 9 objs/emulator64-arm -avd test\n",
+        DEFAULT_RUNS, MAX_RUNS, STARTUP_TRACE_FIRST_FRAME);
+}
+
+/* Append |arg| to |cmd| as a single shell argument. */
+static void
+add_arg(stralloc_t* cmd, const char* arg)
+{
+    if (cmd->n > 0)
+        stralloc_add_c(cmd, ' ');
+#ifdef _WIN32
+    char* quoted = win32_cmdline_quote(arg);
+    stralloc_add_str(cmd, quoted);
+    free(quoted);
+#else
+    stralloc_add_c(cmd, '\'');
+    for (; *arg; arg++) {
+        if (*arg == '\'')
+            stralloc_add_str(cmd, "'\\''");
+        else
+            stralloc_add_c(cmd, *arg);
+    }
+    stralloc_add_c(cmd, '\'');
+#endif
+}
+
+/* Parse the startup trace at |path|, adding the total duration of each
+ * phase to the statistics. Return 0 on success, or -1 if the milestone
+ * wasn't reached, in which case the run is ignored. The trace has one
+ * event per line, see startup_trace.c.
+ */
+static int
+parse_trace(const char* path, const char* milestone)
+{
+    FILE*   file = fopen(path, "r");
+    char    line[512];
+    double  sums_ms[MAX_PHASES];
+    int     seen[MAX_PHASES];
+    double  total_ms = 0.;
+    int     reached = 0;
+    int     n;
+
+    if (!file)
+        return -1;
+
+    memset(seen, 0, sizeof seen);
+    while (fgets(line, sizeof line, file)) {
+        char       name[MAX_PHASE_NAME];
+        char       ph;
+        long long  ts = 0, dur = 0;
+
+        if (sscanf(line, "{\"name\":\"%63[^\"]\",\"ph\":\"%c\",\"ts\":%lld",
+                   name, &ph, &ts) != 3)
+            continue;
+        if (ph == 'X') {
+            const char* p = strstr(line, "\"dur\":");
+            if (!p || sscanf(p + 6, "%lld", &dur) != 1)
+                continue;
+        }
+        if (!strcmp(name, milestone) && !reached) {
+            total_ms = (ts + dur) / 1000.;
+            reached = 1;
+        }
+        if (ph != 'X')
+            continue;
+
+        /* Phases can happen several times per run, e.g. nand_add_dev. */
+        Phase* phase = phase_get(name);
+        if (!phase)
+            continue;
+        n = phase - _phases;
+        if (!seen[n]) {
+            seen[n] = 1;
+            sums_ms[n] = 0.;
+        }
+        sums_ms[n] += dur / 1000.;
+    }
+    fclose(file);
+
+    if (!reached)
+        return -1;
+
+    Phase* total = phase_get(TOTAL_PHASE);
+    if (total && total->count < MAX_RUNS)
+        total->values_ms[total->count++] = total_ms;
+
+    for (n = 0; n < _num_phases; n++) {
+        if (seen[n] && _phases[n].count < MAX_RUNS)
+            _phases[n].values_ms[_phases[n].count++] = sums_ms[n];
+    }
+    return 0;
+}
+
+static int
+compare_doubles(const void* a, const void* b)
+{
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da < db) ? -1 : (da > db);
+}
+
+static void
+print_report(int runs)
+{
+    int n;
+
+    printf("%-24s %6s %10s %10s %10s\n",
+           "phase", "runs", "median", "min", "max");
+    for (n = 0; n < _num_phases; n++) {
+        Phase*  phase = &_phases[n];
+        double  median;
+
+        if (!phase->count)
+            continue;
+        qsort(phase->values_ms, phase->count, sizeof(double),
+              compare_doubles);
+        if (phase->count & 1)
+            median = phase->values_ms[phase->count / 2];
+        else
+            median = (phase->values_ms[phase->count / 2 - 1] +
+                      phase->values_ms[phase->count / 2]) / 2.;
+
+        printf("%-24s %3d/%-2d %10.2f %10.2f %10.2f\n",
+               phase->name, phase->count, runs, median,
+               phase->values_ms[0], phase->values_ms[phase->count - 1]);
+    }
+}
+
+int
+main(int argc, char** argv)
+{
+    const char*  milestone = STARTUP_TRACE_FIRST_FRAME;
+    int          runs = DEFAULT_RUNS;
+    int          failures = 0;
+    int          n;
+    TempFile*    trace;
+    STRALLOC_DEFINE(cmd);
+    STRALLOC_DEFINE(env);
+
+    argc--, argv++;
+    while (argc > 0 && argv[0][0] == '-') {
+        if (!strcmp(argv[0], "-runs") && argc > 1) {
+            runs = atoi(argv[1]);
+            if (runs < 1 || runs > MAX_RUNS) {
+                fprintf(stderr, "Invalid run count: %s\n", argv[1]);
+                return 1;
+            }
+        } else if (!strcmp(argv[0], "-milestone") && argc > 1) {
+            milestone = argv[1];
+        } else {
+            usage();
+            return !strcmp(argv[0], "-help") ? 0 : 1;
+        }
+        argc -= 2, argv += 2;
+    }
+    if (argc < 1) {
+        usage();
+        return 1;
+    }
+
+    trace = tempfile_create();
+    if (!trace) {
+        fprintf(stderr, "Could not create temporary trace file\n");
+        return 1;
+    }
+
+    for (n = 0; n < argc; n++)
+        add_arg(cmd, argv[n]);
+    add_arg(cmd, "-no-window");
+    add_arg(cmd, "-trace-startup");
+    add_arg(cmd, tempfile_path(trace));
+
+    /* putenv() keeps a reference to the string, which is never freed. */
+    stralloc_format(env, "%s=%s", STARTUP_TRACE_EXIT_ENV, milestone);
+    putenv(ASTRDUP(stralloc_cstr(env)));
+
+    for (n = 0; n < runs; n++) {
+        remove(tempfile_path(trace));
+        int status = system(stralloc_cstr(cmd));
+        if (status != 0 || parse_trace(tempfile_path(trace), milestone) < 0) {
+            fprintf(stderr, "Run %d did not reach milestone '%s' (status %d)\n",
+                    n + 1, milestone, status);
+            failures++;
+            continue;
+        }
+        fprintf(stderr, "Run %d/%d done\n", n + 1, runs);
+    }
+
+    tempfile_close(trace);
+    stralloc_reset(cmd);
+    stralloc_reset(env);
+
+    print_report(runs);
+    return failures == runs;
+}
@@ -0,0 +1,88 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* This is the source code of the "emulator_trace_decode" program, which
+ * formats the QEMU log messages recorded into the binary trace rings,
+ * with '-qemu -d <items>,ring' or the 'trace start' console command.
+ * See android/utils/trace_ring.h.
+ */
+
+#include "android/utils/trace_ring.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Required by android/utils/debug.h */
+int android_verbose;
+
+typedef struct {
+    int  raw;
+} Output;
+
+static void
+usage(void)
+{
+    printf(
+        "Usage: emulator_trace_decode [-raw] <dump>\n\n"
+        "Prints the messages of a trace ring dump in time order, each\n"
+        "prefixed with its time in seconds since the first one and the\n"
+        "index of the thread that logged it.\n\n"
+        "Options:\n"
+        "  -raw    print the messages only, like the text log\n");
+}
+
+static void
+print_event(void* opaque, uint32_t thread, int64_t time_ns,
+            const char* text, size_t len)
+{
+    Output* out = opaque;
+
+    if (out->raw) {
+        fwrite(text, 1, len, stdout);
+        return;
+    }
+    /* Messages that continue a line, or span several ones, are still
+     * printed each on their own lines. */
+    printf("%4lld.%06lld %3u: ",
+           (long long)(time_ns / 1000000000),
+           (long long)(time_ns % 1000000000) / 1000, thread);
+    fwrite(text, 1, len, stdout);
+    if (!len || text[len - 1] != '\n')
+        putchar('\n');
+}
+
+int
+main(int argc, char** argv)
+{
+    Output  out = { 0 };
+    int     count;
+
+    argc--, argv++;
+    if (argc > 0 && !strcmp(argv[0], "-raw")) {
+        out.raw = 1;
+        argc--, argv++;
+    }
+    if (argc != 1 || argv[0][0] == '-') {
+        usage();
+        return argc == 1 && !strcmp(argv[0], "-help") ? 0 : 1;
+    }
+
+    count = traceRing_decode(argv[0], print_event, &out);
+    if (count < 0) {
+        fprintf(stderr, "Can't decode %s: %s\n", argv[0],
+                errno == EINVAL ? "not a trace ring dump" : strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "%d events\n", count);
+    return 0;
+}
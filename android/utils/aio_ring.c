@@ -0,0 +1,793 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/aio_ring.h"
+
+#include "android/utils/eintr_wrapper.h"
+#include "android/utils/system.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/aio_abi.h>
+
+// The io_uring ABI, which the headers of older toolchains don't have. Only
+// what is used here is declared, the rest of each structure is padding.
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup     425
+#define __NR_io_uring_enter     426
+#define __NR_io_uring_register  427
+#endif
+
+#define URING_OFF_SQ_RING         0ULL
+#define URING_OFF_CQ_RING         0x8000000ULL
+#define URING_OFF_SQES            0x10000000ULL
+
+#define URING_OP_READV            1
+#define URING_OP_WRITEV           2
+#define URING_OP_FSYNC            3
+#define URING_OP_READ_FIXED       4
+#define URING_OP_WRITE_FIXED      5
+
+#define URING_FSYNC_DATASYNC      1
+#define URING_ENTER_GETEVENTS     1
+
+#define URING_REGISTER_BUFFERS    0
+#define URING_UNREGISTER_BUFFERS  1
+#define URING_REGISTER_EVENTFD    4
+
+// Older kernels don't accept registered buffers above 1 GiB.
+#define URING_MAX_BUFFER_SIZE     (1UL << 30)
+#define URING_MAX_BUFFERS         1024
+
+typedef struct {
+    uint8_t   opcode;
+    uint8_t   flags;
+    uint16_t  ioprio;
+    int32_t   fd;
+    uint64_t  off;
+    uint64_t  addr;
+    uint32_t  len;
+    uint32_t  op_flags;
+    uint64_t  user_data;
+    uint16_t  buf_index;
+    uint16_t  pad[3];
+    uint64_t  pad2[2];
+} UringSqe;
+
+typedef struct {
+    uint64_t  user_data;
+    int32_t   res;
+    uint32_t  flags;
+} UringCqe;
+
+typedef struct {
+    uint32_t  head, tail, ring_mask, ring_entries, flags, dropped, array;
+    uint32_t  resv1;
+    uint64_t  resv2;
+} UringSqOffsets;
+
+typedef struct {
+    uint32_t  head, tail, ring_mask, ring_entries, overflow, cqes, flags;
+    uint32_t  resv1;
+    uint64_t  resv2;
+} UringCqOffsets;
+
+typedef struct {
+    uint32_t        sq_entries;
+    uint32_t        cq_entries;
+    uint32_t        flags;
+    uint32_t        sq_thread_cpu;
+    uint32_t        sq_thread_idle;
+    uint32_t        features;
+    uint32_t        wq_fd;
+    uint32_t        resv[3];
+    UringSqOffsets  sq_off;
+    UringCqOffsets  cq_off;
+} UringParams;
+
+// The barriers between the ring indices and the entries they cover.
+#define aioRing_barrier()  __sync_synchronize()
+
+// Events harvested by each io_getevents() call.
+#define AIO_RING_EVENTS  64
+
+// No request, at the end of the lists of free and refused requests.
+#define AIO_RING_NONE  0xffffffffU
+
+typedef struct {
+    AioRingDoneFunc      done;
+    void*                opaque;
+    AioRingOp            op;
+    int                  fd;
+    int64_t              offset;
+    const struct iovec*  iov;       // Given by the caller.
+    int                  iovcnt;
+    struct iovec*        rest;      // Rest of |iov| after a partial transfer.
+    int                  restcnt;
+    int                  restmax;   // Capacity of |rest|.
+    int64_t              size;      // Total size of |iov|.
+    int64_t              done_bytes;
+    int64_t              error;     // Set if the kernel refused it.
+    uint32_t             next;
+} AioRingReq;
+
+struct AioRing {
+    AioRingKind     kind;
+    unsigned        depth;
+    int             event_fd;
+    AioRingReq*     reqs;
+    uint32_t        free_head;
+    uint32_t*       queue;          // Requests to submit, in order.
+    unsigned        num_queued;
+    unsigned        num_in_flight;  // Submitted, or refused.
+    uint32_t        refused;        // List of requests refused by the kernel.
+    struct iovec*   buffers;        // Registered with io_uring.
+    int             num_buffers;
+    AioRingStats    stats;
+
+    // io_uring.
+    int             fd;
+    void*           sq_map;
+    size_t          sq_map_size;
+    void*           cq_map;
+    size_t          cq_map_size;
+    UringSqe*       sqes;
+    size_t          sqes_size;
+    uint32_t*       sq_head;
+    uint32_t*       sq_tail;
+    uint32_t        sq_mask;
+    uint32_t*       cq_head;
+    uint32_t*       cq_tail;
+    uint32_t        cq_mask;
+    UringCqe*       cqes;
+
+    // Linux AIO.
+    aio_context_t   ctx;
+    struct iocb*    iocbs;
+    struct iocb**   iocb_ptrs;
+};
+
+static int aioRing_syscallError(long ret) {
+    return ret < 0 ? -errno : (int)ret;
+}
+
+static int uring_setup(unsigned entries, UringParams* params) {
+    return aioRing_syscallError(
+            syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                       unsigned flags) {
+    return aioRing_syscallError(syscall(__NR_io_uring_enter, fd, to_submit,
+                                        min_complete, flags, NULL, 0));
+}
+
+static int uring_register(int fd, unsigned opcode, const void* arg,
+                          unsigned count) {
+    return aioRing_syscallError(
+            syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+static int aioRing_uringInit(AioRing* ring) {
+    UringParams params;
+    uint32_t* array;
+    unsigned n;
+    char* sq;
+    char* cq;
+
+    memset(&params, 0, sizeof(params));
+    ring->fd = uring_setup(ring->depth, &params);
+    if (ring->fd < 0) {
+        return ring->fd;
+    }
+    ring->sq_map_size = params.sq_off.array +
+                        params.sq_entries * sizeof(uint32_t);
+    ring->cq_map_size = params.cq_off.cqes +
+                        params.cq_entries * sizeof(UringCqe);
+    ring->sqes_size = params.sq_entries * sizeof(UringSqe);
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        URING_OFF_SQ_RING);
+    ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        URING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, URING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED ||
+        ring->sqes == MAP_FAILED) {
+        return -errno;
+    }
+
+    sq = ring->sq_map;
+    ring->sq_head = (uint32_t*)(sq + params.sq_off.head);
+    ring->sq_tail = (uint32_t*)(sq + params.sq_off.tail);
+    ring->sq_mask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+    // Each entry of the array is the index of the SQE in the same place.
+    array = (uint32_t*)(sq + params.sq_off.array);
+    for (n = 0; n < params.sq_entries; n++) {
+        array[n] = n;
+    }
+
+    cq = ring->cq_map;
+    ring->cq_head = (uint32_t*)(cq + params.cq_off.head);
+    ring->cq_tail = (uint32_t*)(cq + params.cq_off.tail);
+    ring->cq_mask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (UringCqe*)(cq + params.cq_off.cqes);
+
+    return uring_register(ring->fd, URING_REGISTER_EVENTFD,
+                          &ring->event_fd, 1);
+}
+
+static void aioRing_uringDone(AioRing* ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map && ring->cq_map != MAP_FAILED) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map && ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+}
+
+static int aioRing_aioInit(AioRing* ring) {
+    int ret = aioRing_syscallError(
+            syscall(__NR_io_setup, ring->depth, &ring->ctx));
+    if (ret < 0) {
+        ring->ctx = 0;
+        return ret;
+    }
+    AARRAY_NEW0(ring->iocbs, ring->depth);
+    AARRAY_NEW(ring->iocb_ptrs, ring->depth);
+    return 0;
+}
+
+static void aioRing_aioDone(AioRing* ring) {
+    if (ring->ctx) {
+        syscall(__NR_io_destroy, ring->ctx);
+    }
+    AFREE(ring->iocb_ptrs);
+    AFREE(ring->iocbs);
+}
+
+static void aioRing_release(AioRing* ring) {
+    uint32_t n;
+
+    if (ring->kind == AIO_RING_IO_URING) {
+        aioRing_uringDone(ring);
+    } else {
+        aioRing_aioDone(ring);
+    }
+    if (ring->event_fd >= 0) {
+        close(ring->event_fd);
+    }
+    for (n = 0; n < ring->depth; n++) {
+        AFREE(ring->reqs[n].rest);
+    }
+    AFREE(ring->buffers);
+    AFREE(ring->queue);
+    AFREE(ring->reqs);
+    AFREE(ring);
+}
+
+AioRingKind aioRing_kind(const AioRing* ring) {
+    return ring->kind;
+}
+
+AioRing* aioRing_new(unsigned depth, AioRingKind kind) {
+    AioRing* ring;
+    uint32_t n;
+    int ret;
+
+    if (kind == AIO_RING_ANY) {
+        ring = aioRing_new(depth, AIO_RING_IO_URING);
+        return ring ? ring : aioRing_new(depth, AIO_RING_LINUX_AIO);
+    }
+
+    ANEW0(ring);
+    ring->kind = kind;
+    ring->depth = depth;
+    ring->fd = -1;
+    ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    AARRAY_NEW0(ring->reqs, depth);
+    AARRAY_NEW(ring->queue, depth);
+    for (n = 0; n < depth; n++) {
+        ring->reqs[n].next = n + 1 < depth ? n + 1 : AIO_RING_NONE;
+    }
+    ring->free_head = 0;
+    ring->refused = AIO_RING_NONE;
+
+    if (ring->event_fd < 0) {
+        ret = -errno;
+    } else if (kind == AIO_RING_IO_URING) {
+        ret = aioRing_uringInit(ring);
+    } else {
+        ret = aioRing_aioInit(ring);
+    }
+    if (ret < 0) {
+        aioRing_release(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+void aioRing_free(AioRing* ring) {
+    if (!ring) {
+        return;
+    }
+    while (ring->num_queued || ring->num_in_flight) {
+        if (ring->num_queued && aioRing_submit(ring) < 0 &&
+            !ring->num_in_flight) {
+            break;
+        }
+        aioRing_reap(ring, true);
+    }
+    aioRing_release(ring);
+}
+
+int aioRing_eventFd(const AioRing* ring) {
+    return ring->event_fd;
+}
+
+int aioRing_registerBuffers(AioRing* ring, const struct iovec* regions,
+                            int count) {
+    struct iovec* buffers = NULL;
+    int num_buffers = 0;
+    int n, ret;
+
+    if (ring->kind != AIO_RING_IO_URING) {
+        return -ENOTSUP;
+    }
+    if (ring->num_buffers) {
+        uring_register(ring->fd, URING_UNREGISTER_BUFFERS, NULL, 0);
+        AFREE(ring->buffers);
+        ring->buffers = NULL;
+        ring->num_buffers = 0;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    // Split the regions into buffers of at most URING_MAX_BUFFER_SIZE.
+    for (n = 0; n < count; n++) {
+        char* base = regions[n].iov_base;
+        size_t left = regions[n].iov_len;
+        while (left > 0) {
+            size_t len = left < URING_MAX_BUFFER_SIZE ? left
+                                                     : URING_MAX_BUFFER_SIZE;
+            if (num_buffers == URING_MAX_BUFFERS) {
+                AFREE(buffers);
+                return -E2BIG;
+            }
+            AARRAY_RENEW(buffers, num_buffers + 1);
+            buffers[num_buffers].iov_base = base;
+            buffers[num_buffers].iov_len = len;
+            num_buffers++;
+            base += len;
+            left -= len;
+        }
+    }
+
+    ret = uring_register(ring->fd, URING_REGISTER_BUFFERS, buffers,
+                         num_buffers);
+    if (ret < 0) {
+        AFREE(buffers);
+        return ret;
+    }
+    ring->buffers = buffers;
+    ring->num_buffers = num_buffers;
+    return 0;
+}
+
+static int64_t aioRing_iovSize(const struct iovec* iov, int iovcnt) {
+    int64_t size = 0;
+    int n;
+
+    for (n = 0; n < iovcnt; n++) {
+        size += iov[n].iov_len;
+    }
+    return size;
+}
+
+bool aioRing_queue(AioRing* ring, AioRingOp op, int fd, int64_t offset,
+                   const struct iovec* iov, int iovcnt,
+                   AioRingDoneFunc done, void* opaque) {
+    uint32_t index = ring->free_head;
+    AioRingReq* req;
+
+    if (index == AIO_RING_NONE) {
+        return false;
+    }
+    req = &ring->reqs[index];
+    ring->free_head = req->next;
+
+    req->done = done;
+    req->opaque = opaque;
+    req->op = op;
+    req->fd = fd;
+    req->offset = offset;
+    req->iov = iov;
+    req->iovcnt = iovcnt;
+    req->restcnt = 0;
+    req->size = op == AIO_RING_FDSYNC ? 0 : aioRing_iovSize(iov, iovcnt);
+    req->done_bytes = 0;
+    req->error = 0;
+
+    ring->queue[ring->num_queued++] = index;
+    ring->stats.requests++;
+    return true;
+}
+
+unsigned aioRing_queued(const AioRing* ring) {
+    return ring->num_queued;
+}
+
+unsigned aioRing_inFlight(const AioRing* ring) {
+    return ring->num_in_flight;
+}
+
+// Return the buffers of the next transfer of |req|, and their count.
+static const struct iovec* aioRingReq_iov(const AioRingReq* req, int* count) {
+    if (req->restcnt) {
+        *count = req->restcnt;
+        return req->rest;
+    }
+    *count = req->iovcnt;
+    return req->iov;
+}
+
+// Return the index of the registered buffer of |ring| that contains
+// |iov|, or -1.
+static int aioRing_findBuffer(const AioRing* ring, const struct iovec* iov) {
+    const char* base = iov->iov_base;
+    int n;
+
+    for (n = 0; n < ring->num_buffers; n++) {
+        const char* start = ring->buffers[n].iov_base;
+        if (base >= start &&
+            base + iov->iov_len <= start + ring->buffers[n].iov_len) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+static void aioRing_uringPrepare(AioRing* ring, uint32_t index,
+                                 UringSqe* sqe) {
+    const AioRingReq* req = &ring->reqs[index];
+    const struct iovec* iov;
+    int count, buffer;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = req->fd;
+    sqe->user_data = index;
+    if (req->op == AIO_RING_FDSYNC) {
+        sqe->opcode = URING_OP_FSYNC;
+        sqe->op_flags = URING_FSYNC_DATASYNC;
+        return;
+    }
+    iov = aioRingReq_iov(req, &count);
+    sqe->off = req->offset + req->done_bytes;
+    if (count == 1 && (buffer = aioRing_findBuffer(ring, iov)) >= 0) {
+        sqe->opcode = req->op == AIO_RING_READ ? URING_OP_READ_FIXED
+                                               : URING_OP_WRITE_FIXED;
+        sqe->addr = (uintptr_t)iov->iov_base;
+        sqe->len = iov->iov_len;
+        sqe->buf_index = buffer;
+        ring->stats.fixed++;
+    } else {
+        sqe->opcode = req->op == AIO_RING_READ ? URING_OP_READV
+                                               : URING_OP_WRITEV;
+        sqe->addr = (uintptr_t)iov;
+        sqe->len = count;
+    }
+}
+
+// Complete the request at the head of the queue of |ring| with |error|.
+static void aioRing_refuse(AioRing* ring, int error) {
+    uint32_t index = ring->queue[0];
+    uint64_t one = 1;
+
+    ring->reqs[index].error = error;
+    ring->reqs[index].next = ring->refused;
+    ring->refused = index;
+    ring->num_in_flight++;
+    ring->num_queued--;
+    memmove(ring->queue, ring->queue + 1,
+            ring->num_queued * sizeof(ring->queue[0]));
+    // Make sure the caller reaps it.
+    HANDLE_EINTR(write(ring->event_fd, &one, sizeof(one)));
+}
+
+static int aioRing_uringSubmit(AioRing* ring) {
+    uint32_t tail = *ring->sq_tail;
+    unsigned n;
+    int ret;
+
+    // The ring has room for |depth| requests, and the kernel consumes the
+    // entries in each call, so it is never full.
+    for (n = 0; n < ring->num_queued; n++) {
+        aioRing_uringPrepare(ring, ring->queue[n],
+                             &ring->sqes[tail & ring->sq_mask]);
+        tail++;
+    }
+    aioRing_barrier();
+    *ring->sq_tail = tail;
+
+    ret = uring_enter(ring->fd, ring->num_queued, 0, 0);
+    // Take back the entries that weren't consumed, to prepare them again
+    // with the next call.
+    aioRing_barrier();
+    *ring->sq_tail = *ring->sq_head;
+    if (ret == -EAGAIN || ret == -EBUSY || ret == -EINTR) {
+        return ret;
+    }
+    if (ret < 0) {
+        // Retrying won't help, e.g. EFAULT or EINVAL: fail them all.
+        while (ring->num_queued) {
+            aioRing_refuse(ring, ret);
+        }
+        return ret;
+    }
+    if (ret == 0) {
+        return -EAGAIN;
+    }
+    ring->num_in_flight += ret;
+    ring->num_queued -= ret;
+    memmove(ring->queue, ring->queue + ret,
+            ring->num_queued * sizeof(ring->queue[0]));
+    ring->stats.submits++;
+    if ((uint32_t)ret > ring->stats.max_batch) {
+        ring->stats.max_batch = ret;
+    }
+    return ret;
+}
+
+static void aioRing_aioPrepare(AioRing* ring, uint32_t index,
+                               struct iocb* iocb) {
+    const AioRingReq* req = &ring->reqs[index];
+    const struct iovec* iov;
+    int count;
+
+    memset(iocb, 0, sizeof(*iocb));
+    iocb->aio_data = index;
+    iocb->aio_fildes = req->fd;
+    iocb->aio_flags = IOCB_FLAG_RESFD;
+    iocb->aio_resfd = ring->event_fd;
+    if (req->op == AIO_RING_FDSYNC) {
+        iocb->aio_lio_opcode = IOCB_CMD_FDSYNC;
+        return;
+    }
+    iov = aioRingReq_iov(req, &count);
+    iocb->aio_lio_opcode = req->op == AIO_RING_READ ? IOCB_CMD_PREADV
+                                                    : IOCB_CMD_PWRITEV;
+    iocb->aio_buf = (uintptr_t)iov;
+    iocb->aio_nbytes = count;
+    iocb->aio_offset = req->offset + req->done_bytes;
+}
+
+static int aioRing_aioSubmit(AioRing* ring) {
+    int submitted = 0;
+    unsigned n;
+
+    for (n = 0; n < ring->num_queued; n++) {
+        struct iocb* iocb = &ring->iocbs[ring->queue[n]];
+        aioRing_aioPrepare(ring, ring->queue[n], iocb);
+        ring->iocb_ptrs[n] = iocb;
+    }
+    // io_submit() stops at the first request it refuses, which is failed
+    // so that the following ones can go.
+    while (ring->num_queued) {
+        int ret = aioRing_syscallError(
+                syscall(__NR_io_submit, ring->ctx, (long)ring->num_queued,
+                        ring->iocb_ptrs));
+        if (ret == -EAGAIN || ret == -EINTR) {
+            return submitted ? submitted : ret;
+        }
+        if (ret <= 0) {
+            aioRing_refuse(ring, ret ? ret : -EIO);
+            memmove(ring->iocb_ptrs, ring->iocb_ptrs + 1,
+                    ring->num_queued * sizeof(ring->iocb_ptrs[0]));
+            continue;
+        }
+        submitted += ret;
+        ring->num_in_flight += ret;
+        ring->num_queued -= ret;
+        memmove(ring->queue, ring->queue + ret,
+                ring->num_queued * sizeof(ring->queue[0]));
+        memmove(ring->iocb_ptrs, ring->iocb_ptrs + ret,
+                ring->num_queued * sizeof(ring->iocb_ptrs[0]));
+        ring->stats.submits++;
+        if ((uint32_t)ret > ring->stats.max_batch) {
+            ring->stats.max_batch = ret;
+        }
+    }
+    return submitted;
+}
+
+int aioRing_submit(AioRing* ring) {
+    if (!ring->num_queued) {
+        return 0;
+    }
+    if (ring->kind == AIO_RING_LINUX_AIO) {
+        return aioRing_aioSubmit(ring);
+    }
+    return aioRing_uringSubmit(ring);
+}
+
+// Set the remaining buffers of |req| after its first |done_bytes|.
+static void aioRingReq_skip(AioRingReq* req) {
+    int64_t skip = req->done_bytes;
+    int n;
+
+    if (req->restmax < req->iovcnt) {
+        AARRAY_RENEW(req->rest, req->iovcnt);
+        req->restmax = req->iovcnt;
+    }
+    req->restcnt = 0;
+    for (n = 0; n < req->iovcnt; n++) {
+        if (skip >= (int64_t)req->iov[n].iov_len) {
+            skip -= req->iov[n].iov_len;
+            continue;
+        }
+        req->rest[req->restcnt].iov_base = (char*)req->iov[n].iov_base + skip;
+        req->rest[req->restcnt].iov_len = req->iov[n].iov_len - skip;
+        req->restcnt++;
+        skip = 0;
+    }
+}
+
+// Handle the result |res| of the last transfer of request |index|. Return
+// true if it is finished, or false if it was queued again for the rest.
+static bool aioRing_complete(AioRing* ring, uint32_t index, int64_t res) {
+    AioRingReq* req = &ring->reqs[index];
+
+    if (req->op != AIO_RING_FDSYNC) {
+        if (res > 0) {
+            req->done_bytes += res;
+        }
+        if (res > 0 && req->done_bytes < req->size) {
+            aioRingReq_skip(req);
+            ring->queue[ring->num_queued++] = index;
+            ring->stats.resubmits++;
+            return false;
+        }
+    }
+    req->error = res < 0 ? res : 0;
+    return true;
+}
+
+// Release request |index| of |ring| and run its completion function.
+static void aioRing_finish(AioRing* ring, uint32_t index) {
+    AioRingReq* req = &ring->reqs[index];
+    AioRingDoneFunc done = req->done;
+    void* opaque = req->opaque;
+    int64_t ret = req->error ? req->error : req->done_bytes;
+
+    req->next = ring->free_head;
+    ring->free_head = index;
+    ring->stats.completions++;
+    // The function can queue new requests.
+    done(opaque, ret);
+}
+
+static int aioRing_uringReap(AioRing* ring, bool wait) {
+    int count = 0;
+
+    for (;;) {
+        uint32_t head = *ring->cq_head;
+        uint32_t index;
+        int32_t res;
+
+        aioRing_barrier();
+        if (head == *ring->cq_tail) {
+            if (!wait || count || !ring->num_in_flight) {
+                break;
+            }
+            if (uring_enter(ring->fd, 0, 1, URING_ENTER_GETEVENTS) < 0 &&
+                errno != EINTR) {
+                break;
+            }
+            continue;
+        }
+        aioRing_barrier();
+        index = (uint32_t)ring->cqes[head & ring->cq_mask].user_data;
+        res = ring->cqes[head & ring->cq_mask].res;
+        aioRing_barrier();
+        *ring->cq_head = head + 1;
+
+        ring->num_in_flight--;
+        if (aioRing_complete(ring, index, res)) {
+            aioRing_finish(ring, index);
+            count++;
+        }
+    }
+    return count;
+}
+
+static int aioRing_aioReap(AioRing* ring, bool wait) {
+    struct io_event events[AIO_RING_EVENTS];
+    int count = 0;
+
+    for (;;) {
+        struct timespec timeout = { 0, 0 };
+        bool block = wait && !count && ring->num_in_flight > 0;
+        int n, ret;
+
+        ret = aioRing_syscallError(
+                syscall(__NR_io_getevents, ring->ctx, block ? 1L : 0L,
+                        (long)AIO_RING_EVENTS, events,
+                        block ? NULL : &timeout));
+        if (ret == -EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        ring->num_in_flight -= ret;
+        for (n = 0; n < ret; n++) {
+            uint32_t index = (uint32_t)events[n].data;
+            if (aioRing_complete(ring, index, events[n].res)) {
+                aioRing_finish(ring, index);
+                count++;
+            }
+        }
+        if (ret < AIO_RING_EVENTS) {
+            break;
+        }
+    }
+    return count;
+}
+
+int aioRing_reap(AioRing* ring, bool wait) {
+    uint64_t resubmits = ring->stats.resubmits;
+    uint64_t events;
+    int count = 0;
+
+    // Clear the eventfd first, so that completions from now on set it.
+    HANDLE_EINTR(read(ring->event_fd, &events, sizeof(events)));
+
+    while (ring->refused != AIO_RING_NONE) {
+        uint32_t index = ring->refused;
+        ring->refused = ring->reqs[index].next;
+        ring->num_in_flight--;
+        aioRing_finish(ring, index);
+        count++;
+    }
+    if (count) {
+        wait = false;
+    }
+
+    if (ring->kind == AIO_RING_IO_URING) {
+        count += aioRing_uringReap(ring, wait);
+    } else {
+        count += aioRing_aioReap(ring, wait);
+    }
+
+    // Continue the partial transfers.
+    if (ring->stats.resubmits != resubmits) {
+        aioRing_submit(ring);
+    }
+    return count;
+}
+
+const AioRingStats* aioRing_stats(const AioRing* ring) {
+    return &ring->stats;
+}
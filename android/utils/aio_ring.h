@@ -0,0 +1,121 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_AIO_RING_H
+#define ANDROID_UTILS_AIO_RING_H
+
+#include "android/utils/compiler.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+ANDROID_BEGIN_HEADER
+
+// Asynchronous file I/O with the native interfaces of Linux, for the
+// block layer, see linux-aio.c.
+//
+// An AioRing queues requests without any system call, and submits all the
+// queued ones with a single one in aioRing_submit(). It uses io_uring
+// when the kernel has it, or Linux AIO otherwise, which only really runs
+// asynchronously on files opened with O_DIRECT. Both are called directly
+// through syscall(), so that neither liburing nor libaio is needed.
+//
+// Completions are signaled on an eventfd, which the caller polls and then
+// calls aioRing_reap() to run the completion functions of the finished
+// requests. Reads and writes that the kernel completes partially are
+// resubmitted for the rest, so that a request only completes short at
+// the end of the file.
+//
+// With io_uring, memory regions that most requests use, such as the
+// guest RAM, can be registered once so that the kernel doesn't map and
+// pin their pages for each request.
+//
+// None of this is thread-safe.
+
+typedef enum {
+    AIO_RING_ANY = 0,       // Best interface available, for aioRing_new().
+    AIO_RING_IO_URING,
+    AIO_RING_LINUX_AIO,
+} AioRingKind;
+
+typedef enum {
+    AIO_RING_READ = 0,
+    AIO_RING_WRITE,
+    AIO_RING_FDSYNC,
+} AioRingOp;
+
+// Called by aioRing_reap() for a finished request, with the number of
+// bytes transferred, or a negative errno value.
+typedef void (*AioRingDoneFunc)(void* opaque, int64_t ret);
+
+typedef struct {
+    uint64_t  requests;     // Requests queued.
+    uint64_t  submits;      // System calls that submitted requests.
+    uint64_t  fixed;        // Requests into registered buffers.
+    uint64_t  resubmits;    // Partial transfers that were continued.
+    uint64_t  completions;
+    uint32_t  max_batch;    // Most requests submitted by one call.
+} AioRingStats;
+
+typedef struct AioRing AioRing;
+
+// Return the interface used by |ring|.
+AioRingKind aioRing_kind(const AioRing* ring);
+
+// Return a new ring for up to |depth| requests in flight, using |kind|,
+// or NULL if the kernel doesn't support it.
+AioRing* aioRing_new(unsigned depth, AioRingKind kind);
+
+// Wait for the requests in flight, and release |ring|.
+void aioRing_free(AioRing* ring);
+
+// Return the non-blocking eventfd that becomes readable when requests of
+// |ring| complete.
+int aioRing_eventFd(const AioRing* ring);
+
+// Register |count| memory regions with |ring|, replacing the previous
+// ones, so that requests with a single buffer inside one of them use it
+// directly. Return 0 on success, or a negative errno value, which is
+// -ENOTSUP without io_uring, and usually -ENOMEM when the regions are
+// above RLIMIT_MEMLOCK.
+int aioRing_registerBuffers(AioRing* ring, const struct iovec* regions,
+                            int count);
+
+// Queue a request of |ring| for |op| on |fd| at |offset|, with |iovcnt|
+// buffers that must remain valid until it completes. Return false if
+// |ring| already has |depth| requests.
+bool aioRing_queue(AioRing* ring, AioRingOp op, int fd, int64_t offset,
+                   const struct iovec* iov, int iovcnt,
+                   AioRingDoneFunc done, void* opaque);
+
+// Return the number of requests of |ring| that are queued, or in flight.
+unsigned aioRing_queued(const AioRing* ring);
+unsigned aioRing_inFlight(const AioRing* ring);
+
+// Submit all the queued requests of |ring|. Return the number of requests
+// submitted, or a negative errno value. The requests that couldn't be
+// submitted stay queued after -EAGAIN, -EBUSY or -EINTR, and are completed
+// with any other error by the next aioRing_reap().
+int aioRing_submit(AioRing* ring);
+
+// Run the completion functions of the finished requests of |ring|, after
+// waiting for at least one if |wait| is true and any are in flight.
+// Return the number of requests completed.
+int aioRing_reap(AioRing* ring, bool wait);
+
+// Return the statistics of |ring|.
+const AioRingStats* aioRing_stats(const AioRing* ring);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_AIO_RING_H
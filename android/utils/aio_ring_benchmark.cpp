@@ -0,0 +1,519 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// Replays a mix of 4K to 1M reads and writes, random or sequential,
+// against a raw and a qcow2 disk image, through the thread pool of
+// posix-aio-compat.c and through the native rings of linux-aio.c, and
+// reports the IOPS and latency percentiles of each. Run with
+// emulator_benchmarks.
+//
+// The block drivers can't be linked here, so the I/O they generate is
+// reproduced: raw-posix issues one request per guest request. qcow2
+// issues one request per run of contiguous clusters, one after the
+// other, into clusters allocated in the order they were first written,
+// with its L2 tables cached.
+
+#include "android/utils/aio_ring.h"
+
+#include "android/filesystems/testing/TestSupport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const int64_t kImageSize = 128LL << 20;
+const int64_t kClusterSize = 64 << 10;
+const size_t kMaxRequest = 1 << 20;
+const int kDepth = 32;
+const int kRequests = 1000;
+
+typedef void (*DoneFunc)(void* opaque, int64_t ret);
+
+int64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+uint32_t nextRandom(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// The requests of the guest.
+struct Request {
+    int64_t offset;
+    size_t size;
+    bool write;
+};
+
+// 70% reads, with sizes weighted towards the small ones.
+std::vector<Request> makeTrace(bool random, uint32_t seed) {
+    static const struct { size_t size; int weight; } kSizes[] = {
+        { 4 << 10, 40 }, { 16 << 10, 20 }, { 64 << 10, 20 },
+        { 256 << 10, 15 }, { 1 << 20, 5 },
+    };
+    std::vector<Request> trace;
+    int64_t offset = 0;
+    for (int n = 0; n < kRequests; ++n) {
+        Request request;
+        int pick = nextRandom(&seed) % 100;
+        size_t k = 0;
+        while (pick >= kSizes[k].weight) {
+            pick -= kSizes[k].weight;
+            k++;
+        }
+        request.size = kSizes[k].size;
+        request.write = nextRandom(&seed) % 100 < 30;
+        if (random) {
+            offset = (int64_t)(nextRandom(&seed) %
+                               ((kImageSize - request.size) / 4096)) * 4096;
+        } else if (offset + (int64_t)request.size > kImageSize) {
+            offset = 0;
+        }
+        request.offset = offset;
+        offset += request.size;
+        trace.push_back(request);
+    }
+    return trace;
+}
+
+// The file of an image, and where its guest offsets are.
+struct Image {
+    std::string name;
+    std::string path;
+    // Host offset of each guest cluster, for qcow2.
+    std::vector<int64_t> clusters;
+
+    // Return the length of the run of contiguous clusters at guest
+    // |offset|, up to |size|, and set its host offset.
+    size_t map(int64_t offset, size_t size, int64_t* host) const {
+        if (clusters.empty()) {
+            *host = offset;
+            return size;
+        }
+        int64_t index = offset / kClusterSize;
+        size_t len = std::min((int64_t)size,
+                              kClusterSize - offset % kClusterSize);
+        *host = clusters[index] + offset % kClusterSize;
+        while (len < size && clusters[index + 1] == clusters[index] +
+                                                   kClusterSize) {
+            index++;
+            len = std::min(size, len + kClusterSize);
+        }
+        return len;
+    }
+};
+
+void fillFile(const std::string& path, int64_t size) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    ASSERT_GE(fd, 0);
+    std::vector<char> chunk(kMaxRequest, 'd');
+    for (int64_t pos = 0; pos < size; pos += chunk.size()) {
+        ASSERT_EQ((ssize_t)chunk.size(),
+                  write(fd, &chunk[0], chunk.size()));
+    }
+    fsync(fd);
+    close(fd);
+}
+
+// An image of clusters written in random order, after its metadata.
+void makeQcow2(Image* image) {
+    int64_t count = kImageSize / kClusterSize;
+    uint32_t seed = 1234;
+    std::vector<int64_t> order(count);
+    for (int64_t n = 0; n < count; ++n) {
+        order[n] = n;
+    }
+    // Mostly in order, as a guest fills its disk, with some shuffling.
+    for (int64_t n = 0; n < count; ++n) {
+        if (nextRandom(&seed) % 4 == 0) {
+            std::swap(order[n], order[nextRandom(&seed) % count]);
+        }
+    }
+    image->clusters.resize(count);
+    for (int64_t n = 0; n < count; ++n) {
+        // Header, L1 table, refcount table and block, L2 tables.
+        image->clusters[order[n]] = (n + 4) * kClusterSize;
+    }
+    fillFile(image->path, kImageSize + 4 * kClusterSize);
+}
+
+// An interface to submit requests asynchronously.
+class Engine {
+public:
+    virtual ~Engine() {}
+    virtual const char* name() const = 0;
+    virtual bool queue(int fd, bool write, int64_t offset, void* buffer,
+                       size_t size, DoneFunc done, void* opaque) = 0;
+    virtual void submit() = 0;
+    // Wait for completions and run their functions.
+    virtual void wait() = 0;
+};
+
+// A pool of threads that run blocking requests, which signal their
+// completions on a pipe, like posix-aio-compat.c.
+class ThreadEngine : public Engine {
+public:
+    explicit ThreadEngine(int count) : mStop(false) {
+        pthread_mutex_init(&mLock, NULL);
+        pthread_cond_init(&mCond, NULL);
+        if (pipe(mPipe) < 0) {
+            abort();
+        }
+        fcntl(mPipe[0], F_SETFL, O_NONBLOCK);
+        mThreads.resize(count);
+        for (int n = 0; n < count; ++n) {
+            pthread_create(&mThreads[n], NULL, threadMain, this);
+        }
+    }
+
+    virtual ~ThreadEngine() {
+        pthread_mutex_lock(&mLock);
+        mStop = true;
+        pthread_cond_broadcast(&mCond);
+        pthread_mutex_unlock(&mLock);
+        for (size_t n = 0; n < mThreads.size(); ++n) {
+            pthread_join(mThreads[n], NULL);
+        }
+        close(mPipe[0]);
+        close(mPipe[1]);
+    }
+
+    virtual const char* name() const { return "threads"; }
+
+    virtual bool queue(int fd, bool write, int64_t offset, void* buffer,
+                       size_t size, DoneFunc done, void* opaque) {
+        Job job = { fd, write, offset, buffer, size, done, opaque, 0 };
+        // Each request is handed to the threads at once.
+        pthread_mutex_lock(&mLock);
+        mJobs.push_back(job);
+        pthread_cond_signal(&mCond);
+        pthread_mutex_unlock(&mLock);
+        return true;
+    }
+
+    virtual void submit() {}
+
+    virtual void wait() {
+        struct pollfd pfd = { mPipe[0], POLLIN, 0 };
+        char bytes[64];
+        poll(&pfd, 1, -1);
+        while (read(mPipe[0], bytes, sizeof(bytes)) > 0) {
+        }
+        std::deque<Job> done;
+        pthread_mutex_lock(&mLock);
+        done.swap(mDone);
+        pthread_mutex_unlock(&mLock);
+        for (size_t n = 0; n < done.size(); ++n) {
+            done[n].done(done[n].opaque, done[n].ret);
+        }
+    }
+
+private:
+    struct Job {
+        int fd;
+        bool write;
+        int64_t offset;
+        void* buffer;
+        size_t size;
+        DoneFunc done;
+        void* opaque;
+        int64_t ret;
+    };
+
+    static void* threadMain(void* opaque) {
+        ThreadEngine* engine = static_cast<ThreadEngine*>(opaque);
+        pthread_mutex_lock(&engine->mLock);
+        for (;;) {
+            while (engine->mJobs.empty() && !engine->mStop) {
+                pthread_cond_wait(&engine->mCond, &engine->mLock);
+            }
+            if (engine->mStop) {
+                break;
+            }
+            Job job = engine->mJobs.front();
+            engine->mJobs.pop_front();
+            pthread_mutex_unlock(&engine->mLock);
+
+            job.ret = job.write
+                    ? pwrite(job.fd, job.buffer, job.size, job.offset)
+                    : pread(job.fd, job.buffer, job.size, job.offset);
+            if (job.ret < 0) {
+                job.ret = -errno;
+            }
+
+            pthread_mutex_lock(&engine->mLock);
+            engine->mDone.push_back(job);
+            char byte = 0;
+            if (write(engine->mPipe[1], &byte, 1) < 0) {
+                abort();
+            }
+        }
+        pthread_mutex_unlock(&engine->mLock);
+        return NULL;
+    }
+
+    pthread_mutex_t mLock;
+    pthread_cond_t mCond;
+    bool mStop;
+    std::deque<Job> mJobs;
+    std::deque<Job> mDone;
+    int mPipe[2];
+    std::vector<pthread_t> mThreads;
+};
+
+class RingEngine : public Engine {
+public:
+    RingEngine(AioRing* ring, const char* name)
+        : mRing(ring), mName(name), mIovs(kDepth * 2), mNext(0) {}
+
+    virtual ~RingEngine() { aioRing_free(mRing); }
+
+    virtual const char* name() const { return mName; }
+
+    virtual bool queue(int fd, bool write, int64_t offset, void* buffer,
+                       size_t size, DoneFunc done, void* opaque) {
+        struct iovec* iov = &mIovs[mNext++ % mIovs.size()];
+        iov->iov_base = buffer;
+        iov->iov_len = size;
+        return aioRing_queue(mRing, write ? AIO_RING_WRITE : AIO_RING_READ,
+                             fd, offset, iov, 1, done, opaque);
+    }
+
+    virtual void submit() { aioRing_submit(mRing); }
+
+    virtual void wait() {
+        struct pollfd pfd = { aioRing_eventFd(mRing), POLLIN, 0 };
+        poll(&pfd, 1, -1);
+        aioRing_reap(mRing, false);
+    }
+
+    const AioRingStats* stats() const { return aioRing_stats(mRing); }
+
+private:
+    AioRing* mRing;
+    const char* mName;
+    std::vector<struct iovec> mIovs;
+    size_t mNext;
+};
+
+// A guest request in flight, and its next cluster run.
+struct Op;
+
+struct Run {
+    Engine* engine;
+    const Image* image;
+    int fd;
+    const std::vector<Request>* trace;
+    std::vector<Op*> free;
+    std::vector<int64_t> latencies;
+    int in_flight;
+    int errors;
+};
+
+struct Op {
+    Run* run;
+    const Request* request;
+    char* buffer;
+    size_t done;
+    int64_t start;
+};
+
+void issue(Op* op);
+
+void onDone(void* opaque, int64_t ret) {
+    Op* op = static_cast<Op*>(opaque);
+    Run* run = op->run;
+    if (ret <= 0) {
+        run->errors++;
+        ret = op->request->size - op->done;
+    }
+    op->done += ret;
+    if (op->done < op->request->size) {
+        // qcow2 goes on with the next run of clusters.
+        issue(op);
+        return;
+    }
+    run->latencies.push_back(nowUs() - op->start);
+    run->in_flight--;
+    run->free.push_back(op);
+}
+
+void issue(Op* op) {
+    Run* run = op->run;
+    int64_t host;
+    size_t len = run->image->map(op->request->offset + op->done,
+                                 op->request->size - op->done, &host);
+    if (!run->engine->queue(run->fd, op->request->write, host,
+                            op->buffer + op->done, len, onDone, op)) {
+        abort();
+    }
+}
+
+struct Result {
+    double iops;
+    double mbps;
+    int64_t p50;
+    int64_t p90;
+    int64_t p99;
+};
+
+// Replay |trace| on |image| with |engine|, with |kDepth| requests in
+// flight, whose buffers are in |ram|.
+Result replay(Engine* engine, const Image& image, bool direct,
+              const std::vector<Request>& trace, char* ram) {
+    Run run;
+    run.engine = engine;
+    run.image = &image;
+    run.fd = open(image.path.c_str(), O_RDWR | (direct ? O_DIRECT : 0));
+    run.trace = &trace;
+    run.in_flight = 0;
+    run.errors = 0;
+    EXPECT_GE(run.fd, 0);
+
+    std::vector<Op> ops(kDepth);
+    for (int n = 0; n < kDepth; ++n) {
+        ops[n].run = &run;
+        ops[n].buffer = ram + n * kMaxRequest;
+        run.free.push_back(&ops[n]);
+    }
+
+    int64_t bytes = 0;
+    int64_t start = nowUs();
+    size_t next = 0;
+    while (next < trace.size() || run.in_flight) {
+        while (!run.free.empty() && next < trace.size()) {
+            Op* op = run.free.back();
+            run.free.pop_back();
+            op->request = &trace[next++];
+            op->done = 0;
+            op->start = nowUs();
+            run.in_flight++;
+            bytes += op->request->size;
+            issue(op);
+        }
+        engine->submit();
+        engine->wait();
+    }
+    int64_t elapsed = nowUs() - start;
+    close(run.fd);
+
+    EXPECT_EQ(0, run.errors);
+    EXPECT_EQ(trace.size(), run.latencies.size());
+    std::sort(run.latencies.begin(), run.latencies.end());
+    Result result;
+    result.iops = trace.size() * 1e6 / elapsed;
+    result.mbps = bytes / (double)elapsed;
+    result.p50 = run.latencies[run.latencies.size() / 2];
+    result.p90 = run.latencies[run.latencies.size() * 9 / 10];
+    result.p99 = run.latencies[run.latencies.size() * 99 / 100];
+    return result;
+}
+
+}  // namespace
+
+TEST(AioRingBenchmark, ImageReplay) {
+    Image images[2];
+    images[0].name = "raw";
+    images[0].path = android::testing::CreateTempFilePath();
+    fillFile(images[0].path, kImageSize);
+    images[1].name = "qcow2";
+    images[1].path = android::testing::CreateTempFilePath();
+    makeQcow2(&images[1]);
+
+    // The buffers of the requests, as in the guest RAM.
+    const size_t ramSize = kDepth * kMaxRequest;
+    void* ramAlloc = NULL;
+    ASSERT_EQ(0, posix_memalign(&ramAlloc, 4096, ramSize));
+    char* ram = static_cast<char*>(ramAlloc);
+    memset(ram, 'g', ramSize);
+    struct iovec region = { ram, ramSize };
+
+    printf("%-6s %-4s %-8s %-16s %8s %8s %8s %8s %8s %6s\n", "image",
+           "io", "cache", "engine", "IOPS", "MB/s", "p50 us", "p90 us",
+           "p99 us", "batch");
+    for (int direct = 0; direct < 2; ++direct) {
+        for (int i = 0; i < 2; ++i) {
+            for (int random = 0; random < 2; ++random) {
+                std::vector<Request> trace = makeTrace(random, 42 + random);
+                for (int e = 0; e < 4; ++e) {
+                    Engine* engine = NULL;
+                    RingEngine* ring = NULL;
+                    if (e == 0) {
+                        engine = new ThreadEngine(8);
+                    } else {
+                        AioRingKind kind = e == 3 ? AIO_RING_LINUX_AIO
+                                                  : AIO_RING_IO_URING;
+                        // Linux AIO blocks without O_DIRECT.
+                        if (kind == AIO_RING_LINUX_AIO && !direct) {
+                            continue;
+                        }
+                        AioRing* aio = aioRing_new(kDepth, kind);
+                        if (!aio) {
+                            continue;
+                        }
+                        if (e == 2 &&
+                            aioRing_registerBuffers(aio, &region, 1) < 0) {
+                            printf("Can't register buffers, skipped\n");
+                            aioRing_free(aio);
+                            continue;
+                        }
+                        ring = new RingEngine(
+                                aio, e == 1 ? "io_uring"
+                                     : e == 2 ? "io_uring+fixed"
+                                              : "linux-aio");
+                        engine = ring;
+                    }
+                    Result r = replay(engine, images[i], direct, trace, ram);
+                    // Requests per system call.
+                    char batch[16] = "-";
+                    if (ring) {
+                        const AioRingStats* stats = ring->stats();
+                        snprintf(batch, sizeof(batch), "%.1f",
+                                 (double)stats->requests / stats->submits);
+                        if (e == 2) {
+                            EXPECT_EQ(stats->requests, stats->fixed);
+                        }
+                    }
+                    printf("%-6s %-4s %-8s %-16s %8.0f %8.1f %8lld %8lld "
+                           "%8lld %6s\n", images[i].name.c_str(),
+                           random ? "rand" : "seq",
+                           direct ? "none" : "default", engine->name(),
+                           r.iops, r.mbps, (long long)r.p50,
+                           (long long)r.p90, (long long)r.p99, batch);
+                    delete engine;
+                }
+            }
+        }
+    }
+    free(ramAlloc);
+    unlink(images[0].path.c_str());
+    unlink(images[1].path.c_str());
+}
@@ -0,0 +1,292 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/aio_ring.h"
+
+#include "android/filesystems/testing/TestSupport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+struct Result {
+    int64_t ret;
+    bool done;
+};
+
+void onDone(void* opaque, int64_t ret) {
+    Result* result = static_cast<Result*>(opaque);
+    result->ret = ret;
+    result->done = true;
+}
+
+bool isReadable(int fd) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, 1000) == 1;
+}
+
+// Reap the requests of |ring| until none are in flight.
+void reapAll(AioRing* ring) {
+    while (aioRing_inFlight(ring) || aioRing_queued(ring)) {
+        ASSERT_TRUE(isReadable(aioRing_eventFd(ring)));
+        aioRing_reap(ring, false);
+    }
+}
+
+class AioRingTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mPath = android::testing::CreateTempFilePath();
+        mFd = open(mPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        ASSERT_GE(mFd, 0);
+    }
+
+    virtual void TearDown() {
+        close(mFd);
+        unlink(mPath.c_str());
+    }
+
+    // Return the kinds of rings that the kernel supports.
+    std::vector<AioRingKind> kinds() {
+        std::vector<AioRingKind> result;
+        static const AioRingKind kKinds[] = {
+            AIO_RING_IO_URING, AIO_RING_LINUX_AIO,
+        };
+        for (size_t n = 0; n < sizeof(kKinds) / sizeof(kKinds[0]); ++n) {
+            AioRing* ring = aioRing_new(4, kKinds[n]);
+            if (ring) {
+                result.push_back(kKinds[n]);
+                aioRing_free(ring);
+            } else {
+                printf("Kind %d not supported by the kernel\n", kKinds[n]);
+            }
+        }
+        return result;
+    }
+
+    std::string mPath;
+    int mFd;
+};
+
+}  // namespace
+
+TEST_F(AioRingTest, AnyKind) {
+    AioRing* ring = aioRing_new(8, AIO_RING_ANY);
+    if (!ring) {
+        printf("No native AIO, skipping\n");
+        return;
+    }
+    EXPECT_NE(AIO_RING_ANY, aioRing_kind(ring));
+    EXPECT_GE(aioRing_eventFd(ring), 0);
+    aioRing_free(ring);
+}
+
+TEST_F(AioRingTest, BatchedWritesAndReads) {
+    const int kCount = 16;
+    const size_t kSize = 4096;
+    std::vector<AioRingKind> kinds = this->kinds();
+
+    for (size_t k = 0; k < kinds.size(); ++k) {
+        SCOPED_TRACE(kinds[k]);
+        AioRing* ring = aioRing_new(kCount, kinds[k]);
+        ASSERT_TRUE(ring);
+
+        std::vector<std::string> blocks;
+        std::vector<struct iovec> iovs(kCount);
+        Result results[kCount];
+        for (int n = 0; n < kCount; ++n) {
+            blocks.push_back(std::string(kSize, (char)('a' + n)));
+        }
+        for (int n = 0; n < kCount; ++n) {
+            iovs[n].iov_base = &blocks[n][0];
+            iovs[n].iov_len = kSize;
+            results[n].done = false;
+            // Written backwards, to make sure offsets are used.
+            EXPECT_TRUE(aioRing_queue(ring, AIO_RING_WRITE, mFd,
+                                      (kCount - 1 - n) * kSize, &iovs[n], 1,
+                                      onDone, &results[n]));
+        }
+        EXPECT_EQ((unsigned)kCount, aioRing_queued(ring));
+        EXPECT_EQ(kCount, aioRing_submit(ring));
+        EXPECT_EQ(0U, aioRing_queued(ring));
+        reapAll(ring);
+        for (int n = 0; n < kCount; ++n) {
+            EXPECT_TRUE(results[n].done);
+            EXPECT_EQ((int64_t)kSize, results[n].ret);
+        }
+
+        // Read back two blocks per request, each in two halves.
+        std::string data(kCount * kSize, 0);
+        std::vector<struct iovec> halves(kCount * 4);
+        for (int n = 0; n < kCount / 2; ++n) {
+            for (int h = 0; h < 4; ++h) {
+                halves[n * 4 + h].iov_base = &data[(n * 4 + h) * kSize / 2];
+                halves[n * 4 + h].iov_len = kSize / 2;
+            }
+            results[n].done = false;
+            EXPECT_TRUE(aioRing_queue(ring, AIO_RING_READ, mFd,
+                                      n * 2 * kSize, &halves[n * 4], 4,
+                                      onDone, &results[n]));
+        }
+        EXPECT_EQ(kCount / 2, aioRing_submit(ring));
+        reapAll(ring);
+        for (int n = 0; n < kCount / 2; ++n) {
+            EXPECT_TRUE(results[n].done);
+            EXPECT_EQ((int64_t)kSize * 2, results[n].ret);
+        }
+        for (int n = 0; n < kCount; ++n) {
+            EXPECT_EQ(blocks[kCount - 1 - n], data.substr(n * kSize, kSize));
+        }
+
+        const AioRingStats* stats = aioRing_stats(ring);
+        EXPECT_EQ((uint64_t)kCount * 3 / 2, stats->requests);
+        EXPECT_EQ(2U, stats->submits);
+        EXPECT_EQ((uint32_t)kCount, stats->max_batch);
+        EXPECT_EQ((uint64_t)kCount * 3 / 2, stats->completions);
+        aioRing_free(ring);
+    }
+}
+
+TEST_F(AioRingTest, ShortReadAtEndOfFile) {
+    std::string contents(6000, 'x');
+    ASSERT_EQ((ssize_t)contents.size(),
+              write(mFd, contents.data(), contents.size()));
+    std::vector<AioRingKind> kinds = this->kinds();
+
+    for (size_t k = 0; k < kinds.size(); ++k) {
+        SCOPED_TRACE(kinds[k]);
+        AioRing* ring = aioRing_new(4, kinds[k]);
+        std::string data(8192, 0);
+        struct iovec iov = { &data[0], data.size() };
+        Result result = { 0, false };
+
+        EXPECT_TRUE(aioRing_queue(ring, AIO_RING_READ, mFd, 0, &iov, 1,
+                                  onDone, &result));
+        EXPECT_EQ(1, aioRing_submit(ring));
+        reapAll(ring);
+        EXPECT_TRUE(result.done);
+        EXPECT_EQ(6000, result.ret);
+        EXPECT_EQ(contents, data.substr(0, 6000));
+        aioRing_free(ring);
+    }
+}
+
+TEST_F(AioRingTest, Full) {
+    std::vector<AioRingKind> kinds = this->kinds();
+
+    for (size_t k = 0; k < kinds.size(); ++k) {
+        SCOPED_TRACE(kinds[k]);
+        AioRing* ring = aioRing_new(4, kinds[k]);
+        char buffer[512];
+        struct iovec iov = { buffer, sizeof(buffer) };
+        Result results[5];
+
+        for (int n = 0; n < 4; ++n) {
+            EXPECT_TRUE(aioRing_queue(ring, AIO_RING_READ, mFd, 0, &iov, 1,
+                                      onDone, &results[n]));
+        }
+        EXPECT_FALSE(aioRing_queue(ring, AIO_RING_READ, mFd, 0, &iov, 1,
+                                   onDone, &results[4]));
+        EXPECT_EQ(4, aioRing_submit(ring));
+        EXPECT_FALSE(aioRing_queue(ring, AIO_RING_READ, mFd, 0, &iov, 1,
+                                   onDone, &results[4]));
+        // A request can be queued again once one completes.
+        while (aioRing_reap(ring, true) == 0) {
+        }
+        EXPECT_TRUE(aioRing_queue(ring, AIO_RING_READ, mFd, 0, &iov, 1,
+                                  onDone, &results[4]));
+        aioRing_free(ring);
+    }
+}
+
+TEST_F(AioRingTest, BadFileDescriptor) {
+    std::vector<AioRingKind> kinds = this->kinds();
+
+    for (size_t k = 0; k < kinds.size(); ++k) {
+        SCOPED_TRACE(kinds[k]);
+        AioRing* ring = aioRing_new(4, kinds[k]);
+        char buffer[512];
+        struct iovec iov = { buffer, sizeof(buffer) };
+        Result bad = { 0, false };
+        Result good = { 0, false };
+
+        // The good request must still go after the bad one.
+        EXPECT_TRUE(aioRing_queue(ring, AIO_RING_WRITE, 1000, 0, &iov, 1,
+                                  onDone, &bad));
+        EXPECT_TRUE(aioRing_queue(ring, AIO_RING_WRITE, mFd, 0, &iov, 1,
+                                  onDone, &good));
+        aioRing_submit(ring);
+        reapAll(ring);
+        EXPECT_TRUE(bad.done);
+        EXPECT_EQ(-EBADF, bad.ret);
+        EXPECT_TRUE(good.done);
+        EXPECT_EQ(512, good.ret);
+        aioRing_free(ring);
+    }
+}
+
+TEST_F(AioRingTest, RegisteredBuffers) {
+    AioRing* ring = aioRing_new(4, AIO_RING_IO_URING);
+    if (!ring) {
+        printf("No io_uring, skipping\n");
+        return;
+    }
+    std::vector<char> region(65536, 'r');
+    struct iovec whole = { &region[0], region.size() };
+    int ret = aioRing_registerBuffers(ring, &whole, 1);
+    if (ret == -ENOMEM || ret == -EPERM) {
+        printf("Can't lock buffers, skipping\n");
+        aioRing_free(ring);
+        return;
+    }
+    ASSERT_EQ(0, ret);
+
+    // Inside the region, then across its end.
+    struct iovec inside = { &region[4096], 8192 };
+    std::vector<char> other(4096, 'o');
+    struct iovec outside = { &other[0], other.size() };
+    Result results[3] = { { 0, false }, { 0, false }, { 0, false } };
+    EXPECT_TRUE(aioRing_queue(ring, AIO_RING_WRITE, mFd, 0, &inside, 1,
+                              onDone, &results[0]));
+    EXPECT_TRUE(aioRing_queue(ring, AIO_RING_WRITE, mFd, 8192, &outside, 1,
+                              onDone, &results[1]));
+    EXPECT_TRUE(aioRing_queue(ring, AIO_RING_FDSYNC, mFd, 0, NULL, 0,
+                              onDone, &results[2]));
+    EXPECT_EQ(3, aioRing_submit(ring));
+    reapAll(ring);
+    EXPECT_EQ(8192, results[0].ret);
+    EXPECT_EQ(4096, results[1].ret);
+    EXPECT_EQ(0, results[2].ret);
+    EXPECT_EQ(1U, aioRing_stats(ring)->fixed);
+
+    char check[12288];
+    ASSERT_EQ((ssize_t)sizeof(check), pread(mFd, check, sizeof(check), 0));
+    EXPECT_EQ(std::string(8192, 'r'), std::string(check, 8192));
+    EXPECT_EQ(std::string(4096, 'o'), std::string(check + 8192, 4096));
+
+    // Linux AIO has no registered buffers.
+    AioRing* aio = aioRing_new(4, AIO_RING_LINUX_AIO);
+    if (aio) {
+        EXPECT_EQ(-ENOTSUP, aioRing_registerBuffers(aio, &whole, 1));
+        aioRing_free(aio);
+    }
+    EXPECT_EQ(0, aioRing_registerBuffers(ring, NULL, 0));
+    aioRing_free(ring);
+}
@@ -0,0 +1,196 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/char_queue.h"
+
+#include <stddef.h>
+
+// Most writes are passed through, the buffer is only allocated on the
+// first one that the reader refuses, and grows up to a size that no
+// reader should ever lag behind.
+#define CHAR_QUEUE_MIN_SIZE  4096
+#define CHAR_QUEUE_MAX_SIZE  (16 << 20)
+
+void charQueueSet_init(CharQueueSet* set, void (*notify)(void* opaque),
+                       void* notify_opaque) {
+    set->pending = NULL;
+    set->num_pending = 0;
+    set->notify = notify;
+    set->notify_opaque = notify_opaque;
+}
+
+// Insert |queue| at the head of the list |*head|.
+static void charQueue_link(CharQueue* queue, CharQueue** head) {
+    queue->next = *head;
+    if (queue->next) {
+        queue->next->pprev = &queue->next;
+    }
+    queue->pprev = head;
+    *head = queue;
+}
+
+static void charQueue_addPending(CharQueue* queue) {
+    CharQueueSet* set = queue->set;
+
+    if (queue->pprev) {
+        return;
+    }
+    charQueue_link(queue, &set->pending);
+    set->num_pending++;
+    if (set->notify) {
+        set->notify(set->notify_opaque);
+    }
+}
+
+static void charQueue_removePending(CharQueue* queue) {
+    if (!queue->pprev) {
+        return;
+    }
+    *queue->pprev = queue->next;
+    if (queue->next) {
+        queue->next->pprev = queue->pprev;
+    }
+    queue->next = NULL;
+    queue->pprev = NULL;
+    queue->set->num_pending--;
+}
+
+int charQueueSet_poll(CharQueueSet* set) {
+    // A reader can close any queue, or write to others, which are then
+    // added to |set|. So the pending queues are moved to |todo| first,
+    // where charQueue_done() unlinks them as well, and each one goes back
+    // to |set| before it is flushed.
+    CharQueue* todo = set->pending;
+
+    if (todo) {
+        todo->pprev = &todo;
+    }
+    set->pending = NULL;
+    while (todo) {
+        CharQueue* queue = todo;
+
+        todo = queue->next;
+        if (todo) {
+            todo->pprev = &todo;
+        }
+        charQueue_link(queue, &set->pending);
+        charQueue_flush(queue);
+    }
+    return set->num_pending;
+}
+
+void charQueue_init(CharQueue* queue, CharQueueSet* set,
+                    CharQueueSendFunc send, void* opaque) {
+    ringBuffer_init(&queue->ring, CHAR_QUEUE_MIN_SIZE, CHAR_QUEUE_MAX_SIZE);
+    queue->send = send;
+    queue->opaque = opaque;
+    queue->set = set;
+    queue->next = NULL;
+    queue->pprev = NULL;
+    queue->bytes = 0;
+    queue->stalls = 0;
+    queue->closed = NULL;
+}
+
+void charQueue_done(CharQueue* queue) {
+    if (queue->closed) {
+        *queue->closed = true;
+        queue->closed = NULL;
+    }
+    charQueue_removePending(queue);
+    ringBuffer_done(&queue->ring);
+}
+
+// Pass |len| bytes of |data| to the reader until it refuses them. Return
+// the number of bytes it accepted, or -1 if the reader closed |queue|,
+// which may be freed by now.
+static int charQueue_send(CharQueue* queue, const uint8_t* data, int len) {
+    // The reader can also write to |queue|, which sends again.
+    bool* outer = queue->closed;
+    bool closed = false;
+    int ret = 0;
+
+    queue->closed = &closed;
+    while (ret < len) {
+        int size = queue->send(queue->opaque, data + ret, len - ret);
+        if (closed) {
+            if (outer) {
+                *outer = true;
+            }
+            return -1;
+        }
+        if (size <= 0) {
+            break;
+        }
+        if (size > len - ret) {
+            size = len - ret;
+        }
+        ret += size;
+    }
+    queue->closed = outer;
+    queue->bytes += ret;
+    return ret;
+}
+
+int charQueue_write(CharQueue* queue, const uint8_t* data, int len) {
+    int ret = 0;
+
+    if (len <= 0) {
+        return 0;
+    }
+    if (charQueue_count(queue) == 0) {
+        ret = charQueue_send(queue, data, len);
+        if (ret < 0) {
+            // Nobody will read the rest.
+            return len;
+        }
+        if (ret == len) {
+            return ret;
+        }
+        queue->stalls++;
+    }
+    ret += ringBuffer_write(&queue->ring, data + ret, len - ret);
+    if (charQueue_count(queue) > 0) {
+        charQueue_addPending(queue);
+    }
+    return ret;
+}
+
+uint32_t charQueue_flush(CharQueue* queue) {
+    for (;;) {
+        const uint8_t* data;
+        uint32_t avail = ringBuffer_peek(&queue->ring, &data);
+        int size;
+
+        if (avail == 0) {
+            break;
+        }
+        size = charQueue_send(queue, data, avail);
+        if (size < 0) {
+            return 0;
+        }
+        ringBuffer_consume(&queue->ring, size);
+        if ((uint32_t)size < avail) {
+            break;
+        }
+    }
+    if (charQueue_count(queue) == 0) {
+        charQueue_removePending(queue);
+    }
+    return charQueue_count(queue);
+}
+
+void charQueue_getStats(const CharQueue* queue, CharQueueStats* stats) {
+    stats->bytes = queue->bytes;
+    stats->stalls = queue->stalls;
+    stats->high_water = queue->ring.high_water;
+    stats->pending = charQueue_count(queue);
+}
@@ -0,0 +1,103 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_CHAR_QUEUE_H
+#define ANDROID_UTILS_CHAR_QUEUE_H
+
+#include "android/utils/compiler.h"
+#include "android/utils/ring_buffer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+// A byte stream towards a reader that may not accept everything at once,
+// e.g. one direction of a charpipe.
+//
+// While nothing is buffered, data written to a CharQueue is passed
+// straight to the reader through its send callback. Whatever the reader
+// refuses is kept in a RingBuffer, and the queue is put on the pending
+// list of its CharQueueSet, whose notify callback is called so that the
+// owner can schedule a flush. Polling a set only visits its pending
+// queues: idle queues cost nothing.
+
+// Pass up to |len| bytes of |data| to the reader. Return the number of
+// bytes it accepted, 0 if it can't take any for now.
+typedef int (*CharQueueSendFunc)(void* opaque, const uint8_t* data, int len);
+
+typedef struct {
+    uint64_t  bytes;        // Bytes accepted by the reader.
+    uint64_t  stalls;       // Times the reader refused data, which was
+                            // then buffered.
+    uint32_t  high_water;   // Largest number of bytes ever buffered.
+    uint32_t  pending;      // Bytes currently buffered.
+} CharQueueStats;
+
+typedef struct CharQueue CharQueue;
+
+typedef struct {
+    CharQueue*  pending;        // Queues with buffered data.
+    int         num_pending;
+    void      (*notify)(void* opaque);
+    void*       notify_opaque;
+} CharQueueSet;
+
+struct CharQueue {
+    RingBuffer         ring;
+    CharQueueSendFunc  send;
+    void*              opaque;
+    CharQueueSet*      set;
+    CharQueue*         next;    // Next pending queue in |set|.
+    CharQueue**        pprev;   // NULL if not pending.
+    uint64_t           bytes;
+    uint64_t           stalls;
+    bool*              closed;  // Set by charQueue_done() during a send.
+};
+
+// Initialize |set|. |notify| is called with |notify_opaque| each time one
+// of its queues goes from empty to pending. It can be NULL.
+void charQueueSet_init(CharQueueSet* set, void (*notify)(void* opaque),
+                       void* notify_opaque);
+
+// Try to flush all pending queues of |set|. Return the number of queues
+// that are still pending.
+int charQueueSet_poll(CharQueueSet* set);
+
+// Initialize |queue| as a member of |set|, sending its data with |send|.
+void charQueue_init(CharQueue* queue, CharQueueSet* set,
+                    CharQueueSendFunc send, void* opaque);
+
+// Drop the buffered data of |queue| and release its memory. It can be
+// used again afterwards. The reader can call it while data is passed to
+// it, the write or flush in progress then leaves |queue| alone.
+void charQueue_done(CharQueue* queue);
+
+// Send |len| bytes of |data| to the reader of |queue|, buffering what it
+// does not accept. Return the number of bytes taken, which is less than
+// |len| only if the buffer reached its maximum size.
+int charQueue_write(CharQueue* queue, const uint8_t* data, int len);
+
+// Pass as much buffered data of |queue| as possible to its reader. Return
+// the number of bytes left in the buffer.
+uint32_t charQueue_flush(CharQueue* queue);
+
+// Number of bytes buffered in |queue|.
+static inline uint32_t charQueue_count(const CharQueue* queue) {
+    return ringBuffer_count(&queue->ring);
+}
+
+// Fill |stats| with the counters of |queue|.
+void charQueue_getStats(const CharQueue* queue, CharQueueStats* stats);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_CHAR_QUEUE_H
@@ -0,0 +1,261 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// Measures the CharQueue core of the charpipes, with 1, 10 and 100 pipes
+// between pairs of endpoints. Each main loop iteration is modelled by a
+// charQueueSet_poll() after which every reader can take a limited number
+// of bytes again, like a guest draining its serial port. Run with
+// emulator_benchmarks.
+
+#include "android/utils/char_queue.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const int kMessageSize = 64;
+const int kChunkSize = 4096;
+const int kBurstSize = 64 * 1024;
+const uint64_t kTotalBytes = 256 << 20;
+const int kRoundTrips = 2000000;
+const int kIdlePolls = 10000000;
+
+double elapsedSecs(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// One end of a pipe. |out| holds what it writes, for the peer to read.
+struct Endpoint {
+    CharQueue out;
+    Endpoint* peer;
+    int budget;          // Bytes it can still read in this iteration.
+    uint64_t received;
+    int partial;         // Bytes of the current message received so far.
+    bool echo;           // Send each message back once received.
+    int roundTrips;
+
+    // CharQueue callback, pass data written by |opaque| to its peer.
+    static int send(void* opaque, const uint8_t* data, int len) {
+        Endpoint* reader = static_cast<Endpoint*>(opaque)->peer;
+        if (len > reader->budget) {
+            len = reader->budget;
+        }
+        reader->budget -= len;
+        reader->received += len;
+        reader->partial += len;
+        while (reader->partial >= kMessageSize) {
+            reader->partial -= kMessageSize;
+            if (reader->echo) {
+                // Reply from the read handler, as the modem does.
+                charQueue_write(&reader->out, data, kMessageSize);
+            } else {
+                reader->roundTrips++;
+            }
+        }
+        return len;
+    }
+};
+
+struct Pipe {
+    Endpoint a;
+    Endpoint b;
+};
+
+class Pipes {
+public:
+    // |budget| is the number of bytes each reader takes per iteration.
+    Pipes(int count, int budget)
+            : mCount(count), mBudget(budget), mPipes(new Pipe[count]) {
+        charQueueSet_init(&mSet, NULL, NULL);
+        for (int n = 0; n < count; ++n) {
+            Pipe* pipe = &mPipes[n];
+            memset(pipe, 0, sizeof(*pipe));
+            pipe->a.peer = &pipe->b;
+            pipe->b.peer = &pipe->a;
+            charQueue_init(&pipe->a.out, &mSet, Endpoint::send, &pipe->a);
+            charQueue_init(&pipe->b.out, &mSet, Endpoint::send, &pipe->b);
+        }
+        refill();
+    }
+
+    ~Pipes() {
+        for (int n = 0; n < mCount; ++n) {
+            charQueue_done(&mPipes[n].a.out);
+            charQueue_done(&mPipes[n].b.out);
+        }
+        delete [] mPipes;
+    }
+
+    int count() const { return mCount; }
+    Pipe* pipe(int n) { return &mPipes[n]; }
+
+    // One main loop iteration.
+    void iterate() {
+        poll();
+        refill();
+    }
+
+    void poll() { charQueueSet_poll(&mSet); }
+
+    int numPending() const { return mSet.num_pending; }
+
+    // Flush every queue, as charpipe_poll() used to.
+    void walkAll() {
+        for (int n = 0; n < mCount; ++n) {
+            charQueue_flush(&mPipes[n].a.out);
+            charQueue_flush(&mPipes[n].b.out);
+        }
+    }
+
+    void getStats(CharQueueStats* total) {
+        memset(total, 0, sizeof(*total));
+        for (int n = 0; n < 2 * mCount; ++n) {
+            CharQueueStats stats;
+            Pipe* pipe = &mPipes[n / 2];
+            charQueue_getStats((n & 1) ? &pipe->b.out : &pipe->a.out, &stats);
+            total->bytes += stats.bytes;
+            total->stalls += stats.stalls;
+            if (stats.high_water > total->high_water) {
+                total->high_water = stats.high_water;
+            }
+        }
+    }
+
+private:
+    void refill() {
+        for (int n = 0; n < mCount; ++n) {
+            mPipes[n].a.budget = mBudget;
+            mPipes[n].b.budget = mBudget;
+        }
+    }
+
+    int mCount;
+    int mBudget;
+    Pipe* mPipes;
+    CharQueueSet mSet;
+};
+
+// Messages sent by each 'a' end and echoed by the 'b' end, one at a time.
+// With a budget smaller than a message, they are buffered on both ways.
+void measureLatency(int count, int budget) {
+    Pipes pipes(count, budget);
+    uint8_t message[kMessageSize];
+    memset(message, 'x', sizeof(message));
+
+    for (int n = 0; n < count; ++n) {
+        pipes.pipe(n)->b.echo = true;
+    }
+    const int perPipe = kRoundTrips / count;
+    int iterations = 0;
+    clock_t start = clock();
+    for (int trip = 0; trip < perPipe; ++trip) {
+        for (int n = 0; n < count; ++n) {
+            Endpoint* a = &pipes.pipe(n)->a;
+            charQueue_write(&a->out, message, kMessageSize);
+        }
+        do {
+            pipes.iterate();
+            iterations++;
+        } while (pipes.numPending() > 0);
+    }
+    double secs = elapsedSecs(start);
+    for (int n = 0; n < count; ++n) {
+        ASSERT_EQ(perPipe, pipes.pipe(n)->a.roundTrips);
+    }
+    printf("%3d pipes, %4d bytes per read: %d-byte round trip %6.0f ns, "
+           "%.1f iterations\n",
+           count, budget, kMessageSize, secs * 1e9 / (perPipe * count),
+           (double)iterations / perPipe);
+}
+
+// Bursts written faster than the readers take them, which then catch up
+// before the next burst.
+void measureThroughput(int count) {
+    Pipes pipes(count, kChunkSize);
+    static uint8_t burst[kBurstSize];
+    const uint64_t perPipe = kTotalBytes / count;
+    uint64_t written = 0;
+    int iterations = 0;
+
+    clock_t start = clock();
+    while (written < perPipe) {
+        if (iterations % (kBurstSize / kChunkSize) == 0) {
+            for (int n = 0; n < count; ++n) {
+                Endpoint* a = &pipes.pipe(n)->a;
+                ASSERT_EQ(kBurstSize,
+                          charQueue_write(&a->out, burst, kBurstSize));
+            }
+            written += kBurstSize;
+        }
+        pipes.iterate();
+        iterations++;
+    }
+    while (pipes.numPending() > 0) {
+        pipes.iterate();
+        iterations++;
+    }
+    double secs = elapsedSecs(start);
+
+    CharQueueStats stats;
+    pipes.getStats(&stats);
+    ASSERT_EQ(written * count, stats.bytes);
+    printf("%3d pipes: %7.1f MB/s, %d iterations, %llu stalls, "
+           "max %u bytes buffered\n",
+           count, stats.bytes / secs / (1 << 20), iterations,
+           (unsigned long long)stats.stalls, stats.high_water);
+}
+
+// Main loop iterations with nothing to send.
+void measureIdle(int count) {
+    Pipes pipes(count, kChunkSize);
+
+    clock_t start = clock();
+    for (int n = 0; n < kIdlePolls; ++n) {
+        pipes.poll();
+    }
+    double pending = elapsedSecs(start) * 1e9 / kIdlePolls;
+
+    start = clock();
+    for (int n = 0; n < kIdlePolls / count; ++n) {
+        pipes.walkAll();
+    }
+    double all = elapsedSecs(start) * 1e9 / (kIdlePolls / count);
+
+    printf("%3d pipes: idle poll %6.1f ns, walking all halves %8.1f ns\n",
+           count, pending, all);
+}
+
+}  // namespace
+
+TEST(CharQueueBenchmark, Latency) {
+    measureLatency(1, 4096);
+    measureLatency(10, 4096);
+    measureLatency(100, 4096);
+    measureLatency(1, 16);
+    measureLatency(10, 16);
+    measureLatency(100, 16);
+}
+
+TEST(CharQueueBenchmark, Throughput) {
+    measureThroughput(1);
+    measureThroughput(10);
+    measureThroughput(100);
+}
+
+TEST(CharQueueBenchmark, Idle) {
+    measureIdle(1);
+    measureIdle(10);
+    measureIdle(100);
+}
@@ -0,0 +1,280 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/char_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+namespace {
+
+// A reader that accepts up to |budget| bytes, then refuses everything
+// until the budget is raised again.
+struct Reader {
+    Reader() : budget(1 << 30), calls(0) {}
+
+    static int send(void* opaque, const uint8_t* data, int len) {
+        Reader* reader = static_cast<Reader*>(opaque);
+        reader->calls++;
+        if (len > reader->budget) {
+            len = reader->budget;
+        }
+        reader->budget -= len;
+        reader->received.append(reinterpret_cast<const char*>(data), len);
+        return len;
+    }
+
+    int budget;
+    int calls;
+    std::string received;
+};
+
+void countNotify(void* opaque) {
+    (*static_cast<int*>(opaque))++;
+}
+
+int writeString(CharQueue* queue, const char* str) {
+    return charQueue_write(queue, reinterpret_cast<const uint8_t*>(str),
+                           strlen(str));
+}
+
+}  // namespace
+
+TEST(CharQueue, PassThrough) {
+    CharQueueSet set;
+    int notified = 0;
+    charQueueSet_init(&set, countNotify, &notified);
+    Reader reader;
+    CharQueue queue;
+    charQueue_init(&queue, &set, Reader::send, &reader);
+
+    EXPECT_EQ(5, writeString(&queue, "hello"));
+    EXPECT_EQ("hello", reader.received);
+    EXPECT_EQ(0U, charQueue_count(&queue));
+    EXPECT_EQ(0, notified);
+    EXPECT_TRUE(set.pending == NULL);
+    // Nothing was buffered, so no memory either.
+    EXPECT_TRUE(queue.ring.data == NULL);
+
+    CharQueueStats stats;
+    charQueue_getStats(&queue, &stats);
+    EXPECT_EQ(5U, stats.bytes);
+    EXPECT_EQ(0U, stats.stalls);
+    EXPECT_EQ(0U, stats.high_water);
+    charQueue_done(&queue);
+}
+
+TEST(CharQueue, BufferWhenFull) {
+    CharQueueSet set;
+    int notified = 0;
+    charQueueSet_init(&set, countNotify, &notified);
+    Reader reader;
+    reader.budget = 3;
+    CharQueue queue;
+    charQueue_init(&queue, &set, Reader::send, &reader);
+
+    EXPECT_EQ(5, writeString(&queue, "hello"));
+    EXPECT_EQ("hel", reader.received);
+    EXPECT_EQ(2U, charQueue_count(&queue));
+    EXPECT_EQ(1, notified);
+    EXPECT_EQ(&queue, set.pending);
+    EXPECT_EQ(1, set.num_pending);
+
+    // Buffered data goes first, even if the reader can accept more.
+    reader.budget = 100;
+    EXPECT_EQ(6, writeString(&queue, " world"));
+    EXPECT_EQ("hel", reader.received);
+    EXPECT_EQ(1, notified);
+
+    EXPECT_EQ(0, charQueueSet_poll(&set));
+    EXPECT_EQ("hello world", reader.received);
+    EXPECT_TRUE(set.pending == NULL);
+
+    CharQueueStats stats;
+    charQueue_getStats(&queue, &stats);
+    EXPECT_EQ(11U, stats.bytes);
+    EXPECT_EQ(1U, stats.stalls);
+    EXPECT_EQ(8U, stats.high_water);
+    EXPECT_EQ(0U, stats.pending);
+    charQueue_done(&queue);
+}
+
+TEST(CharQueue, PollOnlyPending) {
+    const int kCount = 4;
+    CharQueueSet set;
+    charQueueSet_init(&set, NULL, NULL);
+    Reader readers[kCount];
+    CharQueue queues[kCount];
+    for (int n = 0; n < kCount; ++n) {
+        readers[n].budget = 0;
+        charQueue_init(&queues[n], &set, Reader::send, &readers[n]);
+    }
+    writeString(&queues[1], "one");
+    writeString(&queues[3], "three");
+    EXPECT_EQ(2, set.num_pending);
+
+    for (int n = 0; n < kCount; ++n) {
+        readers[n].calls = 0;
+    }
+    // Still full: only the pending queues are asked.
+    EXPECT_EQ(2, charQueueSet_poll(&set));
+    EXPECT_EQ(0, readers[0].calls);
+    EXPECT_EQ(1, readers[1].calls);
+    EXPECT_EQ(0, readers[2].calls);
+    EXPECT_EQ(1, readers[3].calls);
+
+    readers[3].budget = 100;
+    EXPECT_EQ(1, charQueueSet_poll(&set));
+    EXPECT_EQ("three", readers[3].received);
+    EXPECT_EQ(&queues[1], set.pending);
+
+    // Dropping a pending queue removes it from the set.
+    charQueue_done(&queues[1]);
+    EXPECT_EQ(0, set.num_pending);
+    EXPECT_EQ(0U, charQueue_count(&queues[1]));
+    for (int n = 0; n < kCount; ++n) {
+        charQueue_done(&queues[n]);
+    }
+}
+
+namespace {
+
+// A reader that accepts everything, then makes |queue| pending in |set|
+// from scratch, as when a charpipe half closes its peer and the memory
+// gets reused.
+struct ReusingReader {
+    static int send(void* opaque, const uint8_t* data, int len) {
+        ReusingReader* reader = static_cast<ReusingReader*>(opaque);
+        charQueue_done(reader->queue);
+        charQueue_init(reader->queue, reader->set, Reader::send,
+                       reader->reader);
+        writeString(reader->queue, "reused");
+        return len;
+    }
+
+    CharQueue* queue;
+    CharQueueSet* set;
+    Reader* reader;
+};
+
+}  // namespace
+
+TEST(CharQueue, PollWhileReaderClosesQueue) {
+    CharQueueSet set;
+    charQueueSet_init(&set, NULL, NULL);
+    CharQueueSet other_set;
+    charQueueSet_init(&other_set, NULL, NULL);
+
+    Reader reader;
+    reader.budget = 0;
+    CharQueue queue;
+    charQueue_init(&queue, &set, Reader::send, &reader);
+    writeString(&queue, "first");
+
+    // Pending queues are added at the head, so this one is flushed first.
+    ReusingReader reusing = { &queue, &other_set, &reader };
+    Reader closing;
+    closing.budget = 0;
+    CharQueue closing_queue;
+    charQueue_init(&closing_queue, &set, Reader::send, &closing);
+    writeString(&closing_queue, "second");
+    EXPECT_EQ(2, set.num_pending);
+    closing_queue.send = ReusingReader::send;
+    closing_queue.opaque = &reusing;
+
+    reader.calls = 0;
+    EXPECT_EQ(0, charQueueSet_poll(&set));
+    EXPECT_TRUE(set.pending == NULL);
+    // |queue| now belongs to |other_set|, the poll must not flush it.
+    EXPECT_EQ(1, reader.calls);
+    EXPECT_EQ(&queue, other_set.pending);
+    EXPECT_EQ(1, other_set.num_pending);
+
+    charQueue_done(&queue);
+    charQueue_done(&closing_queue);
+}
+
+namespace {
+
+// A reader that takes a few bytes, then closes its queue, as when the
+// user of a charpipe half closes it from its read handler.
+struct ClosingReader {
+    static int send(void* opaque, const uint8_t* data, int len) {
+        ClosingReader* reader = static_cast<ClosingReader*>(opaque);
+        if (reader->budget == 0) {
+            return 0;
+        }
+        charQueue_done(reader->queue);
+        return len < 2 ? len : 2;
+    }
+
+    CharQueue* queue;
+    int budget;
+};
+
+}  // namespace
+
+TEST(CharQueue, ReaderClosesQueue) {
+    CharQueueSet set;
+    charQueueSet_init(&set, NULL, NULL);
+    CharQueue queue;
+    ClosingReader reader = { &queue, 0 };
+    charQueue_init(&queue, &set, ClosingReader::send, &reader);
+
+    // Closed while flushing: nothing is consumed from the released buffer.
+    EXPECT_EQ(5, writeString(&queue, "hello"));
+    EXPECT_EQ(5U, charQueue_count(&queue));
+    reader.budget = 1;
+    EXPECT_EQ(0U, charQueue_flush(&queue));
+    EXPECT_EQ(0U, charQueue_count(&queue));
+    EXPECT_TRUE(queue.ring.data == NULL);
+    EXPECT_TRUE(set.pending == NULL);
+    EXPECT_EQ(0, set.num_pending);
+
+    // Closed while writing: the rest is dropped, not buffered.
+    charQueue_init(&queue, &set, ClosingReader::send, &reader);
+    EXPECT_EQ(5, writeString(&queue, "hello"));
+    EXPECT_EQ(0U, charQueue_count(&queue));
+    EXPECT_TRUE(queue.ring.data == NULL);
+    EXPECT_TRUE(set.pending == NULL);
+    charQueue_done(&queue);
+}
+
+TEST(CharQueue, LargeBacklog) {
+    CharQueueSet set;
+    charQueueSet_init(&set, NULL, NULL);
+    Reader reader;
+    reader.budget = 0;
+    CharQueue queue;
+    charQueue_init(&queue, &set, Reader::send, &reader);
+
+    std::string expected;
+    for (int n = 0; n < 10000; ++n) {
+        char line[32];
+        snprintf(line, sizeof(line), "line %d\n", n);
+        expected += line;
+        ASSERT_EQ((int)strlen(line), writeString(&queue, line));
+        // Drain a little from time to time.
+        if (n % 100 == 0) {
+            reader.budget = 17;
+            charQueue_flush(&queue);
+        }
+    }
+    reader.budget = 1 << 30;
+    EXPECT_EQ(0U, charQueue_flush(&queue));
+    EXPECT_EQ(expected, reader.received);
+    EXPECT_GT(queue.ring.capacity, 4096U);
+    charQueue_done(&queue);
+}
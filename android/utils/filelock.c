@@ -389,6 +389,43 @@ filelock_atexit( void )
      filelock_release( lock );
 }
 
+void
+filelock_release_all( void )
+{
+    filelock_atexit();
+}
+
+void
+filelock_transfer_all( int  pid )
+{
+    FileLock*  lock;
+    char       buf[16];
+
+    snprintf(buf, sizeof buf, "%d", pid);
+    for (lock = _all_filelocks; lock != NULL; lock = lock->next) {
+        int  fd;
+
+        if (!lock->locked)
+            continue;
+        /* the pid is stored in the lock file itself on Posix, and in
+         * the pid file within the lock directory on Windows */
+#ifdef _WIN32
+        fd = open( lock->temp, O_WRONLY | O_TRUNC );
+#else
+        fd = HANDLE_EINTR(open( lock->lock, O_WRONLY | O_TRUNC ));
+#endif
+        if (fd < 0) {
+            D( "could not transfer lock '%s': %s", lock->lock, strerror(errno) );
+            continue;
+        }
+        if (HANDLE_EINTR(write( fd, buf, strlen(buf) + 1 )) < 0) {
+            D( "could not write PID to '%s'", lock->lock );
+        }
+        IGNORE_EINTR(close(fd));
+        lock->locked = 0;
+    }
+}
+
 /* create a file lock */
 FileLock*
 filelock_create( const char*  file )
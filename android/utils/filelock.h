@@ -39,6 +39,15 @@ typedef struct FileLock  FileLock;
 extern FileLock*  filelock_create ( const char*  path );
 extern void       filelock_release( FileLock*  lock );
 
+/* release all file locks held by the current process */
+extern void       filelock_release_all( void );
+
+/* hand all file locks held by the current process over to process 'pid',
+ * usually a child that keeps using the locked files after the current
+ * process exits. they are no longer released when the current process
+ * exits, 'pid' should call filelock_release_all() when it is done. */
+extern void       filelock_transfer_all( int  pid );
+
 ANDROID_END_HEADER
 
 #endif /* _ANDROID_UTILS_FILELOCK_H */
@@ -0,0 +1,574 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/guest_profiler.h"
+
+#include "android/utils/debug.h"
+#include "android/utils/intmap.h"
+#include "android/utils/system.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of unique stacks above which samples are only attributed to
+// libraries, without file offsets, to bound memory usage.
+#define MAX_PRECISE_STACKS  (1 << 18)
+
+// Maximum length of a collapsed stack.
+#define MAX_STACK_LEN  512
+
+typedef struct {
+    uint64_t  start;
+    uint64_t  end;
+    uint64_t  offset;   // file offset of |start|.
+    char*     path;
+} GuestMapping;
+
+typedef struct {
+    int            tgid;
+    int            num_threads;
+    char*          name;
+    GuestMapping*  maps;        // sorted by |start|, non-overlapping.
+    int            num_maps;
+    int            max_maps;
+} GuestProcess;
+
+typedef struct {
+    int            tid;
+    char*          name;
+    GuestProcess*  process;
+} GuestThread;
+
+typedef struct {
+    char*     stack;      // NULL for free slots.
+    uint32_t  hash;
+    int64_t   weight_us;
+} GuestStack;
+
+typedef struct {
+    bool          enabled;
+    char*         path;
+    AIntMap*      processes;  // tgid -> GuestProcess*
+    AIntMap*      threads;    // tid -> GuestThread*
+    GuestThread*  current;
+    GuestStack*   stacks;     // open addressing hash table.
+    int           num_stacks;
+    int           max_stacks; // power of 2.
+} GuestProfiler;
+
+static GuestProfiler _profiler;
+
+static void guestProfiler_atExit(void) {
+    guestProfiler_finish();
+}
+
+void guestProfiler_init(const char* path) {
+    static bool registered;
+
+    if (_profiler.enabled || !path) {
+        return;
+    }
+    _profiler.path = ASTRDUP(path);
+    _profiler.enabled = true;
+    if (!registered) {
+        atexit(guestProfiler_atExit);
+        registered = true;
+    }
+}
+
+bool guestProfiler_isEnabled(void) {
+    return _profiler.enabled;
+}
+
+// Copy |name|, replacing the characters that have a meaning in the
+// collapsed stack format.
+static char* guestProfiler_copyName(const char* name, int len) {
+    char* copy;
+    int n;
+
+    if (len < 0) {
+        len = strlen(name);
+    }
+    copy = android_alloc(len + 1);
+    for (n = 0; n < len; n++) {
+        char c = name[n];
+        copy[n] = (c == ';' || c == '\n' || c == '\r') ? '_' : c;
+    }
+    copy[len] = '\0';
+    return copy;
+}
+
+static GuestProcess* guestProfiler_getProcess(int tgid) {
+    GuestProcess* process;
+
+    if (!_profiler.processes) {
+        _profiler.processes = aintMap_new();
+    }
+    process = aintMap_get(_profiler.processes, tgid);
+    if (!process) {
+        ANEW0(process);
+        process->tgid = tgid;
+        aintMap_set(_profiler.processes, tgid, process);
+    }
+    return process;
+}
+
+static void guestProfiler_freeMaps(GuestProcess* process) {
+    int n;
+
+    for (n = 0; n < process->num_maps; n++) {
+        AFREE(process->maps[n].path);
+    }
+    AFREE(process->maps);
+    process->maps = NULL;
+    process->num_maps = process->max_maps = 0;
+}
+
+static void guestProfiler_freeProcess(GuestProcess* process) {
+    guestProfiler_freeMaps(process);
+    AFREE(process->name);
+    AFREE(process);
+}
+
+static void guestProfiler_releaseProcess(GuestProcess* process) {
+    if (--process->num_threads <= 0) {
+        aintMap_del(_profiler.processes, process->tgid);
+        guestProfiler_freeProcess(process);
+    }
+}
+
+static void guestProfiler_freeThread(GuestThread* thread) {
+    if (thread->process) {
+        guestProfiler_releaseProcess(thread->process);
+    }
+    if (_profiler.current == thread) {
+        _profiler.current = NULL;
+    }
+    AFREE(thread->name);
+    AFREE(thread);
+}
+
+// Create thread |tid| in process |tgid|, replacing any previous thread
+// with the same id.
+static GuestThread* guestProfiler_newThread(int tgid, int tid) {
+    GuestProcess* process;
+    GuestThread* thread;
+
+    if (!_profiler.threads) {
+        _profiler.threads = aintMap_new();
+    }
+    process = guestProfiler_getProcess(tgid);
+    process->num_threads++;
+    // Release the previous thread after taking a reference to the process,
+    // which may be the same.
+    thread = aintMap_del(_profiler.threads, tid);
+    if (thread) {
+        guestProfiler_freeThread(thread);
+    }
+    ANEW0(thread);
+    thread->tid = tid;
+    thread->process = process;
+    aintMap_set(_profiler.threads, tid, thread);
+    return thread;
+}
+
+// Return thread |tid|, creating it in a process of the same id if it is
+// not known yet.
+static GuestThread* guestProfiler_getThread(int tid) {
+    GuestThread* thread = NULL;
+
+    if (_profiler.threads) {
+        thread = aintMap_get(_profiler.threads, tid);
+    }
+    return thread ? thread : guestProfiler_newThread(tid, tid);
+}
+
+void guestProfiler_switchTo(int tid) {
+    if (!_profiler.enabled) {
+        return;
+    }
+    _profiler.current = guestProfiler_getThread(tid);
+}
+
+void guestProfiler_fork(int pid) {
+    GuestProcess* parent;
+    GuestThread* child;
+    int n;
+
+    if (!_profiler.enabled) {
+        return;
+    }
+    parent = _profiler.current ? _profiler.current->process : NULL;
+    child = guestProfiler_newThread(pid, pid);
+    if (!parent || parent == child->process) {
+        return;
+    }
+    // The pid may be reused while the previous process is still known.
+    guestProfiler_freeMaps(child->process);
+    AFREE(child->process->name);
+    child->process->name = parent->name ? ASTRDUP(parent->name) : NULL;
+    if (parent->num_maps > 0) {
+        AARRAY_NEW(child->process->maps, parent->num_maps);
+        for (n = 0; n < parent->num_maps; n++) {
+            child->process->maps[n] = parent->maps[n];
+            child->process->maps[n].path = ASTRDUP(parent->maps[n].path);
+        }
+        child->process->num_maps = child->process->max_maps =
+                parent->num_maps;
+    }
+}
+
+void guestProfiler_clone(int tgid, int tid) {
+    if (!_profiler.enabled) {
+        return;
+    }
+    guestProfiler_newThread(tgid, tid);
+}
+
+void guestProfiler_exec(const char* cmdline, int len) {
+    GuestProcess* process;
+    int n;
+
+    if (!_profiler.enabled || !_profiler.current) {
+        return;
+    }
+    // Only keep argv[0].
+    for (n = 0; n < len && cmdline[n]; n++) {
+    }
+    if (n == 0) {
+        return;
+    }
+    process = _profiler.current->process;
+    AFREE(process->name);
+    process->name = guestProfiler_copyName(cmdline, n);
+}
+
+void guestProfiler_nameThread(int tgid, int tid, const char* name) {
+    GuestThread* thread;
+
+    if (!_profiler.enabled) {
+        return;
+    }
+    if (tid < 0) {
+        thread = _profiler.current;
+        if (!thread) {
+            return;
+        }
+    } else {
+        thread = guestProfiler_getThread(tid);
+        if (tgid >= 0 && thread->process->tgid != tgid) {
+            thread = guestProfiler_newThread(tgid, tid);
+        }
+    }
+    AFREE(thread->name);
+    thread->name = guestProfiler_copyName(name, -1);
+    if (thread->tid == thread->process->tgid) {
+        AFREE(thread->process->name);
+        thread->process->name = ASTRDUP(thread->name);
+    }
+}
+
+// Remove the mappings of |process| in [start, end), splitting the ones
+// that are only partially covered.
+static void guestProfiler_removeMaps(GuestProcess* process,
+                                     uint64_t start, uint64_t end) {
+    int n = 0;
+
+    while (n < process->num_maps) {
+        GuestMapping* map = &process->maps[n];
+
+        if (map->end <= start || map->start >= end) {
+            n++;
+            continue;
+        }
+        if (map->start < start && map->end > end) {
+            // Keep both sides.
+            GuestMapping right = *map;
+            right.offset += end - map->start;
+            right.start = end;
+            right.path = ASTRDUP(map->path);
+            map->end = start;
+            if (process->num_maps == process->max_maps) {
+                process->max_maps += process->max_maps / 2 + 4;
+                AARRAY_RENEW(process->maps, process->max_maps);
+            }
+            AARRAY_MOVE(&process->maps[n + 2], &process->maps[n + 1],
+                        process->num_maps - n - 1);
+            process->maps[n + 1] = right;
+            process->num_maps++;
+            return;
+        }
+        if (map->start < start) {
+            map->end = start;
+            n++;
+        } else if (map->end > end) {
+            map->offset += end - map->start;
+            map->start = end;
+            n++;
+        } else {
+            AFREE(map->path);
+            AARRAY_MOVE(&process->maps[n], &process->maps[n + 1],
+                        process->num_maps - n - 1);
+            process->num_maps--;
+        }
+    }
+}
+
+void guestProfiler_map(int tid, uint64_t start, uint64_t end,
+                       uint64_t offset, const char* path) {
+    GuestThread* thread;
+    GuestProcess* process;
+    int n;
+
+    if (!_profiler.enabled || start >= end || !path || !path[0]) {
+        return;
+    }
+    thread = (tid < 0) ? _profiler.current : guestProfiler_getThread(tid);
+    if (!thread) {
+        return;
+    }
+    process = thread->process;
+    guestProfiler_removeMaps(process, start, end);
+
+    if (process->num_maps == process->max_maps) {
+        process->max_maps += process->max_maps / 2 + 4;
+        AARRAY_RENEW(process->maps, process->max_maps);
+    }
+    for (n = process->num_maps; n > 0; n--) {
+        if (process->maps[n - 1].start < start) {
+            break;
+        }
+        process->maps[n] = process->maps[n - 1];
+    }
+    process->maps[n].start = start;
+    process->maps[n].end = end;
+    process->maps[n].offset = offset;
+    process->maps[n].path = guestProfiler_copyName(path, -1);
+    process->num_maps++;
+}
+
+void guestProfiler_unmap(uint64_t start, uint64_t end) {
+    if (!_profiler.enabled || !_profiler.current || start >= end) {
+        return;
+    }
+    guestProfiler_removeMaps(_profiler.current->process, start, end);
+}
+
+void guestProfiler_exit(void) {
+    GuestThread* thread = _profiler.current;
+
+    if (!_profiler.enabled || !thread) {
+        return;
+    }
+    aintMap_del(_profiler.threads, thread->tid);
+    guestProfiler_freeThread(thread);
+}
+
+static const GuestMapping* guestProfiler_findMap(const GuestProcess* process,
+                                                 uint64_t pc) {
+    int lo = 0, hi = process->num_maps;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const GuestMapping* map = &process->maps[mid];
+        if (pc < map->start) {
+            hi = mid;
+        } else if (pc >= map->end) {
+            lo = mid + 1;
+        } else {
+            return map;
+        }
+    }
+    return NULL;
+}
+
+static uint32_t guestProfiler_hash(const char* str) {
+    uint32_t hash = 2166136261U;  // FNV-1a
+
+    for (; *str; str++) {
+        hash = (hash ^ (uint8_t)*str) * 16777619U;
+    }
+    return hash;
+}
+
+static void guestProfiler_growStacks(void) {
+    GuestStack* old = _profiler.stacks;
+    int old_max = _profiler.max_stacks;
+    int n;
+
+    _profiler.max_stacks = old_max ? old_max * 2 : 256;
+    AARRAY_NEW0(_profiler.stacks, _profiler.max_stacks);
+    for (n = 0; n < old_max; n++) {
+        if (old[n].stack) {
+            uint32_t mask = _profiler.max_stacks - 1;
+            uint32_t slot = old[n].hash & mask;
+            while (_profiler.stacks[slot].stack) {
+                slot = (slot + 1) & mask;
+            }
+            _profiler.stacks[slot] = old[n];
+        }
+    }
+    AFREE(old);
+}
+
+static void guestProfiler_addStack(const char* stack, int64_t weight_us) {
+    uint32_t hash = guestProfiler_hash(stack);
+    uint32_t mask, slot;
+
+    if (2 * (_profiler.num_stacks + 1) > _profiler.max_stacks) {
+        guestProfiler_growStacks();
+    }
+    mask = _profiler.max_stacks - 1;
+    for (slot = hash & mask; _profiler.stacks[slot].stack;
+         slot = (slot + 1) & mask) {
+        GuestStack* entry = &_profiler.stacks[slot];
+        if (entry->hash == hash && !strcmp(entry->stack, stack)) {
+            entry->weight_us += weight_us;
+            return;
+        }
+    }
+    _profiler.stacks[slot].stack = ASTRDUP(stack);
+    _profiler.stacks[slot].hash = hash;
+    _profiler.stacks[slot].weight_us = weight_us;
+    _profiler.num_stacks++;
+}
+
+void guestProfiler_sample(GuestProfilerMode mode, uint64_t pc,
+                          int64_t weight_us) {
+    char stack[MAX_STACK_LEN];
+    char* p = stack;
+    char* end = stack + sizeof(stack);
+    const GuestThread* thread = _profiler.current;
+    bool precise = _profiler.num_stacks < MAX_PRECISE_STACKS;
+
+    if (!_profiler.enabled || weight_us <= 0) {
+        return;
+    }
+    if (mode == GUEST_PROFILER_IDLE) {
+        guestProfiler_addStack("[idle]", weight_us);
+        return;
+    }
+    if (thread) {
+        p += snprintf(p, end - p, "%s[%d];%s[%d];",
+                      thread->process->name ? thread->process->name : "?",
+                      thread->process->tgid,
+                      thread->name ? thread->name : "?", thread->tid);
+    } else {
+        p += snprintf(p, end - p, "[unknown];");
+    }
+    if (p >= end) {
+        p = end - 1;
+    }
+
+    if (mode == GUEST_PROFILER_KERNEL) {
+        if (precise) {
+            snprintf(p, end - p, "[kernel]+0x%llx", (unsigned long long)pc);
+        } else {
+            snprintf(p, end - p, "[kernel]");
+        }
+    } else {
+        const GuestMapping* map =
+                thread ? guestProfiler_findMap(thread->process, pc) : NULL;
+        if (!map) {
+            snprintf(p, end - p, "[unknown]");
+        } else if (precise) {
+            snprintf(p, end - p, "%s+0x%llx", map->path,
+                     (unsigned long long)(pc - map->start + map->offset));
+        } else {
+            snprintf(p, end - p, "%s", map->path);
+        }
+    }
+    guestProfiler_addStack(stack, weight_us);
+}
+
+static int guestProfiler_compareStacks(const void* a, const void* b) {
+    return strcmp((*(const GuestStack* const*)a)->stack,
+                  (*(const GuestStack* const*)b)->stack);
+}
+
+void guestProfiler_report(stralloc_t* out) {
+    const GuestStack** sorted;
+    int count = 0;
+    int n;
+
+    if (!_profiler.num_stacks) {
+        return;
+    }
+    AARRAY_NEW(sorted, _profiler.num_stacks);
+    for (n = 0; n < _profiler.max_stacks; n++) {
+        if (_profiler.stacks[n].stack) {
+            sorted[count++] = &_profiler.stacks[n];
+        }
+    }
+    qsort(sorted, count, sizeof(sorted[0]), guestProfiler_compareStacks);
+    for (n = 0; n < count; n++) {
+        stralloc_add_format(out, "%s %lld\n", sorted[n]->stack,
+                            (long long)sorted[n]->weight_us);
+    }
+    AFREE(sorted);
+}
+
+void guestProfiler_finish(void) {
+    STRALLOC_DEFINE(report);
+    FILE* file;
+
+    if (!_profiler.enabled) {
+        return;
+    }
+    _profiler.enabled = false;
+
+    file = fopen(_profiler.path, "w");
+    if (!file) {
+        derror("could not create guest profile file: %s", _profiler.path);
+    } else {
+        guestProfiler_report(report);
+        if (report->n > 0) {
+            fwrite(report->s, 1, report->n, file);
+        }
+        fclose(file);
+        stralloc_reset(report);
+    }
+    AFREE(_profiler.path);
+    _profiler.path = NULL;
+}
+
+void guestProfiler_reset(void) {
+    int n;
+
+    _profiler.enabled = false;
+    AFREE(_profiler.path);
+    _profiler.path = NULL;
+
+    if (_profiler.threads) {
+        AINTMAP_FOREACH_VALUE(_profiler.threads, thread, {
+            GuestThread* t = thread;
+            AFREE(t->name);
+            AFREE(t);
+        });
+        aintMap_free(_profiler.threads);
+        _profiler.threads = NULL;
+    }
+    if (_profiler.processes) {
+        AINTMAP_FOREACH_VALUE(_profiler.processes, process,
+                              guestProfiler_freeProcess(process));
+        aintMap_free(_profiler.processes);
+        _profiler.processes = NULL;
+    }
+    _profiler.current = NULL;
+
+    for (n = 0; n < _profiler.max_stacks; n++) {
+        AFREE(_profiler.stacks[n].stack);
+    }
+    AFREE(_profiler.stacks);
+    _profiler.stacks = NULL;
+    _profiler.num_stacks = _profiler.max_stacks = 0;
+}
@@ -0,0 +1,110 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_GUEST_PROFILER_H
+#define ANDROID_UTILS_GUEST_PROFILER_H
+
+#include "android/utils/compiler.h"
+#include "android/utils/stralloc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+// Guest-aware sampling profiler.
+//
+// The guest kernel reports context switches, forks, clones, execve() and
+// executable mappings through the goldfish trace device, which forwards
+// them here to track the guest processes, threads and their mappings.
+// The emulator periodically samples the guest program counter with
+// guestProfiler_sample(), and the host time elapsed since the previous
+// sample is attributed to the current guest process, thread, and
+// library + file offset.
+//
+// The result is written in the 'collapsed stack' format, one line per
+// unique location, e.g.:
+//
+//   system_server[412];Binder_2[530];/system/lib/libc.so+0x1a2c4 1250
+//
+// where the last number is the host time in microseconds. This can be fed
+// to flamegraph.pl, or to 'pprof -collapsed'. File offsets can be turned
+// into symbols with addr2line, kernel addresses with System.map.
+//
+// All functions must be called from the main loop thread.
+
+// What the guest CPU was doing when a sample was taken.
+typedef enum {
+    GUEST_PROFILER_USER = 0,
+    GUEST_PROFILER_KERNEL,
+    GUEST_PROFILER_IDLE,
+} GuestProfilerMode;
+
+// Start profiling, the report will be written to |path| when
+// guestProfiler_finish() is called, which happens automatically at exit.
+void guestProfiler_init(const char* path);
+
+// Return true iff profiling was started with guestProfiler_init().
+bool guestProfiler_isEnabled(void);
+
+// Kernel notifications. |tid| values are thread ids, and |tgid| values
+// are thread group ids, i.e. process ids. Unless stated otherwise, they
+// apply to the current thread, the last one passed to
+// guestProfiler_switchTo().
+
+// The guest kernel switched to thread |tid|.
+void guestProfiler_switchTo(int tid);
+
+// The current process forked into a new process |pid|, which inherits its
+// name and mappings.
+void guestProfiler_fork(int pid);
+
+// Thread |tid| was created in process |tgid|.
+void guestProfiler_clone(int tgid, int tid);
+
+// The current process called execve(). |cmdline| holds the NUL-separated
+// arguments, and is |len| bytes long.
+void guestProfiler_exec(const char* cmdline, int len);
+
+// Name thread |tid| of process |tgid|. This is used for the threads that
+// exist before the trace device is probed, and for the current thread
+// when |tid| is -1. A process is named after its main thread.
+void guestProfiler_nameThread(int tgid, int tid, const char* name);
+
+// Record that the file |path| at |offset| was mapped at [start, end) in
+// the process of thread |tid|, or in the current process if |tid| is -1.
+// Existing mappings in that range are replaced.
+void guestProfiler_map(int tid, uint64_t start, uint64_t end,
+                       uint64_t offset, const char* path);
+
+// Remove the mappings in [start, end) from the current process.
+void guestProfiler_unmap(uint64_t start, uint64_t end);
+
+// The current thread exited.
+void guestProfiler_exit(void);
+
+// Attribute |weight_us| microseconds of host time to the current thread,
+// running at guest address |pc| in |mode|.
+void guestProfiler_sample(GuestProfilerMode mode, uint64_t pc,
+                          int64_t weight_us);
+
+// Append the collapsed stacks recorded so far to |out|, sorted by stack.
+void guestProfiler_report(stralloc_t* out);
+
+// Write the report and stop profiling.
+void guestProfiler_finish(void);
+
+// Forget all processes, threads and samples, and stop profiling.
+void guestProfiler_reset(void);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_GUEST_PROFILER_H
@@ -0,0 +1,146 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/guest_profiler.h"
+
+#include "android/base/String.h"
+
+#include <gtest/gtest.h>
+
+using android::base::String;
+
+namespace {
+
+class GuestProfilerTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        guestProfiler_reset();
+        // The file is never written, as the profiler is reset before exit.
+        guestProfiler_init("/nonexistent/guest-profile.txt");
+    }
+
+    virtual void TearDown() {
+        guestProfiler_reset();
+    }
+
+    String report() {
+        STRALLOC_DEFINE(out);
+        guestProfiler_report(out);
+        String result(stralloc_cstr(out));
+        stralloc_reset(out);
+        return result;
+    }
+};
+
+}  // namespace
+
+TEST_F(GuestProfilerTest, Disabled) {
+    guestProfiler_reset();
+    EXPECT_FALSE(guestProfiler_isEnabled());
+    guestProfiler_switchTo(1);
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x1000, 10);
+    EXPECT_STREQ("", report().c_str());
+}
+
+TEST_F(GuestProfilerTest, UserKernelIdle) {
+    EXPECT_TRUE(guestProfiler_isEnabled());
+    guestProfiler_nameThread(1, 1, "init");
+    guestProfiler_map(1, 0x8000, 0x10000, 0, "/init");
+    guestProfiler_switchTo(1);
+
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x8010, 100);
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x8010, 50);
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x20000, 7);
+    guestProfiler_sample(GUEST_PROFILER_KERNEL, 0xc0008000, 20);
+    guestProfiler_sample(GUEST_PROFILER_IDLE, 0xc0001000, 1000);
+
+    EXPECT_STREQ(
+            "[idle] 1000\n"
+            "init[1];init[1];/init+0x10 150\n"
+            "init[1];init[1];[kernel]+0xc0008000 20\n"
+            "init[1];init[1];[unknown] 7\n",
+            report().c_str());
+}
+
+TEST_F(GuestProfilerTest, ForkCloneExec) {
+    guestProfiler_nameThread(-1, 100, "zygote");
+    guestProfiler_map(100, 0x40000000, 0x40100000, 0x2000,
+                      "/system/lib/libc.so");
+    guestProfiler_switchTo(100);
+
+    // The child inherits the parent's mappings, and is renamed later.
+    guestProfiler_fork(200);
+    guestProfiler_switchTo(200);
+    guestProfiler_nameThread(-1, -1, "com.example");
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x40000010, 5);
+
+    guestProfiler_clone(200, 201);
+    guestProfiler_switchTo(201);
+    guestProfiler_nameThread(-1, -1, "Binder;1");
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x40000020, 3);
+
+    // execve() names the process after argv[0].
+    guestProfiler_switchTo(100);
+    guestProfiler_fork(300);
+    guestProfiler_switchTo(300);
+    guestProfiler_map(-1, 0x8000, 0x9000, 0, "/system/bin/sh");
+    const char cmdline[] = "/system/bin/sh\0-c\0ls";
+    guestProfiler_exec(cmdline, sizeof(cmdline));
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x8004, 1);
+
+    EXPECT_STREQ(
+            "/system/bin/sh[300];?[300];/system/bin/sh+0x4 1\n"
+            "com.example[200];Binder_1[201];/system/lib/libc.so+0x2020 3\n"
+            "com.example[200];com.example[200];/system/lib/libc.so+0x2010 5\n",
+            report().c_str());
+}
+
+TEST_F(GuestProfilerTest, MapUnmap) {
+    guestProfiler_switchTo(10);
+    guestProfiler_map(-1, 0x1000, 0x5000, 0, "/a");
+    // Replaces the middle of /a.
+    guestProfiler_map(-1, 0x2000, 0x3000, 0x100, "/b");
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x1000, 1);
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x2008, 1);
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x3008, 1);
+
+    guestProfiler_unmap(0x1000, 0x2000);
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x1000, 1);
+
+    // Splits /a in two.
+    guestProfiler_unmap(0x3800, 0x4000);
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x3900, 1);
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x4008, 1);
+
+    EXPECT_STREQ(
+            "?[10];?[10];/a+0x0 1\n"
+            "?[10];?[10];/a+0x2008 1\n"
+            "?[10];?[10];/a+0x3008 1\n"
+            "?[10];?[10];/b+0x108 1\n"
+            "?[10];?[10];[unknown] 2\n",
+            report().c_str());
+}
+
+TEST_F(GuestProfilerTest, Exit) {
+    guestProfiler_switchTo(5);
+    guestProfiler_map(-1, 0x1000, 0x2000, 0, "/bin");
+    guestProfiler_exit();
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x1000, 4);
+
+    // The process is gone with its last thread.
+    guestProfiler_switchTo(5);
+    guestProfiler_sample(GUEST_PROFILER_USER, 0x1000, 2);
+
+    EXPECT_STREQ(
+            "?[5];?[5];[unknown] 2\n"
+            "[unknown];[unknown] 4\n",
+            report().c_str());
+}
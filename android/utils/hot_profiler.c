@@ -0,0 +1,318 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/hot_profiler.h"
+
+#include "android/utils/system.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#elif defined(__APPLE__)
+#  include <mach/mach_time.h>
+#else
+#  include <time.h>
+#endif
+
+typedef struct {
+    uint64_t  reads;
+    uint64_t  writes;
+} HotProfilerIo;
+
+typedef struct {
+    int64_t           started_ns;   // time of the last start, if running.
+    int64_t           elapsed_ns;   // time spent running before that.
+    HotProfilerStats  regions[HOT_PROFILER_REGION_COUNT];
+    uint64_t          counters[HOT_PROFILER_COUNTER_COUNT];
+    HotProfilerIo     io[HOT_PROFILER_MAX_IO];
+    char*             io_names[HOT_PROFILER_MAX_IO];
+} HotProfiler;
+
+static HotProfiler _profiler;
+
+bool android_hot_profiler_enabled = false;
+
+static const char* const _region_names[HOT_PROFILER_REGION_COUNT] = {
+    [HOT_PROFILER_CPU_EXEC] = "cpu_exec",
+    [HOT_PROFILER_MAIN_LOOP_WAIT] = "main_loop_wait",
+    [HOT_PROFILER_IO_HANDLERS] = "io handlers",
+    [HOT_PROFILER_TIMERS] = "timers",
+    [HOT_PROFILER_BOTTOM_HALVES] = "bottom halves",
+    [HOT_PROFILER_TRANSLATE] = "translate",
+};
+
+static const char* const _counter_names[HOT_PROFILER_COUNTER_COUNT] = {
+    [HOT_PROFILER_TLB_REFILL] = "tlb refills",
+    [HOT_PROFILER_TB_FLUSH] = "tb flushes",
+    [HOT_PROFILER_IDLE_WAKEUP] = "idle wakeups",
+    [HOT_PROFILER_WAKEUP_IO] = "  by i/o",
+    [HOT_PROFILER_WAKEUP_SIGNAL] = "  by signal",
+    [HOT_PROFILER_WAKEUP_TIMER] = "  by timer",
+    [HOT_PROFILER_WAKEUP_BH] = "  by bh",
+    [HOT_PROFILER_WAKEUP_SLIRP] = "  by slirp",
+    [HOT_PROFILER_WAKEUP_CHARPIPE] = "  by charpipe",
+    [HOT_PROFILER_AUDIO_TIMER] = "audio timer",
+    [HOT_PROFILER_DISPLAY_TIMER] = "display timer",
+};
+
+int64_t hotProfiler_now(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (int64_t)(now.QuadPart * (1e9 / freq.QuadPart));
+#elif defined(__APPLE__)
+    static mach_timebase_info_data_t timebase;
+    if (!timebase.denom) {
+        mach_timebase_info(&timebase);
+    }
+    return (int64_t)(mach_absolute_time() * timebase.numer / timebase.denom);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+void hotProfiler_start(void) {
+    if (android_hot_profiler_enabled) {
+        return;
+    }
+    _profiler.started_ns = hotProfiler_now();
+    android_hot_profiler_enabled = true;
+}
+
+void hotProfiler_stop(void) {
+    if (!android_hot_profiler_enabled) {
+        return;
+    }
+    android_hot_profiler_enabled = false;
+    _profiler.elapsed_ns += hotProfiler_now() - _profiler.started_ns;
+}
+
+void hotProfiler_reset(void) {
+    memset(_profiler.regions, 0, sizeof(_profiler.regions));
+    memset(_profiler.counters, 0, sizeof(_profiler.counters));
+    memset(_profiler.io, 0, sizeof(_profiler.io));
+    _profiler.elapsed_ns = 0;
+    _profiler.started_ns = hotProfiler_now();
+}
+
+int hotProfiler_bucketFor(int64_t duration_ns) {
+    uint64_t us = (duration_ns > 0) ? (uint64_t)duration_ns / 1000 : 0;
+    int bucket = 0;
+
+    while (us > 0 && bucket < HOT_PROFILER_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void hotProfiler_record(HotProfilerRegion region, int64_t duration_ns) {
+    HotProfilerStats* stats;
+
+    if ((unsigned)region >= HOT_PROFILER_REGION_COUNT) {
+        return;
+    }
+    if (duration_ns < 0) {
+        duration_ns = 0;
+    }
+    stats = &_profiler.regions[region];
+    stats->count++;
+    stats->total_ns += duration_ns;
+    if (duration_ns > stats->max_ns) {
+        stats->max_ns = duration_ns;
+    }
+    stats->buckets[hotProfiler_bucketFor(duration_ns)]++;
+}
+
+void hotProfiler_addCount(HotProfilerCounter counter) {
+    if ((unsigned)counter < HOT_PROFILER_COUNTER_COUNT) {
+        _profiler.counters[counter]++;
+    }
+}
+
+void hotProfiler_addIo(int io_index, bool is_write) {
+    if ((unsigned)io_index >= HOT_PROFILER_MAX_IO) {
+        return;
+    }
+    if (is_write) {
+        _profiler.io[io_index].writes++;
+    } else {
+        _profiler.io[io_index].reads++;
+    }
+}
+
+void hotProfiler_setIoName(int io_index, const char* name) {
+    if ((unsigned)io_index >= HOT_PROFILER_MAX_IO) {
+        return;
+    }
+    AFREE(_profiler.io_names[io_index]);
+    _profiler.io_names[io_index] = name ? ASTRDUP(name) : NULL;
+}
+
+void hotProfiler_getStats(HotProfilerRegion region, HotProfilerStats* stats) {
+    if ((unsigned)region >= HOT_PROFILER_REGION_COUNT) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = _profiler.regions[region];
+}
+
+uint64_t hotProfiler_getCount(HotProfilerCounter counter) {
+    if ((unsigned)counter >= HOT_PROFILER_COUNTER_COUNT) {
+        return 0;
+    }
+    return _profiler.counters[counter];
+}
+
+void hotProfiler_getIo(int io_index, uint64_t* reads, uint64_t* writes) {
+    if ((unsigned)io_index >= HOT_PROFILER_MAX_IO) {
+        *reads = *writes = 0;
+        return;
+    }
+    *reads = _profiler.io[io_index].reads;
+    *writes = _profiler.io[io_index].writes;
+}
+
+static int hotProfiler_compareIo(const void* a, const void* b) {
+    const HotProfilerIo* ia = &_profiler.io[*(const int*)a];
+    const HotProfilerIo* ib = &_profiler.io[*(const int*)b];
+    uint64_t ta = ia->reads + ia->writes;
+    uint64_t tb = ib->reads + ib->writes;
+
+    if (ta != tb) {
+        return (ta > tb) ? -1 : 1;
+    }
+    return *(const int*)a - *(const int*)b;
+}
+
+static void hotProfiler_reportBuckets(stralloc_t* out,
+                                      const HotProfilerStats* stats) {
+    int n;
+
+    for (n = 0; n < HOT_PROFILER_BUCKETS; n++) {
+        char range[32];
+
+        if (!stats->buckets[n]) {
+            continue;
+        }
+        if (n == 0) {
+            snprintf(range, sizeof(range), "<1us");
+        } else if (n == HOT_PROFILER_BUCKETS - 1) {
+            snprintf(range, sizeof(range), ">=%lluus", 1ULL << (n - 1));
+        } else {
+            snprintf(range, sizeof(range), "%llu-%lluus",
+                     1ULL << (n - 1), 1ULL << n);
+        }
+        stralloc_add_format(out, "  %-14s %12llu\n", range,
+                            (unsigned long long)stats->buckets[n]);
+    }
+}
+
+void hotProfiler_report(stralloc_t* out) {
+    int64_t elapsed_ns = _profiler.elapsed_ns;
+    int io_order[HOT_PROFILER_MAX_IO];
+    int num_io = 0;
+    int n;
+
+    if (android_hot_profiler_enabled) {
+        elapsed_ns += hotProfiler_now() - _profiler.started_ns;
+    }
+
+    stralloc_add_format(out, "profiler: %s, %.3f s profiled\n",
+                        android_hot_profiler_enabled ? "running" : "stopped",
+                        elapsed_ns / 1e9);
+
+    stralloc_add_format(out, "%-16s %12s %12s %10s %10s %7s\n",
+                        "region", "count", "total ms", "avg us", "max us",
+                        "time %");
+    for (n = 0; n < HOT_PROFILER_REGION_COUNT; n++) {
+        const HotProfilerStats* stats = &_profiler.regions[n];
+        stralloc_add_format(
+                out, "%-16s %12llu %12.3f %10.2f %10.2f %7.2f\n",
+                _region_names[n], (unsigned long long)stats->count,
+                stats->total_ns / 1e6,
+                stats->count ? stats->total_ns / 1e3 / stats->count : 0.,
+                stats->max_ns / 1e3,
+                elapsed_ns > 0 ? 100. * stats->total_ns / elapsed_ns : 0.);
+    }
+
+    for (n = 0; n < HOT_PROFILER_REGION_COUNT; n++) {
+        const HotProfilerStats* stats = &_profiler.regions[n];
+        if (!stats->count) {
+            continue;
+        }
+        stralloc_add_format(out, "%s histogram:\n", _region_names[n]);
+        hotProfiler_reportBuckets(out, stats);
+    }
+
+    stralloc_add_format(out, "%-16s %12s %12s\n", "event", "count", "per s");
+    for (n = 0; n < HOT_PROFILER_COUNTER_COUNT; n++) {
+        stralloc_add_format(
+                out, "%-16s %12llu %12.1f\n", _counter_names[n],
+                (unsigned long long)_profiler.counters[n],
+                elapsed_ns > 0 ? _profiler.counters[n] * 1e9 / elapsed_ns : 0.);
+    }
+
+    for (n = 0; n < HOT_PROFILER_MAX_IO; n++) {
+        if (_profiler.io[n].reads || _profiler.io[n].writes) {
+            io_order[num_io++] = n;
+        }
+    }
+    if (!num_io) {
+        return;
+    }
+    qsort(io_order, num_io, sizeof(io_order[0]), hotProfiler_compareIo);
+
+    stralloc_add_format(out, "%-16s %12s %12s\n",
+                        "mmio", "reads", "writes");
+    for (n = 0; n < num_io; n++) {
+        int index = io_order[n];
+        char name[32];
+
+        if (_profiler.io_names[index]) {
+            snprintf(name, sizeof(name), "%s", _profiler.io_names[index]);
+        } else {
+            snprintf(name, sizeof(name), "io#%d", index);
+        }
+        stralloc_add_format(out, "%-16s %12llu %12llu\n", name,
+                            (unsigned long long)_profiler.io[index].reads,
+                            (unsigned long long)_profiler.io[index].writes);
+    }
+}
+
+int hotProfiler_dump(const char* path) {
+    STRALLOC_DEFINE(report);
+    FILE* file;
+    int ret = 0;
+
+    file = fopen(path, "w");
+    if (!file) {
+        return -1;
+    }
+    hotProfiler_report(report);
+    if (fwrite(report->s, 1, report->n, file) != report->n) {
+        ret = -1;
+    }
+    if (fclose(file) != 0) {
+        ret = -1;
+    }
+    stralloc_reset(report);
+    return ret;
+}
@@ -0,0 +1,162 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_HOT_PROFILER_H
+#define ANDROID_UTILS_HOT_PROFILER_H
+
+#include "android/utils/compiler.h"
+#include "android/utils/stralloc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+// Runtime profiler for the emulator's hot paths.
+//
+// Unlike the CONFIG_PROFILER counters, this is always compiled in, and is
+// toggled at runtime, usually from the 'profile' console command. While it
+// is stopped, each instrumentation point only checks a global flag.
+//
+// It records how long the main thread spends in a few regions (running
+// translated code, waiting in the main loop, running timers, ...) as
+// log2 histograms, counts a few events such as TLB refills, and counts MMIO
+// accesses per I/O memory slot, which are named after the device that
+// registered them.
+//
+// All functions must be called from the main loop thread.
+
+// Regions that are timed. Note that they can nest: translation happens
+// inside cpu_exec(), and the I/O handlers, timers and bottom-halves are run
+// from main_loop_wait().
+typedef enum {
+    HOT_PROFILER_CPU_EXEC = 0,
+    HOT_PROFILER_MAIN_LOOP_WAIT,
+    HOT_PROFILER_IO_HANDLERS,
+    HOT_PROFILER_TIMERS,
+    HOT_PROFILER_BOTTOM_HALVES,
+    HOT_PROFILER_TRANSLATE,
+    HOT_PROFILER_REGION_COUNT
+} HotProfilerRegion;
+
+// Events that are only counted. The report also gives their rate per second
+// of profiling. The WAKEUP counters are only incremented while the main loop
+// is idle, i.e. all vCPUs are halted, and tell why it woke up.
+typedef enum {
+    HOT_PROFILER_TLB_REFILL = 0,
+    HOT_PROFILER_TB_FLUSH,
+    HOT_PROFILER_IDLE_WAKEUP,       // Any idle wakeup, the sum of the below.
+    HOT_PROFILER_WAKEUP_IO,         // A file descriptor was ready.
+    HOT_PROFILER_WAKEUP_SIGNAL,     // A signal, usually the host alarm.
+    HOT_PROFILER_WAKEUP_TIMER,      // A QEMU timer deadline.
+    HOT_PROFILER_WAKEUP_BH,         // A scheduled bottom-half.
+    HOT_PROFILER_WAKEUP_SLIRP,      // A slirp TCP timer or UDP expiration.
+    HOT_PROFILER_WAKEUP_CHARPIPE,   // Buffered charpipe data.
+    HOT_PROFILER_AUDIO_TIMER,       // Runs of the audio timer.
+    HOT_PROFILER_DISPLAY_TIMER,     // Runs of the display refresh timer.
+    HOT_PROFILER_COUNTER_COUNT
+} HotProfilerCounter;
+
+// Number of duration histogram buckets. Bucket 0 counts durations below
+// 1 microsecond, bucket N > 0 counts durations in [2^(N-1), 2^N)
+// microseconds, and the last one everything above.
+#define HOT_PROFILER_BUCKETS  24
+
+// Number of I/O memory slots that are tracked, see IO_MEM_NB_ENTRIES.
+#define HOT_PROFILER_MAX_IO   512
+
+typedef struct {
+    uint64_t  count;
+    int64_t   total_ns;
+    int64_t   max_ns;
+    uint64_t  buckets[HOT_PROFILER_BUCKETS];
+} HotProfilerStats;
+
+// Do not use directly, this is only exported for the inline functions below.
+extern bool android_hot_profiler_enabled;
+
+// Start profiling. Statistics accumulate over start/stop cycles until
+// hotProfiler_reset() is called.
+void hotProfiler_start(void);
+
+// Stop profiling.
+void hotProfiler_stop(void);
+
+// Clear all statistics. Does not change whether the profiler runs.
+void hotProfiler_reset(void);
+
+// Return true iff the profiler is running.
+static inline bool hotProfiler_isEnabled(void) {
+    return android_hot_profiler_enabled;
+}
+
+// Return a monotonic timestamp in nanoseconds.
+int64_t hotProfiler_now(void);
+
+// Add a duration of |duration_ns| to |region|.
+void hotProfiler_record(HotProfilerRegion region, int64_t duration_ns);
+
+// Add one to |counter|.
+void hotProfiler_addCount(HotProfilerCounter counter);
+
+// Count one MMIO access to the I/O memory slot |io_index|.
+void hotProfiler_addIo(int io_index, bool is_write);
+
+// Return the index of the histogram bucket for |duration_ns|.
+int hotProfiler_bucketFor(int64_t duration_ns);
+
+// Name the I/O memory slot |io_index|, usually after the device that
+// registered it. |name| is copied.
+void hotProfiler_setIoName(int io_index, const char* name);
+
+// Accessors for the current statistics.
+void hotProfiler_getStats(HotProfilerRegion region, HotProfilerStats* stats);
+uint64_t hotProfiler_getCount(HotProfilerCounter counter);
+void hotProfiler_getIo(int io_index, uint64_t* reads, uint64_t* writes);
+
+// Return a timestamp to pass to hotProfiler_end(), or 0 if the profiler
+// is stopped.
+static inline int64_t hotProfiler_begin(void) {
+    return android_hot_profiler_enabled ? hotProfiler_now() : 0;
+}
+
+// Record the time spent in |region| since |start|, as returned by
+// hotProfiler_begin(). Does nothing if the profiler was started or
+// stopped in between.
+static inline void hotProfiler_end(HotProfilerRegion region, int64_t start) {
+    if (android_hot_profiler_enabled && start) {
+        hotProfiler_record(region, hotProfiler_now() - start);
+    }
+}
+
+static inline void hotProfiler_count(HotProfilerCounter counter) {
+    if (android_hot_profiler_enabled) {
+        hotProfiler_addCount(counter);
+    }
+}
+
+static inline void hotProfiler_countIo(int io_index, bool is_write) {
+    if (android_hot_profiler_enabled) {
+        hotProfiler_addIo(io_index, is_write);
+    }
+}
+
+// Append a human-readable report of the current statistics to |out|,
+// with '\n' line endings.
+void hotProfiler_report(stralloc_t* out);
+
+// Write the report to the file at |path|. Return 0 on success, or -1 on
+// failure with errno set.
+int hotProfiler_dump(const char* path);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_HOT_PROFILER_H
@@ -0,0 +1,139 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/hot_profiler.h"
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+TEST(HotProfiler, BucketFor) {
+    EXPECT_EQ(0, hotProfiler_bucketFor(-5));
+    EXPECT_EQ(0, hotProfiler_bucketFor(0));
+    EXPECT_EQ(0, hotProfiler_bucketFor(999));
+    EXPECT_EQ(1, hotProfiler_bucketFor(1000));
+    EXPECT_EQ(1, hotProfiler_bucketFor(1999));
+    EXPECT_EQ(2, hotProfiler_bucketFor(2000));
+    EXPECT_EQ(2, hotProfiler_bucketFor(3999));
+    EXPECT_EQ(3, hotProfiler_bucketFor(4000));
+    EXPECT_EQ(HOT_PROFILER_BUCKETS - 1,
+              hotProfiler_bucketFor(1000LL * 1000 * 1000 * 3600));
+}
+
+TEST(HotProfiler, DisabledByDefault) {
+    hotProfiler_reset();
+    EXPECT_FALSE(hotProfiler_isEnabled());
+    EXPECT_EQ(0, hotProfiler_begin());
+
+    hotProfiler_end(HOT_PROFILER_CPU_EXEC, 1);
+    hotProfiler_count(HOT_PROFILER_TLB_REFILL);
+    hotProfiler_countIo(3, false);
+
+    HotProfilerStats stats;
+    hotProfiler_getStats(HOT_PROFILER_CPU_EXEC, &stats);
+    EXPECT_EQ(0U, stats.count);
+    EXPECT_EQ(0U, hotProfiler_getCount(HOT_PROFILER_TLB_REFILL));
+    uint64_t reads, writes;
+    hotProfiler_getIo(3, &reads, &writes);
+    EXPECT_EQ(0U, reads);
+}
+
+TEST(HotProfiler, RecordRegions) {
+    hotProfiler_reset();
+    hotProfiler_record(HOT_PROFILER_TRANSLATE, 500);
+    hotProfiler_record(HOT_PROFILER_TRANSLATE, 1500);
+    hotProfiler_record(HOT_PROFILER_TRANSLATE, 40000);
+
+    HotProfilerStats stats;
+    hotProfiler_getStats(HOT_PROFILER_TRANSLATE, &stats);
+    EXPECT_EQ(3U, stats.count);
+    EXPECT_EQ(42000, stats.total_ns);
+    EXPECT_EQ(40000, stats.max_ns);
+    EXPECT_EQ(1U, stats.buckets[0]);
+    EXPECT_EQ(1U, stats.buckets[1]);
+    EXPECT_EQ(1U, stats.buckets[hotProfiler_bucketFor(40000)]);
+
+    hotProfiler_getStats(HOT_PROFILER_TIMERS, &stats);
+    EXPECT_EQ(0U, stats.count);
+
+    hotProfiler_reset();
+    hotProfiler_getStats(HOT_PROFILER_TRANSLATE, &stats);
+    EXPECT_EQ(0U, stats.count);
+    EXPECT_EQ(0, stats.max_ns);
+}
+
+TEST(HotProfiler, StartStop) {
+    hotProfiler_reset();
+    hotProfiler_start();
+    EXPECT_TRUE(hotProfiler_isEnabled());
+
+    int64_t start = hotProfiler_begin();
+    EXPECT_NE(0, start);
+    hotProfiler_end(HOT_PROFILER_BOTTOM_HALVES, start);
+    hotProfiler_count(HOT_PROFILER_TB_FLUSH);
+    hotProfiler_countIo(7, true);
+    hotProfiler_countIo(7, false);
+    hotProfiler_countIo(7, false);
+    // Out of range slots are ignored.
+    hotProfiler_countIo(-1, false);
+    hotProfiler_countIo(HOT_PROFILER_MAX_IO, false);
+
+    // A region that starts while stopped is not recorded.
+    hotProfiler_stop();
+    start = hotProfiler_begin();
+    hotProfiler_start();
+    hotProfiler_end(HOT_PROFILER_BOTTOM_HALVES, start);
+    hotProfiler_stop();
+    EXPECT_FALSE(hotProfiler_isEnabled());
+
+    HotProfilerStats stats;
+    hotProfiler_getStats(HOT_PROFILER_BOTTOM_HALVES, &stats);
+    EXPECT_EQ(1U, stats.count);
+    EXPECT_EQ(1U, hotProfiler_getCount(HOT_PROFILER_TB_FLUSH));
+    uint64_t reads, writes;
+    hotProfiler_getIo(7, &reads, &writes);
+    EXPECT_EQ(2U, reads);
+    EXPECT_EQ(1U, writes);
+}
+
+TEST(HotProfiler, Report) {
+    hotProfiler_reset();
+    hotProfiler_setIoName(5, "goldfish_tty");
+    hotProfiler_start();
+    hotProfiler_countIo(5, false);
+    hotProfiler_countIo(9, true);
+    hotProfiler_countIo(9, true);
+    hotProfiler_count(HOT_PROFILER_IDLE_WAKEUP);
+    hotProfiler_count(HOT_PROFILER_WAKEUP_TIMER);
+    hotProfiler_stop();
+    hotProfiler_record(HOT_PROFILER_CPU_EXEC, 3000);
+
+    STRALLOC_DEFINE(report);
+    hotProfiler_report(report);
+    const char* text = stralloc_cstr(report);
+
+    EXPECT_TRUE(strstr(text, "profiler: stopped"));
+    EXPECT_TRUE(strstr(text, "cpu_exec histogram:\n  2-4us "));
+    EXPECT_FALSE(strstr(text, "timers histogram:"));
+    EXPECT_TRUE(strstr(text, "\nidle wakeups                1 "));
+    EXPECT_TRUE(strstr(text, "\n  by timer                  1 "));
+    EXPECT_TRUE(strstr(text, "\n  by i/o                    0 "));
+    // Busiest slots first, unnamed ones by index.
+    const char* tty = strstr(text, "goldfish_tty ");
+    const char* other = strstr(text, "io#9 ");
+    ASSERT_TRUE(tty);
+    ASSERT_TRUE(other);
+    EXPECT_LT(other, tty);
+
+    stralloc_reset(report);
+    hotProfiler_setIoName(5, NULL);
+    hotProfiler_reset();
+}
@@ -27,6 +27,11 @@
 /* a simple .ini file parser and container for Android
  * no sections support. see android/utils/ini.h for
  * more details on the supported file format.
+ *
+ * pairs are kept in file order in the 'pairs' array, which is
+ * what iniFile_getEntry() and iniFile_saveToFile() walk. keys are
+ * looked up through an open-addressing hash table whose slots
+ * contain 1 + the index of the first pair with that key, or 0.
  */
 typedef struct {
     char*  key;
@@ -37,6 +42,8 @@ struct IniFile {
     int       numPairs;
     int       maxPairs;
     IniPair*  pairs;
+    unsigned  slotMask;
+    int*      slots;
 };
 
 void
@@ -49,6 +56,7 @@ iniFile_free( IniFile*  i )
         i->pairs[nn].value = NULL;
     }
     AFREE(i->pairs);
+    AFREE(i->slots);
     AFREE(i);
 }
 
@@ -85,12 +93,74 @@ iniPair_replaceValue( IniPair* pair, const char* value )
     AFREE(key);
 }
 
+/* FNV-1a hash of the first 'len' bytes of 'key' */
+static unsigned
+iniFile_hashKey( const char*  key, int  len )
+{
+    uint32_t  h = 2166136261U;
+    int       nn;
+
+    for (nn = 0; nn < len; nn++) {
+        h ^= (unsigned char)key[nn];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/* Return the hash slot for 'key', or the empty slot where it should go */
+static int*
+iniFile_lookup( IniFile*  i, const char*  key, int  keyLen )
+{
+    unsigned  index = iniFile_hashKey(key, keyLen) & i->slotMask;
+
+    for (;;) {
+        int*         slot = &i->slots[index];
+        const char*  k;
+
+        if (*slot == 0)
+            return slot;
+
+        k = i->pairs[*slot - 1].key;
+        if (!memcmp(k, key, keyLen) && k[keyLen] == 0)
+            return slot;
+
+        index = (index + 1) & i->slotMask;
+    }
+}
+
+/* Make sure the hash table can index 'count' pairs with a load
+ * factor under 1/2 */
+static void
+iniFile_reserveSlots( IniFile*  i, int  count )
+{
+    unsigned  numSlots = i->slots ? i->slotMask + 1 : 16;
+    int       nn;
+
+    if (i->slots && (unsigned)count*2 <= numSlots)
+        return;
+
+    while ((unsigned)count*2 > numSlots)
+        numSlots *= 2;
+
+    AFREE(i->slots);
+    AARRAY_NEW0(i->slots, numSlots);
+    i->slotMask = numSlots - 1;
+
+    for (nn = 0; nn < i->numPairs; nn++) {
+        const char*  key  = i->pairs[nn].key;
+        int*         slot = iniFile_lookup(i, key, strlen(key));
+        if (*slot == 0)
+            *slot = nn + 1;
+    }
+}
+
 static void
 iniFile_addPair( IniFile*  i,
                  const char*  key,   int  keyLen,
                  const char*  value, int  valueLen )
 {
     IniPair*  pair;
+    int*      slot;
 
     if (i->numPairs >= i->maxPairs) {
         int       oldMax = i->maxPairs;
@@ -99,23 +169,27 @@ iniFile_addPair( IniFile*  i,
         AARRAY_RENEW(i->pairs, newMax);
         i->maxPairs = newMax;
     }
+    iniFile_reserveSlots(i, i->numPairs + 1);
 
     pair = i->pairs + i->numPairs;
     iniPair_init(pair, key, keyLen, value, valueLen);
 
+    /* when a key appears several times, lookups return the first one */
+    slot = iniFile_lookup(i, pair->key, keyLen);
+    if (*slot == 0)
+        *slot = i->numPairs + 1;
+
     i->numPairs += 1;
 }
 
 static IniPair*
 iniFile_getPair( IniFile* i, const char* key )
 {
-    if (i && key) {
-        int  nn;
+    if (i && key && i->slots) {
+        int  slot = *iniFile_lookup(i, key, strlen(key));
 
-        for (nn = 0; nn < i->numPairs; nn++) {
-            if (!strcmp(i->pairs[nn].key,key))
-                return &i->pairs[nn];
-        }
+        if (slot != 0)
+            return &i->pairs[slot - 1];
     }
     return NULL;
 }
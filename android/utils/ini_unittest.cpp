@@ -0,0 +1,80 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/ini.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+TEST(IniFile, ParseAndLookup) {
+    static const char kText[] =
+        "# comment\n"
+        "hw.ramSize = 512\n"
+        "hw.lcd.density=240\n"
+        "  disk.dataPartition.size = 200M  \n"
+        "bad line\n"
+        "empty.value =\n";
+    IniFile* ini = iniFile_newFromMemory(kText, NULL);
+    ASSERT_TRUE(ini);
+    EXPECT_EQ(4, iniFile_getPairCount(ini));
+    EXPECT_STREQ("512", iniFile_getValue(ini, "hw.ramSize"));
+    EXPECT_STREQ("240", iniFile_getValue(ini, "hw.lcd.density"));
+    EXPECT_STREQ("200M", iniFile_getValue(ini, "disk.dataPartition.size"));
+    EXPECT_STREQ("", iniFile_getValue(ini, "empty.value"));
+    EXPECT_FALSE(iniFile_getValue(ini, "hw.ram"));
+    EXPECT_FALSE(iniFile_getValue(ini, "hw.ramSizeX"));
+    EXPECT_EQ(200 * 1024 * 1024LL,
+              iniFile_getDiskSize(ini, "disk.dataPartition.size", "0"));
+    iniFile_free(ini);
+}
+
+TEST(IniFile, DuplicateKeysReturnFirstValue) {
+    IniFile* ini = iniFile_newFromMemory("a=1\nb=2\na=3\n", NULL);
+    ASSERT_TRUE(ini);
+    EXPECT_EQ(3, iniFile_getPairCount(ini));
+    EXPECT_STREQ("1", iniFile_getValue(ini, "a"));
+
+    char* key;
+    char* value;
+    ASSERT_EQ(0, iniFile_getEntry(ini, 2, &key, &value));
+    EXPECT_STREQ("a", key);
+    EXPECT_STREQ("3", value);
+    free(key);
+    free(value);
+    iniFile_free(ini);
+}
+
+TEST(IniFile, SetValueKeepsOrder) {
+    IniFile* ini = iniFile_newFromMemory("", NULL);
+    ASSERT_TRUE(ini);
+    char name[32];
+    for (int n = 0; n < 500; ++n) {
+        snprintf(name, sizeof(name), "key.%d", n);
+        iniFile_setInteger(ini, name, n);
+    }
+    iniFile_setValue(ini, "key.7", "seven");
+    EXPECT_EQ(500, iniFile_getPairCount(ini));
+    EXPECT_STREQ("seven", iniFile_getValue(ini, "key.7"));
+    EXPECT_EQ(499, iniFile_getInteger(ini, "key.499", -1));
+
+    for (int n = 0; n < 500; ++n) {
+        char* key;
+        char* value;
+        ASSERT_EQ(0, iniFile_getEntry(ini, n, &key, &value));
+        snprintf(name, sizeof(name), "key.%d", n);
+        EXPECT_STREQ(name, key);
+        free(key);
+        free(value);
+    }
+    iniFile_free(ini);
+}
@@ -12,28 +12,35 @@
 
 #include "android/utils/intmap.h"
 #include "android/utils/system.h"
-#include "android/utils/duff.h"
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 /* We implement the map as two parallel arrays.
  *
  * One array for the integer keys, and the other one
- * for the corresponding pointers.
+ * for the corresponding pointers. Items are stored densely
+ * in these arrays, which is what the iterator walks.
  *
- * A more sophisticated implementation will probably be
- * needed in the case where we would need to store a large
- * number of items in the map.
+ * Lookups go through an open-addressing hash table with linear
+ * probing, whose slots contain 1 + the index of an item in the
+ * arrays above, or 0 for empty slots. Deletions use backward-shift
+ * so that no tombstones are needed.
  */
 
 struct AIntMap {
-    int     size;
-    int     capacity;
-    int*    keys;
-    void**  values;
+    int       size;
+    int       capacity;
+    int*      keys;
+    void**    values;
+    unsigned  slotMask;
+    int*      slots;
 
 #define INIT_CAPACITY  8
+#define INIT_SLOTS     (2*INIT_CAPACITY)
     int     keys0[INIT_CAPACITY];
     void*   values0[INIT_CAPACITY];
+    int     slots0[INIT_SLOTS];
 };
 
 AIntMap*
@@ -43,9 +50,11 @@ aintMap_new(void)
 
     ANEW0(map);
     map->size     = 0;
-    map->capacity = 4;
+    map->capacity = INIT_CAPACITY;
     map->keys     = map->keys0;
     map->values   = map->values0;
+    map->slots    = map->slots0;
+    map->slotMask = INIT_SLOTS - 1;
 
     return map;
 }
@@ -58,6 +67,8 @@ aintMap_free( AIntMap*  map )
             AFREE(map->keys);
         if (map->values != map->values0)
             AFREE(map->values);
+        if (map->slots != map->slots0)
+            AFREE(map->slots);
 
         map->size = 0;
         map->capacity = 0;
@@ -71,6 +82,38 @@ aintMap_getCount( AIntMap* map )
     return map->size;
 }
 
+static unsigned
+aintMap_hash( int  key )
+{
+    /* Knuth's multiplicative hash, keep the high bits */
+    uint32_t  h = (uint32_t)key * 2654435761U;
+    return h ^ (h >> 16);
+}
+
+/* Return the slot that contains 'key', or the empty slot
+ * where it should be inserted.
+ */
+static int*
+aintMap_lookup( AIntMap*  map, int  key )
+{
+    unsigned  index = aintMap_hash(key) & map->slotMask;
+
+    for (;;) {
+        int*  slot = &map->slots[index];
+
+        if (*slot == 0 || map->keys[*slot - 1] == key)
+            return slot;
+
+        index = (index + 1) & map->slotMask;
+    }
+}
+
+int
+aintMap_has( AIntMap*  map, int  key )
+{
+    return *aintMap_lookup(map, key) != 0;
+}
+
 void*
 aintMap_get( AIntMap*  map, int  key )
 {
@@ -80,17 +123,12 @@ aintMap_get( AIntMap*  map, int  key )
 void*
 aintMap_getWithDefault( AIntMap*  map, int key, void*  def )
 {
-    int  limit   = map->size + 1;
-    int  index   = 0;
-    int* keys    = map->keys;
-
-    index = 0;
-    DUFF4(limit,{
-        if (keys[index] == key)
-            return map->values[index];
-        index++;
-    });
-    return def;
+    int  slot = *aintMap_lookup(map, key);
+
+    if (slot == 0)
+        return def;
+
+    return map->values[slot - 1];
 }
 
 static void
@@ -98,14 +136,23 @@ aintMap_grow( AIntMap* map )
 {
     int   oldCapacity = map->capacity;
     int   newCapacity;
-    void* keys = map->keys;
-    void* values = map->values;
+    int*    keys = map->keys;
+    void**  values = map->values;
+    int*    slots = map->slots;
+    unsigned  numSlots;
+    int   nn;
 
-    if (keys == map->keys0)
+    if (keys == map->keys0) {
         keys = NULL;
+        AARRAY_RENEW(keys, oldCapacity);
+        memcpy(keys, map->keys0, sizeof(map->keys0));
+    }
 
-    if (values == map->values0)
+    if (values == map->values0) {
         values = NULL;
+        AARRAY_RENEW(values, oldCapacity);
+        memcpy(values, map->values0, sizeof(map->values0));
+    }
 
     if (oldCapacity < 256)
         newCapacity = oldCapacity*2;
@@ -118,68 +165,96 @@ aintMap_grow( AIntMap* map )
     map->keys = keys;
     map->values = values;
     map->capacity = newCapacity;
+
+    /* Keep the load factor of the hash table under 1/2 */
+    numSlots = map->slotMask + 1;
+    if ((unsigned)newCapacity*2 <= numSlots)
+        return;
+
+    while ((unsigned)newCapacity*2 > numSlots)
+        numSlots *= 2;
+
+    if (slots != map->slots0)
+        AFREE(slots);
+
+    AARRAY_NEW0(map->slots, numSlots);
+    map->slotMask = numSlots - 1;
+
+    for (nn = 0; nn < map->size; nn++)
+        *aintMap_lookup(map, map->keys[nn]) = nn + 1;
 }
 
 
 void*
 aintMap_set( AIntMap* map, int key, void* value )
 {
-    int  index, limit;
-    int* keys;
-    void* result = NULL;
-
-    /* First, try to find the item in our heap */
-    keys  = map->keys;
-    limit = map->size;
-    index = 0;
-    DUFF4(limit,{
-        if (keys[index] == key)
-            goto FOUND;
-        index++;
-    });
+    int*  slot = aintMap_lookup(map, key);
+    void* result;
+    int   index;
+
+    if (*slot != 0) {
+        index  = *slot - 1;
+        result = map->values[index];
+        map->values[index] = value;
+        return result;
+    }
 
     /* Not found, need to add it */
-    if (map->size >= map->capacity)
+    if (map->size >= map->capacity) {
         aintMap_grow(map);
+        slot = aintMap_lookup(map, key);
+    }
 
-    map->keys[limit]   = key;
-    map->values[limit] = value;
-    map->size ++;
-    return NULL;
-
-FOUND:
-    result = map->values[index];
+    index = map->size++;
+    map->keys[index]   = key;
     map->values[index] = value;
-    return result;
+    *slot = index + 1;
+    return NULL;
 }
 
 
 void*
 aintMap_del( AIntMap* map, int key )
 {
-    int  index, limit;
-    int* keys;
-    void* result = NULL;
-
-    keys  = map->keys;
-    limit = map->size;
-    index = 0;
-    DUFF4(limit,{
-        if (keys[index] == key);
-            goto FOUND;
-        index++;
-    });
-    return NULL;
+    int*      slot = aintMap_lookup(map, key);
+    unsigned  hole, next;
+    int       index, last;
+    void*     result;
+
+    if (*slot == 0)
+        return NULL;
 
-FOUND:
+    index  = *slot - 1;
     result = map->values[index];
-    if (index+1 < limit) {
-        /* Move last item to 'index' */
-        --limit;
-        map->keys[index] = map->keys[limit];
-        map->values[index] = map->values[limit];
+
+    /* Backward-shift the following entries of the probe sequence
+     * into the hole, unless that would move them before their
+     * home slot.
+     */
+    hole = slot - map->slots;
+    next = hole;
+    for (;;) {
+        unsigned  home;
+
+        next = (next + 1) & map->slotMask;
+        if (map->slots[next] == 0)
+            break;
+
+        home = aintMap_hash(map->keys[map->slots[next] - 1]) & map->slotMask;
+        if (((next - home) & map->slotMask) >= ((next - hole) & map->slotMask)) {
+            map->slots[hole] = map->slots[next];
+            hole = next;
+        }
+    }
+    map->slots[hole] = 0;
+
+    /* Move last item to 'index' */
+    last = --map->size;
+    if (index < last) {
+        map->keys[index]   = map->keys[last];
+        map->values[index] = map->values[last];
+        *aintMap_lookup(map, map->keys[index]) = index + 1;
     }
-    map->size -= 1;
     return result;
 }
 
@@ -0,0 +1,96 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/intmap.h"
+
+#include <stddef.h>
+
+#include <gtest/gtest.h>
+
+static void* intToPtr(int value) {
+    return reinterpret_cast<void*>(static_cast<ptrdiff_t>(value));
+}
+
+TEST(AIntMap, Empty) {
+    AIntMap* map = aintMap_new();
+    EXPECT_EQ(0, aintMap_getCount(map));
+    EXPECT_FALSE(aintMap_has(map, 0));
+    EXPECT_FALSE(aintMap_get(map, 42));
+    EXPECT_EQ(intToPtr(7), aintMap_getWithDefault(map, 42, intToPtr(7)));
+    EXPECT_FALSE(aintMap_del(map, 42));
+    aintMap_free(map);
+}
+
+TEST(AIntMap, SetGetReplace) {
+    AIntMap* map = aintMap_new();
+    EXPECT_FALSE(aintMap_set(map, 10, intToPtr(100)));
+    EXPECT_FALSE(aintMap_set(map, -3, NULL));
+    EXPECT_EQ(2, aintMap_getCount(map));
+
+    EXPECT_EQ(intToPtr(100), aintMap_get(map, 10));
+    // NULL is a valid value.
+    EXPECT_TRUE(aintMap_has(map, -3));
+    EXPECT_FALSE(aintMap_getWithDefault(map, -3, intToPtr(1)));
+
+    EXPECT_EQ(intToPtr(100), aintMap_set(map, 10, intToPtr(101)));
+    EXPECT_EQ(intToPtr(101), aintMap_get(map, 10));
+    EXPECT_EQ(2, aintMap_getCount(map));
+    aintMap_free(map);
+}
+
+TEST(AIntMap, ManyItemsAndDeletions) {
+    const int kCount = 5000;
+    AIntMap* map = aintMap_new();
+    for (int n = 0; n < kCount; ++n) {
+        // Spread keys so that some of them collide in the hash table.
+        EXPECT_FALSE(aintMap_set(map, n * 1024, intToPtr(n + 1)));
+    }
+    EXPECT_EQ(kCount, aintMap_getCount(map));
+
+    for (int n = 0; n < kCount; n += 2) {
+        EXPECT_EQ(intToPtr(n + 1), aintMap_del(map, n * 1024));
+    }
+    EXPECT_EQ(kCount / 2, aintMap_getCount(map));
+
+    for (int n = 0; n < kCount; ++n) {
+        if (n & 1) {
+            EXPECT_EQ(intToPtr(n + 1), aintMap_get(map, n * 1024)) << n;
+        } else {
+            EXPECT_FALSE(aintMap_has(map, n * 1024)) << n;
+        }
+    }
+    aintMap_free(map);
+}
+
+TEST(AIntMap, Iteration) {
+    AIntMap* map = aintMap_new();
+    int sum = 0;
+    for (int n = 1; n <= 100; ++n) {
+        aintMap_set(map, n, intToPtr(n));
+        sum += n;
+    }
+    aintMap_del(map, 50);
+    sum -= 50;
+
+    int count = 0;
+    AIntMapIterator iter[1];
+    aintMapIterator_init(iter, map);
+    while (aintMapIterator_next(iter)) {
+        EXPECT_EQ(intToPtr(iter->key), iter->value);
+        sum -= iter->key;
+        count++;
+    }
+    aintMapIterator_done(iter);
+
+    EXPECT_EQ(99, count);
+    EXPECT_EQ(0, sum);
+    aintMap_free(map);
+}
@@ -0,0 +1,158 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// Compares the hashed AIntMap and IniFile lookups against the linear
+// scans they replaced. Run with emulator_benchmarks.
+
+#include "android/utils/intmap.h"
+#include "android/utils/ini.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const int kLookups = 2000000;
+const int kMaxKeys = 512;
+
+double elapsedNs(clock_t start, int count) {
+    return (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / count;
+}
+
+void* intToPtr(int value) {
+    return reinterpret_cast<void*>(static_cast<ptrdiff_t>(value));
+}
+
+// The previous AIntMap lookup: a linear scan over the keys array.
+class LinearIntMap {
+public:
+    LinearIntMap() : mCount(0) {}
+    void set(int key, void* value) {
+        mKeys[mCount] = key;
+        mValues[mCount] = value;
+        mCount++;
+    }
+    void* get(int key) const {
+        for (int n = 0; n < mCount; ++n) {
+            if (mKeys[n] == key)
+                return mValues[n];
+        }
+        return NULL;
+    }
+private:
+    int mCount;
+    int mKeys[kMaxKeys];
+    void* mValues[kMaxKeys];
+};
+
+// The previous IniFile lookup: a strcmp() over each pair in order.
+class LinearIniFile {
+public:
+    explicit LinearIniFile(IniFile* ini) : mCount(iniFile_getPairCount(ini)) {
+        for (int n = 0; n < mCount; ++n) {
+            iniFile_getEntry(ini, n, &mKeys[n], &mValues[n]);
+        }
+    }
+    ~LinearIniFile() {
+        for (int n = 0; n < mCount; ++n) {
+            free(mKeys[n]);
+            free(mValues[n]);
+        }
+    }
+    const char* get(const char* key) const {
+        for (int n = 0; n < mCount; ++n) {
+            if (!strcmp(mKeys[n], key))
+                return mValues[n];
+        }
+        return NULL;
+    }
+private:
+    int mCount;
+    char* mKeys[kMaxKeys];
+    char* mValues[kMaxKeys];
+};
+
+}  // namespace
+
+TEST(LookupBenchmark, AIntMap) {
+    static const int kSizes[] = { 8, 64, 512 };
+    for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s) {
+        const int size = kSizes[s];
+        AIntMap* map = aintMap_new();
+        LinearIntMap linear;
+        for (int n = 0; n < size; ++n) {
+            aintMap_set(map, n * 7, intToPtr(n + 1));
+            linear.set(n * 7, intToPtr(n + 1));
+        }
+
+        // Half of the lookups miss.
+        size_t check = 0;
+        clock_t start = clock();
+        for (int n = 0; n < kLookups; ++n) {
+            check += (size_t)aintMap_get(map, (n % (2 * size)) * 7);
+        }
+        double hashed = elapsedNs(start, kLookups);
+
+        size_t checkLinear = 0;
+        start = clock();
+        for (int n = 0; n < kLookups; ++n) {
+            checkLinear += (size_t)linear.get((n % (2 * size)) * 7);
+        }
+        double scanned = elapsedNs(start, kLookups);
+
+        EXPECT_EQ(checkLinear, check);
+        printf("AIntMap  %4d keys: hashed %7.1f ns/lookup, linear %7.1f ns/lookup\n",
+               size, hashed, scanned);
+        aintMap_free(map);
+    }
+}
+
+TEST(LookupBenchmark, IniFile) {
+    static const int kSizes[] = { 16, 128, 512 };
+    for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s) {
+        const int size = kSizes[s];
+        IniFile* ini = iniFile_newFromMemory("", NULL);
+        static char keys[2 * kMaxKeys][64];
+        const int numKeys = 2 * size;
+        for (int n = 0; n < size; ++n) {
+            // Keys sharing a long prefix, like hardware-properties.ini ones,
+            // half of the lookups miss.
+            snprintf(keys[2 * n], sizeof(keys[0]), "hw.sensors.property.%d", n);
+            snprintf(keys[2 * n + 1], sizeof(keys[0]), "hw.sensors.missing.%d", n);
+            iniFile_setInteger(ini, keys[2 * n], n);
+        }
+        LinearIniFile linear(ini);
+
+        size_t check = 0;
+        clock_t start = clock();
+        for (int n = 0; n < kLookups; ++n) {
+            check += iniFile_getValue(ini, keys[n % numKeys]) != NULL;
+        }
+        double hashed = elapsedNs(start, kLookups);
+
+        size_t checkLinear = 0;
+        start = clock();
+        for (int n = 0; n < kLookups; ++n) {
+            checkLinear += linear.get(keys[n % numKeys]) != NULL;
+        }
+        double scanned = elapsedNs(start, kLookups);
+
+        EXPECT_EQ(checkLinear, check);
+        printf("IniFile  %4d keys: hashed %7.1f ns/lookup, linear %7.1f ns/lookup\n",
+               size, hashed, scanned);
+        iniFile_free(ini);
+    }
+}
@@ -0,0 +1,144 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/packet_pool.h"
+
+#include "android/utils/system.h"
+
+#include <string.h>
+
+// Each buffer is preceded by a 16-byte header, which keeps the buffers
+// as aligned as the slabs returned by malloc().
+struct PacketPoolBlock {
+    union {
+        struct {
+            PacketPoolBlock*  next;     // Next free block of the class.
+            uint32_t          klass;    // PACKET_POOL_NUM_CLASSES if large.
+            uint32_t          size;     // Allocated size, if large.
+        } link;
+        uint8_t  pad[16];
+    } u;
+};
+
+struct PacketPoolSlab {
+    union {
+        PacketPoolSlab*  next;
+        uint8_t          pad[16];
+    } u;
+};
+
+// Usable size of each class, and number of buffers per slab: small
+// classes get large slabs, the 64 KB one is for aggregated frames, which
+// are rare.
+static const uint32_t kClassSize[PACKET_POOL_NUM_CLASSES] = {
+    256, 2048, 16384, 69632,
+};
+
+static const uint32_t kClassSlab[PACKET_POOL_NUM_CLASSES] = {
+    64, 16, 4, 1,
+};
+
+static int packetPool_classFor(size_t size) {
+    int klass;
+
+    for (klass = 0; klass < PACKET_POOL_NUM_CLASSES; klass++) {
+        if (size <= kClassSize[klass]) {
+            return klass;
+        }
+    }
+    return PACKET_POOL_NUM_CLASSES;
+}
+
+// Add a slab of buffers of |klass| to the free list.
+static void packetPool_grow(PacketPool* pool, int klass) {
+    size_t stride = sizeof(PacketPoolBlock) + kClassSize[klass];
+    size_t size = sizeof(PacketPoolSlab) + stride * kClassSlab[klass];
+    PacketPoolSlab* slab = android_alloc(size);
+    uint8_t* p = (uint8_t*)(slab + 1);
+    uint32_t n;
+
+    slab->u.next = pool->slabs;
+    pool->slabs = slab;
+    pool->stats.mallocs++;
+    pool->stats.bytes += size;
+
+    for (n = 0; n < kClassSlab[klass]; n++, p += stride) {
+        PacketPoolBlock* block = (PacketPoolBlock*)p;
+        block->u.link.klass = klass;
+        block->u.link.size = 0;
+        block->u.link.next = pool->free[klass];
+        pool->free[klass] = block;
+    }
+}
+
+void packetPool_init(PacketPool* pool) {
+    memset(pool, 0, sizeof(*pool));
+    packetPool_grow(pool, 0);
+    packetPool_grow(pool, 1);
+}
+
+void packetPool_done(PacketPool* pool) {
+    while (pool->slabs) {
+        PacketPoolSlab* slab = pool->slabs;
+        pool->slabs = slab->u.next;
+        android_free(slab);
+    }
+    memset(pool, 0, sizeof(*pool));
+}
+
+void* packetPool_alloc(PacketPool* pool, size_t size) {
+    int klass = packetPool_classFor(size);
+    PacketPoolBlock* block;
+
+    if (klass == PACKET_POOL_NUM_CLASSES) {
+        block = android_alloc(sizeof(*block) + size);
+        block->u.link.klass = klass;
+        block->u.link.size = (uint32_t)size;
+        pool->stats.mallocs++;
+        pool->stats.bytes += sizeof(*block) + size;
+    } else {
+        if (!pool->free[klass]) {
+            packetPool_grow(pool, klass);
+        }
+        block = pool->free[klass];
+        pool->free[klass] = block->u.link.next;
+    }
+    block->u.link.next = NULL;
+
+    pool->stats.allocs++;
+    if (++pool->stats.in_use > pool->stats.high_water) {
+        pool->stats.high_water = pool->stats.in_use;
+    }
+    return block + 1;
+}
+
+void packetPool_free(PacketPool* pool, void* buffer) {
+    PacketPoolBlock* block;
+    uint32_t klass;
+
+    if (!buffer) {
+        return;
+    }
+    block = (PacketPoolBlock*)buffer - 1;
+    klass = block->u.link.klass;
+    pool->stats.in_use--;
+    if (klass == PACKET_POOL_NUM_CLASSES) {
+        pool->stats.bytes -= sizeof(*block) + block->u.link.size;
+        android_free(block);
+        return;
+    }
+    block->u.link.next = pool->free[klass];
+    pool->free[klass] = block;
+}
+
+void packetPool_getStats(const PacketPool* pool, PacketPoolStats* stats) {
+    *stats = pool->stats;
+}
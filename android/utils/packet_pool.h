@@ -0,0 +1,70 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_PACKET_POOL_H
+#define ANDROID_UTILS_PACKET_POOL_H
+
+#include "android/utils/compiler.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+// A pool of packet buffers, for queues that hold many short-lived frames,
+// e.g. the send queue of a VLAN.
+//
+// Requests are rounded up to one of a few size classes. Each class keeps
+// a free list of released buffers, refilled by carving slabs of several
+// buffers at once, so that queueing a packet rarely reaches malloc().
+// Memory is only given back by packetPool_done(). Requests larger than
+// the largest class are served by malloc() directly.
+
+// Number of size classes: 256, 2048, 16384 and 69632 bytes.
+#define PACKET_POOL_NUM_CLASSES  4
+
+typedef struct {
+    uint64_t  allocs;       // Buffers handed out.
+    uint64_t  mallocs;      // Calls to malloc(), for slabs or large
+                            // buffers.
+    uint32_t  in_use;       // Buffers currently handed out.
+    uint32_t  high_water;   // Largest value of |in_use|.
+    uint64_t  bytes;        // Memory currently allocated by the pool.
+} PacketPoolStats;
+
+typedef struct PacketPoolBlock PacketPoolBlock;
+typedef struct PacketPoolSlab PacketPoolSlab;
+
+typedef struct {
+    PacketPoolBlock*  free[PACKET_POOL_NUM_CLASSES];
+    PacketPoolSlab*   slabs;
+    PacketPoolStats   stats;
+} PacketPool;
+
+// Initialize |pool| and preallocate one slab of the small classes.
+void packetPool_init(PacketPool* pool);
+
+// Release all memory of |pool|. All its buffers must have been freed.
+void packetPool_done(PacketPool* pool);
+
+// Return a buffer of at least |size| bytes, aligned like the memory
+// returned by malloc(). Aborts if memory is exhausted.
+void* packetPool_alloc(PacketPool* pool, size_t size);
+
+// Give back a buffer returned by packetPool_alloc(). |buffer| can be NULL.
+void packetPool_free(PacketPool* pool, void* buffer);
+
+// Fill |stats| with the counters of |pool|.
+void packetPool_getStats(const PacketPool* pool, PacketPoolStats* stats);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_PACKET_POOL_H
@@ -0,0 +1,104 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/packet_pool.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+class PacketPoolTest : public ::testing::Test {
+protected:
+    virtual void SetUp() { packetPool_init(&mPool); }
+    virtual void TearDown() { packetPool_done(&mPool); }
+
+    PacketPoolStats stats() {
+        PacketPoolStats result;
+        packetPool_getStats(&mPool, &result);
+        return result;
+    }
+
+    PacketPool mPool;
+};
+
+}  // namespace
+
+TEST_F(PacketPoolTest, Preallocated) {
+    // The two small classes are ready.
+    EXPECT_EQ(2U, stats().mallocs);
+    void* small = packetPool_alloc(&mPool, 60);
+    void* frame = packetPool_alloc(&mPool, 1514);
+    EXPECT_EQ(2U, stats().mallocs);
+    EXPECT_EQ(2U, stats().allocs);
+    EXPECT_EQ(2U, stats().in_use);
+    memset(small, 0x11, 60);
+    memset(frame, 0x22, 1514);
+    packetPool_free(&mPool, small);
+    packetPool_free(&mPool, frame);
+    EXPECT_EQ(0U, stats().in_use);
+    EXPECT_EQ(2U, stats().high_water);
+}
+
+TEST_F(PacketPoolTest, Reuse) {
+    void* first = packetPool_alloc(&mPool, 100);
+    packetPool_free(&mPool, first);
+    for (int n = 0; n < 1000; ++n) {
+        void* buffer = packetPool_alloc(&mPool, 100 + n % 150);
+        EXPECT_EQ(first, buffer);
+        packetPool_free(&mPool, buffer);
+    }
+    EXPECT_EQ(2U, stats().mallocs);
+    EXPECT_EQ(1001U, stats().allocs);
+}
+
+TEST_F(PacketPoolTest, Grow) {
+    std::vector<void*> buffers;
+    for (int n = 0; n < 1000; ++n) {
+        void* buffer = packetPool_alloc(&mPool, 64);
+        // Aligned, and not overlapping the previous one.
+        EXPECT_EQ(0U, (uintptr_t)buffer % sizeof(void*));
+        memset(buffer, n, 256);
+        buffers.push_back(buffer);
+    }
+    for (size_t n = 0; n < buffers.size(); ++n) {
+        EXPECT_EQ((uint8_t)n, ((uint8_t*)buffers[n])[255]);
+    }
+    // Slabs of several buffers.
+    EXPECT_LT(stats().mallocs, 20U);
+    EXPECT_EQ(1000U, stats().high_water);
+    for (size_t n = 0; n < buffers.size(); ++n) {
+        packetPool_free(&mPool, buffers[n]);
+    }
+    EXPECT_EQ(0U, stats().in_use);
+}
+
+TEST_F(PacketPoolTest, Large) {
+    const uint64_t bytes = stats().bytes;
+    void* jumbo = packetPool_alloc(&mPool, 65536);
+    void* huge = packetPool_alloc(&mPool, 100000);
+    memset(jumbo, 1, 65536);
+    memset(huge, 2, 100000);
+    EXPECT_EQ(4U, stats().mallocs);
+    EXPECT_GT(stats().bytes, bytes + 165536);
+
+    packetPool_free(&mPool, huge);
+    packetPool_free(&mPool, jumbo);
+    packetPool_free(&mPool, NULL);
+    // The largest class is kept, but not oversized buffers.
+    EXPECT_LT(stats().bytes, bytes + 100000);
+    EXPECT_EQ(jumbo, packetPool_alloc(&mPool, 4000 * 16));
+    EXPECT_EQ(4U, stats().mallocs);
+}
@@ -0,0 +1,345 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/pcap_writer.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PCAP_MAGIC     0xa1b2c3d4
+#define PCAP_MAJOR     2
+#define PCAP_MINOR     4
+#define PCAP_ETHERNET  1
+
+// Default number of files in ring mode.
+#define PCAP_RING_FILES  4
+
+// Each file is written through a large stdio buffer, the writer is
+// expected to run on a thread of its own.
+#define PCAP_FILE_BUFFER  (256 * 1024)
+
+typedef struct {
+    uint32_t  magic;
+    uint16_t  version_major;
+    uint16_t  version_minor;
+    int32_t   this_zone;
+    uint32_t  sigfigs;
+    uint32_t  snaplen;
+    uint32_t  network;
+} PcapFileHeader;
+
+// Also the header of each packet in a PcapQueue.
+typedef struct {
+    uint32_t  ts_sec;
+    uint32_t  ts_usec;
+    uint32_t  incl_len;
+    uint32_t  orig_len;
+} PcapPacketHeader;
+
+static uint32_t pcapSnaplen(uint32_t snaplen) {
+    if (snaplen == 0 || snaplen > PCAP_WRITER_MAX_SNAPLEN) {
+        return PCAP_WRITER_MAX_SNAPLEN;
+    }
+    return snaplen;
+}
+
+// Parse |value| as a positive number. Return 0 on success, -1 otherwise.
+static int pcapParseNumber(const char* value, uint32_t* result) {
+    char* end;
+    unsigned long n;
+
+    errno = 0;
+    n = strtoul(value, &end, 10);
+    if (errno || end == value || *end != '\0' || n == 0 || n > UINT32_MAX) {
+        return -1;
+    }
+    *result = (uint32_t)n;
+    return 0;
+}
+
+int pcapWriter_parseSpec(const char* spec, char** path,
+                         PcapWriterConfig* config) {
+    const char* comma = strchr(spec, ',');
+    size_t pathLen = comma ? (size_t)(comma - spec) : strlen(spec);
+    uint32_t sizeMb = 0;
+    uint32_t ringMb = 0;
+    char option[64];
+
+    memset(config, 0, sizeof(*config));
+    if (pathLen == 0) {
+        return -1;
+    }
+
+    while (comma) {
+        const char* start = comma + 1;
+        size_t len;
+        char* value;
+        uint32_t n;
+
+        comma = strchr(start, ',');
+        len = comma ? (size_t)(comma - start) : strlen(start);
+        if (len >= sizeof(option)) {
+            return -1;
+        }
+        memcpy(option, start, len);
+        option[len] = '\0';
+        value = strchr(option, '=');
+        if (!value) {
+            return -1;
+        }
+        *value++ = '\0';
+        if (pcapParseNumber(value, &n) < 0) {
+            return -1;
+        }
+        if (!strcmp(option, "size") && n < 4096) {
+            sizeMb = n;
+        } else if (!strcmp(option, "time")) {
+            config->rotate_secs = n;
+        } else if (!strcmp(option, "files")) {
+            config->max_files = n;
+        } else if (!strcmp(option, "ring") && n < 4096) {
+            ringMb = n;
+        } else if (!strcmp(option, "snaplen") &&
+                   n <= PCAP_WRITER_MAX_SNAPLEN) {
+            config->snaplen = n;
+        } else {
+            return -1;
+        }
+    }
+
+    if (ringMb) {
+        if (sizeMb) {
+            return -1;
+        }
+        if (!config->max_files) {
+            config->max_files = PCAP_RING_FILES;
+        }
+        config->rotate_size = ((uint64_t)ringMb << 20) / config->max_files;
+    } else {
+        config->rotate_size = (uint64_t)sizeMb << 20;
+    }
+
+    *path = malloc(pathLen + 1);
+    memcpy(*path, spec, pathLen);
+    (*path)[pathLen] = '\0';
+    return 0;
+}
+
+void pcapWriter_filePath(const PcapWriter* writer, uint32_t index,
+                         char* buffer, size_t size) {
+    if (index == 0) {
+        snprintf(buffer, size, "%s", writer->path);
+    } else {
+        snprintf(buffer, size, "%s.%u", writer->path, index);
+    }
+}
+
+// Create file |index| of |writer| and write its header.
+static int pcapWriter_startFile(PcapWriter* writer, uint32_t index) {
+    size_t size = strlen(writer->path) + 16;
+    char* path = malloc(size);
+    PcapFileHeader h;
+    FILE* file;
+
+    pcapWriter_filePath(writer, index, path, size);
+    file = fopen(path, "wb");
+    free(path);
+    if (!file) {
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, PCAP_FILE_BUFFER);
+
+    h.magic         = PCAP_MAGIC;
+    h.version_major = PCAP_MAJOR;
+    h.version_minor = PCAP_MINOR;
+    h.this_zone     = 0;
+    h.sigfigs       = 0;  // all tools set it to 0 in practice
+    h.snaplen       = writer->config.snaplen;
+    h.network       = PCAP_ETHERNET;
+    if (fwrite(&h, sizeof(h), 1, file) != 1) {
+        int err = errno;
+        fclose(file);
+        errno = err;
+        return -1;
+    }
+
+    writer->file = file;
+    writer->index = index;
+    writer->file_size = sizeof(h);
+    writer->file_packets = 0;
+    writer->files++;
+    return 0;
+}
+
+int pcapWriter_open(PcapWriter* writer, const char* path,
+                    const PcapWriterConfig* config) {
+    memset(writer, 0, sizeof(*writer));
+    writer->config = *config;
+    writer->config.snaplen = pcapSnaplen(config->snaplen);
+    writer->path = malloc(strlen(path) + 1);
+    strcpy(writer->path, path);
+    if (pcapWriter_startFile(writer, 0) < 0) {
+        int err = errno;
+        free(writer->path);
+        writer->path = NULL;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+// Close the current file and start the next one, if the current one is
+// full or too old to take a packet of |caplen| bytes at |sec|.
+static int pcapWriter_rotate(PcapWriter* writer, uint32_t sec,
+                             uint32_t caplen) {
+    const PcapWriterConfig* config = &writer->config;
+    uint32_t index;
+
+    if (writer->file_packets == 0) {
+        return 0;
+    }
+    if (!(config->rotate_size &&
+          writer->file_size + sizeof(PcapPacketHeader) + caplen >
+                  config->rotate_size) &&
+        !(config->rotate_secs && sec - writer->file_start >=
+                                         config->rotate_secs)) {
+        return 0;
+    }
+    fclose(writer->file);
+    writer->file = NULL;
+    index = writer->index + 1;
+    if (config->max_files && index >= config->max_files) {
+        index = 0;
+    }
+    return pcapWriter_startFile(writer, index);
+}
+
+// Write a packet whose stored bytes are split in two runs.
+static int pcapWriter_writeRuns(PcapWriter* writer, uint32_t sec,
+                                uint32_t usec, const void* data1,
+                                uint32_t len1, const void* data2,
+                                uint32_t len2, uint32_t len) {
+    PcapPacketHeader h;
+    uint32_t caplen = len1 + len2;
+
+    if (caplen > writer->config.snaplen) {
+        caplen = writer->config.snaplen;
+        if (len1 > caplen) {
+            len1 = caplen;
+        }
+        len2 = caplen - len1;
+    }
+    if (!writer->file) {
+        errno = EBADF;
+        return -1;
+    }
+    if (pcapWriter_rotate(writer, sec, caplen) < 0) {
+        return -1;
+    }
+    if (writer->file_packets == 0) {
+        writer->file_start = sec;
+    }
+
+    h.ts_sec   = sec;
+    h.ts_usec  = usec;
+    h.incl_len = caplen;
+    h.orig_len = len;
+    if (fwrite(&h, sizeof(h), 1, writer->file) != 1 ||
+        (len1 && fwrite(data1, len1, 1, writer->file) != 1) ||
+        (len2 && fwrite(data2, len2, 1, writer->file) != 1)) {
+        return -1;
+    }
+    writer->file_size += sizeof(h) + caplen;
+    writer->file_packets++;
+    writer->packets++;
+    writer->bytes += caplen;
+    return 0;
+}
+
+int pcapWriter_write(PcapWriter* writer, uint32_t sec, uint32_t usec,
+                     const void* data, uint32_t caplen, uint32_t len) {
+    return pcapWriter_writeRuns(writer, sec, usec, data, caplen, NULL, 0,
+                                len);
+}
+
+void pcapWriter_flush(PcapWriter* writer) {
+    if (writer->file) {
+        fflush(writer->file);
+    }
+}
+
+void pcapWriter_close(PcapWriter* writer) {
+    if (writer->file) {
+        fclose(writer->file);
+        writer->file = NULL;
+    }
+    free(writer->path);
+    writer->path = NULL;
+}
+
+void pcapQueue_init(PcapQueue* queue, uint32_t capacity, uint32_t snaplen) {
+    ringBuffer_init(&queue->ring, capacity, capacity);
+    queue->snaplen = pcapSnaplen(snaplen);
+}
+
+void pcapQueue_done(PcapQueue* queue) {
+    ringBuffer_done(&queue->ring);
+}
+
+int pcapQueue_put(PcapQueue* queue, uint32_t sec, uint32_t usec,
+                  const void* data, uint32_t len) {
+    PcapPacketHeader h;
+
+    h.ts_sec   = sec;
+    h.ts_usec  = usec;
+    h.incl_len = len < queue->snaplen ? len : queue->snaplen;
+    h.orig_len = len;
+    if (ringBuffer_space(&queue->ring) < sizeof(h) + h.incl_len) {
+        return -1;
+    }
+    ringBuffer_write(&queue->ring, &h, sizeof(h));
+    ringBuffer_write(&queue->ring, data, h.incl_len);
+    return 0;
+}
+
+int pcapQueue_drain(PcapQueue* queue, PcapWriter* writer) {
+    RingBuffer* ring = &queue->ring;
+    int count = 0;
+
+    while (ringBuffer_count(ring) > 0) {
+        PcapPacketHeader h;
+        const uint8_t* data1;
+        const uint8_t* data2 = NULL;
+        uint32_t len1;
+        uint32_t len2 = 0;
+        int ret;
+
+        ringBuffer_read(ring, &h, sizeof(h));
+        len1 = ringBuffer_peek(ring, &data1);
+        if (len1 >= h.incl_len) {
+            len1 = h.incl_len;
+        } else {
+            // The packet wraps around the end of the ring.
+            data2 = ring->data;
+            len2 = h.incl_len - len1;
+        }
+        ret = pcapWriter_writeRuns(writer, h.ts_sec, h.ts_usec, data1, len1,
+                                   data2, len2, h.orig_len);
+        ringBuffer_consume(ring, h.incl_len);
+        if (ret < 0) {
+            ringBuffer_consume(ring, ringBuffer_count(ring));
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,122 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_PCAP_WRITER_H
+#define ANDROID_UTILS_PCAP_WRITER_H
+
+#include "android/utils/compiler.h"
+#include "android/utils/ring_buffer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+ANDROID_BEGIN_HEADER
+
+// Writing of network captures in libpcap format, see
+// http://wiki.wireshark.org/Development/LibpcapFileFormat
+//
+// A PcapWriter stores packets into a file, or a sequence of files: a new
+// one is started when the current one reaches a size or an age. Files
+// are named <path>, then <path>.1, <path>.2, etc. With a maximum number
+// of files, the numbers wrap around and the oldest file is overwritten,
+// so that only the most recent packets are kept.
+//
+// A PcapQueue holds packets on their way to a PcapWriter in a buffer of
+// bounded size, dropping those that don't fit. Neither is thread-safe.
+
+#define PCAP_WRITER_MAX_SNAPLEN  65535
+
+typedef struct {
+    uint32_t  snaplen;       // Bytes kept from each packet, at most
+                             // PCAP_WRITER_MAX_SNAPLEN, which 0 means.
+    uint64_t  rotate_size;   // Start a new file past this size, if not 0.
+    uint32_t  rotate_secs;   // Start a new file past this age, if not 0.
+    uint32_t  max_files;     // Overwrite the oldest file past that, if
+                             // not 0.
+} PcapWriterConfig;
+
+typedef struct {
+    PcapWriterConfig  config;
+    char*             path;
+    FILE*             file;
+    uint32_t          index;        // Of the current file.
+    uint64_t          file_size;    // Bytes in the current file.
+    uint32_t          file_start;   // Time of its first packet.
+    uint64_t          file_packets;
+    uint64_t          packets;      // Packets written, in all files.
+    uint64_t          bytes;        // Packet bytes written, without the
+                                    // pcap headers.
+    uint32_t          files;        // Files started.
+} PcapWriter;
+
+// Parse a capture specification: a file path, optionally followed by
+// comma-separated options:
+//   size=<MB>      start a new file every <MB> megabytes.
+//   time=<secs>    start a new file every <secs> seconds.
+//   files=<n>      keep at most <n> files.
+//   ring=<MB>      keep only the last <MB> megabytes, in files=<n> files
+//                  (4 by default) of <MB>/<n> megabytes each.
+//   snaplen=<n>    keep only the first <n> bytes of each packet.
+// On success, set |*path| to a new string, that the caller must free(),
+// and return 0. Return -1 on error.
+int pcapWriter_parseSpec(const char* spec, char** path,
+                         PcapWriterConfig* config);
+
+// Create the first file of |writer| at |path|. Return 0 on success, or
+// -1 with errno set.
+int pcapWriter_open(PcapWriter* writer, const char* path,
+                    const PcapWriterConfig* config);
+
+// Write a packet of |len| bytes received at |sec|.|usec|, of which the
+// first |caplen| are in |data|. Fewer bytes are stored if the snaplen of
+// |writer| is smaller. Return 0 on success, or -1 with errno set.
+int pcapWriter_write(PcapWriter* writer, uint32_t sec, uint32_t usec,
+                     const void* data, uint32_t caplen, uint32_t len);
+
+// Flush the current file of |writer| to disk.
+void pcapWriter_flush(PcapWriter* writer);
+
+// Close the current file of |writer| and release its resources.
+void pcapWriter_close(PcapWriter* writer);
+
+// Put the path of file |index| of |writer| in |buffer|.
+void pcapWriter_filePath(const PcapWriter* writer, uint32_t index,
+                         char* buffer, size_t size);
+
+typedef struct {
+    RingBuffer  ring;
+    uint32_t    snaplen;
+} PcapQueue;
+
+// Initialize |queue| to hold up to |capacity| bytes of packets, of which
+// it keeps up to |snaplen| bytes each.
+void pcapQueue_init(PcapQueue* queue, uint32_t capacity, uint32_t snaplen);
+
+// Release the memory of |queue|, dropping its packets.
+void pcapQueue_done(PcapQueue* queue);
+
+// Number of bytes used in |queue|.
+static inline uint32_t pcapQueue_count(const PcapQueue* queue) {
+    return ringBuffer_count(&queue->ring);
+}
+
+// Add a packet of |len| bytes received at |sec|.|usec|. Return 0 on
+// success, or -1 if it was dropped because |queue| is full.
+int pcapQueue_put(PcapQueue* queue, uint32_t sec, uint32_t usec,
+                  const void* data, uint32_t len);
+
+// Pass all packets of |queue| to |writer|. Return the number of packets,
+// or -1 if writing one failed, in which case the rest are dropped.
+int pcapQueue_drain(PcapQueue* queue, PcapWriter* writer);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_PCAP_WRITER_H
@@ -0,0 +1,107 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// Measures the cost of packet capture for the emulation thread, as the
+// rate at which it can pass frames to the guest: without capture, with
+// each packet written to the file synchronously, as qemu-tcpdump.c used
+// to, and with packets queued for a capture thread. The capture thread's
+// work is done between batches and not counted, as it runs in parallel.
+// Run with emulator_benchmarks.
+
+#include "android/utils/pcap_writer.h"
+
+#include "android/filesystems/testing/TestSupport.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const int kBatch = 2048;
+const int kBatches = 100;
+const uint32_t kQueueSize = 4 << 20;
+
+enum Mode { kOff, kSync, kAsync };
+
+void measure(Mode mode, int frameSize) {
+    static uint8_t frame[1514];
+    static uint8_t guest[1514];
+    std::string path = android::testing::CreateTempFilePath();
+    PcapWriterConfig config;
+    PcapWriter writer;
+    PcapQueue queue;
+
+    memset(&config, 0, sizeof(config));
+    ASSERT_EQ(0, pcapWriter_open(&writer, path.c_str(), &config));
+    pcapQueue_init(&queue, kQueueSize, 0);
+
+    clock_t spent = 0;
+    for (int batch = 0; batch < kBatches; ++batch) {
+        clock_t start = clock();
+        for (int n = 0; n < kBatch; ++n) {
+            struct timeval now;
+            // Delivery of the frame to the guest.
+            frame[0] = (uint8_t)n;
+            memcpy(guest, frame, frameSize);
+            switch (mode) {
+            case kOff:
+                break;
+            case kSync:
+                gettimeofday(&now, NULL);
+                pcapWriter_write(&writer, now.tv_sec, now.tv_usec, frame,
+                                 frameSize, frameSize);
+                break;
+            case kAsync:
+                gettimeofday(&now, NULL);
+                ASSERT_EQ(0, pcapQueue_put(&queue, now.tv_sec, now.tv_usec,
+                                           frame, frameSize));
+                break;
+            }
+        }
+        spent += clock() - start;
+        // The capture thread.
+        pcapQueue_drain(&queue, &writer);
+        pcapWriter_flush(&writer);
+    }
+    double secs = (double)spent / CLOCKS_PER_SEC;
+    uint64_t packets = writer.packets;
+
+    pcapWriter_close(&writer);
+    pcapQueue_done(&queue);
+    unlink(path.c_str());
+
+    static const char* const kNames[] = { "off", "sync", "async" };
+    const double frames = (double)kBatch * kBatches;
+    printf("%4d-byte frames, capture %-5s: %6.2f Mframes/s, %7.1f MB/s\n",
+           frameSize, kNames[mode], frames / secs / 1e6,
+           frames * frameSize / secs / (1 << 20));
+    if (mode != kOff) {
+        ASSERT_EQ((uint64_t)frames, packets);
+    }
+}
+
+}  // namespace
+
+TEST(PcapWriterBenchmark, Capture) {
+    measure(kOff, 64);
+    measure(kSync, 64);
+    measure(kAsync, 64);
+    measure(kOff, 1514);
+    measure(kSync, 1514);
+    measure(kAsync, 1514);
+}
@@ -0,0 +1,296 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/pcap_writer.h"
+
+#include "android/filesystems/testing/TestSupport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+struct Record {
+    uint32_t sec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+    std::string data;
+};
+
+struct Capture {
+    bool exists;
+    uint32_t snaplen;
+    std::vector<Record> records;
+};
+
+// Parse the pcap file at |path|.
+Capture readCapture(const std::string& path) {
+    Capture capture;
+    capture.exists = false;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return capture;
+    }
+    capture.exists = true;
+    uint32_t header[6];
+    EXPECT_EQ(1U, fread(header, sizeof(header), 1, file));
+    EXPECT_EQ(0xa1b2c3d4U, header[0]);
+    capture.snaplen = header[4];
+    uint32_t h[4];
+    while (fread(h, sizeof(h), 1, file) == 1) {
+        Record record;
+        record.sec = h[0];
+        record.incl_len = h[2];
+        record.orig_len = h[3];
+        record.data.resize(h[2]);
+        if (h[2]) {
+            EXPECT_EQ(1U, fread(&record.data[0], h[2], 1, file));
+        }
+        capture.records.push_back(record);
+    }
+    fclose(file);
+    return capture;
+}
+
+std::string makePacket(size_t len, char seed) {
+    std::string packet(len, 0);
+    for (size_t n = 0; n < len; ++n) {
+        packet[n] = (char)(seed + n);
+    }
+    return packet;
+}
+
+class PcapWriterTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mPath = android::testing::CreateTempFilePath();
+        memset(&mConfig, 0, sizeof(mConfig));
+    }
+
+    virtual void TearDown() {
+        unlink(mPath.c_str());
+        for (int n = 1; n < 10; ++n) {
+            unlink(path(n).c_str());
+        }
+    }
+
+    std::string path(int index) {
+        if (index == 0) {
+            return mPath;
+        }
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), ".%d", index);
+        return mPath + suffix;
+    }
+
+    void open(PcapWriter* writer) {
+        ASSERT_EQ(0, pcapWriter_open(writer, mPath.c_str(), &mConfig));
+    }
+
+    void write(PcapWriter* writer, uint32_t sec, const std::string& packet) {
+        ASSERT_EQ(0, pcapWriter_write(writer, sec, 0, packet.data(),
+                                      packet.size(), packet.size()));
+    }
+
+    std::string mPath;
+    PcapWriterConfig mConfig;
+};
+
+}  // namespace
+
+TEST(PcapWriter, ParseSpec) {
+    PcapWriterConfig config;
+    char* path = NULL;
+
+    ASSERT_EQ(0, pcapWriter_parseSpec("/tmp/net.pcap", &path, &config));
+    EXPECT_STREQ("/tmp/net.pcap", path);
+    EXPECT_EQ(0U, config.snaplen);
+    EXPECT_EQ(0U, config.rotate_size);
+    EXPECT_EQ(0U, config.rotate_secs);
+    EXPECT_EQ(0U, config.max_files);
+    free(path);
+
+    ASSERT_EQ(0, pcapWriter_parseSpec("net.pcap,size=10,time=60,files=5,"
+                                      "snaplen=128", &path, &config));
+    EXPECT_STREQ("net.pcap", path);
+    EXPECT_EQ(128U, config.snaplen);
+    EXPECT_EQ(10U << 20, config.rotate_size);
+    EXPECT_EQ(60U, config.rotate_secs);
+    EXPECT_EQ(5U, config.max_files);
+    free(path);
+
+    ASSERT_EQ(0, pcapWriter_parseSpec("net.pcap,ring=64", &path, &config));
+    EXPECT_EQ(16U << 20, config.rotate_size);
+    EXPECT_EQ(4U, config.max_files);
+    free(path);
+
+    ASSERT_EQ(0, pcapWriter_parseSpec("net.pcap,files=8,ring=64", &path,
+                                      &config));
+    EXPECT_EQ(8U << 20, config.rotate_size);
+    EXPECT_EQ(8U, config.max_files);
+    free(path);
+
+    static const char* const kInvalid[] = {
+        "", ",size=1", "net.pcap,", "net.pcap,size", "net.pcap,size=",
+        "net.pcap,size=x", "net.pcap,size=0", "net.pcap,bogus=1",
+        "net.pcap,ring=4,size=1", "net.pcap,snaplen=70000",
+    };
+    for (size_t n = 0; n < sizeof(kInvalid) / sizeof(kInvalid[0]); ++n) {
+        EXPECT_EQ(-1, pcapWriter_parseSpec(kInvalid[n], &path, &config))
+                << kInvalid[n];
+    }
+}
+
+TEST_F(PcapWriterTest, SingleFile) {
+    PcapWriter writer;
+    mConfig.snaplen = 100;
+    open(&writer);
+    std::string small = makePacket(60, 'a');
+    std::string large = makePacket(1514, 'b');
+    write(&writer, 1, small);
+    write(&writer, 2, large);
+    pcapWriter_close(&writer);
+
+    Capture capture = readCapture(mPath);
+    EXPECT_EQ(100U, capture.snaplen);
+    ASSERT_EQ(2U, capture.records.size());
+    EXPECT_EQ(small, capture.records[0].data);
+    EXPECT_EQ(100U, capture.records[1].incl_len);
+    EXPECT_EQ(1514U, capture.records[1].orig_len);
+    EXPECT_EQ(large.substr(0, 100), capture.records[1].data);
+    EXPECT_EQ(160U, writer.bytes);
+}
+
+TEST_F(PcapWriterTest, RotateBySize) {
+    PcapWriter writer;
+    // Three 100-byte packets per file.
+    mConfig.rotate_size = 24 + 3 * (16 + 100);
+    open(&writer);
+    for (int n = 0; n < 7; ++n) {
+        write(&writer, n, makePacket(100, n));
+    }
+    EXPECT_EQ(3U, writer.files);
+    pcapWriter_close(&writer);
+
+    EXPECT_EQ(3U, readCapture(path(0)).records.size());
+    EXPECT_EQ(3U, readCapture(path(1)).records.size());
+    Capture last = readCapture(path(2));
+    ASSERT_EQ(1U, last.records.size());
+    EXPECT_EQ(makePacket(100, 6), last.records[0].data);
+    EXPECT_FALSE(readCapture(path(3)).exists);
+}
+
+TEST_F(PcapWriterTest, RotateByTime) {
+    PcapWriter writer;
+    mConfig.rotate_secs = 10;
+    open(&writer);
+    write(&writer, 100, makePacket(10, 0));
+    write(&writer, 105, makePacket(10, 1));
+    write(&writer, 110, makePacket(10, 2));
+    write(&writer, 125, makePacket(10, 3));
+    write(&writer, 126, makePacket(10, 4));
+    pcapWriter_close(&writer);
+
+    EXPECT_EQ(2U, readCapture(path(0)).records.size());
+    EXPECT_EQ(1U, readCapture(path(1)).records.size());
+    Capture last = readCapture(path(2));
+    ASSERT_EQ(2U, last.records.size());
+    EXPECT_EQ(125U, last.records[0].sec);
+}
+
+TEST_F(PcapWriterTest, Ring) {
+    PcapWriter writer;
+    mConfig.rotate_size = 24 + 2 * (16 + 100);
+    mConfig.max_files = 3;
+    open(&writer);
+    // Seven files worth of packets, the numbers wrap around twice.
+    for (int n = 0; n < 13; ++n) {
+        write(&writer, n, makePacket(100, n));
+    }
+    EXPECT_EQ(7U, writer.files);
+    pcapWriter_close(&writer);
+
+    // Only the last five packets are left.
+    Capture capture = readCapture(path(0));
+    ASSERT_EQ(1U, capture.records.size());
+    EXPECT_EQ(12U, capture.records[0].sec);
+    capture = readCapture(path(1));
+    ASSERT_EQ(2U, capture.records.size());
+    EXPECT_EQ(8U, capture.records[0].sec);
+    capture = readCapture(path(2));
+    ASSERT_EQ(2U, capture.records.size());
+    EXPECT_EQ(10U, capture.records[0].sec);
+    EXPECT_FALSE(readCapture(path(3)).exists);
+}
+
+TEST_F(PcapWriterTest, Queue) {
+    PcapWriter writer;
+    PcapQueue queue;
+    open(&writer);
+    pcapQueue_init(&queue, 1024, 0);
+
+    // Packets dropped when full.
+    std::string packet = makePacket(300, 'q');
+    int queued = 0;
+    while (pcapQueue_put(&queue, queued, 0, packet.data(),
+                         packet.size()) == 0) {
+        queued++;
+    }
+    EXPECT_EQ(3, queued);
+    EXPECT_EQ(3 * (16 + 300U), pcapQueue_count(&queue));
+    EXPECT_EQ(3, pcapQueue_drain(&queue, &writer));
+    EXPECT_EQ(0U, pcapQueue_count(&queue));
+
+    // Packets that wrap around the end of the buffer.
+    for (int n = 0; n < 20; ++n) {
+        std::string p = makePacket(100 + 37 * n, n);
+        ASSERT_EQ(0, pcapQueue_put(&queue, 100 + n, 0, p.data(), p.size()));
+        EXPECT_EQ(1, pcapQueue_drain(&queue, &writer));
+    }
+    pcapWriter_close(&writer);
+    pcapQueue_done(&queue);
+
+    Capture capture = readCapture(mPath);
+    ASSERT_EQ(23U, capture.records.size());
+    EXPECT_EQ(packet, capture.records[2].data);
+    for (int n = 0; n < 20; ++n) {
+        EXPECT_EQ(100U + n, capture.records[3 + n].sec);
+        EXPECT_EQ(makePacket(100 + 37 * n, n), capture.records[3 + n].data);
+    }
+}
+
+TEST_F(PcapWriterTest, QueueSnaplen) {
+    PcapWriter writer;
+    PcapQueue queue;
+    open(&writer);
+    pcapQueue_init(&queue, 1024, 64);
+
+    std::string packet = makePacket(1514, 's');
+    for (int n = 0; n < 10; ++n) {
+        ASSERT_EQ(0, pcapQueue_put(&queue, n, 0, packet.data(),
+                                   packet.size()));
+    }
+    EXPECT_EQ(10, pcapQueue_drain(&queue, &writer));
+    pcapWriter_close(&writer);
+    pcapQueue_done(&queue);
+
+    Capture capture = readCapture(mPath);
+    ASSERT_EQ(10U, capture.records.size());
+    EXPECT_EQ(packet.substr(0, 64), capture.records[9].data);
+    EXPECT_EQ(1514U, capture.records[9].orig_len);
+}
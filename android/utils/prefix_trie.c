@@ -0,0 +1,140 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/prefix_trie.h"
+
+#include "android/utils/system.h"
+
+// A node for each prefix of the keys. The children of a node are linked
+// in the order of their characters, so that a lookup can stop early.
+// A key is stored on the node of its last character, with its rank,
+// i.e. the number of keys added before it.
+typedef struct {
+    int            first_child;
+    int            next_sibling;
+    unsigned char  c;
+    int            exact_rank;      // -1 if no key ends here.
+    int            exact_value;
+    int            prefix_rank;     // -1 if no prefix key ends here.
+    int            prefix_value;
+} PrefixTrieNode;
+
+struct PrefixTrie {
+    PrefixTrieNode*  nodes;     // The root is nodes[0].
+    int              count;
+    int              capacity;
+    int              keys;
+};
+
+static int prefixTrie_newNode(PrefixTrie* trie, unsigned char c) {
+    PrefixTrieNode* node;
+
+    if (trie->count == trie->capacity) {
+        trie->capacity = trie->capacity ? trie->capacity * 2 : 64;
+        AARRAY_RENEW(trie->nodes, trie->capacity);
+    }
+    node = &trie->nodes[trie->count];
+    node->first_child = -1;
+    node->next_sibling = -1;
+    node->c = c;
+    node->exact_rank = -1;
+    node->exact_value = -1;
+    node->prefix_rank = -1;
+    node->prefix_value = -1;
+    return trie->count++;
+}
+
+PrefixTrie* prefixTrie_new(void) {
+    PrefixTrie* trie;
+    ANEW0(trie);
+    prefixTrie_newNode(trie, 0);
+    return trie;
+}
+
+void prefixTrie_free(PrefixTrie* trie) {
+    if (trie) {
+        AFREE(trie->nodes);
+        AFREE(trie);
+    }
+}
+
+void prefixTrie_add(PrefixTrie* trie, const char* key, bool prefix,
+                    int value) {
+    const unsigned char* p = (const unsigned char*)key;
+    int index = 0;
+    PrefixTrieNode* node;
+
+    for (; *p; p++) {
+        // The child is inserted after |prev|, or first if it's -1.
+        int prev = -1;
+        int child = trie->nodes[index].first_child;
+
+        while (child >= 0 && trie->nodes[child].c < *p) {
+            prev = child;
+            child = trie->nodes[child].next_sibling;
+        }
+        if (child < 0 || trie->nodes[child].c != *p) {
+            int next = child;
+            child = prefixTrie_newNode(trie, *p);
+            trie->nodes[child].next_sibling = next;
+            if (prev < 0) {
+                trie->nodes[index].first_child = child;
+            } else {
+                trie->nodes[prev].next_sibling = child;
+            }
+        }
+        index = child;
+    }
+
+    // The first key added with the same text wins.
+    node = &trie->nodes[index];
+    if (prefix && node->prefix_rank < 0) {
+        node->prefix_rank = trie->keys;
+        node->prefix_value = value;
+    } else if (!prefix && node->exact_rank < 0) {
+        node->exact_rank = trie->keys;
+        node->exact_value = value;
+    }
+    trie->keys++;
+}
+
+int prefixTrie_find(const PrefixTrie* trie, const char* str) {
+    const PrefixTrieNode* nodes = trie->nodes;
+    const unsigned char* p = (const unsigned char*)str;
+    const PrefixTrieNode* node = &nodes[0];
+    int rank = -1;
+    int value = -1;
+
+    for (;;) {
+        int child;
+
+        if (node->prefix_rank >= 0 && (rank < 0 || node->prefix_rank < rank)) {
+            rank = node->prefix_rank;
+            value = node->prefix_value;
+        }
+        if (!*p) {
+            break;
+        }
+        child = node->first_child;
+        while (child >= 0 && nodes[child].c < *p) {
+            child = nodes[child].next_sibling;
+        }
+        if (child < 0 || nodes[child].c != *p) {
+            return value;
+        }
+        node = &nodes[child];
+        p++;
+    }
+    if (node->exact_rank >= 0 && (rank < 0 || node->exact_rank < rank)) {
+        value = node->exact_value;
+    }
+    return value;
+}
@@ -0,0 +1,47 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_PREFIX_TRIE_H
+#define ANDROID_UTILS_PREFIX_TRIE_H
+
+#include "android/utils/compiler.h"
+
+#include <stdbool.h>
+
+ANDROID_BEGIN_HEADER
+
+// A trie of string keys, each matching either only itself or all the
+// strings that start with it, for command tables such as the AT commands
+// of telephony/android_modem.c.
+//
+// A lookup only reads each character of the string once, instead of
+// comparing it with every key. When several keys match, the first one
+// added wins, as if the keys were tried in order.
+
+typedef struct PrefixTrie PrefixTrie;
+
+// Return a new empty trie.
+PrefixTrie* prefixTrie_new(void);
+
+// Release |trie|.
+void prefixTrie_free(PrefixTrie* trie);
+
+// Add |key| to |trie| with |value|, which must be >= 0. If |prefix| is
+// true, |key| matches all the strings that start with it.
+void prefixTrie_add(PrefixTrie* trie, const char* key, bool prefix,
+                    int value);
+
+// Return the value of the first key of |trie| that matches |str|, or -1.
+int prefixTrie_find(const PrefixTrie* trie, const char* str);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_PREFIX_TRIE_H
@@ -0,0 +1,99 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/prefix_trie.h"
+
+#include <stdio.h>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+class PrefixTrieTest : public ::testing::Test {
+protected:
+    virtual void SetUp() { mTrie = prefixTrie_new(); }
+    virtual void TearDown() { prefixTrie_free(mTrie); }
+
+    PrefixTrie* mTrie;
+};
+
+}  // namespace
+
+TEST_F(PrefixTrieTest, Empty) {
+    EXPECT_EQ(-1, prefixTrie_find(mTrie, ""));
+    EXPECT_EQ(-1, prefixTrie_find(mTrie, "+CREG?"));
+}
+
+TEST_F(PrefixTrieTest, ExactKeys) {
+    prefixTrie_add(mTrie, "+CREG?", false, 0);
+    prefixTrie_add(mTrie, "+CREG=2", false, 1);
+    prefixTrie_add(mTrie, "+CGREG?", false, 2);
+    prefixTrie_add(mTrie, "E0Q0V1", false, 3);
+
+    EXPECT_EQ(0, prefixTrie_find(mTrie, "+CREG?"));
+    EXPECT_EQ(1, prefixTrie_find(mTrie, "+CREG=2"));
+    EXPECT_EQ(2, prefixTrie_find(mTrie, "+CGREG?"));
+    EXPECT_EQ(3, prefixTrie_find(mTrie, "E0Q0V1"));
+
+    EXPECT_EQ(-1, prefixTrie_find(mTrie, "+CREG"));
+    EXPECT_EQ(-1, prefixTrie_find(mTrie, "+CREG?1"));
+    EXPECT_EQ(-1, prefixTrie_find(mTrie, "+CREG=1"));
+    EXPECT_EQ(-1, prefixTrie_find(mTrie, ""));
+}
+
+TEST_F(PrefixTrieTest, PrefixKeys) {
+    prefixTrie_add(mTrie, "+CMGS=", true, 0);
+    prefixTrie_add(mTrie, "D", true, 1);
+
+    EXPECT_EQ(0, prefixTrie_find(mTrie, "+CMGS="));
+    EXPECT_EQ(0, prefixTrie_find(mTrie, "+CMGS=23"));
+    EXPECT_EQ(1, prefixTrie_find(mTrie, "D5551212;"));
+    EXPECT_EQ(-1, prefixTrie_find(mTrie, "+CMGS"));
+    EXPECT_EQ(-1, prefixTrie_find(mTrie, "A"));
+}
+
+TEST_F(PrefixTrieTest, FirstKeyWins) {
+    // As in the AT command table, "+CHLD=" shadows "+CHLD=0".
+    prefixTrie_add(mTrie, "+CHLD=", true, 0);
+    prefixTrie_add(mTrie, "+CHLD=0", false, 1);
+    prefixTrie_add(mTrie, "+CSQ", false, 2);
+    prefixTrie_add(mTrie, "+C", true, 3);
+    prefixTrie_add(mTrie, "+CSQ", false, 4);
+
+    EXPECT_EQ(0, prefixTrie_find(mTrie, "+CHLD=0"));
+    EXPECT_EQ(0, prefixTrie_find(mTrie, "+CHLD=12"));
+    EXPECT_EQ(2, prefixTrie_find(mTrie, "+CSQ"));
+    EXPECT_EQ(3, prefixTrie_find(mTrie, "+CSQ=1"));
+    EXPECT_EQ(3, prefixTrie_find(mTrie, "+CFUN?"));
+}
+
+TEST_F(PrefixTrieTest, EmptyPrefixMatchesAll) {
+    prefixTrie_add(mTrie, "+CFUN?", false, 0);
+    prefixTrie_add(mTrie, "", true, 1);
+
+    EXPECT_EQ(0, prefixTrie_find(mTrie, "+CFUN?"));
+    EXPECT_EQ(1, prefixTrie_find(mTrie, "+CFUN=1"));
+    EXPECT_EQ(1, prefixTrie_find(mTrie, ""));
+    EXPECT_EQ(1, prefixTrie_find(mTrie, "anything"));
+}
+
+TEST_F(PrefixTrieTest, ManyKeys) {
+    char key[16];
+    for (int n = 0; n < 1000; ++n) {
+        snprintf(key, sizeof(key), "+X%d", n * 7919 % 1000);
+        prefixTrie_add(mTrie, key, false, n);
+    }
+    for (int n = 0; n < 1000; ++n) {
+        snprintf(key, sizeof(key), "+X%d", n * 7919 % 1000);
+        EXPECT_EQ(n, prefixTrie_find(mTrie, key)) << key;
+    }
+    EXPECT_EQ(-1, prefixTrie_find(mTrie, "+X1000"));
+}
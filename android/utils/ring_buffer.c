@@ -0,0 +1,132 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/ring_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t ringBuffer_roundUp(uint32_t size) {
+    uint32_t result = 1;
+    while (result < size && result < 0x80000000U) {
+        result <<= 1;
+    }
+    return result;
+}
+
+void ringBuffer_init(RingBuffer* ring, uint32_t capacity,
+                     uint32_t max_capacity) {
+    memset(ring, 0, sizeof(*ring));
+    ring->capacity = ringBuffer_roundUp(capacity);
+    ring->max_capacity = ringBuffer_roundUp(max_capacity);
+    if (ring->max_capacity < ring->capacity) {
+        ring->max_capacity = ring->capacity;
+    }
+}
+
+void ringBuffer_done(RingBuffer* ring) {
+    free(ring->data);
+    ring->data = NULL;
+    ring->rpos = ring->wpos = 0;
+}
+
+// Make room for |count| bytes in |ring|, which must not exceed its maximum
+// capacity. Return 0 on success, or -1 if memory is short.
+static int ringBuffer_reserve(RingBuffer* ring, uint32_t count) {
+    uint32_t capacity = ring->capacity;
+    uint8_t* data;
+    uint32_t len;
+
+    if (ring->data && count <= capacity) {
+        return 0;
+    }
+    while (capacity < count) {
+        capacity <<= 1;
+    }
+    data = malloc(capacity);
+    if (!data) {
+        return -1;
+    }
+    if (ring->data) {
+        // Move the current content to the start of the new ring.
+        len = ringBuffer_copy(ring, data, ringBuffer_count(ring));
+        free(ring->data);
+        ring->rpos = 0;
+        ring->wpos = len;
+    }
+    ring->data = data;
+    ring->capacity = capacity;
+    return 0;
+}
+
+uint32_t ringBuffer_write(RingBuffer* ring, const void* data, uint32_t len) {
+    const uint8_t* src = data;
+    uint32_t space = ringBuffer_space(ring);
+    uint32_t count;
+    uint32_t offset;
+    uint32_t first;
+
+    if (len > space) {
+        len = space;
+    }
+    if (!len) {
+        return 0;
+    }
+    count = ringBuffer_count(ring) + len;
+    if (ringBuffer_reserve(ring, count) < 0) {
+        if (!ring->data) {
+            return 0;
+        }
+        // Fill what is left of the current ring.
+        len = ring->capacity - ringBuffer_count(ring);
+        count = ring->capacity;
+    }
+    offset = ring->wpos & (ring->capacity - 1);
+    first = ring->capacity - offset;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(ring->data + offset, src, first);
+    memcpy(ring->data, src + first, len - first);
+    ring->wpos += len;
+    if (count > ring->high_water) {
+        ring->high_water = count;
+    }
+    return len;
+}
+
+uint32_t ringBuffer_copy(const RingBuffer* ring, void* data, uint32_t len) {
+    uint8_t* dst = data;
+    uint32_t count = ringBuffer_count(ring);
+    uint32_t offset;
+    uint32_t first;
+
+    if (len > count) {
+        len = count;
+    }
+    if (!len) {
+        return 0;
+    }
+    offset = ring->rpos & (ring->capacity - 1);
+    first = ring->capacity - offset;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(dst, ring->data + offset, first);
+    memcpy(dst + first, ring->data, len - first);
+    return len;
+}
+
+uint32_t ringBuffer_read(RingBuffer* ring, void* data, uint32_t len) {
+    len = ringBuffer_copy(ring, data, len);
+    ringBuffer_consume(ring, len);
+    return len;
+}
@@ -0,0 +1,94 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_RING_BUFFER_H
+#define ANDROID_UTILS_RING_BUFFER_H
+
+#include "android/utils/compiler.h"
+
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+// A byte FIFO over a power-of-two ring.
+//
+// Unlike CBuffer, data is never moved when it is consumed: the read and
+// write positions are free-running counters, masked with the capacity.
+// The ring starts at an initial capacity and doubles, up to a maximum,
+// when a write doesn't fit.
+//
+// Readers access the data in place with ringBuffer_peek(), which returns
+// the longest contiguous run of data, then release it with
+// ringBuffer_consume(). There are never more than two runs.
+
+typedef struct {
+    uint8_t*  data;
+    uint32_t  capacity;       // Current size of |data|, a power of 2.
+    uint32_t  max_capacity;   // Size that |data| can grow to.
+    uint32_t  rpos;           // Free-running read position.
+    uint32_t  wpos;           // Free-running write position.
+    uint32_t  high_water;     // Largest number of bytes ever buffered.
+} RingBuffer;
+
+// Initialize |ring| with |capacity| bytes, growing up to |max_capacity|.
+// Both are rounded up to a power of 2. No memory is allocated until the
+// first write.
+void ringBuffer_init(RingBuffer* ring, uint32_t capacity,
+                     uint32_t max_capacity);
+
+// Release the memory used by |ring|, which is left empty.
+void ringBuffer_done(RingBuffer* ring);
+
+// Number of bytes that can be read from |ring|.
+static inline uint32_t ringBuffer_count(const RingBuffer* ring) {
+    return ring->wpos - ring->rpos;
+}
+
+// Number of bytes that can be written to |ring|, growing it if needed.
+static inline uint32_t ringBuffer_space(const RingBuffer* ring) {
+    return ring->max_capacity - ringBuffer_count(ring);
+}
+
+// Append up to |len| bytes of |data| to |ring|. Return the number of bytes
+// written, which is less than |len| only if the ring is full, or if it
+// could not grow.
+uint32_t ringBuffer_write(RingBuffer* ring, const void* data, uint32_t len);
+
+// Set |*data| to the first contiguous run of readable bytes of |ring| and
+// return its length, or 0 if |ring| is empty.
+static inline uint32_t ringBuffer_peek(const RingBuffer* ring,
+                                       const uint8_t** data) {
+    uint32_t count = ringBuffer_count(ring);
+    uint32_t offset = ring->rpos & (ring->capacity - 1);
+
+    if (count > ring->capacity - offset) {
+        count = ring->capacity - offset;
+    }
+    *data = ring->data + offset;
+    return count;
+}
+
+// Drop the first |len| readable bytes of |ring|. |len| must not be larger
+// than ringBuffer_count().
+static inline void ringBuffer_consume(RingBuffer* ring, uint32_t len) {
+    ring->rpos += len;
+}
+
+// Copy up to |len| bytes from the start of |ring| to |data| without
+// consuming them. Return the number of bytes copied.
+uint32_t ringBuffer_copy(const RingBuffer* ring, void* data, uint32_t len);
+
+// Same as ringBuffer_copy(), followed by ringBuffer_consume().
+uint32_t ringBuffer_read(RingBuffer* ring, void* data, uint32_t len);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_RING_BUFFER_H
@@ -0,0 +1,191 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/ring_buffer.h"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+TEST(RingBuffer, Init) {
+    RingBuffer ring;
+    ringBuffer_init(&ring, 100, 50);
+    EXPECT_EQ(128U, ring.capacity);
+    EXPECT_EQ(128U, ring.max_capacity);
+    EXPECT_EQ(0U, ringBuffer_count(&ring));
+    EXPECT_EQ(128U, ringBuffer_space(&ring));
+    EXPECT_TRUE(ring.data == NULL);
+    ringBuffer_done(&ring);
+}
+
+TEST(RingBuffer, WrapAround) {
+    RingBuffer ring;
+    ringBuffer_init(&ring, 16, 16);
+
+    uint8_t in[16], out[16];
+    for (int n = 0; n < 16; ++n) {
+        in[n] = n;
+    }
+    EXPECT_EQ(12U, ringBuffer_write(&ring, in, 12));
+    EXPECT_EQ(10U, ringBuffer_read(&ring, out, 10));
+    EXPECT_EQ(0, memcmp(in, out, 10));
+
+    // This one wraps around, and only 14 bytes fit.
+    EXPECT_EQ(14U, ringBuffer_write(&ring, in, 16));
+    EXPECT_EQ(16U, ringBuffer_count(&ring));
+    EXPECT_EQ(0U, ringBuffer_write(&ring, in, 1));
+
+    const uint8_t* data;
+    EXPECT_EQ(6U, ringBuffer_peek(&ring, &data));
+    EXPECT_EQ(10, data[0]);
+    ringBuffer_consume(&ring, 6);
+    EXPECT_EQ(10U, ringBuffer_peek(&ring, &data));
+    EXPECT_EQ(0, memcmp(in + 4, data, 10));
+
+    EXPECT_EQ(10U, ringBuffer_copy(&ring, out, 16));
+    EXPECT_EQ(10U, ringBuffer_count(&ring));
+    EXPECT_EQ(16U, ring.high_water);
+    ringBuffer_done(&ring);
+}
+
+TEST(RingBuffer, Grow) {
+    RingBuffer ring;
+    ringBuffer_init(&ring, 8, 64);
+
+    uint8_t in[64], out[64];
+    for (int n = 0; n < 64; ++n) {
+        in[n] = n;
+    }
+    // Wrap around before growing, the content must be kept in order.
+    EXPECT_EQ(6U, ringBuffer_write(&ring, in, 6));
+    EXPECT_EQ(5U, ringBuffer_read(&ring, out, 5));
+    EXPECT_EQ(6U, ringBuffer_write(&ring, in + 6, 6));
+    EXPECT_EQ(8U, ring.capacity);
+
+    EXPECT_EQ(20U, ringBuffer_write(&ring, in + 12, 20));
+    EXPECT_EQ(32U, ring.capacity);
+    EXPECT_EQ(27U, ringBuffer_read(&ring, out, 64));
+    EXPECT_EQ(0, memcmp(in + 5, out, 27));
+
+    EXPECT_EQ(64U, ringBuffer_write(&ring, in, 64));
+    EXPECT_EQ(64U, ring.capacity);
+    EXPECT_EQ(0U, ringBuffer_write(&ring, in, 1));
+    EXPECT_EQ(64U, ring.high_water);
+    ringBuffer_done(&ring);
+}
+
+#ifndef _WIN32
+
+// Pushes a few hundred MB from a pipe through a ring used like the goldfish
+// TTY receive buffer: the character backend fills it with whatever the pipe
+// returns, up to the free space, and the guest drains it with reads of
+// varying sizes, straight from the ring.
+TEST(RingBuffer, TtyThroughPipe) {
+    const uint64_t kTotal = 256 << 20;
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    RingBuffer ring;
+    ringBuffer_init(&ring, 4096, 4096);
+
+    // Byte N of the stream is N % 251, so that the data at any position
+    // is at pattern + position % 251.
+    static uint8_t pattern[65536 + 251];
+    for (size_t n = 0; n < sizeof(pattern); ++n) {
+        pattern[n] = (uint8_t)(n % 251);
+    }
+    uint64_t written = 0;
+    uint64_t received = 0;
+    uint64_t consumed = 0;
+    unsigned guestRead = 1;
+    bool ok = true;
+
+    while (consumed < kTotal && ok) {
+        // Sender: fill the pipe.
+        if (written < kTotal) {
+            size_t len = 65536;
+            if (len > kTotal - written) {
+                len = kTotal - written;
+            }
+            ssize_t ret = write(fds[1], pattern + written % 251, len);
+            if (ret > 0) {
+                written += ret;
+            } else if (ret < 0 && errno != EAGAIN) {
+                ADD_FAILURE() << "write: " << strerror(errno);
+                break;
+            }
+            if (written == kTotal) {
+                close(fds[1]);
+            }
+        }
+
+        // Backend: read as much as the ring accepts, as qemu-char does.
+        uint8_t buf[4096];
+        for (;;) {
+            size_t len = ringBuffer_space(&ring);
+            if (len > sizeof(buf)) {
+                len = sizeof(buf);
+            }
+            if (!len) {
+                break;
+            }
+            ssize_t ret = read(fds[0], buf, len);
+            if (ret <= 0) {
+                break;
+            }
+            ASSERT_EQ((uint32_t)ret, ringBuffer_write(&ring, buf, ret));
+            received += ret;
+            if (written < kTotal) {
+                // Let the sender catch up.
+                break;
+            }
+        }
+
+        // Guest: read up to 1 KB at a time, possibly across the wrap.
+        while (ringBuffer_count(&ring) > 0) {
+            uint32_t want = guestRead;
+            if (want > ringBuffer_count(&ring)) {
+                want = ringBuffer_count(&ring);
+            }
+            guestRead = (guestRead * 7 + 13) % 1024 + 1;
+            while (want > 0) {
+                const uint8_t* data;
+                uint32_t len = ringBuffer_peek(&ring, &data);
+                if (len > want) {
+                    len = want;
+                }
+                if (memcmp(data, pattern + consumed % 251, len)) {
+                    ok = false;
+                }
+                ringBuffer_consume(&ring, len);
+                consumed += len;
+                want -= len;
+            }
+        }
+    }
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(kTotal, received);
+    EXPECT_EQ(kTotal, consumed);
+    EXPECT_EQ(4096U, ring.capacity);
+
+    close(fds[0]);
+    ringBuffer_done(&ring);
+}
+
+#endif  // !_WIN32
@@ -0,0 +1,253 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/shared_ram.h"
+
+#include <errno.h>
+
+#ifdef _WIN32
+
+int sharedRam_open(const char* path) {
+    errno = ENOSYS;
+    return -1;
+}
+
+void* sharedRam_map(int fd, uint64_t offset, size_t size) {
+    errno = ENOSYS;
+    return NULL;
+}
+
+int sharedRam_save(const char* path, const SharedRamBlock* blocks,
+                   int count) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int sharedRam_countPages(const void* addr, size_t size,
+                         SharedRamStats* stats) {
+    errno = ENOSYS;
+    return -1;
+}
+
+#else  // !_WIN32
+
+#include "android/utils/eintr_wrapper.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bits of a /proc/self/pagemap entry, see Documentation/vm/pagemap.txt.
+#define PAGEMAP_PRESENT     (1ULL << 63)
+#define PAGEMAP_SWAPPED     (1ULL << 62)
+#define PAGEMAP_FILE        (1ULL << 61)
+
+// Number of pagemap entries read at once.
+#define PAGEMAP_BATCH       512
+
+static size_t sharedRam_pageSize(void) {
+    static size_t page_size;
+    if (!page_size) {
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    return page_size;
+}
+
+int sharedRam_open(const char* path) {
+    return HANDLE_EINTR(open(path, O_RDONLY));
+}
+
+void* sharedRam_map(int fd, uint64_t offset, size_t size) {
+    struct stat st;
+    void* addr;
+
+    if (offset & (sharedRam_pageSize() - 1)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0) {
+        return NULL;
+    }
+    if ((uint64_t)st.st_size < offset + size) {
+        errno = EINVAL;
+        return NULL;
+    }
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                (off_t)offset);
+    return (addr == MAP_FAILED) ? NULL : addr;
+}
+
+static int sharedRam_isZero(const uint8_t* p, size_t size) {
+    const uint64_t* q = (const uint64_t*)p;
+    size_t n;
+
+    for (n = 0; n < size / sizeof(*q); n++) {
+        if (q[n]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int sharedRam_writeAll(int fd, const uint8_t* data, size_t size,
+                              uint64_t offset) {
+    while (size > 0) {
+        ssize_t ret = HANDLE_EINTR(pwrite(fd, data, size, (off_t)offset));
+        if (ret <= 0) {
+            if (ret == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        data += ret;
+        size -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+// Write |block| to |fd|, skipping pages full of zeroes.
+static int sharedRam_writeBlock(int fd, const SharedRamBlock* block) {
+    const uint8_t* host = block->host;
+    size_t page_size = sharedRam_pageSize();
+    uint64_t start = 0;
+    uint64_t pos;
+
+    for (pos = 0; pos < block->size; pos += page_size) {
+        size_t len = page_size;
+        if (len > block->size - pos) {
+            len = block->size - pos;
+        }
+        if (!sharedRam_isZero(host + pos, len)) {
+            continue;
+        }
+        if (pos > start &&
+            sharedRam_writeAll(fd, host + start, pos - start,
+                               block->offset + start) < 0) {
+            return -1;
+        }
+        start = pos + len;
+    }
+    if (block->size > start &&
+        sharedRam_writeAll(fd, host + start, block->size - start,
+                           block->offset + start) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int sharedRam_save(const char* path, const SharedRamBlock* blocks,
+                   int count) {
+    char* tmp_path;
+    uint64_t file_size = 0;
+    int fd;
+    int n;
+    int saved_errno;
+
+    tmp_path = malloc(strlen(path) + sizeof(".XXXXXX"));
+    if (!tmp_path) {
+        errno = ENOMEM;
+        return -1;
+    }
+    sprintf(tmp_path, "%s.XXXXXX", path);
+    fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        goto FAIL_FREE;
+    }
+    for (n = 0; n < count; n++) {
+        uint64_t end = blocks[n].offset + blocks[n].size;
+        if (sharedRam_writeBlock(fd, &blocks[n]) < 0) {
+            goto FAIL_CLOSE;
+        }
+        if (end > file_size) {
+            file_size = end;
+        }
+    }
+    // The trailing holes must be part of the file too, and the file is
+    // meant to be shared by instances running as other users.
+    if (ftruncate(fd, (off_t)file_size) < 0 || fchmod(fd, 0644) < 0) {
+        goto FAIL_CLOSE;
+    }
+    if (close(fd) < 0) {
+        fd = -1;
+        goto FAIL_CLOSE;
+    }
+    if (rename(tmp_path, path) < 0) {
+        fd = -1;
+        goto FAIL_CLOSE;
+    }
+    free(tmp_path);
+    return 0;
+
+FAIL_CLOSE:
+    saved_errno = errno;
+    if (fd >= 0) {
+        close(fd);
+    }
+    unlink(tmp_path);
+    errno = saved_errno;
+FAIL_FREE:
+    free(tmp_path);
+    return -1;
+}
+
+int sharedRam_countPages(const void* addr, size_t size,
+                         SharedRamStats* stats) {
+    size_t page_size = sharedRam_pageSize();
+    uint64_t first = (uintptr_t)addr / page_size;
+    uint64_t last = ((uintptr_t)addr + size + page_size - 1) / page_size;
+    uint64_t entries[PAGEMAP_BATCH];
+    int fd;
+
+    fd = HANDLE_EINTR(open("/proc/self/pagemap", O_RDONLY));
+    if (fd < 0) {
+        return -1;
+    }
+    while (first < last) {
+        size_t count = PAGEMAP_BATCH;
+        ssize_t ret;
+        size_t n;
+
+        if (count > last - first) {
+            count = (size_t)(last - first);
+        }
+        ret = HANDLE_EINTR(pread(fd, entries, count * sizeof(entries[0]),
+                                 (off_t)(first * sizeof(entries[0]))));
+        if (ret <= 0) {
+            int saved_errno = (ret == 0) ? ENOSYS : errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+        count = (size_t)ret / sizeof(entries[0]);
+        for (n = 0; n < count; n++) {
+            uint64_t entry = entries[n];
+            if (entry & PAGEMAP_SWAPPED) {
+                stats->private_pages++;
+            } else if (!(entry & PAGEMAP_PRESENT)) {
+                stats->absent_pages++;
+            } else if (entry & PAGEMAP_FILE) {
+                stats->shared_pages++;
+            } else {
+                stats->private_pages++;
+            }
+        }
+        first += count;
+    }
+    close(fd);
+    return 0;
+}
+
+#endif  // !_WIN32
@@ -0,0 +1,73 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_SHARED_RAM_H
+#define ANDROID_UTILS_SHARED_RAM_H
+
+#include "android/utils/compiler.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+// Guest RAM shared between emulator instances through a base file.
+//
+// A RAM base file holds an image of the guest RAM blocks, each one at its
+// ram_addr_t offset, usually taken right after loading a snapshot. Other
+// instances that boot from the same snapshot map their RAM blocks from it
+// with MAP_PRIVATE: the pages they do not modify stay in the host page
+// cache and are shared by all of them, and the ones they write to are
+// copied on write into private memory.
+//
+// The file is never modified once written, a new version is renamed over
+// the old one so that existing mappings keep the old content.
+//
+// Only supported on POSIX hosts. On Windows, all functions fail with
+// errno set to ENOSYS.
+
+// A range of host memory to write to a RAM base file at |offset|.
+typedef struct {
+    const void*  host;
+    uint64_t     offset;
+    uint64_t     size;
+} SharedRamBlock;
+
+// Page counts returned by sharedRam_countPages().
+typedef struct SharedRamStats {
+    uint64_t  shared_pages;    // Resident pages still backed by the file.
+    uint64_t  private_pages;   // Copied-on-write pages, resident or swapped.
+    uint64_t  absent_pages;    // Pages that were never touched.
+} SharedRamStats;
+
+// Open the RAM base file at |path| for mapping. Return a file descriptor,
+// or -1 on failure with errno set.
+int sharedRam_open(const char* path);
+
+// Map |size| bytes of the RAM base file |fd| at |offset|, copy-on-write.
+// Return the address of the mapping, or NULL with errno set if |offset| is
+// not aligned to a host page, or if the file is too short. The mapping
+// must be released with munmap().
+void* sharedRam_map(int fd, uint64_t offset, size_t size);
+
+// Write the |count| blocks of |blocks| to a new RAM base file at |path|,
+// replacing any existing one. Pages full of zeroes are left as holes in
+// the file. Return 0 on success, or -1 on failure with errno set.
+int sharedRam_save(const char* path, const SharedRamBlock* blocks, int count);
+
+// Add the number of shared, private and absent host pages in
+// [addr, addr + size) of the current process to |stats|. Return 0 on
+// success, or -1 with errno set if the host cannot tell.
+int sharedRam_countPages(const void* addr, size_t size, SharedRamStats* stats);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_SHARED_RAM_H
@@ -0,0 +1,149 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/shared_ram.h"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+
+#ifndef _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+class SharedRamTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        mPageSize = (size_t)sysconf(_SC_PAGESIZE);
+        snprintf(mPath, sizeof(mPath), "/tmp/shared_ram_unittest.%d",
+                 (int)getpid());
+    }
+
+    virtual void TearDown() {
+        unlink(mPath);
+    }
+
+    size_t mPageSize;
+    char mPath[64];
+};
+
+}  // namespace
+
+TEST_F(SharedRamTest, SaveAndMap) {
+    size_t size = 4 * mPageSize;
+    char* ram = static_cast<char*>(calloc(1, size));
+    // Pages 0 and 2 have data, pages 1 and 3 are holes.
+    memset(ram, 'a', mPageSize);
+    ram[2 * mPageSize + 10] = 'b';
+
+    SharedRamBlock blocks[2] = {
+        { ram, 0, size },
+        // A second block after a gap.
+        { ram, 8 * mPageSize, mPageSize },
+    };
+    ASSERT_EQ(0, sharedRam_save(mPath, blocks, 2));
+
+    struct stat st;
+    ASSERT_EQ(0, stat(mPath, &st));
+    EXPECT_EQ(9 * mPageSize, (size_t)st.st_size);
+
+    int fd = sharedRam_open(mPath);
+    ASSERT_GE(fd, 0);
+    char* map = static_cast<char*>(sharedRam_map(fd, 0, size));
+    ASSERT_TRUE(map != NULL);
+    EXPECT_EQ(0, memcmp(ram, map, size));
+
+    // Writes are private to the mapping.
+    map[0] = 'z';
+    char* map2 = static_cast<char*>(sharedRam_map(fd, 0, size));
+    ASSERT_TRUE(map2 != NULL);
+    EXPECT_EQ('a', map2[0]);
+
+    char* map3 = static_cast<char*>(sharedRam_map(fd, 8 * mPageSize,
+                                                  mPageSize));
+    ASSERT_TRUE(map3 != NULL);
+    EXPECT_EQ('a', map3[0]);
+
+    munmap(map, size);
+    munmap(map2, size);
+    munmap(map3, mPageSize);
+    close(fd);
+    free(ram);
+}
+
+TEST_F(SharedRamTest, MapChecks) {
+    char* ram = static_cast<char*>(calloc(1, mPageSize));
+    SharedRamBlock block = { ram, 0, mPageSize };
+    ASSERT_EQ(0, sharedRam_save(mPath, &block, 1));
+
+    int fd = sharedRam_open(mPath);
+    ASSERT_GE(fd, 0);
+    errno = 0;
+    EXPECT_TRUE(sharedRam_map(fd, 0, 2 * mPageSize) == NULL);
+    EXPECT_EQ(EINVAL, errno);
+    errno = 0;
+    EXPECT_TRUE(sharedRam_map(fd, 16, 16) == NULL);
+    EXPECT_EQ(EINVAL, errno);
+    close(fd);
+    free(ram);
+
+    EXPECT_EQ(-1, sharedRam_open("/nonexistent/shared_ram"));
+}
+
+TEST_F(SharedRamTest, CountPages) {
+    size_t size = 4 * mPageSize;
+    char* ram = static_cast<char*>(malloc(size));
+    memset(ram, 'a', size);
+    SharedRamBlock block = { ram, 0, size };
+    ASSERT_EQ(0, sharedRam_save(mPath, &block, 1));
+    free(ram);
+
+    int fd = sharedRam_open(mPath);
+    ASSERT_GE(fd, 0);
+    volatile char* map = static_cast<char*>(sharedRam_map(fd, 0, size));
+    ASSERT_TRUE(map != NULL);
+
+    // Page 0 is read, page 1 is written, pages 2 and 3 are not touched.
+    EXPECT_EQ('a', map[0]);
+    map[mPageSize] = 'b';
+
+    SharedRamStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (sharedRam_countPages((const void*)map, size, &stats) < 0) {
+        // Hosts without /proc/self/pagemap.
+        munmap((void*)map, size);
+        close(fd);
+        return;
+    }
+    EXPECT_EQ(4U, stats.shared_pages + stats.private_pages +
+                  stats.absent_pages);
+    EXPECT_LE(1U, stats.shared_pages);
+    EXPECT_EQ(1U, stats.private_pages);
+
+    munmap((void*)map, size);
+    close(fd);
+}
+
+#else  // _WIN32
+
+TEST(SharedRam, NotSupported) {
+    EXPECT_EQ(-1, sharedRam_open("C:\\base.ram"));
+    EXPECT_EQ(ENOSYS, errno);
+}
+
+#endif  // _WIN32
@@ -0,0 +1,208 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/startup_trace.h"
+
+#include "android/utils/debug.h"
+#include "android/utils/system.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#elif defined(__APPLE__)
+#  include <sys/time.h>
+#else
+#  include <time.h>
+#endif
+
+// Maximum number of recorded events. Startup only has a few dozen of them,
+// later ones are dropped.
+#define MAX_EVENTS  256
+
+// Maximum nesting depth of spans.
+#define MAX_DEPTH   16
+
+typedef struct {
+    const char* name;
+    int64_t     start_us;
+    int64_t     duration_us;  // -1 for milestones.
+} StartupEvent;
+
+typedef struct {
+    bool          enabled;
+    char*         path;
+    const char*   exit_name;
+    int64_t       origin_us;
+    int           num_events;
+    int           depth;
+    int           open[MAX_DEPTH];  // indices in |events| of open spans.
+    StartupEvent  events[MAX_EVENTS];
+} StartupTrace;
+
+static StartupTrace _trace;
+
+static int64_t startupTrace_now_us(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (int64_t)(now.QuadPart * 1000000.0 / freq.QuadPart);
+#elif defined(__APPLE__)
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static void startupTrace_atExit(void) {
+    startupTrace_finish();
+}
+
+static void startupTrace_checkExit(const char* name) {
+    if (_trace.exit_name && !strcmp(_trace.exit_name, name)) {
+        startupTrace_finish();
+        exit(0);
+    }
+}
+
+void startupTrace_init(const char* path) {
+    if (_trace.enabled || !path) {
+        return;
+    }
+    _trace.path = ASTRDUP(path);
+    _trace.exit_name = getenv(STARTUP_TRACE_EXIT_ENV);
+    _trace.origin_us = startupTrace_now_us();
+    _trace.num_events = 0;
+    _trace.depth = 0;
+    _trace.enabled = true;
+    atexit(startupTrace_atExit);
+}
+
+bool startupTrace_isEnabled(void) {
+    return _trace.enabled;
+}
+
+static StartupEvent* startupTrace_addEvent(const char* name) {
+    StartupEvent* event;
+
+    if (_trace.num_events >= MAX_EVENTS) {
+        return NULL;
+    }
+    event = &_trace.events[_trace.num_events++];
+    event->name = name;
+    event->start_us = startupTrace_now_us() - _trace.origin_us;
+    event->duration_us = -1;
+    return event;
+}
+
+void startupTrace_begin(const char* name) {
+    StartupEvent* event;
+
+    if (!_trace.enabled) {
+        return;
+    }
+    event = startupTrace_addEvent(name);
+    if (!event) {
+        return;
+    }
+    event->duration_us = 0;
+    if (_trace.depth < MAX_DEPTH) {
+        _trace.open[_trace.depth++] = _trace.num_events - 1;
+    }
+}
+
+void startupTrace_end(const char* name) {
+    int depth;
+
+    if (!_trace.enabled) {
+        return;
+    }
+    for (depth = _trace.depth - 1; depth >= 0; depth--) {
+        StartupEvent* event = &_trace.events[_trace.open[depth]];
+        if (!strcmp(event->name, name)) {
+            event->duration_us =
+                    startupTrace_now_us() - _trace.origin_us - event->start_us;
+            // Also closes any inner span that was left open.
+            _trace.depth = depth;
+            startupTrace_checkExit(name);
+            return;
+        }
+    }
+}
+
+void startupTrace_mark(const char* name) {
+    if (!_trace.enabled) {
+        return;
+    }
+    startupTrace_addEvent(name);
+    startupTrace_checkExit(name);
+    if (!strcmp(name, STARTUP_TRACE_FIRST_FRAME)) {
+        startupTrace_finish();
+    }
+}
+
+void startupTrace_finish(void) {
+    FILE* file;
+    int n;
+
+    if (!_trace.enabled) {
+        return;
+    }
+    _trace.enabled = false;
+
+    // Spans that are still open end now.
+    for (n = 0; n < _trace.depth; n++) {
+        StartupEvent* event = &_trace.events[_trace.open[n]];
+        event->duration_us =
+                startupTrace_now_us() - _trace.origin_us - event->start_us;
+    }
+    _trace.depth = 0;
+
+    file = fopen(_trace.path, "w");
+    if (!file) {
+        derror("could not create startup trace file: %s", _trace.path);
+        AFREE(_trace.path);
+        _trace.path = NULL;
+        return;
+    }
+
+    // One event per line, which emulator_startup_bench relies on.
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (n = 0; n < _trace.num_events; n++) {
+        const StartupEvent* event = &_trace.events[n];
+        if (event->duration_us < 0) {
+            fprintf(file,
+                    "{\"name\":\"%s\",\"ph\":\"i\",\"ts\":%lld,"
+                    "\"pid\":1,\"tid\":1,\"s\":\"g\"}",
+                    event->name, (long long)event->start_us);
+        } else {
+            fprintf(file,
+                    "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+                    "\"pid\":1,\"tid\":1}",
+                    event->name, (long long)event->start_us,
+                    (long long)event->duration_us);
+        }
+        fprintf(file, "%s\n", (n + 1 < _trace.num_events) ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+
+    AFREE(_trace.path);
+    _trace.path = NULL;
+}
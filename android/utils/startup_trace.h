@@ -0,0 +1,63 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_STARTUP_TRACE_H
+#define ANDROID_UTILS_STARTUP_TRACE_H
+
+#include "android/utils/compiler.h"
+
+#include <stdbool.h>
+
+ANDROID_BEGIN_HEADER
+
+// Lightweight startup timeline tracing.
+//
+// Startup phases are bracketed with startupTrace_begin() and
+// startupTrace_end(), and milestones are recorded with startupTrace_mark().
+// When tracing was enabled with startupTrace_init(), the events are written
+// to a file in the Chrome trace event format (open it from
+// chrome://tracing) once the "first-frame" milestone is reached, or at exit.
+// Otherwise, all these calls are no-ops that only check a global flag.
+//
+// Phase and milestone names must be string literals, they are not copied
+// and are written to the trace file as-is.
+
+// Name of the milestone that ends startup tracing.
+#define STARTUP_TRACE_FIRST_FRAME  "first-frame"
+
+// Name of an environment variable that can be set to the name of a phase
+// or milestone. When it completes, the trace is written and the program
+// exits immediately with status 0. This is used by emulator_startup_bench.
+#define STARTUP_TRACE_EXIT_ENV  "ANDROID_EMULATOR_STARTUP_EXIT"
+
+// Enable startup tracing, recording events to the file at |path|.
+// Timestamps are relative to the time of this call.
+void startupTrace_init(const char* path);
+
+// Return true iff startup tracing is currently enabled.
+bool startupTrace_isEnabled(void);
+
+// Start a new span named |name|. Spans can be nested.
+void startupTrace_begin(const char* name);
+
+// End the innermost open span named |name|.
+void startupTrace_end(const char* name);
+
+// Record the instantaneous milestone |name|.
+void startupTrace_mark(const char* name);
+
+// Write the trace file and stop tracing. Called automatically when the
+// first-frame milestone is reached, and at exit.
+void startupTrace_finish(void);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_STARTUP_TRACE_H
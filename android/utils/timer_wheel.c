@@ -0,0 +1,181 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/timer_wheel.h"
+
+#include <string.h>
+
+#define TIMER_WHEEL_MASK  (TIMER_WHEEL_SLOTS - 1)
+
+// Ticks reached by the top level.
+#define TIMER_WHEEL_RANGE  \
+        (1LL << (TIMER_WHEEL_LEVEL_BITS * TIMER_WHEEL_LEVELS))
+
+static inline int timerWheel_firstBit(uint64_t bits) {
+    return __builtin_ctzll(bits);
+}
+
+void timerWheel_init(TimerWheel* wheel, int64_t now) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now;
+}
+
+// Link |entry| into the slot matching its expiration, relative to the
+// current tick of |wheel|.
+static void timerWheel_insert(TimerWheel* wheel, TimerWheelEntry* entry) {
+    int64_t expires = entry->expires;
+    int64_t delta = expires - wheel->now;
+    TimerWheelEntry** head;
+    unsigned slot;
+    int level;
+
+    if (delta < 0) {
+        expires = wheel->now;
+        delta = 0;
+    } else if (delta >= TIMER_WHEEL_RANGE) {
+        // Put back in the wheel when the top level reaches its slot.
+        expires = wheel->now + TIMER_WHEEL_RANGE - 1;
+        delta = TIMER_WHEEL_RANGE - 1;
+    }
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        if (delta < (1LL << (TIMER_WHEEL_LEVEL_BITS * (level + 1)))) {
+            break;
+        }
+    }
+    slot = ((uint64_t)expires >> (TIMER_WHEEL_LEVEL_BITS * level)) &
+           TIMER_WHEEL_MASK;
+
+    head = &wheel->slots[level][slot];
+    entry->next = *head;
+    if (entry->next) {
+        entry->next->pprev = &entry->next;
+    }
+    entry->pprev = head;
+    entry->slot = level * TIMER_WHEEL_SLOTS + slot;
+    *head = entry;
+    wheel->bitmap[level] |= 1ULL << slot;
+}
+
+static void timerWheel_unlink(TimerWheel* wheel, TimerWheelEntry* entry) {
+    unsigned level = entry->slot / TIMER_WHEEL_SLOTS;
+    unsigned slot = entry->slot % TIMER_WHEEL_SLOTS;
+
+    *entry->pprev = entry->next;
+    if (entry->next) {
+        entry->next->pprev = entry->pprev;
+    }
+    entry->next = NULL;
+    entry->pprev = NULL;
+    if (!wheel->slots[level][slot]) {
+        wheel->bitmap[level] &= ~(1ULL << slot);
+    }
+}
+
+void timerWheel_add(TimerWheel* wheel, TimerWheelEntry* entry,
+                    int64_t expires) {
+    if (entry->pprev) {
+        timerWheel_unlink(wheel, entry);
+    } else {
+        wheel->count++;
+    }
+    entry->expires = expires;
+    timerWheel_insert(wheel, entry);
+}
+
+void timerWheel_remove(TimerWheel* wheel, TimerWheelEntry* entry) {
+    if (entry->pprev) {
+        timerWheel_unlink(wheel, entry);
+        wheel->count--;
+    }
+}
+
+// Called on the first tick of a turn of level 0: move the timers of the
+// slots that start at this tick one or more levels down.
+static void timerWheel_cascade(TimerWheel* wheel) {
+    int level;
+
+    for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        unsigned slot = ((uint64_t)wheel->now >>
+                         (TIMER_WHEEL_LEVEL_BITS * level)) & TIMER_WHEEL_MASK;
+        TimerWheelEntry* entry = wheel->slots[level][slot];
+
+        wheel->slots[level][slot] = NULL;
+        wheel->bitmap[level] &= ~(1ULL << slot);
+        while (entry) {
+            TimerWheelEntry* next = entry->next;
+            timerWheel_insert(wheel, entry);
+            entry = next;
+        }
+        // Only the first slot of a level turns the level above.
+        if (slot != 0) {
+            break;
+        }
+    }
+}
+
+void timerWheel_advance(TimerWheel* wheel, int64_t now,
+                        TimerWheelFunc func, void* opaque) {
+    while (wheel->now <= now) {
+        unsigned slot = (uint64_t)wheel->now & TIMER_WHEEL_MASK;
+        TimerWheelEntry* entry;
+        int64_t next;
+
+        if (slot == 0) {
+            timerWheel_cascade(wheel);
+        }
+        while ((entry = wheel->slots[0][slot]) != NULL) {
+            timerWheel_unlink(wheel, entry);
+            wheel->count--;
+            func(opaque, entry);
+        }
+
+        // Skip the ticks where nothing happens.
+        next = timerWheel_nextTick(wheel);
+        if (next < 0 || next > now) {
+            next = now + 1;
+        } else if (next <= wheel->now) {
+            next = wheel->now + 1;
+        }
+        wheel->now = next;
+    }
+}
+
+int64_t timerWheel_nextTick(const TimerWheel* wheel) {
+    int64_t next = -1;
+    int level;
+
+    if (wheel->count == 0) {
+        return -1;
+    }
+    for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        int shift = TIMER_WHEEL_LEVEL_BITS * level;
+        uint64_t bits = wheel->bitmap[level];
+        uint64_t start;
+        unsigned rotate;
+        int64_t tick;
+
+        if (!bits) {
+            continue;
+        }
+        // The first slot boundary of this level not processed yet, and
+        // the non-empty slots in the order they are reached from it.
+        start = ((uint64_t)wheel->now + (1ULL << shift) - 1) >> shift;
+        rotate = start & TIMER_WHEEL_MASK;
+        if (rotate) {
+            bits = (bits >> rotate) | (bits << (TIMER_WHEEL_SLOTS - rotate));
+        }
+        tick = (int64_t)((start + timerWheel_firstBit(bits)) << shift);
+        if (next < 0 || tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
@@ -0,0 +1,98 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_TIMER_WHEEL_H
+#define ANDROID_UTILS_TIMER_WHEEL_H
+
+#include "android/utils/compiler.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+// A hierarchical timer wheel, for large numbers of timers that are
+// mostly cancelled or re-armed before they expire, e.g. one per network
+// session.
+//
+// Time is counted in ticks of any unit. Level 0 has one slot per tick,
+// each level above has slots covering a whole turn of the level below.
+// A timer is put in the slot of the lowest level that reaches its
+// expiration, and moves down one level each time the wheel turns to its
+// slot, so that adding and removing a timer take constant time, as does
+// each tick of timerWheel_advance(). Timers further away than the top
+// level reaches simply go around it again.
+//
+// Timers are embedded in the structures of the caller, and recovered with
+// a cast or offsetof(). Nothing is allocated.
+
+#define TIMER_WHEEL_LEVEL_BITS  6
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVELS      4
+
+typedef struct TimerWheelEntry TimerWheelEntry;
+
+struct TimerWheelEntry {
+    TimerWheelEntry*   next;
+    TimerWheelEntry**  pprev;      // NULL if not pending.
+    int64_t            expires;
+    uint32_t           slot;       // Level * TIMER_WHEEL_SLOTS + slot.
+};
+
+typedef struct {
+    int64_t           now;         // Next tick to process.
+    uint32_t          count;       // Pending timers.
+    uint64_t          bitmap[TIMER_WHEEL_LEVELS];   // Non-empty slots.
+    TimerWheelEntry*  slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} TimerWheel;
+
+typedef void (*TimerWheelFunc)(void* opaque, TimerWheelEntry* entry);
+
+// Initialize an empty |wheel| whose first tick to process is |now|.
+void timerWheel_init(TimerWheel* wheel, int64_t now);
+
+// Initialize |entry| as not pending.
+static inline void timerWheelEntry_init(TimerWheelEntry* entry) {
+    entry->next = NULL;
+    entry->pprev = NULL;
+    entry->expires = 0;
+    entry->slot = 0;
+}
+
+// Return true if |entry| is in a wheel.
+static inline bool timerWheelEntry_pending(const TimerWheelEntry* entry) {
+    return entry->pprev != NULL;
+}
+
+// Arm |entry| to expire at tick |expires|, removing it first if pending.
+// An expiration before the next tick to process, |wheel->now|, is treated
+// as that tick.
+void timerWheel_add(TimerWheel* wheel, TimerWheelEntry* entry,
+                    int64_t expires);
+
+// Cancel |entry| if it is pending.
+void timerWheel_remove(TimerWheel* wheel, TimerWheelEntry* entry);
+
+// Process all ticks up to |now| included, calling |func| for each timer
+// that expires, in order of expiration, after removing it. |func| may add
+// and remove timers, including the one it is given.
+void timerWheel_advance(TimerWheel* wheel, int64_t now,
+                        TimerWheelFunc func, void* opaque);
+
+// Return the tick at which timerWheel_advance() must be called next, or
+// -1 if no timer is pending. This is the expiration of the next timer,
+// or earlier when timers further away must move down a level first.
+int64_t timerWheel_nextTick(const TimerWheel* wheel);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_TIMER_WHEEL_H
@@ -0,0 +1,209 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/timer_wheel.h"
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+struct Timer {
+    TimerWheelEntry entry;  // First, so that entries can be cast back.
+    int id;
+    int64_t fired;          // Tick at which it fired, or -1.
+    int64_t rearm;          // Re-armed that many ticks later, if not 0.
+};
+
+struct Fired {
+    TimerWheel* wheel;
+    std::vector<Timer*> timers;
+};
+
+void onExpire(void* opaque, TimerWheelEntry* entry) {
+    Fired* fired = static_cast<Fired*>(opaque);
+    Timer* timer = reinterpret_cast<Timer*>(entry);
+    timer->fired = fired->wheel->now;
+    fired->timers.push_back(timer);
+    if (timer->rearm) {
+        timerWheel_add(fired->wheel, entry, fired->wheel->now + timer->rearm);
+        timer->rearm = 0;
+    }
+}
+
+class TimerWheelTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        timerWheel_init(&mWheel, 1000);
+        mFired.wheel = &mWheel;
+    }
+
+    Timer* makeTimer(int id) {
+        Timer* timer = new Timer;
+        timerWheelEntry_init(&timer->entry);
+        timer->id = id;
+        timer->fired = -1;
+        timer->rearm = 0;
+        mTimers.push_back(timer);
+        return timer;
+    }
+
+    virtual void TearDown() {
+        for (size_t n = 0; n < mTimers.size(); ++n) {
+            delete mTimers[n];
+        }
+    }
+
+    void advance(int64_t now) {
+        timerWheel_advance(&mWheel, now, onExpire, &mFired);
+    }
+
+    TimerWheel mWheel;
+    Fired mFired;
+    std::vector<Timer*> mTimers;
+};
+
+}  // namespace
+
+TEST_F(TimerWheelTest, Empty) {
+    EXPECT_EQ(-1, timerWheel_nextTick(&mWheel));
+    advance(100000);
+    EXPECT_EQ(100001, mWheel.now);
+    EXPECT_EQ(0U, mFired.timers.size());
+}
+
+TEST_F(TimerWheelTest, Order) {
+    static const int64_t kDelays[] = { 5, 1, 70, 63, 64, 5000, 300000 };
+    const int kCount = sizeof(kDelays) / sizeof(kDelays[0]);
+    for (int n = 0; n < kCount; ++n) {
+        Timer* timer = makeTimer(n);
+        timerWheel_add(&mWheel, &timer->entry, 1000 + kDelays[n]);
+        EXPECT_TRUE(timerWheelEntry_pending(&timer->entry));
+    }
+    EXPECT_EQ(7U, mWheel.count);
+    EXPECT_EQ(1001, timerWheel_nextTick(&mWheel));
+
+    advance(1004);
+    EXPECT_EQ(1U, mFired.timers.size());
+    advance(1000 + 300000);
+    ASSERT_EQ(7U, mFired.timers.size());
+    EXPECT_EQ(0U, mWheel.count);
+    EXPECT_EQ(-1, timerWheel_nextTick(&mWheel));
+
+    static const int kOrder[] = { 1, 0, 3, 4, 2, 5, 6 };
+    for (int n = 0; n < kCount; ++n) {
+        Timer* timer = mFired.timers[n];
+        EXPECT_EQ(kOrder[n], timer->id);
+        EXPECT_EQ(1000 + kDelays[timer->id], timer->fired);
+        EXPECT_FALSE(timerWheelEntry_pending(&timer->entry));
+    }
+}
+
+TEST_F(TimerWheelTest, Remove) {
+    Timer* a = makeTimer(0);
+    Timer* b = makeTimer(1);
+    Timer* c = makeTimer(2);
+    timerWheel_add(&mWheel, &a->entry, 1100);
+    timerWheel_add(&mWheel, &b->entry, 1100);
+    timerWheel_add(&mWheel, &c->entry, 1100);
+    timerWheel_remove(&mWheel, &b->entry);
+    timerWheel_remove(&mWheel, &b->entry);
+    EXPECT_FALSE(timerWheelEntry_pending(&b->entry));
+    EXPECT_EQ(2U, mWheel.count);
+
+    // Moving a pending timer.
+    timerWheel_add(&mWheel, &c->entry, 1200);
+    EXPECT_EQ(2U, mWheel.count);
+
+    advance(1150);
+    ASSERT_EQ(1U, mFired.timers.size());
+    EXPECT_EQ(a, mFired.timers[0]);
+    timerWheel_remove(&mWheel, &c->entry);
+    EXPECT_EQ(-1, timerWheel_nextTick(&mWheel));
+    advance(2000);
+    EXPECT_EQ(1U, mFired.timers.size());
+}
+
+TEST_F(TimerWheelTest, NextTick) {
+    Timer* timer = makeTimer(0);
+    // Level 1: woken up when the timer moves to level 0, then on time.
+    timerWheel_add(&mWheel, &timer->entry, 1000 + 200);
+    int64_t next = timerWheel_nextTick(&mWheel);
+    EXPECT_GT(next, 1000);
+    EXPECT_LE(next, 1200);
+    advance(next);
+    EXPECT_EQ(1200, timerWheel_nextTick(&mWheel));
+
+    // Past expirations are due at the next tick.
+    timerWheel_add(&mWheel, &timer->entry, 10);
+    EXPECT_EQ(mWheel.now, timerWheel_nextTick(&mWheel));
+    advance(mWheel.now);
+    EXPECT_EQ(1U, mFired.timers.size());
+}
+
+TEST_F(TimerWheelTest, Rearm) {
+    Timer* timer = makeTimer(0);
+    timer->rearm = 500;
+    timerWheel_add(&mWheel, &timer->entry, 1010);
+    advance(1010);
+    EXPECT_EQ(1U, mFired.timers.size());
+    EXPECT_TRUE(timerWheelEntry_pending(&timer->entry));
+    advance(5000);
+    ASSERT_EQ(2U, mFired.timers.size());
+    EXPECT_EQ(1510, timer->fired);
+}
+
+TEST_F(TimerWheelTest, BeyondRange) {
+    // Four levels of 64 slots reach 2^24 ticks.
+    const int64_t kFar = 1000 + (1LL << 24) * 3 + 12345;
+    Timer* timer = makeTimer(0);
+    timerWheel_add(&mWheel, &timer->entry, kFar);
+    int wakeups = 0;
+    while (mFired.timers.empty()) {
+        int64_t next = timerWheel_nextTick(&mWheel);
+        ASSERT_GE(next, mWheel.now);
+        advance(next);
+        wakeups++;
+    }
+    EXPECT_EQ(kFar, timer->fired);
+    EXPECT_LT(wakeups, 20);
+}
+
+TEST_F(TimerWheelTest, Random) {
+    const int kTimers = 20000;
+    srand(1234);
+    for (int n = 0; n < kTimers; ++n) {
+        Timer* timer = makeTimer(n);
+        int64_t delay = rand() % (n % 10 ? 5000 : 2000000);
+        timerWheel_add(&mWheel, &timer->entry, 1000 + delay);
+    }
+    // Remove a tenth of them.
+    for (int n = 0; n < kTimers; n += 10) {
+        timerWheel_remove(&mWheel, &mTimers[n]->entry);
+    }
+    int64_t now = 1000;
+    while (mWheel.count > 0) {
+        now += rand() % 3000;
+        advance(now);
+    }
+    ASSERT_EQ((size_t)(kTimers - kTimers / 10), mFired.timers.size());
+    for (size_t n = 0; n < mFired.timers.size(); ++n) {
+        Timer* timer = mFired.timers[n];
+        EXPECT_NE(0, timer->id % 10);
+        EXPECT_EQ(timer->entry.expires, timer->fired);
+        if (n > 0) {
+            EXPECT_LE(mFired.timers[n - 1]->fired, timer->fired);
+        }
+    }
+}
@@ -0,0 +1,1025 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/trace_ring.h"
+
+#include "android/utils/hot_profiler.h"
+#include "android/utils/stralloc.h"
+#include "android/utils/system.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  include <io.h>
+#else
+#  include <limits.h>
+#  include <signal.h>
+#  include <unistd.h>
+#endif
+#ifdef __APPLE__
+#  include <pthread.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// An event is stored as a timestamp, its format's address and then its
+// arguments, split over consecutive records.
+#define TRACE_EVENT_HEADER  16
+#define TRACE_RECORD_DATA   (TRACE_RING_RECORD_SIZE - 8)
+#define TRACE_MAX_RECORDS   \
+    ((TRACE_EVENT_HEADER + TRACE_RING_MAX_PAYLOAD + TRACE_RECORD_DATA - 1) / \
+     TRACE_RECORD_DATA)
+
+enum {
+    TRACE_RECORD_FIRST = 1,
+    TRACE_RECORD_NEXT,
+};
+
+typedef struct {
+    uint32_t  seq;      // Low bits of the record's position + 1, set last.
+    uint16_t  length;   // Bytes of event data, in the first record.
+    uint8_t   kind;     // TRACE_RECORD_FIRST or TRACE_RECORD_NEXT.
+    uint8_t   count;    // Records of the event, in the first record.
+    uint8_t   data[TRACE_RECORD_DATA];
+} TraceRecord;
+
+// Types of the arguments, as read by va_arg(). Each is recorded as 8
+// bytes, except strings.
+typedef enum {
+    TRACE_ARG_INT = 0,
+    TRACE_ARG_LONG,
+    TRACE_ARG_LLONG,
+    TRACE_ARG_SIZE,
+    TRACE_ARG_INTMAX,
+    TRACE_ARG_PTRDIFF,
+    TRACE_ARG_PTR,
+    TRACE_ARG_DOUBLE,
+    TRACE_ARG_LDOUBLE,
+    TRACE_ARG_STRING,
+    TRACE_ARG_SKIP,     // %n, not recorded.
+} TraceArgType;
+
+// Most arguments of a format, others are ignored.
+#define TRACE_MAX_ARGS  24
+
+// A conversion of a format: its text, and the arguments it takes.
+typedef struct {
+    const char*   start;
+    const char*   end;
+    bool          star_width;
+    bool          star_precision;
+    int           precision;    // Literal precision, or -1.
+    TraceArgType  type;
+} TraceConversion;
+
+typedef struct {
+    uint8_t  type;
+    uint8_t  limit;     // Longest string, 0 for the previous argument.
+} TraceArg;
+
+typedef struct {
+    const char*  fmt;
+    uint8_t      count;
+    uint8_t      strings;
+    TraceArg     args[TRACE_MAX_ARGS];
+} TraceSignature;
+
+// Signatures of the recently used formats, per thread.
+#define TRACE_CACHE_SIZE  64
+
+typedef struct TraceRing {
+    struct TraceRing*  next;
+    TraceRecord*       records;
+    uint32_t           index;
+    uint32_t           mask;
+    volatile uint64_t  head;        // Records written.
+    volatile uint64_t  events;
+    TraceSignature     cache[TRACE_CACHE_SIZE];
+} TraceRing;
+
+// The rings of all threads, which are only added at the front.
+static TraceRing* volatile _rings;
+static uint32_t _ring_count;
+static uint32_t _ring_size = TRACE_RING_DEFAULT_SIZE;
+
+// The stores to a record must be seen by other threads in order, which
+// x86 already guarantees.
+#if defined(__i386__) || defined(__x86_64__)
+#define TRACE_WMB()  __asm__ __volatile__("" ::: "memory")
+#else
+#define TRACE_WMB()  __sync_synchronize()
+#endif
+#define TRACE_RMB()  __sync_synchronize()
+
+// Return the next conversion of the format at |*p|, and advance |*p|
+// after it. Return false at the end of the format, or at a conversion
+// that isn't supported, such as positional arguments.
+static bool traceFormat_next(const char** p, TraceConversion* conv) {
+    const char* s = *p;
+    int longs = 0;
+
+    for (;;) {
+        s = strchr(s, '%');
+        if (!s) {
+            return false;
+        }
+        if (s[1] != '%') {
+            break;
+        }
+        s += 2;
+    }
+    conv->start = s++;
+    conv->star_width = false;
+    conv->star_precision = false;
+    conv->precision = -1;
+
+    while (*s && strchr("-+ #0'", *s)) {
+        s++;
+    }
+    if (*s == '*') {
+        conv->star_width = true;
+        s++;
+    } else {
+        while (*s >= '0' && *s <= '9') {
+            s++;
+        }
+    }
+    if (*s == '.') {
+        s++;
+        if (*s == '*') {
+            conv->star_precision = true;
+            s++;
+        } else {
+            conv->precision = 0;
+            while (*s >= '0' && *s <= '9') {
+                conv->precision = conv->precision * 10 + (*s++ - '0');
+            }
+        }
+    }
+
+    conv->type = TRACE_ARG_INT;
+    for (;; s++) {
+        switch (*s) {
+        case 'h':
+            continue;
+        case 'l':
+            conv->type = ++longs > 1 ? TRACE_ARG_LLONG : TRACE_ARG_LONG;
+            continue;
+        case 'q':
+        case 'L':
+            conv->type = TRACE_ARG_LLONG;
+            continue;
+        case 'z':
+            conv->type = TRACE_ARG_SIZE;
+            continue;
+        case 'j':
+            conv->type = TRACE_ARG_INTMAX;
+            continue;
+        case 't':
+            conv->type = TRACE_ARG_PTRDIFF;
+            continue;
+        }
+        break;
+    }
+
+    switch (*s) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        break;
+    case 'c':
+        conv->type = TRACE_ARG_INT;
+        break;
+    case 'p':
+        conv->type = TRACE_ARG_PTR;
+        break;
+    case 's':
+        if (conv->type != TRACE_ARG_INT) {
+            return false;   // Wide strings.
+        }
+        conv->type = TRACE_ARG_STRING;
+        break;
+    case 'n':
+        conv->type = TRACE_ARG_SKIP;
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+    case 'a': case 'A':
+        conv->type = (conv->type == TRACE_ARG_LLONG) ? TRACE_ARG_LDOUBLE
+                                                     : TRACE_ARG_DOUBLE;
+        break;
+    default:
+        return false;
+    }
+    conv->end = ++s;
+    *p = s;
+    return true;
+}
+
+static void traceSignature_add(TraceSignature* sig, TraceArgType type,
+                               int limit) {
+    if (sig->count < TRACE_MAX_ARGS) {
+        sig->args[sig->count].type = type;
+        sig->args[sig->count].limit = limit;
+        sig->count++;
+    }
+}
+
+static void traceSignature_parse(TraceSignature* sig, const char* fmt) {
+    TraceConversion conv;
+    const char* p = fmt;
+    int n;
+
+    sig->fmt = fmt;
+    sig->count = 0;
+    sig->strings = 0;
+    while (traceFormat_next(&p, &conv)) {
+        if (conv.star_width) {
+            traceSignature_add(sig, TRACE_ARG_INT, 0);
+        }
+        if (conv.star_precision) {
+            traceSignature_add(sig, TRACE_ARG_INT, 0);
+        }
+        if (conv.type == TRACE_ARG_STRING) {
+            int limit = TRACE_RING_MAX_STRING;
+            if (conv.star_precision) {
+                limit = 0;
+            } else if (conv.precision >= 0 && conv.precision < limit) {
+                // A limit of 0 means the previous argument, see below.
+                limit = conv.precision ? conv.precision : 1;
+            }
+            traceSignature_add(sig, TRACE_ARG_STRING, limit);
+        } else {
+            traceSignature_add(sig, conv.type, 0);
+        }
+    }
+    for (n = 0; n < sig->count; ++n) {
+        if (sig->args[n].type == TRACE_ARG_STRING) {
+            sig->strings++;
+        }
+    }
+}
+
+#ifdef __APPLE__
+static pthread_key_t _ring_key;
+static pthread_once_t _ring_key_once = PTHREAD_ONCE_INIT;
+
+static void traceRing_createKey(void) {
+    pthread_key_create(&_ring_key, NULL);
+}
+
+static TraceRing* traceRing_get(void) {
+    pthread_once(&_ring_key_once, traceRing_createKey);
+    return pthread_getspecific(_ring_key);
+}
+
+static void traceRing_set(TraceRing* ring) {
+    pthread_setspecific(_ring_key, ring);
+}
+#else
+static __thread TraceRing* _current_ring;
+
+static TraceRing* traceRing_get(void) {
+    return _current_ring;
+}
+
+static void traceRing_set(TraceRing* ring) {
+    _current_ring = ring;
+}
+#endif
+
+// Return the ring of the calling thread, created on its first event.
+// Rings are never freed, so that the events of the threads that exited
+// are dumped too.
+static TraceRing* traceRing_current(void) {
+    TraceRing* ring = traceRing_get();
+    if (ring) {
+        return ring;
+    }
+    ANEW0(ring);
+    ring->mask = _ring_size - 1;
+    AARRAY_NEW0(ring->records, _ring_size);
+    ring->index = __sync_fetch_and_add(&_ring_count, 1);
+    do {
+        ring->next = _rings;
+    } while (!__sync_bool_compare_and_swap(&_rings, ring->next, ring));
+    traceRing_set(ring);
+    return ring;
+}
+
+void traceRing_setSize(uint32_t records) {
+    uint32_t size = 1;
+    while (size < records && size < (1U << 30)) {
+        size <<= 1;
+    }
+    // An event must fit, with room for older ones.
+    if (size < 64) {
+        size = 64;
+    }
+    _ring_size = size;
+}
+
+static void traceRing_write(TraceRing* ring, const uint8_t* data,
+                            size_t length) {
+    uint32_t count = (length + TRACE_RECORD_DATA - 1) / TRACE_RECORD_DATA;
+    uint64_t pos = ring->head;
+    uint32_t n;
+
+    for (n = 0; n < count; ++n, data += TRACE_RECORD_DATA) {
+        TraceRecord* rec = &ring->records[(pos + n) & ring->mask];
+        rec->seq = 0;
+        TRACE_WMB();
+        rec->length = length;
+        rec->kind = n ? TRACE_RECORD_NEXT : TRACE_RECORD_FIRST;
+        rec->count = count;
+        memcpy(rec->data, data, TRACE_RECORD_DATA);
+        TRACE_WMB();
+        rec->seq = (uint32_t)(pos + n + 1);
+    }
+    TRACE_WMB();
+    ring->head = pos + count;
+    ring->events++;
+}
+
+static inline uint8_t* tracePut64(uint8_t* out, uint64_t value) {
+    memcpy(out, &value, sizeof(value));
+    return out + sizeof(value);
+}
+
+void traceRing_vrecord(const char* fmt, va_list args) {
+    TraceRing* ring = traceRing_current();
+    TraceSignature* sig;
+    uint8_t data[TRACE_MAX_RECORDS * TRACE_RECORD_DATA];
+    uint8_t* out = data;
+    int64_t last_int = -1;
+    size_t room;
+    int n;
+
+    sig = &ring->cache[((uintptr_t)fmt >> 3) & (TRACE_CACHE_SIZE - 1)];
+    if (sig->fmt != fmt) {
+        traceSignature_parse(sig, fmt);
+    }
+    // What the strings can use.
+    room = TRACE_RING_MAX_PAYLOAD - (sig->count - sig->strings) * 8 -
+           sig->strings;
+
+    out = tracePut64(out, hotProfiler_now());
+    out = tracePut64(out, (uintptr_t)fmt);
+    for (n = 0; n < sig->count; ++n) {
+        switch (sig->args[n].type) {
+        case TRACE_ARG_INT:
+            last_int = va_arg(args, int);
+            out = tracePut64(out, last_int);
+            break;
+        case TRACE_ARG_LONG:
+            out = tracePut64(out, va_arg(args, long));
+            break;
+        case TRACE_ARG_LLONG:
+            out = tracePut64(out, va_arg(args, long long));
+            break;
+        case TRACE_ARG_SIZE:
+            out = tracePut64(out, va_arg(args, size_t));
+            break;
+        case TRACE_ARG_INTMAX:
+            out = tracePut64(out, va_arg(args, intmax_t));
+            break;
+        case TRACE_ARG_PTRDIFF:
+            out = tracePut64(out, va_arg(args, ptrdiff_t));
+            break;
+        case TRACE_ARG_PTR:
+            out = tracePut64(out, (uintptr_t)va_arg(args, void*));
+            break;
+        case TRACE_ARG_DOUBLE:
+        case TRACE_ARG_LDOUBLE: {
+            double value = (sig->args[n].type == TRACE_ARG_DOUBLE)
+                    ? va_arg(args, double)
+                    : (double)va_arg(args, long double);
+            memcpy(out, &value, sizeof(value));
+            out += sizeof(value);
+            break;
+        }
+        case TRACE_ARG_STRING: {
+            const char* str = va_arg(args, const char*);
+            size_t limit = sig->args[n].limit;
+            const char* end;
+            size_t len;
+
+            if (!str) {
+                str = "(null)";
+            }
+            if (!limit) {
+                limit = (last_int >= 0 && last_int < TRACE_RING_MAX_STRING)
+                        ? last_int : TRACE_RING_MAX_STRING;
+            }
+            if (limit > room) {
+                limit = room;
+            }
+            // Not strlen(), as a precision allows unterminated strings.
+            end = memchr(str, 0, limit);
+            len = end ? (size_t)(end - str) : limit;
+            *out++ = len;
+            memcpy(out, str, len);
+            out += len;
+            room -= len;
+            break;
+        }
+        case TRACE_ARG_SKIP:
+            va_arg(args, void*);
+            break;
+        }
+    }
+    traceRing_write(ring, data, out - data);
+}
+
+void traceRing_record(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    traceRing_vrecord(fmt, args);
+    va_end(args);
+}
+
+void traceRing_getStats(TraceRingStats* stats) {
+    TraceRing* ring;
+
+    memset(stats, 0, sizeof(*stats));
+    for (ring = _rings; ring; ring = ring->next) {
+        uint64_t head = ring->head;
+        uint64_t events = ring->events;
+        uint64_t first = head > ring->mask ? head - ring->mask - 1 : 0;
+        uint64_t kept = 0;
+        uint64_t pos;
+
+        // Count the events that are still in the ring.
+        for (pos = first; pos < head; ++pos) {
+            const TraceRecord* rec = &ring->records[pos & ring->mask];
+            if (rec->kind == TRACE_RECORD_FIRST &&
+                rec->seq == (uint32_t)(pos + 1)) {
+                kept++;
+            }
+        }
+        stats->threads++;
+        stats->events += events;
+        stats->records += head;
+        if (events > kept) {
+            stats->lost += events - kept;
+        }
+    }
+}
+
+/* DUMPS
+ *
+ * A dump starts with a TraceDumpHeader, followed by each ring as a
+ * TraceDumpRing and its records, and ends with the formats as a count,
+ * then each as its address, length, and text.
+ */
+
+#define TRACE_DUMP_MAGIC    "QTRACE\r\n"
+#define TRACE_DUMP_VERSION  1
+
+typedef struct {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  record_size;
+    uint32_t  rings;
+    uint32_t  reserved;
+} TraceDumpHeader;
+
+typedef struct {
+    uint32_t  index;
+    uint32_t  size;
+    uint64_t  head;
+} TraceDumpRing;
+
+typedef struct {
+    uint64_t  address;
+    uint32_t  length;
+    uint32_t  reserved;
+} TraceDumpFormat;
+
+// Formats of the events being dumped, as a hash table that doesn't need
+// malloc(), which can't be called from a signal handler.
+#define TRACE_DUMP_MAX_FORMATS  4096
+
+static const char* _dump_formats[TRACE_DUMP_MAX_FORMATS];
+static volatile int _dumping;
+
+static int traceDump_write(int fd, const void* data, size_t size) {
+    const char* p = data;
+    while (size > 0) {
+        int ret = write(fd, p, size);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        p += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+static void traceDump_addFormats(const TraceRing* ring) {
+    uint64_t head = ring->head;
+    uint64_t pos = head > ring->mask ? head - ring->mask - 1 : 0;
+
+    TRACE_RMB();
+    for (; pos < head; ++pos) {
+        const TraceRecord* rec = &ring->records[pos & ring->mask];
+        uint64_t address;
+        uint32_t slot;
+        int probe;
+
+        if (rec->kind != TRACE_RECORD_FIRST ||
+            rec->seq != (uint32_t)(pos + 1)) {
+            continue;
+        }
+        memcpy(&address, rec->data + 8, sizeof(address));
+        TRACE_RMB();
+        if (rec->seq != (uint32_t)(pos + 1)) {
+            continue;  // Overwritten while reading it.
+        }
+        slot = (uint32_t)((address >> 3) * 2654435761U);
+        for (probe = 0; probe < TRACE_DUMP_MAX_FORMATS; ++probe) {
+            const char** entry =
+                    &_dump_formats[(slot + probe) % TRACE_DUMP_MAX_FORMATS];
+            if (!*entry) {
+                *entry = (const char*)(uintptr_t)address;
+            }
+            if (*entry == (const char*)(uintptr_t)address) {
+                break;
+            }
+        }
+    }
+}
+
+int traceRing_dumpFd(int fd) {
+    TraceRing* first = _rings;
+    TraceRing* ring;
+    TraceDumpHeader header;
+    uint32_t count = 0;
+    int ret = 0;
+    int n;
+
+    if (__sync_lock_test_and_set(&_dumping, 1)) {
+        return -EBUSY;
+    }
+    memset(_dump_formats, 0, sizeof(_dump_formats));
+
+    for (ring = first; ring; ring = ring->next) {
+        count++;
+        // The formats of the events that are overwritten while dumping
+        // are added below.
+        traceDump_addFormats(ring);
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_DUMP_MAGIC, sizeof(header.magic));
+    header.version = TRACE_DUMP_VERSION;
+    header.record_size = TRACE_RING_RECORD_SIZE;
+    header.rings = count;
+    ret = traceDump_write(fd, &header, sizeof(header));
+
+    for (ring = first; ring && !ret; ring = ring->next) {
+        TraceDumpRing info;
+        info.index = ring->index;
+        info.size = ring->mask + 1;
+        info.head = ring->head;
+        TRACE_RMB();
+        ret = traceDump_write(fd, &info, sizeof(info));
+        if (!ret) {
+            ret = traceDump_write(fd, ring->records,
+                                  info.size * sizeof(TraceRecord));
+        }
+        traceDump_addFormats(ring);
+    }
+
+    count = 0;
+    for (n = 0; n < TRACE_DUMP_MAX_FORMATS; ++n) {
+        count += _dump_formats[n] != NULL;
+    }
+    if (!ret) {
+        ret = traceDump_write(fd, &count, sizeof(count));
+    }
+    for (n = 0; n < TRACE_DUMP_MAX_FORMATS && !ret; ++n) {
+        TraceDumpFormat format;
+        if (!_dump_formats[n]) {
+            continue;
+        }
+        format.address = (uintptr_t)_dump_formats[n];
+        format.length = strlen(_dump_formats[n]);
+        format.reserved = 0;
+        ret = traceDump_write(fd, &format, sizeof(format));
+        if (!ret) {
+            ret = traceDump_write(fd, _dump_formats[n], format.length);
+        }
+    }
+    __sync_lock_release(&_dumping);
+    return ret;
+}
+
+int traceRing_dump(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    int ret;
+
+    if (fd < 0) {
+        return -1;
+    }
+    ret = traceRing_dumpFd(fd);
+    close(fd);
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+    return 0;
+}
+
+#ifndef _WIN32
+static char _crash_path[PATH_MAX];
+
+static void traceRing_onCrash(int sig) {
+    int fd = open(_crash_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        traceRing_dumpFd(fd);
+        close(fd);
+    }
+    // The default action was restored, and runs when the handler returns.
+    raise(sig);
+}
+#endif
+
+void traceRing_dumpOnCrash(const char* path) {
+#ifndef _WIN32
+    static const int kSignals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+    struct sigaction act;
+    size_t n;
+
+    snprintf(_crash_path, sizeof(_crash_path), "%s", path);
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = traceRing_onCrash;
+    act.sa_flags = SA_RESETHAND;
+    sigemptyset(&act.sa_mask);
+    for (n = 0; n < sizeof(kSignals) / sizeof(kSignals[0]); ++n) {
+        sigaction(kSignals[n], &act, NULL);
+    }
+#else
+    (void)path;
+#endif
+}
+
+/* DECODING
+ */
+
+typedef struct {
+    int64_t         time_ns;
+    uint32_t        thread;
+    uint32_t        length;
+    size_t          offset; // Of its timestamp, format address, then
+                            // arguments, in the decoded data.
+} TraceEvent;
+
+typedef struct {
+    uint64_t     address;
+    const char*  text;      // Zero-terminated copy.
+} TraceFormat;
+
+static int traceEvent_compare(const void* a, const void* b) {
+    const TraceEvent* ea = a;
+    const TraceEvent* eb = b;
+    if (ea->time_ns != eb->time_ns) {
+        return ea->time_ns < eb->time_ns ? -1 : 1;
+    }
+    if (ea->thread != eb->thread) {
+        return ea->thread < eb->thread ? -1 : 1;
+    }
+    // Events of a thread are already in order.
+    return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+}
+
+static int traceFormat_compare(const void* a, const void* b) {
+    const TraceFormat* fa = a;
+    const TraceFormat* fb = b;
+    return fa->address < fb->address ? -1 : fa->address > fb->address;
+}
+
+static uint64_t traceGet64(const uint8_t** p, const uint8_t* end) {
+    uint64_t value = 0;
+    if (end - *p >= 8) {
+        memcpy(&value, *p, sizeof(value));
+        *p += 8;
+    } else {
+        *p = end;
+    }
+    return value;
+}
+
+// Append |conv| of |fmt| to |out| with its arguments from |*p|.
+static void traceEvent_formatOne(stralloc_t* out, const TraceConversion* conv,
+                                 const uint8_t** p, const uint8_t* end) {
+    char spec[64];
+    int width = 0, precision = 0;
+    size_t len = conv->end - conv->start;
+
+    if (len >= sizeof(spec)) {
+        stralloc_add_bytes(out, conv->start, len);
+        return;
+    }
+    memcpy(spec, conv->start, len);
+    spec[len] = 0;
+    if (conv->star_width) {
+        width = (int)traceGet64(p, end);
+    }
+    if (conv->star_precision) {
+        precision = (int)traceGet64(p, end);
+    }
+
+// The spec takes 0, 1 or 2 int arguments before the value.
+#define TRACE_FORMAT(value) \
+    do { \
+        if (conv->star_width && conv->star_precision) { \
+            stralloc_add_format(out, spec, width, precision, value); \
+        } else if (conv->star_width) { \
+            stralloc_add_format(out, spec, width, value); \
+        } else if (conv->star_precision) { \
+            stralloc_add_format(out, spec, precision, value); \
+        } else { \
+            stralloc_add_format(out, spec, value); \
+        } \
+    } while (0)
+
+    switch (conv->type) {
+    case TRACE_ARG_INT:
+        TRACE_FORMAT((int)traceGet64(p, end));
+        break;
+    case TRACE_ARG_LONG:
+        TRACE_FORMAT((long)traceGet64(p, end));
+        break;
+    case TRACE_ARG_LLONG:
+        TRACE_FORMAT((long long)traceGet64(p, end));
+        break;
+    case TRACE_ARG_SIZE:
+        TRACE_FORMAT((size_t)traceGet64(p, end));
+        break;
+    case TRACE_ARG_INTMAX:
+        TRACE_FORMAT((intmax_t)traceGet64(p, end));
+        break;
+    case TRACE_ARG_PTRDIFF:
+        TRACE_FORMAT((ptrdiff_t)traceGet64(p, end));
+        break;
+    case TRACE_ARG_PTR:
+        TRACE_FORMAT((void*)(uintptr_t)traceGet64(p, end));
+        break;
+    case TRACE_ARG_DOUBLE:
+    case TRACE_ARG_LDOUBLE: {
+        uint64_t bits = traceGet64(p, end);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (conv->type == TRACE_ARG_DOUBLE) {
+            TRACE_FORMAT(value);
+        } else {
+            TRACE_FORMAT((long double)value);
+        }
+        break;
+    }
+    case TRACE_ARG_STRING: {
+        char str[TRACE_RING_MAX_STRING + 1];
+        size_t n = 0;
+        if (*p < end) {
+            n = *(*p)++;
+            if (n > (size_t)(end - *p)) {
+                n = end - *p;
+            }
+            memcpy(str, *p, n);
+            *p += n;
+        }
+        str[n] = 0;
+        TRACE_FORMAT(str);
+        break;
+    }
+    case TRACE_ARG_SKIP:
+        break;
+    }
+#undef TRACE_FORMAT
+}
+
+static void traceEvent_format(stralloc_t* out, const uint8_t* data,
+                              const TraceEvent* event,
+                              const TraceFormat* formats, int count) {
+    const uint8_t* p = data + event->offset + 8;
+    const uint8_t* end = data + event->offset + event->length;
+    TraceFormat key;
+    const TraceFormat* format;
+    TraceConversion conv;
+    const char* s;
+    int args = 0;
+
+    key.address = traceGet64(&p, end);
+    format = bsearch(&key, formats, count, sizeof(*formats),
+                     traceFormat_compare);
+    if (!format) {
+        stralloc_add_format(out, "<unknown format 0x%llx>\n",
+                            (unsigned long long)key.address);
+        return;
+    }
+
+    s = format->text;
+    for (;;) {
+        const char* start = s;
+        if (!traceFormat_next(&s, &conv)) {
+            break;
+        }
+        // Literal text, with %% as %.
+        while (start < conv.start) {
+            if (start[0] == '%' && start[1] == '%') {
+                start++;
+            }
+            stralloc_add_c(out, *start++);
+        }
+        args += conv.star_width + conv.star_precision + 1;
+        if (args > TRACE_MAX_ARGS) {
+            // Not recorded, as traceSignature_parse() ignores them.
+            s = conv.start;
+            break;
+        }
+        traceEvent_formatOne(out, &conv, &p, end);
+    }
+    while (*s) {
+        if (s[0] == '%' && s[1] == '%') {
+            s++;
+        }
+        stralloc_add_c(out, *s++);
+    }
+}
+
+int traceRing_decode(const char* path, TraceRingEventFunc func,
+                     void* opaque) {
+    FILE* file = fopen(path, "rb");
+    uint8_t* data = NULL;
+    size_t size = 0, capacity = 0, pos;
+    TraceDumpHeader header;
+    TraceEvent* events = NULL;
+    int count = 0, max_events = 0;
+    TraceFormat* formats = NULL;
+    uint32_t format_count = 0;
+    uint8_t* pool = NULL;
+    size_t pool_size = 0, pool_used = 0;
+    int64_t origin = 0;
+    uint32_t n;
+    int ret = -1;
+
+    if (!file) {
+        return -1;
+    }
+    for (;;) {
+        size_t got;
+        if (size == capacity) {
+            capacity = capacity ? capacity * 2 : 1 << 20;
+            AARRAY_RENEW(data, capacity);
+        }
+        got = fread(data + size, 1, capacity - size, file);
+        if (!got) {
+            break;
+        }
+        size += got;
+    }
+    fclose(file);
+
+    errno = EINVAL;
+    if (size < sizeof(header)) {
+        goto EXIT;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, TRACE_DUMP_MAGIC, sizeof(header.magic)) ||
+        header.version != TRACE_DUMP_VERSION ||
+        header.record_size != TRACE_RING_RECORD_SIZE) {
+        goto EXIT;
+    }
+    pos = sizeof(header);
+
+    // The events of all the rings. Those that span several records are
+    // copied to |pool|, which is allocated for the worst case.
+    for (n = 0; n < header.rings; ++n) {
+        TraceDumpRing ring;
+        const TraceRecord* records;
+        uint64_t first, p;
+
+        if (size - pos < sizeof(ring)) {
+            goto EXIT;
+        }
+        memcpy(&ring, data + pos, sizeof(ring));
+        pos += sizeof(ring);
+        if (!ring.size || (ring.size & (ring.size - 1)) ||
+            (size - pos) / sizeof(TraceRecord) < ring.size) {
+            goto EXIT;
+        }
+        records = (const TraceRecord*)(data + pos);
+        pos += ring.size * sizeof(TraceRecord);
+
+        pool_size += ring.size * TRACE_RECORD_DATA;
+        AARRAY_RENEW(pool, pool_size);
+
+        first = ring.head > ring.size ? ring.head - ring.size : 0;
+        for (p = first; p < ring.head; ++p) {
+            const TraceRecord* rec = &records[p & (ring.size - 1)];
+            uint32_t r;
+
+            if (rec->kind != TRACE_RECORD_FIRST ||
+                rec->seq != (uint32_t)(p + 1) ||
+                rec->count * TRACE_RECORD_DATA < rec->length ||
+                rec->length < TRACE_EVENT_HEADER ||
+                p + rec->count > ring.head) {
+                continue;
+            }
+            for (r = 1; r < rec->count; ++r) {
+                const TraceRecord* next = &records[(p + r) & (ring.size - 1)];
+                if (next->kind != TRACE_RECORD_NEXT ||
+                    next->seq != (uint32_t)(p + r + 1)) {
+                    break;
+                }
+            }
+            if (r < rec->count) {
+                continue;  // Partly overwritten.
+            }
+            if (count == max_events) {
+                max_events = max_events ? max_events * 2 : 1024;
+                AARRAY_RENEW(events, max_events);
+            }
+            events[count].thread = ring.index;
+            events[count].length = rec->length;
+            events[count].offset = pool_used;
+            for (r = 0; r < rec->count; ++r) {
+                memcpy(pool + pool_used,
+                       records[(p + r) & (ring.size - 1)].data,
+                       TRACE_RECORD_DATA);
+                pool_used += TRACE_RECORD_DATA;
+            }
+            memcpy(&events[count].time_ns, rec->data, 8);
+            count++;
+            p += rec->count - 1;
+        }
+    }
+    if (size - pos < sizeof(format_count)) {
+        goto EXIT;
+    }
+    memcpy(&format_count, data + pos, sizeof(format_count));
+    pos += sizeof(format_count);
+    if (format_count > TRACE_DUMP_MAX_FORMATS) {
+        goto EXIT;
+    }
+    AARRAY_NEW0(formats, format_count);
+    for (n = 0; n < format_count; ++n) {
+        TraceDumpFormat format;
+        char* text;
+
+        if (size - pos < sizeof(format)) {
+            goto EXIT;
+        }
+        memcpy(&format, data + pos, sizeof(format));
+        pos += sizeof(format);
+        if (size - pos < format.length) {
+            goto EXIT;
+        }
+        AARRAY_NEW(text, format.length + 1);
+        memcpy(text, data + pos, format.length);
+        text[format.length] = 0;
+        pos += format.length;
+        formats[n].address = format.address;
+        formats[n].text = text;
+    }
+    qsort(formats, format_count, sizeof(*formats), traceFormat_compare);
+
+    qsort(events, count, sizeof(*events), traceEvent_compare);
+    if (count > 0) {
+        origin = events[0].time_ns;
+    }
+    for (n = 0; n < (uint32_t)count; ++n) {
+        STRALLOC_DEFINE(text);
+        traceEvent_format(text, pool, &events[n], formats, format_count);
+        func(opaque, events[n].thread, events[n].time_ns - origin,
+             text->s ? text->s : "", text->n);
+        stralloc_reset(text);
+    }
+    ret = count;
+
+EXIT:
+    if (formats) {
+        for (n = 0; n < format_count; ++n) {
+            AFREE((char*)formats[n].text);
+        }
+        AFREE(formats);
+    }
+    AFREE(events);
+    AFREE(pool);
+    AFREE(data);
+    return ret;
+}
@@ -0,0 +1,98 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_TRACE_RING_H
+#define ANDROID_UTILS_TRACE_RING_H
+
+#include "android/utils/compiler.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+// Binary trace rings, for the binary mode of qemu_log(), see qemu-log.c.
+//
+// Instead of formatting a message, traceRing_record() copies its format
+// string's address, a timestamp and its raw arguments into fixed-size
+// records of an in-memory ring that belongs to the calling thread. The
+// rings are created on first use, and are never locked: each has a single
+// writer, and readers detect the records that are being overwritten with
+// a sequence number. Once a ring is full, the oldest events are lost.
+//
+// The rings are written to a file by traceRing_dump(), on request or when
+// the process crashes, and the messages are only formatted later by
+// traceRing_decode(), see the emulator_trace_decode program.
+//
+// Format strings must remain valid until the dump, e.g. be literals. The
+// arguments of each event are limited to TRACE_RING_MAX_PAYLOAD bytes,
+// with the %s ones truncated to TRACE_RING_MAX_STRING characters.
+
+// Size of a ring record, which holds 56 bytes of the event data.
+#define TRACE_RING_RECORD_SIZE  64
+
+// Default number of records per ring, i.e. 4 MiB per thread.
+#define TRACE_RING_DEFAULT_SIZE 65536
+
+// Most bytes of arguments recorded per event, at 8 bytes per argument,
+// and 1 + length for strings.
+#define TRACE_RING_MAX_PAYLOAD  880
+
+// Longest %s argument recorded.
+#define TRACE_RING_MAX_STRING   255
+
+// Set the number of records, rounded up to a power of 2, of the rings
+// that are created from now on.
+void traceRing_setSize(uint32_t records);
+
+// Record an event for the printf-like |fmt| and its arguments in the ring
+// of the calling thread.
+void traceRing_record(const char* fmt, ...);
+void traceRing_vrecord(const char* fmt, va_list args);
+
+typedef struct {
+    uint32_t  threads;      // Rings created.
+    uint64_t  events;       // Events recorded.
+    uint64_t  records;      // Records written, including overwritten ones.
+    uint64_t  lost;         // Events that were overwritten.
+} TraceRingStats;
+
+// Fill |stats| for all the rings.
+void traceRing_getStats(TraceRingStats* stats);
+
+// Write all the rings to |fd|, with async-signal-safe calls only. Return
+// 0 on success, or a negative errno value.
+int traceRing_dumpFd(int fd);
+
+// Write all the rings to the file at |path|. Return 0 on success, or -1
+// with errno set.
+int traceRing_dump(const char* path);
+
+// Dump the rings to |path| when the process receives SIGSEGV, SIGBUS,
+// SIGILL, SIGFPE or SIGABRT, before it dies. Does nothing on Windows.
+void traceRing_dumpOnCrash(const char* path);
+
+// Called by traceRing_decode() for each event of a dump, with the index
+// of the thread that recorded it, its timestamp relative to the first
+// event, and the formatted message, which isn't zero-terminated.
+typedef void (*TraceRingEventFunc)(void* opaque, uint32_t thread,
+                                   int64_t time_ns, const char* text,
+                                   size_t len);
+
+// Format the events of the dump at |path| and pass them to |func| in
+// timestamp order. Return the number of events, or -1 with errno set,
+// to EINVAL if |path| isn't a dump.
+int traceRing_decode(const char* path, TraceRingEventFunc func, void* opaque);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_TRACE_RING_H
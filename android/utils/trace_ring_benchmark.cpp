@@ -0,0 +1,108 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// Measures the cost per qemu_log_mask() call of the messages that -d exec
+// and -d int produce: with the category disabled, recorded into the trace
+// ring, and formatted into the log file as qemu-log.c does in text mode.
+// Also reports the time to dump and decode the ring afterwards, which is
+// not paid by the emulation. Run with emulator_benchmarks.
+
+#include "android/utils/trace_ring.h"
+
+#include "android/filesystems/testing/TestSupport.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const int kEvents = 1000000;
+const int kLogExec = 1 << 5;
+
+enum Mode { kDisabled, kRing, kText };
+
+int sLogLevel;
+FILE* sLogFile;
+Mode sMode;
+
+// Same as qemu_log_mask() in qemu-log.c.
+void __attribute__((noinline)) logMask(int mask, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    if (sLogLevel & mask) {
+        if (sMode == kRing) {
+            traceRing_vrecord(fmt, args);
+        } else {
+            vfprintf(sLogFile, fmt, args);
+        }
+    }
+    va_end(args);
+}
+
+void countEvent(void* opaque, uint32_t, int64_t, const char*, size_t) {
+    ++*static_cast<int*>(opaque);
+}
+
+void measure(Mode mode) {
+    std::string path = android::testing::CreateTempFilePath();
+    static const char* const kNames[] = { "disabled", "ring", "text" };
+
+    sMode = mode;
+    sLogLevel = (mode == kDisabled) ? 0 : kLogExec;
+    sLogFile = fopen(path.c_str(), "w");
+    ASSERT_TRUE(sLogFile);
+    setvbuf(sLogFile, NULL, _IOLBF, 0);
+
+    clock_t start = clock();
+    for (int n = 0; n < kEvents; ++n) {
+        uintptr_t tb = 0x40000000 + n * 64;
+        uint32_t pc = 0xc0008000 + n * 4;
+        if (n % 16) {
+            logMask(kLogExec, "Trace %p [%08x] %s\n", (void*)tb, pc,
+                    "do_idle");
+        } else {
+            logMask(kLogExec, "%6d: v=%02x e=%04x i=%d cpl=%d pc=%08x\n",
+                    n, 0x20, 0, 1, 0, pc);
+        }
+    }
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    fclose(sLogFile);
+    unlink(path.c_str());
+    printf("%-8s: %7.1f ns/event\n", kNames[mode], secs * 1e9 / kEvents);
+
+    if (mode == kRing) {
+        int decoded = 0;
+        start = clock();
+        ASSERT_EQ(0, traceRing_dump(path.c_str()));
+        double dumpSecs = (double)(clock() - start) / CLOCKS_PER_SEC;
+        start = clock();
+        ASSERT_LT(0, traceRing_decode(path.c_str(), countEvent, &decoded));
+        double decodeSecs = (double)(clock() - start) / CLOCKS_PER_SEC;
+        printf("          dump %.1f ms, decode %d events in %.1f ms\n",
+               dumpSecs * 1e3, decoded, decodeSecs * 1e3);
+        unlink(path.c_str());
+    }
+}
+
+}  // namespace
+
+TEST(TraceRingBenchmark, CostPerEvent) {
+    measure(kDisabled);
+    measure(kRing);
+    measure(kText);
+}
@@ -0,0 +1,206 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/trace_ring.h"
+
+#include "android/filesystems/testing/TestSupport.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+struct Event {
+    uint32_t thread;
+    int64_t timeNs;
+    std::string text;
+};
+
+void onEvent(void* opaque, uint32_t thread, int64_t timeNs,
+             const char* text, size_t len) {
+    Event event;
+    event.thread = thread;
+    event.timeNs = timeNs;
+    event.text.assign(text, len);
+    static_cast<std::vector<Event>*>(opaque)->push_back(event);
+}
+
+// Dump the rings and return the last |count| events, as the rings keep
+// the events of the previous tests.
+std::vector<Event> dumpAndDecode(size_t count) {
+    std::string path = android::testing::CreateTempFilePath();
+    std::vector<Event> events;
+    EXPECT_EQ(0, traceRing_dump(path.c_str()));
+    EXPECT_LE((int)count, traceRing_decode(path.c_str(), onEvent, &events));
+    unlink(path.c_str());
+    if (events.size() > count) {
+        events.erase(events.begin(), events.end() - count);
+    }
+    return events;
+}
+
+std::string format(const char* fmt, ...) {
+    char text[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    return text;
+}
+
+}  // namespace
+
+TEST(TraceRing, FormatsLikePrintf) {
+    const char* null = NULL;
+    int x = 0;
+    std::vector<std::string> expected;
+
+#define CHECK_FORMAT(...) \
+    traceRing_record(__VA_ARGS__); \
+    expected.push_back(format(__VA_ARGS__))
+
+    CHECK_FORMAT("no arguments\n");
+    CHECK_FORMAT("%d %i %u %x %X %o %c\n", -42, 7, 3000000000U, 0xbeef,
+                 0xBEEF, 8, 'z');
+    CHECK_FORMAT("%hhd %hd %ld %lu %lld %llx\n", 1, -2, -3L, 4UL, -5LL,
+                 0x123456789abcULL);
+    CHECK_FORMAT("%08" PRIx64 " [%016" PRIx64 "] %zu\n",
+                 (uint64_t)0xabc, (uint64_t)-1, (size_t)1234);
+    CHECK_FORMAT("%5.2f %e %g %Lf\n", 3.14159, -1e10, 0.5, (long double)2.5);
+    CHECK_FORMAT("%s|%-8s|%8s|%.3s|%.*s|%*d\n", "str", "left", "right",
+                 "truncated", 2, "star", 6, 99);
+    CHECK_FORMAT("%s %p 100%%\n", null, &x);
+    CHECK_FORMAT("%d%n and the rest\n", 5, &x);
+
+#undef CHECK_FORMAT
+
+    std::vector<Event> events = dumpAndDecode(expected.size());
+    ASSERT_EQ(expected.size(), events.size());
+    for (size_t n = 0; n < expected.size(); ++n) {
+        EXPECT_EQ(expected[n], events[n].text);
+        EXPECT_EQ(events[0].thread, events[n].thread);
+        if (n > 0) {
+            EXPECT_LE(events[n - 1].timeNs, events[n].timeNs);
+        }
+    }
+}
+
+TEST(TraceRing, LongStrings) {
+    std::string a(TRACE_RING_MAX_STRING, 'a');
+    std::string b(1000, 'b');
+
+    // Spans several records.
+    traceRing_record("%s %s %s\n", a.c_str(), "-", a.c_str());
+    // Truncated to the longest string.
+    traceRing_record("%s\n", b.c_str());
+    // Truncated to the payload.
+    traceRing_record("%s%s%s%s\n", a.c_str(), a.c_str(), a.c_str(), a.c_str());
+
+    std::vector<Event> events = dumpAndDecode(3);
+    ASSERT_EQ(3U, events.size());
+    EXPECT_EQ(a + " - " + a + "\n", events[0].text);
+    EXPECT_EQ(std::string(TRACE_RING_MAX_STRING, 'b') + "\n", events[1].text);
+    std::string text = events[2].text;
+    EXPECT_GT(text.size(), 3 * a.size());
+    EXPECT_LT(text.size(), (size_t)TRACE_RING_MAX_PAYLOAD);
+    EXPECT_EQ(std::string(text.size() - 1, 'a') + "\n", text);
+}
+
+TEST(TraceRing, DecodeErrors) {
+    std::vector<Event> events;
+    std::string path = android::testing::CreateTempFilePath();
+
+    errno = 0;
+    EXPECT_EQ(-1, traceRing_decode((path + ".missing").c_str(), onEvent,
+                                   &events));
+    EXPECT_EQ(ENOENT, errno);
+
+    FILE* file = fopen(path.c_str(), "wb");
+    ASSERT_TRUE(file);
+    fputs("not a trace, but long enough to be one\n", file);
+    fclose(file);
+    EXPECT_EQ(-1, traceRing_decode(path.c_str(), onEvent, &events));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_TRUE(events.empty());
+    unlink(path.c_str());
+}
+
+#ifndef _WIN32
+
+namespace {
+
+const int kThreadEvents = 1000;
+
+void* recordEvents(void*) {
+    for (int n = 0; n < kThreadEvents; ++n) {
+        traceRing_record("thread event %d\n", n);
+    }
+    return NULL;
+}
+
+}  // namespace
+
+TEST(TraceRing, ThreadsAndWrapping) {
+    TraceRingStats before, after;
+    pthread_t thread;
+
+    traceRing_getStats(&before);
+    traceRing_setSize(100);     // Rounded up to 128.
+    ASSERT_EQ(0, pthread_create(&thread, NULL, recordEvents, NULL));
+    ASSERT_EQ(0, pthread_join(thread, NULL));
+    traceRing_setSize(TRACE_RING_DEFAULT_SIZE);
+    traceRing_record("main event\n");
+
+    traceRing_getStats(&after);
+    EXPECT_EQ(before.threads + 1, after.threads);
+    EXPECT_EQ(before.events + kThreadEvents + 1, after.events);
+    EXPECT_EQ(before.lost + kThreadEvents - 128, after.lost);
+
+    // The last events of the thread, then the one of the main thread.
+    std::vector<Event> events = dumpAndDecode(129);
+    ASSERT_EQ(129U, events.size());
+    for (int n = 0; n < 128; ++n) {
+        EXPECT_EQ(format("thread event %d\n", kThreadEvents - 128 + n),
+                  events[n].text);
+        EXPECT_EQ(events[0].thread, events[n].thread);
+    }
+    EXPECT_EQ("main event\n", events[128].text);
+    EXPECT_NE(events[0].thread, events[128].thread);
+}
+
+TEST(TraceRingDeathTest, DumpOnCrash) {
+    std::string path = android::testing::CreateTempFilePath();
+
+    EXPECT_DEATH({
+        traceRing_dumpOnCrash(path.c_str());
+        traceRing_record("about to crash %d\n", 42);
+        abort();
+    }, "");
+
+    std::vector<Event> events;
+    ASSERT_LT(0, traceRing_decode(path.c_str(), onEvent, &events));
+    EXPECT_EQ("about to crash 42\n", events.back().text);
+    unlink(path.c_str());
+}
+
+#endif  // !_WIN32
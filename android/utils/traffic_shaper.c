@@ -0,0 +1,532 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/traffic_shaper.h"
+
+#include "android/utils/system.h"
+
+#include <string.h>
+
+#define TRAFFIC_PROTOCOL_TCP  6
+#define TRAFFIC_PROTOCOL_UDP  17
+
+#define TRAFFIC_TCP_FIN  0x01
+#define TRAFFIC_TCP_SYN  0x02
+#define TRAFFIC_TCP_RST  0x04
+#define TRAFFIC_TCP_ACK  0x10
+
+#define TRAFFIC_RANDOM_SEED  0x2545f491
+
+// Initial size of the session table, which doubles when it has more
+// sessions than buckets.
+#define TRAFFIC_DELAY_MIN_BUCKETS  64
+
+// A queued or held frame, followed by its data if copied.
+struct TrafficPacket {
+    TrafficPacket*  next;
+    int64_t         time;       // When it can be sent.
+    size_t          size;
+    void*           opaque;
+    void*           data;
+};
+
+struct TrafficSession {
+    TimerWheelEntry    timer;       // First, to find a session from it.
+    TrafficSession*    next;        // In its hash bucket.
+    uint32_t           hash;
+    TrafficSessionKey  key;
+    int64_t            last_seen;   // In milliseconds.
+    TrafficPacket*     packet;      // The held SYN, if any.
+};
+
+// A xorshift generator, good enough for the loss and jitter models.
+static uint32_t trafficRandom(uint32_t* state) {
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static TrafficPacket* trafficPacket_new(PacketPool* pool, void* data,
+                                        size_t size, void* opaque,
+                                        bool do_copy) {
+    TrafficPacket* packet =
+            packetPool_alloc(pool, sizeof(*packet) + (do_copy ? size : 0));
+
+    packet->next = NULL;
+    packet->time = 0;
+    packet->size = size;
+    packet->opaque = opaque;
+    if (do_copy) {
+        packet->data = packet + 1;
+        memcpy(packet->data, data, size);
+    } else {
+        packet->data = data;
+    }
+    return packet;
+}
+
+bool trafficPacket_isInternal(const void* frame, size_t size) {
+    const uint8_t* data = frame;
+
+    // Room for the Ethernet and IP headers.
+    if (size < 40) {
+        return false;
+    }
+    if (data[12] != 0x08 || data[13] != 0x00) {
+        return false;
+    }
+    data += 14;
+    if ((data[0] >> 4) != 4 || (data[0] & 15) < 5) {
+        return false;
+    }
+    return data[12] == 10 && data[16] == 10;
+}
+
+int trafficPacket_parse(const void* frame, size_t size,
+                        TrafficSessionKey* key) {
+    const uint8_t* data = frame;
+    const uint8_t* end = data + size;
+
+    // Room for the Ethernet header and the frame check sequence.
+    if (size < 14 + 4) {
+        return -1;
+    }
+    if (data[12] != 0x08 || data[13] != 0x00) {
+        return -1;
+    }
+    data += 14;
+    end -= 4;
+    if (data + 20 > end) {
+        return -1;
+    }
+    // IPv4, with a valid header length and time-to-live.
+    if ((data[0] >> 4) != 4 || (data[0] & 15) < 5 || data[8] == 0) {
+        return -1;
+    }
+    if (data[9] != TRAFFIC_PROTOCOL_TCP && data[9] != TRAFFIC_PROTOCOL_UDP) {
+        return -1;
+    }
+    key->protocol = data[9];
+    key->src_ip = (data[12] << 24) | (data[13] << 16) | (data[14] << 8) |
+                  data[15];
+    key->dst_ip = (data[16] << 24) | (data[17] << 16) | (data[18] << 8) |
+                  data[19];
+
+    data += 4 * (data[0] & 15);
+    if (data + (key->protocol == TRAFFIC_PROTOCOL_TCP ? 20 : 8) > end) {
+        return -1;
+    }
+    key->src_port = (uint16_t)((data[0] << 8) | data[1]);
+    key->dst_port = (uint16_t)((data[2] << 8) | data[3]);
+    return key->protocol == TRAFFIC_PROTOCOL_TCP ? data[13] : 0;
+}
+
+void trafficShaper_init(TrafficShaper* shaper, bool do_copy,
+                        TrafficSendFunc send_func) {
+    memset(shaper, 0, sizeof(*shaper));
+    shaper->send_func = send_func;
+    shaper->do_copy = do_copy;
+    shaper->random = TRAFFIC_RANDOM_SEED;
+    packetPool_init(&shaper->pool);
+}
+
+void trafficShaper_done(TrafficShaper* shaper) {
+    while (shaper->head) {
+        TrafficPacket* packet = shaper->head;
+        shaper->head = packet->next;
+        packetPool_free(&shaper->pool, packet);
+    }
+    shaper->tail = NULL;
+    shaper->num_packets = 0;
+    packetPool_done(&shaper->pool);
+}
+
+static void trafficShaper_update(TrafficShaper* shaper) {
+    shaper->active = shaper->rate > 0 || shaper->jitter_us || shaper->loss;
+}
+
+static void trafficShaper_refill(TrafficShaper* shaper, int64_t now) {
+    if (now > shaper->last) {
+        shaper->tokens += (now - shaper->last) * shaper->rate / 1e6;
+        if (shaper->tokens > shaper->burst) {
+            shaper->tokens = shaper->burst;
+        }
+        shaper->last = now;
+    }
+}
+
+static void trafficShaper_deliver(TrafficShaper* shaper, void* data,
+                                  size_t size, void* opaque) {
+    shaper->tokens -= size;
+    shaper->stats.packets++;
+    shaper->stats.bytes += size;
+    shaper->send_func(data, size, opaque);
+}
+
+void trafficShaper_setRate(TrafficShaper* shaper, double rate, int64_t now) {
+    // Send all queued frames when changing the rate.
+    while (shaper->head) {
+        TrafficPacket* packet = shaper->head;
+        shaper->head = packet->next;
+        if (!shaper->head) {
+            shaper->tail = NULL;
+        }
+        shaper->num_packets--;
+        trafficShaper_deliver(shaper, packet->data, packet->size,
+                              packet->opaque);
+        packetPool_free(&shaper->pool, packet);
+    }
+
+    if (rate > 1.) {
+        shaper->rate = rate / 8.;
+        shaper->burst = shaper->rate * TRAFFIC_SHAPER_BURST_US / 1e6;
+    } else {
+        shaper->rate = 0;
+        shaper->burst = 0;
+    }
+    shaper->tokens = shaper->burst;
+    shaper->last = now;
+    trafficShaper_update(shaper);
+}
+
+void trafficShaper_setJitter(TrafficShaper* shaper, uint32_t jitter_us) {
+    shaper->jitter_us = jitter_us;
+    trafficShaper_update(shaper);
+}
+
+void trafficShaper_setLoss(TrafficShaper* shaper, double percent) {
+    if (percent <= 0) {
+        shaper->loss = 0;
+    } else if (percent >= 100.) {
+        shaper->loss = UINT32_MAX;
+    } else {
+        shaper->loss = (uint32_t)(percent / 100. * 4294967296.);
+    }
+    trafficShaper_update(shaper);
+}
+
+// Return true if the bucket of |shaper| allows a frame to leave.
+static inline bool trafficShaper_hasTokens(const TrafficShaper* shaper) {
+    return shaper->rate == 0 || shaper->tokens >= 0;
+}
+
+void trafficShaper_send(TrafficShaper* shaper, int64_t now, void* data,
+                        size_t size, void* opaque) {
+    TrafficPacket* packet;
+    int64_t time = now;
+
+    if (!shaper->active || trafficPacket_isInternal(data, size)) {
+        shaper->send_func(data, size, opaque);
+        return;
+    }
+    if (shaper->loss && trafficRandom(&shaper->random) < shaper->loss) {
+        shaper->stats.dropped++;
+        return;
+    }
+    if (shaper->jitter_us) {
+        time += trafficRandom(&shaper->random) % (shaper->jitter_us + 1);
+    }
+
+    trafficShaper_refill(shaper, now);
+    if (!shaper->head && time <= now && trafficShaper_hasTokens(shaper)) {
+        trafficShaper_deliver(shaper, data, size, opaque);
+        return;
+    }
+
+    // Frames leave in order: one with a shorter jitter than the previous
+    // one waits for it.
+    if (shaper->tail && shaper->tail->time > time) {
+        time = shaper->tail->time;
+    }
+    packet = trafficPacket_new(&shaper->pool, data, size, opaque,
+                               shaper->do_copy);
+    packet->time = time;
+    if (shaper->tail) {
+        shaper->tail->next = packet;
+    } else {
+        shaper->head = packet;
+    }
+    shaper->tail = packet;
+    shaper->num_packets++;
+    shaper->stats.delayed++;
+
+    trafficShaper_run(shaper, now);
+}
+
+bool trafficShaper_canSend(const TrafficShaper* shaper, int64_t now) {
+    double tokens = shaper->tokens;
+
+    if (!shaper->active) {
+        return true;
+    }
+    if (shaper->head) {
+        return false;
+    }
+    if (shaper->rate == 0) {
+        return true;
+    }
+    if (now > shaper->last) {
+        tokens += (now - shaper->last) * shaper->rate / 1e6;
+    }
+    return tokens >= 0;
+}
+
+void trafficShaper_run(TrafficShaper* shaper, int64_t now) {
+    TrafficPacket* packet;
+
+    trafficShaper_refill(shaper, now);
+    while ((packet = shaper->head) != NULL && packet->time <= now &&
+           trafficShaper_hasTokens(shaper)) {
+        shaper->head = packet->next;
+        if (!shaper->head) {
+            shaper->tail = NULL;
+        }
+        shaper->num_packets--;
+        trafficShaper_deliver(shaper, packet->data, packet->size,
+                              packet->opaque);
+        packetPool_free(&shaper->pool, packet);
+    }
+}
+
+int64_t trafficShaper_nextTime(const TrafficShaper* shaper) {
+    int64_t time;
+
+    if (!shaper->head) {
+        return -1;
+    }
+    time = shaper->head->time;
+    if (!trafficShaper_hasTokens(shaper)) {
+        // Rounded up, so that the bucket isn't still short of a fraction
+        // of a token.
+        int64_t refill = shaper->last +
+                         (int64_t)(-shaper->tokens * 1e6 / shaper->rate) + 1;
+        if (refill > time) {
+            time = refill;
+        }
+    }
+    return time;
+}
+
+static uint32_t trafficSessionKey_hash(const TrafficSessionKey* key) {
+    uint32_t h = key->src_ip;
+
+    h = h * 0x9e3779b1U ^ key->dst_ip;
+    h = h * 0x9e3779b1U ^ (((uint32_t)key->src_port << 16) | key->dst_port);
+    h = h * 0x9e3779b1U ^ key->protocol;
+    // Mix the high bits into the low ones, which select the bucket.
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+static bool trafficSessionKey_equal(const TrafficSessionKey* a,
+                                    const TrafficSessionKey* b) {
+    return a->src_ip == b->src_ip && a->dst_ip == b->dst_ip &&
+           a->src_port == b->src_port && a->dst_port == b->dst_port &&
+           a->protocol == b->protocol;
+}
+
+// Return the link to the session of |key| in its bucket, which points to
+// NULL if there is none.
+static TrafficSession** trafficDelay_lookup(TrafficDelay* delay,
+                                            const TrafficSessionKey* key,
+                                            uint32_t hash) {
+    TrafficSession** pnode = &delay->buckets[hash & (delay->num_buckets - 1)];
+    TrafficSession* node;
+
+    while ((node = *pnode) != NULL) {
+        if (node->hash == hash && trafficSessionKey_equal(&node->key, key)) {
+            break;
+        }
+        pnode = &node->next;
+    }
+    return pnode;
+}
+
+static void trafficDelay_grow(TrafficDelay* delay) {
+    uint32_t num_buckets = delay->num_buckets * 2;
+    TrafficSession** buckets = android_alloc0(num_buckets * sizeof(*buckets));
+    uint32_t n;
+
+    for (n = 0; n < delay->num_buckets; n++) {
+        TrafficSession* session = delay->buckets[n];
+        while (session) {
+            TrafficSession* next = session->next;
+            TrafficSession** head = &buckets[session->hash & (num_buckets - 1)];
+            session->next = *head;
+            *head = session;
+            session = next;
+        }
+    }
+    android_free(delay->buckets);
+    delay->buckets = buckets;
+    delay->num_buckets = num_buckets;
+}
+
+// Unlink the session at |lookup| and free it, with its held frame.
+static void trafficDelay_remove(TrafficDelay* delay,
+                                TrafficSession** lookup) {
+    TrafficSession* session = *lookup;
+
+    *lookup = session->next;
+    timerWheel_remove(&delay->wheel, &session->timer);
+    if (session->packet) {
+        packetPool_free(&delay->pool, session->packet);
+        delay->num_pending--;
+    }
+    android_free(session);
+    delay->num_sessions--;
+}
+
+// Called when the timer of a session expires, to send its held SYN, or
+// forget it if it was idle for too long.
+static void trafficDelay_expire(void* opaque, TimerWheelEntry* entry) {
+    TrafficDelay* delay = opaque;
+    TrafficSession* session = (TrafficSession*)entry;
+    TrafficPacket* packet = session->packet;
+    int64_t now = delay->wheel.now;
+
+    if (packet) {
+        session->packet = NULL;
+        session->last_seen = now;
+        delay->num_pending--;
+        timerWheel_add(&delay->wheel, &session->timer,
+                       now + TRAFFIC_DELAY_IDLE_MS);
+        delay->send_func(packet->data, packet->size, packet->opaque);
+        packetPool_free(&delay->pool, packet);
+    } else if (session->last_seen + TRAFFIC_DELAY_IDLE_MS > now) {
+        timerWheel_add(&delay->wheel, &session->timer,
+                       session->last_seen + TRAFFIC_DELAY_IDLE_MS);
+    } else {
+        trafficDelay_remove(delay, trafficDelay_lookup(delay, &session->key,
+                                                       session->hash));
+        delay->stats.expired++;
+    }
+}
+
+void trafficDelay_init(TrafficDelay* delay, TrafficSendFunc send_func) {
+    memset(delay, 0, sizeof(*delay));
+    delay->send_func = send_func;
+    delay->random = TRAFFIC_RANDOM_SEED;
+    delay->num_buckets = TRAFFIC_DELAY_MIN_BUCKETS;
+    delay->buckets = android_alloc0(delay->num_buckets *
+                                    sizeof(*delay->buckets));
+    timerWheel_init(&delay->wheel, 0);
+    packetPool_init(&delay->pool);
+}
+
+// Forget all sessions, sending their held frames if |send| is true.
+static void trafficDelay_clear(TrafficDelay* delay, bool send) {
+    uint32_t n;
+
+    for (n = 0; n < delay->num_buckets; n++) {
+        while (delay->buckets[n]) {
+            TrafficSession* session = delay->buckets[n];
+            TrafficPacket* packet = session->packet;
+            if (packet && send) {
+                delay->send_func(packet->data, packet->size, packet->opaque);
+            }
+            trafficDelay_remove(delay, &delay->buckets[n]);
+        }
+    }
+}
+
+void trafficDelay_done(TrafficDelay* delay) {
+    trafficDelay_clear(delay, false);
+    android_free(delay->buckets);
+    delay->buckets = NULL;
+    packetPool_done(&delay->pool);
+}
+
+void trafficDelay_setLatency(TrafficDelay* delay, int min_ms, int max_ms) {
+    // Accept all sessions when changing the latency.
+    trafficDelay_clear(delay, true);
+    delay->min_ms = min_ms;
+    delay->max_ms = max_ms;
+    delay->active = (min_ms <= max_ms) && min_ms > 0;
+}
+
+void trafficDelay_send(TrafficDelay* delay, int64_t now, const void* data,
+                       size_t size, void* opaque) {
+    if (delay->active && !trafficPacket_isInternal(data, size)) {
+        TrafficSessionKey key;
+        int flags = trafficPacket_parse(data, size, &key);
+        int64_t now_ms = now / 1000;
+
+        trafficDelay_run(delay, now);
+        if (flags >= 0) {
+            uint32_t hash = trafficSessionKey_hash(&key);
+            TrafficSession** lookup = trafficDelay_lookup(delay, &key, hash);
+            TrafficSession* session = *lookup;
+            bool syn = (flags & (TRAFFIC_TCP_SYN | TRAFFIC_TCP_ACK)) ==
+                       TRAFFIC_TCP_SYN;
+
+            if (flags & (TRAFFIC_TCP_FIN | TRAFFIC_TCP_RST)) {
+                // The connection is closed.
+                if (session) {
+                    trafficDelay_remove(delay, lookup);
+                }
+            } else if (session) {
+                if (session->packet && syn) {
+                    // A re-transmission of the SYN being held.
+                    delay->stats.swallowed++;
+                    return;
+                }
+                session->last_seen = now_ms;
+            } else if (syn) {
+                // Establish a new session slightly in the future.
+                int latency = delay->min_ms;
+                int range = delay->max_ms - delay->min_ms;
+
+                if (range > 0) {
+                    latency += trafficRandom(&delay->random) % (range + 1);
+                }
+                ANEW(session);
+                timerWheelEntry_init(&session->timer);
+                session->hash = hash;
+                session->key = key;
+                session->last_seen = now_ms;
+                session->packet = trafficPacket_new(&delay->pool,
+                                                    (void*)data, size,
+                                                    opaque, true);
+                session->next = *lookup;
+                *lookup = session;
+                timerWheel_add(&delay->wheel, &session->timer,
+                               now_ms + latency);
+                delay->num_sessions++;
+                delay->num_pending++;
+                delay->stats.delayed++;
+                if (delay->num_sessions > delay->num_buckets) {
+                    trafficDelay_grow(delay);
+                }
+                return;
+            }
+        }
+    }
+    delay->send_func((void*)data, size, opaque);
+}
+
+void trafficDelay_run(TrafficDelay* delay, int64_t now) {
+    timerWheel_advance(&delay->wheel, now / 1000, trafficDelay_expire, delay);
+}
+
+int64_t trafficDelay_nextTime(const TrafficDelay* delay) {
+    int64_t tick = timerWheel_nextTick(&delay->wheel);
+
+    return tick < 0 ? -1 : tick * 1000;
+}
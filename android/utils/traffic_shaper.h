@@ -0,0 +1,172 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_TRAFFIC_SHAPER_H
+#define ANDROID_UTILS_TRAFFIC_SHAPER_H
+
+#include "android/utils/compiler.h"
+#include "android/utils/packet_pool.h"
+#include "android/utils/timer_wheel.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+// Emulation of slow networks for Ethernet frames, see android/shaper.c.
+//
+// A TrafficShaper limits the rate of the frames that go through it in one
+// direction, with a token bucket: frames consume one token per byte, and
+// wait while the bucket is empty, which it fills at the configured rate,
+// up to the traffic of TRAFFIC_SHAPER_BURST_US. It can also hold each
+// frame for a random time, up to a jitter, without reordering them, and
+// drop a percentage of them at random.
+//
+// A TrafficDelay emulates the latency of connection establishment, by
+// holding the first SYN of each TCP session for a random time. Sessions
+// are kept in a hash table of their addresses and ports, until their FIN
+// or RST, or until they have been idle for TRAFFIC_DELAY_IDLE_MS.
+//
+// Neither reads a clock. Times are given by the caller, in microseconds,
+// who must call the _run() function at the time returned by _nextTime().
+// Frames between two 10.x.x.x addresses, internal to the emulated
+// network, are never shaped nor delayed.
+
+#define TRAFFIC_SHAPER_BURST_US  10000
+#define TRAFFIC_DELAY_IDLE_MS    (5 * 60 * 1000)
+
+// Called for each frame that leaves a shaper or a delay. |opaque| is the
+// value given with the frame.
+typedef void (*TrafficSendFunc)(void* data, size_t size, void* opaque);
+
+typedef struct TrafficPacket TrafficPacket;
+
+typedef struct {
+    uint64_t  packets;      // Frames sent.
+    uint64_t  bytes;
+    uint64_t  delayed;      // Frames that were queued before being sent.
+    uint64_t  dropped;      // Frames dropped by the loss model.
+} TrafficShaperStats;
+
+typedef struct {
+    TrafficSendFunc     send_func;
+    bool                do_copy;    // Copy the frames that are queued.
+    bool                active;
+    double              rate;       // Bytes per second, 0 if unlimited.
+    double              burst;      // Bucket size in bytes.
+    double              tokens;     // Negative after a large frame.
+    int64_t             last;       // Time of the last refill.
+    uint32_t            jitter_us;
+    uint32_t            loss;       // Drop probability, over 2^32.
+    uint32_t            random;     // Random generator state, not 0.
+    TrafficPacket*      head;
+    TrafficPacket*      tail;
+    uint32_t            num_packets;
+    PacketPool          pool;
+    TrafficShaperStats  stats;
+} TrafficShaper;
+
+// Return true if |data| is an IPv4 frame between two 10.x.x.x addresses.
+bool trafficPacket_isInternal(const void* data, size_t size);
+
+// Initialize an unlimited |shaper| that passes its frames to |send_func|.
+void trafficShaper_init(TrafficShaper* shaper, bool do_copy,
+                        TrafficSendFunc send_func);
+
+// Drop the queued frames of |shaper| and release its memory.
+void trafficShaper_done(TrafficShaper* shaper);
+
+// Limit |shaper| to |rate| bits per second, or remove the limit if it is
+// not above 1. Queued frames are sent first.
+void trafficShaper_setRate(TrafficShaper* shaper, double rate, int64_t now);
+
+// Hold each frame for a random time up to |jitter_us|.
+void trafficShaper_setJitter(TrafficShaper* shaper, uint32_t jitter_us);
+
+// Drop |percent| of the frames, at random.
+void trafficShaper_setLoss(TrafficShaper* shaper, double percent);
+
+// Send a frame through |shaper| at time |now|. Unless |shaper| copies
+// them, a frame that can't be sent right away must remain valid until it
+// is.
+void trafficShaper_send(TrafficShaper* shaper, int64_t now, void* data,
+                        size_t size, void* opaque);
+
+// Return true if a frame sent at |now| would go through without waiting.
+bool trafficShaper_canSend(const TrafficShaper* shaper, int64_t now);
+
+// Send the queued frames that are due at |now|.
+void trafficShaper_run(TrafficShaper* shaper, int64_t now);
+
+// Return when the next queued frame is due, or -1 if there are none.
+int64_t trafficShaper_nextTime(const TrafficShaper* shaper);
+
+typedef struct {
+    uint32_t  src_ip;
+    uint32_t  dst_ip;
+    uint16_t  src_port;
+    uint16_t  dst_port;
+    uint8_t   protocol;
+} TrafficSessionKey;
+
+// Parse the addresses and ports of an IPv4 TCP or UDP frame into |key|.
+// Return its TCP flags, 0 for UDP, or -1 for other frames.
+int trafficPacket_parse(const void* data, size_t size,
+                        TrafficSessionKey* key);
+
+typedef struct TrafficSession TrafficSession;
+
+typedef struct {
+    uint64_t  delayed;      // Sessions whose first SYN was held.
+    uint64_t  swallowed;    // SYNs sent again while held, and dropped.
+    uint64_t  expired;      // Sessions forgotten after being idle.
+} TrafficDelayStats;
+
+typedef struct {
+    TrafficSendFunc     send_func;
+    bool                active;
+    int                 min_ms;
+    int                 max_ms;
+    uint32_t            random;         // Random generator state, not 0.
+    TrafficSession**    buckets;
+    uint32_t            num_buckets;    // A power of 2.
+    uint32_t            num_sessions;
+    uint32_t            num_pending;    // Sessions with a SYN held.
+    TimerWheel          wheel;          // In milliseconds.
+    PacketPool          pool;
+    TrafficDelayStats   stats;
+} TrafficDelay;
+
+// Initialize an inactive |delay| that passes its frames to |send_func|.
+void trafficDelay_init(TrafficDelay* delay, TrafficSendFunc send_func);
+
+// Drop the sessions and held frames of |delay|, and release its memory.
+void trafficDelay_done(TrafficDelay* delay);
+
+// Delay new sessions by |min_ms| to |max_ms|, or not at all if |min_ms|
+// is 0 or above |max_ms|. Held frames are sent and sessions forgotten.
+void trafficDelay_setLatency(TrafficDelay* delay, int min_ms, int max_ms);
+
+// Send a frame through |delay| at time |now|, which is always copied if
+// held. The frames due at |now| are sent first.
+void trafficDelay_send(TrafficDelay* delay, int64_t now, const void* data,
+                       size_t size, void* opaque);
+
+// Send the held frames due at |now|, and forget the idle sessions.
+void trafficDelay_run(TrafficDelay* delay, int64_t now);
+
+// Return when trafficDelay_run() must be called next, or -1 if never.
+int64_t trafficDelay_nextTime(const TrafficDelay* delay);
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_TRAFFIC_SHAPER_H
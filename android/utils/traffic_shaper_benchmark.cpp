@@ -0,0 +1,314 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// Feeds synthetic streams of frames through the network emulation of
+// android/shaper.c, on a simulated clock, and checks that the rate, loss
+// and latency it achieves are the configured ones. Then measures the cost
+// of the session table with many concurrent TCP sessions, against the
+// linked list that netdelay used to scan for each SYN, FIN and RST. Run
+// with emulator_benchmarks.
+
+#include "android/utils/traffic_shaper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const uint32_t kGuest = 0x0a00020f;
+const uint32_t kRemote = 0xc0a80001;
+
+std::string makeFrame(uint16_t port, uint8_t flags, size_t size) {
+    std::string frame(size, 0);
+    uint8_t* data = reinterpret_cast<uint8_t*>(&frame[0]);
+    data[12] = 0x08;
+    uint8_t* ip = data + 14;
+    ip[0] = 0x45;
+    ip[8] = 64;
+    ip[9] = 6;
+    for (int n = 0; n < 4; ++n) {
+        ip[12 + n] = (uint8_t)(kGuest >> (24 - 8 * n));
+        ip[16 + n] = (uint8_t)(kRemote >> (24 - 8 * n));
+    }
+    ip[20] = port >> 8;
+    ip[21] = (uint8_t)port;
+    ip[23] = 80;
+    ip[33] = flags;
+    return frame;
+}
+
+// Frames leaving the shaper or delay, and the simulated clock.
+struct Sink {
+    uint64_t frames;
+    uint64_t bytes;
+    int64_t now;
+    int64_t latency;        // Sum of the latencies of the frames.
+    int64_t max_latency;
+    int64_t min_latency;
+};
+
+Sink sSink;
+
+// Each frame carries the time it was sent at in its opaque value.
+void onSend(void* data, size_t size, void* opaque) {
+    int64_t latency = sSink.now - (int64_t)(intptr_t)opaque;
+    sSink.frames++;
+    sSink.bytes += size;
+    sSink.latency += latency;
+    if (latency > sSink.max_latency) {
+        sSink.max_latency = latency;
+    }
+    if (sSink.min_latency < 0 || latency < sSink.min_latency) {
+        sSink.min_latency = latency;
+    }
+}
+
+void resetSink() {
+    memset(&sSink, 0, sizeof(sSink));
+    sSink.min_latency = -1;
+}
+
+// Run a shaper at |rate| bits/s for |secs| simulated seconds, with a
+// sender that keeps up to 64 frames of |frameSize| bytes queued, and
+// return the achieved rate in bits/s.
+double measureRate(double rate, int secs, int frameSize) {
+    TrafficShaper shaper;
+    std::string frame = makeFrame(1, 0x10, frameSize);
+    const int64_t end = secs * 1000000LL;
+
+    resetSink();
+    trafficShaper_init(&shaper, true, onSend);
+    trafficShaper_setRate(&shaper, rate, 0);
+    while (sSink.now < end) {
+        while (shaper.num_packets < 64) {
+            trafficShaper_send(&shaper, sSink.now, &frame[0], frame.size(),
+                               (void*)(intptr_t)sSink.now);
+        }
+        sSink.now = trafficShaper_nextTime(&shaper);
+        trafficShaper_run(&shaper, sSink.now);
+    }
+    trafficShaper_done(&shaper);
+    // The first frames leave at once, from the bucket that starts full.
+    return (sSink.bytes - frameSize) * 8. / (sSink.now / 1e6);
+}
+
+}  // namespace
+
+TEST(TrafficShaperBenchmark, Rate) {
+    static const double kRates[] = {
+        14400, 80000, 236800, 1920000, 14400000, 100000000,
+    };
+    for (size_t n = 0; n < sizeof(kRates) / sizeof(kRates[0]); ++n) {
+        for (int size = 64; size <= 1514; size += 1450) {
+            double achieved = measureRate(kRates[n], 60, size);
+            printf("rate %10.0f bits/s, %4d-byte frames: achieved %10.0f "
+                   "bits/s (%+.3f%%)\n", kRates[n], size, achieved,
+                   (achieved / kRates[n] - 1) * 100);
+            EXPECT_NEAR(kRates[n], achieved, kRates[n] / 100);
+        }
+    }
+}
+
+TEST(TrafficShaperBenchmark, JitterAndLoss) {
+    static const uint32_t kJitters[] = { 1000, 20000, 200000 };
+    static const double kLosses[] = { 0.1, 1., 10. };
+    const int kFrames = 200000;
+    std::string frame = makeFrame(1, 0x10, 1514);
+
+    for (size_t n = 0; n < sizeof(kJitters) / sizeof(kJitters[0]); ++n) {
+        TrafficShaper shaper;
+        resetSink();
+        trafficShaper_init(&shaper, true, onSend);
+        trafficShaper_setJitter(&shaper, kJitters[n]);
+        trafficShaper_setLoss(&shaper, kLosses[n]);
+        // A frame every millisecond.
+        for (int f = 0; f < kFrames; ++f) {
+            int64_t next;
+            int64_t sent = f * 1000LL;
+            while ((next = trafficShaper_nextTime(&shaper)) >= 0 &&
+                   next <= sent) {
+                sSink.now = next;
+                trafficShaper_run(&shaper, next);
+            }
+            sSink.now = sent;
+            trafficShaper_send(&shaper, sent, &frame[0], frame.size(),
+                               (void*)(intptr_t)sent);
+        }
+        while (shaper.head) {
+            sSink.now = trafficShaper_nextTime(&shaper);
+            trafficShaper_run(&shaper, sSink.now);
+        }
+
+        double loss = 100. * shaper.stats.dropped / kFrames;
+        double mean = (double)sSink.latency / sSink.frames;
+        printf("jitter %6u us: latency %6.0f us mean, %6lld max, "
+               "loss %5.2f%% for %5.2f%%\n", kJitters[n], mean,
+               (long long)sSink.max_latency, loss, kLosses[n]);
+        EXPECT_LE(sSink.max_latency, (int64_t)kJitters[n]);
+        // Frames are not reordered, so wait a little more than the
+        // average of the jitter.
+        EXPECT_GE(mean, kJitters[n] / 2. * 0.95);
+        EXPECT_NEAR(kLosses[n], loss, kLosses[n] / 10 + 0.05);
+        EXPECT_EQ((uint64_t)kFrames, sSink.frames + shaper.stats.dropped);
+        trafficShaper_done(&shaper);
+    }
+}
+
+TEST(TrafficShaperBenchmark, ConnectionLatency) {
+    static const int kLatencies[][2] = {
+        { 150, 550 }, { 80, 400 }, { 35, 200 }, { 100, 100 },
+    };
+    const int kSessions = 50000;
+
+    for (size_t n = 0; n < sizeof(kLatencies) / sizeof(kLatencies[0]); ++n) {
+        const int min = kLatencies[n][0];
+        const int max = kLatencies[n][1];
+        TrafficDelay delay;
+        resetSink();
+        trafficDelay_init(&delay, onSend);
+        trafficDelay_setLatency(&delay, min, max);
+        // A new session every 100 us, all open at the same time.
+        for (int s = 0; s < kSessions; ++s) {
+            std::string syn = makeFrame(s, 0x02, 80);
+            int64_t sent = s * 100LL;
+            syn[28] = (char)(s >> 16);
+            sSink.now = sent;
+            trafficDelay_send(&delay, sent, syn.data(), syn.size(),
+                              (void*)(intptr_t)sent);
+            int64_t next;
+            while ((next = trafficDelay_nextTime(&delay)) >= 0 &&
+                   next <= sent) {
+                sSink.now = next;
+                trafficDelay_run(&delay, next);
+            }
+        }
+        while (delay.num_pending) {
+            sSink.now = trafficDelay_nextTime(&delay);
+            trafficDelay_run(&delay, sSink.now);
+        }
+
+        double mean = (double)sSink.latency / sSink.frames / 1000.;
+        printf("latency %3d-%3d ms: %6.1f ms mean, %5.1f-%5.1f ms, "
+               "%u sessions\n", min, max, mean, sSink.min_latency / 1000.,
+               sSink.max_latency / 1000., delay.num_sessions);
+        EXPECT_EQ((uint64_t)kSessions, sSink.frames);
+        EXPECT_EQ((uint32_t)kSessions, delay.num_sessions);
+        // Times are rounded to the millisecond of the session table.
+        EXPECT_GE(sSink.min_latency, (min - 1) * 1000);
+        EXPECT_LE(sSink.max_latency, (max + 1) * 1000);
+        EXPECT_NEAR((min + max) / 2., mean, (max - min) / 50. + 1);
+        trafficDelay_done(&delay);
+    }
+}
+
+namespace {
+
+// The session list of netdelay before the table, for comparison.
+struct ListSession {
+    ListSession* next;
+    TrafficSessionKey key;
+};
+
+ListSession** listLookup(ListSession** head, const TrafficSessionKey& key) {
+    ListSession** pnode = head;
+    ListSession* node;
+    while ((node = *pnode) != NULL) {
+        if (node->key.src_ip == key.src_ip &&
+            node->key.dst_ip == key.dst_ip &&
+            node->key.src_port == key.src_port &&
+            node->key.dst_port == key.dst_port &&
+            node->key.protocol == key.protocol) {
+            break;
+        }
+        pnode = &node->next;
+    }
+    return pnode;
+}
+
+void discard(void*, size_t, void*) {}
+
+}  // namespace
+
+// Sessions |op| to |op| + |sessions| - 1 are open before each operation,
+// which closes the first one and opens the next one, with a FIN and a SYN
+// that are both looked up in the session table.
+TEST(TrafficShaperBenchmark, Sessions) {
+    static const int kCounts[] = { 100, 1000, 10000, 100000 };
+    const int kOps = 200000;
+
+    for (size_t n = 0; n < sizeof(kCounts) / sizeof(kCounts[0]); ++n) {
+        const int sessions = kCounts[n];
+        const int keys = sessions * 2;
+        std::vector<std::string> syns;
+        std::vector<std::string> fins;
+        for (int s = 0; s < keys; ++s) {
+            syns.push_back(makeFrame(s, 0x02, 80));
+            fins.push_back(makeFrame(s, 0x11, 80));
+            syns.back()[28] = fins.back()[28] = (char)(s >> 16);
+        }
+
+        TrafficDelay delay;
+        trafficDelay_init(&delay, discard);
+        trafficDelay_setLatency(&delay, 1, 1);
+        int64_t now = 0;
+        for (int s = 0; s < sessions; ++s) {
+            trafficDelay_send(&delay, now, syns[s].data(), syns[s].size(),
+                              NULL);
+        }
+        clock_t start = clock();
+        for (int op = 0; op < kOps; ++op) {
+            const std::string& fin = fins[op % keys];
+            const std::string& syn = syns[(op + sessions) % keys];
+            now += 10;
+            trafficDelay_send(&delay, now, fin.data(), fin.size(), NULL);
+            trafficDelay_send(&delay, now, syn.data(), syn.size(), NULL);
+        }
+        double tableNs = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 /
+                         kOps;
+        EXPECT_EQ((uint32_t)sessions, delay.num_sessions);
+        trafficDelay_done(&delay);
+
+        // The same with the list, only for the lookups and updates.
+        std::vector<ListSession> nodes(keys);
+        ListSession* head = NULL;
+        for (int s = 0; s < keys; ++s) {
+            trafficPacket_parse(syns[s].data(), syns[s].size(),
+                                &nodes[s].key);
+        }
+        for (int s = sessions - 1; s >= 0; --s) {
+            nodes[s].next = head;
+            head = &nodes[s];
+        }
+        const int ops = sessions >= 10000 ? kOps / 100 : kOps;
+        start = clock();
+        for (int op = 0; op < ops; ++op) {
+            ListSession** lookup = listLookup(&head, nodes[op % keys].key);
+            ASSERT_TRUE(*lookup != NULL);
+            *lookup = (*lookup)->next;
+            ListSession* node = &nodes[(op + sessions) % keys];
+            ASSERT_TRUE(*listLookup(&head, node->key) == NULL);
+            node->next = head;
+            head = node;
+        }
+        double listNs = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 /
+                        ops;
+
+        printf("%6d sessions: table %6.0f ns/op, list %9.0f ns/op\n",
+               sessions, tableNs, listNs);
+    }
+}
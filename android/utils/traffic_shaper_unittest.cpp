@@ -0,0 +1,349 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/traffic_shaper.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const uint8_t kFin = 0x01;
+const uint8_t kSyn = 0x02;
+const uint8_t kRst = 0x04;
+const uint8_t kAck = 0x10;
+
+const uint32_t kGuest = 0x0a00020f;     // 10.0.2.15
+const uint32_t kRemote = 0xc0a80001;    // 192.168.0.1
+
+// An Ethernet frame with an IPv4 TCP or UDP packet.
+std::string makeFrame(uint32_t src, uint32_t dst, uint16_t srcPort,
+                      uint16_t dstPort, uint8_t flags, size_t size = 80,
+                      uint8_t protocol = 6) {
+    std::string frame(size, 0);
+    uint8_t* data = reinterpret_cast<uint8_t*>(&frame[0]);
+    data[12] = 0x08;
+    uint8_t* ip = data + 14;
+    ip[0] = 0x45;
+    ip[8] = 64;
+    ip[9] = protocol;
+    for (int n = 0; n < 4; ++n) {
+        ip[12 + n] = (uint8_t)(src >> (24 - 8 * n));
+        ip[16 + n] = (uint8_t)(dst >> (24 - 8 * n));
+    }
+    uint8_t* tcp = ip + 20;
+    tcp[0] = srcPort >> 8;
+    tcp[1] = (uint8_t)srcPort;
+    tcp[2] = dstPort >> 8;
+    tcp[3] = (uint8_t)dstPort;
+    if (protocol == 6) {
+        tcp[13] = flags;
+    }
+    return frame;
+}
+
+std::string makeSyn(uint16_t port, uint8_t flags = kSyn) {
+    return makeFrame(kGuest, kRemote, port, 80, flags);
+}
+
+struct Sent {
+    std::string frame;
+    int64_t time;
+};
+
+std::vector<Sent> sSent;
+int64_t sNow;
+
+void onSend(void* data, size_t size, void*) {
+    Sent sent;
+    sent.frame.assign(static_cast<const char*>(data), size);
+    sent.time = sNow;
+    sSent.push_back(sent);
+}
+
+class TrafficShaperTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        sSent.clear();
+        sNow = 0;
+        trafficShaper_init(&mShaper, true, onSend);
+    }
+
+    virtual void TearDown() {
+        trafficShaper_done(&mShaper);
+    }
+
+    void send(const std::string& frame) {
+        std::string copy = frame;
+        trafficShaper_send(&mShaper, sNow, &copy[0], copy.size(), NULL);
+    }
+
+    void runUntil(int64_t end) {
+        int64_t next;
+        while ((next = trafficShaper_nextTime(&mShaper)) >= 0 &&
+               next <= end) {
+            ASSERT_GE(next, sNow);
+            sNow = next;
+            trafficShaper_run(&mShaper, sNow);
+        }
+        sNow = end;
+    }
+
+    TrafficShaper mShaper;
+};
+
+class TrafficDelayTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        sSent.clear();
+        sNow = 1000000;
+        trafficDelay_init(&mDelay, onSend);
+    }
+
+    virtual void TearDown() {
+        trafficDelay_done(&mDelay);
+    }
+
+    void send(const std::string& frame) {
+        trafficDelay_send(&mDelay, sNow, frame.data(), frame.size(), NULL);
+    }
+
+    void runUntil(int64_t end) {
+        int64_t next;
+        while ((next = trafficDelay_nextTime(&mDelay)) >= 0 && next <= end) {
+            ASSERT_GE(next, sNow - 1000);
+            sNow = next > sNow ? next : sNow;
+            trafficDelay_run(&mDelay, sNow);
+        }
+        sNow = end;
+    }
+
+    TrafficDelay mDelay;
+};
+
+}  // namespace
+
+TEST(TrafficPacket, Parse) {
+    TrafficSessionKey key;
+    std::string frame = makeFrame(kGuest, kRemote, 1234, 80, kSyn | kAck);
+    EXPECT_EQ(kSyn | kAck, trafficPacket_parse(frame.data(), frame.size(),
+                                               &key));
+    EXPECT_EQ(kGuest, key.src_ip);
+    EXPECT_EQ(kRemote, key.dst_ip);
+    EXPECT_EQ(1234, key.src_port);
+    EXPECT_EQ(80, key.dst_port);
+    EXPECT_EQ(6, key.protocol);
+
+    frame = makeFrame(kGuest, kRemote, 53, 53, 0, 60, 17);
+    EXPECT_EQ(0, trafficPacket_parse(frame.data(), frame.size(), &key));
+    EXPECT_EQ(17, key.protocol);
+
+    // ICMP, and truncated.
+    frame = makeFrame(kGuest, kRemote, 0, 0, 0, 60, 1);
+    EXPECT_EQ(-1, trafficPacket_parse(frame.data(), frame.size(), &key));
+    frame = makeSyn(1234);
+    EXPECT_EQ(-1, trafficPacket_parse(frame.data(), 40, &key));
+
+    EXPECT_FALSE(trafficPacket_isInternal(frame.data(), frame.size()));
+    frame = makeFrame(kGuest, 0x0a000202, 1234, 80, kSyn);
+    EXPECT_TRUE(trafficPacket_isInternal(frame.data(), frame.size()));
+}
+
+TEST_F(TrafficShaperTest, Unlimited) {
+    EXPECT_FALSE(mShaper.active);
+    send(makeSyn(1));
+    EXPECT_EQ(1U, sSent.size());
+    EXPECT_EQ(-1, trafficShaper_nextTime(&mShaper));
+}
+
+TEST_F(TrafficShaperTest, Rate) {
+    // 1000 bytes per second, a bucket of 10 bytes.
+    trafficShaper_setRate(&mShaper, 8000., sNow);
+    EXPECT_TRUE(mShaper.active);
+    std::string frame = makeFrame(kGuest, kRemote, 1, 2, kAck, 100);
+
+    send(frame);
+    EXPECT_EQ(1U, sSent.size());
+    EXPECT_FALSE(trafficShaper_canSend(&mShaper, sNow));
+    send(frame);
+    send(frame);
+    EXPECT_EQ(1U, sSent.size());
+    EXPECT_EQ(2U, mShaper.num_packets);
+
+    // Each frame waits for the bucket to recover from the previous one.
+    runUntil(1000000);
+    ASSERT_EQ(3U, sSent.size());
+    EXPECT_NEAR(90000, sSent[1].time, 2);
+    EXPECT_NEAR(190000, sSent[2].time, 2);
+    EXPECT_TRUE(trafficShaper_canSend(&mShaper, sNow));
+    EXPECT_EQ(3U, mShaper.stats.packets);
+    EXPECT_EQ(2U, mShaper.stats.delayed);
+
+    // Internal frames are never shaped.
+    send(frame);
+    send(makeFrame(kGuest, 0x0a000202, 1, 2, kAck, 100));
+    EXPECT_EQ(5U, sSent.size());
+}
+
+TEST_F(TrafficShaperTest, SetRateSendsQueued) {
+    trafficShaper_setRate(&mShaper, 8000., sNow);
+    std::string frame = makeFrame(kGuest, kRemote, 1, 2, kAck, 100);
+    send(frame);
+    send(frame);
+    EXPECT_EQ(1U, sSent.size());
+    trafficShaper_setRate(&mShaper, 0, sNow);
+    EXPECT_EQ(2U, sSent.size());
+    EXPECT_FALSE(mShaper.active);
+    EXPECT_EQ(-1, trafficShaper_nextTime(&mShaper));
+}
+
+TEST_F(TrafficShaperTest, Jitter) {
+    trafficShaper_setJitter(&mShaper, 5000);
+    for (int n = 0; n < 1000; ++n) {
+        send(makeFrame(kGuest, kRemote, n, 2, kAck));
+        runUntil(sNow + 1000);
+    }
+    runUntil(sNow + 10000);
+    ASSERT_EQ(1000U, sSent.size());
+
+    int64_t total = 0;
+    for (int n = 0; n < 1000; ++n) {
+        TrafficSessionKey key;
+        trafficPacket_parse(sSent[n].frame.data(), sSent[n].frame.size(),
+                            &key);
+        // In order, and within the jitter.
+        EXPECT_EQ(n, key.src_port);
+        int64_t delay = sSent[n].time - n * 1000;
+        EXPECT_GE(delay, 0);
+        EXPECT_LE(delay, 5000);
+        total += delay;
+    }
+    // Never less than the uniform average.
+    EXPECT_GT(total / 1000, 2000);
+}
+
+TEST_F(TrafficShaperTest, Loss) {
+    trafficShaper_setLoss(&mShaper, 10.);
+    EXPECT_TRUE(mShaper.active);
+    std::string frame = makeSyn(1);
+    for (int n = 0; n < 100000; ++n) {
+        send(frame);
+    }
+    EXPECT_NEAR(10000, (int)mShaper.stats.dropped, 500);
+    EXPECT_EQ(100000U, sSent.size() + mShaper.stats.dropped);
+
+    trafficShaper_setLoss(&mShaper, 100.);
+    sSent.clear();
+    for (int n = 0; n < 1000; ++n) {
+        send(frame);
+    }
+    EXPECT_EQ(0U, sSent.size());
+}
+
+TEST_F(TrafficDelayTest, Syn) {
+    trafficDelay_setLatency(&mDelay, 100, 100);
+    EXPECT_TRUE(mDelay.active);
+
+    send(makeSyn(1000));
+    EXPECT_EQ(0U, sSent.size());
+    EXPECT_EQ(1U, mDelay.num_pending);
+    // Re-transmissions are swallowed, other sessions are independent.
+    sNow += 50000;
+    send(makeSyn(1000));
+    send(makeSyn(1001));
+    EXPECT_EQ(1U, mDelay.stats.swallowed);
+    EXPECT_EQ(2U, mDelay.num_sessions);
+    // Other frames of the session are not held.
+    send(makeSyn(1000, kAck));
+    EXPECT_EQ(1U, sSent.size());
+
+    runUntil(sNow + 1000000);
+    ASSERT_EQ(3U, sSent.size());
+    EXPECT_EQ(makeSyn(1000), sSent[1].frame);
+    EXPECT_EQ(1100000, sSent[1].time);
+    EXPECT_EQ(1150000, sSent[2].time);
+    EXPECT_EQ(0U, mDelay.num_pending);
+
+    // Established sessions are not delayed again.
+    send(makeSyn(1000));
+    EXPECT_EQ(4U, sSent.size());
+
+    // Until closed.
+    send(makeSyn(1000, kFin | kAck));
+    EXPECT_EQ(1U, mDelay.num_sessions);
+    send(makeSyn(1001, kRst));
+    EXPECT_EQ(0U, mDelay.num_sessions);
+    send(makeSyn(1000));
+    EXPECT_EQ(6U, sSent.size());
+    EXPECT_EQ(1U, mDelay.num_pending);
+}
+
+TEST_F(TrafficDelayTest, Range) {
+    trafficDelay_setLatency(&mDelay, 100, 300);
+    for (int n = 0; n < 1000; ++n) {
+        send(makeSyn(n));
+    }
+    int64_t start = sNow;
+    runUntil(sNow + 1000000);
+    ASSERT_EQ(1000U, sSent.size());
+    int64_t total = 0;
+    for (size_t n = 0; n < sSent.size(); ++n) {
+        int64_t delay = sSent[n].time - start;
+        EXPECT_GE(delay, 100000);
+        EXPECT_LE(delay, 300000);
+        if (n > 0) {
+            EXPECT_LE(sSent[n - 1].time, sSent[n].time);
+        }
+        total += delay;
+    }
+    EXPECT_NEAR(200000, total / 1000, 10000);
+    EXPECT_GE(mDelay.num_buckets, 1000U);
+}
+
+TEST_F(TrafficDelayTest, SetLatencySendsHeld) {
+    trafficDelay_setLatency(&mDelay, 100, 200);
+    send(makeSyn(1));
+    send(makeSyn(2));
+    EXPECT_EQ(0U, sSent.size());
+    trafficDelay_setLatency(&mDelay, 0, 0);
+    EXPECT_EQ(2U, sSent.size());
+    EXPECT_EQ(0U, mDelay.num_sessions);
+    EXPECT_FALSE(mDelay.active);
+    send(makeSyn(3));
+    EXPECT_EQ(3U, sSent.size());
+}
+
+TEST_F(TrafficDelayTest, IdleSessions) {
+    trafficDelay_setLatency(&mDelay, 10, 10);
+    send(makeSyn(1));
+    send(makeSyn(2));
+    runUntil(sNow + 100000);
+    EXPECT_EQ(2U, sSent.size());
+
+    // Traffic keeps a session alive.
+    const int64_t kIdle = TRAFFIC_DELAY_IDLE_MS * 1000LL;
+    runUntil(sNow + kIdle / 2);
+    send(makeSyn(1, kAck));
+    runUntil(sNow + kIdle * 3 / 4);
+    EXPECT_EQ(1U, mDelay.num_sessions);
+    EXPECT_EQ(1U, mDelay.stats.expired);
+    runUntil(sNow + kIdle);
+    EXPECT_EQ(0U, mDelay.num_sessions);
+    EXPECT_EQ(-1, trafficDelay_nextTime(&mDelay));
+
+    // And a new SYN is delayed again.
+    send(makeSyn(2));
+    EXPECT_EQ(1U, mDelay.num_pending);
+}
@@ -12,6 +12,8 @@
 #include "android/utils/uncompress.h"
 #include "zlib.h"
 
+#include <stdlib.h>
+
 bool uncompress_gzipStream(uint8_t* dst, size_t* dstLen, const uint8_t* src,
                    size_t srcLen) {
     z_stream stream;
@@ -41,3 +43,67 @@ bool uncompress_gzipStream(uint8_t* dst, size_t* dstLen, const uint8_t* src,
     }
     return result == Z_OK;
 }
+
+bool uncompress_gzipStreamAlloc(const uint8_t* src, size_t srcLen,
+                                size_t maxLen, uint8_t** dst, size_t* dstLen) {
+    *dst = NULL;
+    *dstLen = 0;
+
+    z_stream stream;
+    stream.next_in = (Bytef*)src;
+    stream.avail_in = srcLen;
+    stream.zalloc = (alloc_func)0;
+    stream.zfree = (free_func)0;
+    stream.opaque = (voidpf)0;
+
+    const int GZIP_WINDOW_BITS = 15 + 16;
+    if (inflateInit2(&stream, GZIP_WINDOW_BITS) != Z_OK) {
+        return false;
+    }
+
+    // Start with a 4:1 ratio guess, which covers most kernels and
+    // ramdisks, and double the buffer each time it fills up.
+    size_t capacity = srcLen * 4 + 4096;
+    if (maxLen && capacity > maxLen) {
+        capacity = maxLen;
+    }
+
+    uint8_t* buffer = NULL;
+    size_t total = 0;
+    int result = Z_OK;
+    for (;;) {
+        uint8_t* newBuffer = (uint8_t*)realloc(buffer, capacity);
+        if (!newBuffer) {
+            result = Z_MEM_ERROR;
+            break;
+        }
+        buffer = newBuffer;
+        stream.next_out = buffer + total;
+        stream.avail_out = capacity - total;
+
+        result = inflate(&stream, Z_NO_FLUSH);
+        total = capacity - stream.avail_out;
+        if (result != Z_OK) {
+            break;
+        }
+        if (maxLen && total >= maxLen) {
+            result = Z_STREAM_END;
+            break;
+        }
+        if (stream.avail_out == 0) {
+            capacity *= 2;
+            if (maxLen && capacity > maxLen) {
+                capacity = maxLen;
+            }
+        } else if (stream.avail_in == 0) {
+            // Truncated input.
+            result = Z_BUF_ERROR;
+            break;
+        }
+    }
+    inflateEnd(&stream);
+
+    *dst = buffer;
+    *dstLen = total;
+    return result == Z_STREAM_END;
+}
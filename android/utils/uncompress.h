@@ -34,6 +34,16 @@ ANDROID_BEGIN_HEADER
 bool uncompress_gzipStream(uint8_t* dst, size_t* dstLen, const uint8_t* src,
                            size_t srcLen);
 
+// Decompress the gzip stream at |src| into a heap-allocated buffer that
+// is grown as needed, so callers don't have to guess the uncompressed size.
+// If |maxLen| is not 0, decompression stops once that many bytes have been
+// produced, which is enough for callers that only need a stream prefix.
+// On success, return true and set |*dst| and |*dstLen|. On failure, return
+// false; |*dst| then holds what could be decompressed (possibly NULL) and
+// must still be released with free().
+bool uncompress_gzipStreamAlloc(const uint8_t* src, size_t srcLen,
+                                size_t maxLen, uint8_t** dst, size_t* dstLen);
+
 ANDROID_END_HEADER
 
 #endif /* ANDROID_UTILS_UNCOMPRESS_H */
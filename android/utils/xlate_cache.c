@@ -0,0 +1,23 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/xlate_cache.h"
+
+#include <string.h>
+
+void xlateCache_init(XlateCache* cache) {
+    memset(cache, 0, sizeof(*cache));
+}
+
+void xlateCache_flush(XlateCache* cache) {
+    memset(cache->entries, 0, sizeof(cache->entries));
+    cache->flushes++;
+}
@@ -0,0 +1,112 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#ifndef ANDROID_UTILS_XLATE_CACHE_H
+#define ANDROID_UTILS_XLATE_CACHE_H
+
+#include "android/utils/compiler.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+ANDROID_BEGIN_HEADER
+
+// A small direct-mapped cache of guest page translations.
+//
+// Devices that copy guest buffers translate each guest virtual page to a
+// guest physical page, which means walking the guest page tables, and then
+// to a host pointer. This caches the result of both steps by virtual page
+// number.
+//
+// The cache doesn't know when the guest page tables change. Instead, each
+// lookup is given a |generation| that must change whenever a translation
+// may have become stale, e.g. a count of the guest TLB flushes, and a
+// |context| such as the CPU doing the lookup. The whole cache is dropped
+// when either differs from the previous lookup.
+
+// Number of entries, must be a power of 2.
+#define XLATE_CACHE_SIZE  256
+
+typedef struct {
+    uint64_t  vpage;    // Virtual page number plus one, 0 for empty entries.
+    uint64_t  ppage;    // Physical page number.
+    uint8_t*  host;     // Host address of the page, or NULL if not RAM.
+} XlateCacheEntry;
+
+typedef struct {
+    const void*      context;
+    unsigned         generation;
+    uint64_t         hits;
+    uint64_t         misses;
+    uint64_t         flushes;
+    XlateCacheEntry  entries[XLATE_CACHE_SIZE];
+} XlateCache;
+
+// Initialize an empty |cache|.
+void xlateCache_init(XlateCache* cache);
+
+// Drop all entries of |cache|.
+void xlateCache_flush(XlateCache* cache);
+
+// Drop all entries of |cache| if |context| or |generation| differ from the
+// last call. Must be called before a series of lookups.
+static inline void xlateCache_sync(XlateCache* cache,
+                                   const void* context,
+                                   unsigned generation) {
+    if (cache->context != context || cache->generation != generation) {
+        xlateCache_flush(cache);
+        cache->context = context;
+        cache->generation = generation;
+    }
+}
+
+// Look up |vpage| in |cache|. On success, set |*ppage| and |*host| and
+// return true.
+static inline bool xlateCache_lookup(XlateCache* cache,
+                                     uint64_t vpage,
+                                     uint64_t* ppage,
+                                     uint8_t** host) {
+    const XlateCacheEntry* entry =
+            &cache->entries[vpage & (XLATE_CACHE_SIZE - 1)];
+    if (entry->vpage != vpage + 1) {
+        cache->misses++;
+        return false;
+    }
+    cache->hits++;
+    *ppage = entry->ppage;
+    *host = entry->host;
+    return true;
+}
+
+// Return the physical page number of |paddr|, a guest physical address as
+// returned by a page table walk, keeping only the bits in |addr_mask|. The
+// others are flags that the walk may leave, e.g. the NX bit on x86.
+static inline uint64_t xlateCache_physPage(uint64_t paddr,
+                                           uint64_t addr_mask,
+                                           int page_bits) {
+    return (paddr & addr_mask) >> page_bits;
+}
+
+// Record that |vpage| translates to |ppage|, whose host address is |host|.
+static inline void xlateCache_insert(XlateCache* cache,
+                                     uint64_t vpage,
+                                     uint64_t ppage,
+                                     uint8_t* host) {
+    XlateCacheEntry* entry = &cache->entries[vpage & (XLATE_CACHE_SIZE - 1)];
+    entry->vpage = vpage + 1;
+    entry->ppage = ppage;
+    entry->host = host;
+}
+
+ANDROID_END_HEADER
+
+#endif  // ANDROID_UTILS_XLATE_CACHE_H
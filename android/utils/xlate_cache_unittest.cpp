@@ -0,0 +1,89 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/xlate_cache.h"
+
+#include <gtest/gtest.h>
+
+TEST(XlateCache, InsertAndLookup) {
+    XlateCache cache;
+    xlateCache_init(&cache);
+    xlateCache_sync(&cache, NULL, 0);
+
+    uint8_t page[16];
+    uint64_t ppage = 0;
+    uint8_t* host = NULL;
+
+    // Virtual page 0 must not match an empty entry.
+    EXPECT_FALSE(xlateCache_lookup(&cache, 0, &ppage, &host));
+
+    xlateCache_insert(&cache, 0, 42, page);
+    xlateCache_insert(&cache, 7, 43, NULL);
+    EXPECT_TRUE(xlateCache_lookup(&cache, 0, &ppage, &host));
+    EXPECT_EQ(42U, ppage);
+    EXPECT_EQ(page, host);
+    EXPECT_TRUE(xlateCache_lookup(&cache, 7, &ppage, &host));
+    EXPECT_EQ(43U, ppage);
+    EXPECT_TRUE(host == NULL);
+
+    // Conflicting pages replace each other.
+    xlateCache_insert(&cache, XLATE_CACHE_SIZE, 44, page);
+    EXPECT_FALSE(xlateCache_lookup(&cache, 0, &ppage, &host));
+    EXPECT_TRUE(xlateCache_lookup(&cache, XLATE_CACHE_SIZE, &ppage, &host));
+    EXPECT_EQ(44U, ppage);
+
+    EXPECT_EQ(3U, cache.hits);
+    EXPECT_EQ(2U, cache.misses);
+}
+
+TEST(XlateCache, PhysPage) {
+    // An x86 NX page: the walk leaves bit 63 set, TARGET_PTE_MASK drops it.
+    const uint64_t kX86PteMask = 0x7fffffffffffULL;
+    const uint64_t kNxPage = (1ULL << 63) | 0x12345000ULL;
+
+    EXPECT_EQ(0x12345U, xlateCache_physPage(kNxPage, kX86PteMask, 12));
+    EXPECT_EQ(0x12345U, xlateCache_physPage(0x12345000ULL, kX86PteMask, 12));
+    // Other targets keep all the bits.
+    EXPECT_EQ(0x12345U, xlateCache_physPage(0x12345000ULL, ~0ULL, 12));
+
+    // The cached translation is the one without the flag.
+    XlateCache cache;
+    xlateCache_init(&cache);
+    xlateCache_sync(&cache, NULL, 0);
+    xlateCache_insert(&cache, 0xb7000,
+                      xlateCache_physPage(kNxPage, kX86PteMask, 12), NULL);
+    uint64_t ppage = 0;
+    uint8_t* host = NULL;
+    EXPECT_TRUE(xlateCache_lookup(&cache, 0xb7000, &ppage, &host));
+    EXPECT_EQ(0x12345U, ppage);
+}
+
+TEST(XlateCache, Sync) {
+    XlateCache cache;
+    xlateCache_init(&cache);
+    int cpu0, cpu1;
+    uint64_t ppage;
+    uint8_t* host;
+
+    xlateCache_sync(&cache, &cpu0, 1);
+    xlateCache_insert(&cache, 3, 4, NULL);
+
+    // Same context and generation, nothing is dropped.
+    xlateCache_sync(&cache, &cpu0, 1);
+    EXPECT_TRUE(xlateCache_lookup(&cache, 3, &ppage, &host));
+
+    xlateCache_sync(&cache, &cpu0, 2);
+    EXPECT_FALSE(xlateCache_lookup(&cache, 3, &ppage, &host));
+
+    xlateCache_insert(&cache, 3, 4, NULL);
+    xlateCache_sync(&cache, &cpu1, 2);
+    EXPECT_FALSE(xlateCache_lookup(&cache, 3, &ppage, &host));
+}
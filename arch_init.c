@@ -375,6 +375,7 @@ int ram_load(QEMUFile *f, void *opaque, int version_id)
 {
     ram_addr_t addr;
     int flags;
+    bool base_used = qemu_ram_base_used();
 
     if (version_id < 3 || version_id > 4) {
         return -EINVAL;
@@ -436,13 +437,22 @@ int ram_load(QEMUFile *f, void *opaque, int version_id)
             }
 
             ch = qemu_get_byte(f);
-            memset(host, ch, TARGET_PAGE_SIZE);
+            if (base_used) {
+                /* Don't unshare pages that already match, and don't
+                 * discard them either, as that would bring back the
+                 * content of the RAM base file. */
+                if (!is_dup_page(host, ch)) {
+                    memset(host, ch, TARGET_PAGE_SIZE);
+                }
+            } else {
+                memset(host, ch, TARGET_PAGE_SIZE);
 #ifndef _WIN32
-            if (ch == 0 &&
-                (!kvm_enabled() || kvm_has_sync_mmu())) {
-                qemu_madvise(host, TARGET_PAGE_SIZE, QEMU_MADV_DONTNEED);
-            }
+                if (ch == 0 &&
+                    (!kvm_enabled() || kvm_has_sync_mmu())) {
+                    qemu_madvise(host, TARGET_PAGE_SIZE, QEMU_MADV_DONTNEED);
+                }
 #endif
+            }
         } else if (flags & RAM_SAVE_FLAG_PAGE) {
             void *host;
 
@@ -451,7 +461,16 @@ int ram_load(QEMUFile *f, void *opaque, int version_id)
             else
                 host = host_from_stream_offset(f, addr, flags);
 
-            qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+            if (base_used) {
+                uint8_t buf[TARGET_PAGE_SIZE];
+
+                qemu_get_buffer(f, buf, TARGET_PAGE_SIZE);
+                if (memcmp(host, buf, TARGET_PAGE_SIZE)) {
+                    memcpy(host, buf, TARGET_PAGE_SIZE);
+                }
+            } else {
+                qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+            }
         }
         if (qemu_file_get_error(f)) {
             return -EIO;
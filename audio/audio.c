@@ -33,6 +33,7 @@
 #include "android/utils/system.h"
 #include "android/qemu-debug.h"
 #include "android/android.h"
+#include "android/utils/hot_profiler.h"
 
 /* #define DEBUG_PLIVE */
 /* #define DEBUG_LIVE */
@@ -1226,6 +1227,7 @@ static void audio_timer (void *opaque)
     last = now;
 #endif
 
+    hotProfiler_count(HOT_PROFILER_AUDIO_TIMER);
     audio_run ("timer");
     timer_mod(s->ts, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + conf.period.ticks);
 }
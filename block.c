@@ -677,6 +677,24 @@ void bdrv_close(BlockDriverState *bs)
     }
 }
 
+/*
+ * Close and open the image again with the same flags, to drop all the
+ * metadata cached by the driver after another process modified the file.
+ */
+int bdrv_reopen(BlockDriverState *bs)
+{
+    char filename[sizeof(bs->filename)];
+    BlockDriver *drv = bs->drv;
+    int flags = bs->open_flags;
+
+    if (!drv) {
+        return -ENOMEDIUM;
+    }
+    pstrcpy(filename, sizeof(filename), bs->filename);
+    bdrv_close(bs);
+    return bdrv_open(bs, filename, flags, drv);
+}
+
 void bdrv_close_all(void)
 {
     BlockDriverState *bs;
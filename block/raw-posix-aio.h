@@ -34,10 +34,20 @@ BlockDriverAIOCB *paio_ioctl(BlockDriverState *bs, int fd,
         unsigned long int req, void *buf,
         BlockDriverCompletionFunc *cb, void *opaque);
 
-/* linux-aio.c - Linux native implementation */
-void *laio_init(void);
+/* linux-aio.c - Linux native implementation, with io_uring or Linux AIO.
+ * laio_init() returns NULL if neither is available, or if |buffered| and
+ * the host doesn't have io_uring. laio_submit() returns NULL if it can't
+ * take the request, which the thread pool must then handle. */
+void *laio_init(int buffered);
 BlockDriverAIOCB *laio_submit(BlockDriverState *bs, void *aio_ctx, int fd,
         int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
         BlockDriverCompletionFunc *cb, void *opaque, int type);
 
+/* The guest RAM is registered with io_uring, which keeps its own references
+ * to the pages. Loading a snapshot can replace them (see ram_load()), so it
+ * must be done between laio_unregister_ram() and laio_register_ram(), with
+ * no request in flight. */
+void laio_unregister_ram(void);
+void laio_register_ram(void);
+
 #endif /* QEMU_RAW_POSIX_AIO_H */
@@ -166,28 +166,18 @@ static int raw_open_common(BlockDriverState *bs, const char *filename,
         }
     }
 
-#ifdef CONFIG_LINUX_AIO
-    if ((bdrv_flags & (BDRV_O_NOCACHE|BDRV_O_NATIVE_AIO)) ==
-                      (BDRV_O_NOCACHE|BDRV_O_NATIVE_AIO)) {
-
-        /* We're falling back to POSIX AIO in some cases */
-        paio_init();
+    /* We're falling back to POSIX AIO in some cases */
+    if (paio_init() < 0) {
+        goto out_free_buf;
+    }
 
-        s->aio_ctx = laio_init();
-        if (!s->aio_ctx) {
-            goto out_free_buf;
-        }
-        s->use_aio = 1;
-    } else
-#endif
-    {
-        if (paio_init() < 0) {
-            goto out_free_buf;
-        }
 #ifdef CONFIG_LINUX_AIO
-        s->use_aio = 0;
-#endif
+    s->use_aio = 0;
+    if (bdrv_flags & BDRV_O_NATIVE_AIO) {
+        s->aio_ctx = laio_init(!(bdrv_flags & BDRV_O_NOCACHE));
+        s->use_aio = (s->aio_ctx != NULL);
     }
+#endif
 
     return 0;
 
@@ -513,15 +503,18 @@ static BlockDriverAIOCB *raw_aio_submit(BlockDriverState *bs,
      * boundary.  Check if this is the case or telll the low-level
      * driver that it needs to copy the buffer.
      */
-    if (s->aligned_buf) {
-        if (!qiov_is_aligned(qiov)) {
-            type |= QEMU_AIO_MISALIGNED;
+    if (s->aligned_buf && !qiov_is_aligned(qiov)) {
+        type |= QEMU_AIO_MISALIGNED;
 #ifdef CONFIG_LINUX_AIO
-        } else if (s->use_aio) {
-            return laio_submit(bs, s->aio_ctx, s->fd, sector_num, qiov,
-                               nb_sectors, cb, opaque, type);
-#endif
+    } else if (s->use_aio) {
+        BlockDriverAIOCB *acb;
+
+        acb = laio_submit(bs, s->aio_ctx, s->fd, sector_num, qiov,
+                          nb_sectors, cb, opaque, type);
+        if (acb) {
+            return acb;
         }
+#endif
     }
 
     return paio_submit(bs, s->fd, sector_num, qiov, nb_sectors,
@@ -20,6 +20,7 @@
 #include "cpu.h"
 #include "disas/disas.h"
 #include "tcg.h"
+#include "helper.h"
 #include "sysemu/kvm.h"
 #include "exec/hax.h"
 #include "qemu/atomic.h"
@@ -189,6 +190,39 @@ static inline TranslationBlock *tb_find_fast(CPUArchState *env)
     return tb;
 }
 
+/* Called from translated code at the end of a TB that jumps to a
+   computed address (indirect branch, return).  Returns the host code of
+   the next TB if it is in tb_jmp_cache, so that translated code can jump
+   there directly, or the TCG epilogue, which returns 0 to cpu_exec(), on
+   a miss or when the CPU must go back to the main loop.  */
+void *helper_lookup_tb_ptr(CPUArchState *env)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    int flags;
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    tb = env->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
+                 tb->flags != flags)) {
+        tcg_ctx.tb_ctx.tb_lookup_miss_count++;
+        return tcg_ctx.code_gen_epilogue;
+    }
+
+    /* Make the TB current before checking for pending requests, so
+       that cpu_unlink_tb() either breaks its direct jumps, or we see
+       the request here and go back to the main loop.  */
+    env->current_tb = tb;
+    barrier();
+    if (unlikely(cpu->interrupt_request || cpu->exit_request)) {
+        tcg_ctx.tb_ctx.tb_lookup_miss_count++;
+        return tcg_ctx.code_gen_epilogue;
+    }
+    tcg_ctx.tb_ctx.tb_lookup_hit_count++;
+    return tb->tc_ptr;
+}
+
 static CPUDebugExcpHandler *debug_excp_handler;
 
 void cpu_set_debug_excp_handler(CPUDebugExcpHandler *handler)
@@ -594,6 +628,7 @@ int cpu_exec(CPUOldState *env)
                     tc_ptr = tb->tc_ptr;
                 /* execute the generated code */
                     next_tb = tcg_qemu_tb_exec(env, tc_ptr);
+                    tcg_ctx.tb_ctx.tb_exit_count++;
                     if ((next_tb & 3) == 2) {
                         /* Instruction counter expired.  */
                         int insns_left;
@@ -35,6 +35,7 @@
 #include "exec/hax.h"
 
 #include "sysemu/cpus.h"
+#include "android/utils/hot_profiler.h"
 
 static CPUState *cur_cpu;
 static CPUState *next_cpu;
@@ -178,6 +179,7 @@ void vm_stop(int reason)
 static int qemu_cpu_exec(CPUOldState *env)
 {
     int ret;
+    int64_t hot_start;
 
 #ifdef CONFIG_PROFILER
     int64_t ti = profile_getclock();
@@ -199,7 +201,9 @@ static int qemu_cpu_exec(CPUOldState *env)
         env->icount_extra = count;
     }
 #endif
+    hot_start = hotProfiler_begin();
     ret = cpu_exec(env);
+    hotProfiler_end(HOT_PROFILER_CPU_EXEC, hot_start);
 #ifdef CONFIG_PROFILER
     qemu_time += profile_getclock() - ti;
 #endif
@@ -22,9 +22,14 @@
 #include "exec/exec-all.h"
 #include "exec/cputlb.h"
 #include "exec/ram_addr.h"
+#include "qemu/timer.h"
+#include "android/utils/hot_profiler.h"
 
 /* statistics */
 int tlb_flush_count;
+int tlb_flush_page_count;
+int tlb_resize_count;
+uint64_t tlb_victim_hit_count;
 
 static const CPUTLBEntry s_cputlb_empty_entry = {
     .addr_read  = -1,
@@ -33,6 +38,108 @@ static const CPUTLBEntry s_cputlb_empty_entry = {
     .addend     = -1,
 };
 
+/* Length of the window over which the use of a TLB is measured before
+   it is shrunk.  */
+#define TLB_RESIZE_WINDOW_NS  (100 * 1000 * 1000LL)
+
+static bool tlb_entry_is_empty(const CPUTLBEntry *te)
+{
+    return te->addr_read == -1 && te->addr_write == -1 && te->addr_code == -1;
+}
+
+/* Return true iff 'te' maps the page at 'addr' for any kind of access. */
+static bool tlb_entry_matches_page(const CPUTLBEntry *te, target_ulong addr)
+{
+    const target_ulong mask = TARGET_PAGE_MASK | TLB_INVALID_MASK;
+
+    return addr == (te->addr_read & mask) ||
+           addr == (te->addr_write & mask) ||
+           addr == (te->addr_code & mask);
+}
+
+static void tlb_mmu_alloc(CPUArchState *env, int mmu_idx, size_t n_entries)
+{
+    env->tlb_mask[mmu_idx] = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
+    env->tlb_table[mmu_idx] = g_malloc(n_entries * sizeof(CPUTLBEntry));
+    env->iotlb[mmu_idx] = g_malloc(n_entries * sizeof(hwaddr));
+}
+
+static void tlb_mmu_flush(CPUArchState *env, int mmu_idx)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+
+    /* s_cputlb_empty_entry is all ones.  */
+    memset(env->tlb_table[mmu_idx], -1,
+           tlb_n_entries(env, mmu_idx) * sizeof(CPUTLBEntry));
+    memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+    desc->n_used_entries = 0;
+    desc->n_evictions = 0;
+}
+
+void tlb_init(CPUArchState *env)
+{
+    int64_t now = get_clock_realtime();
+    int mmu_idx;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+
+        memset(desc, 0, sizeof(*desc));
+        desc->window_begin_ns = now;
+        tlb_mmu_alloc(env, mmu_idx, 1 << CPU_TLB_DYN_DEFAULT_BITS);
+        tlb_mmu_flush(env, mmu_idx);
+    }
+    env->tlb_flush_addr = -1;
+    env->tlb_flush_mask = 0;
+}
+
+/* Called on a full flush to adapt the size of the TLB of 'mmu_idx' to
+   its use since the previous one. The table doubles when more than 70%
+   of its entries were used, or when conflicting pages evicted many
+   valid entries. It only shrinks when less than 30% of its entries were
+   used at every flush of the last TLB_RESIZE_WINDOW_NS, so that a short
+   phase with a small working set doesn't make it thrash right after.  */
+static void tlb_mmu_resize(CPUArchState *env, int mmu_idx, int64_t now)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    size_t old_size = tlb_n_entries(env, mmu_idx);
+    size_t new_size = old_size;
+    size_t rate;
+    bool window_expired = now > desc->window_begin_ns + TLB_RESIZE_WINDOW_NS;
+
+    if (desc->n_used_entries > desc->window_max_entries) {
+        desc->window_max_entries = desc->n_used_entries;
+    }
+    rate = desc->window_max_entries * 100 / old_size;
+
+    if (rate > 70 || desc->n_evictions > old_size / 2) {
+        if (old_size < (1 << CPU_TLB_DYN_MAX_BITS)) {
+            new_size = old_size << 1;
+        }
+    } else if (rate < 30 && window_expired) {
+        new_size = 1 << CPU_TLB_DYN_MIN_BITS;
+        while (new_size < old_size &&
+               desc->window_max_entries * 100 / new_size > 70) {
+            new_size <<= 1;
+        }
+    }
+
+    if (new_size == old_size) {
+        if (window_expired) {
+            desc->window_begin_ns = now;
+            desc->window_max_entries = 0;
+        }
+        return;
+    }
+
+    g_free(env->tlb_table[mmu_idx]);
+    g_free(env->iotlb[mmu_idx]);
+    tlb_mmu_alloc(env, mmu_idx, new_size);
+    desc->window_begin_ns = now;
+    desc->window_max_entries = 0;
+    tlb_resize_count++;
+}
+
 /* NOTE:
  * If flush_global is true (the usual case), flush all tlb entries.
  * If flush_global is false, flush (at least) all tlb entries not
@@ -47,7 +154,8 @@ static const CPUTLBEntry s_cputlb_empty_entry = {
  */
 void tlb_flush(CPUArchState *env, int flush_global)
 {
-    int i;
+    int64_t now = get_clock_realtime();
+    int mmu_idx;
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush:\n");
@@ -56,12 +164,9 @@ void tlb_flush(CPUArchState *env, int flush_global)
        links while we are modifying them */
     env->current_tb = NULL;
 
-    for (i = 0; i < CPU_TLB_SIZE; i++) {
-        int mmu_idx;
-
-        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-            env->tlb_table[mmu_idx][i] = s_cputlb_empty_entry;
-        }
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        tlb_mmu_resize(env, mmu_idx, now);
+        tlb_mmu_flush(env, mmu_idx);
     }
 
     memset(env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
@@ -73,19 +178,23 @@ void tlb_flush(CPUArchState *env, int flush_global)
 
 static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
-    if (addr == (tlb_entry->addr_read &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
-        addr == (tlb_entry->addr_write &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
-        addr == (tlb_entry->addr_code &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+    if (tlb_entry_matches_page(tlb_entry, addr)) {
         *tlb_entry = s_cputlb_empty_entry;
     }
 }
 
+static void tlb_flush_vtlb_page(CPUArchState *env, int mmu_idx,
+                                target_ulong addr)
+{
+    int k;
+
+    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
+    }
+}
+
 void tlb_flush_page(CPUArchState *env, target_ulong addr)
 {
-    int i;
     int mmu_idx;
 
 #if defined(DEBUG_TLB)
@@ -106,9 +215,11 @@ void tlb_flush_page(CPUArchState *env, target_ulong addr)
     env->current_tb = NULL;
 
     addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    tlb_flush_page_count++;
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        tlb_flush_entry(&env->tlb_table[mmu_idx][tlb_index(env, mmu_idx, addr)],
+                        addr);
+        tlb_flush_vtlb_page(env, mmu_idx, addr);
     }
 
     tb_flush_jmp_cache(env, addr);
@@ -159,12 +270,16 @@ void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length)
 
         env = cpu->env_ptr;
         for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-            unsigned int i;
+            size_t i, n = tlb_n_entries(env, mmu_idx);
 
-            for (i = 0; i < CPU_TLB_SIZE; i++) {
+            for (i = 0; i < n; i++) {
                 tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                       start1, length);
             }
+            for (i = 0; i < CPU_VTLB_SIZE; i++) {
+                tlb_reset_dirty_range(&env->tlb_v_table[mmu_idx][i],
+                                      start1, length);
+            }
         }
     }
 }
@@ -180,14 +295,51 @@ static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
    so that it is no longer dirty */
 void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
 {
-    int i;
+    int k;
     int mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+        tlb_set_dirty1(&env->tlb_table[mmu_idx][tlb_index(env, mmu_idx, vaddr)],
+                       vaddr);
+        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+            tlb_set_dirty1(&env->tlb_v_table[mmu_idx][k], vaddr);
+        }
+    }
+}
+
+/* Called on a TLB miss before walking the guest page tables. If the
+   victim TLB of 'mmu_idx' has an entry for 'page', swap it with the one
+   at 'index' in the main table and return true. 'elt_ofs' is the offset
+   in CPUTLBEntry of the address field to compare (addr_read, addr_write
+   or addr_code). */
+bool victim_tlb_hit(CPUArchState *env, int mmu_idx, int index,
+                    size_t elt_ofs, target_ulong page)
+{
+    int vidx;
+
+    for (vidx = 0; vidx < CPU_VTLB_SIZE; vidx++) {
+        CPUTLBEntry *vtlb = &env->tlb_v_table[mmu_idx][vidx];
+        target_ulong cmp = *(target_ulong *)((uintptr_t)vtlb + elt_ofs);
+
+        if ((cmp & (TARGET_PAGE_MASK | TLB_INVALID_MASK)) == page) {
+            CPUTLBEntry *tlb = &env->tlb_table[mmu_idx][index];
+            hwaddr *iotlb = &env->iotlb[mmu_idx][index];
+            CPUTLBEntry tmptlb = *tlb;
+            hwaddr tmpiotlb = *iotlb;
+
+            if (tlb_entry_is_empty(tlb)) {
+                env->tlb_d[mmu_idx].n_used_entries++;
+            }
+            *tlb = *vtlb;
+            *vtlb = tmptlb;
+            *iotlb = env->iotlb_v[mmu_idx][vidx];
+            env->iotlb_v[mmu_idx][vidx] = tmpiotlb;
+            tlb_victim_hit_count++;
+            return true;
+        }
     }
+    return false;
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
@@ -230,6 +382,7 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
     CPUWatchpoint *wp;
     hwaddr iotlb;
 
+    hotProfiler_count(HOT_PROFILER_TLB_REFILL);
     assert(size >= TARGET_PAGE_SIZE);
     if (size != TARGET_PAGE_SIZE) {
         tlb_add_large_page(env, vaddr, size);
@@ -286,9 +439,26 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
         }
     }
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    env->iotlb[mmu_idx][index] = iotlb - vaddr;
+    /* Make sure there's no cached translation for the new page.  */
+    tlb_flush_vtlb_page(env, mmu_idx, vaddr & TARGET_PAGE_MASK);
+
+    index = tlb_index(env, mmu_idx, vaddr);
     te = &env->tlb_table[mmu_idx][index];
+
+    /* Keep the entry being replaced in the victim TLB, unless it is for
+       the same page.  */
+    if (tlb_entry_is_empty(te)) {
+        env->tlb_d[mmu_idx].n_used_entries++;
+    } else if (!tlb_entry_matches_page(te, vaddr & TARGET_PAGE_MASK)) {
+        CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+        unsigned int vidx = desc->vindex++ % CPU_VTLB_SIZE;
+
+        env->tlb_v_table[mmu_idx][vidx] = *te;
+        env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
+        desc->n_evictions++;
+    }
+
+    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -325,8 +495,8 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     int mmu_idx, page_index, pd;
     void *p;
 
-    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env1);
+    page_index = tlb_index(env1, mmu_idx, addr);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
                  (addr & TARGET_PAGE_MASK))) {
         cpu_ldub_code(env1, addr);
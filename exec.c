@@ -47,6 +47,7 @@
 #include "exec/hax.h"
 #include "exec/ram_addr.h"
 #include "qemu/timer.h"
+#include "android/utils/shared_ram.h"
 #if defined(CONFIG_USER_ONLY)
 #include <qemu.h>
 #endif
@@ -185,6 +186,8 @@ void cpu_exec_init(CPUArchState *env)
     QTAILQ_INIT(&env->watchpoints);
 #if defined(CONFIG_USER_ONLY)
     cpu_list_unlock();
+#else
+    tlb_init(env);
 #endif
 #if defined(CPU_SAVE_VERSION) && !defined(CONFIG_USER_ONLY)
     register_savevm(NULL,
@@ -604,8 +607,10 @@ void cpu_tlb_update_dirty(CPUArchState *env)
     int i;
     int mmu_idx;
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        for(i = 0; i < CPU_TLB_SIZE; i++)
+        for(i = 0; i < tlb_n_entries(env, mmu_idx); i++)
             tlb_update_dirty(&env->tlb_table[mmu_idx][i]);
+        for(i = 0; i < CPU_VTLB_SIZE; i++)
+            tlb_update_dirty(&env->tlb_v_table[mmu_idx][i]);
     }
 }
 
@@ -951,6 +956,90 @@ static void *file_ram_alloc(RAMBlock *block,
 }
 #endif
 
+/* Descriptor of the RAM base file, or -1 if it could not be opened. */
+static int ram_base_fd = -2;
+static bool ram_base_used;
+
+/*
+ * Map the RAM of |block| copy-on-write from the RAM base file, at the
+ * same offset, so that the pages the guest does not modify are shared
+ * with the other instances that use the same file. Return NULL if the
+ * file cannot be used for this block, e.g. because it was produced with
+ * a different memory layout.
+ */
+static void *ram_base_alloc(RAMBlock *block, const char *name,
+                            ram_addr_t size)
+{
+    void *area;
+
+    if (ram_base_fd == -2) {
+        ram_base_fd = sharedRam_open(ram_base_path);
+    }
+    if (ram_base_fd < 0) {
+        return NULL;
+    }
+    area = sharedRam_map(ram_base_fd, block->offset, size);
+    if (!area) {
+        fprintf(stderr, "Cannot map RAM block '%s' from %s: %s\n",
+                name, ram_base_path, strerror(errno));
+        return NULL;
+    }
+    block->fd = dup(ram_base_fd);
+    block->flags |= RAM_BASE_MASK;
+    ram_base_used = true;
+    return area;
+}
+
+bool qemu_ram_base_used(void)
+{
+    return ram_base_used;
+}
+
+int qemu_ram_save_base(const char *path)
+{
+    RAMBlock *block;
+    SharedRamBlock *blocks;
+    int count = 0;
+    int ret;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        count++;
+    }
+    blocks = g_new(SharedRamBlock, count);
+    count = 0;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        blocks[count].host = block->host;
+        blocks[count].offset = block->offset;
+        blocks[count].size = block->length;
+        count++;
+    }
+    ret = sharedRam_save(path, blocks, count);
+    g_free(blocks);
+    return ret;
+}
+
+int qemu_ram_get_sharing_stats(SharedRamStats *stats)
+{
+    RAMBlock *block;
+
+    memset(stats, 0, sizeof(*stats));
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (sharedRam_countPages(block->host, block->length, stats) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void qemu_ram_foreach_block(RAMBlockIterFunc func, void *opaque)
+{
+    RAMBlock *block;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        func(block->host, block->offset, block->length, opaque);
+    }
+}
+
 static ram_addr_t find_ram_offset(ram_addr_t size)
 {
     RAMBlock *block, *next_block;
@@ -1102,6 +1191,10 @@ ram_addr_t qemu_ram_alloc_from_ptr(DeviceState *dev, const char *name,
                 exit(1);
             }
             new_block->host = file_ram_alloc(new_block, size, mem_path);
+        } else if (ram_base_path && phys_mem_alloc == qemu_anon_ram_alloc &&
+                   !hax_enabled()) {
+            /* HAX populates guest memory itself, see below. */
+            new_block->host = ram_base_alloc(new_block, name, size);
         }
         if (!new_block->host) {
             new_block->host = phys_mem_alloc(size);
@@ -1253,7 +1346,11 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
             } else {
                 flags = MAP_FIXED;
                 munmap(vaddr, length);
-                if (block->fd >= 0) {
+                if (block->flags & RAM_BASE_MASK) {
+                    flags |= MAP_PRIVATE;
+                    area = mmap(vaddr, length, PROT_READ | PROT_WRITE,
+                                flags, block->fd, block->offset + offset);
+                } else if (block->fd >= 0) {
 #ifdef MAP_POPULATE
                     flags |= mem_prealloc ? MAP_POPULATE | MAP_SHARED :
                         MAP_PRIVATE;
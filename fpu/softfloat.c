@@ -42,6 +42,9 @@ these four paragraphs for those parts of this code that are retained.
 
 #include "fpu/softfloat.h"
 
+#include <float.h>
+#include <math.h>
+
 /*----------------------------------------------------------------------------
 | Primitive arithmetic functions, including multi-word arithmetic, and
 | division and square root approximations.  (Can be specialized to target if
@@ -1864,7 +1867,7 @@ static float32 subFloat32Sigs( float32 a, float32 b, flag zSign STATUS_PARAM)
 | Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_add( float32 a, float32 b STATUS_PARAM )
+static float32 soft_float32_add( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
     a = float32_squash_input_denormal(a STATUS_VAR);
@@ -1887,7 +1890,7 @@ float32 float32_add( float32 a, float32 b STATUS_PARAM )
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_sub( float32 a, float32 b STATUS_PARAM )
+static float32 soft_float32_sub( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
     a = float32_squash_input_denormal(a STATUS_VAR);
@@ -1910,7 +1913,7 @@ float32 float32_sub( float32 a, float32 b STATUS_PARAM )
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_mul( float32 a, float32 b STATUS_PARAM )
+static float32 soft_float32_mul( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
@@ -1973,7 +1976,7 @@ float32 float32_mul( float32 a, float32 b STATUS_PARAM )
 | IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_div( float32 a, float32 b STATUS_PARAM )
+static float32 soft_float32_div( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
@@ -2143,7 +2146,7 @@ float32 float32_rem( float32 a, float32 b STATUS_PARAM )
 | externally will flip the sign bit on NaNs.)
 *----------------------------------------------------------------------------*/
 
-float32 float32_muladd(float32 a, float32 b, float32 c, int flags STATUS_PARAM)
+static float32 soft_float32_muladd(float32 a, float32 b, float32 c, int flags STATUS_PARAM)
 {
     flag aSign, bSign, cSign, zSign;
     int_fast16_t aExp, bExp, cExp, pExp, zExp, expDiff;
@@ -2345,7 +2348,7 @@ float32 float32_muladd(float32 a, float32 b, float32 c, int flags STATUS_PARAM)
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_sqrt( float32 a STATUS_PARAM )
+static float32 soft_float32_sqrt( float32 a STATUS_PARAM )
 {
     flag aSign;
     int_fast16_t aExp, zExp;
@@ -3427,7 +3430,7 @@ static float64 subFloat64Sigs( float64 a, float64 b, flag zSign STATUS_PARAM )
 | Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_add( float64 a, float64 b STATUS_PARAM )
+static float64 soft_float64_add( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
     a = float64_squash_input_denormal(a STATUS_VAR);
@@ -3450,7 +3453,7 @@ float64 float64_add( float64 a, float64 b STATUS_PARAM )
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_sub( float64 a, float64 b STATUS_PARAM )
+static float64 soft_float64_sub( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
     a = float64_squash_input_denormal(a STATUS_VAR);
@@ -3473,7 +3476,7 @@ float64 float64_sub( float64 a, float64 b STATUS_PARAM )
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_mul( float64 a, float64 b STATUS_PARAM )
+static float64 soft_float64_mul( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
@@ -3534,7 +3537,7 @@ float64 float64_mul( float64 a, float64 b STATUS_PARAM )
 | the IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_div( float64 a, float64 b STATUS_PARAM )
+static float64 soft_float64_div( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
@@ -3697,7 +3700,7 @@ float64 float64_rem( float64 a, float64 b STATUS_PARAM )
 | externally will flip the sign bit on NaNs.)
 *----------------------------------------------------------------------------*/
 
-float64 float64_muladd(float64 a, float64 b, float64 c, int flags STATUS_PARAM)
+static float64 soft_float64_muladd(float64 a, float64 b, float64 c, int flags STATUS_PARAM)
 {
     flag aSign, bSign, cSign, zSign;
     int_fast16_t aExp, bExp, cExp, pExp, zExp, expDiff;
@@ -3918,7 +3921,7 @@ float64 float64_muladd(float64 a, float64 b, float64 c, int flags STATUS_PARAM)
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_sqrt( float64 a STATUS_PARAM )
+static float64 soft_float64_sqrt( float64 a STATUS_PARAM )
 {
     flag aSign;
     int_fast16_t aExp, zExp;
@@ -3964,6 +3967,324 @@ float64 float64_sqrt( float64 a STATUS_PARAM )
 
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast path ("hardfloat") for the basic arithmetic operations.
+|
+| When the inexact flag is already raised and the rounding mode is
+| round-to-nearest-even, an operation on zero or normal inputs can be done
+| with the host FPU: it computes the same correctly rounded result, and the
+| only other flag it can raise is overflow, which is detected from an
+| infinite result.  Tiny results, which may underflow or need to be flushed
+| to zero, and all other inputs still go through the software
+| implementations above.
+|
+| This requires the host to evaluate float and double expressions in their
+| own precision (i.e. no x87 excess precision) with its default rounding
+| mode, which QEMU never changes.  muladd is only done on the host when the
+| compiler can use an FMA instruction, as fma() is slow otherwise.
+*----------------------------------------------------------------------------*/
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0 && !defined(__FAST_MATH__)
+#define USE_HARDFLOAT 1
+#else
+#define USE_HARDFLOAT 0
+#endif
+
+#if USE_HARDFLOAT && defined(__FMA__)
+#define USE_HARDFLOAT_FMA 1
+#else
+#define USE_HARDFLOAT_FMA 0
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} union_float32;
+
+typedef union {
+    float64 s;
+    double h;
+} union_float64;
+
+INLINE flag can_use_fpu(float_status *status)
+{
+    return USE_HARDFLOAT &&
+           (STATUS(float_exception_flags) & float_flag_inexact) &&
+           STATUS(float_rounding_mode) == float_round_nearest_even;
+}
+
+/* Returns 1 if `a' is a zero or a normal number. */
+INLINE flag float32_is_zero_or_normal(float32 a)
+{
+    uint32_t exp = float32_val(a) & 0x7F800000;
+
+    return exp != 0x7F800000 && (exp != 0 || !(float32_val(a) & 0x007FFFFF));
+}
+
+INLINE flag float64_is_zero_or_normal(float64 a)
+{
+    uint64_t exp = float64_val(a) & LIT64(0x7FF0000000000000);
+
+    return exp != LIT64(0x7FF0000000000000) &&
+           (exp != 0 || !(float64_val(a) & LIT64(0x000FFFFFFFFFFFFF)));
+}
+
+/* Checks the host result `r' of an operation.  Raises overflow if it is
+   infinite and returns 1 if it can be used as is, or returns 0 if it is
+   tiny and must be recomputed in software.  `zeroOk' tells whether a zero
+   result is known to be exact, e.g. a product with a zero operand. */
+INLINE flag float32_hard_result_ok(float32 r, flag zeroOk STATUS_PARAM)
+{
+    uint32_t abs = float32_val(r) & 0x7FFFFFFF;
+
+    if (abs == 0x7F800000) {
+        float_raise(float_flag_overflow STATUS_VAR);
+        return 1;
+    }
+    return abs > 0x00800000 || (abs == 0 && zeroOk);
+}
+
+INLINE flag float64_hard_result_ok(float64 r, flag zeroOk STATUS_PARAM)
+{
+    uint64_t abs = float64_val(r) & LIT64(0x7FFFFFFFFFFFFFFF);
+
+    if (abs == LIT64(0x7FF0000000000000)) {
+        float_raise(float_flag_overflow STATUS_VAR);
+        return 1;
+    }
+    return abs > LIT64(0x0010000000000000) || (abs == 0 && zeroOk);
+}
+
+float32 float32_add( float32 a, float32 b STATUS_PARAM )
+{
+    if (can_use_fpu(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        union_float32 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h + ub.h;
+        if (float32_hard_result_ok(ur.s, float32_is_zero(a) &&
+                                         float32_is_zero(b) STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+    return soft_float32_add(a, b STATUS_VAR);
+}
+
+float32 float32_sub( float32 a, float32 b STATUS_PARAM )
+{
+    if (can_use_fpu(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        union_float32 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h - ub.h;
+        if (float32_hard_result_ok(ur.s, float32_is_zero(a) &&
+                                         float32_is_zero(b) STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+    return soft_float32_sub(a, b STATUS_VAR);
+}
+
+float32 float32_mul( float32 a, float32 b STATUS_PARAM )
+{
+    if (can_use_fpu(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        union_float32 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h * ub.h;
+        if (float32_hard_result_ok(ur.s, float32_is_zero(a) ||
+                                         float32_is_zero(b) STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+    return soft_float32_mul(a, b STATUS_VAR);
+}
+
+float32 float32_div( float32 a, float32 b STATUS_PARAM )
+{
+    if (can_use_fpu(status) &&
+        float32_is_zero_or_normal(a) &&
+        float32_is_zero_or_normal(b) && !float32_is_zero(b)) {
+        union_float32 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h / ub.h;
+        if (float32_hard_result_ok(ur.s, float32_is_zero(a) STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+    return soft_float32_div(a, b STATUS_VAR);
+}
+
+float32 float32_muladd(float32 a, float32 b, float32 c, int flags STATUS_PARAM)
+{
+    if (USE_HARDFLOAT_FMA && can_use_fpu(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b) &&
+        float32_is_zero_or_normal(c)) {
+        union_float32 ua, ub, uc, ur;
+
+        ua.s = a;
+        ub.s = b;
+        uc.s = c;
+        if (flags & float_muladd_negate_product) {
+            ua.h = -ua.h;
+        }
+        if (flags & float_muladd_negate_c) {
+            uc.h = -uc.h;
+        }
+        if (float32_is_zero(a) || float32_is_zero(b)) {
+            /* The product is an exact zero, and so is the sum. */
+            ur.h = (ua.h * ub.h) + uc.h;
+        } else {
+            ur.h = fmaf(ua.h, ub.h, uc.h);
+            if (!float32_hard_result_ok(ur.s, 0 STATUS_VAR)) {
+                return soft_float32_muladd(a, b, c, flags STATUS_VAR);
+            }
+        }
+        if (flags & float_muladd_negate_result) {
+            return float32_chs(ur.s);
+        }
+        return ur.s;
+    }
+    return soft_float32_muladd(a, b, c, flags STATUS_VAR);
+}
+
+float32 float32_sqrt( float32 a STATUS_PARAM )
+{
+    if (can_use_fpu(status) && float32_is_zero_or_normal(a) &&
+        (!float32_is_neg(a) || float32_is_zero(a))) {
+        union_float32 ua, ur;
+
+        /* The square root of a normal number is normal. */
+        ua.s = a;
+        ur.h = sqrtf(ua.h);
+        return ur.s;
+    }
+    return soft_float32_sqrt(a STATUS_VAR);
+}
+
+float64 float64_add( float64 a, float64 b STATUS_PARAM )
+{
+    if (can_use_fpu(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        union_float64 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h + ub.h;
+        if (float64_hard_result_ok(ur.s, float64_is_zero(a) &&
+                                         float64_is_zero(b) STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+    return soft_float64_add(a, b STATUS_VAR);
+}
+
+float64 float64_sub( float64 a, float64 b STATUS_PARAM )
+{
+    if (can_use_fpu(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        union_float64 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h - ub.h;
+        if (float64_hard_result_ok(ur.s, float64_is_zero(a) &&
+                                         float64_is_zero(b) STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+    return soft_float64_sub(a, b STATUS_VAR);
+}
+
+float64 float64_mul( float64 a, float64 b STATUS_PARAM )
+{
+    if (can_use_fpu(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        union_float64 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h * ub.h;
+        if (float64_hard_result_ok(ur.s, float64_is_zero(a) ||
+                                         float64_is_zero(b) STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+    return soft_float64_mul(a, b STATUS_VAR);
+}
+
+float64 float64_div( float64 a, float64 b STATUS_PARAM )
+{
+    if (can_use_fpu(status) &&
+        float64_is_zero_or_normal(a) &&
+        float64_is_zero_or_normal(b) && !float64_is_zero(b)) {
+        union_float64 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h / ub.h;
+        if (float64_hard_result_ok(ur.s, float64_is_zero(a) STATUS_VAR)) {
+            return ur.s;
+        }
+    }
+    return soft_float64_div(a, b STATUS_VAR);
+}
+
+float64 float64_muladd(float64 a, float64 b, float64 c, int flags STATUS_PARAM)
+{
+    if (USE_HARDFLOAT_FMA && can_use_fpu(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b) &&
+        float64_is_zero_or_normal(c)) {
+        union_float64 ua, ub, uc, ur;
+
+        ua.s = a;
+        ub.s = b;
+        uc.s = c;
+        if (flags & float_muladd_negate_product) {
+            ua.h = -ua.h;
+        }
+        if (flags & float_muladd_negate_c) {
+            uc.h = -uc.h;
+        }
+        if (float64_is_zero(a) || float64_is_zero(b)) {
+            /* The product is an exact zero, and so is the sum. */
+            ur.h = (ua.h * ub.h) + uc.h;
+        } else {
+            ur.h = fma(ua.h, ub.h, uc.h);
+            if (!float64_hard_result_ok(ur.s, 0 STATUS_VAR)) {
+                return soft_float64_muladd(a, b, c, flags STATUS_VAR);
+            }
+        }
+        if (flags & float_muladd_negate_result) {
+            return float64_chs(ur.s);
+        }
+        return ur.s;
+    }
+    return soft_float64_muladd(a, b, c, flags STATUS_VAR);
+}
+
+float64 float64_sqrt( float64 a STATUS_PARAM )
+{
+    if (can_use_fpu(status) && float64_is_zero_or_normal(a) &&
+        (!float64_is_neg(a) || float64_is_zero(a))) {
+        union_float64 ua, ur;
+
+        /* The square root of a normal number is normal. */
+        ua.s = a;
+        ur.h = sqrt(ua.h);
+        return ur.s;
+    }
+    return soft_float64_sqrt(a STATUS_VAR);
+}
+
 /*----------------------------------------------------------------------------
 | Returns the binary log of the double-precision floating-point value `a'.
 | The operation is performed according to the IEC/IEEE Standard for Binary
@@ -0,0 +1,330 @@
+// Copyright 2014 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// These tests check that the host FPU fast path of fpu/softfloat.c gives
+// bit-for-bit the same results and exception flags as the software
+// implementation.
+//
+// The fast path is only taken when the inexact flag is already raised, so
+// each operation is done twice: once with no flags raised, which always
+// uses the software implementation, and once with the inexact flag raised.
+// Apart from the inexact flag, both must give the same result and flags.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+// The QEMU headers are C-only, and pull system headers that must be seen
+// by the C++ compiler first.
+extern "C" {
+#include "fpu/softfloat.h"
+}
+
+namespace {
+
+const int kRandomIterations = 200000;
+
+// Small deterministic PRNG (xorshift64*), so that failures are
+// reproducible.
+class Random {
+public:
+    Random() : mState(0x9E3779B97F4A7C15ULL) {}
+
+    uint64_t next() {
+        mState ^= mState >> 12;
+        mState ^= mState << 25;
+        mState ^= mState >> 27;
+        return mState * 2685821657736338717ULL;
+    }
+
+private:
+    uint64_t mState;
+};
+
+// Configurations of float_status used by the targets: plain IEEE, and
+// the ARM "standard FPSCR value" used by NEON, which flushes denormals.
+struct StatusConfig {
+    const char* name;
+    bool flushToZero;
+    bool flushInputsToZero;
+    bool defaultNanMode;
+    int detectTininess;
+};
+
+const StatusConfig kConfigs[] = {
+    { "ieee", false, false, false, float_tininess_after_rounding },
+    { "ieee-before", false, false, false, float_tininess_before_rounding },
+    { "ftz", true, true, true, float_tininess_before_rounding },
+};
+
+void initStatus(float_status* status, const StatusConfig& config,
+                int flags) {
+    memset(status, 0, sizeof(*status));
+    set_float_rounding_mode(float_round_nearest_even, status);
+    set_float_detect_tininess(config.detectTininess, status);
+    set_flush_to_zero(config.flushToZero, status);
+    set_flush_inputs_to_zero(config.flushInputsToZero, status);
+    set_default_nan_mode(config.defaultNanMode, status);
+    set_float_exception_flags(flags, status);
+}
+
+// Interesting single-precision values: zeroes, extreme normals,
+// denormals, infinities, NaNs, and values around 1.
+const uint32_t kEdgeFloat32[] = {
+    0x00000000, 0x80000000,  // +0, -0
+    0x00800000, 0x80800000,  // +-FLT_MIN
+    0x00800001, 0x00FFFFFF,
+    0x7F7FFFFF, 0xFF7FFFFF,  // +-FLT_MAX
+    0x7F000000, 0x3F800000, 0xBF800000, 0x3F800001, 0x3F7FFFFF,
+    0x00000001, 0x807FFFFF,  // denormals
+    0x7F800000, 0xFF800000,  // +-inf
+    0x7FC00000, 0x7FA00000,  // quiet and signaling NaNs
+    0x1F800000, 0x20000000, 0x5F800000, 0x60000000,
+};
+
+const uint64_t kEdgeFloat64[] = {
+    0x0000000000000000ULL, 0x8000000000000000ULL,
+    0x0010000000000000ULL, 0x8010000000000000ULL,
+    0x0010000000000001ULL, 0x001FFFFFFFFFFFFFULL,
+    0x7FEFFFFFFFFFFFFFULL, 0xFFEFFFFFFFFFFFFFULL,
+    0x7FE0000000000000ULL, 0x3FF0000000000000ULL, 0xBFF0000000000000ULL,
+    0x3FF0000000000001ULL, 0x3FEFFFFFFFFFFFFFULL,
+    0x0000000000000001ULL, 0x800FFFFFFFFFFFFFULL,
+    0x7FF0000000000000ULL, 0xFFF0000000000000ULL,
+    0x7FF8000000000000ULL, 0x7FF4000000000000ULL,
+    0x1FF0000000000000ULL, 0x2000000000000000ULL,
+    0x5FF0000000000000ULL, 0x6000000000000000ULL,
+};
+
+// Returns a random float32, biased towards values whose operations
+// overflow or underflow: the exponent is either fully random or close
+// to one of its ends.
+uint32_t randomFloat32(Random* rng) {
+    uint64_t r = rng->next();
+    uint32_t sign = (r & 1) << 31;
+    uint32_t frac = (r >> 1) & 0x007FFFFF;
+    uint32_t exp;
+    switch ((r >> 24) & 3) {
+    case 0:
+        exp = (r >> 32) & 0xFF;
+        break;
+    case 1:
+        exp = (r >> 32) & 0x1F;
+        break;
+    case 2:
+        exp = 0xFE - ((r >> 32) & 0x1F);
+        break;
+    default:
+        exp = 0x70 + ((r >> 32) & 0x1F);
+        break;
+    }
+    return sign | (exp << 23) | frac;
+}
+
+uint64_t randomFloat64(Random* rng) {
+    uint64_t r = rng->next();
+    uint64_t sign = (r & 1) << 63;
+    uint64_t frac = rng->next() & 0x000FFFFFFFFFFFFFULL;
+    uint64_t exp;
+    switch ((r >> 1) & 3) {
+    case 0:
+        exp = (r >> 8) & 0x7FF;
+        break;
+    case 1:
+        exp = (r >> 8) & 0x3F;
+        break;
+    case 2:
+        exp = 0x7FE - ((r >> 8) & 0x3F);
+        break;
+    default:
+        exp = 0x3E0 + ((r >> 8) & 0x3F);
+        break;
+    }
+    return sign | (exp << 52) | frac;
+}
+
+enum Op { kAdd, kSub, kMul, kDiv, kSqrt, kMulAdd };
+
+const char* const kOpNames[] = { "add", "sub", "mul", "div", "sqrt", "muladd" };
+
+float32 doFloat32Op(Op op, uint32_t a, uint32_t b, uint32_t c, int mulAddFlags,
+                    float_status* status) {
+    float32 fa = make_float32(a);
+    float32 fb = make_float32(b);
+    float32 fc = make_float32(c);
+    switch (op) {
+    case kAdd: return float32_add(fa, fb, status);
+    case kSub: return float32_sub(fa, fb, status);
+    case kMul: return float32_mul(fa, fb, status);
+    case kDiv: return float32_div(fa, fb, status);
+    case kSqrt: return float32_sqrt(fa, status);
+    case kMulAdd: return float32_muladd(fa, fb, fc, mulAddFlags, status);
+    }
+    return fa;
+}
+
+float64 doFloat64Op(Op op, uint64_t a, uint64_t b, uint64_t c, int mulAddFlags,
+                    float_status* status) {
+    float64 fa = make_float64(a);
+    float64 fb = make_float64(b);
+    float64 fc = make_float64(c);
+    switch (op) {
+    case kAdd: return float64_add(fa, fb, status);
+    case kSub: return float64_sub(fa, fb, status);
+    case kMul: return float64_mul(fa, fb, status);
+    case kDiv: return float64_div(fa, fb, status);
+    case kSqrt: return float64_sqrt(fa, status);
+    case kMulAdd: return float64_muladd(fa, fb, fc, mulAddFlags, status);
+    }
+    return fa;
+}
+
+// Runs |op| on the given inputs through both paths, and returns true iff
+// they agree. On mismatch, a description is added to the test output.
+bool checkFloat32(const StatusConfig& config, Op op, uint32_t a, uint32_t b,
+                  uint32_t c, int mulAddFlags) {
+    float_status soft, hard;
+    initStatus(&soft, config, 0);
+    initStatus(&hard, config, float_flag_inexact);
+
+    uint32_t softResult = float32_val(
+            doFloat32Op(op, a, b, c, mulAddFlags, &soft));
+    uint32_t hardResult = float32_val(
+            doFloat32Op(op, a, b, c, mulAddFlags, &hard));
+    int softFlags = get_float_exception_flags(&soft) | float_flag_inexact;
+    int hardFlags = get_float_exception_flags(&hard);
+    if (softResult == hardResult && softFlags == hardFlags) {
+        return true;
+    }
+    ADD_FAILURE() << "float32_" << kOpNames[op] << " (" << config.name
+                  << ", muladd flags " << mulAddFlags << ") "
+                  << std::hex << a << " " << b << " " << c
+                  << ": soft " << softResult << "/" << softFlags
+                  << ", hard " << hardResult << "/" << hardFlags;
+    return false;
+}
+
+bool checkFloat64(const StatusConfig& config, Op op, uint64_t a, uint64_t b,
+                  uint64_t c, int mulAddFlags) {
+    float_status soft, hard;
+    initStatus(&soft, config, 0);
+    initStatus(&hard, config, float_flag_inexact);
+
+    uint64_t softResult = float64_val(
+            doFloat64Op(op, a, b, c, mulAddFlags, &soft));
+    uint64_t hardResult = float64_val(
+            doFloat64Op(op, a, b, c, mulAddFlags, &hard));
+    int softFlags = get_float_exception_flags(&soft) | float_flag_inexact;
+    int hardFlags = get_float_exception_flags(&hard);
+    if (softResult == hardResult && softFlags == hardFlags) {
+        return true;
+    }
+    ADD_FAILURE() << "float64_" << kOpNames[op] << " (" << config.name
+                  << ", muladd flags " << mulAddFlags << ") "
+                  << std::hex << a << " " << b << " " << c
+                  << ": soft " << softResult << "/" << softFlags
+                  << ", hard " << hardResult << "/" << hardFlags;
+    return false;
+}
+
+const Op kOps[] = { kAdd, kSub, kMul, kDiv, kSqrt, kMulAdd };
+
+const int kMulAddFlags[] = {
+    0,
+    float_muladd_negate_c,
+    float_muladd_negate_product,
+    float_muladd_negate_result,
+    float_muladd_negate_c | float_muladd_negate_product |
+            float_muladd_negate_result,
+};
+
+const size_t kMaxFailures = 10;
+
+}  // namespace
+
+TEST(SoftFloat, Float32EdgeCases) {
+    const size_t n = sizeof(kEdgeFloat32) / sizeof(kEdgeFloat32[0]);
+    size_t failures = 0;
+    for (size_t k = 0; k < sizeof(kConfigs) / sizeof(kConfigs[0]); ++k) {
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                for (size_t o = 0; o < sizeof(kOps) / sizeof(kOps[0]); ++o) {
+                    uint32_t c = kEdgeFloat32[(i + j) % n];
+                    if (!checkFloat32(kConfigs[k], kOps[o], kEdgeFloat32[i],
+                                      kEdgeFloat32[j], c, 0) &&
+                        ++failures >= kMaxFailures) {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(SoftFloat, Float64EdgeCases) {
+    const size_t n = sizeof(kEdgeFloat64) / sizeof(kEdgeFloat64[0]);
+    size_t failures = 0;
+    for (size_t k = 0; k < sizeof(kConfigs) / sizeof(kConfigs[0]); ++k) {
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                for (size_t o = 0; o < sizeof(kOps) / sizeof(kOps[0]); ++o) {
+                    uint64_t c = kEdgeFloat64[(i + j) % n];
+                    if (!checkFloat64(kConfigs[k], kOps[o], kEdgeFloat64[i],
+                                      kEdgeFloat64[j], c, 0) &&
+                        ++failures >= kMaxFailures) {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(SoftFloat, Float32Random) {
+    Random rng;
+    size_t failures = 0;
+    for (int n = 0; n < kRandomIterations; ++n) {
+        const StatusConfig& config =
+                kConfigs[n % (sizeof(kConfigs) / sizeof(kConfigs[0]))];
+        uint32_t a = randomFloat32(&rng);
+        uint32_t b = randomFloat32(&rng);
+        uint32_t c = randomFloat32(&rng);
+        int mulAddFlags = kMulAddFlags[n % (sizeof(kMulAddFlags) /
+                                            sizeof(kMulAddFlags[0]))];
+        for (size_t o = 0; o < sizeof(kOps) / sizeof(kOps[0]); ++o) {
+            if (!checkFloat32(config, kOps[o], a, b, c, mulAddFlags) &&
+                ++failures >= kMaxFailures) {
+                return;
+            }
+        }
+    }
+}
+
+TEST(SoftFloat, Float64Random) {
+    Random rng;
+    size_t failures = 0;
+    for (int n = 0; n < kRandomIterations; ++n) {
+        const StatusConfig& config =
+                kConfigs[n % (sizeof(kConfigs) / sizeof(kConfigs[0]))];
+        uint64_t a = randomFloat64(&rng);
+        uint64_t b = randomFloat64(&rng);
+        uint64_t c = randomFloat64(&rng);
+        int mulAddFlags = kMulAddFlags[n % (sizeof(kMulAddFlags) /
+                                            sizeof(kMulAddFlags[0]))];
+        for (size_t o = 0; o < sizeof(kOps) / sizeof(kOps[0]); ++o) {
+            if (!checkFloat64(config, kOps[o], a, b, c, mulAddFlags) &&
+                ++failures >= kMaxFailures) {
+                return;
+            }
+        }
+    }
+}
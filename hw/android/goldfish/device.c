@@ -15,6 +15,7 @@
 #include "hw/android/goldfish/device.h"
 #include "hw/android/goldfish/vmem.h"
 #include "android/utils/debug.h"
+#include "android/utils/hot_profiler.h"
 
 #define PDEV_BUS_OP_DONE        (0x00)
 #define PDEV_BUS_OP_REMOVE_DEV  (0x04)
@@ -104,6 +105,7 @@ int goldfish_device_add(struct goldfish_device *dev,
     int iomemtype;
     goldfish_add_device_no_io(dev);
     iomemtype = cpu_register_io_memory(mem_read, mem_write, opaque);
+    hotProfiler_setIoName(iomemtype >> IO_MEM_SHIFT, dev->name);
     cpu_register_physical_memory(dev->base, dev->size, iomemtype);
     return 0;
 }
@@ -15,6 +15,7 @@
 #include "android/charmap.h"
 #include "android/globals.h"  /* for android_hw */
 #include "android/multitouch-screen.h"
+#include "android/utils/hot_profiler.h"
 #include "exec/cpu-common.h"
 #include "exec/hwaddr.h"
 #include "hw/hw.h"
@@ -518,6 +519,7 @@ void events_dev_init(uint32_t base, qemu_irq irq)
     }
 
     iomemtype = cpu_register_io_memory(events_readfn, events_writefn, s);
+    hotProfiler_setIoName(iomemtype >> IO_MEM_SHIFT, "goldfish_events");
 
     cpu_register_physical_memory(base, 0xfff, iomemtype);
 
@@ -14,6 +14,7 @@
 #include "android/android.h"
 #include "android/utils/debug.h"
 #include "android/utils/duff.h"
+#include "android/utils/startup_trace.h"
 #include "exec/ram_addr.h"
 #include "hw/android/goldfish/device.h"
 #include "hw/hw.h"
@@ -453,6 +454,8 @@ static void goldfish_fb_update_display(void *opaque)
     if(base == 0)
         return;
 
+    startupTrace_mark(STARTUP_TRACE_FIRST_FRAME);
+
     if((s->int_enable & FB_INT_VSYNC) && !(s->int_status & FB_INT_VSYNC)) {
         s->int_status |= FB_INT_VSYNC;
         goldfish_device_set_irq(&s->dev, 0, 1);
@@ -628,6 +631,15 @@ static void goldfish_fb_write(void *opaque, hwaddr offset,
     }
 }
 
+/* A refresh has nothing to do while the guest is halted, unless a new base
+ * must be shown, or the guest waits for VSYNC interrupts. */
+static int goldfish_fb_is_idle(void *opaque)
+{
+    struct goldfish_fb_state *s = opaque;
+
+    return !s->need_update && !(s->int_enable & FB_INT_VSYNC);
+}
+
 static CPUReadMemoryFunc *goldfish_fb_readfn[] = {
    goldfish_fb_read,
    goldfish_fb_read,
@@ -655,6 +667,7 @@ void goldfish_fb_init(int id)
                                  NULL,
                                  NULL,
                                  s);
+    graphic_console_set_idle_check(s->ds, goldfish_fb_is_idle);
 
     s->dpi = 165;  /* XXX: Find better way to get actual value ! */
 
@@ -15,10 +15,16 @@
 #include "hw/android/goldfish/nand.h"
 #include "hw/android/goldfish/vmem.h"
 #include "hw/hw.h"
+#include "sysemu/sysemu.h"
+#include "android/utils/hot_profiler.h"
 #include "android/utils/tempfile.h"
 #include "android/qemu-debug.h"
 #include "android/android.h"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 #define  DEBUG  1
 #if DEBUG
 #  define  D(...)    VERBOSE_PRINT(init,__VA_ARGS__)
@@ -65,6 +71,12 @@ typedef struct {
     uint32_t   erase_size;   /* size of the data buffer mentioned above */
     uint64_t   max_size;     /* Capacity limit for the image. The actual underlying
                               * file may be smaller. */
+#ifndef _WIN32
+    /* Background snapshot state, see nand_dev_background_prepare() */
+    uint64_t   saved_size;   /* size of the image when the VM was stopped */
+    int        preimage_fd;  /* original content of the chunks modified since */
+    uint8_t*   preserved;    /* one flag per chunk, shared with the child */
+#endif
 } nand_dev;
 
 nand_threshold    android_nand_write_threshold;
@@ -216,6 +228,191 @@ static int  do_ftruncate(int  fd, size_t  size)
 #define NAND_DEV_SAVE_DISK_BUF_SIZE 2048
 
 
+#ifndef _WIN32
+
+/* Granularity of the pre-images kept during a background save. */
+#define NAND_DEV_PRESERVE_CHUNK  65536
+
+/* True in the child process that writes a background snapshot. */
+static int nand_background_save = 0;
+
+/* EINTR-proof pread/pwrite. These don't touch the file offset, which the
+ * child process of a background save shares with the emulator. */
+static ssize_t do_pread(int fd, void* buf, size_t size, uint64_t offset)
+{
+    ssize_t ret;
+    do {
+        ret = pread(fd, buf, size, (off_t)offset);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+static ssize_t do_pwrite(int fd, const void* buf, size_t size, uint64_t offset)
+{
+    ssize_t ret;
+    do {
+        ret = pwrite(fd, buf, size, (off_t)offset);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+/**
+ * Called before the guest modifies [addr, addr + len) of a device while a
+ * background save is running: copy the chunks the child did not read yet
+ * to the pre-image file, then flag them so that the child reads them from
+ * there.
+ */
+static void nand_dev_preserve(nand_dev *dev, uint64_t addr, uint32_t len)
+{
+    uint8_t buffer[NAND_DEV_PRESERVE_CHUNK];
+    uint64_t chunk, last;
+
+    if (!dev->preserved || addr >= dev->saved_size || !len) {
+        return;
+    }
+    chunk = addr / NAND_DEV_PRESERVE_CHUNK;
+    last = (addr + len - 1) / NAND_DEV_PRESERVE_CHUNK;
+    for (; chunk <= last; chunk++) {
+        uint64_t offset = chunk * NAND_DEV_PRESERVE_CHUNK;
+        ssize_t ret;
+
+        if (offset >= dev->saved_size) {
+            break;
+        }
+        if (dev->preserved[chunk]) {
+            continue;
+        }
+        ret = do_pread(dev->fd, buffer, sizeof(buffer), offset);
+        if (ret < 0 || do_pwrite(dev->preimage_fd, buffer, ret, offset) != ret) {
+            XLOG("%s: could not preserve chunk: %s\n", __FUNCTION__,
+                 strerror(errno));
+            continue;
+        }
+        /* The child must not see the flag before the pre-image. */
+        __sync_synchronize();
+        dev->preserved[chunk] = 1;
+    }
+}
+
+/**
+ * Copies the disk image, as it was when the VM was stopped, to the snapshot
+ * file from the child process of a background save.
+ */
+static void nand_dev_save_disk_background(QEMUFile *f, nand_dev *dev)
+{
+    uint8_t buffer[NAND_DEV_PRESERVE_CHUNK];
+    uint64_t offset;
+    uint64_t total_size = dev->saved_size;
+
+    if (total_size > dev->max_size) {
+        total_size = dev->max_size;
+    }
+    qemu_put_be64(f, total_size);
+
+    for (offset = 0; offset < total_size; offset += NAND_DEV_PRESERVE_CHUNK) {
+        uint64_t chunk = offset / NAND_DEV_PRESERVE_CHUNK;
+        size_t size = NAND_DEV_PRESERVE_CHUNK;
+        ssize_t ret;
+
+        if (size > total_size - offset) {
+            size = total_size - offset;
+        }
+        ret = do_pread(dev->fd, buffer, size, offset);
+        __sync_synchronize();
+        if (dev->preserved && dev->preserved[chunk]) {
+            /* The emulator modified it since, the data read above may or
+             * may not be the original one. */
+            ret = do_pread(dev->preimage_fd, buffer, size, offset);
+        }
+        if (ret != size) {
+            qemu_file_set_error(f, ret < 0 ? -errno : -EIO);
+            XLOG("%s read failed: %s\n", __FUNCTION__,
+                 ret < 0 ? strerror(errno) : "short read");
+            return;
+        }
+        qemu_put_buffer(f, buffer, size);
+    }
+}
+
+static int64_t nand_dev_background_prepare(void *opaque, bool guest_resumes)
+{
+    int64_t total = 0;
+    int i;
+
+    for (i = 0; i < nand_dev_count; i++) {
+        nand_dev *dev = nand_devs + i;
+        struct stat st;
+        size_t chunks;
+
+        dev->saved_size = (fstat(dev->fd, &st) == 0) ? st.st_size : 0;
+        total += dev->saved_size;
+        if (!guest_resumes || (dev->flags & NAND_DEV_FLAG_READ_ONLY)) {
+            continue;
+        }
+        /* The flags are written by the emulator and read by the child,
+         * hence a shared mapping. */
+        chunks = (dev->saved_size + NAND_DEV_PRESERVE_CHUNK - 1) /
+                 NAND_DEV_PRESERVE_CHUNK;
+        if (!chunks) {
+            continue;
+        }
+        dev->preserved = mmap(NULL, chunks, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (dev->preserved == MAP_FAILED) {
+            dev->preserved = NULL;
+        }
+        if (dev->preserved) {
+            FILE* tmp = tmpfile();
+            dev->preimage_fd = tmp ? dup(fileno(tmp)) : -1;
+            if (tmp) {
+                fclose(tmp);
+            }
+        }
+        if (!dev->preserved || dev->preimage_fd < 0) {
+            /* Not much we can do, the snapshot may be inconsistent. */
+            XLOG("could not preserve %.*s during the background save: %s\n",
+                 dev->devname_len, dev->devname, strerror(errno));
+            if (dev->preserved) {
+                munmap(dev->preserved, chunks);
+                dev->preserved = NULL;
+            }
+        }
+    }
+    nand_background_save = 1;
+    return total;
+}
+
+static void nand_dev_background_finish(void *opaque)
+{
+    int i;
+
+    for (i = 0; i < nand_dev_count; i++) {
+        nand_dev *dev = nand_devs + i;
+        if (dev->preserved) {
+            munmap(dev->preserved,
+                   (dev->saved_size + NAND_DEV_PRESERVE_CHUNK - 1) /
+                   NAND_DEV_PRESERVE_CHUNK);
+            dev->preserved = NULL;
+        }
+        if (dev->preimage_fd >= 0) {
+            close(dev->preimage_fd);
+            dev->preimage_fd = -1;
+        }
+        dev->saved_size = 0;
+    }
+    nand_background_save = 0;
+}
+
+#else  /* _WIN32 */
+
+#define nand_background_save  0
+#define nand_dev_preserve(dev, addr, len)  ((void)0)
+#define nand_dev_save_disk_background(f, dev)  ((void)0)
+
+#endif  /* _WIN32 */
+
 /**
  * Copies the current contents of a disk image into the snapshot file.
  *
@@ -230,6 +427,11 @@ static void  nand_dev_save_disk_state(QEMUFile *f, nand_dev *dev)
     int ret;
     uint64_t total_copied = 0;
 
+    if (nand_background_save) {
+        nand_dev_save_disk_background(f, dev);
+        return;
+    }
+
     /* Size of file to restore, hence size of data block following.
      * TODO Work out whether to use lseek64 here. */
 
@@ -384,53 +586,120 @@ static int   nand_dev_controller_state_load(QEMUFile *f, void  *opaque, int  ver
     return ret ? ret : nand_dev_load_disks(f);
 }
 
+/* Read |len| bytes at the current offset of the image into |dst|. Past the
+ * end of the file, set |*eof| and fill |dst| with 0xff, like erased flash.
+ */
+static void nand_dev_read_range(nand_dev *dev, uint8_t *dst, int len, int *eof)
+{
+    while (len > 0 && !*eof) {
+        int ret = do_read(dev->fd, dst, len);
+        if (ret <= 0) {
+            *eof = 1;
+            break;
+        }
+        dst += ret;
+        len -= ret;
+    }
+    if (len > 0) {
+        memset(dst, 0xff, len);
+    }
+}
+
 static uint32_t nand_dev_read_file(nand_dev *dev, target_ulong data, uint64_t addr, uint32_t total_len)
 {
+    VmemRange ranges[VMEM_MAX_RANGES];
     uint32_t len = total_len;
-    size_t read_len = dev->erase_size;
     int eof = 0;
 
     NAND_UPDATE_READ_THRESHOLD(total_len);
 
     do_lseek(dev->fd, addr, SEEK_SET);
     while(len > 0) {
-        if(read_len < dev->erase_size) {
-            memset(dev->data, 0xff, dev->erase_size);
-            read_len = dev->erase_size;
-            eof = 1;
-        }
-        if(len < read_len)
-            read_len = len;
-        if(!eof) {
-            read_len = do_read(dev->fd, dev->data, read_len);
+        int count = VMEM_MAX_RANGES;
+        int mapped = vmem_map(current_cpu, data, len, 1, ranges, &count);
+        int n;
+
+        if (mapped < 0)
+            break;
+        /* Read straight into guest RAM, pages that are not RAM go through
+         * the data buffer. */
+        for (n = 0; n < count; n++) {
+            VmemRange *r = &ranges[n];
+            int offset, read_len;
+
+            if (r->host) {
+                nand_dev_read_range(dev, r->host, r->len, &eof);
+                continue;
+            }
+            for (offset = 0; offset < r->len; offset += read_len) {
+                read_len = r->len - offset;
+                if (read_len > dev->erase_size)
+                    read_len = dev->erase_size;
+                nand_dev_read_range(dev, dev->data, read_len, &eof);
+                cpu_physical_memory_write_rom(r->phys + offset, dev->data,
+                                              read_len);
+            }
         }
-        safe_memory_rw_debug(current_cpu, data, dev->data, read_len, 1);
-        data += read_len;
-        len -= read_len;
+        vmem_unmap(ranges, count, 1);
+        data += mapped;
+        len -= mapped;
     }
     return total_len;
 }
 
+/* Write |len| bytes of |src| at the current offset of the image. Return the
+ * number of bytes written. */
+static int nand_dev_write_range(nand_dev *dev, const uint8_t *src, int len)
+{
+    int ret = do_write(dev->fd, src, len);
+    if (ret < len) {
+        XLOG("nand_dev_write_file, write failed: %s\n", strerror(errno));
+        return ret < 0 ? 0 : ret;
+    }
+    return len;
+}
+
 static uint32_t nand_dev_write_file(nand_dev *dev, target_ulong data, uint64_t addr, uint32_t total_len)
 {
+    VmemRange ranges[VMEM_MAX_RANGES];
     uint32_t len = total_len;
-    size_t write_len = dev->erase_size;
-    int ret;
 
     NAND_UPDATE_WRITE_THRESHOLD(total_len);
 
+    nand_dev_preserve(dev, addr, total_len);
     do_lseek(dev->fd, addr, SEEK_SET);
     while(len > 0) {
-        if(len < write_len)
-            write_len = len;
-        safe_memory_rw_debug(current_cpu, data, dev->data, write_len, 0);
-        ret = do_write(dev->fd, dev->data, write_len);
-        if(ret < write_len) {
-            XLOG("nand_dev_write_file, write failed: %s\n", strerror(errno));
+        int count = VMEM_MAX_RANGES;
+        int mapped = vmem_map(current_cpu, data, len, 0, ranges, &count);
+        int n;
+
+        if (mapped < 0)
             break;
+        for (n = 0; n < count; n++) {
+            VmemRange *r = &ranges[n];
+            int offset, write_len, ret;
+
+            if (r->host) {
+                ret = nand_dev_write_range(dev, r->host, r->len);
+                len -= ret;
+                if (ret < r->len)
+                    return total_len - len;
+                continue;
+            }
+            for (offset = 0; offset < r->len; offset += write_len) {
+                write_len = r->len - offset;
+                if (write_len > dev->erase_size)
+                    write_len = dev->erase_size;
+                cpu_physical_memory_rw(r->phys + offset, dev->data,
+                                       write_len, 0);
+                ret = nand_dev_write_range(dev, dev->data, write_len);
+                len -= ret;
+                if (ret < write_len)
+                    return total_len - len;
+            }
         }
-        data += write_len;
-        len -= write_len;
+        vmem_unmap(ranges, count, 0);
+        data += mapped;
     }
     return total_len - len;
 }
@@ -441,6 +710,7 @@ static uint32_t nand_dev_erase_file(nand_dev *dev, uint64_t addr, uint32_t total
     size_t write_len = dev->erase_size;
     int ret;
 
+    nand_dev_preserve(dev, addr, total_len);
     do_lseek(dev->fd, addr, SEEK_SET);
     memset(dev->data, 0xff, dev->erase_size);
     while(len > 0) {
@@ -682,6 +952,7 @@ void nand_dev_init(uint32_t base)
 
     s = (nand_dev_controller_state *)g_malloc0(sizeof(nand_dev_controller_state));
     iomemtype = cpu_register_io_memory(nand_dev_readfn, nand_dev_writefn, s);
+    hotProfiler_setIoName(iomemtype >> IO_MEM_SHIFT, "goldfish_nand");
     cpu_register_physical_memory(base, 0x00000fff, iomemtype);
     s->base = base;
 
@@ -692,6 +963,10 @@ void nand_dev_init(uint32_t base)
                     nand_dev_controller_state_save,
                     nand_dev_controller_state_load,
                     s);
+#ifndef _WIN32
+    register_background_save(nand_dev_background_prepare,
+                             nand_dev_background_finish, NULL);
+#endif
 }
 
 static int arg_match(const char *a, const char *b, size_t b_len)
@@ -901,6 +1176,11 @@ void nand_add_dev(const char *arg)
         close(initfd);
     }
     dev->fd = rwfd;
+#ifndef _WIN32
+    dev->saved_size = 0;
+    dev->preimage_fd = -1;
+    dev->preserved = NULL;
+#endif
 
     nand_dev_count++;
 
@@ -0,0 +1,254 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "migration/qemu-file.h"
+#include "net/net.h"
+#include "hw/android/goldfish/device.h"
+#include "hw/hw.h"
+#include "qemu/timer.h"
+#include "android/emulation/goldfish_net.h"
+
+/* Glue between the goldfish network device model, see
+ * android/emulation/goldfish_net.h, and the rest of QEMU: guest physical
+ * memory, the VLAN layer, the goldfish interrupt controller and the
+ * virtual clock for interrupt coalescing. */
+
+struct net_state {
+    struct goldfish_device dev;
+    GoldfishNet net;
+    VLANClientState *vc;
+    QEMUTimer *timer;
+};
+
+#define  GOLDFISH_NET_SAVE_VERSION  1
+
+static void goldfish_net_save(QEMUFile *f, void *opaque)
+{
+    struct net_state *s = opaque;
+    GoldfishNet *net = &s->net;
+
+    qemu_put_be32(f, net->int_status);
+    qemu_put_be32(f, net->int_enable);
+    qemu_put_be32(f, net->ring_size);
+    qemu_put_be64(f, net->tx.base);
+    qemu_put_be32(f, net->tx.head);
+    qemu_put_be64(f, net->rx.base);
+    qemu_put_be32(f, net->rx.head);
+    qemu_put_be32(f, net->coalesce_frames);
+    qemu_put_be32(f, net->coalesce_usecs);
+    qemu_put_be32(f, net->pending_causes);
+    qemu_put_be32(f, net->pending_count);
+}
+
+static int goldfish_net_load(QEMUFile *f, void *opaque, int version_id)
+{
+    struct net_state *s = opaque;
+    GoldfishNet *net = &s->net;
+
+    if (version_id != GOLDFISH_NET_SAVE_VERSION) {
+        return -1;
+    }
+    net->int_status = qemu_get_be32(f);
+    net->int_enable = qemu_get_be32(f);
+    net->ring_size = qemu_get_be32(f);
+    net->tx.base = qemu_get_be64(f);
+    net->tx.head = qemu_get_be32(f);
+    net->rx.base = qemu_get_be64(f);
+    net->rx.head = qemu_get_be32(f);
+    net->coalesce_frames = qemu_get_be32(f);
+    net->coalesce_usecs = qemu_get_be32(f);
+    net->pending_causes = qemu_get_be32(f);
+    net->pending_count = qemu_get_be32(f);
+
+    /* The interrupt controller restores the IRQ line itself. The
+     * coalescing timer and the frames queued by the VLAN are not saved,
+     * signal what was pending right away. */
+    timer_del(s->timer);
+    net->timer_armed = 0;
+    net->tx_blocked = 0;
+    net->irq_level = (net->int_status & net->int_enable) != 0;
+    goldfishNet_timerExpired(net);
+    return 0;
+}
+
+static void net_read_mem(void *opaque, uint64_t addr, void *buf, uint32_t len)
+{
+    cpu_physical_memory_read(addr, buf, len);
+}
+
+static void net_write_mem(void *opaque, uint64_t addr, const void *buf,
+                          uint32_t len)
+{
+    cpu_physical_memory_write(addr, buf, len);
+}
+
+static void *net_map_mem(void *opaque, uint64_t addr, uint32_t len,
+                         int is_write)
+{
+    hwaddr plen = len;
+    void *host = cpu_physical_memory_map(addr, &plen, is_write);
+
+    if (host && plen < len) {
+        cpu_physical_memory_unmap(host, plen, is_write, 0);
+        host = NULL;
+    }
+    return host;
+}
+
+static void net_unmap_mem(void *opaque, void *host, uint32_t len,
+                          int is_write)
+{
+    cpu_physical_memory_unmap(host, len, is_write, len);
+}
+
+static void goldfish_net_tx_sent(VLANClientState *vc)
+{
+    struct net_state *s = vc->opaque;
+
+    goldfishNet_txResume(&s->net);
+}
+
+static int net_send(void *opaque, const GoldfishNetIov *iov, int count)
+{
+    struct net_state *s = opaque;
+    struct iovec vec[GOLDFISH_NET_MAX_FRAGMENTS];
+    int n;
+
+    for (n = 0; n < count; n++) {
+        vec[n].iov_base = iov[n].base;
+        vec[n].iov_len = iov[n].len;
+    }
+    return qemu_sendv_packet_async(s->vc, vec, count, goldfish_net_tx_sent);
+}
+
+static void net_set_irq(void *opaque, int level)
+{
+    struct net_state *s = opaque;
+
+    goldfish_device_set_irq(&s->dev, 0, level);
+}
+
+static void net_set_timer(void *opaque, uint32_t usecs)
+{
+    struct net_state *s = opaque;
+
+    if (usecs) {
+        timer_mod(s->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                            usecs * 1000LL);
+    } else {
+        timer_del(s->timer);
+    }
+}
+
+static void net_rx_ready(void *opaque)
+{
+    struct net_state *s = opaque;
+
+    qemu_flush_queued_packets(s->vc);
+}
+
+static const GoldfishNetOps goldfish_net_ops = {
+    .read_mem  = net_read_mem,
+    .write_mem = net_write_mem,
+    .map_mem   = net_map_mem,
+    .unmap_mem = net_unmap_mem,
+    .send      = net_send,
+    .set_irq   = net_set_irq,
+    .set_timer = net_set_timer,
+    .rx_ready  = net_rx_ready,
+};
+
+static void goldfish_net_timer_tick(void *opaque)
+{
+    struct net_state *s = opaque;
+
+    goldfishNet_timerExpired(&s->net);
+}
+
+static int goldfish_net_can_receive(VLANClientState *vc)
+{
+    struct net_state *s = vc->opaque;
+
+    return goldfishNet_canReceive(&s->net);
+}
+
+static ssize_t goldfish_net_receive(VLANClientState *vc, const uint8_t *buf,
+                                    size_t size)
+{
+    struct net_state *s = vc->opaque;
+
+    return goldfishNet_receive(&s->net, buf, size);
+}
+
+static void goldfish_net_cleanup(VLANClientState *vc)
+{
+    struct net_state *s = vc->opaque;
+
+    timer_del(s->timer);
+}
+
+static uint32_t goldfish_net_read(void *opaque, hwaddr offset)
+{
+    struct net_state *s = opaque;
+
+    return goldfishNet_read(&s->net, offset);
+}
+
+static void goldfish_net_write(void *opaque, hwaddr offset, uint32_t value)
+{
+    struct net_state *s = opaque;
+
+    goldfishNet_write(&s->net, offset, value);
+}
+
+static CPUReadMemoryFunc *goldfish_net_readfn[] = {
+    goldfish_net_read,
+    goldfish_net_read,
+    goldfish_net_read
+};
+
+static CPUWriteMemoryFunc *goldfish_net_writefn[] = {
+    goldfish_net_write,
+    goldfish_net_write,
+    goldfish_net_write
+};
+
+void goldfish_net_init(NICInfo *nd, int id)
+{
+    struct net_state *s;
+    static int  instance_id = 0;
+
+    s = g_malloc0(sizeof(*s));
+    s->dev.name = "goldfish_net";
+    s->dev.id = id;
+    s->dev.size = 0x1000;
+    s->dev.irq_count = 1;
+
+    s->timer = timer_new(QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                         goldfish_net_timer_tick, s);
+    goldfishNet_init(&s->net, &goldfish_net_ops, s, nd->macaddr);
+
+    s->vc = qemu_new_vlan_client(nd->vlan, nd->model, nd->name,
+                                 goldfish_net_can_receive,
+                                 goldfish_net_receive, NULL,
+                                 goldfish_net_cleanup, s);
+    qemu_format_nic_info_str(s->vc, nd->macaddr);
+
+    goldfish_device_add(&s->dev, goldfish_net_readfn, goldfish_net_writefn, s);
+
+    register_savevm(NULL,
+                    "goldfish_net",
+                    instance_id++,
+                    GOLDFISH_NET_SAVE_VERSION,
+                    goldfish_net_save,
+                    goldfish_net_load,
+                    s);
+}
@@ -14,7 +14,6 @@
 #include "hw/android/goldfish/pipe.h"
 #include "hw/android/goldfish/device.h"
 #include "hw/android/goldfish/vmem.h"
-#include "exec/ram_addr.h"
 #include "qemu/timer.h"
 
 #define  DEBUG 0
@@ -969,6 +968,36 @@ struct PipeDevice {
     uint64_t  params_addr;
 };
 
+/* Maximum number of host buffers a guest buffer maps to. The guest driver
+ * never crosses a page boundary, but there is no harm in allowing it. */
+#define PIPE_MAX_BUFFERS  4
+
+/* Map the guest buffer of the current command, at |dev->address|, into
+ * |buffers|. |is_write| is 1 if the pipe writes to it. Return the number
+ * of buffers, or -1 if the buffer is not entirely in guest RAM. */
+static int
+pipeDevice_mapBuffer( PipeDevice* dev, CPUState* cpu, int is_write,
+                      VmemRange* ranges, GoldfishPipeBuffer* buffers )
+{
+    int count = PIPE_MAX_BUFFERS;
+    int n;
+
+    if (vmem_map(cpu, dev->address, dev->size, is_write, ranges, &count)
+            != (int)dev->size) {
+        vmem_unmap(ranges, count, 0);
+        return -1;
+    }
+    for (n = 0; n < count; n++) {
+        if (ranges[n].host == NULL) {
+            vmem_unmap(ranges, count, 0);
+            return -1;
+        }
+        buffers[n].data = ranges[n].host;
+        buffers[n].size = ranges[n].len;
+    }
+    return count;
+}
+
 static void
 pipeDevice_doCommand( PipeDevice* dev, uint32_t command )
 {
@@ -1016,18 +1045,17 @@ pipeDevice_doCommand( PipeDevice* dev, uint32_t command )
         break;
 
     case PIPE_CMD_READ_BUFFER: {
-        /* Translate virtual address into physical one, into emulator memory. */
-        GoldfishPipeBuffer  buffer;
-        target_ulong        address = dev->address;
-        target_ulong        page    = address & TARGET_PAGE_MASK;
-        hwaddr  phys;
-        phys = safe_get_phys_page_debug(ENV_GET_CPU(env), page);
-#ifdef TARGET_X86_64
-        phys = phys & TARGET_PTE_MASK;
-#endif
-        buffer.data = qemu_get_ram_ptr(phys) + (address - page);
-        buffer.size = dev->size;
-        dev->status = pipe->funcs->recvBuffers(pipe->opaque, &buffer, 1);
+        /* Translate virtual address into host ones, into emulator memory. */
+        VmemRange           ranges[PIPE_MAX_BUFFERS];
+        GoldfishPipeBuffer  buffers[PIPE_MAX_BUFFERS];
+        int                 count = pipeDevice_mapBuffer(dev, ENV_GET_CPU(env), 1,
+                                                         ranges, buffers);
+        if (count < 0) {
+            dev->status = PIPE_ERROR_INVAL;
+            break;
+        }
+        dev->status = pipe->funcs->recvBuffers(pipe->opaque, buffers, count);
+        vmem_unmap(ranges, count, 1);
         DD("%s: CMD_READ_BUFFER channel=0x%llx address=0x%16llx size=%d > status=%d",
            __FUNCTION__, (unsigned long long)dev->channel, (unsigned long long)dev->address,
            dev->size, dev->status);
@@ -1035,18 +1063,17 @@ pipeDevice_doCommand( PipeDevice* dev, uint32_t command )
     }
 
     case PIPE_CMD_WRITE_BUFFER: {
-        /* Translate virtual address into physical one, into emulator memory. */
-        GoldfishPipeBuffer  buffer;
-        target_ulong        address = dev->address;
-        target_ulong        page    = address & TARGET_PAGE_MASK;
-        hwaddr  phys;
-        phys = safe_get_phys_page_debug(ENV_GET_CPU(env), page);
-#ifdef TARGET_X86_64
-        phys = phys & TARGET_PTE_MASK;
-#endif
-        buffer.data = qemu_get_ram_ptr(phys) + (address - page);
-        buffer.size = dev->size;
-        dev->status = pipe->funcs->sendBuffers(pipe->opaque, &buffer, 1);
+        /* Translate virtual address into host ones, into emulator memory. */
+        VmemRange           ranges[PIPE_MAX_BUFFERS];
+        GoldfishPipeBuffer  buffers[PIPE_MAX_BUFFERS];
+        int                 count = pipeDevice_mapBuffer(dev, ENV_GET_CPU(env), 0,
+                                                         ranges, buffers);
+        if (count < 0) {
+            dev->status = PIPE_ERROR_INVAL;
+            break;
+        }
+        dev->status = pipe->funcs->sendBuffers(pipe->opaque, buffers, count);
+        vmem_unmap(ranges, count, 0);
         DD("%s: CMD_WRITE_BUFFER channel=0x%llx address=0x%16llx size=%d > status=%d",
            __FUNCTION__, (unsigned long long)dev->channel, (unsigned long long)dev->address,
            dev->size, dev->status);
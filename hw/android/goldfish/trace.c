@@ -10,13 +10,15 @@
 ** GNU General Public License for more details.
 */
 /*
- * Virtual hardware for bridging the FUSE kernel module
- * in the emulated OS and outside file system
+ * Virtual hardware through which the guest kernel reports process and
+ * thread events, see android/utils/guest_profiler.h
  */
 #include "migration/qemu-file.h"
 #include "hw/android/goldfish/trace.h"
 #include "hw/android/goldfish/vmem.h"
 #include "sysemu/sysemu.h"
+#include "qemu/timer.h"
+#include "android/utils/guest_profiler.h"
 
 /* Set to 1 to debug tracing */
 #define DEBUG   0
@@ -39,9 +41,10 @@
 // TODO(digit): Re-enable tracing some day?
 #define tracing 0
 
-extern void cpu_loop_exit(CPUArchState* env);
+/* Interval between two samples of the guest PC */
+#define TRACE_SAMPLE_INTERVAL_MS  2
 
-extern const char *trace_filename;
+extern void cpu_loop_exit(CPUArchState* env);
 
 /* for execve */
 static char exec_path[CLIENT_PAGE_SIZE];
@@ -59,6 +62,55 @@ static unsigned long unmap_start; // start address to unmap
 /* for context switch */
 //static unsigned long cs_pid;    // context switch PID
 
+static QEMUTimer* sample_timer;
+static int64_t    last_sample_us;
+
+/* Copy the NUL-terminated string at guest address 'ptr' into 'buf' */
+static void trace_read_string(target_ulong ptr, char *buf, int max)
+{
+    int len = 0;
+
+    while (len < max - 1) {
+        int chunk = TARGET_PAGE_SIZE - (ptr & ~TARGET_PAGE_MASK);
+        if (chunk > max - 1 - len)
+            chunk = max - 1 - len;
+        if (safe_memory_rw_debug(current_cpu, ptr, (uint8_t*)buf + len,
+                                 chunk, 0) < 0)
+            break;
+        if (memchr(buf + len, 0, chunk))
+            return;
+        len += chunk;
+        ptr += chunk;
+    }
+    buf[len] = 0;
+}
+
+/* Attribute the time elapsed since the previous sample to the current
+ * guest PC */
+static void trace_dev_sample(void *opaque)
+{
+    CPUState *cpu = first_cpu;
+    CPUArchState *env = cpu->env_ptr;
+    int64_t now = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    target_ulong pc, cs_base;
+    int flags;
+
+    if (vm_running) {
+        GuestProfilerMode mode;
+        if (cpu->halted)
+            mode = GUEST_PROFILER_IDLE;
+        else if (cpu_mmu_index(env) == MMU_USER_IDX)
+            mode = GUEST_PROFILER_USER;
+        else
+            mode = GUEST_PROFILER_KERNEL;
+        cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+        guestProfiler_sample(mode, pc, now - last_sample_us);
+    }
+    last_sample_us = now;
+    timer_mod(sample_timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + TRACE_SAMPLE_INTERVAL_MS);
+}
+
 /* I/O write */
 static void trace_dev_write(void *opaque, hwaddr offset, uint32_t value)
 {
@@ -69,29 +121,20 @@ static void trace_dev_write(void *opaque, hwaddr offset, uint32_t value)
     switch (offset >> 2) {
     case TRACE_DEV_REG_SWITCH:  // context switch, switch to pid
         DPID("QEMU.trace: context switch tid=%u\n", value);
-        if (trace_filename != NULL) {
-            D("QEMU.trace: kernel, context switch %u\n", value);
-        }
         tid = (unsigned) value;
+        guestProfiler_switchTo(tid);
         break;
     case TRACE_DEV_REG_TGID:    // save the tgid for the following fork/clone
         DPID("QEMU.trace: tgid=%u\n", value);
         tgid = value;
-        if (trace_filename != NULL) {
-            D("QEMU.trace: kernel, tgid %u\n", value);
-        }
         break;
     case TRACE_DEV_REG_FORK:    // fork, fork new pid
         DPID("QEMU.trace: fork (pid=%d tgid=%d value=%d)\n", pid, tgid, value);
-        if (trace_filename != NULL) {
-            D("QEMU.trace: kernel, fork %u\n", value);
-        }
+        guestProfiler_fork(value);
         break;
     case TRACE_DEV_REG_CLONE:    // fork, clone new pid (i.e. thread)
         DPID("QEMU.trace: clone (pid=%d tgid=%d value=%d)\n", pid, tgid, value);
-        if (trace_filename != NULL) {
-            D("QEMU.trace: kernel, clone %u\n", value);
-        }
+        guestProfiler_clone(tgid, value);
         break;
     case TRACE_DEV_REG_EXECVE_VMSTART:  // execve, vstart
         vstart = value;
@@ -103,23 +146,23 @@ static void trace_dev_write(void *opaque, hwaddr offset, uint32_t value)
         eoff = value;
         break;
     case TRACE_DEV_REG_EXECVE_EXEPATH:  // init exec, path of EXE
-        vstrcpy(value, exec_path, CLIENT_PAGE_SIZE);
-        if (trace_filename != NULL) {
-            D("QEMU.trace: kernel, init exec [%lx,%lx]@%lx [%s]\n",
-              vstart, vend, eoff, exec_path);
-        }
+        trace_read_string(value, exec_path, CLIENT_PAGE_SIZE);
+        D("QEMU.trace: kernel, init exec [%lx,%lx]@%lx [%s]\n",
+          vstart, vend, eoff, exec_path);
+        guestProfiler_map(pid, vstart, vend, eoff, exec_path);
         exec_path[0] = 0;
         break;
     case TRACE_DEV_REG_CMDLINE_LEN:     // execve, process cmdline length
         cmdlen = value;
         break;
     case TRACE_DEV_REG_CMDLINE:         // execve, process cmdline
+        if (cmdlen > CLIENT_PAGE_SIZE)
+            cmdlen = CLIENT_PAGE_SIZE;
         safe_memory_rw_debug(current_cpu, value, (uint8_t*)exec_arg, cmdlen, 0);
-        if (trace_filename != NULL) {
-            D("QEMU.trace: kernel, execve [%.*s]\n", cmdlen, exec_arg);
-        }
+        D("QEMU.trace: kernel, execve [%.*s]\n", cmdlen, exec_arg);
+        guestProfiler_exec(exec_arg, cmdlen);
 #if DEBUG || DEBUG_PID
-        if (trace_filename != NULL) {
+        {
             int i;
             for (i = 0; i < cmdlen; i ++)
                 if (i != cmdlen - 1 && exec_arg[i] == 0)
@@ -131,29 +174,24 @@ static void trace_dev_write(void *opaque, hwaddr offset, uint32_t value)
         break;
     case TRACE_DEV_REG_EXIT:            // exit, exit current process with exit code
         DPID("QEMU.trace: exit tid=%u\n", value);
-        if (trace_filename != NULL) {
-            D("QEMU.trace: kernel, exit %x\n", value);
-        }
+        guestProfiler_exit();
         break;
-    case TRACE_DEV_REG_NAME:            // record thread name
-        vstrcpy(value, exec_path, CLIENT_PAGE_SIZE);
+    case TRACE_DEV_REG_NAME: {          // record thread name
+        trace_read_string(value, exec_path, CLIENT_PAGE_SIZE);
         DPID("QEMU.trace: thread name=%s\n", exec_path);
 
         // Remove the trailing newline if it exists
         int len = strlen(exec_path);
-        if (exec_path[len - 1] == '\n') {
+        if (len > 0 && exec_path[len - 1] == '\n') {
             exec_path[len - 1] = 0;
         }
-        if (trace_filename != NULL) {
-            D("QEMU.trace: kernel, name %s\n", exec_path);
-        }
+        guestProfiler_nameThread(-1, -1, exec_path);
         break;
+    }
     case TRACE_DEV_REG_MMAP_EXEPATH:    // mmap, path of EXE, the others are same as execve
-        vstrcpy(value, exec_path, CLIENT_PAGE_SIZE);
+        trace_read_string(value, exec_path, CLIENT_PAGE_SIZE);
         DPID("QEMU.trace: mmap exe=%s\n", exec_path);
-        if (trace_filename != NULL) {
-            D("QEMU.trace: kernel, mmap [%lx,%lx]@%lx [%s]\n", vstart, vend, eoff, exec_path);
-        }
+        guestProfiler_map(-1, vstart, vend, eoff, exec_path);
         exec_path[0] = 0;
         break;
     case TRACE_DEV_REG_INIT_PID:        // init, name the pid that starts before device registered
@@ -161,11 +199,9 @@ static void trace_dev_write(void *opaque, hwaddr offset, uint32_t value)
         DPID("QEMU.trace: pid=%d\n", value);
         break;
     case TRACE_DEV_REG_INIT_NAME:       // init, the comm of the init pid
-        vstrcpy(value, exec_path, CLIENT_PAGE_SIZE);
+        trace_read_string(value, exec_path, CLIENT_PAGE_SIZE);
         DPID("QEMU.trace: tgid=%d pid=%d name=%s\n", tgid, pid, exec_path);
-        if (trace_filename != NULL) {
-            D("QEMU.trace: kernel, init name %u [%s]\n", pid, exec_path);
-        }
+        guestProfiler_nameThread(-1, pid, exec_path);
         exec_path[0] = 0;
         break;
 
@@ -173,20 +209,16 @@ static void trace_dev_write(void *opaque, hwaddr offset, uint32_t value)
         dsaddr = value;
         break;
     case TRACE_DEV_REG_DYN_SYM:         // add dynamic symbol
-        vstrcpy(value, exec_arg, CLIENT_PAGE_SIZE);
-        if (trace_filename != NULL) {
-            D("QEMU.trace: dynamic symbol %lx:%s\n", dsaddr, exec_arg);
-        }
+        trace_read_string(value, exec_arg, CLIENT_PAGE_SIZE);
+        D("QEMU.trace: dynamic symbol %lx:%s\n", dsaddr, exec_arg);
         exec_arg[0] = 0;
         break;
     case TRACE_DEV_REG_REMOVE_ADDR:         // remove dynamic symbol addr
-        if (trace_filename != NULL) {
-            D("QEMU.trace: dynamic symbol remove %lx\n", dsaddr);
-        }
+        D("QEMU.trace: dynamic symbol remove %lx\n", dsaddr);
         break;
 
     case TRACE_DEV_REG_PRINT_STR:       // print string
-        vstrcpy(value, exec_arg, CLIENT_PAGE_SIZE);
+        trace_read_string(value, exec_arg, CLIENT_PAGE_SIZE);
         printf("%s", exec_arg);
         exec_arg[0] = 0;
         break;
@@ -211,6 +243,7 @@ static void trace_dev_write(void *opaque, hwaddr offset, uint32_t value)
         unmap_start = value;
         break;
     case TRACE_DEV_REG_UNMAP_END:
+        guestProfiler_unmap(unmap_start, value);
         break;
 
     case TRACE_DEV_REG_METHOD_ENTRY:
@@ -219,11 +252,9 @@ static void trace_dev_write(void *opaque, hwaddr offset, uint32_t value)
     case TRACE_DEV_REG_NATIVE_ENTRY:
     case TRACE_DEV_REG_NATIVE_EXIT:
     case TRACE_DEV_REG_NATIVE_EXCEPTION:
-        if (trace_filename != NULL) {
-            if (tracing) {
-                int __attribute__((unused)) call_type = (offset - 4096) >> 2;
-                //trace_interpreted_method(value, call_type);
-            }
+        if (tracing) {
+            int __attribute__((unused)) call_type = (offset - 4096) >> 2;
+            //trace_interpreted_method(value, call_type);
         }
         break;
 
@@ -292,4 +323,11 @@ void trace_dev_init()
     goldfish_device_add(&s->dev, trace_dev_readfn, trace_dev_writefn, s);
 
     exec_path[0] = exec_arg[0] = '\0';
+
+    if (guestProfiler_isEnabled()) {
+        sample_timer = timer_new_ms(QEMU_CLOCK_REALTIME, trace_dev_sample, s);
+        last_sample_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+        timer_mod(sample_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                                TRACE_SAMPLE_INTERVAL_MS);
+    }
 }
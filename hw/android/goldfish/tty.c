@@ -14,6 +14,8 @@
 #include "hw/android/goldfish/device.h"
 #include "hw/android/goldfish/vmem.h"
 #include "hw/hw.h"
+#include "qemu/timer.h"
+#include "android/utils/ring_buffer.h"
 
 enum {
     TTY_PUT_CHAR       = 0x00,
@@ -30,50 +32,126 @@ enum {
     TTY_CMD_READ_BUFFER    = 3,
 };
 
+/* Size of the receive ring. The guest driver reads at most what
+ * TTY_BYTES_READY reports, in one go. */
+#define  TTY_RX_SIZE  4096
+
 struct tty_state {
     struct goldfish_device dev;
     CharDriverState *cs;
     uint64_t ptr;
     uint32_t ptr_len;
     uint32_t ready;
-    uint8_t data[128];
-    uint32_t data_count;
+    RingBuffer rx;
+    GoldfishTtyStats stats;
+    struct tty_state *next;
 };
 
-#define  GOLDFISH_TTY_SAVE_VERSION  2
+static struct tty_state *tty_states;
+
+#define  GOLDFISH_TTY_SAVE_VERSION  3
 
 static void  goldfish_tty_save(QEMUFile*  f, void*  opaque)
 {
     struct tty_state*  s = opaque;
+    uint8_t  data[TTY_RX_SIZE];
+    uint32_t count = ringBuffer_copy(&s->rx, data, sizeof(data));
 
     qemu_put_be64( f, s->ptr );
     qemu_put_be32( f, s->ptr_len );
     qemu_put_byte( f, s->ready );
-    qemu_put_byte( f, s->data_count );
-    qemu_put_buffer( f, s->data, s->data_count );
+    qemu_put_be32( f, count );
+    qemu_put_buffer( f, data, count );
 }
 
 static int  goldfish_tty_load(QEMUFile*  f, void*  opaque, int  version_id)
 {
     struct tty_state*  s = opaque;
+    uint8_t  data[TTY_RX_SIZE];
+    uint32_t count;
 
-    if ((version_id != GOLDFISH_TTY_SAVE_VERSION) && 
-        (version_id != (GOLDFISH_TTY_SAVE_VERSION - 1))) {
+    if (version_id < 1 || version_id > GOLDFISH_TTY_SAVE_VERSION) {
         return -1;
     }
-    if (version_id == (GOLDFISH_TTY_SAVE_VERSION - 1)) {
+    if (version_id == 1) {
         s->ptr    = (uint64_t)qemu_get_be32(f);
     } else {
         s->ptr    = qemu_get_be64(f);
     }
     s->ptr_len    = qemu_get_be32(f);
     s->ready      = qemu_get_byte(f);
-    s->data_count = qemu_get_byte(f);
-    qemu_get_buffer(f, s->data, s->data_count);
+    /* Versions 1 and 2 had a 128-byte linear buffer. */
+    if (version_id < 3) {
+        count = qemu_get_byte(f);
+    } else {
+        count = qemu_get_be32(f);
+    }
+    if (count > sizeof(data)) {
+        return -EINVAL;
+    }
+    qemu_get_buffer(f, data, count);
+    ringBuffer_consume(&s->rx, ringBuffer_count(&s->rx));
+    ringBuffer_write(&s->rx, data, count);
 
     return 0;
 }
 
+/* Send |len| bytes of guest memory at |addr| to the character backend. The
+ * guest pages are handed over in place, in as few calls as possible. */
+static void goldfish_tty_send(struct tty_state *s, target_ulong addr, int len)
+{
+    VmemRange ranges[VMEM_MAX_RANGES];
+
+    while (len > 0) {
+        int count = VMEM_MAX_RANGES;
+        int mapped = vmem_map(current_cpu, addr, len, 0, ranges, &count);
+        int n;
+
+        if (mapped < 0) {
+            break;
+        }
+        for (n = 0; n < count; n++) {
+            VmemRange *r = &ranges[n];
+            int offset, l;
+
+            if (r->host) {
+                qemu_chr_write(s->cs, r->host, r->len);
+                s->stats.tx_calls++;
+                continue;
+            }
+            for (offset = 0; offset < r->len; offset += l) {
+                uint8_t temp[256];
+                l = r->len - offset;
+                if (l > (int)sizeof(temp))
+                    l = sizeof(temp);
+                cpu_physical_memory_rw(r->phys + offset, temp, l, 0);
+                qemu_chr_write(s->cs, temp, l);
+                s->stats.tx_calls++;
+            }
+        }
+        vmem_unmap(ranges, count, 0);
+        s->stats.tx_bytes += mapped;
+        addr += mapped;
+        len -= mapped;
+    }
+}
+
+/* Copy |len| bytes from the receive ring to guest memory at |addr|. */
+static void goldfish_tty_recv(struct tty_state *s, target_ulong addr, int len)
+{
+    while (len > 0) {
+        const uint8_t *data;
+        int l = ringBuffer_peek(&s->rx, &data);
+        if (l > len)
+            l = len;
+        safe_memory_rw_debug(current_cpu, addr, (uint8_t*)data, l, 1);
+        ringBuffer_consume(&s->rx, l);
+        addr += l;
+        len -= l;
+    }
+    s->stats.rx_reads++;
+}
+
 static uint32_t goldfish_tty_read(void *opaque, hwaddr offset)
 {
     struct tty_state *s = (struct tty_state *)opaque;
@@ -82,7 +160,7 @@ static uint32_t goldfish_tty_read(void *opaque, hwaddr offset)
 
     switch (offset) {
         case TTY_BYTES_READY:
-            return s->data_count;
+            return ringBuffer_count(&s->rx);
     default:
         cpu_abort(cpu_single_env,
                   "goldfish_tty_read: Bad offset %" HWADDR_PRIx "\n",
@@ -100,15 +178,18 @@ static void goldfish_tty_write(void *opaque, hwaddr offset, uint32_t value)
     switch(offset) {
         case TTY_PUT_CHAR: {
             uint8_t ch = value;
-            if(s->cs)
+            if(s->cs) {
                 qemu_chr_write(s->cs, &ch, 1);
+                s->stats.tx_bytes++;
+                s->stats.tx_calls++;
+            }
         } break;
 
         case TTY_CMD:
             switch(value) {
                 case TTY_CMD_INT_DISABLE:
                     if(s->ready) {
-                        if(s->data_count > 0)
+                        if(ringBuffer_count(&s->rx) > 0)
                             goldfish_device_set_irq(&s->dev, 0, 0);
                         s->ready = 0;
                     }
@@ -116,7 +197,7 @@ static void goldfish_tty_write(void *opaque, hwaddr offset, uint32_t value)
 
                 case TTY_CMD_INT_ENABLE:
                     if(!s->ready) {
-                        if(s->data_count > 0)
+                        if(ringBuffer_count(&s->rx) > 0)
                             goldfish_device_set_irq(&s->dev, 0, 1);
                         s->ready = 1;
                     }
@@ -124,36 +205,17 @@ static void goldfish_tty_write(void *opaque, hwaddr offset, uint32_t value)
 
                 case TTY_CMD_WRITE_BUFFER:
                     if(s->cs) {
-                        int len;
-                        target_ulong  buf;
-
-                        buf = s->ptr;
-                        len = s->ptr_len;
-
-                        while (len) {
-                            char   temp[64];
-                            int    to_write = sizeof(temp);
-                            if (to_write > len)
-                                to_write = len;
-
-                            safe_memory_rw_debug(current_cpu, buf, (uint8_t*)temp, to_write, 0);
-                            qemu_chr_write(s->cs, (const uint8_t*)temp, to_write);
-                            buf += to_write;
-                            len -= to_write;
-                        }
+                        goldfish_tty_send(s, s->ptr, s->ptr_len);
                         //printf("goldfish_tty_write: got %d bytes from %llx\n", s->ptr_len, (unsigned long long)s->ptr);
                     }
                     break;
 
                 case TTY_CMD_READ_BUFFER:
-                    if(s->ptr_len > s->data_count)
-                        cpu_abort (cpu_single_env, "goldfish_tty_write: reading more data than available %d %d\n", s->ptr_len, s->data_count);
-                    safe_memory_rw_debug(current_cpu, s->ptr, s->data, s->ptr_len,1);
+                    if(s->ptr_len > ringBuffer_count(&s->rx))
+                        cpu_abort (cpu_single_env, "goldfish_tty_write: reading more data than available %d %d\n", s->ptr_len, ringBuffer_count(&s->rx));
+                    goldfish_tty_recv(s, s->ptr, s->ptr_len);
                     //printf("goldfish_tty_write: read %d bytes to %llx\n", s->ptr_len, (unsigned long long)s->ptr);
-                    if(s->data_count > s->ptr_len)
-                        memmove(s->data, s->data + s->ptr_len, s->data_count - s->ptr_len);
-                    s->data_count -= s->ptr_len;
-                    if(s->data_count == 0 && s->ready)
+                    if(ringBuffer_count(&s->rx) == 0 && s->ready)
                         goldfish_device_set_irq(&s->dev, 0, 0);
                     break;
 
@@ -185,16 +247,15 @@ static int tty_can_receive(void *opaque)
 {
     struct tty_state *s = opaque;
 
-    return (sizeof(s->data) - s->data_count);
+    return ringBuffer_space(&s->rx);
 }
 
 static void tty_receive(void *opaque, const uint8_t *buf, int size)
 {
     struct tty_state *s = opaque;
 
-    memcpy(s->data + s->data_count, buf, size);
-    s->data_count += size;
-    if(s->data_count > 0 && s->ready)
+    s->stats.rx_bytes += ringBuffer_write(&s->rx, buf, size);
+    if(ringBuffer_count(&s->rx) > 0 && s->ready)
         goldfish_device_set_irq(&s->dev, 0, 1);
 }
 
@@ -224,6 +285,9 @@ int goldfish_tty_add(CharDriverState *cs, int id, uint32_t base, int irq)
     s->dev.irq = irq;
     s->dev.irq_count = 1;
     s->cs = cs;
+    ringBuffer_init(&s->rx, TTY_RX_SIZE, TTY_RX_SIZE);
+    s->stats.id = id;
+    s->stats.start_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
     if(cs) {
         qemu_chr_add_handlers(cs, tty_can_receive, tty_receive, NULL, s);
@@ -233,6 +297,11 @@ int goldfish_tty_add(CharDriverState *cs, int id, uint32_t base, int irq)
     if(ret) {
         g_free(s);
     } else {
+        struct tty_state **pnext = &tty_states;
+        while (*pnext)
+            pnext = &(*pnext)->next;
+        *pnext = s;
+
         register_savevm(NULL,
                         "goldfish_tty",
                         instance_id++,
@@ -244,3 +313,16 @@ int goldfish_tty_add(CharDriverState *cs, int id, uint32_t base, int irq)
     return ret;
 }
 
+
+int goldfish_tty_get_stats(int index, GoldfishTtyStats *stats)
+{
+    struct tty_state *s = tty_states;
+
+    while (s && index-- > 0)
+        s = s->next;
+    if (!s)
+        return -1;
+    *stats = s->stats;
+    stats->rx_high_water = s->rx.high_water;
+    return 0;
+}
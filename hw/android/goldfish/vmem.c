@@ -11,6 +11,11 @@
 */
 #include "hw/hw.h"
 #include "hw/android/goldfish/vmem.h"
+#include "exec/cputlb.h"
+#include "exec/exec-all.h"
+#include "exec/hax.h"
+#include "exec/ram_addr.h"
+#include "android/utils/xlate_cache.h"
 #ifdef TARGET_I386
 #include "sysemu/kvm.h"
 #endif
@@ -29,23 +34,217 @@
 int safe_memory_rw_debug(CPUState *cpu, target_ulong addr, uint8_t *buf,
                          int len, int is_write)
 {
+    return vmem_copy(cpu, addr, buf, len, is_write);
+}
+
+hwaddr safe_get_phys_page_debug(CPUState *cpu, target_ulong addr)
+{
+    CPUArchState *env = cpu->env_ptr;
+
 #ifdef TARGET_I386
     if (kvm_enabled()) {
         kvm_get_sregs(cpu);
     }
 #endif
-    return cpu_memory_rw_debug(cpu, addr, buf, len, is_write);
+    return cpu_get_phys_page_debug(env, addr);
 }
 
-hwaddr safe_get_phys_page_debug(CPUState *cpu, target_ulong addr)
-{
-    CPUArchState *env = cpu->env_ptr;
+// The bits of a physical address returned by cpu_get_phys_page_debug().
+// On x86, the NX bit of the PTE is left in bit 63.
+#ifdef TARGET_X86_64
+#define VMEM_PHYS_MASK  TARGET_PTE_MASK
+#else
+#define VMEM_PHYS_MASK  (~0ULL)
+#endif
+
+// Translations of the pages that were not in the softmmu TLB. Only used
+// under TCG: with a hypervisor, the guest TLB flushes are not seen.
+static XlateCache vmem_cache;
 
+// Return true iff the softmmu TLB, and hence |vmem_cache|, can be used.
+static bool vmem_use_tlb(CPUState *cpu)
+{
 #ifdef TARGET_I386
     if (kvm_enabled()) {
         kvm_get_sregs(cpu);
+        return false;
     }
 #endif
-    return cpu_get_phys_page_debug(env, addr);
+    return !hax_enabled();
+}
+
+// Look for |page| in the TLB of each MMU mode. Return the host address of
+// the page if it is RAM that can be accessed directly, NULL otherwise.
+static uint8_t *vmem_tlb_lookup(CPUArchState *env, target_ulong page,
+                                int is_write)
+{
+    int mmu_idx;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBEntry *te =
+                &env->tlb_table[mmu_idx][tlb_index(env, mmu_idx, page)];
+        target_ulong tlb_addr = is_write ? te->addr_write : te->addr_read;
+
+        // Any flag, e.g. TLB_MMIO or TLB_NOTDIRTY, means a slow access.
+        if (tlb_addr == page) {
+            return (uint8_t *)(uintptr_t)(page + te->addend);
+        }
+    }
+    return NULL;
+}
+
+// Translate the guest virtual |page|. Set |*phys| to its physical address,
+// and |*host| to its host address if it is RAM, or NULL. Return 0 on
+// success, or -1 if the page is not mapped.
+static int vmem_translate(CPUState *cpu, target_ulong page, int is_write,
+                          bool use_tlb, hwaddr *phys, uint8_t **host)
+{
+    CPUArchState *env = cpu->env_ptr;
+    uint64_t ppage;
+    PhysPageDesc *p;
+
+    if (use_tlb) {
+        *host = vmem_tlb_lookup(env, page, is_write);
+        if (*host) {
+            // Not needed to access RAM.
+            *phys = -1;
+            return 0;
+        }
+        if (xlateCache_lookup(&vmem_cache, page >> TARGET_PAGE_BITS,
+                              &ppage, host)) {
+            *phys = (hwaddr)ppage << TARGET_PAGE_BITS;
+            return 0;
+        }
+    }
+
+    *phys = cpu_get_phys_page_debug(env, page);
+    if (*phys == -1) {
+        return -1;
+    }
+    ppage = xlateCache_physPage(*phys, VMEM_PHYS_MASK, TARGET_PAGE_BITS);
+    *phys = (hwaddr)ppage << TARGET_PAGE_BITS;
+    p = phys_page_find(ppage);
+    if (p && (p->phys_offset & ~TARGET_PAGE_MASK) == IO_MEM_RAM) {
+        *host = qemu_get_ram_ptr(p->phys_offset & TARGET_PAGE_MASK);
+    } else {
+        *host = NULL;
+    }
+    if (use_tlb) {
+        xlateCache_insert(&vmem_cache, page >> TARGET_PAGE_BITS, ppage,
+                          *host);
+    }
+    return 0;
+}
+
+int vmem_map(CPUState *cpu, target_ulong addr, int len, int is_write,
+             VmemRange *ranges, int *count)
+{
+    bool use_tlb = vmem_use_tlb(cpu);
+    int max_ranges = *count;
+    int n = -1;
+    int done = 0;
+
+    if (use_tlb) {
+        xlateCache_sync(&vmem_cache, cpu,
+                        tlb_flush_count + tlb_flush_page_count);
+    }
+
+    while (done < len) {
+        target_ulong page = addr & TARGET_PAGE_MASK;
+        int offset = addr - page;
+        int l = TARGET_PAGE_SIZE - offset;
+        hwaddr phys;
+        uint8_t *host;
+
+        if (l > len - done) {
+            l = len - done;
+        }
+        if (vmem_translate(cpu, page, is_write, use_tlb, &phys, &host) < 0) {
+            *count = 0;
+            return -1;
+        }
+        if (host) {
+            host += offset;
+        } else {
+            phys += offset;
+        }
+        if (n >= 0 && host && ranges[n].host + ranges[n].len == host) {
+            ranges[n].len += l;
+        } else {
+            if (n + 1 == max_ranges) {
+                break;
+            }
+            n++;
+            ranges[n].host = host;
+            ranges[n].phys = phys;
+            ranges[n].len = l;
+        }
+        addr += l;
+        done += l;
+    }
+    *count = n + 1;
+    return done;
 }
 
+void vmem_unmap(VmemRange *ranges, int count, int is_write)
+{
+    int n;
+
+    if (!is_write) {
+        return;
+    }
+    for (n = 0; n < count; n++) {
+        uint8_t *host = ranges[n].host;
+        int len = ranges[n].len;
+
+        if (!host) {
+            continue;
+        }
+        // One host page at a time: contiguous host pages may belong to
+        // different RAM blocks.
+        while (len > 0) {
+            int l = TARGET_PAGE_SIZE - ((uintptr_t)host & ~TARGET_PAGE_MASK);
+            if (l > len) {
+                l = len;
+            }
+            cpu_physical_memory_unmap(host, l, 1, l);
+            host += l;
+            len -= l;
+        }
+    }
+}
+
+int vmem_copy(CPUState *cpu, target_ulong addr, uint8_t *buf, int len,
+              int is_write)
+{
+    VmemRange ranges[VMEM_MAX_RANGES];
+
+    while (len > 0) {
+        int count = VMEM_MAX_RANGES;
+        int mapped = vmem_map(cpu, addr, len, is_write, ranges, &count);
+        int n;
+
+        if (mapped < 0) {
+            return -1;
+        }
+        for (n = 0; n < count; n++) {
+            VmemRange *r = &ranges[n];
+            if (r->host) {
+                if (is_write) {
+                    memcpy(r->host, buf, r->len);
+                } else {
+                    memcpy(buf, r->host, r->len);
+                }
+            } else if (is_write) {
+                cpu_physical_memory_write_rom(r->phys, buf, r->len);
+            } else {
+                cpu_physical_memory_rw(r->phys, buf, r->len, 0);
+            }
+            buf += r->len;
+        }
+        vmem_unmap(ranges, count, is_write);
+        addr += mapped;
+        len -= mapped;
+    }
+    return 0;
+}
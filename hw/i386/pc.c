@@ -1147,7 +1147,9 @@ static void pc_init1(ram_addr_t ram_size,
     for(i = 0; i < nb_nics; i++) {
         NICInfo *nd = &nd_table[i];
 
-        if (!pci_enabled || (nd->model && strcmp(nd->model, "ne2k_isa") == 0))
+        if (nd->model && strcmp(nd->model, "goldfish") == 0)
+            goldfish_net_init(nd, i);
+        else if (!pci_enabled || (nd->model && strcmp(nd->model, "ne2k_isa") == 0))
             pc_init_ne2k_isa(nd, i8259);
         else
             pci_nic_init(pci_bus, nd, -1, "ne2k_pci");
@@ -13,6 +13,7 @@
 #define _CHARPIPE_H
 
 #include "qemu-common.h"
+#include "android/utils/char_queue.h"
 
 /* open two connected character drivers that can be used to communicate by internal
  * QEMU components. For Android, this is used to connect an emulated serial port
@@ -30,4 +31,19 @@ extern CharDriverState*  qemu_chr_open_buffer( CharDriverState*  endpoint );
 /* must be called from the main event loop to poll all charpipes */
 extern void charpipe_poll( void );
 
+/* lower *timeout (in milliseconds) if charpipe_poll() has buffered data
+ * to send before then. must be called before the main loop blocks */
+extern void charpipe_update_timeout( int*  timeout );
+
+/* traffic counters of one charpipe half, i.e. of the data written to it,
+ * or of one charbuffer */
+typedef struct {
+    char            name[16];   /* e.g. "pipe2.a" or "buffer0" */
+    CharQueueStats  queue;
+} CharPipeStats;
+
+/* fill *stats for the index-th charpipe half or charbuffer, in creation
+ * order. return 0 on success, or -1 if there are less than index+1 */
+extern int  charpipe_get_stats( int  index, CharPipeStats*  stats );
+
 #endif /* _CHARPIPE_H */
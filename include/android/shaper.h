@@ -13,9 +13,11 @@
 #define _SLIRP_SHAPER_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 /* a NetShaper object is used to limit the throughput of data packets
- * at a fixed rate expressed in bits/seconds
+ * at a fixed rate expressed in bits/seconds, and optionally to add
+ * jitter and packet loss
  */
 typedef struct NetShaperRec_*  NetShaper;
 typedef void (*NetShaperSendFunc)( void*  data, size_t  size, void*  opaque);
@@ -31,6 +33,22 @@ void        netshaper_send_aux( NetShaper  shaper, void* data, size_t  size, voi
 
 int         netshaper_can_send( NetShaper  shaper );
 
+/* hold each packet for a random time up to 'jitter_ms', without reordering */
+void        netshaper_set_jitter( NetShaper  shaper, int  jitter_ms );
+
+/* drop 'percent' of the packets at random */
+void        netshaper_set_loss( NetShaper  shaper, double  percent );
+
+typedef struct {
+    uint64_t  packets;   /* packets sent */
+    uint64_t  bytes;
+    uint64_t  delayed;   /* packets that had to wait */
+    uint64_t  dropped;   /* packets dropped by the loss model */
+    uint32_t  queued;    /* packets waiting */
+} NetShaperStats;
+
+void        netshaper_get_stats( NetShaper  shaper, NetShaperStats*  stats );
+
 void        netshaper_destroy (NetShaper   shaper);
 
 /* a NetDelay object is used to simulate network connection latencies */
@@ -42,6 +60,15 @@ void       netdelay_send( NetDelay  delay, const void*  data, size_t  size );
 void       netdelay_send_aux( NetDelay  delay, const void*  data, size_t  size, void*  opaque );
 void       netdelay_destroy( NetDelay  delay );
 
+typedef struct {
+    uint32_t  sessions;  /* sessions being tracked */
+    uint32_t  pending;   /* sessions whose SYN is held */
+    uint64_t  delayed;   /* sessions that were delayed */
+    uint64_t  expired;   /* sessions forgotten after being idle */
+} NetDelayStats;
+
+void       netdelay_get_stats( NetDelay  delay, NetDelayStats*  stats );
+
 /** in vl.c */
 /* network traffic shaper and delayer */
 extern NetShaper   slirp_shaper_in;
@@ -18,8 +18,11 @@
 extern int  qemu_tcpdump_active;
 
 /* start a new packet capture, close the current one if any.
+ * |spec| is a file path, optionally followed by options for file
+ * rotation, ring mode and snaplen, see pcapWriter_parseSpec() in
+ * android/utils/pcap_writer.h, e.g. "net.pcap,ring=64,snaplen=128".
  * returns 0 on success, and -1 on failure (see errno then) */
-extern int  qemu_tcpdump_start( const char*  filepath );
+extern int  qemu_tcpdump_start( const char*  spec );
 
 /* stop the current packet capture, if any */
 extern void qemu_tcpdump_stop( void );
@@ -33,4 +36,15 @@ extern void qemu_tcpdump_packet( const void*  base, int  len );
  */
 extern void  qemu_tcpdump_stats( uint64_t  *pcount, uint64_t*  psize );
 
+typedef struct {
+    int       active;
+    uint64_t  packets;   /* packets queued for the capture file */
+    uint64_t  bytes;     /* their total size */
+    uint64_t  dropped;   /* packets dropped because the disk lagged */
+    int       error;     /* errno of the first write error, or 0 */
+} QemuTcpdumpStatus;
+
+/* returns the state of the current, or last, packet capture */
+extern void  qemu_tcpdump_get_status( QemuTcpdumpStatus*  status );
+
 #endif /* _QEMU_TCPDUMP_H */
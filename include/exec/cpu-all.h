@@ -462,6 +462,9 @@ extern ram_addr_t ram_size;
 /* RAM is pre-allocated and passed into qemu_ram_alloc_from_ptr */
 #define RAM_PREALLOC_MASK   (1 << 0)
 
+/* RAM is mapped copy-on-write from the RAM base file */
+#define RAM_BASE_MASK       (1 << 1)
+
 typedef struct RAMBlock {
     uint8_t *host;
     ram_addr_t offset;
@@ -492,6 +495,18 @@ extern RAMList ram_list;
 extern const char *mem_path;
 extern int mem_prealloc;
 
+/* RAM base file shared between instances, see android/utils/shared_ram.h */
+extern const char *ram_base_path;
+
+struct SharedRamStats;
+
+/* Return true iff some RAM blocks are mapped from ram_base_path. */
+bool qemu_ram_base_used(void);
+/* Write the current content of all RAM blocks to a RAM base file. */
+int qemu_ram_save_base(const char *path);
+/* Count the shared and private host pages of all RAM blocks. */
+int qemu_ram_get_sharing_stats(struct SharedRamStats *stats);
+
 /* physical memory access */
 
 /* Flags stored in the low bits of the TLB virtual address.  These are
@@ -82,6 +82,11 @@ static inline void cpu_register_physical_memory(hwaddr start_addr,
 
 ram_addr_t cpu_get_physical_page_desc(hwaddr addr);
 
+typedef void (RAMBlockIterFunc)(void *host_addr,
+    ram_addr_t offset, ram_addr_t length, void *opaque);
+
+void qemu_ram_foreach_block(RAMBlockIterFunc func, void *opaque);
+
 int cpu_register_io_memory(CPUReadMemoryFunc * const *mem_read,
                            CPUWriteMemoryFunc * const *mem_write,
                            void *opaque);
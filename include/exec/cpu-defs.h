@@ -74,8 +74,16 @@ typedef uint64_t target_ulong;
 #define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
 
 #if !defined(CONFIG_USER_ONLY)
-#define CPU_TLB_BITS 8
-#define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
+/* The TLB of each MMU mode is a direct-mapped table whose size is
+   adjusted at runtime between 1 << CPU_TLB_DYN_MIN_BITS and
+   1 << CPU_TLB_DYN_MAX_BITS entries, see tlb_mmu_resize() in cputlb.c.  */
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+#define CPU_TLB_DYN_MAX_BITS 12
+
+/* Number of entries of the fully associative victim TLB of each MMU
+   mode, which holds the entries most recently evicted from the table.  */
+#define CPU_VTLB_SIZE 8
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -105,16 +113,40 @@ typedef struct CPUTLBEntry {
 
 QEMU_BUILD_BUG_ON(sizeof(CPUTLBEntry) != (1 << CPU_TLB_ENTRY_BITS));
 
+/* Bookkeeping used to resize the TLB of a given MMU mode.  */
+typedef struct CPUTLBDesc {
+    /* Start time (in ns) of the current resize window, and the largest
+       number of entries that were in use at a flush during it.  */
+    int64_t window_begin_ns;
+    size_t window_max_entries;
+    /* Number of entries filled, and number of valid entries replaced
+       with a different page, since the last flush.  */
+    size_t n_used_entries;
+    size_t n_evictions;
+    /* Next victim TLB slot to replace.  */
+    unsigned int vindex;
+} CPUTLBDesc;
+
 #define CPU_COMMON_TLB \
-    /* The meaning of the MMU modes is defined in the target code. */   \
-    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
-    hwaddr iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                           \
     target_ulong tlb_flush_addr;                                        \
     target_ulong tlb_flush_mask;
 
+/* The tables are allocated by tlb_init() and must survive CPU reset.
+   tlb_mask is (number of entries - 1) << CPU_TLB_ENTRY_BITS, as used by
+   the inline TLB lookup of the TCG backends. */
+#define CPU_COMMON_TLB_TABLES \
+    /* The meaning of the MMU modes is defined in the target code. */   \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
+    CPUTLBEntry *tlb_table[NB_MMU_MODES];                               \
+    hwaddr *iotlb[NB_MMU_MODES];                                        \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    hwaddr iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                        \
+    CPUTLBDesc tlb_d[NB_MMU_MODES];
+
 #else
 
 #define CPU_COMMON_TLB
+#define CPU_COMMON_TLB_TABLES
 
 #endif
 
@@ -186,5 +218,6 @@ typedef struct CPUWatchpoint {
     /* user data */                                                     \
     void *opaque;                                                       \
                                                                         \
+    CPU_COMMON_TLB_TABLES                                               \
 
 #endif
@@ -100,6 +100,7 @@ void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t end,
                               int is_cpu_write_access);
 #if !defined(CONFIG_USER_ONLY)
 /* cputlb.c */
+void tlb_init(CPUArchState *env);
 void tlb_flush_page(CPUArchState *env, target_ulong addr);
 void tlb_flush(CPUArchState *env, int flush_global);
 void tlb_set_page(CPUArchState *env, target_ulong vaddr,
@@ -199,6 +200,11 @@ struct TBContext {
     /* statistics */
     int tb_flush_count;
     int tb_phys_invalidate_count;
+    /* returns from translated code to the cpu_exec() loop, and TB lookups
+       done from translated code for indirect branches */
+    uint64_t tb_exit_count;
+    uint64_t tb_lookup_hit_count;
+    uint64_t tb_lookup_miss_count;
 
     int tb_invalidated_flag;
 };
@@ -360,6 +366,21 @@ extern void *io_mem_opaque[IO_MEM_NB_ENTRIES];
 
 void tlb_fill(CPUArchState *env1, target_ulong addr, int is_write, int mmu_idx,
               uintptr_t retaddr);
+bool victim_tlb_hit(CPUArchState *env, int mmu_idx, int index,
+                    size_t elt_ofs, target_ulong page);
+
+/* Return the index of the entry for 'addr' in the TLB of 'mmu_idx'.  */
+static inline int tlb_index(CPUArchState *env, int mmu_idx, target_ulong addr)
+{
+    uintptr_t size_mask = env->tlb_mask[mmu_idx] >> CPU_TLB_ENTRY_BITS;
+    return (addr >> TARGET_PAGE_BITS) & size_mask;
+}
+
+/* Return the number of entries in the TLB of 'mmu_idx'.  */
+static inline size_t tlb_n_entries(CPUArchState *env, int mmu_idx)
+{
+    return (env->tlb_mask[mmu_idx] >> CPU_TLB_ENTRY_BITS) + 1;
+}
 
 uint8_t helper_ldb_cmmu(CPUArchState *env, target_ulong addr, int mmu_idx);
 uint16_t helper_ldw_cmmu(CPUArchState *env, target_ulong addr, int mmu_idx);
@@ -402,6 +423,8 @@ void cpu_set_debug_excp_handler(CPUDebugExcpHandler *handler);
 
 /* vl.c */
 extern int singlestep;
+extern int tb_superblocks;
+extern int tb_no_goto_ptr;
 
 /* cpu-exec.c */
 extern volatile sig_atomic_t exit_request;
@@ -44,6 +44,25 @@ int goldfish_device_bus_init(uint32_t base, uint32_t irq);
 qemu_irq *goldfish_interrupt_init(uint32_t base, qemu_irq parent_irq, qemu_irq parent_fiq);
 void goldfish_timer_and_rtc_init(uint32_t timerbase, int timerirq);
 int goldfish_tty_add(CharDriverState *cs, int id, uint32_t base, int irq);
+
+// Traffic counters of a TTY, from the guest's point of view: tx is what
+// the guest wrote to the character backend, rx what it read from it.
+typedef struct {
+    int       id;
+    int64_t   start_ms;       // QEMU_CLOCK_REALTIME when the TTY was added.
+    uint64_t  tx_bytes;
+    uint64_t  tx_calls;       // Number of writes to the character backend.
+    uint64_t  rx_bytes;
+    uint64_t  rx_reads;       // Number of TTY_CMD_READ_BUFFER commands.
+    uint32_t  rx_high_water;  // Largest number of bytes waiting for the guest.
+} GoldfishTtyStats;
+
+// Copy the counters of the |index|-th TTY, in order of creation, to |stats|.
+// Return 0 on success, or -1 if there is no such TTY.
+int goldfish_tty_get_stats(int index, GoldfishTtyStats *stats);
+// Add a goldfish paravirtual network device for |nd|, see
+// android/emulation/goldfish_net.h. Selected with -net nic,model=goldfish.
+void goldfish_net_init(NICInfo *nd, int id);
 void goldfish_fb_init(int id);
 void goldfish_audio_init(uint32_t base, int id, const char* input_source);
 void goldfish_battery_init(int has_battery);
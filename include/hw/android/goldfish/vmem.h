@@ -23,5 +23,38 @@ int safe_memory_rw_debug(CPUState *env, target_ulong addr, uint8_t *buf,
 
 hwaddr safe_get_phys_page_debug(CPUState *env, target_ulong addr);
 
+// A range of guest memory returned by vmem_map(). If the guest pages are
+// RAM, |host| points to them, otherwise it is NULL and the range must be
+// accessed through cpu_physical_memory_rw() at |phys|.
+typedef struct {
+    uint8_t  *host;
+    hwaddr    phys;
+    int       len;
+} VmemRange;
+
+// Maximum number of ranges that vmem_copy() maps at once.
+#define VMEM_MAX_RANGES  16
+
+// Translate |len| bytes of guest virtual memory at |addr| into at most
+// |*count| ranges, merging the pages that are contiguous in host memory.
+// |is_write| is 1 if the caller will write to guest memory. On return,
+// |*count| is the number of ranges filled. Return the number of bytes
+// mapped, which is less than |len| if the ranges ran out, or -1 if a page
+// is not mapped in the guest.
+//
+// Under TCG, the translations come from the softmmu TLB when the guest
+// touched the pages recently, or from a small cache that is dropped on each
+// TLB flush. The ranges are only valid until the guest runs again.
+int vmem_map(CPUState *cpu, target_ulong addr, int len, int is_write,
+             VmemRange *ranges, int *count);
+
+// Release ranges returned by vmem_map(). If |is_write| is 1, mark the RAM
+// pages as dirty and invalidate the translated code they contain.
+void vmem_unmap(VmemRange *ranges, int count, int is_write);
+
+// Like cpu_memory_rw_debug(), but through vmem_map().
+int vmem_copy(CPUState *cpu, target_ulong addr, uint8_t *buf, int len,
+              int is_write);
+
 
 #endif  /* GOLDFISH_VMEM_H */
@@ -2,6 +2,7 @@
 #define QEMU_NET_H
 
 #include "qemu-common.h"
+#include "android/utils/packet_pool.h"
 
 /* VLANs support */
 
@@ -27,6 +28,12 @@ struct VLANClientState {
     char *model;
     char *name;
     char info_str[256];
+    /* Packets sent by this client that wait in the VLAN send queue. */
+    unsigned int queue_len;
+    unsigned int queue_max;
+    uint64_t queued;
+    /* Packets refused by all receivers, or by a full send queue. */
+    uint64_t dropped;
 };
 
 typedef struct VLANPacket VLANPacket;
@@ -47,7 +54,16 @@ struct VLANState {
     struct VLANState *next;
     unsigned int nb_guest_devs, nb_host_devs;
     VLANPacket *send_queue;
+    VLANPacket **send_queue_tail;
     int delivering;
+    /* While qemu_flush_queued_packets() runs: the rest of its batch, the
+     * packet being delivered, and the delivered packets waiting for their
+     * sent_cb. */
+    VLANPacket *batch;
+    VLANPacket *current;
+    VLANPacket *sent;
+    VLANPacket **sent_tail;
+    PacketPool packet_pool;
 };
 
 VLANState *qemu_find_vlan(int id);
@@ -70,6 +86,21 @@ void qemu_send_packet(VLANClientState *vc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_async(VLANClientState *vc, const uint8_t *buf,
                                int size, NetPacketSent *sent_cb);
 void qemu_flush_queued_packets(VLANClientState *vc);
+
+typedef struct {
+    int vlan_id;
+    char name[32];
+    unsigned int queue_len;
+    unsigned int queue_max;
+    uint64_t queued;
+    uint64_t dropped;
+} VLANClientStats;
+
+/* Fill |stats| for the |index|-th client, counting through all VLANs.
+ * Return -1 if there is no such client. */
+int qemu_get_vlan_client_stats(int index, VLANClientStats *stats);
+/* Same for the packet pool of the |index|-th VLAN. */
+int qemu_get_vlan_pool_stats(int index, int *vlan_id, PacketPoolStats *stats);
 void qemu_format_nic_info_str(VLANClientState *vc, uint8_t macaddr[6]);
 void qemu_check_nic_model(NICInfo *nd, const char *model);
 void qemu_check_nic_model_list(NICInfo *nd, const char * const *models,
@@ -40,6 +40,8 @@ static inline bool qemu_log_enabled(void)
 #define CPU_LOG_RESET      (1 << 9)
 #define LOG_UNIMP          (1 << 10)
 #define LOG_GUEST_ERROR    (1 << 11)
+/* Record the messages in binary trace rings, see qemu-log.c */
+#define LOG_TRACE_RING     (1 << 13)
 
 /* Returns true if a bit is set in the current loglevel mask
  */
@@ -56,13 +58,7 @@ void GCC_FMT_ATTR(1, 2) qemu_log(const char *fmt, ...);
 
 /* vfprintf-like logging function
  */
-static inline void GCC_FMT_ATTR(1, 0)
-qemu_log_vprintf(const char *fmt, va_list va)
-{
-    if (qemu_logfile) {
-        vfprintf(qemu_logfile, fmt, va);
-    }
-}
+void GCC_FMT_ATTR(1, 0) qemu_log_vprintf(const char *fmt, va_list va);
 
 /* log only if a bit is set on the current loglevel mask
  */
@@ -177,6 +173,11 @@ static inline void qemu_set_log(int log_flags)
 }
 
 void qemu_set_log_filename(const char *filename);
+
+/* Returns the file where the trace rings are dumped, or NULL if
+ * LOG_TRACE_RING was never enabled.
+ */
+const char *qemu_log_ring_path(void);
 int qemu_str_to_log_mask(const char *str);
 
 /* Print a usage message listing all the valid logging categories
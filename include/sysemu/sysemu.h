@@ -19,6 +19,7 @@
 extern const char *bios_name;
 
 extern const char* savevm_on_exit;
+extern int savevm_on_exit_background;
 extern int no_shutdown;
 extern int vm_running;
 extern int vm_can_run(void);
@@ -52,6 +53,16 @@ int init_timer_alarm(void);
 int qemu_timer_alarm_pending(void);
 void quit_timers(void);
 
+/* The main loop is idle while all vCPUs are halted, or the VM is stopped.
+ * Periodic device timers that have nothing to do should not re-arm
+ * themselves while qemu_is_idle() returns true, and use an idle handler to
+ * restart when the main loop leaves idle mode. */
+typedef void QEMUIdleHandler(void *opaque, int idle);
+void qemu_add_idle_handler(QEMUIdleHandler *cb, void *opaque);
+int qemu_is_idle(void);
+/* Delay timer deadlines by up to |slack_ms| while idle, to coalesce them. */
+void configure_timer_slack(int slack_ms);
+
 int64_t qemu_icount;
 int64_t qemu_icount_bias;
 int icount_time_shift;
@@ -77,10 +88,34 @@ void qemu_system_powerdown(void);
 void qemu_system_reset(void);
 
 void do_savevm(Monitor *mon, const char *name);
-void do_loadvm(Monitor *mon, const char *name);
+int do_loadvm(Monitor *mon, const char *name);
 void do_delvm(Monitor *mon, const char *name);
 void do_info_snapshots(Monitor *mon, Monitor* err);
 
+/* Background snapshots: the VM is stopped just long enough to fork(), and
+ * the child process writes the snapshot from its copy-on-write image of
+ * the guest RAM and device state. If |exit_after| is true, the emulator
+ * is about to exit and the child outlives it. Return 0 if the child was
+ * started, or -1 on failure, e.g. on Windows, after printing to |mon|. */
+int do_savevm_background(Monitor *mon, const char *name, bool exit_after);
+void do_info_savevm_background(Monitor *mon);
+/* Print a message to |mon| and return 1 if a background save is running. */
+int savevm_background_busy(Monitor *mon);
+/* Block until the running background save, if any, completes. */
+void savevm_background_wait(void);
+
+/* Devices whose state lives outside of the snapshot's block devices, such
+ * as the NAND images, register here to be notified of background saves.
+ * |prepare| is called with the VM stopped, right before fork(), and must
+ * return the number of bytes it will write, for progress reporting. When
+ * |guest_resumes| is true, the device keeps running in the parent while the
+ * child saves it, and must keep the data the child needs. |finish| is
+ * called in the parent once the child exited. */
+typedef int64_t BackgroundSavePrepare(void *opaque, bool guest_resumes);
+typedef void BackgroundSaveFinish(void *opaque);
+void register_background_save(BackgroundSavePrepare *prepare,
+                              BackgroundSaveFinish *finish, void *opaque);
+
 void qemu_announce_self(void);
 
 void main_loop_wait(int timeout);
@@ -429,17 +429,23 @@ typedef void (*vga_hw_update_ptr)(void *);
 typedef void (*vga_hw_invalidate_ptr)(void *);
 typedef void (*vga_hw_screen_dump_ptr)(void *, const char *);
 typedef void (*vga_hw_text_update_ptr)(void *, console_ch_t *);
+typedef int (*vga_hw_is_idle_ptr)(void *);
 
 DisplayState *graphic_console_init(vga_hw_update_ptr update,
                                    vga_hw_invalidate_ptr invalidate,
                                    vga_hw_screen_dump_ptr screen_dump,
                                    vga_hw_text_update_ptr text_update,
                                    void *opaque);
+/* |is_idle| returns 1 when a display refresh has nothing to do as long as
+ * the guest doesn't run, e.g. no VSYNC interrupt is expected. */
+void graphic_console_set_idle_check(DisplayState *ds,
+                                    vga_hw_is_idle_ptr is_idle);
 
 void vga_hw_update(void);
 void vga_hw_invalidate(void);
 void vga_hw_screen_dump(const char *filename);
 void vga_hw_text_update(console_ch_t *chardata);
+int vga_hw_is_idle(void);
 
 int is_graphic_console(void);
 int is_fixedsize_console(void);
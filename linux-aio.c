@@ -0,0 +1,347 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include <pthread.h>
+
+#include "qemu-common.h"
+#include "qemu/queue.h"
+#include "block/aio.h"
+#include "block/block_int.h"
+#include "block/raw-posix-aio.h"
+#include "exec/cpu-common.h"
+#include "android/utils/aio_ring.h"
+
+/* Native asynchronous I/O for the raw-posix driver, with aio=native.
+ *
+ * All the images share one AioRing (see android/utils/aio_ring.h), which
+ * uses io_uring, or Linux AIO on kernels without it. The requests made
+ * during a main loop iteration are only queued, and a bottom half submits
+ * them all with a single system call. Completions are signaled on an
+ * eventfd, handled like the pipe of posix-aio-compat.c.
+ *
+ * The guest RAM is registered with the ring when the first requests are
+ * submitted, so that io_uring doesn't pin its pages for each request.
+ * That usually needs a RLIMIT_MEMLOCK as large as the RAM, and is simply
+ * skipped otherwise. Loading a snapshot can replace the pages of the RAM,
+ * so they are unregistered meanwhile, see laio_unregister_ram().
+ *
+ * A forked child, such as the background snapshot writer of savevm.c,
+ * shares the io_uring rings and the eventfd with the parent, and has no
+ * Linux AIO context. It doesn't use the ring at all: laio_submit() fails
+ * and raw-posix uses the thread pool instead.
+ */
+
+/* Requests in flight for all the images. Above that, raw-posix uses the
+ * thread pool. */
+#define MAX_EVENTS 128
+
+struct qemu_laio_state;
+
+struct qemu_laiocb {
+    BlockDriverAIOCB common;
+    struct qemu_laio_state *ctx;
+    QEMUIOVector *qiov;
+    int64_t nbytes;
+    int type;
+    int64_t ret;
+    int cancelled;
+    int async_context_id;
+    QLIST_ENTRY(qemu_laiocb) node;
+};
+
+struct qemu_laio_state {
+    AioRing *ring;
+    QEMUBH *submit_bh;
+    int ram_registered;
+    int ram_loading;        /* don't register the RAM, it's being loaded */
+    int forked;             /* in a child process, don't use the ring */
+    /* completed requests of another async context */
+    QLIST_HEAD(, qemu_laiocb) completed_reqs;
+};
+
+static struct qemu_laio_state *laio_state;
+
+static void qemu_laio_process_completion(struct qemu_laiocb *laiocb)
+{
+    int64_t ret = laiocb->ret;
+
+    if (ret == laiocb->nbytes) {
+        ret = 0;
+    } else if (ret >= 0) {
+        /* Short reads mean EOF, pad with zeros. */
+        if (laiocb->type == QEMU_AIO_READ) {
+            qemu_iovec_memset(laiocb->qiov, ret, 0, laiocb->nbytes - ret);
+            ret = 0;
+        } else {
+            ret = -ENOSPC;
+        }
+    }
+    laiocb->common.cb(laiocb->common.opaque, ret);
+    qemu_aio_release(laiocb);
+}
+
+/* called by the ring for each finished request */
+static void qemu_laio_done(void *opaque, int64_t ret)
+{
+    struct qemu_laiocb *laiocb = opaque;
+
+    laiocb->ret = ret;
+    if (laiocb->cancelled) {
+        qemu_aio_release(laiocb);
+    } else if (laiocb->async_context_id != get_async_context_id()) {
+        QLIST_INSERT_HEAD(&laiocb->ctx->completed_reqs, laiocb, node);
+    } else {
+        qemu_laio_process_completion(laiocb);
+    }
+}
+
+static void qemu_laio_submit(struct qemu_laio_state *s)
+{
+    int ret = aioRing_submit(s->ring);
+
+    /* on other errors, the requests are failed by the next reap */
+    if ((ret == -EAGAIN || ret == -EBUSY || ret == -EINTR) &&
+        !aioRing_inFlight(s->ring)) {
+        /* nothing will complete to submit them, so try again later */
+        qemu_bh_schedule(s->submit_bh);
+    }
+}
+
+static void qemu_laio_completion_cb(void *opaque)
+{
+    struct qemu_laio_state *s = opaque;
+
+    aioRing_reap(s->ring, false);
+    if (aioRing_queued(s->ring)) {
+        qemu_laio_submit(s);
+    }
+}
+
+static int qemu_laio_flush_cb(void *opaque)
+{
+    struct qemu_laio_state *s = opaque;
+
+    /* qemu_aio_wait() only polls the eventfd if this is not zero */
+    if (aioRing_queued(s->ring)) {
+        qemu_laio_submit(s);
+    }
+    return aioRing_inFlight(s->ring) > 0 || aioRing_queued(s->ring) > 0;
+}
+
+static int qemu_laio_process_queue(void *opaque)
+{
+    struct qemu_laio_state *s = opaque;
+    struct qemu_laiocb *laiocb, *next;
+    int ret = 0;
+
+    QLIST_FOREACH_SAFE(laiocb, &s->completed_reqs, node, next) {
+        if (laiocb->async_context_id == get_async_context_id()) {
+            QLIST_REMOVE(laiocb, node);
+            qemu_laio_process_completion(laiocb);
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+typedef struct {
+    struct iovec *regions;
+    int count;
+} LaioRamRegions;
+
+static void qemu_laio_add_ram_block(void *host_addr, ram_addr_t offset,
+                                    ram_addr_t length, void *opaque)
+{
+    LaioRamRegions *ram = opaque;
+
+    ram->regions = g_renew(struct iovec, ram->regions, ram->count + 1);
+    ram->regions[ram->count].iov_base = host_addr;
+    ram->regions[ram->count].iov_len = length;
+    ram->count++;
+}
+
+static void qemu_laio_register_ram(struct qemu_laio_state *s)
+{
+    LaioRamRegions ram = { NULL, 0 };
+
+    qemu_ram_foreach_block(qemu_laio_add_ram_block, &ram);
+    if (ram.count == 0) {
+        /* images are opened before the machine allocates its RAM */
+        return;
+    }
+    s->ram_registered = 1;
+    /* requests outside of the registered buffers work the same */
+    aioRing_registerBuffers(s->ring, ram.regions, ram.count);
+    g_free(ram.regions);
+}
+
+/* submits the requests queued during this main loop iteration */
+static void qemu_laio_submit_bh(void *opaque)
+{
+    struct qemu_laio_state *s = opaque;
+
+    if (s->forked) {
+        /* the parent submits them */
+        return;
+    }
+    if (!s->ram_registered && !s->ram_loading &&
+        aioRing_kind(s->ring) == AIO_RING_IO_URING) {
+        qemu_laio_register_ram(s);
+    }
+    qemu_laio_submit(s);
+}
+
+void laio_unregister_ram(void)
+{
+    struct qemu_laio_state *s = laio_state;
+
+    if (!s) {
+        return;
+    }
+    s->ram_loading = 1;
+    if (s->ram_registered) {
+        /* the caller flushed the requests, none uses the buffers */
+        aioRing_registerBuffers(s->ring, NULL, 0);
+        s->ram_registered = 0;
+    }
+}
+
+void laio_register_ram(void)
+{
+    if (laio_state) {
+        /* with the next requests */
+        laio_state->ram_loading = 0;
+    }
+}
+
+/* The kernel copies the pinned pages in fork() instead of sharing them,
+ * which would copy the whole RAM for the background snapshot. */
+static void laio_prepare_fork(void)
+{
+    struct qemu_laio_state *s = laio_state;
+
+    if (s->ram_registered) {
+        /* registered again with the next requests */
+        aioRing_registerBuffers(s->ring, NULL, 0);
+        s->ram_registered = 0;
+    }
+}
+
+static void laio_child_after_fork(void)
+{
+    struct qemu_laio_state *s = laio_state;
+
+    s->forked = 1;
+    /* the completions are the parent's */
+    qemu_aio_set_fd_handler(aioRing_eventFd(s->ring), NULL, NULL, NULL, NULL,
+                            NULL);
+}
+
+static void laio_cancel(BlockDriverAIOCB *blockacb)
+{
+    struct qemu_laiocb *laiocb = (struct qemu_laiocb *)blockacb;
+    struct qemu_laio_state *s = laiocb->ctx;
+
+    if (laiocb->ret != -EINPROGRESS) {
+        /* completed, but not reported to its async context yet */
+        QLIST_REMOVE(laiocb, node);
+        qemu_aio_release(laiocb);
+        return;
+    }
+
+    /* neither interface can reliably cancel a request, wait for it */
+    laiocb->cancelled = 1;
+    aioRing_submit(s->ring);
+    while (laiocb->ret == -EINPROGRESS && aioRing_inFlight(s->ring)) {
+        aioRing_reap(s->ring, true);
+    }
+}
+
+static AIOPool laio_pool = {
+    .aiocb_size         = sizeof(struct qemu_laiocb),
+    .cancel             = laio_cancel,
+};
+
+BlockDriverAIOCB *laio_submit(BlockDriverState *bs, void *aio_ctx, int fd,
+        int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
+        BlockDriverCompletionFunc *cb, void *opaque, int type)
+{
+    struct qemu_laio_state *s = aio_ctx;
+    struct qemu_laiocb *laiocb;
+    AioRingOp op;
+
+    if (s->forked) {
+        return NULL;
+    }
+    switch (type) {
+    case QEMU_AIO_READ:
+        op = AIO_RING_READ;
+        break;
+    case QEMU_AIO_WRITE:
+        op = AIO_RING_WRITE;
+        break;
+    default:
+        return NULL;
+    }
+    if (qiov->niov > IOV_MAX) {
+        return NULL;
+    }
+
+    laiocb = qemu_aio_get(&laio_pool, bs, cb, opaque);
+    if (!laiocb) {
+        return NULL;
+    }
+    laiocb->ctx = s;
+    laiocb->qiov = qiov;
+    laiocb->nbytes = nb_sectors * 512;
+    laiocb->type = type;
+    laiocb->ret = -EINPROGRESS;
+    laiocb->cancelled = 0;
+    laiocb->async_context_id = get_async_context_id();
+
+    if (!aioRing_queue(s->ring, op, fd, sector_num * 512, qiov->iov,
+                       qiov->niov, qemu_laio_done, laiocb)) {
+        /* the ring is full, the caller falls back to the thread pool */
+        qemu_aio_release(laiocb);
+        return NULL;
+    }
+    qemu_bh_schedule(s->submit_bh);
+    return &laiocb->common;
+}
+
+void *laio_init(int buffered)
+{
+    struct qemu_laio_state *s = laio_state;
+
+    if (!s) {
+        AioRing *ring = aioRing_new(MAX_EVENTS, AIO_RING_ANY);
+
+        if (!ring) {
+            return NULL;
+        }
+        s = g_malloc0(sizeof(*s));
+        s->ring = ring;
+        s->submit_bh = qemu_bh_new(qemu_laio_submit_bh, s);
+        QLIST_INIT(&s->completed_reqs);
+        qemu_aio_set_fd_handler(aioRing_eventFd(ring),
+                                qemu_laio_completion_cb, NULL,
+                                qemu_laio_flush_cb, qemu_laio_process_queue,
+                                s);
+        laio_state = s;
+        pthread_atfork(laio_prepare_fork, NULL, laio_child_after_fork);
+    }
+
+    /* Linux AIO blocks in io_submit() without O_DIRECT */
+    if (buffered && aioRing_kind(s->ring) != AIO_RING_IO_URING) {
+        return NULL;
+    }
+    return s;
+}
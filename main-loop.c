@@ -24,6 +24,7 @@
 
 #include "android/charpipe.h"
 #include "android/log-rotate.h"
+#include "android/utils/hot_profiler.h"
 #include "android/snaphost-android.h"
 #include "block/aio.h"
 #include "exec/hax.h"
@@ -260,19 +261,23 @@ void os_host_main_loop_wait(int *timeout)
 #endif  // _WIN32
 
 static void qemu_run_alarm_timer(void);  // forward
+static void qemu_update_idle(void);  // forward
+static int qemu_idle;
 
 void main_loop_wait(int timeout)
 {
     fd_set rfds, wfds, xfds;
     int ret, nfds;
+    int64_t hot_start;
     struct timeval tv;
+    // Which source sets the timeout, for the idle wakeup counters.
+    HotProfilerCounter wakeup = HOT_PROFILER_WAKEUP_TIMER;
+    int old_timeout = timeout;
 
     qemu_bh_update_timeout(&timeout);
-
-    os_host_main_loop_wait(&timeout);
-
-    tv.tv_sec = timeout / 1000;
-    tv.tv_usec = (timeout % 1000) * 1000;
+    if (timeout < old_timeout) {
+        wakeup = HOT_PROFILER_WAKEUP_BH;
+    }
 
     /* poll any events */
 
@@ -284,11 +289,36 @@ void main_loop_wait(int timeout)
     qemu_iohandler_fill(&nfds, &rfds, &wfds, &xfds);
     if (slirp_is_inited()) {
         slirp_select_fill(&nfds, &rfds, &wfds, &xfds);
+        old_timeout = timeout;
+        slirp_update_timeout(&timeout);
+        if (timeout < old_timeout) {
+            wakeup = HOT_PROFILER_WAKEUP_SLIRP;
+        }
     }
+    old_timeout = timeout;
+    charpipe_update_timeout(&timeout);
+    if (timeout < old_timeout) {
+        wakeup = HOT_PROFILER_WAKEUP_CHARPIPE;
+    }
+
+    os_host_main_loop_wait(&timeout);
+
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
 
     qemu_mutex_unlock_iothread();
     ret = select(nfds + 1, &rfds, &wfds, &xfds, &tv);
     qemu_mutex_lock_iothread();
+    if (qemu_idle && hotProfiler_isEnabled()) {
+        if (ret > 0) {
+            wakeup = HOT_PROFILER_WAKEUP_IO;
+        } else if (ret < 0) {
+            wakeup = HOT_PROFILER_WAKEUP_SIGNAL;
+        }
+        hotProfiler_count(HOT_PROFILER_IDLE_WAKEUP);
+        hotProfiler_count(wakeup);
+    }
+    hot_start = hotProfiler_begin();
     qemu_iohandler_poll(&rfds, &wfds, &xfds, ret);
     if (slirp_is_inited()) {
         if (ret < 0) {
@@ -299,14 +329,19 @@ void main_loop_wait(int timeout)
         slirp_select_poll(&rfds, &wfds, &xfds);
     }
     charpipe_poll();
+    hotProfiler_end(HOT_PROFILER_IO_HANDLERS, hot_start);
 
+    hot_start = hotProfiler_begin();
     qemu_clock_run_all_timers();
 
     qemu_run_alarm_timer();
+    hotProfiler_end(HOT_PROFILER_TIMERS, hot_start);
 
     /* Check bottom-halves last in case any of the earlier events triggered
        them.  */
+    hot_start = hotProfiler_begin();
     qemu_bh_poll();
+    hotProfiler_end(HOT_PROFILER_BOTTOM_HALVES, hot_start);
 
 }
 
@@ -321,6 +356,7 @@ void main_loop(void)
 
     for (;;) {
         do {
+            int64_t hot_start;
 #ifdef CONFIG_PROFILER
             int64_t ti;
 #endif
@@ -328,7 +364,11 @@ void main_loop(void)
 #ifdef CONFIG_PROFILER
             ti = profile_getclock();
 #endif
+            hot_start = hotProfiler_begin();
+            qemu_update_idle();
             main_loop_wait(qemu_calculate_timeout());
+            qemu_update_idle();
+            hotProfiler_end(HOT_PROFILER_MAIN_LOOP_WAIT, hot_start);
 #ifdef CONFIG_PROFILER
             dev_time += profile_getclock() - ti;
 #endif
@@ -344,12 +384,16 @@ void main_loop(void)
                 vm_stop(0);
                 no_shutdown = 0;
             } else {
+                savevm_background_wait();
                 if (savevm_on_exit != NULL) {
                   /* Prior to saving VM to the snapshot file, save HW config
                    * settings for that VM, so we can match them when VM gets
                    * loaded from the snapshot. */
                   snaphost_save_config(savevm_on_exit);
-                  do_savevm(cur_mon, savevm_on_exit);
+                  if (!savevm_on_exit_background || hax_enabled() ||
+                      do_savevm_background(cur_mon, savevm_on_exit, true) < 0) {
+                      do_savevm(cur_mon, savevm_on_exit);
+                  }
                 }
                 break;
             }
@@ -387,6 +431,9 @@ struct qemu_alarm_timer {
 
 static struct qemu_alarm_timer *alarm_timer;
 
+/* Set while a periodic alarm is stopped in idle mode. */
+static int alarm_timer_suspended;
+
 static inline int alarm_has_dynticks(struct qemu_alarm_timer *t)
 {
     return t->rearm != NULL;
@@ -400,8 +447,8 @@ static void qemu_rearm_alarm_timer(struct qemu_alarm_timer *t)
 }
 
 static void qemu_run_alarm_timer(void) {
-    /* rearm timer, if not periodic */
-    if (alarm_timer->expired) {
+    /* rearm timer, if not periodic. This is done when leaving idle mode. */
+    if (alarm_timer->expired && !qemu_idle) {
         alarm_timer->expired = 0;
         qemu_rearm_alarm_timer(alarm_timer);
     }
@@ -683,7 +730,9 @@ static int unix_start_timer(struct qemu_alarm_timer *t)
     /* for i386 kernel 2.6 to get 1 ms */
     itv.it_interval.tv_usec = 999;
     itv.it_value.tv_sec = 0;
-    itv.it_value.tv_usec = 10 * 1000;
+    /* this is also restarted when leaving idle mode, so don't let the
+     * vCPU run for too long before the first tick */
+    itv.it_value.tv_usec = 999;
 
     err = setitimer(ITIMER_REAL, &itv, NULL);
     if (err)
@@ -904,17 +953,110 @@ void quit_timers(void)
 {
     struct qemu_alarm_timer *t = alarm_timer;
     alarm_timer = NULL;
-    t->stop(t);
+    if (!alarm_timer_suspended)
+        t->stop(t);
+}
+
+/***********************************************************/
+/* idle mode */
+
+/* The main loop is idle when all vCPUs are halted, or the VM is stopped.
+ * Nothing needs to interrupt guest code then, so the periodic host alarm
+ * is stopped, periodic device timers that have nothing to do stop re-arming
+ * themselves, and the main loop only wakes up for actual timer deadlines,
+ * which are coalesced with the -timer-slack value. */
+
+typedef struct IdleHandlerEntry {
+    QEMUIdleHandler *cb;
+    void *opaque;
+    struct IdleHandlerEntry *next;
+} IdleHandlerEntry;
+
+static IdleHandlerEntry *first_idle_handler;
+
+static int64_t timer_slack_ns;
+
+void qemu_add_idle_handler(QEMUIdleHandler *cb, void *opaque)
+{
+    IdleHandlerEntry **pe, *e;
+    e = g_malloc0(sizeof(IdleHandlerEntry));
+    e->cb = cb;
+    e->opaque = opaque;
+    for(pe = &first_idle_handler; *pe != NULL; pe = &(*pe)->next);
+    *pe = e;
+}
+
+int qemu_is_idle(void)
+{
+    return qemu_idle;
+}
+
+void configure_timer_slack(int slack_ms)
+{
+    timer_slack_ns = (int64_t)slack_ms * 1000000LL;
+}
+
+static void qemu_alarm_timer_set_idle(struct qemu_alarm_timer *t, int idle)
+{
+    if (alarm_has_dynticks(t)) {
+        /* one-shot alarms are just not re-armed while idle */
+        if (!idle) {
+            t->expired = 0;
+            qemu_rearm_alarm_timer(t);
+        }
+        return;
+    }
+    if (idle) {
+        t->stop(t);
+        alarm_timer_suspended = 1;
+    } else {
+        if (t->start(t) < 0) {
+            fprintf(stderr, "Failed to restart %s alarm timer: aborting\n",
+                    t->name);
+            exit(1);
+        }
+        alarm_timer_suspended = 0;
+    }
+}
+
+static void qemu_update_idle(void)
+{
+    IdleHandlerEntry *e;
+    int idle = !vm_running || !tcg_has_work();
+
+    if (idle == qemu_idle)
+        return;
+    qemu_idle = idle;
+    if (alarm_timer)
+        qemu_alarm_timer_set_idle(alarm_timer, idle);
+    for (e = first_idle_handler; e != NULL; e = e->next)
+        e->cb(e->opaque, idle);
+}
+
+/* Round a timeout up, so that it expires on a multiple of the timer slack
+ * of the host monotonic clock. This coalesces the deadlines of all timers,
+ * and of all emulators running on the same host. */
+static int64_t qemu_coalesce_timeout(int64_t timeout_ns)
+{
+    int64_t now, deadline;
+
+    if (timer_slack_ns <= 0 || timeout_ns <= 0)
+        return timeout_ns;
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    deadline = now + timeout_ns + timer_slack_ns - 1;
+    deadline -= deadline % timer_slack_ns;
+    return deadline - now;
 }
 
 int qemu_calculate_timeout(void)
 {
     int timeout;
+    int64_t timeout_ns;
 
     if (!vm_running)
         timeout = 5000;
     else if (tcg_has_work())
-        timeout = 0;
+        return 0;
     else {
 #ifdef WIN32
         /* This corresponds to the case where the emulated system is
@@ -930,11 +1072,16 @@ int qemu_calculate_timeout(void)
 #else
         timeout = 5000;
 #endif
-        int64_t timeout_ns = (int64_t)timeout * 1000000LL;
-        timeout_ns = qemu_soonest_timeout(
-                timeout_ns, timerlistgroup_deadline_ns(&main_loop_tlg));
-        timeout = (int)((timeout_ns + 999999LL) / 1000000LL);
     }
 
+    /* Also while the VM is stopped: the alarm timer is off then, so the
+     * REALTIME timers, e.g. the display refresh, only run when the wait
+     * ends. The VIRTUAL clock is disabled and has no deadline. */
+    timeout_ns = (int64_t)timeout * 1000000LL;
+    timeout_ns = qemu_soonest_timeout(
+            timeout_ns, timerlistgroup_deadline_ns(&main_loop_tlg));
+    timeout_ns = qemu_coalesce_timeout(timeout_ns);
+    timeout = (int)((timeout_ns + 999999LL) / 1000000LL);
+
     return timeout;
 }
@@ -1,9 +1,11 @@
 #include "cpu.h"
 #include "exec/exec-all.h"
 #include "qemu/host-utils.h"
+#include "android/utils/hot_profiler.h"
 
 uint64_t io_mem_read(int io_index, hwaddr addr, unsigned size)
 {
+    hotProfiler_countIo(io_index, false);
     return _io_mem_read[io_index][ctzl(size)](io_mem_opaque[io_index],
                                               addr);
 }
@@ -11,6 +13,7 @@ uint64_t io_mem_read(int io_index, hwaddr addr, unsigned size)
 void io_mem_write(int io_index, hwaddr addr,
                   uint64_t val, unsigned size)
 {
+    hotProfiler_countIo(io_index, true);
     _io_mem_write[io_index][ctzl(size)](io_mem_opaque[io_index],
                                         addr, val);
 }
@@ -337,6 +337,88 @@ static char *assign_name(VLANClientState *vc1, const char *model)
     return strdup(buf);
 }
 
+/* Packets that a client can have in the send queue. Beyond that, those
+ * without a completion callback are dropped: their sender does not wait
+ * for them, and would otherwise grow the queue without bounds. */
+#define VLAN_QUEUE_MAX_LEN  10000
+
+/* Return a packet of |size| bytes from the pool of the VLAN, or NULL if
+ * the queue of |sender| is full. */
+static VLANPacket *qemu_new_packet(VLANClientState *sender, size_t size,
+                                   NetPacketSent *sent_cb)
+{
+    VLANPacket *packet;
+
+    if (sender->queue_len >= VLAN_QUEUE_MAX_LEN && sent_cb == NULL) {
+        sender->dropped++;
+        return NULL;
+    }
+    packet = packetPool_alloc(&sender->vlan->packet_pool,
+                              sizeof(VLANPacket) + size);
+    packet->next = NULL;
+    packet->sender = sender;
+    packet->size = 0;
+    packet->sent_cb = sent_cb;
+    return packet;
+}
+
+/* |packet| comes from the pool of |vlan|, its sender may be gone. */
+static void qemu_free_packet(VLANState *vlan, VLANPacket *packet)
+{
+    packetPool_free(&vlan->packet_pool, packet);
+}
+
+/* Append |packet| to the send queue, which is delivered in order. */
+static void qemu_queue_packet(VLANPacket *packet)
+{
+    VLANClientState *sender = packet->sender;
+    VLANState *vlan = sender->vlan;
+
+    *vlan->send_queue_tail = packet;
+    vlan->send_queue_tail = &packet->next;
+    sender->queued++;
+    if (++sender->queue_len > sender->queue_max) {
+        sender->queue_max = sender->queue_len;
+    }
+}
+
+/* Drop the packets of |vc| from the list at |ppacket|, and return the
+ * new end of the list. */
+static VLANPacket **qemu_purge_packet_list(VLANState *vlan,
+                                           VLANPacket **ppacket,
+                                           VLANClientState *vc)
+{
+    while (*ppacket != NULL) {
+        VLANPacket *packet = *ppacket;
+
+        if (packet->sender == vc) {
+            *ppacket = packet->next;
+            qemu_free_packet(vlan, packet);
+        } else {
+            ppacket = &packet->next;
+        }
+    }
+    return ppacket;
+}
+
+/* Drop the packets queued by |vc|, which is going away. It can be deleted
+ * by a receiver or a sent_cb, so this includes those of the batch being
+ * delivered by qemu_flush_queued_packets(). */
+static void qemu_purge_queued_packets(VLANClientState *vc)
+{
+    VLANState *vlan = vc->vlan;
+
+    vlan->send_queue_tail = qemu_purge_packet_list(vlan, &vlan->send_queue,
+                                                   vc);
+    qemu_purge_packet_list(vlan, &vlan->batch, vc);
+    vlan->sent_tail = qemu_purge_packet_list(vlan, &vlan->sent, vc);
+    if (vlan->current != NULL && vlan->current->sender == vc) {
+        /* qemu_flush_queued_packets() frees it after its delivery */
+        vlan->current->sender = NULL;
+    }
+    vc->queue_len = 0;
+}
+
 VLANClientState *qemu_new_vlan_client(VLANState *vlan,
                                       const char *model,
                                       const char *name,
@@ -375,6 +457,7 @@ void qemu_del_vlan_client(VLANClientState *vc)
     while (*pvc != NULL)
         if (*pvc == vc) {
             *pvc = vc->next;
+            qemu_purge_queued_packets(vc);
             if (vc->cleanup) {
                 vc->cleanup(vc);
             }
@@ -420,12 +503,15 @@ int qemu_can_send_packet(VLANClientState *sender)
 static int
 qemu_deliver_packet(VLANClientState *sender, const uint8_t *buf, int size)
 {
+    VLANState *vlan = sender->vlan;
     VLANClientState *vc;
+    int delivering = vlan->delivering;
     int ret = -1;
 
-    sender->vlan->delivering = 1;
+    /* |sender| can be deleted by a receiver, don't use it afterwards */
+    vlan->delivering = 1;
 
-    for (vc = sender->vlan->first_client; vc != NULL; vc = vc->next) {
+    for (vc = vlan->first_client; vc != NULL; vc = vc->next) {
         ssize_t len;
 
         if (vc == sender) {
@@ -442,31 +528,98 @@ qemu_deliver_packet(VLANClientState *sender, const uint8_t *buf, int size)
         ret = (ret >= 0) ? ret : len;
     }
 
-    sender->vlan->delivering = 0;
+    vlan->delivering = delivering;
 
     return ret;
 }
 
-void qemu_flush_queued_packets(VLANClientState *vc)
+/* Call the sent_cb of the packets delivered by the last batch. It's done
+ * once the batch is over, so that the senders can send again right away. */
+static void qemu_run_sent_callbacks(VLANState *vlan)
 {
     VLANPacket *packet;
 
-    while ((packet = vc->vlan->send_queue) != NULL) {
-        int ret;
+    /* a callback can delete a client, and purge the list */
+    while ((packet = vlan->sent) != NULL) {
+        vlan->sent = packet->next;
+        if (vlan->sent == NULL) {
+            vlan->sent_tail = &vlan->sent;
+        }
+        packet->sent_cb(packet->sender);
+        qemu_free_packet(vlan, packet);
+    }
+}
 
-        vc->vlan->send_queue = packet->next;
+void qemu_flush_queued_packets(VLANClientState *vc)
+{
+    VLANState *vlan = vc->vlan;
+    int delivering = vlan->delivering;
+    int blocked = 0;
 
-        ret = qemu_deliver_packet(packet->sender, packet->data, packet->size);
-        if (ret == 0 && packet->sent_cb != NULL) {
-            packet->next = vc->vlan->send_queue;
-            vc->vlan->send_queue = packet;
-            break;
-        }
+    if (vlan->current != NULL) {
+        /* called by a receiver, the batch being delivered goes on */
+        return;
+    }
+
+    /* Deliver the queue in batches: take all the packets queued so far
+     * at once, those that the receivers queue meanwhile make the next
+     * batch. */
+    while (vlan->send_queue != NULL && !blocked) {
+        vlan->batch = vlan->send_queue;
+        vlan->send_queue = NULL;
+        vlan->send_queue_tail = &vlan->send_queue;
+        vlan->delivering = 1;
+
+        while (vlan->batch != NULL) {
+            VLANPacket *packet = vlan->batch;
+            VLANClientState *sender;
+            int ret;
+
+            vlan->batch = packet->next;
+            vlan->current = packet;
+            ret = qemu_deliver_packet(packet->sender, packet->data,
+                                      packet->size);
+            vlan->current = NULL;
+
+            sender = packet->sender;
+            if (sender == NULL) {
+                /* deleted during the delivery */
+                qemu_free_packet(vlan, packet);
+                continue;
+            }
 
-        if (packet->sent_cb)
-            packet->sent_cb(packet->sender);
+            if (ret == 0 && packet->sent_cb != NULL) {
+                /* Retry it and the rest of the batch first next time. */
+                VLANPacket **tail;
+
+                packet->next = vlan->batch;
+                vlan->batch = NULL;
+                for (tail = &packet->next; *tail != NULL;
+                     tail = &(*tail)->next) {
+                }
+                *tail = vlan->send_queue;
+                if (vlan->send_queue == NULL) {
+                    vlan->send_queue_tail = tail;
+                }
+                vlan->send_queue = packet;
+                blocked = 1;
+                break;
+            }
 
-        g_free(packet);
+            sender->queue_len--;
+            if (ret == 0) {
+                sender->dropped++;
+            }
+            if (packet->sent_cb) {
+                packet->next = NULL;
+                *vlan->sent_tail = packet;
+                vlan->sent_tail = &packet->next;
+            } else {
+                qemu_free_packet(vlan, packet);
+            }
+        }
+        vlan->delivering = delivering;
+        qemu_run_sent_callbacks(vlan);
     }
 }
 
@@ -476,13 +629,13 @@ static void qemu_enqueue_packet(VLANClientState *sender,
 {
     VLANPacket *packet;
 
-    packet = g_malloc(sizeof(VLANPacket) + size);
-    packet->next = sender->vlan->send_queue;
-    packet->sender = sender;
+    packet = qemu_new_packet(sender, size, sent_cb);
+    if (packet == NULL) {
+        return;
+    }
     packet->size = size;
-    packet->sent_cb = sent_cb;
     memcpy(packet->data, buf, size);
-    sender->vlan->send_queue = packet;
+    qemu_queue_packet(packet);
 }
 
 ssize_t qemu_send_packet_async(VLANClientState *sender,
@@ -510,6 +663,9 @@ ssize_t qemu_send_packet_async(VLANClientState *sender,
         qemu_enqueue_packet(sender, buf, size, sent_cb);
         return 0;
     }
+    if (ret == 0) {
+        sender->dropped++;
+    }
 
     qemu_flush_queued_packets(sender);
 
@@ -552,12 +708,15 @@ static ssize_t calc_iov_length(const struct iovec *iov, int iovcnt)
 static int qemu_deliver_packet_iov(VLANClientState *sender,
                                    const struct iovec *iov, int iovcnt)
 {
+    VLANState *vlan = sender->vlan;
     VLANClientState *vc;
+    int delivering = vlan->delivering;
     int ret = -1;
 
-    sender->vlan->delivering = 1;
+    /* |sender| can be deleted by a receiver, don't use it afterwards */
+    vlan->delivering = 1;
 
-    for (vc = sender->vlan->first_client; vc != NULL; vc = vc->next) {
+    for (vc = vlan->first_client; vc != NULL; vc = vc->next) {
         ssize_t len;
 
         if (vc == sender) {
@@ -578,7 +737,7 @@ static int qemu_deliver_packet_iov(VLANClientState *sender,
         ret = (ret >= 0) ? ret : len;
     }
 
-    sender->vlan->delivering = 0;
+    vlan->delivering = delivering;
 
     return ret;
 }
@@ -593,11 +752,10 @@ static ssize_t qemu_enqueue_packet_iov(VLANClientState *sender,
 
     max_len = calc_iov_length(iov, iovcnt);
 
-    packet = g_malloc(sizeof(VLANPacket) + max_len);
-    packet->next = sender->vlan->send_queue;
-    packet->sender = sender;
-    packet->sent_cb = sent_cb;
-    packet->size = 0;
+    packet = qemu_new_packet(sender, max_len, sent_cb);
+    if (packet == NULL) {
+        return max_len;
+    }
 
     for (i = 0; i < iovcnt; i++) {
         size_t len = iov[i].iov_len;
@@ -606,7 +764,7 @@ static ssize_t qemu_enqueue_packet_iov(VLANClientState *sender,
         packet->size += len;
     }
 
-    sender->vlan->send_queue = packet;
+    qemu_queue_packet(packet);
 
     return packet->size;
 }
@@ -630,6 +788,9 @@ ssize_t qemu_sendv_packet_async(VLANClientState *sender,
         qemu_enqueue_packet_iov(sender, iov, iovcnt, sent_cb);
         return 0;
     }
+    if (ret == 0) {
+        sender->dropped++;
+    }
 
     qemu_flush_queued_packets(sender);
 
@@ -682,6 +843,8 @@ double   qemu_net_upload_speed   = 0.;
 double   qemu_net_download_speed = 0.;
 int      qemu_net_min_latency = 0;
 int      qemu_net_max_latency = 0;
+int      qemu_net_jitter = 0;
+double   qemu_net_loss = 0.;
 int      qemu_net_disable = 0;
 
 int
@@ -746,6 +909,10 @@ slirp_init_shapers( void )
     netdelay_set_latency( slirp_delay_in, qemu_net_min_latency, qemu_net_max_latency );
     netshaper_set_rate( slirp_shaper_out, qemu_net_download_speed );
     netshaper_set_rate( slirp_shaper_in,  qemu_net_upload_speed  );
+    netshaper_set_jitter( slirp_shaper_out, qemu_net_jitter );
+    netshaper_set_jitter( slirp_shaper_in,  qemu_net_jitter );
+    netshaper_set_loss( slirp_shaper_out, qemu_net_loss );
+    netshaper_set_loss( slirp_shaper_in,  qemu_net_loss );
 }
 
 #endif /* CONFIG_ANDROID */
@@ -2110,6 +2277,9 @@ VLANState *qemu_find_vlan(int id)
     vlan = g_malloc0(sizeof(VLANState));
     vlan->id = id;
     vlan->next = NULL;
+    vlan->send_queue_tail = &vlan->send_queue;
+    vlan->sent_tail = &vlan->sent;
+    packetPool_init(&vlan->packet_pool);
     pvlan = &first_vlan;
     while (*pvlan != NULL)
         pvlan = &(*pvlan)->next;
@@ -2548,6 +2718,42 @@ void do_info_network(Monitor *mon)
     }
 }
 
+int qemu_get_vlan_client_stats(int index, VLANClientStats *stats)
+{
+    VLANState *vlan;
+    VLANClientState *vc;
+
+    for (vlan = first_vlan; vlan != NULL; vlan = vlan->next) {
+        for (vc = vlan->first_client; vc != NULL; vc = vc->next) {
+            if (index-- > 0) {
+                continue;
+            }
+            stats->vlan_id = vlan->id;
+            snprintf(stats->name, sizeof(stats->name), "%s", vc->name);
+            stats->queue_len = vc->queue_len;
+            stats->queue_max = vc->queue_max;
+            stats->queued = vc->queued;
+            stats->dropped = vc->dropped;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int qemu_get_vlan_pool_stats(int index, int *vlan_id, PacketPoolStats *stats)
+{
+    VLANState *vlan;
+
+    for (vlan = first_vlan; vlan != NULL; vlan = vlan->next) {
+        if (index-- == 0) {
+            *vlan_id = vlan->id;
+            packetPool_getStats(&vlan->packet_pool, stats);
+            return 0;
+        }
+    }
+    return -1;
+}
+
 int do_set_link(Monitor *mon, const char *name, const char *up_or_down)
 {
     VLANState *vlan;
@@ -618,6 +618,42 @@ BlockDriverAIOCB *paio_ioctl(BlockDriverState *bs, int fd,
     return &acb->common;
 }
 
+/* fork() only duplicates the calling thread. Make sure that no worker holds
+ * the lock at this point, and let the child start over with a new pool and
+ * a signalling pipe of its own, so that the parent doesn't consume its
+ * completion notifications. This is used to save snapshots in the
+ * background, see do_savevm_background(). */
+static void paio_prepare_fork(void)
+{
+    mutex_lock(&lock);
+}
+
+static void paio_parent_after_fork(void)
+{
+    mutex_unlock(&lock);
+}
+
+static void paio_child_after_fork(void)
+{
+    PosixAioState *s = posix_aio_state;
+    int fds[2];
+
+    mutex_unlock(&lock);
+    pthread_cond_init(&cond, NULL);
+    cur_threads = 0;
+    idle_threads = 0;
+
+    if (qemu_pipe(fds) == -1) {
+        die("pipe");
+    }
+    dup2(fds[0], s->rfd);
+    dup2(fds[1], s->wfd);
+    close(fds[0]);
+    close(fds[1]);
+    fcntl(s->rfd, F_SETFL, O_NONBLOCK);
+    fcntl(s->wfd, F_SETFL, O_NONBLOCK);
+}
+
 int paio_init(void)
 {
     struct sigaction act;
@@ -660,6 +696,11 @@ int paio_init(void)
 
     QTAILQ_INIT(&request_list);
 
+    ret = pthread_atfork(paio_prepare_fork, paio_parent_after_fork,
+                         paio_child_after_fork);
+    if (ret)
+        die2(ret, "pthread_atfork");
+
     posix_aio_state = s;
     return 0;
 }
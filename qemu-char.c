@@ -2685,7 +2685,10 @@ void qemu_chr_guest_close(struct CharDriverState *chr)
 
 void qemu_chr_close(CharDriverState *chr)
 {
-    QTAILQ_REMOVE(&chardevs, chr, next);
+    /* charpipes and charbuffers are not in the list */
+    if (chr->next.tqe_prev != NULL) {
+        QTAILQ_REMOVE(&chardevs, chr, next);
+    }
     if (chr->chr_close)
         chr->chr_close(chr);
     g_free(chr->filename);
@@ -19,20 +19,34 @@
 
 #include "qemu-common.h"
 #include "qemu/log.h"
+#include "android/utils/trace_ring.h"
 
 static char *logfilename;
 FILE *qemu_logfile;
 int qemu_loglevel;
 static int log_append = 0;
+static char *ring_dump_path;
+
+/* With LOG_TRACE_RING, the messages are not formatted but recorded into
+ * the binary rings of android/utils/trace_ring.h, which only keep the
+ * address of the format string. The output of cpu_dump_state(), disas()
+ * and such still goes to the log file.
+ */
+void qemu_log_vprintf(const char *fmt, va_list va)
+{
+    if (qemu_loglevel & LOG_TRACE_RING) {
+        traceRing_vrecord(fmt, va);
+    } else if (qemu_logfile) {
+        vfprintf(qemu_logfile, fmt, va);
+    }
+}
 
 void qemu_log(const char *fmt, ...)
 {
     va_list ap;
 
     va_start(ap, fmt);
-    if (qemu_logfile) {
-        vfprintf(qemu_logfile, fmt, ap);
-    }
+    qemu_log_vprintf(fmt, ap);
     va_end(ap);
 }
 
@@ -41,16 +55,44 @@ void qemu_log_mask(int mask, const char *fmt, ...)
     va_list ap;
 
     va_start(ap, fmt);
-    if ((qemu_loglevel & mask) && qemu_logfile) {
-        vfprintf(qemu_logfile, fmt, ap);
+    if (qemu_loglevel & mask) {
+        qemu_log_vprintf(fmt, ap);
     }
     va_end(ap);
 }
 
+static void qemu_log_dump_ring_at_exit(void)
+{
+    if (traceRing_dump(ring_dump_path) == 0) {
+        fprintf(stderr, "qemu: trace ring dumped to %s\n", ring_dump_path);
+    }
+}
+
+const char *qemu_log_ring_path(void)
+{
+    return ring_dump_path;
+}
+
 /* enable or disable low levels log */
 void do_qemu_set_log(int log_flags, bool use_own_buffers)
 {
     qemu_loglevel = log_flags;
+    if ((log_flags & LOG_TRACE_RING) && !ring_dump_path) {
+        /* The rings are dumped next to the log file, when the emulator
+         * exits or crashes */
+        if (logfilename) {
+            ring_dump_path = g_strdup_printf("%s.ring", logfilename);
+        } else {
+#ifdef _WIN32
+            ring_dump_path = g_strdup_printf("qemu-%d.ring", (int)getpid());
+#else
+            ring_dump_path = g_strdup_printf("/tmp/qemu-%d.ring",
+                                             (int)getpid());
+#endif
+        }
+        traceRing_dumpOnCrash(ring_dump_path);
+        atexit(qemu_log_dump_ring_at_exit);
+    }
     if (qemu_loglevel && !qemu_logfile) {
         if (logfilename) {
             qemu_logfile = fopen(logfilename, log_append ? "a" : "w");
@@ -117,6 +159,12 @@ const QEMULogItem qemu_log_items[] = {
     { LOG_GUEST_ERROR, "guest_errors",
       "log when the guest OS does something invalid (eg accessing a\n"
       "non-existent register)" },
+    { LOG_TRACE_RING, "ring",
+      "record the messages of the other items into in-memory binary rings\n"
+      "instead of formatting them, which is much faster. The rings are dumped\n"
+      "at exit or on crash to <logfile>.ring, or /tmp/qemu-<pid>.ring without\n"
+      "-D, or with the 'trace dump' console command. Decode them with\n"
+      "emulator_trace_decode" },
     { 0, NULL, NULL },
 };
 
@@ -144,7 +192,9 @@ int qemu_str_to_log_mask(const char *str)
         }
         if (cmp1(p,p1-p,"all")) {
             for (item = qemu_log_items; item->mask != 0; item++) {
-                mask |= item->mask;
+                if (item->mask != LOG_TRACE_RING) {
+                    mask |= item->mask;
+                }
             }
         } else {
             for (item = qemu_log_items; item->mask != 0; item++) {
@@ -92,6 +92,7 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "-drive [file=file][,if=type][,bus=n][,unit=m][,media=d][,index=i]\n"
     "       [,cyls=c,heads=h,secs=s[,trans=t]][,snapshot=on|off]\n"
     "       [,cache=writethrough|writeback|none][,format=f][,serial=s]\n"
+    "       [,aio=threads|native]\n"
     "                use 'file' as a drive image\n")
 STEXI
 @item -drive @var{option}[,@var{option}[,@var{option}[,...]]]
@@ -126,6 +127,10 @@ the format.  Can be used to specifiy format=raw to avoid interpreting
 an untrusted format header.
 @item serial=@var{serial}
 This option specifies the serial number to assign to the device.
+@item aio=@var{aio}
+@var{aio} is "threads", or "native" and selects between a thread pool and the
+native asynchronous I/O of Linux hosts, io_uring, or Linux AIO together with
+@option{cache=none}.
 @end table
 
 By default, writethrough caching is used for all block device.  This means that
@@ -1635,6 +1640,26 @@ DEF("tb-size", HAS_ARG, QEMU_OPTION_tb_size, \
 STEXI
 ETEXI
 
+DEF("tb-superblocks", 0, QEMU_OPTION_tb_superblocks, \
+    "-tb-superblocks translate the fallthrough path of conditional branches\n" \
+    "                in the same TB, up to the end of the page\n")
+STEXI
+@item -tb-superblocks
+Do not end translation blocks at conditional branches.  The taken path
+leaves the block, and the fallthrough path is translated in the same
+block, which gives the optimizer larger regions to work on.
+ETEXI
+
+DEF("tb-no-goto-ptr", 0, QEMU_OPTION_tb_no_goto_ptr, \
+    "-tb-no-goto-ptr return to the main loop on indirect branches instead of\n" \
+    "                looking up the next TB from translated code\n")
+STEXI
+@item -tb-no-goto-ptr
+End translation blocks with indirect branches by returning to the main
+loop, as before the lookup from translated code was added.  The
+@code{info jit} counters then give the numbers to compare with.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming p     prepare for incoming migration, listen on port p\n")
 STEXI
@@ -1691,6 +1716,15 @@ STEXI
 Save state automatically on exit (as @code{savevm} in monitor)
 ETEXI
 
+DEF("savevm-on-exit-background", 0, QEMU_OPTION_savevm_on_exit_background, \
+    "-savevm-on-exit-background\n" \
+    "                save the state on exit from a background process\n")
+STEXI
+@item -savevm-on-exit-background
+With @option{-savevm-on-exit}, save the state from a child process that
+outlives the emulator
+ETEXI
+
 DEF("mic", HAS_ARG, QEMU_OPTION_mic, \
     "-mic <file>     read audio input from wav file\n")
 
@@ -1759,7 +1793,16 @@ DEF("netfast", 0, QEMU_OPTION_netfast, \
     "-netfast disable network shaping\n")
 
 DEF("tcpdump", HAS_ARG, QEMU_OPTION_tcpdump, \
-    "-tcpdump <file> capture network packets to file\n")
+    "-tcpdump <file>[,options] capture network packets to file\n")
+
+DEF("guest-profile", HAS_ARG, QEMU_OPTION_guest_profile, \
+    "-guest-profile <file> sample guest processes and write a profile to file\n")
+
+DEF("timer-slack", HAS_ARG, QEMU_OPTION_timer_slack, \
+    "-timer-slack <ms> coalesce timers by up to <ms> milliseconds while idle\n")
+
+DEF("ram-base", HAS_ARG, QEMU_OPTION_ram_base, \
+    "-ram-base <file> map guest RAM copy-on-write from a shared base file\n")
 
 DEF("boot-property", HAS_ARG, QEMU_OPTION_boot_property, \
     "-boot-property <name>=<value> set system property on boot\n")
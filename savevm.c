@@ -79,6 +79,9 @@
 #include "sysemu/char.h"
 #include "sysemu/blockdev.h"
 #include "block/block.h"
+#ifdef CONFIG_LINUX_AIO
+#include "block/raw-posix-aio.h"
+#endif
 #include "audio/audio.h"
 #include "migration/migration.h"
 #include "migration/qemu-file.h"
@@ -89,6 +92,7 @@
 #include "qemu/timer.h"
 #include "qemu/queue.h"
 #include "android/snapshot.h"
+#include "android/utils/filelock.h"
 
 
 #define SELF_ANNOUNCE_ROUNDS 5
@@ -584,10 +588,16 @@ static ssize_t block_writev_buffer(void *opaque, struct iovec *iov, int iovcnt,
 }
 #endif
 
+static void savevm_background_report(int64_t done);
+static int bg_progress_fd;
+
 static int block_put_buffer(void *opaque, const uint8_t *buf,
                            int64_t pos, int size)
 {
     bdrv_save_vmstate(opaque, buf, pos, size);
+    if (bg_progress_fd >= 0) {
+        savevm_background_report(pos + size);
+    }
     return size;
 }
 
@@ -2475,42 +2485,26 @@ static int bdrv_snapshot_find(BlockDriverState *bs, QEMUSnapshotInfo *sn_info,
     return ret;
 }
 
-void do_savevm(Monitor *err, const char *name)
+/* Prepare |sn| for saving a snapshot named |name| on |bs|. If a snapshot
+ * with that name exists, it is copied to |old_sn| and |*must_delete| is set. */
+static void savevm_init_snapshot(BlockDriverState *bs, const char *name,
+                                 QEMUSnapshotInfo *sn,
+                                 QEMUSnapshotInfo *old_sn, int *must_delete)
 {
-    BlockDriverState *bs, *bs1;
-    QEMUSnapshotInfo sn1, *sn = &sn1, old_sn1, *old_sn = &old_sn1;
-    int must_delete, ret;
-    BlockDriverInfo bdi1, *bdi = &bdi1;
-    QEMUFile *f;
-    int saved_vm_running;
-    uint32_t vm_state_size;
 #ifdef _WIN32
     struct _timeb tb;
 #else
     struct timeval tv;
 #endif
 
-    bs = bdrv_snapshots();
-    if (!bs) {
-        monitor_printf(err, "No block device can accept snapshots\n");
-        return;
-    }
-
-    /* ??? Should this occur after vm_stop?  */
-    qemu_aio_flush();
-
-    saved_vm_running = vm_running;
-    vm_stop(0);
-
-    must_delete = 0;
+    *must_delete = 0;
     if (name) {
-        ret = bdrv_snapshot_find(bs, old_sn, name);
-        if (ret >= 0) {
-            must_delete = 1;
+        if (bdrv_snapshot_find(bs, old_sn, name) >= 0) {
+            *must_delete = 1;
         }
     }
     memset(sn, 0, sizeof(*sn));
-    if (must_delete) {
+    if (*must_delete) {
         pstrcpy(sn->name, sizeof(sn->name), old_sn->name);
         pstrcpy(sn->id_str, sizeof(sn->id_str), old_sn->id_str);
     } else {
@@ -2529,25 +2523,38 @@ void do_savevm(Monitor *err, const char *name)
     sn->date_nsec = tv.tv_usec * 1000;
 #endif
     sn->vm_clock_nsec = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+}
+
+/* Write the VM state to |bs|, and create the snapshot |sn| on all the
+ * devices that support it. Return 0 on success, or -1 on failure. */
+static int savevm_write_snapshot(Monitor *err, BlockDriverState *bs,
+                                 QEMUSnapshotInfo *sn,
+                                 QEMUSnapshotInfo *old_sn, int must_delete)
+{
+    BlockDriverState *bs1;
+    BlockDriverInfo bdi1, *bdi = &bdi1;
+    QEMUFile *f;
+    uint32_t vm_state_size;
+    int ret, result = 0;
 
     if (bdrv_get_info(bs, bdi) < 0 || bdi->vm_state_offset <= 0) {
         monitor_printf(err, "Device %s does not support VM state snapshots\n",
                               bdrv_get_device_name(bs));
-        goto the_end;
+        return -1;
     }
 
     /* save the VM state */
     f = qemu_fopen_bdrv(bs, 1);
     if (!f) {
         monitor_printf(err, "Could not open VM state file\n");
-        goto the_end;
+        return -1;
     }
     ret = qemu_savevm_state(f);
     vm_state_size = qemu_ftell(f);
     qemu_fclose(f);
     if (ret < 0) {
         monitor_printf(err, "Error %d while writing VM\n", ret);
-        goto the_end;
+        return -1;
     }
 
     /* create the snapshots */
@@ -2569,16 +2576,367 @@ void do_savevm(Monitor *err, const char *name)
             if (ret < 0) {
                 monitor_printf(err, "Error while creating snapshot on '%s'\n",
                                       bdrv_get_device_name(bs1));
+                result = -1;
             }
         }
     }
+    return result;
+}
+
+void do_savevm(Monitor *err, const char *name)
+{
+    BlockDriverState *bs;
+    QEMUSnapshotInfo sn1, *sn = &sn1, old_sn1, *old_sn = &old_sn1;
+    int must_delete;
+    int saved_vm_running;
+
+    if (savevm_background_busy(err)) {
+        return;
+    }
+
+    bs = bdrv_snapshots();
+    if (!bs) {
+        monitor_printf(err, "No block device can accept snapshots\n");
+        return;
+    }
+
+    /* ??? Should this occur after vm_stop?  */
+    qemu_aio_flush();
+
+    saved_vm_running = vm_running;
+    vm_stop(0);
+
+    savevm_init_snapshot(bs, name, sn, old_sn, &must_delete);
+    savevm_write_snapshot(err, bs, sn, old_sn, must_delete);
 
- the_end:
     if (saved_vm_running)
         vm_start();
 }
 
-void do_loadvm(Monitor *err, const char *name)
+/***********************************************************/
+/* background snapshots */
+
+typedef struct BackgroundSaveHandler {
+    BackgroundSavePrepare *prepare;
+    BackgroundSaveFinish *finish;
+    void *opaque;
+    QTAILQ_ENTRY(BackgroundSaveHandler) next;
+} BackgroundSaveHandler;
+
+static QTAILQ_HEAD(, BackgroundSaveHandler) background_save_handlers =
+    QTAILQ_HEAD_INITIALIZER(background_save_handlers);
+
+/* Progress record sent by the child through the progress pipe. The last
+ * one has the result of the save. */
+typedef struct {
+    int64_t done;
+    int64_t total;
+    int64_t result;         /* -1 while saving, then 0 on success and 1 on
+                               failure */
+} BackgroundSaveProgress;
+
+typedef struct {
+    int pid;                /* child saving the snapshot, or 0 */
+    int fd;                 /* read end of the progress pipe, or -1 */
+    char name[256];
+    BackgroundSaveProgress progress;
+    int64_t start_ms;
+    int64_t end_ms;
+    int status;             /* -1 until the first save completes, then
+                               0 on success, 1 on failure, and 2 if the
+                               child died without reporting its result */
+} BackgroundSave;
+
+static BackgroundSave bg_save = { .fd = -1, .status = -1 };
+
+/* In the child, write end of the progress pipe, or -1. */
+static int bg_progress_fd = -1;
+static BackgroundSaveProgress bg_progress;
+
+/* Report progress once per percent. */
+static void savevm_background_report(int64_t done)
+{
+    int64_t step = bg_progress.total / 100;
+
+    if (done < bg_progress.done + step) {
+        return;
+    }
+    bg_progress.done = done;
+    if (write(bg_progress_fd, &bg_progress, sizeof(bg_progress)) < 0) {
+        bg_progress_fd = -1;
+    }
+}
+
+void register_background_save(BackgroundSavePrepare *prepare,
+                              BackgroundSaveFinish *finish, void *opaque)
+{
+    BackgroundSaveHandler *h = g_malloc0(sizeof(*h));
+
+    h->prepare = prepare;
+    h->finish = finish;
+    h->opaque = opaque;
+    QTAILQ_INSERT_TAIL(&background_save_handlers, h, next);
+}
+
+int savevm_background_busy(Monitor *err)
+{
+    if (!bg_save.pid) {
+        return 0;
+    }
+    monitor_printf(err, "Snapshot '%s' is being saved in the background, "
+                   "try again later\n", bg_save.name);
+    return 1;
+}
+
+#ifndef _WIN32
+
+static int savevm_background_err(void *opaque, const char *str, int size)
+{
+    return fwrite(str, 1, size, stderr);
+}
+
+/* Close the sockets inherited from the emulator, so that the child doesn't
+ * keep its ports, e.g. the console and adb ones, once it exits. */
+static void savevm_close_sockets(void)
+{
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    int fd;
+
+    if (max_fd < 0 || max_fd > 65536) {
+        max_fd = 65536;
+    }
+    for (fd = 3; fd < max_fd; fd++) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            close(fd);
+        }
+    }
+}
+
+static void QEMU_NORETURN savevm_background_child(
+        BlockDriverState *bs, QEMUSnapshotInfo *sn, QEMUSnapshotInfo *old_sn,
+        int must_delete, int progress_fd, bool exit_after)
+{
+    Monitor *err;
+    int ret;
+
+    /* Don't get killed by the terminal's ^C with the emulator. */
+    setsid();
+    signal(SIGPIPE, SIG_IGN);
+    savevm_close_sockets();
+
+    bg_progress_fd = progress_fd;
+    err = monitor_fake_new(NULL, savevm_background_err);
+    ret = savevm_write_snapshot(err, bs, sn, old_sn, must_delete);
+    if (ret == 0) {
+        fprintf(stderr, "Saved snapshot '%s' in the background\n", sn->name);
+    }
+    if (exit_after) {
+        filelock_release_all();
+    }
+    /* The parent can't always get the exit status: its SIGCHLD handler
+     * may reap us first. */
+    if (bg_progress_fd >= 0) {
+        bg_progress.result = (ret < 0) ? 1 : 0;
+        if (write(bg_progress_fd, &bg_progress, sizeof(bg_progress)) < 0) {
+            bg_progress_fd = -1;
+        }
+    }
+    /* Skip the emulator's atexit() handlers, they belong to the parent. */
+    _exit(ret < 0 ? 1 : 0);
+}
+
+static void savevm_background_complete(void)
+{
+    BackgroundSaveHandler *h;
+    BlockDriverState *bs;
+    int status = 0;
+    int ret;
+
+    qemu_set_fd_handler(bg_save.fd, NULL, NULL, NULL);
+    close(bg_save.fd);
+    bg_save.fd = -1;
+
+    /* Fails with ECHILD if the SIGCHLD handler reaped the child. */
+    do {
+        ret = waitpid(bg_save.pid, &status, 0);
+    } while (ret < 0 && errno == EINTR);
+    bg_save.pid = 0;
+    if (bg_save.progress.result >= 0) {
+        bg_save.status = (int)bg_save.progress.result;
+    } else if (ret > 0) {
+        /* Died before reporting, e.g. killed. */
+        bg_save.status = 1;
+    } else {
+        bg_save.status = 2;
+    }
+    bg_save.end_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+
+    QTAILQ_FOREACH(h, &background_save_handlers, next) {
+        h->finish(h->opaque);
+    }
+
+    /* The child added the snapshot behind our back. */
+    bs = NULL;
+    while ((bs = bdrv_next(bs))) {
+        if (bdrv_can_snapshot(bs) && bdrv_reopen(bs) < 0) {
+            fprintf(stderr, "Could not reopen %s after saving a snapshot\n",
+                    bdrv_get_device_name(bs));
+        }
+    }
+}
+
+static void savevm_background_read(void *opaque)
+{
+    BackgroundSaveProgress progress;
+    ssize_t ret;
+
+    ret = read(bg_save.fd, &progress, sizeof(progress));
+    if (ret == sizeof(progress)) {
+        bg_save.progress = progress;
+    } else if (ret < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    } else {
+        /* End of file, or an error. The records are smaller than
+         * PIPE_BUF, so a partial one means the child is gone too. */
+        savevm_background_complete();
+    }
+}
+
+int do_savevm_background(Monitor *err, const char *name, bool exit_after)
+{
+    BlockDriverState *bs;
+    BackgroundSaveHandler *h;
+    QEMUSnapshotInfo sn1, *sn = &sn1, old_sn1, *old_sn = &old_sn1;
+    int must_delete;
+    int saved_vm_running;
+    int fds[2] = { -1, -1 };
+    int pid;
+
+    if (savevm_background_busy(err)) {
+        return -1;
+    }
+
+    bs = bdrv_snapshots();
+    if (!bs) {
+        monitor_printf(err, "No block device can accept snapshots\n");
+        return -1;
+    }
+    if (!exit_after && qemu_pipe(fds) < 0) {
+        monitor_printf(err, "Could not create pipe: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* Quiesce the devices, the child gets a copy-on-write image of their
+     * state as it is now. */
+    qemu_aio_flush();
+    saved_vm_running = vm_running;
+    vm_stop(0);
+
+    savevm_init_snapshot(bs, name, sn, old_sn, &must_delete);
+
+    bg_progress.done = 0;
+    bg_progress.result = -1;
+    bg_progress.total = ram_bytes_total();
+    QTAILQ_FOREACH(h, &background_save_handlers, next) {
+        bg_progress.total += h->prepare(h->opaque, !exit_after);
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        if (fds[0] >= 0) {
+            close(fds[0]);
+        }
+        savevm_background_child(bs, sn, old_sn, must_delete, fds[1],
+                                exit_after);
+    }
+    if (fds[1] >= 0) {
+        close(fds[1]);
+    }
+    if (pid < 0) {
+        monitor_printf(err, "Could not fork: %s\n", strerror(errno));
+        if (fds[0] >= 0) {
+            close(fds[0]);
+        }
+        QTAILQ_FOREACH(h, &background_save_handlers, next) {
+            h->finish(h->opaque);
+        }
+        if (saved_vm_running)
+            vm_start();
+        return -1;
+    }
+
+    if (exit_after) {
+        /* The child keeps using the images once we are gone. */
+        filelock_transfer_all(pid);
+        return 0;
+    }
+
+    bg_save.pid = pid;
+    bg_save.fd = fds[0];
+    pstrcpy(bg_save.name, sizeof(bg_save.name), sn->name);
+    bg_save.progress = bg_progress;
+    bg_save.start_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    fcntl(bg_save.fd, F_SETFL, O_NONBLOCK);
+    qemu_set_fd_handler(bg_save.fd, savevm_background_read, NULL, NULL);
+
+    if (saved_vm_running)
+        vm_start();
+    return 0;
+}
+
+void savevm_background_wait(void)
+{
+    int flags;
+
+    if (!bg_save.pid) {
+        return;
+    }
+    fprintf(stderr, "Waiting for snapshot '%s' to be saved...\n",
+            bg_save.name);
+    flags = fcntl(bg_save.fd, F_GETFL);
+    fcntl(bg_save.fd, F_SETFL, flags & ~O_NONBLOCK);
+    while (bg_save.pid) {
+        savevm_background_read(NULL);
+    }
+}
+
+#else  /* _WIN32 */
+
+int do_savevm_background(Monitor *err, const char *name, bool exit_after)
+{
+    monitor_printf(err, "Background snapshots are not supported on Windows\n");
+    return -1;
+}
+
+void savevm_background_wait(void)
+{
+}
+
+#endif  /* _WIN32 */
+
+void do_info_savevm_background(Monitor *out)
+{
+    const BackgroundSaveProgress *p = &bg_save.progress;
+
+    if (bg_save.pid) {
+        monitor_printf(out, "saving '%s': %d%% (%lld of %lld MB), %.1f s\n",
+                       bg_save.name,
+                       p->total ? (int)(100 * p->done / p->total) : 0,
+                       (long long)(p->done >> 20), (long long)(p->total >> 20),
+                       (qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                        bg_save.start_ms) / 1000.);
+    } else if (bg_save.status < 0) {
+        monitor_printf(out, "no background snapshot\n");
+    } else {
+        monitor_printf(out, "saved '%s' in %.1f s: %s\n", bg_save.name,
+                       (bg_save.end_ms - bg_save.start_ms) / 1000.,
+                       bg_save.status == 0 ? "done" :
+                       bg_save.status == 1 ? "failed" : "result unknown");
+    }
+}
+
+int do_loadvm(Monitor *err, const char *name)
 {
     BlockDriverState *bs, *bs1;
     BlockDriverInfo bdi1, *bdi = &bdi1;
@@ -2586,11 +2944,16 @@ void do_loadvm(Monitor *err, const char *name)
     QEMUFile *f;
     int ret;
     int saved_vm_running;
+    int result = -1;
+
+    if (savevm_background_busy(err)) {
+        return -1;
+    }
 
     bs = bdrv_snapshots();
     if (!bs) {
         monitor_printf(err, "No block device supports snapshots\n");
-        return;
+        return -1;
     }
 
     /* Flush all IO requests so they don't interfere with the new state.  */
@@ -2632,7 +2995,7 @@ void do_loadvm(Monitor *err, const char *name)
     if (bdrv_get_info(bs, bdi) < 0 || bdi->vm_state_offset <= 0) {
         monitor_printf(err, "Device %s does not support VM state snapshots\n",
                        bdrv_get_device_name(bs));
-        return;
+        return -1;
     }
 
     /* Don't even try to load empty VM states */
@@ -2646,14 +3009,23 @@ void do_loadvm(Monitor *err, const char *name)
         monitor_printf(err, "Could not open VM state file\n");
         goto the_end;
     }
+#ifdef CONFIG_LINUX_AIO
+    laio_unregister_ram();
+#endif
     ret = qemu_loadvm_state(f);
+#ifdef CONFIG_LINUX_AIO
+    laio_register_ram();
+#endif
     qemu_fclose(f);
     if (ret < 0) {
         monitor_printf(err, "Error %d while loading VM state\n", ret);
+    } else {
+        result = 0;
     }
  the_end:
     if (saved_vm_running)
         vm_start();
+    return result;
 }
 
 void do_delvm(Monitor *err, const char *name)
@@ -2661,6 +3033,10 @@ void do_delvm(Monitor *err, const char *name)
     BlockDriverState *bs, *bs1;
     int ret;
 
+    if (savevm_background_busy(err)) {
+        return;
+    }
+
     bs = bdrv_snapshots();
     if (!bs) {
         monitor_printf(err, "No block device supports snapshots\n");
@@ -2691,6 +3067,10 @@ void do_info_snapshots(Monitor* out, Monitor* err)
     int nb_sns, i;
     char buf[256];
 
+    if (savevm_background_busy(err)) {
+        return;
+    }
+
     bs = bdrv_snapshots();
     if (!bs) {
         monitor_printf(err, "No available block device supports snapshots\n");
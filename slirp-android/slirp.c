@@ -69,6 +69,7 @@ static const uint8_t zero_ethaddr[6] = { 0, 0, 0, 0, 0, 0 };
 const char *slirp_special_ip = CTL_SPECIAL;
 int slirp_restrict;
 static int do_slowtimo;
+static u_int udp_next_expire;  /* earliest UDP socket expiration, or 0 */
 int link_up;
 struct timeval tt;
 FILE *lfd;
@@ -302,9 +303,7 @@ void slirp_select_fill(int *pnfds,
                        fd_set *readfds, fd_set *writefds, fd_set *xfds)
 {
     struct socket *so, *so_next;
-    struct timeval timeout;
     int nfds;
-    int tmp_time;
 
     /* fail safe */
     global_readfds = NULL;
@@ -316,6 +315,7 @@ void slirp_select_fill(int *pnfds,
 	 * First, TCP sockets
 	 */
 	do_slowtimo = 0;
+	udp_next_expire = 0;
 	if (link_up) {
 		/*
 		 * *_slowtimo needs calling if there are IP fragments
@@ -400,8 +400,10 @@ void slirp_select_fill(int *pnfds,
 				if (so->so_expire <= curtime) {
 					udp_detach(so);
 					continue;
-				} else
-					do_slowtimo = 1; /* Let socket expire */
+				}
+				/* Let socket expire */
+				if (udp_next_expire == 0 || so->so_expire < udp_next_expire)
+					udp_next_expire = so->so_expire;
 			}
 
 			/*
@@ -421,39 +423,6 @@ void slirp_select_fill(int *pnfds,
 		}
 	}
 
-	/*
-	 * Setup timeout to use minimum CPU usage, especially when idle
-	 */
-
-	/*
-	 * First, see the timeout needed by *timo
-	 */
-	timeout.tv_sec = 0;
-	timeout.tv_usec = -1;
-	/*
-	 * If a slowtimo is needed, set timeout to 500ms from the last
-	 * slow timeout. If a fast timeout is needed, set timeout within
-	 * 200ms of when it was requested.
-	 */
-	if (do_slowtimo) {
-		/* XXX + 10000 because some select()'s aren't that accurate */
-		timeout.tv_usec = ((500 - (curtime - last_slowtimo)) * 1000) + 10000;
-		if (timeout.tv_usec < 0)
-		   timeout.tv_usec = 0;
-		else if (timeout.tv_usec > 510000)
-		   timeout.tv_usec = 510000;
-
-		/* Can only fasttimo if we also slowtimo */
-		if (time_fasttimo) {
-			tmp_time = (200 - (curtime - time_fasttimo)) * 1000;
-			if (tmp_time < 0)
-			   tmp_time = 0;
-
-			/* Choose the smallest of the 2 */
-			if (tmp_time < timeout.tv_usec)
-			   timeout.tv_usec = (u_int)tmp_time;
-		}
-	}
     /*
      * now, the proxified sockets
      */
@@ -462,6 +431,31 @@ void slirp_select_fill(int *pnfds,
         *pnfds = nfds;
 }
 
+/*
+ * Lower *timeout (in milliseconds) to the next TCP or IP reassembly timer,
+ * or UDP socket expiration, instead of waking up the main loop periodically
+ * for them. Must be called after slirp_select_fill().
+ */
+void slirp_update_timeout(int *timeout)
+{
+	int t = *timeout;
+
+	if (!link_up)
+		return;
+
+	updtime();
+	if (do_slowtimo) {
+		if (499 - (int)(curtime - last_slowtimo) < t)
+			t = 499 - (int)(curtime - last_slowtimo);
+		if (time_fasttimo && 2 - (int)(curtime - time_fasttimo) < t)
+			t = 2 - (int)(curtime - time_fasttimo);
+	}
+	if (udp_next_expire && (int)(udp_next_expire - curtime) < t)
+		t = (int)(udp_next_expire - curtime);
+
+	*timeout = (t < 0) ? 0 : t;
+}
+
 void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
 {
     struct socket *so, *so_next;
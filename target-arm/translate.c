@@ -58,6 +58,8 @@ typedef struct DisasContext {
     int condexec_mask;
     int condexec_cond;
     struct TranslationBlock *tb;
+    /* Mask of the goto_tb exits already used by this TB.  */
+    int goto_tb_used;
     int singlestep_enabled;
     int thumb;
 #if !defined(CONFIG_USER_ONLY)
@@ -110,6 +112,7 @@ void arm_translate_init(void)
     int i;
 
     cpu_env = tcg_global_reg_new_ptr(TCG_AREG0, "env");
+    tcg_ctx.tcg_env = cpu_env;
 
     for (i = 0; i < 16; i++) {
         cpu_R[i] = tcg_global_mem_new_i32(TCG_AREG0,
@@ -720,7 +723,7 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
 {
     TCGv tmp;
 
-    s->is_jmp = DISAS_UPDATE;
+    s->is_jmp = DISAS_JUMP;
     if (s->thumb != (addr & 1)) {
         tmp = tcg_temp_new_i32();
         tcg_gen_movi_i32(tmp, addr & 1);
@@ -733,7 +736,7 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
 /* Set PC and Thumb state from var.  var is marked as dead.  */
 static inline void gen_bx(DisasContext *s, TCGv var)
 {
-    s->is_jmp = DISAS_UPDATE;
+    s->is_jmp = DISAS_JUMP;
     tcg_gen_andi_i32(cpu_R[15], var, ~1);
     tcg_gen_andi_i32(var, var, 1);
     store_cpu_field(var, thumb);
@@ -3498,18 +3501,38 @@ static int disas_vfp_insn(CPUARMState * env, DisasContext *s, uint32_t insn)
     return 0;
 }
 
+/* End the TB with a jump to the PC already stored in the CPU state.
+   The next TB is looked up from translated code, and we only go back
+   to the main loop when it isn't found.  */
+static inline void gen_lookup_and_goto_ptr(void)
+{
+#if TCG_TARGET_HAS_goto_ptr
+    if (!tb_no_goto_ptr) {
+        TCGv_ptr ptr = tcg_temp_new_ptr();
+        gen_helper_lookup_tb_ptr(ptr, cpu_env);
+        tcg_gen_goto_ptr(ptr);
+        tcg_temp_free_ptr(ptr);
+        return;
+    }
+#endif
+    tcg_gen_exit_tb(0);
+}
+
 static inline void gen_goto_tb(DisasContext *s, int n, uint32_t dest)
 {
     TranslationBlock *tb;
 
     tb = s->tb;
-    if ((tb->pc & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK)) {
+    /* A superblock can have more exits than there are goto_tb slots.  */
+    if ((tb->pc & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK) &&
+        !(s->goto_tb_used & (1 << n))) {
+        s->goto_tb_used |= 1 << n;
         tcg_gen_goto_tb(n);
         gen_set_pc_im(dest);
         tcg_gen_exit_tb((tcg_target_long)tb + n);
     } else {
         gen_set_pc_im(dest);
-        tcg_gen_exit_tb(0);
+        gen_lookup_and_goto_ptr();
     }
 }
 
@@ -4489,6 +4512,47 @@ static const uint8_t neon_2rm_sizes[] = {
    We process data in a mixture of 32-bit and 64-bit chunks.
    Mostly we use 32-bit chunks so we can use normal scalar instructions.  */
 
+/* Emit the three registers same length operation OP on whole D or Q
+   registers as a single vector operation, when there is one.  Return
+   false if the operation must be done one element at a time.  */
+static bool gen_neon_3reg_same_vec(int op, int u, int size, int q,
+                                   int rd, int rn, int rm)
+{
+    uint32_t oprsz = q ? 16 : 8;
+    uint32_t dofs = vfp_reg_offset(1, rd);
+    uint32_t aofs = vfp_reg_offset(1, rn);
+    uint32_t bofs = vfp_reg_offset(1, rm);
+
+    switch (op) {
+    case NEON_3R_LOGIC:
+        switch ((u << 2) | size) {
+        case 0: /* VAND */
+            return tcg_gen_gvec_and(oprsz, dofs, aofs, bofs);
+        case 1: /* VBIC */
+            return tcg_gen_gvec_andc(oprsz, dofs, aofs, bofs);
+        case 2: /* VORR */
+            return tcg_gen_gvec_or(oprsz, dofs, aofs, bofs);
+        case 4: /* VEOR */
+            return tcg_gen_gvec_xor(oprsz, dofs, aofs, bofs);
+        default:
+            return false;
+        }
+    case NEON_3R_VADD_VSUB:
+        if (u) {
+            return tcg_gen_gvec_sub(size, oprsz, dofs, aofs, bofs);
+        }
+        return tcg_gen_gvec_add(size, oprsz, dofs, aofs, bofs);
+    case NEON_3R_VTST_VCEQ:
+        return u && tcg_gen_gvec_cmpeq(size, oprsz, dofs, aofs, bofs);
+    case NEON_3R_VCGT:
+        /* There is no unsigned compare on the host.  */
+        return !u && tcg_gen_gvec_cmpgt(size, oprsz, dofs, aofs, bofs);
+    default:
+        /* The saturating ops must also set QC, so they stay in helpers.  */
+        return false;
+    }
+}
+
 static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t insn)
 {
     int op;
@@ -4525,6 +4589,9 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
         if (q && ((rd | rn | rm) & 1)) {
             return 1;
         }
+        if (gen_neon_3reg_same_vec(op, u, size, q, rd, rn, rm)) {
+            return 0;
+        }
         if (size == 3 && op != NEON_3R_LOGIC) {
             /* 64-bit element instructions. */
             for (pass = 0; pass < (q ? 2 : 1); pass++) {
@@ -9706,6 +9773,7 @@ static inline void gen_intermediate_code_internal(CPUARMState *env,
 
     dc->is_jmp = DISAS_NEXT;
     dc->pc = pc_start;
+    dc->goto_tb_used = 0;
     dc->singlestep_enabled = ENV_GET_CPU(env)->singlestep_enabled;
     dc->condjmp = 0;
     dc->thumb = ARM_TBFLAG_THUMB(tb->flags);
@@ -9845,6 +9913,13 @@ static inline void gen_intermediate_code_internal(CPUARMState *env,
         if (dc->condjmp && !dc->is_jmp) {
             gen_set_label(dc->condlabel);
             dc->condjmp = 0;
+        } else if (dc->condjmp && dc->is_jmp == DISAS_TB_JUMP &&
+                   tb_superblocks && !use_icount && !dc->condexec_mask) {
+            /* Superblock: the conditional branch left the TB when taken,
+               go on translating its fallthrough path in the same TB.  */
+            gen_set_label(dc->condlabel);
+            dc->condjmp = 0;
+            dc->is_jmp = DISAS_NEXT;
         }
 
         if (tcg_check_temp_count()) {
@@ -9915,10 +9990,14 @@ static inline void gen_intermediate_code_internal(CPUARMState *env,
         case DISAS_NEXT:
             gen_goto_tb(dc, 1, dc->pc);
             break;
-        default:
         case DISAS_JUMP:
+            /* indirect branch: look up the next TB from translated code */
+            gen_lookup_and_goto_ptr();
+            break;
+        default:
         case DISAS_UPDATE:
-            /* indicate that the hash table must be used to find the next TB */
+            /* the CPU state changed in a way that may unmask interrupts,
+               go back to the main loop to find the next TB */
             tcg_gen_exit_tb(0);
             break;
         case DISAS_TB_JUMP:
@@ -133,6 +133,7 @@ typedef struct DisasContext {
 } DisasContext;
 
 static void gen_eob(DisasContext *s);
+static void gen_jr(DisasContext *s);
 static void gen_jmp(DisasContext *s, target_ulong eip);
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num);
 
@@ -2476,9 +2477,9 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
         gen_jmp_im(eip);
         tcg_gen_exit_tb((uintptr_t)tb + tb_num);
     } else {
-        /* jump to another page: currently not optimized */
+        /* jump to another page: look the next TB up at runtime */
         gen_jmp_im(eip);
-        gen_eob(s);
+        gen_jr(s);
     }
 }
 
@@ -2863,9 +2864,27 @@ static void gen_debug(DisasContext *s, target_ulong cur_eip)
     s->is_jmp = 3;
 }
 
+/* End the TB with a jump to the EIP already stored in the CPU state.
+   The next TB is looked up from translated code, and we only go back
+   to the main loop when it isn't found.  */
+static inline void gen_lookup_and_goto_ptr(void)
+{
+#if TCG_TARGET_HAS_goto_ptr
+    if (!tb_no_goto_ptr) {
+        TCGv_ptr ptr = tcg_temp_new_ptr();
+        gen_helper_lookup_tb_ptr(ptr, cpu_env);
+        tcg_gen_goto_ptr(ptr);
+        tcg_temp_free_ptr(ptr);
+        return;
+    }
+#endif
+    tcg_gen_exit_tb(0);
+}
+
 /* generate a generic end of block. Trace exception is also generated
-   if needed */
-static void gen_eob(DisasContext *s)
+   if needed. If 'jr' is true, the next TB is looked up directly instead
+   of returning to the main loop. */
+static void gen_eob_worker(DisasContext *s, bool jr)
 {
     gen_update_cc_op(s);
     if (s->tb->flags & HF_INHIBIT_IRQ_MASK) {
@@ -2878,12 +2897,25 @@ static void gen_eob(DisasContext *s)
         gen_helper_debug(cpu_env);
     } else if (s->tf) {
 	gen_helper_single_step(cpu_env);
+    } else if (jr) {
+        gen_lookup_and_goto_ptr();
     } else {
         tcg_gen_exit_tb(0);
     }
     s->is_jmp = 3;
 }
 
+static void gen_eob(DisasContext *s)
+{
+    gen_eob_worker(s, false);
+}
+
+/* generate an end of block for an indirect jump to the current EIP */
+static void gen_jr(DisasContext *s)
+{
+    gen_eob_worker(s, true);
+}
+
 /* generate a jump to eip. No segment change must happen before as a
    direct call to the next block may occur */
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num)
@@ -3280,6 +3312,43 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0x63] = SSE42_OP(pcmpistri),
 };
 
+/* Emit the MMX or SSE integer operation B on the OPRSZ bytes at DOFS and
+   AOFS as a host vector operation.  Return false if it must be done by
+   the sse_op_table1 helper instead.  */
+static bool gen_sse_vec(int b, uint32_t oprsz, int dofs, int aofs)
+{
+    switch (b) {
+    case 0xfc ... 0xfe: /* paddb, paddw, paddl */
+        return tcg_gen_gvec_add(b - 0xfc, oprsz, dofs, dofs, aofs);
+    case 0xd4: /* paddq */
+        return tcg_gen_gvec_add(MO_64, oprsz, dofs, dofs, aofs);
+    case 0xf8 ... 0xfb: /* psubb, psubw, psubl, psubq */
+        return tcg_gen_gvec_sub(b - 0xf8, oprsz, dofs, dofs, aofs);
+    case 0xdb: /* pand */
+        return tcg_gen_gvec_and(oprsz, dofs, dofs, aofs);
+    case 0xdf: /* pandn */
+        return tcg_gen_gvec_andc(oprsz, dofs, aofs, dofs);
+    case 0xeb: /* por */
+        return tcg_gen_gvec_or(oprsz, dofs, dofs, aofs);
+    case 0xef: /* pxor */
+        return tcg_gen_gvec_xor(oprsz, dofs, dofs, aofs);
+    case 0xec ... 0xed: /* paddsb, paddsw */
+        return tcg_gen_gvec_ssadd(b - 0xec, oprsz, dofs, dofs, aofs);
+    case 0xdc ... 0xdd: /* paddusb, paddusw */
+        return tcg_gen_gvec_usadd(b - 0xdc, oprsz, dofs, dofs, aofs);
+    case 0xe8 ... 0xe9: /* psubsb, psubsw */
+        return tcg_gen_gvec_sssub(b - 0xe8, oprsz, dofs, dofs, aofs);
+    case 0xd8 ... 0xd9: /* psubusb, psubusw */
+        return tcg_gen_gvec_ussub(b - 0xd8, oprsz, dofs, dofs, aofs);
+    case 0x74 ... 0x76: /* pcmpeqb, pcmpeqw, pcmpeql */
+        return tcg_gen_gvec_cmpeq(b - 0x74, oprsz, dofs, dofs, aofs);
+    case 0x64 ... 0x66: /* pcmpgtb, pcmpgtw, pcmpgtl */
+        return tcg_gen_gvec_cmpgt(b - 0x64, oprsz, dofs, dofs, aofs);
+    default:
+        return false;
+    }
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -3635,6 +3704,45 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
 	        goto illegal_op;
             }
             val = cpu_ldub_code(env, s->pc++);
+            sse_fn_epp = sse_op_table2[((b - 1) & 3) * 8 +
+                                       (((modrm >> 3)) & 7)][b1];
+            if (!sse_fn_epp) {
+                goto illegal_op;
+            }
+            if (is_xmm) {
+                rm = (modrm & 7) | REX_B(s);
+                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
+            } else {
+                rm = (modrm & 7);
+                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
+            }
+            {
+                /* psrlX, psraX and psllX on words, longs and quads */
+                TCGMemOp vece = MO_16 + ((b - 1) & 3);
+                uint32_t oprsz = is_xmm ? 16 : 8;
+                bool done;
+
+                switch ((modrm >> 3) & 7) {
+                case 2:
+                    done = tcg_gen_gvec_shri(vece, oprsz, op2_offset,
+                                             op2_offset, val);
+                    break;
+                case 4:
+                    done = tcg_gen_gvec_sari(vece, oprsz, op2_offset,
+                                             op2_offset, val);
+                    break;
+                case 6:
+                    done = tcg_gen_gvec_shli(vece, oprsz, op2_offset,
+                                             op2_offset, val);
+                    break;
+                default:
+                    done = false;
+                    break;
+                }
+                if (done) {
+                    break;
+                }
+            }
             if (is_xmm) {
                 gen_op_movl_T0_im(val);
                 tcg_gen_st32_tl(cpu_T[0], cpu_env, offsetof(CPUX86State,xmm_t0.XMM_L(0)));
@@ -3648,18 +3756,6 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                 tcg_gen_st32_tl(cpu_T[0], cpu_env, offsetof(CPUX86State,mmx_t0.MMX_L(1)));
                 op1_offset = offsetof(CPUX86State,mmx_t0);
             }
-            sse_fn_epp = sse_op_table2[((b - 1) & 3) * 8 +
-                                       (((modrm >> 3)) & 7)][b1];
-            if (!sse_fn_epp) {
-                goto illegal_op;
-            }
-            if (is_xmm) {
-                rm = (modrm & 7) | REX_B(s);
-                op2_offset = offsetof(CPUX86State,xmm_regs[rm]);
-            } else {
-                rm = (modrm & 7);
-                op2_offset = offsetof(CPUX86State,fpregs[rm].mmx);
-            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op2_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op1_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4253,6 +4349,10 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (b1 < 2 && gen_sse_vec(b, is_xmm ? 16 : 8,
+                                      op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4826,7 +4926,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s, target_ulong p
             gen_movtl_T1_im(next_eip);
             gen_push_T1(s);
             gen_op_jmp_T0();
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 3: /* lcall Ev */
             gen_op_ld_T1_A0(ot + s->mem_index);
@@ -4852,7 +4952,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s, target_ulong p
             if (s->dflag == 0)
                 gen_op_andl_T0_ffff();
             gen_op_jmp_T0();
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 5: /* ljmp Ev */
             gen_op_ld_T1_A0(ot + s->mem_index);
@@ -6366,7 +6466,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s, target_ulong p
         if (s->dflag == 0)
             gen_op_andl_T0_ffff();
         gen_op_jmp_T0();
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xc3: /* ret */
         gen_pop_T0(s);
@@ -6374,7 +6474,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s, target_ulong p
         if (s->dflag == 0)
             gen_op_andl_T0_ffff();
         gen_op_jmp_T0();
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xca: /* lret im */
         val = cpu_ldsw_code(env, s->pc);
@@ -7753,6 +7853,7 @@ void optimize_flags_init(void)
     assert(sizeof(CCTable) == (1 << 4));
 #endif
     cpu_env = tcg_global_reg_new_ptr(TCG_AREG0, "env");
+    tcg_ctx.tcg_env = cpu_env;
     cpu_cc_op = tcg_global_mem_new_i32(TCG_AREG0,
                                        offsetof(CPUX86State, cc_op), "cc_op");
     cpu_cc_src = tcg_global_mem_new(TCG_AREG0, offsetof(CPUX86State, cc_src),
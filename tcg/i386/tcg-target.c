@@ -137,6 +137,7 @@ static bool have_movbe;
 /* We need this symbol in tcg-target.h, and we can't properly conditionalize
    it there.  Therefore we always define the variable.  */
 bool have_bmi1;
+bool have_sse2;
 
 #if defined(CONFIG_CPUID_H) && defined(bit_BMI2)
 static bool have_bmi2;
@@ -311,6 +312,7 @@ static inline int tcg_target_const_match(tcg_target_long val,
 #define OPC_ARITH_GvEv	(0x03)		/* ... plus (ARITH_FOO << 3) */
 #define OPC_ANDN        (0xf2 | P_EXT38)
 #define OPC_ADD_GvEv	(OPC_ARITH_GvEv | (ARITH_ADD << 3))
+#define OPC_AND_GvEv	(OPC_ARITH_GvEv | (ARITH_AND << 3))
 #define OPC_BSWAP	(0xc8 | P_EXT)
 #define OPC_CALL_Jz	(0xe8)
 #define OPC_CMOVCC      (0x40 | P_EXT)  /* ... plus condition code */
@@ -353,6 +355,40 @@ static inline int tcg_target_const_match(tcg_target_long val,
 #define OPC_TESTL	(0x85)
 #define OPC_XCHG_ax_r32	(0x90)
 
+#define OPC_MOVDQU_VxWx (0x6f | P_EXT | P_SIMDF3)
+#define OPC_MOVDQU_WxVx (0x7f | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_VqWq   (0x7e | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_WqVq   (0xd6 | P_EXT | P_DATA16)
+#define OPC_PADDB       (0xfc | P_EXT | P_DATA16)
+#define OPC_PADDW       (0xfd | P_EXT | P_DATA16)
+#define OPC_PADDD       (0xfe | P_EXT | P_DATA16)
+#define OPC_PADDQ       (0xd4 | P_EXT | P_DATA16)
+#define OPC_PADDSB      (0xec | P_EXT | P_DATA16)
+#define OPC_PADDSW      (0xed | P_EXT | P_DATA16)
+#define OPC_PADDUB      (0xdc | P_EXT | P_DATA16)
+#define OPC_PADDUW      (0xdd | P_EXT | P_DATA16)
+#define OPC_PAND        (0xdb | P_EXT | P_DATA16)
+#define OPC_PANDN       (0xdf | P_EXT | P_DATA16)
+#define OPC_PCMPEQB     (0x74 | P_EXT | P_DATA16)
+#define OPC_PCMPEQW     (0x75 | P_EXT | P_DATA16)
+#define OPC_PCMPEQD     (0x76 | P_EXT | P_DATA16)
+#define OPC_PCMPGTB     (0x64 | P_EXT | P_DATA16)
+#define OPC_PCMPGTW     (0x65 | P_EXT | P_DATA16)
+#define OPC_PCMPGTD     (0x66 | P_EXT | P_DATA16)
+#define OPC_POR         (0xeb | P_EXT | P_DATA16)
+#define OPC_PSHIFTW_Ib  (0x71 | P_EXT | P_DATA16) /* /2 /6 /4 */
+#define OPC_PSHIFTD_Ib  (0x72 | P_EXT | P_DATA16) /* /2 /6 /4 */
+#define OPC_PSHIFTQ_Ib  (0x73 | P_EXT | P_DATA16) /* /2 /6 */
+#define OPC_PSUBB       (0xf8 | P_EXT | P_DATA16)
+#define OPC_PSUBW       (0xf9 | P_EXT | P_DATA16)
+#define OPC_PSUBD       (0xfa | P_EXT | P_DATA16)
+#define OPC_PSUBQ       (0xfb | P_EXT | P_DATA16)
+#define OPC_PSUBSB      (0xe8 | P_EXT | P_DATA16)
+#define OPC_PSUBSW      (0xe9 | P_EXT | P_DATA16)
+#define OPC_PSUBUB      (0xd8 | P_EXT | P_DATA16)
+#define OPC_PSUBUW      (0xd9 | P_EXT | P_DATA16)
+#define OPC_PXOR        (0xef | P_EXT | P_DATA16)
+
 #define OPC_GRP3_Ev	(0xf7)
 #define OPC_GRP5	(0xff)
 
@@ -388,6 +424,15 @@ static inline int tcg_target_const_match(tcg_target_long val,
 #define EXT5_CALLN_Ev	2
 #define EXT5_JMPN_Ev	4
 
+/* Group 12-14 opcode extensions for OPC_PSHIFT{W,D,Q}_Ib.  */
+#define EXT_PSHIFT_SRL  2
+#define EXT_PSHIFT_SRA  4
+#define EXT_PSHIFT_SLL  6
+
+/* SSE registers used by the vector ops, as encoded in the modrm byte.  */
+#define TCG_XMM0        0
+#define TCG_XMM1        1
+
 /* Condition codes to be added to OPC_JCC_{long,short}.  */
 #define JCC_JMP (-1)
 #define JCC_JO  0x0
@@ -436,6 +481,11 @@ static void tcg_out_opc(TCGContext *s, int opc, int r, int rm, int x)
     if (opc & P_ADDR32) {
         tcg_out8(s, 0x67);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
 
     rex = 0;
     rex |= (opc & P_REXW) ? 0x8 : 0x0;  /* REX.W */
@@ -469,6 +519,11 @@ static void tcg_out_opc(TCGContext *s, int opc)
     if (opc & P_DATA16) {
         tcg_out8(s, 0x66);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
     if (opc & (P_EXT | P_EXT38)) {
         tcg_out8(s, 0x0f);
         if (opc & P_EXT38) {
@@ -1203,15 +1258,16 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     tgen_arithi(s, ARITH_AND + trexw, r1,
                 TARGET_PAGE_MASK | ((1 << s_bits) - 1), 0);
-    tgen_arithi(s, ARITH_AND + hrexw, r0,
-                (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS, 0);
+    /* The TLB size is dynamic, see tlb_mmu_resize() in cputlb.c.  */
+    /* and tlb_mask[mem_index](env), r0 */
+    tcg_out_modrm_offset(s, OPC_AND_GvEv + hrexw, r0, TCG_AREG0,
+                         offsetof(CPUArchState, tlb_mask[mem_index]));
+    /* add tlb_table[mem_index](env), r0 */
+    tcg_out_modrm_offset(s, OPC_ADD_GvEv + hrexw, r0, TCG_AREG0,
+                         offsetof(CPUArchState, tlb_table[mem_index]));
 
-    tcg_out_modrm_sib_offset(s, OPC_LEA + hrexw, r0, TCG_AREG0, r0, 0,
-                             offsetof(CPUArchState, tlb_table[mem_index][0])
-                             + which);
-
-    /* cmp 0(r0), r1 */
-    tcg_out_modrm_offset(s, OPC_CMP_GvEv + trexw, r1, r0, 0);
+    /* cmp which(r0), r1 */
+    tcg_out_modrm_offset(s, OPC_CMP_GvEv + trexw, r1, r0, which);
 
     /* Prepare for both the fast path add of the tlb addend, and the slow
        path function argument setup.  There are two cases worth note:
@@ -1227,8 +1283,8 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
     s->code_ptr += 4;
 
     if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-        /* cmp 4(r0), addrhi */
-        tcg_out_modrm_offset(s, OPC_CMP_GvEv, addrhi, r0, 4);
+        /* cmp which+4(r0), addrhi */
+        tcg_out_modrm_offset(s, OPC_CMP_GvEv, addrhi, r0, which + 4);
 
         /* jne slow_path */
         tcg_out_opc(s, OPC_JCC_long + JCC_JNE, 0, 0, 0);
@@ -1240,7 +1296,7 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     /* add addend(r0), r1 */
     tcg_out_modrm_offset(s, OPC_ADD_GvEv + hrexw, r1, r0,
-                         offsetof(CPUTLBEntry, addend) - which);
+                         offsetof(CPUTLBEntry, addend));
 }
 
 /*
@@ -1717,6 +1773,127 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args, bool is64)
 #endif
 }
 
+/* Return true if the vector op OPC can be emitted for elements of size
+   VECE.  SSE2 lacks the saturating ops on 32/64-bit elements, the 64-bit
+   compares, and the 8-bit and 64-bit arithmetic shifts.  */
+static bool tcg_can_emit_vec_op(TCGOpcode opc, TCGMemOp vece)
+{
+    switch (opc) {
+    case INDEX_op_add_vec:
+    case INDEX_op_sub_vec:
+    case INDEX_op_and_vec:
+    case INDEX_op_andc_vec:
+    case INDEX_op_or_vec:
+    case INDEX_op_xor_vec:
+        return true;
+    case INDEX_op_ssadd_vec:
+    case INDEX_op_usadd_vec:
+    case INDEX_op_sssub_vec:
+    case INDEX_op_ussub_vec:
+        return vece <= MO_16;
+    case INDEX_op_cmpeq_vec:
+    case INDEX_op_cmpgt_vec:
+        return vece <= MO_32;
+    case INDEX_op_shli_vec:
+    case INDEX_op_shri_vec:
+        return vece >= MO_16;
+    case INDEX_op_sari_vec:
+        return vece == MO_16 || vece == MO_32;
+    default:
+        return false;
+    }
+}
+
+/* Vector ops work on guest state in memory: the operands are loaded into
+   %xmm0 and %xmm1, which TCG doesn't otherwise use, and the result is
+   stored back from %xmm0.  */
+static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc, const TCGArg *args)
+{
+    static const int add_insn[4] = {
+        OPC_PADDB, OPC_PADDW, OPC_PADDD, OPC_PADDQ
+    };
+    static const int sub_insn[4] = {
+        OPC_PSUBB, OPC_PSUBW, OPC_PSUBD, OPC_PSUBQ
+    };
+    static const int ssadd_insn[2] = { OPC_PADDSB, OPC_PADDSW };
+    static const int usadd_insn[2] = { OPC_PADDUB, OPC_PADDUW };
+    static const int sssub_insn[2] = { OPC_PSUBSB, OPC_PSUBSW };
+    static const int ussub_insn[2] = { OPC_PSUBUB, OPC_PSUBUW };
+    static const int cmpeq_insn[3] = { OPC_PCMPEQB, OPC_PCMPEQW, OPC_PCMPEQD };
+    static const int cmpgt_insn[3] = { OPC_PCMPGTB, OPC_PCMPGTW, OPC_PCMPGTD };
+    static const int shift_insn[4] = {
+        0, OPC_PSHIFTW_Ib, OPC_PSHIFTD_Ib, OPC_PSHIFTQ_Ib
+    };
+    TCGMemOp vece = args[0];
+    intptr_t dofs = args[2], aofs = args[3], bofs = args[4];
+    int ld = args[1] == 16 ? OPC_MOVDQU_VxWx : OPC_MOVQ_VqWq;
+    int st = args[1] == 16 ? OPC_MOVDQU_WxVx : OPC_MOVQ_WqVq;
+    int insn, ext;
+
+    switch (opc) {
+    case INDEX_op_shli_vec:
+        ext = EXT_PSHIFT_SLL;
+        goto do_shift;
+    case INDEX_op_shri_vec:
+        ext = EXT_PSHIFT_SRL;
+        goto do_shift;
+    case INDEX_op_sari_vec:
+        ext = EXT_PSHIFT_SRA;
+    do_shift:
+        tcg_out_modrm_offset(s, ld, TCG_XMM0, TCG_AREG0, aofs);
+        tcg_out_modrm(s, shift_insn[vece], ext, TCG_XMM0);
+        tcg_out8(s, bofs);
+        tcg_out_modrm_offset(s, st, TCG_XMM0, TCG_AREG0, dofs);
+        return;
+    case INDEX_op_andc_vec:
+        /* pandn computes ~xmm0 & xmm1.  */
+        tcg_out_modrm_offset(s, ld, TCG_XMM0, TCG_AREG0, bofs);
+        tcg_out_modrm_offset(s, ld, TCG_XMM1, TCG_AREG0, aofs);
+        tcg_out_modrm(s, OPC_PANDN, TCG_XMM0, TCG_XMM1);
+        tcg_out_modrm_offset(s, st, TCG_XMM0, TCG_AREG0, dofs);
+        return;
+    case INDEX_op_add_vec:
+        insn = add_insn[vece];
+        break;
+    case INDEX_op_sub_vec:
+        insn = sub_insn[vece];
+        break;
+    case INDEX_op_and_vec:
+        insn = OPC_PAND;
+        break;
+    case INDEX_op_or_vec:
+        insn = OPC_POR;
+        break;
+    case INDEX_op_xor_vec:
+        insn = OPC_PXOR;
+        break;
+    case INDEX_op_ssadd_vec:
+        insn = ssadd_insn[vece];
+        break;
+    case INDEX_op_usadd_vec:
+        insn = usadd_insn[vece];
+        break;
+    case INDEX_op_sssub_vec:
+        insn = sssub_insn[vece];
+        break;
+    case INDEX_op_ussub_vec:
+        insn = ussub_insn[vece];
+        break;
+    case INDEX_op_cmpeq_vec:
+        insn = cmpeq_insn[vece];
+        break;
+    case INDEX_op_cmpgt_vec:
+        insn = cmpgt_insn[vece];
+        break;
+    default:
+        tcg_abort();
+    }
+    tcg_out_modrm_offset(s, ld, TCG_XMM0, TCG_AREG0, aofs);
+    tcg_out_modrm_offset(s, ld, TCG_XMM1, TCG_AREG0, bofs);
+    tcg_out_modrm(s, insn, TCG_XMM0, TCG_XMM1);
+    tcg_out_modrm_offset(s, st, TCG_XMM0, TCG_AREG0, dofs);
+}
+
 static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
                               const TCGArg *args, const int *const_args)
 {
@@ -1750,6 +1927,27 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         s->tb_next_offset[args[0]] = s->code_ptr - s->code_buf;
         break;
+    case INDEX_op_goto_ptr:
+        /* jmp *reg */
+        tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, args[0]);
+        break;
+    case INDEX_op_add_vec:
+    case INDEX_op_sub_vec:
+    case INDEX_op_and_vec:
+    case INDEX_op_andc_vec:
+    case INDEX_op_or_vec:
+    case INDEX_op_xor_vec:
+    case INDEX_op_ssadd_vec:
+    case INDEX_op_usadd_vec:
+    case INDEX_op_sssub_vec:
+    case INDEX_op_ussub_vec:
+    case INDEX_op_cmpeq_vec:
+    case INDEX_op_cmpgt_vec:
+    case INDEX_op_shli_vec:
+    case INDEX_op_shri_vec:
+    case INDEX_op_sari_vec:
+        tcg_out_vec_op(s, opc, args);
+        break;
     case INDEX_op_call:
         if (const_args[0]) {
             tcg_out_calli(s, args[0]);
@@ -2082,6 +2280,22 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
+    { INDEX_op_add_vec, { } },
+    { INDEX_op_sub_vec, { } },
+    { INDEX_op_and_vec, { } },
+    { INDEX_op_andc_vec, { } },
+    { INDEX_op_or_vec, { } },
+    { INDEX_op_xor_vec, { } },
+    { INDEX_op_ssadd_vec, { } },
+    { INDEX_op_usadd_vec, { } },
+    { INDEX_op_sssub_vec, { } },
+    { INDEX_op_ussub_vec, { } },
+    { INDEX_op_cmpeq_vec, { } },
+    { INDEX_op_cmpgt_vec, { } },
+    { INDEX_op_shli_vec, { } },
+    { INDEX_op_shri_vec, { } },
+    { INDEX_op_sari_vec, { } },
     { INDEX_op_call, { "ri" } },
     { INDEX_op_br, { } },
     { INDEX_op_mov_i32, { "r", "r" } },
@@ -2279,6 +2493,11 @@ static void tcg_target_qemu_prologue(TCGContext *s)
     tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, tcg_target_call_iarg_regs[1]);
 #endif
 
+    /* Return path for goto_ptr.  Set the return value to 0, as exit_tb
+       would, and fall through to the rest of the epilogue.  */
+    s->code_gen_epilogue = s->code_ptr;
+    tcg_out_movi(s, TCG_TYPE_REG, TCG_REG_EAX, 0);
+
     /* TB epilogue */
     tb_ret_addr = s->code_ptr;
 
@@ -2299,12 +2518,16 @@ static void tcg_target_qemu_prologue(TCGContext *s)
 
 static void tcg_target_init(TCGContext *s)
 {
+    /* SSE2 is part of the x86-64 baseline.  */
+    have_sse2 = TCG_TARGET_REG_BITS == 64;
+
 #ifdef CONFIG_CPUID_H
         unsigned a, b, c, d;
     int max = __get_cpuid_max(0, 0);
 
     if (max >= 1) {
         __cpuid(1, a, b, c, d);
+        have_sse2 = (d & bit_SSE2) != 0;
 #ifndef have_cmov
         /* For 32-bit, 99% certainty that we're running on hardware that
            supports cmov, but we still need to check.  In case cmov is not
@@ -2647,12 +2647,63 @@ static inline void tcg_gen_goto_tb(unsigned idx)
     tcg_gen_op1i(INDEX_op_goto_tb, idx);
 }
 
+/* Jump to the host code at |addr|, which is either the start of a TB or
+   tcg_ctx.code_gen_epilogue.  Only valid if TCG_TARGET_HAS_goto_ptr.  */
+static inline void tcg_gen_goto_ptr(TCGv_ptr addr)
+{
+    *tcg_ctx.gen_opc_ptr++ = INDEX_op_goto_ptr;
+    *tcg_ctx.gen_opparam_ptr++ = GET_TCGV_PTR(addr);
+}
+
 
 void tcg_gen_qemu_ld_i32(TCGv_i32, TCGv, TCGArg, TCGMemOp);
 void tcg_gen_qemu_st_i32(TCGv_i32, TCGv, TCGArg, TCGMemOp);
 void tcg_gen_qemu_ld_i64(TCGv_i64, TCGv, TCGArg, TCGMemOp);
 void tcg_gen_qemu_st_i64(TCGv_i64, TCGv, TCGArg, TCGMemOp);
 
+/* Element-wise operations on the OPRSZ bytes (8 or 16) of guest state at
+   offsets DOFS, AOFS and BOFS from tcg_ctx.tcg_env, with elements of size
+   VECE (MO_8 to MO_64).  They are emitted as host vector instructions when
+   the backend supports the operation for this element size, else the
+   add, sub and logical ones are expanded with 64-bit integer ops.  They
+   return false if nothing was emitted, and the caller must then use its
+   own helper.  */
+bool tcg_gen_gvec_add(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs);
+bool tcg_gen_gvec_sub(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs);
+bool tcg_gen_gvec_and(uint32_t oprsz, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs);
+bool tcg_gen_gvec_andc(uint32_t oprsz, uint32_t dofs,
+                       uint32_t aofs, uint32_t bofs);
+bool tcg_gen_gvec_or(uint32_t oprsz, uint32_t dofs,
+                     uint32_t aofs, uint32_t bofs);
+bool tcg_gen_gvec_xor(uint32_t oprsz, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs);
+/* Saturating signed and unsigned add and sub.  */
+bool tcg_gen_gvec_ssadd(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs);
+bool tcg_gen_gvec_usadd(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs);
+bool tcg_gen_gvec_sssub(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs);
+bool tcg_gen_gvec_ussub(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs);
+/* Set each element to all ones if A == B (A > B signed), else to 0.  */
+bool tcg_gen_gvec_cmpeq(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs);
+bool tcg_gen_gvec_cmpgt(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs);
+/* Shift each element by the immediate SHIFT, which can be larger than the
+   element size: logical shifts then give 0, and arithmetic ones copies of
+   the sign bit.  */
+bool tcg_gen_gvec_shli(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                       uint32_t aofs, unsigned shift);
+bool tcg_gen_gvec_shri(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                       uint32_t aofs, unsigned shift);
+bool tcg_gen_gvec_sari(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                       uint32_t aofs, unsigned shift);
+
 static inline void tcg_gen_qemu_ld8u(TCGv ret, TCGv addr, int mem_index)
 {
     tcg_gen_qemu_ld_tl(ret, addr, mem_index, MO_UB);
@@ -180,6 +180,31 @@ DEF(debug_insn_start, 0, 0, 1, TCG_OPF_NOT_PRESENT)
 #endif
 DEF(exit_tb, 0, 0, 1, TCG_OPF_BB_END)
 DEF(goto_tb, 0, 0, 1, TCG_OPF_BB_END)
+DEF(goto_ptr, 0, 1, 0, TCG_OPF_BB_END | IMPL(TCG_TARGET_HAS_goto_ptr))
+
+/* Element-wise operations on vectors of guest state in env.  The constant
+   args are vece, oprsz, dofs, aofs, and bofs (the shift count for the
+   *i_vec ops).  Guest vector registers are never TCG globals, so these
+   ops neither need nor cause a sync of the globals.  */
+#define IMPL_VEC  IMPL(TCG_TARGET_HAS_vec)
+
+DEF(add_vec, 0, 0, 5, IMPL_VEC)
+DEF(sub_vec, 0, 0, 5, IMPL_VEC)
+DEF(and_vec, 0, 0, 5, IMPL_VEC)
+DEF(andc_vec, 0, 0, 5, IMPL_VEC)
+DEF(or_vec, 0, 0, 5, IMPL_VEC)
+DEF(xor_vec, 0, 0, 5, IMPL_VEC)
+DEF(ssadd_vec, 0, 0, 5, IMPL_VEC)
+DEF(usadd_vec, 0, 0, 5, IMPL_VEC)
+DEF(sssub_vec, 0, 0, 5, IMPL_VEC)
+DEF(ussub_vec, 0, 0, 5, IMPL_VEC)
+DEF(cmpeq_vec, 0, 0, 5, IMPL_VEC)
+DEF(cmpgt_vec, 0, 0, 5, IMPL_VEC)
+DEF(shli_vec, 0, 0, 5, IMPL_VEC)
+DEF(shri_vec, 0, 0, 5, IMPL_VEC)
+DEF(sari_vec, 0, 0, 5, IMPL_VEC)
+
+#undef IMPL_VEC
 
 #define IMPL_NEW_LDST \
     (TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS \
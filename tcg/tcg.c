@@ -105,6 +105,7 @@ static int tcg_target_const_match(tcg_target_long val,
                                   const TCGArgConstraint *arg_ct);
 static void tcg_out_tb_init(TCGContext *s);
 static void tcg_out_tb_finalize(TCGContext *s);
+static bool tcg_can_emit_vec_op(TCGOpcode opc, TCGMemOp vece);
 
 
 TCGOpDef tcg_op_defs[] = {
@@ -992,6 +993,210 @@ void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     *tcg_ctx.gen_opparam_ptr++ = idx;
 }
 
+/* Emit the vector op OPC if the backend supports it for VECE.  */
+static bool tcg_gen_vec_op(TCGOpcode opc, TCGMemOp vece, uint32_t oprsz,
+                           uint32_t dofs, uint32_t aofs, TCGArg bofs)
+{
+    assert(oprsz == 8 || oprsz == 16);
+    if (!TCG_TARGET_HAS_vec || !tcg_can_emit_vec_op(opc, vece)) {
+        return false;
+    }
+    *tcg_ctx.gen_opc_ptr++ = opc;
+    *tcg_ctx.gen_opparam_ptr++ = vece;
+    *tcg_ctx.gen_opparam_ptr++ = oprsz;
+    *tcg_ctx.gen_opparam_ptr++ = dofs;
+    *tcg_ctx.gen_opparam_ptr++ = aofs;
+    *tcg_ctx.gen_opparam_ptr++ = bofs;
+    return true;
+}
+
+/* Return the sign bit of each element of size VECE in a 64-bit word.  */
+static uint64_t gvec_sign_mask(TCGMemOp vece)
+{
+    switch (vece) {
+    case MO_8:
+        return 0x8080808080808080ull;
+    case MO_16:
+        return 0x8000800080008000ull;
+    case MO_32:
+        return 0x8000000080000000ull;
+    default:
+        return 0x8000000000000000ull;
+    }
+}
+
+/* Expand OPC 64 bits at a time.  Additions and subtractions of smaller
+   elements are done on the low bits of each element, with the sign bits
+   masked out so that no carry crosses an element, and the sign bits are
+   then computed separately.  */
+static void tcg_gen_gvec_i64(TCGOpcode opc, TCGMemOp vece, uint32_t oprsz,
+                             uint32_t dofs, uint32_t aofs, uint32_t bofs)
+{
+    TCGv_ptr env = tcg_ctx.tcg_env;
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    uint64_t m = gvec_sign_mask(vece);
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(t0, env, aofs + i);
+        tcg_gen_ld_i64(t1, env, bofs + i);
+        switch (opc) {
+        case INDEX_op_add_vec:
+            if (vece == MO_64) {
+                tcg_gen_add_i64(t0, t0, t1);
+                break;
+            }
+            /* d = ((a & ~m) + (b & ~m)) ^ ((a ^ b) & m) */
+            tcg_gen_xor_i64(t2, t0, t1);
+            tcg_gen_andi_i64(t2, t2, m);
+            tcg_gen_andi_i64(t0, t0, ~m);
+            tcg_gen_andi_i64(t1, t1, ~m);
+            tcg_gen_add_i64(t0, t0, t1);
+            tcg_gen_xor_i64(t0, t0, t2);
+            break;
+        case INDEX_op_sub_vec:
+            if (vece == MO_64) {
+                tcg_gen_sub_i64(t0, t0, t1);
+                break;
+            }
+            /* d = ((a | m) - (b & ~m)) ^ ((a ^ ~b) & m) */
+            tcg_gen_eqv_i64(t2, t0, t1);
+            tcg_gen_andi_i64(t2, t2, m);
+            tcg_gen_ori_i64(t0, t0, m);
+            tcg_gen_andi_i64(t1, t1, ~m);
+            tcg_gen_sub_i64(t0, t0, t1);
+            tcg_gen_xor_i64(t0, t0, t2);
+            break;
+        case INDEX_op_and_vec:
+            tcg_gen_and_i64(t0, t0, t1);
+            break;
+        case INDEX_op_andc_vec:
+            tcg_gen_andc_i64(t0, t0, t1);
+            break;
+        case INDEX_op_or_vec:
+            tcg_gen_or_i64(t0, t0, t1);
+            break;
+        case INDEX_op_xor_vec:
+            tcg_gen_xor_i64(t0, t0, t1);
+            break;
+        default:
+            tcg_abort();
+        }
+        tcg_gen_st_i64(t0, env, dofs + i);
+    }
+
+    tcg_temp_free_i64(t0);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+}
+
+static bool tcg_gen_gvec_3_i64(TCGOpcode opc, TCGMemOp vece, uint32_t oprsz,
+                               uint32_t dofs, uint32_t aofs, uint32_t bofs)
+{
+    if (!tcg_gen_vec_op(opc, vece, oprsz, dofs, aofs, bofs)) {
+        tcg_gen_gvec_i64(opc, vece, oprsz, dofs, aofs, bofs);
+    }
+    return true;
+}
+
+bool tcg_gen_gvec_add(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs)
+{
+    return tcg_gen_gvec_3_i64(INDEX_op_add_vec, vece, oprsz,
+                              dofs, aofs, bofs);
+}
+
+bool tcg_gen_gvec_sub(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs)
+{
+    return tcg_gen_gvec_3_i64(INDEX_op_sub_vec, vece, oprsz,
+                              dofs, aofs, bofs);
+}
+
+bool tcg_gen_gvec_and(uint32_t oprsz, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs)
+{
+    return tcg_gen_gvec_3_i64(INDEX_op_and_vec, MO_64, oprsz,
+                              dofs, aofs, bofs);
+}
+
+bool tcg_gen_gvec_andc(uint32_t oprsz, uint32_t dofs,
+                       uint32_t aofs, uint32_t bofs)
+{
+    return tcg_gen_gvec_3_i64(INDEX_op_andc_vec, MO_64, oprsz,
+                              dofs, aofs, bofs);
+}
+
+bool tcg_gen_gvec_or(uint32_t oprsz, uint32_t dofs,
+                     uint32_t aofs, uint32_t bofs)
+{
+    return tcg_gen_gvec_3_i64(INDEX_op_or_vec, MO_64, oprsz,
+                              dofs, aofs, bofs);
+}
+
+bool tcg_gen_gvec_xor(uint32_t oprsz, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs)
+{
+    return tcg_gen_gvec_3_i64(INDEX_op_xor_vec, MO_64, oprsz,
+                              dofs, aofs, bofs);
+}
+
+bool tcg_gen_gvec_ssadd(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs)
+{
+    return tcg_gen_vec_op(INDEX_op_ssadd_vec, vece, oprsz, dofs, aofs, bofs);
+}
+
+bool tcg_gen_gvec_usadd(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs)
+{
+    return tcg_gen_vec_op(INDEX_op_usadd_vec, vece, oprsz, dofs, aofs, bofs);
+}
+
+bool tcg_gen_gvec_sssub(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs)
+{
+    return tcg_gen_vec_op(INDEX_op_sssub_vec, vece, oprsz, dofs, aofs, bofs);
+}
+
+bool tcg_gen_gvec_ussub(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs)
+{
+    return tcg_gen_vec_op(INDEX_op_ussub_vec, vece, oprsz, dofs, aofs, bofs);
+}
+
+bool tcg_gen_gvec_cmpeq(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs)
+{
+    return tcg_gen_vec_op(INDEX_op_cmpeq_vec, vece, oprsz, dofs, aofs, bofs);
+}
+
+bool tcg_gen_gvec_cmpgt(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                        uint32_t aofs, uint32_t bofs)
+{
+    return tcg_gen_vec_op(INDEX_op_cmpgt_vec, vece, oprsz, dofs, aofs, bofs);
+}
+
+bool tcg_gen_gvec_shli(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                       uint32_t aofs, unsigned shift)
+{
+    return tcg_gen_vec_op(INDEX_op_shli_vec, vece, oprsz, dofs, aofs, shift);
+}
+
+bool tcg_gen_gvec_shri(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                       uint32_t aofs, unsigned shift)
+{
+    return tcg_gen_vec_op(INDEX_op_shri_vec, vece, oprsz, dofs, aofs, shift);
+}
+
+bool tcg_gen_gvec_sari(TCGMemOp vece, uint32_t oprsz, uint32_t dofs,
+                       uint32_t aofs, unsigned shift)
+{
+    return tcg_gen_vec_op(INDEX_op_sari_vec, vece, oprsz, dofs, aofs, shift);
+}
+
 static void tcg_reg_alloc_start(TCGContext *s)
 {
     int i;
@@ -1429,6 +1634,167 @@ static inline void tcg_la_bb_end(TCGContext *s, uint8_t *dead_temps,
     }
 }
 
+/* Maximum number of env ranges tracked by tcg_dead_store_elim().  */
+#define DSE_MAX_RANGES 16
+
+/* Return the size in bytes of the memory accessed by the ld/st op OPC,
+   or 0 if OPC isn't a host load or store.  */
+static int tcg_ldst_size(TCGOpcode opc)
+{
+    switch (opc) {
+    case INDEX_op_ld8u_i32:
+    case INDEX_op_ld8s_i32:
+    case INDEX_op_st8_i32:
+    case INDEX_op_ld8u_i64:
+    case INDEX_op_ld8s_i64:
+    case INDEX_op_st8_i64:
+        return 1;
+    case INDEX_op_ld16u_i32:
+    case INDEX_op_ld16s_i32:
+    case INDEX_op_st16_i32:
+    case INDEX_op_ld16u_i64:
+    case INDEX_op_ld16s_i64:
+    case INDEX_op_st16_i64:
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_st_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_st32_i64:
+        return 4;
+    case INDEX_op_ld_i64:
+    case INDEX_op_st_i64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static bool tcg_op_is_store(TCGOpcode opc)
+{
+    switch (opc) {
+    case INDEX_op_st8_i32:
+    case INDEX_op_st16_i32:
+    case INDEX_op_st_i32:
+    case INDEX_op_st8_i64:
+    case INDEX_op_st16_i64:
+    case INDEX_op_st32_i64:
+    case INDEX_op_st_i64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Return true if [OFS, OFS + LEN) overlaps the memory of a global.  The
+   register allocator reads and writes those behind our back.  */
+static bool tcg_env_range_is_global(TCGContext *s, intptr_t ofs, int len)
+{
+    int i;
+
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+        if (!ts->fixed_reg && ts->mem_reg == TCG_AREG0 &&
+            ofs < ts->mem_offset + (ts->type == TCG_TYPE_I64 ? 8 : 4) &&
+            ts->mem_offset < ofs + len) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Dead store elimination: remove the stores to guest state in env that
+   are overwritten later in the same basic block without being read in
+   between.  Walking backwards, we keep the env ranges that are written
+   before any read.  Anything that may read env without telling us (calls,
+   guest memory accesses that may fault, vector ops, loads through other
+   pointers) or that ends the basic block forgets all of them.  */
+static void tcg_dead_store_elim(TCGContext *s)
+{
+    struct {
+        intptr_t ofs;
+        int len;
+    } dead[DSE_MAX_RANGES];
+    int nb_dead = 0;
+    int i, op_index, nb_args, len;
+    intptr_t ofs;
+    TCGArg env, *args;
+    TCGOpcode op;
+    const TCGOpDef *def;
+
+    env = GET_TCGV_PTR(s->tcg_env);
+    if (s->nb_globals == 0 || !s->temps[env].fixed_reg ||
+        s->temps[env].reg != TCG_AREG0) {
+        return;
+    }
+
+    args = s->gen_opparam_ptr;
+    for (op_index = s->gen_opc_ptr - s->gen_opc_buf - 1;
+         op_index >= 0; op_index--) {
+        op = s->gen_opc_buf[op_index];
+        def = &tcg_op_defs[op];
+        switch (op) {
+        case INDEX_op_call:
+            nb_args = args[-1];
+            args -= nb_args;
+            nb_dead = 0;
+            continue;
+        case INDEX_op_nopn:
+            args -= args[-1];
+            continue;
+        default:
+            args -= def->nb_args;
+            break;
+        }
+
+        len = tcg_ldst_size(op);
+        if (len == 0) {
+            if ((def->flags & (TCG_OPF_BB_END | TCG_OPF_CALL_CLOBBER |
+                               TCG_OPF_SIDE_EFFECTS)) ||
+                (op >= INDEX_op_add_vec && op <= INDEX_op_sari_vec)) {
+                nb_dead = 0;
+            }
+            continue;
+        }
+        if (args[1] != env) {
+            if (!tcg_op_is_store(op)) {
+                nb_dead = 0;
+            }
+            continue;
+        }
+
+        ofs = args[2];
+        if (!tcg_op_is_store(op)) {
+            /* Forget the ranges the load reads from.  */
+            for (i = 0; i < nb_dead; i++) {
+                if (ofs < dead[i].ofs + dead[i].len &&
+                    dead[i].ofs < ofs + len) {
+                    dead[i--] = dead[--nb_dead];
+                }
+            }
+            continue;
+        }
+
+        for (i = 0; i < nb_dead; i++) {
+            if (dead[i].ofs <= ofs &&
+                ofs + len <= dead[i].ofs + dead[i].len) {
+                break;
+            }
+        }
+        if (i < nb_dead) {
+            tcg_set_nop(s, s->gen_opc_buf + op_index, args, def->nb_args);
+#ifdef CONFIG_PROFILER
+            s->dse_count++;
+#endif
+        } else if (nb_dead < DSE_MAX_RANGES &&
+                   !tcg_env_range_is_global(s, ofs, len)) {
+            dead[nb_dead].ofs = ofs;
+            dead[nb_dead].len = len;
+            nb_dead++;
+        }
+    }
+}
+
 /* Liveness analysis : update the opc_dead_args array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -1814,6 +2180,9 @@ static inline void tcg_reg_sync(TCGContext *s, int reg)
             temp_allocate_frame(s, temp);
         }
         tcg_out_st(s, ts->type, reg, ts->mem_reg, ts->mem_offset);
+#ifdef CONFIG_PROFILER
+        s->spill_count++;
+#endif
     }
     ts->mem_coherent = 1;
 }
@@ -2045,6 +2414,9 @@ static void tcg_reg_alloc_mov(TCGContext *s, const TCGOpDef *def,
             temp_allocate_frame(s, args[0]);
         }
         tcg_out_st(s, ots->type, ts->reg, ots->mem_reg, ots->mem_offset);
+#ifdef CONFIG_PROFILER
+        s->spill_count++;
+#endif
         if (IS_DEAD_ARG(1)) {
             temp_dead(s, args[1]);
         }
@@ -2482,6 +2854,9 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
     s->la_time -= profile_getclock();
 #endif
 
+#ifdef USE_LIVENESS_ANALYSIS
+    tcg_dead_store_elim(s);
+#endif
     tcg_liveness_analysis(s);
 
 #ifdef CONFIG_PROFILER
@@ -2599,6 +2974,25 @@ int tcg_gen_code(TCGContext *s, uint8_t *gen_code_buf)
 
     tcg_gen_code_common(s, gen_code_buf, -1);
 
+#ifdef CONFIG_PROFILER
+    {
+        int i;
+        for (i = 0; s->gen_opc_buf[i] != INDEX_op_end; i++) {
+            switch (s->gen_opc_buf[i]) {
+            case INDEX_op_nop:
+            case INDEX_op_nop1:
+            case INDEX_op_nop2:
+            case INDEX_op_nop3:
+            case INDEX_op_nopn:
+                break;
+            default:
+                s->op_count_opt++;
+                break;
+            }
+        }
+    }
+#endif
+
     /* flush instruction cache */
     flush_icache_range((uintptr_t)gen_code_buf, (uintptr_t)s->code_ptr);
 
@@ -2632,6 +3026,12 @@ void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
     cpu_fprintf(f, "deleted ops/TB      %0.2f\n",
                 s->tb_count ? 
                 (double)s->del_op_count / s->tb_count : 0);
+    cpu_fprintf(f, "avg ops/TB after opt %0.1f\n",
+                s->tb_count ? (double)s->op_count_opt / s->tb_count : 0);
+    cpu_fprintf(f, "dead stores/TB      %0.2f\n",
+                s->tb_count ? (double)s->dse_count / s->tb_count : 0);
+    cpu_fprintf(f, "reg spills/TB       %0.2f\n",
+                s->tb_count ? (double)s->spill_count / s->tb_count : 0);
     cpu_fprintf(f, "avg temps/TB        %0.2f max=%d\n",
                 s->tb_count ? 
                 (double)s->temp_count / s->tb_count : 0,
@@ -493,6 +493,9 @@ struct TCGContext {
     int64_t temp_count;
     int temp_count_max;
     int64_t del_op_count;
+    int64_t op_count_opt; /* insn count after optimization */
+    int64_t dse_count;    /* dead stores to env removed */
+    int64_t spill_count;  /* temps stored to memory by the allocator */
     int64_t code_in_len;
     int64_t code_out_len;
     int64_t interm_time;
@@ -520,6 +523,12 @@ struct TCGContext {
     /* Code generation */
     int code_gen_max_blocks;
     uint8_t *code_gen_prologue;
+    /* entry point of the epilogue that returns 0 to cpu_exec(), used as
+       the goto_ptr target when the next TB isn't known */
+    uint8_t *code_gen_epilogue;
+    /* the front-end's TCG_AREG0 global, used by the tcg_gen_gvec_*
+       fallbacks */
+    TCGv_ptr tcg_env;
     uint8_t *code_gen_buffer;
     size_t code_gen_buffer_size;
     /* threshold to flush the translated code buffer */
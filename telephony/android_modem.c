@@ -19,6 +19,7 @@
 #include "android/utils/system.h"
 #include "android/utils/bufprint.h"
 #include "android/utils/path.h"
+#include "android/utils/prefix_trie.h"
 #include "hw/hw.h"
 #include "qemu-common.h"
 #include "sim_card.h"
@@ -225,6 +226,19 @@ typedef struct {
 
 #define  A_MODEM_SELF_SIZE   3
 
+/* an event queued by amodem_inject_sms() and friends */
+typedef enum {
+    A_INJECT_SMS = 0,
+    A_INJECT_CALL,
+    A_INJECT_CANCEL
+} AInjectKind;
+
+typedef struct {
+    AInjectKind  kind;
+    SmsPDU       sms;
+    char         number[ A_CALL_NUMBER_MAX_SIZE+1 ];
+} AInjectEventRec, *AInjectEvent;
+
 
 typedef struct AModemRec_
 {
@@ -276,6 +290,19 @@ typedef struct AModemRec_
     int                 out_size;
     char                out_buff[1024];
 
+    /* bulk injection queue, a ring of inject_capacity events */
+    AInjectEvent        inject_events;
+    int                 inject_capacity;
+    int                 inject_first;
+    int                 inject_count;
+    unsigned            inject_delivered;
+    int                 inject_rate;      /* events per second, 0 for no limit */
+    SysTime             inject_epoch;     /* start of the current rate period */
+    int                 inject_sent;      /* events delivered since inject_epoch */
+    SysTimer            inject_timer;
+    SysTime             inject_when;      /* when inject_timer fires, 0 if unset */
+    SysTime             sms_ack_deadline; /* 0 unless a +CMT waits for +CNMA */
+
     /*
      * Hold non-volatile ram configuration for modem
      */
@@ -617,6 +644,16 @@ amodem_set_legacy( AModem  modem )
 void
 amodem_destroy( AModem  modem )
 {
+    amodem_clear_inject( modem );
+    AFREE( modem->inject_events );
+    modem->inject_events   = NULL;
+    modem->inject_capacity = 0;
+    if (modem->inject_timer) {
+        sys_timer_destroy( modem->inject_timer );
+        modem->inject_timer = NULL;
+        modem->inject_when  = 0;
+    }
+
     asimcard_destroy( modem->sim );
     modem->sim = NULL;
 }
@@ -1006,6 +1043,214 @@ amodem_disconnect_call( AModem  modem, const char*  number )
     return 0;
 }
 
+/** BULK INJECTION
+ **/
+
+/* how long an injected SMS waits for the +CNMA of the previous one */
+#define  INJECT_SMS_ACK_TIMEOUT  2000
+
+/* how often to check for a free call slot for an injected call */
+#define  INJECT_CALL_POLL        100
+
+/* events delivered before giving the channel back to the main loop */
+#define  INJECT_BATCH            8
+
+static void  amodem_inject_run( void*  opaque );
+
+static void
+amodem_inject_schedule( AModem  modem, SysTime  when )
+{
+    if (modem->inject_when != 0 && modem->inject_when <= when)
+        return;
+
+    if (modem->inject_timer == NULL)
+        modem->inject_timer = sys_timer_create();
+
+    modem->inject_when = when;
+    sys_timer_set( modem->inject_timer, when, amodem_inject_run, modem );
+}
+
+static void
+amodem_inject_reset_rate( AModem  modem )
+{
+    modem->inject_epoch = sys_time_ms();
+    modem->inject_sent  = 0;
+}
+
+static AInjectEvent
+amodem_inject_push( AModem  modem, AInjectKind  kind )
+{
+    AInjectEvent  event;
+
+    if (modem->inject_count == modem->inject_capacity) {
+        int  old_capacity = modem->inject_capacity;
+
+        modem->inject_capacity = old_capacity ? old_capacity*2 : 64;
+        AARRAY_RENEW( modem->inject_events, modem->inject_capacity );
+
+        /* move the events that wrapped around after the last one */
+        memcpy( modem->inject_events + old_capacity,
+                modem->inject_events,
+                modem->inject_first*sizeof(AInjectEventRec) );
+    }
+
+    if (modem->inject_count == 0)
+        amodem_inject_reset_rate( modem );
+
+    event = modem->inject_events +
+            (modem->inject_first + modem->inject_count) % modem->inject_capacity;
+    modem->inject_count += 1;
+
+    memset( event, 0, sizeof(*event) );
+    event->kind = kind;
+    amodem_inject_schedule( modem, sys_time_ms() );
+    return event;
+}
+
+static void
+amodem_inject_pop( AModem  modem )
+{
+    AInjectEvent  event = modem->inject_events + modem->inject_first;
+
+    if (event->sms)
+        smspdu_free( event->sms );
+
+    modem->inject_first  = (modem->inject_first + 1) % modem->inject_capacity;
+    modem->inject_count -= 1;
+}
+
+/* deliver the queued events that are due, in order. an event blocks the
+ * ones after it until it can be delivered: an SMS while the previous one
+ * isn't acknowledged, a call while all call slots are used. */
+static void
+amodem_inject_run( void*  opaque )
+{
+    AModem   modem = opaque;
+    SysTime  now   = sys_time_ms();
+    int      batch;
+
+    modem->inject_when = 0;
+
+    for (batch = 0; modem->inject_count > 0; batch++) {
+        AInjectEvent  event = modem->inject_events + modem->inject_first;
+
+        /* don't interleave a +CMT with the '> ' prompt of +CMGS,
+         * handleSendSMSText() resumes delivery */
+        if (modem->wait_sms)
+            return;
+
+        if (batch == INJECT_BATCH) {
+            amodem_inject_schedule( modem, now );
+            return;
+        }
+
+        if (modem->inject_rate > 0) {
+            SysTime  next = modem->inject_epoch +
+                            (SysTime)modem->inject_sent*1000/modem->inject_rate;
+
+            /* don't catch up with more than a second of stalled events */
+            if (next + 1000 < now) {
+                amodem_inject_reset_rate( modem );
+                next = now;
+            }
+            if (next > now) {
+                amodem_inject_schedule( modem, next );
+                return;
+            }
+        }
+
+        switch (event->kind) {
+            case A_INJECT_SMS:
+                if (modem->sms_ack_deadline != 0 &&
+                    modem->sms_ack_deadline > now) {
+                    amodem_inject_schedule( modem, modem->sms_ack_deadline );
+                    return;
+                }
+                amodem_receive_sms( modem, event->sms );
+                modem->sms_ack_deadline = now + INJECT_SMS_ACK_TIMEOUT;
+                break;
+
+            case A_INJECT_CALL:
+                if (modem->call_count >= MAX_CALLS) {
+                    amodem_inject_schedule( modem, now + INJECT_CALL_POLL );
+                    return;
+                }
+                amodem_add_inbound_call( modem, event->number );
+                break;
+
+            case A_INJECT_CANCEL:
+                amodem_disconnect_call( modem, event->number );
+                break;
+        }
+
+        amodem_inject_pop( modem );
+        modem->inject_sent      += 1;
+        modem->inject_delivered += 1;
+    }
+}
+
+void
+amodem_inject_sms( AModem  modem, SmsPDU  pdu )
+{
+    AInjectEvent  event = amodem_inject_push( modem, A_INJECT_SMS );
+
+    event->sms = pdu;
+}
+
+static void
+amodem_inject_number( AModem  modem, AInjectKind  kind, const char*  number )
+{
+    AInjectEvent  event = amodem_inject_push( modem, kind );
+
+    snprintf( event->number, sizeof(event->number), "%s", number );
+}
+
+void
+amodem_inject_call( AModem  modem, const char*  number )
+{
+    amodem_inject_number( modem, A_INJECT_CALL, number );
+}
+
+void
+amodem_inject_cancel( AModem  modem, const char*  number )
+{
+    amodem_inject_number( modem, A_INJECT_CANCEL, number );
+}
+
+void
+amodem_set_inject_rate( AModem  modem, int  per_second )
+{
+    modem->inject_rate = (per_second > 0) ? per_second : 0;
+    amodem_inject_reset_rate( modem );
+    if (modem->inject_count > 0)
+        amodem_inject_schedule( modem, sys_time_ms() );
+}
+
+int
+amodem_get_inject_rate( AModem  modem )
+{
+    return modem->inject_rate;
+}
+
+int
+amodem_get_inject_pending( AModem  modem )
+{
+    return modem->inject_count;
+}
+
+unsigned
+amodem_get_inject_delivered( AModem  modem )
+{
+    return modem->inject_delivered;
+}
+
+void
+amodem_clear_inject( AModem  modem )
+{
+    while (modem->inject_count > 0)
+        amodem_inject_pop( modem );
+}
+
 /** COMMAND HANDLERS
  **/
 
@@ -1590,6 +1835,16 @@ handleSendSMS( const char*  cmd, AModem  modem )
     return "> ";
 }
 
+static const char*
+handleSmsAcknowledge( const char*  cmd, AModem  modem )
+{
+    /* the next injected SMS can be delivered */
+    modem->sms_ack_deadline = 0;
+    if (modem->inject_count > 0)
+        amodem_inject_schedule( modem, sys_time_ms() );
+    return NULL;
+}
+
 #if 0
 static void
 sms_address_dump( SmsAddress  address, FILE*  out )
@@ -2426,8 +2681,8 @@ static const struct {
                               be polled through +CLCC instead */
 
     /* see requestSMSAcknowledge() */
-    { "+CNMA=1", NULL, NULL },
-    { "+CNMA=2", NULL, NULL },
+    { "+CNMA=1", NULL, handleSmsAcknowledge },
+    { "+CNMA=2", NULL, handleSmsAcknowledge },
 
     /* see requestSIM_IO() */
     { "!+CRSM=", NULL, handleSIM_IO },
@@ -2477,6 +2732,28 @@ static const struct {
 
 #define  REPLY(str)  do { const char*  s = (str); R(">> %s\n", quote(s)); return s; } while (0)
 
+/* the commands of sDefaultResponses, each mapped to its index */
+static PrefixTrie*  sResponseTrie;
+
+static const PrefixTrie*
+amodem_get_response_trie( void )
+{
+    if (sResponseTrie == NULL) {
+        int  nn;
+
+        sResponseTrie = prefixTrie_new();
+        for (nn = 0; sDefaultResponses[nn].cmd != NULL; nn++) {
+            const char*  scmd = sDefaultResponses[nn].cmd;
+
+            if (scmd[0] == '!')
+                prefixTrie_add( sResponseTrie, scmd+1, true, nn );
+            else
+                prefixTrie_add( sResponseTrie, scmd, false, nn );
+        }
+    }
+    return sResponseTrie;
+}
+
 const char*  amodem_send( AModem  modem, const char*  cmd )
 {
     const char*  answer;
@@ -2485,6 +2762,8 @@ const char*  amodem_send( AModem  modem, const char*  cmd )
         modem->wait_sms = 0;
         R( "SMS<< %s\n", quote(cmd) );
         answer = handleSendSMSText( cmd, modem );
+        if (modem->inject_count > 0)
+            amodem_inject_schedule( modem, sys_time_ms() );
         REPLY(answer);
     }
 
@@ -2499,30 +2778,10 @@ const char*  amodem_send( AModem  modem, const char*  cmd )
 
     /* TODO: implement command handling */
     {
-        int  nn, found = 0;
-
-        for (nn = 0; ; nn++) {
-            const char*  scmd = sDefaultResponses[nn].cmd;
-
-            if (!scmd) /* end of list */
-                break;
-
-            if (scmd[0] == '!') { /* prefix match */
-                int  len = strlen(++scmd);
-
-                if ( !memcmp( scmd, cmd, len ) ) {
-                    found = 1;
-                    break;
-                }
-            } else { /* full match */
-                if ( !strcmp( scmd, cmd ) ) {
-                    found = 1;
-                    break;
-                }
-            }
-        }
+        /* the first command of the list that matches wins */
+        int  nn = prefixTrie_find( amodem_get_response_trie(), cmd );
 
-        if ( !found )
+        if ( nn < 0 )
         {
             D( "** UNSUPPORTED COMMAND **\n" );
             REPLY( "ERROR: UNSUPPORTED" );
@@ -186,6 +186,31 @@ extern int    amodem_add_inbound_call( AModem  modem, const char*  number );
 extern int    amodem_update_call( AModem  modem, const char*  number, ACallState  state );
 extern int    amodem_disconnect_call( AModem  modem, const char*  number );
 
+/** BULK INJECTION
+ **
+ ** queue incoming SMS messages and call events, to be delivered in order
+ ** at up to a given rate. an SMS waits until the previous injected one is
+ ** acknowledged with +CNMA (or for 2 seconds), and an incoming call until
+ ** a call slot is free, so that the modem channel is never flooded.
+ **/
+
+/* queue an incoming SMS message, this takes ownership of 'pdu' */
+extern void      amodem_inject_sms( AModem  modem, SmsPDU  pdu );
+
+/* queue an incoming call, or the end of a call */
+extern void      amodem_inject_call( AModem  modem, const char*  number );
+extern void      amodem_inject_cancel( AModem  modem, const char*  number );
+
+/* set the most events delivered per second, 0 for no limit (the default) */
+extern void      amodem_set_inject_rate( AModem  modem, int  per_second );
+extern int       amodem_get_inject_rate( AModem  modem );
+
+extern int       amodem_get_inject_pending( AModem  modem );
+extern unsigned  amodem_get_inject_delivered( AModem  modem );
+
+/* drop the queued events */
+extern void      amodem_clear_inject( AModem  modem );
+
 /**/
 
 #endif /* _android_modem_h_ */
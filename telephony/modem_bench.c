@@ -0,0 +1,487 @@
+/* Copyright (C) 2014 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/* This is the source code of the "emulator_modem_bench" program, which
+ * drives the emulated GSM modem of android_modem.c directly, without a
+ * virtual device, the way libreference-ril.so does through the modem
+ * serial port:
+ *
+ *  - it replays the AT commands that the RIL sends at boot and while
+ *    polling, and reports the commands handled per second.
+ *
+ *  - it queues inbound SMS messages with amodem_inject_sms(), acknowledges
+ *    each +CMT with AT+CNMA=1 like the RIL, and reports the achieved rate
+ *    and the latency from injection to the +CMT.
+ *
+ *  - it queues inbound calls and their end with amodem_inject_call() and
+ *    amodem_inject_cancel(), and reports the events delivered per second.
+ *
+ * The modem timers run from the loop of this program, always on the next
+ * iteration, like the QEMU timers of sysdeps_qemu.c.
+ */
+
+#include "android/utils/bufprint.h"
+#include "android/utils/hot_profiler.h"
+#include "android/utils/path.h"
+#include "android/utils/system.h"
+#include "hw/hw.h"
+#include "android_modem.h"
+#include "remote_call.h"
+#include "sms.h"
+#include "sysdeps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Required by android/utils/debug.h */
+int android_verbose;
+
+#define  BENCH_PORT        5554
+#define  DEFAULT_COMMANDS  200000
+#define  DEFAULT_SMS       10000
+#define  DEFAULT_CALLS     1000
+
+/* longest time without progress before giving up */
+#define  STALL_TIMEOUT_MS  10000
+
+/* how often the device polls the signal strength while receiving */
+#define  POLL_PERIOD_MS    10
+
+/* the commands of libreference-ril.so, at boot then while polling */
+static const char* const  _boot_commands[] = {
+    "ATE0Q0V1", "ATS0=0", "AT+CMEE=1", "AT+CREG=2", "AT+CGREG=2",
+    "AT+CCWA=1", "AT+CMOD=0", "AT+CMUT=0", "AT+CSSN=0,1", "AT+COLP=0",
+    "AT+CSCS=\"HEX\"", "AT+CUSD=1", "AT+CGEREP=1,0", "AT+CMGF=0",
+    "AT%CPI=3", "AT%CSTAT=1", "AT+CFUN?", "AT+CFUN=1", "AT%CPHS=1",
+    "AT%CTZV=1", "AT+CPIN?", "AT+CSMS=1", "AT+CNMI=1,2,2,1,1",
+    "AT+CIMI", "AT+CGSN", "AT+CTEC=?", "AT+CTEC?", "AT+WRMP=?",
+};
+
+static const char* const  _poll_commands[] = {
+    "AT+CSQ", "AT+CREG?", "AT+CGREG?",
+    "AT+COPS=3,0;+COPS?;+COPS=3,1;+COPS?;+COPS=3,2;+COPS?",
+    "AT+COPS?", "AT+CLCC", "AT+CGACT?", "AT+CGDCONT?", "AT+CFUN?",
+    "AT+CPIN?", "AT+CRSM=192,28436,0,0,15", "AT+CNMI?", "AT+WPRL?",
+};
+
+#define  ARRAY_LEN(x)  (int)(sizeof(x)/sizeof((x)[0]))
+
+/** SYSDEPS
+ **/
+
+typedef struct SysTimerRec_ {
+    SysTimer     next;
+    SysTime      when;
+    SysCallback  callback;
+    void*        opaque;
+    unsigned     serial;    /* to only fire the timers set before a pass */
+} SysTimerRec;
+
+static SysTimer  _timers;
+static unsigned  _timer_serial;
+
+void
+sys_main_init( void )
+{
+}
+
+long long
+sys_time_ms( void )
+{
+    return hotProfiler_now() / 1000000;
+}
+
+SysTimer
+sys_timer_create( void )
+{
+    SysTimer  timer;
+
+    ANEW0(timer);
+    timer->next = _timers;
+    _timers     = timer;
+    return timer;
+}
+
+void
+sys_timer_set( SysTimer  timer, SysTime  when, SysCallback  callback, void*  opaque )
+{
+    timer->when     = when;
+    timer->callback = callback;
+    timer->opaque   = opaque;
+    timer->serial   = _timer_serial++;
+}
+
+void
+sys_timer_unset( SysTimer  timer )
+{
+    timer->callback = NULL;
+}
+
+void
+sys_timer_destroy( SysTimer  timer )
+{
+    SysTimer*  pnode = &_timers;
+
+    while (*pnode != timer)
+        pnode = &(*pnode)->next;
+    *pnode = timer->next;
+    AFREE(timer);
+}
+
+/* fire the timers that are due, except those set by the callbacks */
+static void
+bench_run_timers( void )
+{
+    SysTime   now   = sys_time_ms();
+    unsigned  limit = _timer_serial;
+
+    for (;;) {
+        SysTimer     timer;
+        SysCallback  callback;
+
+        /* a callback can destroy any timer, so restart each time */
+        for (timer = _timers; timer != NULL; timer = timer->next) {
+            if (timer->callback != NULL && timer->when <= now &&
+                (int)(timer->serial - limit) < 0)
+                break;
+        }
+        if (timer == NULL)
+            return;
+
+        callback        = timer->callback;
+        timer->callback = NULL;
+        callback( timer->opaque );
+    }
+}
+
+/** STUBS
+ **/
+
+/* there are no snapshots, nor other emulators to call */
+
+int
+register_savevm( DeviceState*  dev, const char*  idstr, int  instance_id,
+                 int  version_id, SaveStateHandler*  save_state,
+                 LoadStateHandler*  load_state, void*  opaque )
+{
+    return 0;
+}
+
+void          qemu_put_byte( QEMUFile*  f, int  v ) {}
+void          qemu_put_be32( QEMUFile*  f, unsigned int  v ) {}
+void          qemu_put_buffer( QEMUFile*  f, const uint8_t*  buf, int  size ) {}
+int           qemu_get_byte( QEMUFile*  f ) { return 0; }
+unsigned int  qemu_get_be32( QEMUFile*  f ) { return 0; }
+int           qemu_get_buffer( QEMUFile*  f, uint8_t*  buf, int  size ) { return 0; }
+
+int
+remote_number_string_to_port( const char*  number )
+{
+    return -1;
+}
+
+int
+remote_call_dial( const char*  to_number, int  from_port,
+                  RemoteResultFunc  result_func, void*  result_opaque )
+{
+    return -1;
+}
+
+int
+remote_call_sms( const char*  number, int  from_port, SmsPDU  pdu )
+{
+    return -1;
+}
+
+void
+remote_call_other( const char*  to_number, int  from_port, RemoteCallType  type )
+{
+}
+
+void
+remote_call_cancel( const char*  to_number, int  from_port )
+{
+}
+
+/** DEVICE
+ **/
+
+typedef struct {
+    int       sms_received;
+    int       rings;
+    int       errors;
+    int64_t*  sms_sent_ns;      /* when each SMS was injected */
+    int64_t*  sms_latency_ns;   /* and how long until its +CMT */
+    int       ack_pending;
+} Device;
+
+static Device  _device;
+
+static void
+bench_unsol( void*  opaque, const char*  message )
+{
+    Device*  device = opaque;
+
+    if (!memcmp( message, "+CMT:", 5 )) {
+        int  n = device->sms_received++;
+
+        /* the events are delivered in order */
+        device->sms_latency_ns[n] = hotProfiler_now() - device->sms_sent_ns[n];
+        device->ack_pending = 1;
+    } else if (!memcmp( message, "RING", 4 )) {
+        device->rings++;
+    }
+}
+
+static void
+bench_send( AModem  modem, const char*  cmd )
+{
+    const char*  answer = amodem_send( modem, cmd );
+
+    if (answer == NULL || strstr( answer, "ERROR" ) != NULL) {
+        if (_device.errors++ == 0)
+            fprintf( stderr, "'%s' failed: %s\n", cmd, answer ? answer : "(null)" );
+    }
+}
+
+static int
+compare_int64( const void*  a, const void*  b )
+{
+    int64_t  x = *(const int64_t*)a;
+    int64_t  y = *(const int64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+static double
+elapsed_s( int64_t  start_ns )
+{
+    return (hotProfiler_now() - start_ns) / 1e9;
+}
+
+/* returns the number of commands per second */
+static double
+bench_commands( AModem  modem, int  count )
+{
+    int64_t  start = hotProfiler_now();
+    int      n;
+
+    for (n = 0; n < count; n++)
+        bench_send( modem, _poll_commands[n % ARRAY_LEN(_poll_commands)] );
+
+    return count / elapsed_s( start );
+}
+
+/* returns 0 on success, -1 if the delivery stalled */
+static int
+bench_sms( AModem  modem, int  count, int  rate )
+{
+    SmsAddressRec  sender;
+    SmsPDU*        pdus;
+    int64_t        start = hotProfiler_now();
+    SysTime        last_poll = 0;
+    SysTime        last_progress = sys_time_ms();
+    int            injected = 0;
+    int            received = 0;
+    int            polls = 0;
+
+    sms_address_from_str( &sender, "5551212", 7 );
+    amodem_set_inject_rate( modem, rate );
+
+    while (_device.sms_received < count) {
+        SysTime  now = sys_time_ms();
+
+        /* inject at the rate, or all at once without one */
+        while (injected < count &&
+               (rate == 0 ||
+                (int64_t)injected*1000 <= (hotProfiler_now() - start)/1000000*rate)) {
+            char  text[32];
+            int   len = snprintf( text, sizeof(text), "message %d", injected );
+
+            pdus = smspdu_create_deliver_utf8( (cbytes_t)text, len, &sender, NULL );
+            _device.sms_sent_ns[injected++] = hotProfiler_now();
+            amodem_inject_sms( modem, pdus[0] );
+            free( pdus );
+        }
+
+        bench_run_timers();
+
+        if (_device.ack_pending) {
+            _device.ack_pending = 0;
+            bench_send( modem, "AT+CNMA=1" );
+        }
+        if (now - last_poll >= POLL_PERIOD_MS) {
+            last_poll = now;
+            bench_send( modem, "AT+CSQ" );
+            polls++;
+        }
+
+        if (_device.sms_received != received) {
+            received      = _device.sms_received;
+            last_progress = now;
+        } else if (now - last_progress > STALL_TIMEOUT_MS) {
+            fprintf( stderr, "SMS delivery stalled after %d messages\n", received );
+            return -1;
+        }
+    }
+
+    printf( "sms: %d messages in %.2f s, %.0f/s, %d polls answered\n",
+            count, elapsed_s( start ), count / elapsed_s( start ), polls );
+
+    qsort( _device.sms_latency_ns, count, sizeof(int64_t), compare_int64 );
+    printf( "sms latency: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+            _device.sms_latency_ns[count/2] / 1e6,
+            _device.sms_latency_ns[count*99/100] / 1e6,
+            _device.sms_latency_ns[count-1] / 1e6 );
+    return 0;
+}
+
+/* returns 0 on success, -1 if the delivery stalled */
+static int
+bench_calls( AModem  modem, int  count )
+{
+    int64_t   start = hotProfiler_now();
+    SysTime   last_progress = sys_time_ms();
+    unsigned  delivered = amodem_get_inject_delivered( modem );
+    int       n;
+
+    amodem_set_inject_rate( modem, 0 );
+    for (n = 0; n < count; n++) {
+        char  number[16];
+
+        snprintf( number, sizeof(number), "555%04d", n % 10000 );
+        amodem_inject_call( modem, number );
+        amodem_inject_cancel( modem, number );
+    }
+
+    while (amodem_get_inject_pending( modem ) > 0) {
+        SysTime  now = sys_time_ms();
+
+        bench_run_timers();
+        bench_send( modem, "AT+CLCC" );
+
+        if (amodem_get_inject_delivered( modem ) != delivered) {
+            delivered     = amodem_get_inject_delivered( modem );
+            last_progress = now;
+        } else if (now - last_progress > STALL_TIMEOUT_MS) {
+            fprintf( stderr, "call delivery stalled\n" );
+            return -1;
+        }
+    }
+
+    printf( "calls: %d calls and hangups in %.2f s, %.0f events/s, %d RING\n",
+            count, elapsed_s( start ), 2*count / elapsed_s( start ), _device.rings );
+    return 0;
+}
+
+static void
+usage( void )
+{
+    printf(
+        "Usage: emulator_modem_bench [options]\n\n"
+        "Drives the emulated GSM modem with the AT commands of the RIL, then\n"
+        "injects inbound SMS messages and calls, and reports the throughput.\n\n"
+        "Options:\n"
+        "  -commands <count>  polling commands to send (default %d)\n"
+        "  -sms <count>       SMS messages to inject (default %d)\n"
+        "  -rate <count>      SMS messages injected per second, 0 for all at\n"
+        "                     once (default 0)\n"
+        "  -calls <count>     calls to inject (default %d)\n",
+        DEFAULT_COMMANDS, DEFAULT_SMS, DEFAULT_CALLS );
+}
+
+int
+main( int  argc, char**  argv )
+{
+    int     commands = DEFAULT_COMMANDS;
+    int     sms      = DEFAULT_SMS;
+    int     calls    = DEFAULT_CALLS;
+    int     rate     = 0;
+    int     failed   = 0;
+    char    home[MAX_PATH];
+    char    config[MAX_PATH];
+    char    temp[MAX_PATH + 32];
+    AModem  modem;
+    int     n;
+
+    argc--, argv++;
+    while (argc > 0) {
+        int*  value = NULL;
+
+        if (!strcmp( argv[0], "-commands" ))
+            value = &commands;
+        else if (!strcmp( argv[0], "-sms" ))
+            value = &sms;
+        else if (!strcmp( argv[0], "-rate" ))
+            value = &rate;
+        else if (!strcmp( argv[0], "-calls" ))
+            value = &calls;
+
+        if (value == NULL || argc < 2 || (*value = atoi( argv[1] )) < 0) {
+            usage();
+            return argc > 0 && !strcmp( argv[0], "-help" ) ? 0 : 1;
+        }
+        argc -= 2, argv += 2;
+    }
+
+    /* keep the modem's NV-RAM file away from the user's */
+    bufprint( bufprint_temp_dir( home, home + sizeof(home) ),
+              home + sizeof(home), PATH_SEP "modem-bench-%d", (int)getpid() );
+    snprintf( temp, sizeof(temp), "%s" PATH_SEP ".android", home );
+    if (path_mkdir_if_needed( temp, 0755 ) < 0) {
+        fprintf( stderr, "Could not create %s\n", temp );
+        return 1;
+    }
+    snprintf( temp, sizeof(temp), "ANDROID_SDK_HOME=%s", home );
+    /* putenv() keeps a reference to the string, which is never freed. */
+    putenv( ASTRDUP(temp) );
+    snprintf( temp, sizeof(temp), "modem-nv-ram-%d", BENCH_PORT );
+    bufprint_config_file( config, config + sizeof(config), temp );
+
+    strcpy( imei, DEFAULT_IMEI );
+    strcpy( imsi, DEFAULT_IMSI );
+    strcpy( mcc, DEFAULT_MCC );
+    strcpy( mnc, DEFAULT_MNC );
+    strcpy( carrier_name, DEFAULT_CARRIER_NAME );
+    strcpy( phone_number, DEFAULT_PHONE_NUMBER );
+
+    modem = amodem_create( BENCH_PORT, bench_unsol, &_device );
+    AARRAY_NEW0( _device.sms_sent_ns, sms + 1 );
+    AARRAY_NEW0( _device.sms_latency_ns, sms + 1 );
+
+    for (n = 0; n < ARRAY_LEN(_boot_commands); n++)
+        bench_send( modem, _boot_commands[n] );
+    bench_run_timers();
+
+    if (commands > 0)
+        printf( "commands: %d, %.0f/s\n", commands, bench_commands( modem, commands ) );
+    if (sms > 0 && bench_sms( modem, sms, rate ) < 0)
+        failed = 1;
+    if (calls > 0 && bench_calls( modem, calls ) < 0)
+        failed = 1;
+    if (_device.errors > 0) {
+        fprintf( stderr, "%d commands failed\n", _device.errors );
+        failed = 1;
+    }
+
+    amodem_destroy( modem );
+    AFREE( _device.sms_sent_ns );
+    AFREE( _device.sms_latency_ns );
+
+    path_delete_file( config );
+    snprintf( temp, sizeof(temp), "%s" PATH_SEP ".android", home );
+    rmdir( temp );
+    rmdir( home );
+    return failed;
+}
@@ -39,6 +39,7 @@
 #include "exec/cputlb.h"
 #include "translate-all.h"
 #include "qemu/timer.h"
+#include "android/utils/hot_profiler.h"
 
 //#define DEBUG_TB_INVALIDATE
 //#define DEBUG_FLUSH
@@ -139,6 +140,7 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
     TCGContext *s = &tcg_ctx;
     uint8_t *gen_code_buf;
     int gen_code_size;
+    int64_t hot_start = hotProfiler_begin();
 #ifdef CONFIG_PROFILER
     int64_t ti;
 #endif
@@ -190,6 +192,7 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
         qemu_log_flush();
     }
 #endif
+    hotProfiler_end(HOT_PROFILER_TRANSLATE, hot_start);
     return 0;
 }
 
@@ -753,6 +756,7 @@ void tb_flush(CPUArchState *env1)
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     tcg_ctx.tb_ctx.tb_flush_count++;
+    hotProfiler_count(HOT_PROFILER_TB_FLUSH);
 }
 
 #ifdef DEBUG_TB_CHECK
@@ -1630,6 +1634,18 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    cpu_fprintf(f, "TLB resize count    %d\n", tlb_resize_count);
+    cpu_fprintf(f, "TLB victim hits     %" PRIu64 "\n", tlb_victim_hit_count);
+    cpu_fprintf(f, "TB exits to loop    %" PRIu64 "\n",
+                tcg_ctx.tb_ctx.tb_exit_count);
+    cpu_fprintf(f, "TB ptr lookups      %" PRIu64 " (%" PRIu64 "%% hit)\n",
+                tcg_ctx.tb_ctx.tb_lookup_hit_count +
+                        tcg_ctx.tb_ctx.tb_lookup_miss_count,
+                (tcg_ctx.tb_ctx.tb_lookup_hit_count +
+                 tcg_ctx.tb_ctx.tb_lookup_miss_count) ?
+                        (tcg_ctx.tb_ctx.tb_lookup_hit_count * 100) /
+                        (tcg_ctx.tb_ctx.tb_lookup_hit_count +
+                         tcg_ctx.tb_ctx.tb_lookup_miss_count) : 0);
     tcg_dump_info(f, cpu_fprintf);
 }
 
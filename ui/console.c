@@ -155,6 +155,7 @@ struct QemuConsole {
     vga_hw_invalidate_ptr hw_invalidate;
     vga_hw_screen_dump_ptr hw_screen_dump;
     vga_hw_text_update_ptr hw_text_update;
+    vga_hw_is_idle_ptr hw_is_idle;
     void *hw;
 
     int g_width, g_height;
@@ -208,6 +209,13 @@ void vga_hw_update(void)
         active_console->hw_update(active_console->hw);
 }
 
+int vga_hw_is_idle(void)
+{
+    if (active_console && active_console->hw_is_idle)
+        return active_console->hw_is_idle(active_console->hw);
+    return 0;
+}
+
 void vga_hw_invalidate(void)
 {
     if (active_console && active_console->hw_invalidate)
@@ -1462,6 +1470,19 @@ DisplayState *graphic_console_init(vga_hw_update_ptr update,
     return ds;
 }
 
+void graphic_console_set_idle_check(DisplayState *ds,
+                                    vga_hw_is_idle_ptr is_idle)
+{
+    int i;
+
+    for (i = 0; i < nb_consoles; i++) {
+        if (consoles[i]->ds == ds &&
+            consoles[i]->console_type == GRAPHIC_CONSOLE) {
+            consoles[i]->hw_is_idle = is_idle;
+        }
+    }
+}
+
 int is_graphic_console(void)
 {
     return active_console && active_console->console_type == GRAPHIC_CONSOLE;
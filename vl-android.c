@@ -34,6 +34,7 @@
 #include "hw/audiodev.h"
 #include "hw/isa/isa.h"
 #include "hw/loader.h"
+#include "hw/android/goldfish/device.h"
 #include "hw/android/goldfish/nand.h"
 #include "net/net.h"
 #include "ui/console.h"
@@ -66,7 +67,10 @@
 #include "android/utils/bufprint.h"
 #include "android/utils/debug.h"
 #include "android/utils/filelock.h"
+#include "android/utils/guest_profiler.h"
+#include "android/utils/hot_profiler.h"
 #include "android/utils/path.h"
+#include "android/utils/startup_trace.h"
 #include "android/utils/stralloc.h"
 #include "android/utils/tempfile.h"
 #include "android/display-core.h"
@@ -255,6 +259,7 @@ int64_t ticks_per_sec;
 ram_addr_t ram_size;
 bool xen_allowed;
 const char *mem_path = NULL;
+const char *ram_base_path = NULL;
 #ifdef MAP_POPULATE
 int mem_prealloc = 0; /* force preallocation of physical target memory */
 #endif
@@ -284,6 +289,8 @@ int rtc_td_hack = 0;
 #endif
 int usb_enabled = 0;
 int singlestep = 0;
+int tb_superblocks = 0;
+int tb_no_goto_ptr = 0;
 int smp_cpus = 1;
 const char *vnc_display;
 int acpi_enabled = 1;
@@ -370,6 +377,15 @@ int android_op_netfast = 0;
 /* -tcpdump option value. */
 char* android_op_tcpdump = NULL;
 
+/* -guest-profile option value. */
+char* android_op_guest_profile = NULL;
+
+/* -timer-slack option value. */
+char* android_op_timer_slack = NULL;
+
+/* -ram-base option value. */
+char* android_op_ram_base = NULL;
+
 /* -lcd-density option value. */
 char* android_op_lcd_density = NULL;
 
@@ -398,6 +414,7 @@ const char* dns_log_filename = NULL;
 const char* drop_log_filename = NULL;
 
 const char* savevm_on_exit = NULL;
+int savevm_on_exit_background = 0;
 
 #define TFR(expr) do { if ((expr) != -1) break; } while (errno == EINTR)
 
@@ -1178,14 +1195,33 @@ static QEMUMachine *find_default_machine(void)
 /***********************************************************/
 /* main execution loop */
 
+/* Return 1 iff the display doesn't need to be refreshed while the guest is
+ * idle: no listener polls for user input, and the display hardware has
+ * nothing to show. */
+static int gui_is_idle(DisplayState *ds)
+{
+    DisplayChangeListener *dcl;
+
+    for (dcl = ds->listeners; dcl != NULL; dcl = dcl->next) {
+        if (dcl->dpy_refresh && !dcl->idle)
+            return 0;
+    }
+    return vga_hw_is_idle();
+}
+
 static void gui_update(void *opaque)
 {
     uint64_t interval = GUI_REFRESH_INTERVAL;
     DisplayState *ds = opaque;
     DisplayChangeListener *dcl = ds->listeners;
 
+    hotProfiler_count(HOT_PROFILER_DISPLAY_TIMER);
     dpy_refresh(ds);
 
+    /* restarted by gui_idle_handler() */
+    if (qemu_is_idle() && gui_is_idle(ds))
+        return;
+
     while (dcl != NULL) {
         if (dcl->gui_timer_interval &&
             dcl->gui_timer_interval < interval)
@@ -1195,13 +1231,32 @@ static void gui_update(void *opaque)
     timer_mod(ds->gui_timer, interval + qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
 }
 
+static void gui_idle_handler(void *opaque, int idle)
+{
+    DisplayState *ds = opaque;
+
+    if (!idle && !timer_pending(ds->gui_timer))
+        timer_mod(ds->gui_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+}
+
 static void nographic_update(void *opaque)
 {
     uint64_t interval = GUI_REFRESH_INTERVAL;
 
+    hotProfiler_count(HOT_PROFILER_DISPLAY_TIMER);
+    /* this only wakes up the main loop, which is useless while idle,
+     * restarted by nographic_idle_handler() */
+    if (qemu_is_idle())
+        return;
     timer_mod(nographic_timer, interval + qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
 }
 
+static void nographic_idle_handler(void *opaque, int idle)
+{
+    if (!idle && !timer_pending(nographic_timer))
+        timer_mod(nographic_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+}
+
 struct vm_change_state_entry {
     VMChangeStateHandler *cb;
     void *opaque;
@@ -2070,7 +2125,9 @@ void android_nand_add_image(const char* part_name,
         pstrcat(tmp, sizeof tmp,",pagesize=512,extrasize=0");
     }
 
+    startupTrace_begin("nand_add_dev");
     nand_add_dev(tmp);
+    startupTrace_end("nand_add_dev");
 }
 
 
@@ -2583,6 +2640,9 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_savevm_on_exit:
                 savevm_on_exit = optarg;
                 break;
+            case QEMU_OPTION_savevm_on_exit_background:
+                savevm_on_exit_background = 1;
+                break;
             case QEMU_OPTION_full_screen:
                 full_screen = 1;
                 break;
@@ -2823,6 +2883,12 @@ int main(int argc, char **argv, char **envp)
                 if (tb_size < 0)
                     tb_size = 0;
                 break;
+            case QEMU_OPTION_tb_superblocks:
+                tb_superblocks = 1;
+                break;
+            case QEMU_OPTION_tb_no_goto_ptr:
+                tb_no_goto_ptr = 1;
+                break;
             case QEMU_OPTION_icount:
                 icount_option = optarg;
                 break;
@@ -2847,7 +2913,9 @@ int main(int argc, char **argv, char **envp)
                 break;
 #ifdef CONFIG_NAND
             case QEMU_OPTION_nand:
+                startupTrace_begin("nand_add_dev");
                 nand_add_dev(optarg);
+                startupTrace_end("nand_add_dev");
                 break;
 
 #endif
@@ -2929,6 +2997,18 @@ int main(int argc, char **argv, char **envp)
                 android_op_tcpdump = (char*)optarg;
                 break;
 
+            case QEMU_OPTION_guest_profile:
+                android_op_guest_profile = (char*)optarg;
+                break;
+
+            case QEMU_OPTION_timer_slack:
+                android_op_timer_slack = (char*)optarg;
+                break;
+
+            case QEMU_OPTION_ram_base:
+                android_op_ram_base = (char*)optarg;
+                break;
+
             case QEMU_OPTION_boot_property:
                 boot_property_parse_option((char*)optarg);
                 break;
@@ -3311,6 +3391,27 @@ int main(int argc, char **argv, char **envp)
         qemu_cpu_delay = (int) delay;
     }
 
+    if (android_op_timer_slack) {
+        char*   end;
+        long    slack = strtol(android_op_timer_slack, &end, 0);
+        if (end == NULL || *end || slack < 0 || slack > 1000 ) {
+            PANIC("option -timer-slack must be an integer between 0 and 1000" );
+        }
+        configure_timer_slack((int) slack);
+    }
+
+    /* The RAM base file is only mapped when a snapshot is loaded over it,
+     * otherwise the guest would boot with the RAM content of another
+     * instance. If it doesn't exist yet, it is written after loading. */
+    if (android_op_ram_base) {
+        if (!loadvm || !*loadvm) {
+            dwarning("Ignoring -ram-base, no snapshot is loaded at startup.");
+            android_op_ram_base = NULL;
+        } else if (path_exists(android_op_ram_base)) {
+            ram_base_path = android_op_ram_base;
+        }
+    }
+
     if (android_op_dns_server) {
         char*  x = strchr(android_op_dns_server, ',');
         dns_count = 0;
@@ -3807,6 +3908,13 @@ int main(int argc, char **argv, char **envp)
                       initrd_filename,
                       cpu_model);
 
+        /* The guest kernel reports its processes through the trace device,
+         * which is only needed for profiling. */
+        if (android_op_guest_profile) {
+            guestProfiler_init(android_op_guest_profile);
+            trace_dev_init();
+        }
+
         /* Initialize multi-touch emulation. */
         if (androidHwConfig_isScreenMultiTouch(android_hw)) {
             mts_port_create(NULL);
@@ -3905,10 +4013,14 @@ int main(int argc, char **argv, char **envp)
         }
         dcl = dcl->next;
     }
+    if (ds->gui_timer) {
+        qemu_add_idle_handler(gui_idle_handler, ds);
+    }
 
     if (display_type == DT_NOGRAPHIC || display_type == DT_VNC) {
         nographic_timer = timer_new(QEMU_CLOCK_REALTIME, SCALE_MS, nographic_update, NULL);
         timer_mod(nographic_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+        qemu_add_idle_handler(nographic_idle_handler, NULL);
     }
 
     text_consoles_set_display(ds);
@@ -3955,8 +4067,23 @@ int main(int argc, char **argv, char **envp)
     android_emulator_set_base_port(android_base_port);
 #endif
 
-    if (loadvm)
-        do_loadvm(cur_mon, loadvm);
+    if (loadvm) {
+        int ret;
+
+        startupTrace_begin("loadvm");
+        ret = do_loadvm(cur_mon, loadvm);
+        startupTrace_end("loadvm");
+
+        if (ret < 0 && qemu_ram_base_used()) {
+            PANIC("Could not load snapshot '%s' over RAM base file %s, "
+                  "please restart without -ram-base.", loadvm, ram_base_path);
+        }
+        if (ret == 0 && android_op_ram_base && !ram_base_path &&
+            qemu_ram_save_base(android_op_ram_base) < 0) {
+            dwarning("Could not write RAM base file %s: %s",
+                     android_op_ram_base, strerror(errno));
+        }
+    }
 
     if (incoming) {
         autostart = 0; /* fixme how to deal with -daemonize */